@@ -392,7 +392,7 @@ AppInstance::load(const CLArgs& cl)
         
         std::list<AppInstance::RenderRequest> writersWork;
 
-        if (info.suffix() == NATRON_PROJECT_FILE_EXT) {
+        if (info.suffix() == NATRON_PROJECT_FILE_EXT || info.suffix() == NATRON_PROJECT_BINARY_FILE_EXT) {
             
             if ( !_imp->_currentProject->loadProject(info.path(),info.fileName()) ) {
                 throw std::invalid_argument(tr("Project file loading failed.").toStdString());
@@ -688,6 +688,11 @@ AppInstance::createNodeInternal(const QString & pluginID,
        
     }
     
+    ///Expressions which could not be compiled natively may refer to this node
+    if (addToProject) {
+        getProject()->refreshNativeExpressions( std::list<std::string>( 1, node->getFullyQualifiedName() ) );
+    }
+    
     return node;
 } // createNodeInternal
 
@@ -19,6 +19,7 @@
 #include <sys/resource.h> // for getrlimit
 #endif
 
+#include <algorithm>
 #include <clocale>
 #include <cstddef>
 #include <QDebug>
@@ -33,6 +34,10 @@
 #include <QThreadPool>
 #include <QtCore/QAtomicInt>
 
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#endif
+
 #if defined(Q_OS_MAC)
 #include "client/mac/handler/exception_handler.h"
 #elif defined(Q_OS_LINUX)
@@ -58,8 +63,14 @@
 #include "Engine/FrameEntry.h"
 #include "Engine/StandardPaths.h"
 #include "Engine/Format.h"
+#include "Engine/Profiler.h"
 #include "Engine/Log.h"
+#include "Engine/AsyncLogger.h"
 #include "Engine/Cache.h"
+#include "Engine/CacheIndex.h"
+#include "Engine/MemoryPool.h"
+#include "Engine/RenderThreadPool.h"
+#include "Engine/DedicatedThreadPool.h"
 #include "Engine/Variant.h"
 #include "Engine/Knob.h"
 #include "Engine/Rect.h"
@@ -108,6 +119,7 @@ struct AppManagerPrivate
     U64 _nodesGlobalMemoryUse; //< how much memory all the nodes are using (besides the cache)
     mutable QMutex _ofxLogMutex;
     QString _ofxLog;
+    boost::scoped_ptr<Natron::AsyncLogger> ofxLogger; //< the messages are appended to _ofxLog by its flusher thread
     size_t maxCacheFiles; //< the maximum number of files the application can open for caching. This is the hard limit * 0.9
     size_t currentCacheFilesCount; //< the number of cache files currently opened in the application
     mutable QMutex currentCacheFilesCountMutex; //< protects currentCacheFilesCount
@@ -115,7 +127,11 @@ struct AppManagerPrivate
 
     std::string currentOCIOConfigPath; //< the currentOCIO config path
     
+    QString profileFilename; //< where the trace of the profiler is written at exit, empty if profiling is disabled
+    
     int idealThreadCount; // return value of QThread::idealThreadCount() cached here
+    boost::scoped_ptr<Natron::RenderThreadPool> renderThreadPool; // threads are only started by the first parallel render
+    boost::scoped_ptr<Natron::DedicatedThreadPool> dedicatedThreadPool; // threads are only started by the first call of the multi-thread suite
     
     int nThreadsToRender; // the value held by the corresponding Knob in the Settings, stored here for faster access (3 RW lock vs 1 mutex here)
     int nThreadsPerEffect;  // the value held by the corresponding Knob in the Settings, stored here for faster access (3 RW lock vs 1 mutex here)
@@ -183,6 +199,9 @@ struct AppManagerPrivate
     
     void declareSettingsToPython();
     
+    ///The sink of ofxLogger
+    void writeOfxLogRecords(const std::vector<Natron::LogRecord> & records, int dropped);
+    
 #ifdef NATRON_USE_BREAKPAD
     void initBreakpad();
 #endif
@@ -223,10 +242,13 @@ AppManagerPrivate::AppManagerPrivate()
 ,_nodesGlobalMemoryUse(0)
 ,_ofxLogMutex()
 ,_ofxLog()
+,ofxLogger()
 ,maxCacheFiles(0)
 ,currentCacheFilesCount(0)
 ,currentCacheFilesCountMutex()
 ,idealThreadCount(0)
+,renderThreadPool( new Natron::RenderThreadPool() )
+,dedicatedThreadPool( new Natron::DedicatedThreadPool() )
 ,nThreadsToRender(0)
 ,nThreadsPerEffect(0)
 ,useThreadPool(true)
@@ -247,6 +269,8 @@ AppManagerPrivate::AppManagerPrivate()
     setMaxCacheFiles();
     
     runningThreadsCount = 0;
+    
+    ofxLogger.reset( new Natron::AsyncLogger( boost::bind(&AppManagerPrivate::writeOfxLogRecords, this, _1, _2) ) );
 }
 
 
@@ -263,6 +287,18 @@ AppManager::getHardwareIdealThreadCount()
     return _imp->idealThreadCount;
 }
 
+Natron::RenderThreadPool*
+AppManager::getRenderThreadPool() const
+{
+    return _imp->renderThreadPool.get();
+}
+
+Natron::DedicatedThreadPool*
+AppManager::getDedicatedThreadPool() const
+{
+    return _imp->dedicatedThreadPool.get();
+}
+
 
 
 static bool tryParseFrameRange(const QString& arg,std::pair<int,int>& range)
@@ -317,6 +353,8 @@ struct CLArgsPrivate
     
     QString ipcPipe;
     
+    QString profileFilename;
+    
     int error;
     
     bool isInterpreterMode;
@@ -333,6 +371,7 @@ struct CLArgsPrivate
     , writers()
     , isBackground(false)
     , ipcPipe()
+    , profileFilename()
     , error(0)
     , isInterpreterMode(false)
     , range()
@@ -417,6 +456,11 @@ CLArgs::printUsage(const std::string& programName)
               "start it."
               "NatronRenderer and " NATRON_APPLICATION_NAME "will do the same thing in this mode, only the init.py script will be loaded.");
     W_LINE("\n");
+    W_TR_LINE("[--profile] <trace file path> records the time spent by each node in each action of the render (get region of definition, "
+              "render, conversions, cache lookups, waits for images rendered by other threads...) and writes it to the given file when "
+              NATRON_APPLICATION_NAME " exits.\n"
+              "The file is in the Chrome trace event format (JSON) and can be opened in chrome://tracing or https://ui.perfetto.dev");
+    W_LINE("\n");
     
     W_TR_LINE("- Options for the execution of " NATRON_APPLICATION_NAME " projects:\n");
     W_LINE(programName + " <project file path>");
@@ -532,6 +576,12 @@ CLArgs::isPythonScript() const
     return _imp->isPythonScript;
 }
 
+const QString&
+CLArgs::getProfileFilename() const
+{
+    return _imp->profileFilename;
+}
+
 QStringList::iterator
 CLArgsPrivate::hasFileNameWithExtension(const QString& extension)
 {
@@ -644,8 +694,30 @@ CLArgsPrivate::parse()
         }
     }
     
+    {
+        QStringList::iterator it = hasToken("profile", "");
+        if (it != args.end()) {
+            QStringList::iterator next = it;
+            ++next;
+            if (next == args.end() || next->startsWith("-")) {
+                std::cout << QObject::tr("You must specify the filename of the trace when using the --profile option").toStdString() << std::endl;
+                error = 1;
+                return;
+            }
+            profileFilename = *next;
+#if defined(Q_OS_UNIX)
+            profileFilename = AppManager::qt_tildeExpansion(profileFilename);
+#endif
+            ++next;
+            args.erase(it, next);
+        }
+    }
+    
     {
         QStringList::iterator it = hasFileNameWithExtension(NATRON_PROJECT_FILE_EXT);
+        if (it == args.end()) {
+            it = hasFileNameWithExtension(NATRON_PROJECT_BINARY_FILE_EXT);
+        }
         if (it == args.end()) {
             it = hasFileNameWithExtension("py");
             if (it == args.end() && !isInterpreterMode && isBackground) {
@@ -860,6 +932,17 @@ AppManager::~AppManager()
 
     ///Caches may have launched some threads to delete images, wait for them to be done
     QThreadPool::globalInstance()->waitForDone();
+    _imp->renderThreadPool.reset();
+    _imp->dedicatedThreadPool.reset();
+    
+    ///All render threads are done, write the trace of the profiler
+    if ( !_imp->profileFilename.isEmpty() ) {
+        Natron::Profiler::setEnabled(false);
+        std::string error;
+        if ( !Natron::Profiler::writeChromeTrace(_imp->profileFilename.toStdString(), &error) ) {
+            std::cerr << error << std::endl;
+        }
+    }
     
     ///Kill caches now because decreaseNCacheFilesOpened can be called
     _imp->_nodeCache->waitForDeleterThread();
@@ -1062,6 +1145,11 @@ AppManager::loadInternal(const CLArgs& cl)
     if ( isBackground() && !cl.getIPCPipeName().isEmpty() ) {
         _imp->initProcessInputChannel(cl.getIPCPipeName());
     }
+    
+    if ( !cl.getProfileFilename().isEmpty() ) {
+        _imp->profileFilename = cl.getProfileFilename();
+        Natron::Profiler::setEnabled(true);
+    }
 
 
     if (cl.isInterpreterMode()) {
@@ -1205,6 +1293,7 @@ AppManager::clearAllCaches()
 {
     clearDiskCache();
     clearNodeCache();
+    Natron::MemoryPool::clear();
 
     ///for each app instance clear all its nodes cache
     for (std::map<int,AppInstanceRef>::iterator it = _imp->_appInstances.begin(); it != _imp->_appInstances.end(); ++it) {
@@ -1236,6 +1325,12 @@ AppManager::isLoaded() const
     return _imp->_loaded;
 }
 
+bool
+AppManager::isProfilingFromCommandLine() const
+{
+    return !_imp->profileFilename.isEmpty();
+}
+
 void
 AppManagerPrivate::initProcessInputChannel(const QString & mainProcessServerName)
 {
@@ -1908,6 +2003,15 @@ AppManager::clearExceedingEntriesFromNodeCache()
     _imp->_nodeCache->clearExceedingEntries();
 }
 
+void
+AppManager::registerPluginMemoryInNodeCache(qint64 diff)
+{
+    ///The nodes may release their memory after the caches were destroyed
+    if (_imp->_nodeCache) {
+        _imp->_nodeCache->addExternalMemorySize(diff);
+    }
+}
+
 const PluginsMap&
 AppManager::getPluginsList() const
 {
@@ -2174,6 +2278,18 @@ AppManager::getCachesTotalMemorySize() const
     return _imp->_viewerCache->getMemoryCacheSize() + _imp->_nodeCache->getMemoryCacheSize();
 }
 
+U64
+AppManager::getViewerCacheMemorySize() const
+{
+    return _imp->_viewerCache->getMemoryCacheSize();
+}
+
+U64
+AppManager::getViewerCacheMaximumMemorySize() const
+{
+    return _imp->_viewerCache->getMaximumMemorySize();
+}
+
 Natron::CacheSignalEmitter*
 AppManager::getOrActivateViewerCacheSignalEmitter() const
 {
@@ -2221,36 +2337,7 @@ AppManager::registerEngineMetaTypes() const
 template <typename T>
 void saveCache(Natron::Cache<T>* cache)
 {
-    std::ofstream ofile;
-    ofile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    std::string cacheRestoreFilePath = cache->getRestoreFilePath();
-    try {
-        ofile.open(cacheRestoreFilePath.c_str(),std::ofstream::out);
-    } catch (const std::ofstream::failure & e) {
-        qDebug() << "Exception occured when opening file " <<  cacheRestoreFilePath.c_str() << ": " << e.what();
-        
-        return;
-    }
-    
-    if ( !ofile.good() ) {
-        qDebug() << "Failed to save cache to " << cacheRestoreFilePath.c_str();
-        
-        return;
-    }
-    
-    typename Natron::Cache<T>::CacheTOC toc;
-    cache->save(&toc);
-    unsigned int version = cache->cacheVersion();
-    try {
-        boost::archive::binary_oarchive oArchive(ofile);
-        oArchive << version;
-        oArchive << toc;
-    } catch (const std::exception & e) {
-        qDebug() << "Failed to serialize the cache table of contents: " << e.what();
-    }
-    
-    ofile.close();
-
+    cache->save();
 }
 
 void
@@ -2284,52 +2371,16 @@ AppManagerPrivate::saveCaches()
 template <typename T>
 void restoreCache(AppManagerPrivate* p,Natron::Cache<T>* cache)
 {
-    if ( p->checkForCacheDiskStructure( cache->getCachePath() ) ) {
-        std::ifstream ifile;
-        std::string settingsFilePath = cache->getRestoreFilePath();
-        try {
-            ifile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-            ifile.open(settingsFilePath.c_str(),std::ifstream::in);
-        } catch (const std::ifstream::failure & e) {
-            qDebug() << "Failed to open the cache restoration file: " << e.what();
-            
-            return;
-        }
-        
-        if ( !ifile.good() ) {
-            qDebug() << "Failed to cache file for restoration: " <<  settingsFilePath.c_str();
-            ifile.close();
-            
-            return;
-        }
-        
-        typename Natron::Cache<T>::CacheTOC tableOfContents;
-        unsigned int cacheVersion = 0x1; //< default to 1 before NATRON_CACHE_VERSION was introduced
-        try {
-            boost::archive::binary_iarchive iArchive(ifile);
-            if (cache->cacheVersion() >= NATRON_CACHE_VERSION) {
-                iArchive >> cacheVersion;
-            }
-            //Only load caches with same version, otherwise wipe it!
-            if (cacheVersion == cache->cacheVersion()) {
-                iArchive >> tableOfContents;
-            } else {
-                p->cleanUpCacheDiskStructure(cache->getCachePath());
-            }
-        } catch (const std::exception & e) {
-            qDebug() << e.what();
-            ifile.close();
-            
-            return;
-        }
-        
-        ifile.close();
-        
-        QFile restoreFile( settingsFilePath.c_str() );
-        restoreFile.remove();
-        
-        cache->restore(tableOfContents);
+    ///The index is opened in constant time, entries are restored lazily when first looked-up
+    if ( p->checkForCacheDiskStructure( cache->getCachePath() ) && cache->restore() ) {
+        return;
     }
+    
+    ///The index is missing, corrupted or was written by another cache version: wipe the cache and
+    ///start journaling from an empty cache
+    cache->closeIndex();
+    p->cleanUpCacheDiskStructure( cache->getCachePath() );
+    cache->restore();
 }
 
 void
@@ -2383,9 +2434,7 @@ AppManagerPrivate::restoreCaches()
 bool
 AppManagerPrivate::checkForCacheDiskStructure(const QString & cachePath)
 {
-    QString settingsFilePath(cachePath + QDir::separator() + "restoreFile." NATRON_CACHE_FILE_EXT);
-
-    if ( !QFile::exists(settingsFilePath) ) {
+    if ( !Natron::CacheIndex::existsInDirectory( cachePath.toStdString() ) ) {
         qDebug() << "Disk cache empty.";
         cleanUpCacheDiskStructure(cachePath);
 
@@ -2395,9 +2444,8 @@ AppManagerPrivate::checkForCacheDiskStructure(const QString & cachePath)
     QStringList files = directory.entryList(QDir::AllDirs);
 
 
-    /*Now counting actual data files in the cache*/
-    /*check if there's 256 subfolders, otherwise reset cache.*/
-    int count = 0; // -1 because of the restoreFile
+    /*check if there's 256 subfolders, otherwise reset cache.
+     The data files are not listed: the index knows them.*/
     int subFolderCount = 0;
     for (int i = 0; i < files.size(); ++i) {
         QString subFolder(cachePath);
@@ -2409,12 +2457,6 @@ AppManagerPrivate::checkForCacheDiskStructure(const QString & cachePath)
         QDir d(subFolder);
         if ( d.exists() ) {
             ++subFolderCount;
-            QStringList items = d.entryList();
-            for (int j = 0; j < items.size(); ++j) {
-                if ( ( items[j] != QString(".") ) && ( items[j] != QString("..") ) ) {
-                    ++count;
-                }
-            }
         }
     }
     if (subFolderCount < 256) {
@@ -2624,9 +2666,35 @@ AppManager::getTotalNodesMemoryRegistered() const
     return _imp->_nodesGlobalMemoryUse;
 }
 
+void
+AppManagerPrivate::writeOfxLogRecords(const std::vector<Natron::LogRecord> & records,
+                                      int dropped)
+{
+    QMutexLocker l(&_ofxLogMutex);
+
+    if (dropped > 0) {
+        _ofxLog.append( QString("%1 messages were dropped because they were logged faster than they could be displayed.\n").arg(dropped) );
+    }
+    for (std::vector<Natron::LogRecord>::const_iterator it = records.begin(); it != records.end(); ++it) {
+        if (it->node[0] != '\0') {
+            _ofxLog.append( QString::fromUtf8(it->node) + ": " );
+        }
+        if (it->frame != NATRON_LOG_RECORD_NO_FRAME) {
+            _ofxLog.append( QString("frame %1: ").arg(it->frame) );
+        }
+        if (it->action[0] != '\0') {
+            _ofxLog.append( QString::fromUtf8(it->action) + ": " );
+        }
+        _ofxLog.append( QString::fromUtf8(it->message) + '\n' );
+    }
+}
+
 QString
 AppManager::getOfxLog_mt_safe() const
 {
+    ///Make sure the messages written so far are in the log
+    _imp->ofxLogger->flush();
+    
     QMutexLocker l(&_imp->_ofxLogMutex);
 
     return _imp->_ofxLog;
@@ -2635,14 +2703,23 @@ AppManager::getOfxLog_mt_safe() const
 void
 AppManager::writeToOfxLog_mt_safe(const QString & str)
 {
-    QMutexLocker l(&_imp->_ofxLogMutex);
+    _imp->ofxLogger->log( str.toUtf8().constData() );
+}
 
-    _imp->_ofxLog.append(str + '\n');
+void
+AppManager::writeToOfxLog_mt_safe(const std::string & nodeName,
+                                  int frame,
+                                  const std::string & action,
+                                  const QString & str)
+{
+    _imp->ofxLogger->log( 0, nodeName.c_str(), frame, action.c_str(), str.toUtf8().constData() );
 }
 
 void
 AppManager::clearOfxLog_mt_safe()
 {
+    _imp->ofxLogger->flush();
+    
     QMutexLocker l(&_imp->_ofxLogMutex);
     _imp->_ofxLog.clear();
 }
@@ -2734,6 +2811,11 @@ AppManager::checkCacheFreeMemoryIsGoodEnough()
     
 
     double playbackRAMPercent = appPTR->getCurrentSettings()->getRamPlaybackMaximumPercent();
+    if (totalFreeRAM <= systemRAMToKeepFree) {
+        ///Blocks waiting to be recycled in the pool are not accounted by the caches: free them before evicting anything
+        Natron::MemoryPool::clear();
+        totalFreeRAM = getAmountFreePhysicalRAM();
+    }
     while (totalFreeRAM <= systemRAMToKeepFree) {
         
         size_t nodeCacheSize =  _imp->_nodeCache->getMemoryCacheSize();
@@ -2832,6 +2914,19 @@ AppManager::getNRunningThreads() const
     return (int)_imp->runningThreadsCount;
 }
 
+int
+AppManager::getNActiveThreads() const
+{
+    // activeThreadCount may be negative (for example if releaseThread() is called)
+    int activeThreadsCount = QThreadPool::globalInstance()->activeThreadCount();
+
+    activeThreadsCount += (int)_imp->runningThreadsCount;
+    activeThreadsCount += _imp->renderThreadPool->getActiveThreadCount();
+    activeThreadsCount += _imp->dedicatedThreadPool->getActiveThreadCount();
+
+    return std::max(0, activeThreadsCount);
+}
+
 void
 AppManager::setThreadAsActionCaller(bool actionCaller)
 {
@@ -60,6 +60,8 @@ class FrameParams;
 class FrameEntry;
 class Plugin;
 class CacheSignalEmitter;
+class RenderThreadPool;
+class DedicatedThreadPool;
 
 enum AppInstanceStatusEnum
 {
@@ -123,6 +125,9 @@ public:
     
     bool isPythonScript() const;
     
+    ///The file where the trace of the profiler is written at exit, empty if the profiler is disabled
+    const QString& getProfileFilename() const;
+    
 private:
     
     boost::scoped_ptr<CLArgsPrivate> _imp;
@@ -180,6 +185,11 @@ public:
 
     bool isLoaded() const;
 
+    /**
+     * @brief Returns true if the profiler was enabled with --profile, in which case its trace is written at exit.
+     **/
+    bool isProfilingFromCommandLine() const;
+
     AppInstance* newAppInstance(const CLArgs& cl);
     virtual void hideSplashScreen()
     {
@@ -243,6 +253,11 @@ public:
 
     U64 getCachesTotalMemorySize() const;
 
+    ///The RAM used by the viewer cache and the maximum it may use, i.e: the playback cache RAM percentage of the caches RAM
+    U64 getViewerCacheMemorySize() const;
+
+    U64 getViewerCacheMaximumMemorySize() const;
+
     Natron::CacheSignalEmitter* getOrActivateViewerCacheSignalEmitter() const;
 
     void setApplicationsCachesMaximumMemoryPercent(double p);
@@ -308,8 +323,18 @@ public:
 
     QString getOfxLog_mt_safe() const;
 
+    /**
+     * @brief Appends a message to the OFX log. The message is written in a buffer of the calling thread
+     * and appended to the log by a background thread (see AsyncLogger): this never waits for other threads.
+     **/
     void writeToOfxLog_mt_safe(const QString & str);
     
+    /**
+     * @brief Same as above for a message related to an action of a node at a given frame, which may be
+     * NATRON_LOG_RECORD_NO_FRAME. The action may be empty.
+     **/
+    void writeToOfxLog_mt_safe(const std::string & nodeName, int frame, const std::string & action, const QString & str);
+    
     void clearOfxLog_mt_safe();
     
     virtual void showOfxLog() {}
@@ -351,6 +376,17 @@ public:
 
 
     int getHardwareIdealThreadCount();
+
+    /**
+     * @brief Returns the work-stealing thread pool used by the host frame threading, the multi-thread suite and the viewer.
+     * Its maximum thread count follows the Number of render threads setting.
+     **/
+    Natron::RenderThreadPool* getRenderThreadPool() const;
+
+    /**
+     * @brief Returns the pool of dedicated threads used by the multi-thread suite when the effects do not use the render thread pool.
+     **/
+    Natron::DedicatedThreadPool* getDedicatedThreadPool() const;
     
     
     /**
@@ -385,6 +421,12 @@ public:
      * parallel rendering.
      **/
     int getNRunningThreads() const;
+
+    /**
+     * @brief Returns an estimation of the number of threads which are currently busy: the threads counted by
+     * getNRunningThreads() and the active threads of the global thread pool and of the render and dedicated thread pools.
+     **/
+    int getNActiveThreads() const;
     
     void setThreadAsActionCaller(bool actionCaller);
 
@@ -450,6 +492,13 @@ public Q_SLOTS:
 
     void clearExceedingEntriesFromNodeCache();
 
+    /**
+     * @brief Adds diff bytes to the memory allocated by the plug-ins. It counts against the budget of the in-memory portion
+     * of the node cache, so that images get evicted when the plug-ins allocate more memory.
+     * MT-safe
+     **/
+    void registerPluginMemoryInNodeCache(qint64 diff);
+
     void clearPluginsLoadedCache();
 
     void clearAllCaches();
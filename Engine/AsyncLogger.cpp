@@ -0,0 +1,373 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "AsyncLogger.h"
+
+#include <list>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThreadStorage>
+
+#ifndef Q_MOC_RUN
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "Global/Macros.h"
+
+using namespace Natron;
+
+namespace {
+
+///Qt 4 has no load with acquire semantics
+int
+loadAcquire(QAtomicInt & i)
+{
+    return i.fetchAndAddAcquire(0);
+}
+
+/**
+ * @brief The ring buffer of a thread. The thread is the only one to write records and to move the tail, the flusher thread
+ * is the only one to read records and to move the head, so that neither of them takes a lock.
+ * The counters are free running: they are only compared through their difference.
+ * The buffer outlives its thread, so that the records it wrote before exiting still get flushed.
+ **/
+struct ThreadLogBuffer
+{
+    int threadIndex;
+    std::vector<LogRecord> records; //< the size is a power of 2
+    QAtomicInt head; //< the next record to be flushed
+    QAtomicInt tail; //< the next record to be written
+
+    ThreadLogBuffer(int threadIndex,
+                    int capacity)
+    : threadIndex(threadIndex)
+    , records(capacity)
+    , head(0)
+    , tail(0)
+    {
+    }
+};
+
+typedef boost::shared_ptr<ThreadLogBuffer> ThreadLogBufferPtr;
+
+///Copies src into the fixed-size field dst, truncating it if needed
+template<std::size_t N>
+void
+copyField(char (&dst)[N],
+          const char* src)
+{
+    std::size_t i = 0;
+
+    if (src) {
+        for (; i < N - 1 && src[i] != '\0'; ++i) {
+            dst[i] = src[i];
+        }
+    }
+    dst[i] = '\0';
+}
+
+bool
+recordIsOlder(const LogRecord & a,
+              const LogRecord & b)
+{
+    return a.timestamp < b.timestamp;
+}
+
+} // anon namespace
+
+struct Natron::AsyncLoggerPrivate
+{
+    AsyncLogger::SinkFunction sink;
+    int capacity;
+    int flushIntervalMs;
+    QElapsedTimer clock;
+    QThreadStorage<ThreadLogBufferPtr> localBuffer;
+    QMutex buffersMutex; //< protects buffers and nThreads
+    std::list<ThreadLogBufferPtr> buffers;
+    int nThreads;
+    QAtomicInt dropped;
+    int droppedFlushed; //< only accessed by the flusher thread
+    std::vector<LogRecord> pending; //< only accessed by the flusher thread
+    QMutex flushMutex; //< protects flushRequests, flushedRequests and quit
+    QWaitCondition wakeUpCond;
+    QWaitCondition flushedCond;
+    U64 flushRequests;
+    U64 flushedRequests;
+    bool quit;
+    QThread* flusher;
+
+    AsyncLoggerPrivate(const AsyncLogger::SinkFunction & sink,
+                       int recordsPerThread,
+                       int flushIntervalMs)
+    : sink(sink)
+    , capacity(1)
+    , flushIntervalMs(flushIntervalMs)
+    , clock()
+    , localBuffer()
+    , buffersMutex()
+    , buffers()
+    , nThreads(0)
+    , dropped()
+    , droppedFlushed(0)
+    , pending()
+    , flushMutex()
+    , wakeUpCond()
+    , flushedCond()
+    , flushRequests(0)
+    , flushedRequests(0)
+    , quit(false)
+    , flusher(0)
+    {
+        while (capacity < recordsPerThread) {
+            capacity <<= 1;
+        }
+        clock.start();
+    }
+
+    ThreadLogBuffer* getLocalBuffer()
+    {
+        if ( !localBuffer.hasLocalData() ) {
+            QMutexLocker l(&buffersMutex);
+            ThreadLogBufferPtr buffer( new ThreadLogBuffer(nThreads, capacity) );
+            ++nThreads;
+            buffers.push_back(buffer);
+            localBuffer.setLocalData(buffer);
+        }
+
+        return localBuffer.localData().get();
+    }
+
+    /**
+     * @brief Returns the slot of the next record of the calling thread with all the fields but the message filled,
+     * or NULL if the record must be dropped because the ring buffer is full. The record is only visible to the flusher
+     * thread once endRecord() is called.
+     **/
+    LogRecord* beginRecord(ThreadLogBuffer* buffer,
+                           int kind,
+                           const char* node,
+                           int frame,
+                           const char* action)
+    {
+        ///Only this thread moves the tail
+        unsigned int tail = (unsigned int)(int)buffer->tail;
+        unsigned int head = (unsigned int)loadAcquire(buffer->head);
+
+        if (tail - head >= (unsigned int)capacity) {
+            dropped.fetchAndAddRelaxed(1);
+
+            return NULL;
+        }
+
+        LogRecord & r = buffer->records[tail & ( (unsigned int)capacity - 1 )];
+        r.timestamp = (U64)clock.nsecsElapsed() / 1000;
+        r.threadIndex = buffer->threadIndex;
+        r.kind = kind;
+        copyField(r.node, node);
+        r.frame = frame;
+        copyField(r.action, action);
+
+        return &r;
+    }
+
+    void endRecord(ThreadLogBuffer* buffer)
+    {
+        buffer->tail.fetchAndStoreRelease( (int)buffer->tail + 1 );
+    }
+
+    ///Moves the records of all the threads to pending and hands them to the sink
+    void drain()
+    {
+        std::vector<ThreadLogBufferPtr> toDrain;
+        {
+            QMutexLocker l(&buffersMutex);
+            for (std::list<ThreadLogBufferPtr>::iterator it = buffers.begin(); it != buffers.end();) {
+                toDrain.push_back(*it);
+                if ( it->use_count() == 2 ) {
+                    ///The thread exited: once drained, nothing can be written in its buffer anymore
+                    it = buffers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        const unsigned int mask = (unsigned int)capacity - 1;
+        for (std::vector<ThreadLogBufferPtr>::iterator it = toDrain.begin(); it != toDrain.end(); ++it) {
+            ThreadLogBuffer* buffer = it->get();
+            unsigned int head = (unsigned int)(int)buffer->head;
+            unsigned int tail = (unsigned int)loadAcquire(buffer->tail);
+            for (; head != tail; ++head) {
+                pending.push_back(buffer->records[head & mask]);
+            }
+            buffer->head.fetchAndStoreRelease( (int)head );
+        }
+
+        int droppedCount = (int)dropped;
+        int newlyDropped = droppedCount - droppedFlushed;
+        droppedFlushed = droppedCount;
+        if ( pending.empty() && (newlyDropped == 0) ) {
+            return;
+        }
+        ///The records of each thread are already sorted
+        std::stable_sort(pending.begin(), pending.end(), recordIsOlder);
+        try {
+            sink(pending, newlyDropped);
+        } catch (...) {
+            ///The log must not take the application down
+        }
+        pending.clear();
+    }
+
+    void runFlusher()
+    {
+        for (;;) {
+            U64 requests;
+            bool mustQuit;
+            {
+                QMutexLocker l(&flushMutex);
+                if ( !quit && (flushedRequests == flushRequests) ) {
+                    wakeUpCond.wait(&flushMutex, flushIntervalMs);
+                }
+                requests = flushRequests;
+                mustQuit = quit;
+            }
+
+            drain();
+
+            {
+                QMutexLocker l(&flushMutex);
+                flushedRequests = requests;
+                flushedCond.wakeAll();
+            }
+            if (mustQuit) {
+                return;
+            }
+        }
+    }
+};
+
+namespace {
+
+class FlusherThread
+    : public QThread
+{
+    AsyncLoggerPrivate* _imp;
+
+public:
+
+    FlusherThread(AsyncLoggerPrivate* imp)
+    : QThread()
+    , _imp(imp)
+    {
+        setObjectName( QString::fromUtf8("LogFlusher") );
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        _imp->runFlusher();
+    }
+};
+
+} // anon namespace
+
+AsyncLogger::AsyncLogger(const SinkFunction & sink,
+                         int recordsPerThread,
+                         int flushIntervalMs)
+: _imp( new AsyncLoggerPrivate(sink, recordsPerThread, flushIntervalMs) )
+{
+    _imp->flusher = new FlusherThread(_imp);
+    _imp->flusher->start(QThread::LowPriority);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    {
+        QMutexLocker l(&_imp->flushMutex);
+        _imp->quit = true;
+        _imp->wakeUpCond.wakeOne();
+    }
+    _imp->flusher->wait();
+    delete _imp->flusher;
+    delete _imp;
+}
+
+bool
+AsyncLogger::log(int kind,
+                 const char* node,
+                 int frame,
+                 const char* action,
+                 const char* message)
+{
+    ThreadLogBuffer* buffer = _imp->getLocalBuffer();
+    LogRecord* r = _imp->beginRecord(buffer, kind, node, frame, action);
+
+    if (!r) {
+        return false;
+    }
+    copyField(r->message, message);
+    _imp->endRecord(buffer);
+
+    return true;
+}
+
+bool
+AsyncLogger::vlog(int kind,
+                  const char* node,
+                  int frame,
+                  const char* action,
+                  const char* format,
+                  va_list args)
+{
+    ThreadLogBuffer* buffer = _imp->getLocalBuffer();
+    LogRecord* r = _imp->beginRecord(buffer, kind, node, frame, action);
+
+    if (!r) {
+        return false;
+    }
+    if (vsnprintf(r->message, sizeof(r->message), format, args) < 0) {
+        r->message[0] = '\0';
+    }
+    _imp->endRecord(buffer);
+
+    return true;
+}
+
+void
+AsyncLogger::flush()
+{
+    assert(QThread::currentThread() != _imp->flusher);
+    QMutexLocker l(&_imp->flushMutex);
+    U64 request = ++_imp->flushRequests;
+    _imp->wakeUpCond.wakeOne();
+    while (_imp->flushedRequests < request) {
+        _imp->flushedCond.wait(&_imp->flushMutex);
+    }
+}
+
+int
+AsyncLogger::getDroppedCount() const
+{
+    return (int)_imp->dropped;
+}
+
+U64
+AsyncLogger::getTimestamp() const
+{
+    return (U64)_imp->clock.nsecsElapsed() / 1000;
+}
@@ -0,0 +1,151 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_ASYNCLOGGER_H_
+#define NATRON_ENGINE_ASYNCLOGGER_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <climits>
+#include <cstdarg>
+#include <vector>
+
+#ifndef Q_MOC_RUN
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+
+///Default number of records that each thread can have waiting to be flushed before its records get dropped
+#define NATRON_LOG_DEFAULT_RECORDS_PER_THREAD 1024
+
+///Default period at which the records are flushed, in milliseconds
+#define NATRON_LOG_DEFAULT_FLUSH_INTERVAL_MS 100
+
+///Frame of the records which are not related to a frame
+#define NATRON_LOG_RECORD_NO_FRAME INT_MIN
+
+///Size of the node and action fields of a record, including the terminating null character. Longer ones are truncated.
+#define NATRON_LOG_RECORD_NAME_SIZE 64
+
+///Size of the message field of a record, including the terminating null character. Longer ones are truncated.
+#define NATRON_LOG_RECORD_MESSAGE_SIZE 1024
+
+namespace Natron {
+
+/**
+ * @brief A record of the log. Apart from the timestamp and the thread, all the fields are filled by the caller.
+ * The strings are stored in place so that writing a record into a ring buffer slot never allocates.
+ **/
+struct LogRecord
+{
+    U64 timestamp; //< in microseconds, see AsyncLogger::getTimestamp()
+    int threadIndex; //< index of the thread which wrote the record, in the order of their first record
+    int kind; //< meaning defined by the owner of the logger
+    char node[NATRON_LOG_RECORD_NAME_SIZE]; //< may be empty
+    int frame; //< NATRON_LOG_RECORD_NO_FRAME if none
+    char action[NATRON_LOG_RECORD_NAME_SIZE]; //< may be empty
+    char message[NATRON_LOG_RECORD_MESSAGE_SIZE];
+
+    LogRecord()
+    : timestamp(0)
+    , threadIndex(0)
+    , kind(0)
+    , frame(NATRON_LOG_RECORD_NO_FRAME)
+    {
+        node[0] = '\0';
+        action[0] = '\0';
+        message[0] = '\0';
+    }
+};
+
+struct AsyncLoggerPrivate;
+
+/**
+ * @brief A log whose records are written by the calling thread into a ring buffer of its own, without taking any lock,
+ * and handed to a sink by a background thread. The threads writing records therefore never wait for the I/O of the sink,
+ * nor for each other.
+ *
+ * The ring buffer of each thread has a fixed size: when the flusher thread lags behind, the records which do not fit are
+ * dropped and counted, so that the memory used by the log stays bounded.
+ *
+ * Thread-safety: all functions are MT-safe.
+ **/
+class AsyncLogger
+    : boost::noncopyable
+{
+public:
+
+    /**
+     * @brief Called by the flusher thread with the records written since the previous call, sorted by timestamp,
+     * and the number of records dropped since the previous call.
+     **/
+    typedef boost::function<void (const std::vector<LogRecord> &, int)> SinkFunction;
+
+    /**
+     * @brief Starts the flusher thread. recordsPerThread is rounded up to a power of 2.
+     **/
+    AsyncLogger(const SinkFunction & sink,
+                int recordsPerThread = NATRON_LOG_DEFAULT_RECORDS_PER_THREAD,
+                int flushIntervalMs = NATRON_LOG_DEFAULT_FLUSH_INTERVAL_MS);
+
+    /**
+     * @brief Flushes the records left and stops the flusher thread.
+     **/
+    ~AsyncLogger();
+
+    /**
+     * @brief Writes a record. The strings are copied into the slot of the record, truncated to its size, so this never
+     * allocates. Returns false if it was dropped because the ring buffer of the calling thread is full.
+     **/
+    bool log(int kind,
+             const char* node,
+             int frame,
+             const char* action,
+             const char* message);
+
+    bool log(const char* message)
+    {
+        return log(0, "", NATRON_LOG_RECORD_NO_FRAME, "", message);
+    }
+
+    /**
+     * @brief Same as log() but the message is formatted with vsnprintf directly into the slot of the record.
+     **/
+    bool vlog(int kind,
+              const char* node,
+              int frame,
+              const char* action,
+              const char* format,
+              va_list args);
+
+    /**
+     * @brief Blocks until all the records written before the call have been handed to the sink.
+     * Must not be called from the sink.
+     **/
+    void flush();
+
+    /**
+     * @brief Returns the number of records dropped since the logger was created.
+     **/
+    int getDroppedCount() const;
+
+    /**
+     * @brief Returns the time in microseconds elapsed since the logger was created. This is a monotonic clock.
+     **/
+    U64 getTimestamp() const;
+
+private:
+
+    AsyncLoggerPrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_ASYNCLOGGER_H_
@@ -30,6 +30,7 @@ CLANG_DIAG_OFF(deprecated)
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QMutexLocker>
+#include <QtCore/QAtomicInt>
 #include <QtCore/QObject>
 #include <QtCore/QTextStream>
 #include <QtCore/QBuffer>
@@ -57,6 +58,7 @@ CLANG_DIAG_ON(unused-parameter)
 #include "Engine/FrameEntrySerialization.h"
 #include "Engine/FrameParamsSerialization.h"
 #include "Engine/CacheEntry.h"
+#include "Engine/CacheIndex.h"
 #include "Engine/LRUHashTable.h"
 #include "Engine/StandardPaths.h"
 #include "Engine/ImageLocker.h"
@@ -68,6 +70,9 @@ CLANG_DIAG_ON(unused-parameter)
 //Beyond that percentage of occupation, the cache will start evicting LRU entries
 #define NATRON_CACHE_LIMIT_PERCENT 0.9
 
+///Number of partitions of the cache, each with its own locks and LRU containers. Must be a power of 2.
+#define NATRON_CACHE_SHARDS_COUNT 16
+
 ///When defined, number of opened files, memory size and disk size of the cache are printed whenever there's activity.
 //#define NATRON_DEBUG_CACHE
 
@@ -304,8 +309,6 @@ public:
 
     };
 
-    typedef std::list< SerializedEntry > CacheTOC;
-
 public:
 
 
@@ -371,6 +374,29 @@ public:
 
 private:
 
+    /**
+     * @brief A partition of the cache. Each entry lives in exactly one shard, selected from its hash key
+     * (see getShardIndex()), so that threads looking-up different entries do not serialize on a single mutex.
+     * An entry always stays in the same shard when it is moved between the memory and disk portions.
+     **/
+    struct CacheShard
+    {
+        mutable QMutex lock; //protects memoryCache & diskCache
+        mutable QMutex getLock;  //prevents get() and getOrCreate() to be called simultaneously for entries of this shard
+
+        /*These 2 are mutable because we need to modify the LRU list even
+             when we call get() and we want this function to be const.*/
+        mutable CacheContainer memoryCache;
+        mutable CacheContainer diskCache;
+
+        CacheShard()
+        : lock()
+        , getLock()
+        , memoryCache()
+        , diskCache()
+        {
+        }
+    };
 
     std::size_t _maximumInMemorySize;     // the maximum size of the in-memory portion of the cache.(in % of the maximum cache size)
     std::size_t _maximumCacheSize;     // maximum size allowed for the cache
@@ -380,16 +406,22 @@ private:
      */
     mutable std::size_t _memoryCacheSize;     // current size of the cache in bytes
     mutable std::size_t _diskCacheSize;
-    mutable QMutex _sizeLock; // protects _memoryCacheSize & _diskCacheSize & _maximumInMemorySize & _maximumCacheSize
-    
-    mutable QMutex _lock; //protects _memoryCache & _diskCache
 
-    mutable QMutex _getLock;  //prevents get() and getOrCreate() to be called simultaneously
+    ///Memory allocated outside of the cache (e.g: by the plug-ins) which counts against the budget of the in-memory portion,
+    ///so that the entries get evicted when it grows
+    std::size_t _externalMemorySize;
+    mutable QMutex _sizeLock; // protects _memoryCacheSize & _diskCacheSize & _externalMemorySize & _maximumInMemorySize & _maximumCacheSize
 
-    /*These 2 are mutable because we need to modify the LRU list even
-         when we call get() and we want this function to be const.*/
-    mutable CacheContainer _memoryCache;
-    mutable CacheContainer _diskCache;
+    mutable CacheShard _shards[NATRON_CACHE_SHARDS_COUNT];
+
+    ///Index of the next shard to evict from. Evictions are spread in a round-robin fashion across shards:
+    ///since entries are uniformly distributed by their hash, the LRU entries of all shards have roughly the same age
+    ///and the eviction order stays close to a global LRU.
+    mutable QAtomicInt _nextEvictedShard;
+
+    ///The persistent table of contents of the disk portion. Entries it holds are restored lazily, the first time
+    ///their hash key is looked-up.
+    mutable CacheIndex _index;
     const std::string _cacheName;
     const unsigned int _version;
 
@@ -420,11 +452,10 @@ public:
           ,_maximumCacheSize(maximumCacheSize)
           ,_memoryCacheSize(0)
           ,_diskCacheSize(0)
+          ,_externalMemorySize(0)
           ,_sizeLock()
-          ,_lock()
-          , _getLock()
-          ,_memoryCache()
-          ,_diskCache()
+          ,_nextEvictedShard(0)
+          ,_index()
           ,_cacheName(cacheName)
           ,_version(version)
           ,_signalEmitter(new CacheSignalEmitter)
@@ -437,10 +468,12 @@ public:
 
     virtual ~Cache()
     {
-        QMutexLocker locker(&_lock);
         _tearingDown = true;
-        _memoryCache.clear();
-        _diskCache.clear();
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            QMutexLocker locker(&_shards[i].lock);
+            _shards[i].memoryCache.clear();
+            _shards[i].diskCache.clear();
+        }
         delete _signalEmitter;
         
     }
@@ -464,13 +497,15 @@ public:
     bool get(const typename EntryType::key_type & key,
              std::list<EntryTypePtr>* returnValue) const
     {
+        CacheShard& shard = getShard( key.getHash() );
+        IndexJournalFlusher flusher(this);
 
         ///Be atomic, so it cannot be created by another thread in the meantime
-        QMutexLocker getlocker(&_getLock);
+        QMutexLocker getlocker(&shard.getLock);
 
         ///lock the cache before reading it.
-        QMutexLocker locker(&_lock);
-        return getInternal(key,returnValue);
+        QMutexLocker locker(&shard.lock);
+        return getInternal(shard,key,returnValue);
         
     } // get
     
@@ -482,15 +517,19 @@ public:
                     const ParamsTypePtr& params,
                     EntryTypePtr* returnValue) const
     {
-        
+        CacheShard& shard = getShard( key.getHash() );
+        IndexJournalFlusher flusher(this);
+
         ///Be atomic, so it cannot be created by another thread in the meantime
-        QMutexLocker getlocker(&_getLock);
+        QMutexLocker getlocker(&shard.getLock);
         
         ///lock the cache before reading it.
         std::list<EntryTypePtr> entries;
         {
-            QMutexLocker locker(&_lock);
-            return getInternal(key,entries);
+            QMutexLocker locker(&shard.lock);
+            if ( !getInternal(shard,key,&entries) ) {
+                return false;
+            }
         }
         
         
@@ -506,12 +545,13 @@ public:
 
 private:
     
-    void createInternal(const typename EntryType::key_type & key,
-                const ParamsTypePtr& params,
-                ImageLockerHelper<EntryType>* imageLocker,
-                EntryTypePtr* returnValue) const
+    void createInternal(CacheShard& shard,
+                        const typename EntryType::key_type & key,
+                        const ParamsTypePtr& params,
+                        ImageLockerHelper<EntryType>* imageLocker,
+                        EntryTypePtr* returnValue) const
     {
-        //_lock must not be taken here
+        //shard.lock must not be taken here
         
         ///Before allocating the memory check that there's enough space to fit in memory
         appPTR->checkCacheFreeMemoryIsGoodEnough();
@@ -533,12 +573,11 @@ private:
         U64 memoryCacheSize,maximumInMemorySize;
         {
             QMutexLocker k(&_sizeLock);
-            memoryCacheSize = _memoryCacheSize;
+            memoryCacheSize = _memoryCacheSize + _externalMemorySize;
             maximumInMemorySize = std::max((std::size_t)1,_maximumInMemorySize);
             
         }
         {
-            QMutexLocker locker(&_lock);
             std::list<EntryTypePtr> entriesToBeDeleted;
             double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
             ///While the current cache size can't fit the new entry, erase the last recently used entries.
@@ -546,7 +585,7 @@ private:
             while (occupationPercentage > NATRON_CACHE_LIMIT_PERCENT) {
                 
                 std::list<EntryTypePtr> deleted;
-                if ( !tryEvictEntry(deleted) ) {
+                if ( !tryEvictEntryFromAnyShard(deleted) ) {
                     break;
                 }
                 
@@ -573,18 +612,18 @@ private:
         {
             //If _maximumcacheSize == 0 we don't return 1 otherwise we would cause a deadlock
             QMutexLocker k(&_sizeLock);
-            double occupationPercentage =  _maximumCacheSize == 0 ? 0.99 : (double)_memoryCacheSize / _maximumCacheSize;
+            double occupationPercentage =  _maximumCacheSize == 0 ? 0.99 : (double)(_memoryCacheSize + _externalMemorySize) / _maximumCacheSize;
             
             //_memoryCacheSize member will get updated while images are being destroyed by the parallel thread.
             //we wait for cache memory occupation to be < 100% to be sure we don't hit swap here
             while (occupationPercentage >= 1. && _deleterThread.isWorking()) {
                 _memoryFullCondition.wait(&_sizeLock);
-                occupationPercentage =  _maximumCacheSize == 0 ? 0.99 : (double)_memoryCacheSize / _maximumCacheSize;
+                occupationPercentage =  _maximumCacheSize == 0 ? 0.99 : (double)(_memoryCacheSize + _externalMemorySize) / _maximumCacheSize;
             }
             
         }
         {
-            QMutexLocker locker(&_lock);
+            QMutexLocker locker(&shard.lock);
             
             Natron::StorageModeEnum storage;
             if (params->getCost() == 0) {
@@ -615,7 +654,7 @@ private:
                 assert(imageLocker);
                 imageLocker->lock(*returnValue);
                 
-                sealEntry(*returnValue, true);
+                sealEntry(shard, *returnValue, true);
             }
             
         }
@@ -661,14 +700,17 @@ public:
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
         
         {
+            CacheShard& shard = getShard( key.getHash() );
+            IndexJournalFlusher flusher(this);
+
             ///Be atomic, so it cannot be created by another thread in the meantime
-            QMutexLocker getlocker(&_getLock);
+            QMutexLocker getlocker(&shard.getLock);
             
             std::list<EntryTypePtr> entries;
             bool didGetSucceed;
             {
-                QMutexLocker locker(&_lock);
-                didGetSucceed = getInternal(key,&entries);
+                QMutexLocker locker(&shard.lock);
+                didGetSucceed = getInternal(shard,key,&entries);
             }
             if (didGetSucceed) {
                 for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
@@ -679,7 +721,7 @@ public:
                 }
             }
             
-            createInternal(key,params,imageLocker,returnValue);
+            createInternal(shard,key,params,imageLocker,returnValue);
             return false;
             
         } // getlocker
@@ -690,6 +732,8 @@ public:
      **/
     void clear()
     {
+        IndexJournalFlusher flusher(this);
+
         clearDiskPortion();
         
         
@@ -697,13 +741,17 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type,EntryTypePtr> evictedFromMemory = _memoryCache.evict();
-        while (evictedFromMemory.second) {
-            if ( evictedFromMemory.second->isStoredOnDisk() ) {
-                evictedFromMemory.second->removeAnyBackingFile();
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type,EntryTypePtr> evictedFromMemory = shard.memoryCache.evict();
+            while (evictedFromMemory.second) {
+                if ( evictedFromMemory.second->isStoredOnDisk() ) {
+                    evictedFromMemory.second->removeAnyBackingFile();
+                    appendRemoveToIndex(evictedFromMemory.second);
+                }
+                evictedFromMemory = shard.memoryCache.evict();
             }
-            evictedFromMemory = _memoryCache.evict();
         }
 
         if (_signalEmitter) {
@@ -718,21 +766,29 @@ public:
      **/
     void clearDiskPortion()
     {
+        IndexJournalFlusher flusher(this);
+
         if (_signalEmitter) {
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-
-        /// An entry which has a use_count greater than 1 is not removable:
-        /// The backing file must not be removed because it might be read/written to
-        /// at the same time. The best we can do is just let it here in the cache.
-        std::pair<hash_type,EntryTypePtr> evictedFromDisk = _diskCache.evict();
-        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-        //we'll let the user of these entries purge the extra entries left in the cache later on
-        while (evictedFromDisk.second) {
-            evictedFromDisk.second->removeAnyBackingFile();
-            evictedFromDisk = _diskCache.evict();
+        while ( evictNotAdoptedIndexedEntry() ) {
+        }
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+
+            /// An entry which has a use_count greater than 1 is not removable:
+            /// The backing file must not be removed because it might be read/written to
+            /// at the same time. The best we can do is just let it here in the cache.
+            std::pair<hash_type,EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
+            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+            //we'll let the user of these entries purge the extra entries left in the cache later on
+            while (evictedFromDisk.second) {
+                evictedFromDisk.second->removeAnyBackingFile();
+                appendRemoveToIndex(evictedFromDisk.second);
+                evictedFromDisk = shard.diskCache.evict();
+            }
         }
 
         
@@ -745,54 +801,62 @@ public:
      **/
     void clearInMemoryPortion(bool emitSignals = true)
     {
+        IndexJournalFlusher flusher(this);
+
         if (_signalEmitter) {
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type,EntryTypePtr> evictedFromMemory = _memoryCache.evict();
-        while (evictedFromMemory.second) {
-            ///move back the entry on disk if it can be store on disk
-            if ( evictedFromMemory.second->isStoredOnDisk() ) {
-                evictedFromMemory.second->deallocate();
-                /*insert it back into the disk portion */
-
-                U64 diskCacheSize,maximumCacheSize;
-                {
-                    QMutexLocker k(&_sizeLock);
-                    diskCacheSize = _diskCacheSize;
-                    maximumCacheSize = _maximumCacheSize;
-                }
-                
-                /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
-                while (diskCacheSize + evictedFromMemory.second->size() >= maximumCacheSize) {
-                    
-                    {
-                        std::pair<hash_type,EntryTypePtr> evictedFromDisk = _diskCache.evict();
-                        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-                        //we'll let the user of these entries purge the extra entries left in the cache later on
-                        if (!evictedFromDisk.second) {
-                            break;
-                        }
-                        ///Erase the file from the disk if we reach the limit.
-                        evictedFromDisk.second->removeAnyBackingFile();
-                    }
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type,EntryTypePtr> evictedFromMemory = shard.memoryCache.evict();
+            while (evictedFromMemory.second) {
+                ///move back the entry on disk if it can be store on disk
+                if ( evictedFromMemory.second->isStoredOnDisk() ) {
+                    evictedFromMemory.second->deallocate();
+                    appendInsertToIndex(evictedFromMemory.second);
+                    /*insert it back into the disk portion */
+
+                    U64 diskCacheSize,maximumCacheSize;
                     {
                         QMutexLocker k(&_sizeLock);
                         diskCacheSize = _diskCacheSize;
                         maximumCacheSize = _maximumCacheSize;
                     }
-                }
+                    
+                    /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
+                    while (diskCacheSize + evictedFromMemory.second->size() >= maximumCacheSize) {
+                        
+                        ///Entries not used since the index was opened are the least recently used
+                        if ( !evictNotAdoptedIndexedEntry() ) {
+                            std::pair<hash_type,EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
+                            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+                            //we'll let the user of these entries purge the extra entries left in the cache later on
+                            if (!evictedFromDisk.second) {
+                                break;
+                            }
+                            ///Erase the file from the disk if we reach the limit.
+                            evictedFromDisk.second->removeAnyBackingFile();
+                            appendRemoveToIndex(evictedFromDisk.second);
+                        }
+                        {
+                            QMutexLocker k(&_sizeLock);
+                            diskCacheSize = _diskCacheSize;
+                            maximumCacheSize = _maximumCacheSize;
+                        }
+                    }
 
-                /*update the disk cache size*/
-                CacheIterator existingDiskCacheEntry = _diskCache( evictedFromMemory.second->getHashKey() );
-                /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
-                if ( existingDiskCacheEntry == _diskCache.end() ) {
-                    _diskCache.insert(evictedFromMemory.second->getHashKey(),evictedFromMemory.second);
+                    /*update the disk cache size*/
+                    CacheIterator existingDiskCacheEntry = shard.diskCache( evictedFromMemory.second->getHashKey() );
+                    /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
+                    if ( existingDiskCacheEntry == shard.diskCache.end() ) {
+                        shard.diskCache.insert(evictedFromMemory.second->getHashKey(),evictedFromMemory.second);
+                    }
                 }
-            }
 
-            evictedFromMemory = _memoryCache.evict();
+                evictedFromMemory = shard.memoryCache.evict();
+            }
         }
 
         _signalEmitter->blockSignals(false);
@@ -808,32 +872,29 @@ public:
         ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
         std::list<EntryTypePtr> entriesToBeDeleted;
+        IndexJournalFlusher flusher(this);
         
+        U64 memoryCacheSize,maximumInMemorySize;
         {
-            QMutexLocker locker(&_lock);
+            QMutexLocker k(&_sizeLock);
+            memoryCacheSize = _memoryCacheSize + _externalMemorySize;
+            maximumInMemorySize = std::max((std::size_t)1,_maximumInMemorySize);
+        }
+        double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
+        while (occupationPercentage >= NATRON_CACHE_LIMIT_PERCENT) {
             
-            U64 memoryCacheSize,maximumInMemorySize;
-            {
-                QMutexLocker k(&_sizeLock);
-                memoryCacheSize = _memoryCacheSize;
-                maximumInMemorySize = std::max((std::size_t)1,_maximumInMemorySize);
+            std::list<EntryTypePtr> deleted;
+            if ( !tryEvictEntryFromAnyShard(deleted) ) {
+                break;
             }
-            double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
-            while (occupationPercentage >= NATRON_CACHE_LIMIT_PERCENT) {
-       
-                std::list<EntryTypePtr> deleted;
-                if ( !tryEvictEntry(deleted) ) {
-                    break;
-                }
-                
-                for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
-                    if (!(*it)->isStoredOnDisk()) {
-                        memoryCacheSize -= (*it)->size();
-                    }
-                    entriesToBeDeleted.push_back(*it);
+            
+            for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
+                if (!(*it)->isStoredOnDisk()) {
+                    memoryCacheSize -= (*it)->size();
                 }
-                occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
+                entriesToBeDeleted.push_back(*it);
             }
+            occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
         }
     }
     
@@ -844,15 +905,18 @@ public:
      **/
     void getCopy(std::list<EntryTypePtr>* copy) const
     {
-        QMutexLocker locker(&_lock);
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
 
-        for (CacheIterator it = _memoryCache.begin(); it != _memoryCache.end(); ++it) {
-            const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
-            copy->insert(copy->end(),entries.begin(),entries.end());
-        }
-        for (CacheIterator it = _diskCache.begin(); it != _diskCache.end(); ++it) {
-            const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
-            copy->insert(copy->end(),entries.begin(),entries.end());
+            for (CacheIterator it = shard.memoryCache.begin(); it != shard.memoryCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert(copy->end(),entries.begin(),entries.end());
+            }
+            for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert(copy->end(),entries.begin(),entries.end());
+            }
         }
     }
     
@@ -866,13 +930,9 @@ public:
         ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
         std::list<EntryTypePtr> entriesToBeDeleted;
+        IndexJournalFlusher flusher(this);
         
-        bool ret ;
-        {
-            QMutexLocker locker(&_lock);
-            ret = tryEvictEntry(entriesToBeDeleted);
-        }
-        return ret;
+        return tryEvictEntryFromAnyShard(entriesToBeDeleted);
     }
 
     /**
@@ -881,20 +941,33 @@ public:
      * if there's nothing left to evict.
      **/
     bool evictLRUDiskEntry() const {
-        QMutexLocker locker(&_lock);
         
-        std::pair<hash_type,EntryTypePtr> evicted = _diskCache.evict();
-        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-        //we'll let the user of these entries purge the extra entries left in the cache later on
-        if (!evicted.second) {
-            return false;
+        IndexJournalFlusher flusher(this);
+
+        ///Entries not used since the index was opened are the least recently used
+        if ( evictNotAdoptedIndexedEntry() ) {
+            return true;
         }
-        /*if it is stored on disk, remove it from memory*/
-        
-        assert( evicted.second.unique() );
-        evicted.second->removeAnyBackingFile();
-        
-        return true;
+        int firstShard = _nextEvictedShard.fetchAndAddRelaxed(1);
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[((unsigned int)firstShard + i) & (NATRON_CACHE_SHARDS_COUNT - 1)];
+            QMutexLocker locker(&shard.lock);
+            
+            std::pair<hash_type,EntryTypePtr> evicted = shard.diskCache.evict();
+            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+            //we'll let the user of these entries purge the extra entries left in the cache later on
+            if (!evicted.second) {
+                continue;
+            }
+            /*if it is stored on disk, remove it from memory*/
+            
+            assert( evicted.second.unique() );
+            evicted.second->removeAnyBackingFile();
+            appendRemoveToIndex(evicted.second);
+            
+            return true;
+        }
+        return false;
     }
 
     /**
@@ -1053,16 +1126,6 @@ public:
         return cacheFolderName;
     }
 
-    std::string getRestoreFilePath() const
-    {
-        QString newCachePath( getCachePath() );
-
-        newCachePath.append( QDir::separator() );
-        newCachePath.append("restoreFile." NATRON_CACHE_FILE_EXT);
-
-        return newCachePath.toStdString();
-    }
-
     void setMaximumCacheSize(U64 newSize)
     {
         QMutexLocker k(&_sizeLock);
@@ -1090,6 +1153,26 @@ public:
         QMutexLocker k(&_sizeLock); return _memoryCacheSize;
     }
 
+    /**
+     * @brief Adds diff bytes to the memory allocated outside of the cache that counts against the budget of its in-memory portion.
+     * The entries exceeding the budget are evicted by the next creation of an entry or by clearExceedingEntries().
+     **/
+    void addExternalMemorySize(qint64 diff)
+    {
+        QMutexLocker k(&_sizeLock);
+        ///Avoid underflows, as for _memoryCacheSize
+        if (diff < 0) {
+            _externalMemorySize = -diff > (qint64)_externalMemorySize ? 0 : _externalMemorySize + diff;
+        } else {
+            _externalMemorySize += diff;
+        }
+    }
+
+    std::size_t getExternalMemorySize() const
+    {
+        QMutexLocker k(&_sizeLock); return _externalMemorySize;
+    }
+
     std::size_t getDiskCacheSize() const
     {
         QMutexLocker k(&_sizeLock); return _diskCacheSize;
@@ -1112,33 +1195,37 @@ public:
             return;
         }
 
-        QMutexLocker l(&_lock);
-        CacheIterator existingEntry = _memoryCache( entry->getHashKey() );
-        if ( existingEntry != _memoryCache.end() ) {
+        CacheShard& shard = getShard( entry->getHashKey() );
+        IndexJournalFlusher flusher(this);
+        QMutexLocker l(&shard.lock);
+        CacheIterator existingEntry = shard.memoryCache( entry->getHashKey() );
+        if ( existingEntry != shard.memoryCache.end() ) {
             std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
             for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                 if ( (*it)->getKey() == entry->getKey() ) {
                     (*it)->scheduleForDestruction();
+                    appendRemoveToIndex(*it);
                     ret.erase(it);
                     break;
                 }
             }
             if ( ret.empty() ) {
-                _memoryCache.erase(existingEntry);
+                shard.memoryCache.erase(existingEntry);
             }
         } else {
-            existingEntry = _diskCache( entry->getHashKey() );
-            if ( existingEntry != _diskCache.end() ) {
+            existingEntry = shard.diskCache( entry->getHashKey() );
+            if ( existingEntry != shard.diskCache.end() ) {
                 std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                     if ( (*it)->getKey() == entry->getKey() ) {
                         (*it)->scheduleForDestruction();
+                        appendRemoveToIndex(*it);
                         ret.erase(it);
                         break;
                     }
                 }
                 if ( ret.empty() ) {
-                    _diskCache.erase(existingEntry);
+                    shard.diskCache.erase(existingEntry);
                 }
             }
         }
@@ -1146,23 +1233,27 @@ public:
     
     void removeEntry(U64 hash)
     {
-        QMutexLocker l(&_lock);
-        CacheIterator existingEntry = _memoryCache( hash);
-        if ( existingEntry != _memoryCache.end() ) {
+        CacheShard& shard = getShard(hash);
+        IndexJournalFlusher flusher(this);
+        QMutexLocker l(&shard.lock);
+        CacheIterator existingEntry = shard.memoryCache( hash);
+        if ( existingEntry != shard.memoryCache.end() ) {
             std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
             for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                 (*it)->scheduleForDestruction();
+                appendRemoveToIndex(*it);
             }
-            _memoryCache.erase(existingEntry);
+            shard.memoryCache.erase(existingEntry);
             
         } else {
-            existingEntry = _diskCache( hash );
-            if ( existingEntry != _diskCache.end() ) {
+            existingEntry = shard.diskCache( hash );
+            if ( existingEntry != shard.diskCache.end() ) {
                 std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                     (*it)->scheduleForDestruction();
+                    appendRemoveToIndex(*it);
                 }
-                _diskCache.erase(existingEntry);
+                shard.diskCache.erase(existingEntry);
             
             }
         }
@@ -1172,11 +1263,13 @@ public:
     void removeAllImagesFromCacheWithMatchingKey(U64 treeVersion)
     {
         std::list<EntryTypePtr> toDelete;
-        CacheContainer newMemCache,newDiskCache;
-        {
-            QMutexLocker locker(&_lock);
+        IndexJournalFlusher flusher(this);
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[i];
+            CacheContainer newMemCache,newDiskCache;
+            QMutexLocker locker(&shard.lock);
             
-            for (CacheIterator memIt = _memoryCache.begin(); memIt != _memoryCache.end(); ++memIt) {
+            for (CacheIterator memIt = shard.memoryCache.begin(); memIt != shard.memoryCache.end(); ++memIt) {
                 
                 std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
                 if (!entries.empty()) {
@@ -1187,6 +1280,7 @@ public:
                         
                         for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
                             (*it)->scheduleForDestruction();
+                            appendRemoveToIndex(*it);
                             toDelete.push_back(*it);
                         }
                         
@@ -1197,7 +1291,7 @@ public:
                 }
             }
             
-            for (CacheIterator dIt = _diskCache.begin(); dIt != _diskCache.end(); ++dIt) {
+            for (CacheIterator dIt = shard.diskCache.begin(); dIt != shard.diskCache.end(); ++dIt) {
                 
                 std::list<EntryTypePtr> & entries = getValueFromIterator(dIt);
                 if (!entries.empty()) {
@@ -1208,6 +1302,7 @@ public:
                         
                         for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
                             (*it)->scheduleForDestruction();
+                            appendRemoveToIndex(*it);
                             toDelete.push_back(*it);
                         }
                         
@@ -1218,8 +1313,8 @@ public:
                 }
             }
             
-            _memoryCache = newMemCache;
-            _diskCache = newDiskCache;
+            shard.memoryCache = newMemCache;
+            shard.diskCache = newDiskCache;
             
             
         }
@@ -1233,98 +1328,75 @@ public:
     }
 
     
-    /*Saves cache to disk as a settings file.
-     */
-    void save(CacheTOC* tableOfContents)
+    /**
+     * @brief Flushes the in-memory portion to the disk and rewrites the index of the disk portion so that it can be
+     * restored lazily by the next session. The index stays opened and keeps journaling afterwards.
+     **/
+    void save()
     {
         clearInMemoryPortion(false);
-        QMutexLocker l(&_lock);     // must be locked
-
-        for (CacheIterator it = _diskCache.begin(); it != _diskCache.end(); ++it) {
-            std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
-            for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
-                if ( (*it2)->isStoredOnDisk() ) {
-                    SerializedEntry serialization;
-                    serialization.hash = (*it2)->getHashKey();
-                    serialization.params = (*it2)->getParams();
-                    serialization.key = (*it2)->getKey();
-                    serialization.size = (*it2)->dataSize();
-                    serialization.filePath = (*it2)->getFilePath();
-                    tableOfContents->push_back(serialization);
-#ifdef DEBUG
-                    if (!CacheAPI::checkFileNameMatchesHash(serialization.filePath, serialization.hash)) {
-                        qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
-                    }
-#endif
-                }
-            }
-        }
+        rewriteIndex();
     }
 
-
-    /*Restores the cache from disk.*/
-    void restore(const CacheTOC & tableOfContents)
+    /**
+     * @brief Opens the index of the disk portion written by a previous session. Entries are not created here: they are
+     * adopted by the cache the first time their hash key is looked-up, hence restoring takes a constant time.
+     * Once opened, the index journals all the changes made to the disk portion so that they survive a crash.
+     * Returns false if no valid index could be found, the cache is then empty but journaling anyway.
+     **/
+    bool restore()
     {
-
-        ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
-        ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
-        std::list<EntryTypePtr> entriesToBeDeleted;
-
-        for (typename CacheTOC::const_iterator it =
-                 tableOfContents.begin(); it != tableOfContents.end(); ++it) {
-            if ( it->hash != it->key.getHash() ) {
-                /*
-                 * If this warning is printed this means that the value computed by it->key()
-                 * is different than the value stored prior to serialiazing this entry. In other words there're
-                 * 2 possibilities:
-                 * 1) The key has changed since it has been added to the cache: maybe you forgot to serialize some
-                 * members of the key or you didn't save them correctly.
-                 * 2) The hash key computation is unreliable and is depending upon changing or non-deterministic
-                 * parameters which is wrong.
-                 */
-                qDebug() << "WARNING: serialized hash key different than the restored one";
-            }
-            
-#ifdef DEBUG
-            if (!checkFileNameMatchesHash(it->filePath, it->hash)) {
-                qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
-            }
-#endif
-            
-            EntryType* value = NULL;
-
-            Natron::StorageModeEnum storage = Natron::eStorageModeDisk;
-
-            try {
-                value = new EntryType(it->key,it->params,this,storage,it->filePath);
-                
-                ///This will not put the entry back into RAM, instead we just insert back the entry into the disk cache
-                value->restoreMetaDataFromFile(it->size);
-            } catch (const std::bad_alloc & e) {
-                qDebug() << e.what();
-                continue;
-            }
-
-            {
-                QMutexLocker locker(&_lock);
-                sealEntry(EntryTypePtr(value), false);
-            }
-        }
+        bool ret = _index.open(getCachePath().toStdString(), _version);
+        QMutexLocker k(&_sizeLock);
+        _diskCacheSize += _index.getNotAdoptedSize();
+        
+        return ret;
+    }
+    
+    /**
+     * @brief Closes the index without writing it, e.g: before cleaning up the cache directory.
+     **/
+    void closeIndex()
+    {
+        U64 notAdoptedSize = _index.getNotAdoptedSize();
+        _index.close();
+        QMutexLocker k(&_sizeLock);
+        _diskCacheSize = notAdoptedSize > _diskCacheSize ? 0 : _diskCacheSize - notAdoptedSize;
     }
 
 private:
 
     
-    bool getInternal(const typename EntryType::key_type & key,
-             std::list<EntryTypePtr>* returnValue) const
+    /**
+     * @brief Returns the index of the shard holding the entries with the given hash key.
+     * The low bits of the hash are mixed with the high bits so that keys differing only in their
+     * upper bits do not all fall in the same shard.
+     **/
+    static int getShardIndex(hash_type hash)
+    {
+        U64 h = (U64)hash;
+        h ^= (h >> 33);
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= (h >> 33);
+        return (int)( h & (NATRON_CACHE_SHARDS_COUNT - 1) );
+    }
+
+    CacheShard& getShard(hash_type hash) const
+    {
+        return _shards[getShardIndex(hash)];
+    }
+
+    bool getInternal(CacheShard& shard,
+                     const typename EntryType::key_type & key,
+                     std::list<EntryTypePtr>* returnValue) const
     {
         ///Private should be locked
-        assert(!_lock.tryLock());
+        assert(!shard.lock.tryLock());
         
         ///find a matching value in the internal memory container
-        CacheIterator memoryCached = _memoryCache( key.getHash() );
+        CacheIterator memoryCached = shard.memoryCache( key.getHash() );
         
-        if ( memoryCached != _memoryCache.end() ) {
+        if ( memoryCached != shard.memoryCache.end() ) {
             ///we found something with a matching hash key. There may be several entries linked to
              ///this key, we need to find one with matching params
             std::list<EntryTypePtr> & ret = getValueFromIterator(memoryCached);
@@ -1343,10 +1415,13 @@ private:
             
             return returnValue->size() > 0;
         } else {
+            ///restore from the index the entries with this hash key that were not used since it was opened
+            adoptIndexedEntries( shard, key.getHash() );
+            
             ///fallback on the disk cache internal container
-            CacheIterator diskCached = _diskCache( key.getHash() );
+            CacheIterator diskCached = shard.diskCache( key.getHash() );
             
-            if ( diskCached == _diskCache.end() ) {
+            if ( diskCached == shard.diskCache.end() ) {
                 /*the entry was neither in memory or disk, just allocate a new one*/
                 return false;
             } else {
@@ -1362,7 +1437,7 @@ private:
                          back into the memoryCache.*/
                         
                         if ( ret.empty() ) {
-                            _diskCache.erase(diskCached);
+                            shard.diskCache.erase(diskCached);
                         }
                         
                         try {
@@ -1380,7 +1455,7 @@ private:
                         }
                         
                         //put it back into the RAM
-                        _memoryCache.insert((*it)->getHashKey(),*it);
+                        shard.memoryCache.insert((*it)->getHashKey(),*it);
                         
                         U64 memoryCacheSize,maximumInMemorySize;
                         {
@@ -1394,7 +1469,7 @@ private:
                         
                         //now clear extra entries from the disk cache so it doesn't exceed the RAM limit.
                         while (memoryCacheSize > maximumInMemorySize) {
-                            if ( !tryEvictEntry(entriesToBeDeleted) ) {
+                            if ( !tryEvictEntry(shard, entriesToBeDeleted) ) {
                                 break;
                             }
                             
@@ -1426,20 +1501,225 @@ private:
         }
     }
 
+    /**
+     * @brief Fills the index record of an entry stored on disk. Its data may have been deallocated already,
+     * hence the size is deduced from the params.
+     **/
+    bool makeIndexRecord(const EntryTypePtr & entry,
+                         CacheIndex::Record* record) const
+    {
+        SerializedEntry serialization;
+        serialization.hash = entry->getHashKey();
+        serialization.params = entry->getParams();
+        serialization.key = entry->getKey();
+        serialization.size = serialization.params->getElementsCount() * sizeof(data_t);
+        serialization.filePath = entry->getFilePath();
+#ifdef DEBUG
+        if (!CacheAPI::checkFileNameMatchesHash(serialization.filePath, serialization.hash)) {
+            qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
+        }
+#endif
+        try {
+            std::ostringstream ss;
+            {
+                boost::archive::binary_oarchive oArchive(ss);
+                const SerializedEntry & constSerialization = serialization;
+                oArchive << constSerialization;
+            }
+            record->blob = ss.str();
+        } catch (const std::exception & e) {
+            qDebug() << e.what();
+            return false;
+        }
+        record->hash = serialization.hash;
+        record->size = serialization.size;
+        record->time = entry->getTime();
+        record->filePath = serialization.filePath;
+        
+        return true;
+    }
+    
+    /**
+     * @brief Writes a new index holding the entries of the disk portion and the ones not adopted yet,
+     * which also truncates the journal.
+     **/
+    void rewriteIndex() const
+    {
+        ///Events journaled while the shards are being gathered must not be lost with the old journal
+        _index.beginRewrite();
+        
+        std::list<CacheIndex::Record> records;
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[i];
+            QMutexLocker l(&shard.lock);     // must be locked
+
+            for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+                std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
+                for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
+                    if ( (*it2)->isStoredOnDisk() ) {
+                        CacheIndex::Record r;
+                        if ( makeIndexRecord(*it2, &r) ) {
+                            records.push_back(r);
+                        }
+                    }
+                }
+            }
+        }
+        
+        ///Entries that were never looked-up during this session are still only known by the index and are added by rewrite()
+        if ( !_index.rewrite(records) ) {
+            qDebug() << "WARNING: could not write the index of the" << cacheName().c_str() << "cache";
+        }
+    }
+
+    /**
+     * @brief Writes the events that were journaled while a shard lock was held and compacts the journal
+     * if it grew too much. The shard locks must not be taken.
+     **/
+    void flushIndexJournal() const
+    {
+        if ( _index.flushJournal() ) {
+            ///The journal keeps growing with evictions until the index is rewritten
+            rewriteIndex();
+        }
+    }
+
+    /**
+     * @brief Calls flushIndexJournal() when going out of scope. Declare it before taking any shard lock
+     * so that the journal is written once they are released and threads hashing into the shard do not wait on it.
+     **/
+    class IndexJournalFlusher
+    {
+        const Cache* _cache;
+
+    public:
+
+        IndexJournalFlusher(const Cache* cache)
+            : _cache(cache)
+        {
+        }
+
+        ~IndexJournalFlusher()
+        {
+            _cache->flushIndexJournal();
+        }
+    };
+    
+    ///Called when the data of an entry has been written to its backing file and the entry is now only on disk
+    void appendInsertToIndex(const EntryTypePtr & entry) const
+    {
+        if ( !_index.isOpened() ) {
+            return;
+        }
+        CacheIndex::Record r;
+        if ( makeIndexRecord(entry, &r) ) {
+            _index.appendInsert(r);
+        }
+    }
+    
+    ///Called when the backing file of an entry has been (or is about to be) removed
+    void appendRemoveToIndex(const EntryTypePtr & entry) const
+    {
+        if ( !entry->isStoredOnDisk() || !_index.isOpened() ) {
+            return;
+        }
+        _index.appendRemove( entry->getHashKey(), entry->getFilePath() );
+    }
+    
+    /**
+     * @brief Creates the entries with the given hash key that the index holds and inserts them into the disk portion.
+     **/
+    void adoptIndexedEntries(CacheShard& shard,
+                             hash_type hash) const
+    {
+        assert( !shard.lock.tryLock() );   // must be locked
+        if ( !_index.isOpened() ) {
+            return;
+        }
+        std::list<CacheIndex::Record> records;
+        _index.take(hash, &records);
+        for (std::list<CacheIndex::Record>::iterator it = records.begin(); it != records.end(); ++it) {
+            ///restoreMetaDataFromFile() accounts the size again
+            {
+                QMutexLocker k(&_sizeLock);
+                _diskCacheSize = it->size > _diskCacheSize ? 0 : _diskCacheSize - it->size;
+            }
+            
+            SerializedEntry serialization;
+            EntryType* value = NULL;
+            try {
+                std::istringstream ss(it->blob);
+                boost::archive::binary_iarchive iArchive(ss);
+                iArchive >> serialization;
+                if ( serialization.hash != serialization.key.getHash() ) {
+                    /*
+                     * If this warning is printed this means that the value computed by the key
+                     * is different than the value stored prior to serialiazing this entry. In other words there're
+                     * 2 possibilities:
+                     * 1) The key has changed since it has been added to the cache: maybe you forgot to serialize some
+                     * members of the key or you didn't save them correctly.
+                     * 2) The hash key computation is unreliable and is depending upon changing or non-deterministic
+                     * parameters which is wrong.
+                     */
+                    qDebug() << "WARNING: serialized hash key different than the restored one";
+                }
+                value = new EntryType(serialization.key,serialization.params,this,Natron::eStorageModeDisk,it->filePath);
+                
+                ///This will not put the entry back into RAM, instead we just insert back the entry into the disk cache
+                value->restoreMetaDataFromFile(serialization.size);
+            } catch (const std::exception & e) {
+                qDebug() << e.what();
+                delete value;
+                std::remove( it->filePath.c_str() );
+                _index.appendRemove(it->hash, it->filePath);
+                continue;
+            }
+            sealEntry(shard, EntryTypePtr(value), false);
+        }
+    }
+    
+    /**
+     * @brief Removes from the disk the file of an entry that the index holds and that was not adopted yet.
+     * These entries were not used since the index was opened, hence they are evicted first.
+     **/
+    bool evictNotAdoptedIndexedEntry() const
+    {
+        if ( !_index.isOpened() ) {
+            return false;
+        }
+        CacheIndex::Record r;
+        if ( !_index.takeAny(&r) ) {
+            return false;
+        }
+        std::remove( r.filePath.c_str() );
+        _index.appendRemove(r.hash, r.filePath);
+        {
+            QMutexLocker k(&_sizeLock);
+            _diskCacheSize = r.size > _diskCacheSize ? 0 : _diskCacheSize - r.size;
+        }
+        if (_signalEmitter) {
+            _signalEmitter->emitRemovedEntry(r.time, (int)Natron::eStorageModeDisk);
+        }
+        
+        return true;
+    }
+    
     /** @brief Inserts into the cache an entry that was previously allocated by the createInternal()
      * function. This is called directly by createInternal() if the allocation was successful
      **/
-    void sealEntry(const EntryTypePtr & entry,bool inMemory) const
+    void sealEntry(CacheShard& shard,
+                   const EntryTypePtr & entry,
+                   bool inMemory) const
     {
-        assert( !_lock.tryLock() );   // must be locked
+        assert( !shard.lock.tryLock() );   // must be locked
         typename EntryType::hash_type hash = entry->getHashKey();
         
         if (inMemory) {
             
             /*if the entry doesn't exist on the memory cache,make a new list and insert it*/
-            CacheIterator existingEntry = _memoryCache(hash);
-            if ( existingEntry == _memoryCache.end() ) {
-                _memoryCache.insert(hash,entry);
+            CacheIterator existingEntry = shard.memoryCache(hash);
+            if ( existingEntry == shard.memoryCache.end() ) {
+                shard.memoryCache.insert(hash,entry);
             } else {
                 /*append to the existing list*/
                 getValueFromIterator(existingEntry).push_back(entry);
@@ -1447,9 +1727,9 @@ private:
             
         } else {
             
-            CacheIterator existingEntry = _diskCache(hash);
-            if ( existingEntry == _diskCache.end() ) {
-                _diskCache.insert(hash,entry);
+            CacheIterator existingEntry = shard.diskCache(hash);
+            if ( existingEntry == shard.diskCache.end() ) {
+                shard.diskCache.insert(hash,entry);
             } else {
                 /*append to the existing list*/
                 getValueFromIterator(existingEntry).push_back(entry);
@@ -1458,10 +1738,29 @@ private:
         }
     }
     
-    bool tryEvictEntry(std::list<EntryTypePtr>& entriesToBeDeleted) const
+    /**
+     * @brief Evicts the LRU in-memory entry of one of the shards, trying them in a round-robin fashion.
+     * The shards' locks must not be taken when calling this function: they are taken one at a time so
+     * that 2 threads evicting concurrently never wait on each other's shard.
+     **/
+    bool tryEvictEntryFromAnyShard(std::list<EntryTypePtr>& entriesToBeDeleted) const
+    {
+        int firstShard = _nextEvictedShard.fetchAndAddRelaxed(1);
+        for (int i = 0; i < NATRON_CACHE_SHARDS_COUNT; ++i) {
+            CacheShard& shard = _shards[((unsigned int)firstShard + i) & (NATRON_CACHE_SHARDS_COUNT - 1)];
+            QMutexLocker locker(&shard.lock);
+            if ( tryEvictEntry(shard, entriesToBeDeleted) ) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool tryEvictEntry(CacheShard& shard,
+                       std::list<EntryTypePtr>& entriesToBeDeleted) const
     {
-        assert( !_lock.tryLock() );
-        std::pair<hash_type,EntryTypePtr> evicted = _memoryCache.evict();
+        assert( !shard.lock.tryLock() );
+        std::pair<hash_type,EntryTypePtr> evicted = shard.memoryCache.evict();
         //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
         //we'll let the user of these entries purge the extra entries left in the cache later on
         if (!evicted.second) {
@@ -1474,6 +1773,7 @@ private:
             
             ///This is EXPENSIVE! it calls msync
             evicted.second->deallocate();
+            appendInsertToIndex(evicted.second);
             
             /*insert it back into the disk portion */
             
@@ -1487,8 +1787,9 @@ private:
 
             /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
             while ( ( diskCacheSize  + evicted.second->size() ) >= (maximumCacheSize - maximumInMemorySize) ) {
-                {
-                    std::pair<hash_type,EntryTypePtr> evictedFromDisk = _diskCache.evict();
+                ///Entries not used since the index was opened are the least recently used
+                if ( !evictNotAdoptedIndexedEntry() ) {
+                    std::pair<hash_type,EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
                     //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
                     //we'll let the user of these entries purge the extra entries left in the cache later on
                     if (!evictedFromDisk.second) {
@@ -1497,7 +1798,7 @@ private:
                     
                     ///Erase the file from the disk if we reach the limit.
                     evictedFromDisk.second->scheduleForDestruction();
-                    
+                    appendRemoveToIndex(evictedFromDisk.second);
                     
                     entriesToBeDeleted.push_back(evictedFromDisk.second);
                 }
@@ -1509,10 +1810,10 @@ private:
                 }
             }
 
-            CacheIterator existingDiskCacheEntry = _diskCache(evicted.first);
+            CacheIterator existingDiskCacheEntry = shard.diskCache(evicted.first);
             /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
-            if ( existingDiskCacheEntry == _diskCache.end() ) {
-                _diskCache.insert(evicted.first,evicted.second);
+            if ( existingDiskCacheEntry == shard.diskCache.end() ) {
+                shard.diskCache.insert(evicted.first,evicted.second);
             } else {   /*append to the existing list*/
                 getValueFromIterator(existingDiskCacheEntry).push_back(evicted.second);
             }
@@ -8,6 +8,8 @@
 #include <iostream>
 #include <cassert>
 #include <cstdio> // for std::remove
+#include <cstring> // for std::memcpy
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 #include <fstream>
@@ -21,6 +23,7 @@
 #endif
 #include "Engine/Hash64.h"
 #include "Engine/MemoryFile.h"
+#include "Engine/MemoryPool.h"
 #include "Engine/NonKeyParams.h"
 #include <SequenceParsing.h> // for removePath
 
@@ -30,7 +33,9 @@ namespace Natron {
 
 
 /** @brief Buffer represents  an internal buffer that can be allocated on different devices.
- * For now the class is simple and can only be either on disk using mmap or in RAM using malloc.
+ * For now the class is simple and can only be either on disk using mmap or in RAM using the MemoryPool.
+ * RAM buffers are NOT initialized: the content of a freshly allocated buffer is undefined.
+ * DataType must be a POD type.
  * The cost parameter given to the allocate() function is a hint that the Buffer classes uses
  * to select a device to use. By default -1 means it should not allocate any memory,
  * 0 means RAM and >= 1 means the data will be stored on disk using mmap. We could see this
@@ -51,7 +56,8 @@ public:
 
     Buffer()
         : _path()
-          , _buffer()
+          , _buffer(0)
+          , _count(0)
           , _backingFile()
           , _storageMode(eStorageModeRAM)
     {
@@ -68,8 +74,8 @@ public:
     {
         /*allocate should be called only once.*/
         assert( _path.empty() );
-        assert( ( (_buffer.size() == 0) && !_backingFile ) || ( (_buffer.size() != 0) && !_backingFile ) || (!(_buffer.size() != 0) && _backingFile) );
-        if ( (_buffer.size() > 0) || _backingFile ) {
+        assert( !_buffer || !_backingFile );
+        if ( _buffer || _backingFile ) {
             return;
         }
 
@@ -96,7 +102,8 @@ public:
             }
         } else if (storage == Natron::eStorageModeRAM) {
             _storageMode = eStorageModeRAM;
-            _buffer.resize(count);
+            _buffer = (DataType*)MemoryPool::allocate(count * sizeof(DataType));
+            _count = count;
         }
     }
 
@@ -109,8 +116,17 @@ public:
     void reallocate(U64 count)
     {
         if (_storageMode == eStorageModeRAM) {
-            assert(_buffer.size() > 0); // could be 0 if we allocate 0...
-            _buffer.resize(count);
+            assert(_buffer); // could be NULL if we allocate 0...
+            if (count == _count) {
+                return;
+            }
+            DataType* newBuffer = (DataType*)MemoryPool::allocate(count * sizeof(DataType));
+            if (_buffer && newBuffer) {
+                std::memcpy( newBuffer, _buffer, std::min(count, _count) * sizeof(DataType) );
+            }
+            MemoryPool::release(_buffer, _count * sizeof(DataType));
+            _buffer = newBuffer;
+            _count = count;
         } else if (_storageMode == eStorageModeDisk) {
             assert(_backingFile);
             _backingFile->resize( count * sizeof(DataType) );
@@ -141,7 +157,10 @@ public:
     void deallocate()
     {
         if (_storageMode == eStorageModeRAM) {
-            _buffer.clear();
+            ///Give the block back to the pool so that the next image of the same size can recycle it
+            MemoryPool::release(_buffer, _count * sizeof(DataType));
+            _buffer = 0;
+            _count = 0;
         } else {
             if (_backingFile) {
                 bool flushOk = _backingFile->flush();
@@ -175,7 +194,7 @@ public:
     size_t size() const
     {
         if (_storageMode == eStorageModeRAM) {
-            return _buffer.size() * sizeof(DataType);
+            return _count * sizeof(DataType);
         } else {
             return _backingFile ? _backingFile->size() : 0;
         }
@@ -183,7 +202,7 @@ public:
 
     bool isAllocated() const
     {
-        return (_buffer.size() > 0) || ( _backingFile && _backingFile->data() );
+        return _buffer || ( _backingFile && _backingFile->data() );
     }
 
     DataType* writable()
@@ -195,7 +214,7 @@ public:
                 return NULL;
             }
         } else {
-            return &_buffer.front();
+            return _buffer;
         }
     }
 
@@ -204,7 +223,7 @@ public:
         if (_storageMode == eStorageModeDisk) {
             return (const DataType*)_backingFile->data();
         } else {
-            return &_buffer.front();
+            return _buffer;
         }
     }
 
@@ -216,7 +235,8 @@ public:
 private:
 
     std::string _path;
-    std::vector<DataType> _buffer;
+    DataType* _buffer; //< RAM storage, allocated by the MemoryPool
+    U64 _count; //< number of elements of _buffer
 
     /*mutable so the reOpenFileMapping function can reopen the mmaped file. It doesn't
        change the underlying data*/
@@ -0,0 +1,943 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "CacheIndex.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+#include <stdexcept>
+
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QDebug>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/scoped_ptr.hpp>
+#include <boost/cstdint.hpp>
+#endif
+
+#include "Global/Macros.h"
+#include "Engine/MemoryFile.h"
+
+#define NATRON_CACHE_INDEX_MAGIC "NTCIDX01"
+#define NATRON_CACHE_JOURNAL_MAGIC "NTCJRN01"
+#define NATRON_CACHE_INDEX_FORMAT_VERSION 1
+
+///The journal is compacted once it is this many times bigger than the index it is replayed on top of...
+#define NATRON_CACHE_JOURNAL_MAX_GROWTH 2
+///...and bigger than this, so that a small index is not rewritten for every few evictions
+#define NATRON_CACHE_JOURNAL_MIN_COMPACTION_SIZE (8 * 1024 * 1024)
+
+using namespace Natron;
+
+namespace {
+
+/*
+ * All the structures below are written as-is in the files: their layout must not change without
+ * incrementing NATRON_CACHE_INDEX_FORMAT_VERSION. They are always read with memcpy since the mapping gives no
+ * alignment guarantee.
+ */
+struct IndexHeader
+{
+    char magic[8];
+    U32 formatVersion;
+    U32 cacheVersion;
+    U64 nRecords;
+    U64 nSlots; //< always a power of 2
+    U64 totalSize; //< sum of the size of all the entries of the index
+    U64 reserved[3];
+};
+
+struct IndexSlot
+{
+    U64 hash;
+    U64 recordOffset; //< offset of the record from the start of the file, 0 for an empty slot
+};
+
+struct IndexRecordHeader
+{
+    U64 size;
+    boost::int32_t time;
+    U32 pathLength;
+    U32 blobLength;
+    U32 reserved;
+};
+
+struct JournalHeader
+{
+    char magic[8];
+    U32 formatVersion;
+    U32 cacheVersion;
+};
+
+enum JournalOpEnum
+{
+    eJournalOpInsert = 0,
+    eJournalOpRemove
+};
+
+/*
+ * A journal event is: U32 bodyLength, U32 checksum of the body, then the body:
+ * U8 op, U64 hash, U64 size, int32 time, U32 pathLength, path, U32 blobLength, blob
+ */
+
+U32
+fnv1a(const char* data,
+      std::size_t len)
+{
+    U32 h = 2166136261U;
+
+    for (std::size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)data[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+U64
+mixHash(U64 h)
+{
+    h ^= (h >> 33);
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= (h >> 33);
+
+    return h;
+}
+
+template <typename T>
+void
+appendPOD(std::string* buf,
+          const T & v)
+{
+    buf->append( (const char*)&v, sizeof(T) );
+}
+
+template <typename T>
+bool
+readPOD(const char* data,
+        std::size_t len,
+        std::size_t* offset,
+        T* v)
+{
+    if (*offset + sizeof(T) > len) {
+        return false;
+    }
+    std::memcpy(v, data + *offset, sizeof(T));
+    *offset += sizeof(T);
+
+    return true;
+}
+
+bool
+readString(const char* data,
+           std::size_t len,
+           std::size_t* offset,
+           U32 strLen,
+           std::string* str)
+{
+    if (*offset + strLen > len) {
+        return false;
+    }
+    str->assign(data + *offset, strLen);
+    *offset += strLen;
+
+    return true;
+}
+
+std::string
+joinPath(const std::string & directory,
+         const char* fileName)
+{
+    std::string ret(directory);
+
+    if ( !ret.empty() && (ret[ret.size() - 1] != '/') && (ret[ret.size() - 1] != '\\') ) {
+        ret.push_back('/');
+    }
+    ret.append(fileName);
+
+    return ret;
+}
+
+bool
+fileExists(const std::string & path)
+{
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (f) {
+        std::fclose(f);
+
+        return true;
+    }
+
+    return false;
+}
+
+void
+makeJournalHeader(unsigned int cacheVersion,
+                  JournalHeader* header)
+{
+    std::memset( header, 0, sizeof(JournalHeader) );
+    std::memcpy(header->magic, NATRON_CACHE_JOURNAL_MAGIC, 8);
+    header->formatVersion = NATRON_CACHE_INDEX_FORMAT_VERSION;
+    header->cacheVersion = cacheVersion;
+}
+
+/**
+ * @brief Creates an empty journal, overwriting any existing one, and returns it opened for appending
+ **/
+std::FILE*
+createJournal(const std::string & path,
+              unsigned int cacheVersion,
+              const char* content = 0,
+              std::size_t contentLength = 0)
+{
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+        return 0;
+    }
+    if (content) {
+        std::fwrite(content, 1, contentLength, f);
+    } else {
+        JournalHeader header;
+        makeJournalHeader(cacheVersion, &header);
+        std::fwrite(&header, sizeof(JournalHeader), 1, f);
+    }
+    std::fflush(f);
+
+    return f;
+}
+
+} // anon namespace
+
+namespace Natron {
+
+struct CacheIndexPrivate
+{
+    ///Serializes the writes to the journal file so that they happen outside of lock. Always taken before lock.
+    QMutex journalLock;
+    mutable QMutex lock; //< protects all members
+
+    bool opened;
+    std::string directory;
+    unsigned int cacheVersion;
+
+    ///The mapped index, may be NULL if there was no valid index file
+    boost::scoped_ptr<MemoryFile> mapping;
+    IndexHeader header;
+
+    ///Offsets of the records of the mapped index that were adopted or removed
+    std::set<U64> deadRecords;
+    U64 notAdoptedSize;
+
+    ///Records that were inserted in the journal after the index was written and not adopted yet, indexed by file path
+    typedef std::map<std::string, CacheIndex::Record> JournalRecords;
+    JournalRecords journalRecords;
+    std::multimap<U64, std::string> journalRecordsByHash;
+
+    std::FILE* journal;
+
+    ///Events appended since the last flush, written to the journal by flushJournal()
+    std::string pendingEvents;
+
+    ///Size in bytes of the journal, pending events included
+    U64 journalSize;
+
+    ///Set once flushJournal() asked for a compaction, until the index is reopened
+    bool compactionRequested;
+
+    ///Events appended since beginRewrite(), which the new journal must start with
+    bool recordingRewriteEvents;
+    std::string rewriteEvents;
+
+    ///Next slot of the mapped index to look at in takeAny()
+    U64 evictionCursor;
+
+    CacheIndexPrivate()
+    : journalLock()
+    , lock()
+    , opened(false)
+    , directory()
+    , cacheVersion(0)
+    , mapping()
+    , header()
+    , deadRecords()
+    , notAdoptedSize(0)
+    , journalRecords()
+    , journalRecordsByHash()
+    , journal(0)
+    , pendingEvents()
+    , journalSize(0)
+    , compactionRequested(false)
+    , recordingRewriteEvents(false)
+    , rewriteEvents()
+    , evictionCursor(0)
+    {
+        std::memset( &header, 0, sizeof(IndexHeader) );
+    }
+
+    /**
+     * @brief Both journalLock and lock must be held.
+     **/
+    void closeInternal()
+    {
+        if (journal) {
+            writeEvents(pendingEvents);
+            std::fclose(journal);
+            journal = 0;
+        }
+        pendingEvents.clear();
+        journalSize = 0;
+        compactionRequested = false;
+        mapping.reset();
+        std::memset( &header, 0, sizeof(IndexHeader) );
+        deadRecords.clear();
+        notAdoptedSize = 0;
+        journalRecords.clear();
+        journalRecordsByHash.clear();
+        evictionCursor = 0;
+        opened = false;
+    }
+
+    bool mapIndex(const std::string & path)
+    {
+        try {
+            mapping.reset( new MemoryFile(path, MemoryFile::eFileOpenModeEnumIfExistsKeepElseFail) );
+        } catch (const std::exception & e) {
+            qDebug() << "Failed to map the cache index " << path.c_str() << ": " << e.what();
+            mapping.reset();
+
+            return false;
+        }
+        const char* data = mapping->data();
+        std::size_t len = mapping->size();
+        if ( !data || (len < sizeof(IndexHeader)) ) {
+            mapping.reset();
+
+            return false;
+        }
+        std::memcpy( &header, data, sizeof(IndexHeader) );
+        if ( (std::memcmp(header.magic, NATRON_CACHE_INDEX_MAGIC, 8) != 0) ||
+             ( header.formatVersion != NATRON_CACHE_INDEX_FORMAT_VERSION) ||
+             ( header.cacheVersion != cacheVersion) ||
+             ( header.nSlots == 0) || ( ( header.nSlots & (header.nSlots - 1) ) != 0 ) ||
+             ( sizeof(IndexHeader) + header.nSlots * sizeof(IndexSlot) > len) ) {
+            mapping.reset();
+            std::memset( &header, 0, sizeof(IndexHeader) );
+
+            return false;
+        }
+        notAdoptedSize = header.totalSize;
+
+        return true;
+    }
+
+    void getSlot(U64 i,
+                 IndexSlot* slot) const
+    {
+        assert(mapping && i < header.nSlots);
+        std::memcpy( slot, mapping->data() + sizeof(IndexHeader) + i * sizeof(IndexSlot), sizeof(IndexSlot) );
+    }
+
+    bool readRecord(U64 hash,
+                    U64 offset,
+                    CacheIndex::Record* record) const
+    {
+        assert(mapping);
+        const char* data = mapping->data();
+        std::size_t len = mapping->size();
+        std::size_t pos = offset;
+        IndexRecordHeader rh;
+        if ( !readPOD(data, len, &pos, &rh) ) {
+            return false;
+        }
+        record->hash = hash;
+        record->size = rh.size;
+        record->time = rh.time;
+        if ( !readString(data, len, &pos, rh.pathLength, &record->filePath) ) {
+            return false;
+        }
+
+        return readString(data, len, &pos, rh.blobLength, &record->blob);
+    }
+
+    /**
+     * @brief Returns the size of the record at the given offset, without decoding it
+     **/
+    U64 readRecordSize(U64 offset) const
+    {
+        std::size_t pos = offset;
+        IndexRecordHeader rh;
+        if ( !readPOD(mapping->data(), mapping->size(), &pos, &rh) ) {
+            return 0;
+        }
+
+        return rh.size;
+    }
+
+    /**
+     * @brief Calls f(slotIndex, recordOffset) for all the alive records of the mapped index matching the hash,
+     * stopping as soon as f returns true.
+     **/
+    template <typename F>
+    void probe(U64 hash,
+               F & f) const
+    {
+        if (!mapping) {
+            return;
+        }
+        U64 mask = header.nSlots - 1;
+        for (U64 i = mixHash(hash) & mask, n = 0; n < header.nSlots; i = (i + 1) & mask, ++n) {
+            IndexSlot slot;
+            getSlot(i, &slot);
+            if (slot.recordOffset == 0) {
+                return;
+            }
+            if ( (slot.hash == hash) && ( deadRecords.find(slot.recordOffset) == deadRecords.end() ) ) {
+                if ( f(slot.recordOffset) ) {
+                    return;
+                }
+            }
+        }
+    }
+
+    struct FindByPath
+    {
+        const CacheIndexPrivate* imp;
+        U64 hash;
+        const std::string* path;
+        U64 found;
+
+        bool operator()(U64 offset)
+        {
+            CacheIndex::Record r;
+            if ( imp->readRecord(hash, offset, &r) && (r.filePath == *path) ) {
+                found = offset;
+
+                return true;
+            }
+
+            return false;
+        }
+    };
+
+    struct CollectAll
+    {
+        std::list<U64> offsets;
+
+        bool operator()(U64 offset)
+        {
+            offsets.push_back(offset);
+
+            return false;
+        }
+    };
+
+    void markDead(U64 offset)
+    {
+        if ( deadRecords.insert(offset).second ) {
+            U64 sz = readRecordSize(offset);
+            notAdoptedSize = sz > notAdoptedSize ? 0 : notAdoptedSize - sz;
+        }
+    }
+
+    void removeFromIndex(U64 hash,
+                         const std::string & path)
+    {
+        FindByPath f;
+        f.imp = this;
+        f.hash = hash;
+        f.path = &path;
+        f.found = 0;
+        probe(hash, f);
+        if (f.found) {
+            markDead(f.found);
+        }
+    }
+
+    void removeFromJournalRecords(const std::string & path)
+    {
+        JournalRecords::iterator found = journalRecords.find(path);
+        if ( found == journalRecords.end() ) {
+            return;
+        }
+        std::pair<std::multimap<U64, std::string>::iterator, std::multimap<U64, std::string>::iterator> range =
+            journalRecordsByHash.equal_range(found->second.hash);
+        for (std::multimap<U64, std::string>::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == path) {
+                journalRecordsByHash.erase(it);
+                break;
+            }
+        }
+        notAdoptedSize = found->second.size > notAdoptedSize ? 0 : notAdoptedSize - found->second.size;
+        journalRecords.erase(found);
+    }
+
+    /**
+     * @brief Replays the journal events on top of the mapped index. Returns the number of bytes of valid events,
+     * including the header, or 0 if the journal is invalid.
+     **/
+    std::size_t replayJournal(const std::vector<char> & content,
+                              int* nEvents)
+    {
+        *nEvents = 0;
+        const char* data = content.empty() ? 0 : &content[0];
+        std::size_t len = content.size();
+        std::size_t pos = 0;
+        JournalHeader jh;
+        if ( !readPOD(data, len, &pos, &jh) ||
+             ( std::memcmp(jh.magic, NATRON_CACHE_JOURNAL_MAGIC, 8) != 0) ||
+             ( jh.formatVersion != NATRON_CACHE_INDEX_FORMAT_VERSION) ||
+             ( jh.cacheVersion != cacheVersion) ) {
+            return 0;
+        }
+        for (;;) {
+            std::size_t eventStart = pos;
+            U32 bodyLength, checksum;
+            if ( !readPOD(data, len, &pos, &bodyLength) || !readPOD(data, len, &pos, &checksum) ||
+                 (pos + bodyLength > len) || (fnv1a(data + pos, bodyLength) != checksum) ) {
+                ///Either the end of the journal or an event that was being written when the application crashed
+                return eventStart;
+            }
+            std::size_t bodyEnd = pos + bodyLength;
+            U8 op;
+            CacheIndex::Record r;
+            boost::int32_t time;
+            U32 pathLength, blobLength;
+            if ( !readPOD(data, bodyEnd, &pos, &op) || !readPOD(data, bodyEnd, &pos, &r.hash) ||
+                 !readPOD(data, bodyEnd, &pos, &r.size) || !readPOD(data, bodyEnd, &pos, &time) ||
+                 !readPOD(data, bodyEnd, &pos, &pathLength) || !readString(data, bodyEnd, &pos, pathLength, &r.filePath) ||
+                 !readPOD(data, bodyEnd, &pos, &blobLength) || !readString(data, bodyEnd, &pos, blobLength, &r.blob) ) {
+                return eventStart;
+            }
+            r.time = time;
+            pos = bodyEnd;
+            ++(*nEvents);
+
+            ///Both events supersede any previous record of the same file
+            removeFromIndex(r.hash, r.filePath);
+            removeFromJournalRecords(r.filePath);
+            if (op == eJournalOpInsert) {
+                notAdoptedSize += r.size;
+                journalRecordsByHash.insert( std::make_pair(r.hash, r.filePath) );
+                journalRecords.insert( std::make_pair(r.filePath, r) );
+            }
+        }
+    }
+
+    /**
+     * @brief Maps the index and replays the journal, see CacheIndex::open(). The lock must be held.
+     **/
+    bool open(const std::string & indexDirectory,
+              unsigned int indexCacheVersion)
+    {
+        closeInternal();
+        directory = indexDirectory;
+        cacheVersion = indexCacheVersion;
+        opened = true;
+
+        std::string indexPath = joinPath(directory, NATRON_CACHE_INDEX_FILE_NAME);
+        bool hasIndex = false;
+        if ( fileExists(indexPath) ) {
+            hasIndex = mapIndex(indexPath);
+            if (!hasIndex) {
+                ///Do not replay a journal on top of an index we could not read
+                return false;
+            }
+        }
+
+        std::string journalPath = joinPath(directory, NATRON_CACHE_JOURNAL_FILE_NAME);
+        std::vector<char> content;
+        {
+            std::FILE* f = std::fopen(journalPath.c_str(), "rb");
+            if (f) {
+                char buf[65536];
+                std::size_t n;
+                while ( ( n = std::fread(buf, 1, sizeof(buf), f) ) > 0 ) {
+                    content.insert(content.end(), buf, buf + n);
+                }
+                std::fclose(f);
+            }
+        }
+
+        int nEvents = 0;
+        std::size_t validLength = content.empty() ? 0 : replayJournal(content, &nEvents);
+        if (validLength == content.size() && validLength > 0) {
+            journal = std::fopen(journalPath.c_str(), "ab");
+        } else {
+            ///Drop the invalid tail (or the whole file if it was written by another version) before appending to it
+            journal = createJournal(journalPath, cacheVersion, validLength > 0 ? &content[0] : 0, validLength);
+        }
+        if (!journal) {
+            qDebug() << "Failed to open the cache journal " << journalPath.c_str();
+        }
+        journalSize = validLength > 0 ? validLength : sizeof(JournalHeader);
+
+        return hasIndex || nEvents > 0;
+    }
+
+    void getNotAdopted(std::list<CacheIndex::Record>* records) const
+    {
+        if (mapping) {
+            for (U64 i = 0; i < header.nSlots; ++i) {
+                IndexSlot slot;
+                getSlot(i, &slot);
+                if ( (slot.recordOffset != 0) && ( deadRecords.find(slot.recordOffset) == deadRecords.end() ) ) {
+                    CacheIndex::Record r;
+                    if ( readRecord(slot.hash, slot.recordOffset, &r) ) {
+                        records->push_back(r);
+                    }
+                }
+            }
+        }
+        for (JournalRecords::const_iterator it = journalRecords.begin(); it != journalRecords.end(); ++it) {
+            records->push_back(it->second);
+        }
+    }
+
+    void appendEvent(JournalOpEnum op,
+                     const CacheIndex::Record & record)
+    {
+        if (!journal) {
+            return;
+        }
+        std::string body;
+        body.reserve(record.filePath.size() + record.blob.size() + 40);
+        appendPOD(&body, (U8)op);
+        appendPOD(&body, record.hash);
+        appendPOD(&body, record.size);
+        appendPOD(&body, (boost::int32_t)record.time);
+        appendPOD(&body, (U32)record.filePath.size());
+        body.append(record.filePath);
+        appendPOD(&body, (U32)record.blob.size());
+        body.append(record.blob);
+
+        std::size_t eventStart = pendingEvents.size();
+        appendPOD(&pendingEvents, (U32)body.size());
+        appendPOD( &pendingEvents, fnv1a( body.data(), body.size() ) );
+        pendingEvents.append(body);
+        journalSize += pendingEvents.size() - eventStart;
+        if (recordingRewriteEvents) {
+            rewriteEvents.append(pendingEvents, eventStart, std::string::npos);
+        }
+    }
+
+    /**
+     * @brief Writes the given events to the journal. journalLock must be held.
+     **/
+    void writeEvents(const std::string & events)
+    {
+        if ( !journal || events.empty() ) {
+            return;
+        }
+        std::fwrite(events.data(), 1, events.size(), journal);
+        ///Hand the events over to the OS right away so they survive a crash of the application
+        std::fflush(journal);
+    }
+
+    bool isCompactionNeeded() const
+    {
+        U64 indexSize = mapping ? mapping->size() : 0;
+
+        return journalSize > NATRON_CACHE_JOURNAL_MIN_COMPACTION_SIZE &&
+               journalSize > NATRON_CACHE_JOURNAL_MAX_GROWTH * indexSize;
+    }
+};
+
+CacheIndex::CacheIndex()
+    : _imp( new CacheIndexPrivate() )
+{
+}
+
+CacheIndex::~CacheIndex()
+{
+    close();
+    delete _imp;
+}
+
+bool
+CacheIndex::existsInDirectory(const std::string & directory)
+{
+    return fileExists( joinPath(directory, NATRON_CACHE_INDEX_FILE_NAME) ) ||
+           fileExists( joinPath(directory, NATRON_CACHE_JOURNAL_FILE_NAME) );
+}
+
+bool
+CacheIndex::open(const std::string & directory,
+                 unsigned int cacheVersion)
+{
+    QMutexLocker j(&_imp->journalLock);
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->open(directory, cacheVersion);
+}
+
+void
+CacheIndex::close()
+{
+    QMutexLocker j(&_imp->journalLock);
+    QMutexLocker k(&_imp->lock);
+
+    _imp->closeInternal();
+}
+
+bool
+CacheIndex::isOpened() const
+{
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->opened;
+}
+
+void
+CacheIndex::take(U64 hash,
+                 std::list<Record>* records)
+{
+    QMutexLocker k(&_imp->lock);
+
+    CacheIndexPrivate::CollectAll f;
+    _imp->probe(hash, f);
+    for (std::list<U64>::iterator it = f.offsets.begin(); it != f.offsets.end(); ++it) {
+        Record r;
+        if ( _imp->readRecord(hash, *it, &r) ) {
+            records->push_back(r);
+        }
+        _imp->markDead(*it);
+    }
+
+    std::pair<std::multimap<U64, std::string>::iterator, std::multimap<U64, std::string>::iterator> range =
+        _imp->journalRecordsByHash.equal_range(hash);
+    std::list<std::string> paths;
+    for (std::multimap<U64, std::string>::iterator it = range.first; it != range.second; ++it) {
+        paths.push_back(it->second);
+    }
+    for (std::list<std::string>::iterator it = paths.begin(); it != paths.end(); ++it) {
+        CacheIndexPrivate::JournalRecords::iterator found = _imp->journalRecords.find(*it);
+        if ( found != _imp->journalRecords.end() ) {
+            records->push_back(found->second);
+        }
+        _imp->removeFromJournalRecords(*it);
+    }
+}
+
+bool
+CacheIndex::takeAny(Record* record)
+{
+    QMutexLocker k(&_imp->lock);
+
+    ///Records of the index are older than the ones of the journal: take them first
+    if (_imp->mapping) {
+        while (_imp->evictionCursor < _imp->header.nSlots) {
+            IndexSlot slot;
+            _imp->getSlot(_imp->evictionCursor, &slot);
+            ++_imp->evictionCursor;
+            if ( (slot.recordOffset != 0) && ( _imp->deadRecords.find(slot.recordOffset) == _imp->deadRecords.end() ) ) {
+                bool ok = _imp->readRecord(slot.hash, slot.recordOffset, record);
+                _imp->markDead(slot.recordOffset);
+                if (ok) {
+                    return true;
+                }
+            }
+        }
+    }
+    if ( !_imp->journalRecords.empty() ) {
+        *record = _imp->journalRecords.begin()->second;
+        _imp->removeFromJournalRecords(record->filePath);
+
+        return true;
+    }
+
+    return false;
+}
+
+U64
+CacheIndex::getNotAdoptedSize() const
+{
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->notAdoptedSize;
+}
+
+void
+CacheIndex::getNotAdopted(std::list<Record>* records) const
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->getNotAdopted(records);
+}
+
+void
+CacheIndex::appendInsert(const Record & record)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->appendEvent(eJournalOpInsert, record);
+}
+
+void
+CacheIndex::appendRemove(U64 hash,
+                         const std::string & filePath)
+{
+    QMutexLocker k(&_imp->lock);
+    Record r;
+
+    r.hash = hash;
+    r.filePath = filePath;
+    _imp->appendEvent(eJournalOpRemove, r);
+}
+
+bool
+CacheIndex::flushJournal()
+{
+    QMutexLocker j(&_imp->journalLock);
+    std::string events;
+    bool compact = false;
+    {
+        QMutexLocker k(&_imp->lock);
+        events.swap(_imp->pendingEvents);
+        if ( !_imp->compactionRequested && _imp->isCompactionNeeded() ) {
+            _imp->compactionRequested = true;
+            compact = true;
+        }
+    }
+    _imp->writeEvents(events);
+
+    return compact;
+}
+
+void
+CacheIndex::beginRewrite()
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->recordingRewriteEvents = true;
+    _imp->rewriteEvents.clear();
+}
+
+bool
+CacheIndex::rewrite(const std::list<Record> & adopted)
+{
+    QMutexLocker j(&_imp->journalLock);
+    QMutexLocker k(&_imp->lock);
+    std::string rewriteEvents;
+
+    rewriteEvents.swap(_imp->rewriteEvents);
+    _imp->recordingRewriteEvents = false;
+    if (!_imp->opened) {
+        return false;
+    }
+    std::list<Record> records = adopted;
+    _imp->getNotAdopted(&records);
+    std::string directory = _imp->directory;
+    unsigned int cacheVersion = _imp->cacheVersion;
+
+    ///The index must be unmapped before the file is replaced
+    _imp->closeInternal();
+    bool ok = write(directory, cacheVersion, records);
+    _imp->open(directory, cacheVersion);
+
+    ///The adopted records were gathered while the cache kept journaling: replay the events appended meanwhile
+    ///on top of the new index. They supersede the records of the same files, so an event that was already
+    ///accounted for by the adopted records does no harm.
+    if (ok) {
+        _imp->writeEvents(rewriteEvents);
+        _imp->journalSize += rewriteEvents.size();
+    }
+
+    ///The entries held by the cache stay adopted. If the write failed, the old journal was replayed and may list them too
+    for (std::list<Record>::const_iterator it = adopted.begin(); it != adopted.end(); ++it) {
+        _imp->removeFromIndex(it->hash, it->filePath);
+        _imp->removeFromJournalRecords(it->filePath);
+    }
+
+    return ok;
+}
+
+bool
+CacheIndex::write(const std::string & directory,
+                  unsigned int cacheVersion,
+                  const std::list<Record> & records)
+{
+    IndexHeader header;
+
+    std::memset( &header, 0, sizeof(IndexHeader) );
+    std::memcpy(header.magic, NATRON_CACHE_INDEX_MAGIC, 8);
+    header.formatVersion = NATRON_CACHE_INDEX_FORMAT_VERSION;
+    header.cacheVersion = cacheVersion;
+    header.nRecords = records.size();
+    ///Keep the load factor under 0.5 so that probing sequences stay short
+    header.nSlots = 16;
+    while ( header.nSlots < 2 * header.nRecords ) {
+        header.nSlots <<= 1;
+    }
+
+    std::vector<IndexSlot> slots(header.nSlots);
+    std::memset( &slots[0], 0, slots.size() * sizeof(IndexSlot) );
+    std::string recordsData;
+    U64 recordsStart = sizeof(IndexHeader) + header.nSlots * sizeof(IndexSlot);
+    U64 mask = header.nSlots - 1;
+    for (std::list<Record>::const_iterator it = records.begin(); it != records.end(); ++it) {
+        U64 i = mixHash(it->hash) & mask;
+        while (slots[i].recordOffset != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i].hash = it->hash;
+        slots[i].recordOffset = recordsStart + recordsData.size();
+
+        IndexRecordHeader rh;
+        std::memset( &rh, 0, sizeof(IndexRecordHeader) );
+        rh.size = it->size;
+        rh.time = it->time;
+        rh.pathLength = it->filePath.size();
+        rh.blobLength = it->blob.size();
+        appendPOD(&recordsData, rh);
+        recordsData.append(it->filePath);
+        recordsData.append(it->blob);
+        header.totalSize += it->size;
+    }
+
+    std::string indexPath = joinPath(directory, NATRON_CACHE_INDEX_FILE_NAME);
+    std::string tmpPath = indexPath + ".tmp";
+    std::FILE* f = std::fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        qDebug() << "Failed to write the cache index " << tmpPath.c_str();
+
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(IndexHeader), 1, f) == 1 &&
+              std::fwrite(&slots[0], sizeof(IndexSlot), slots.size(), f) == slots.size() &&
+              ( recordsData.empty() || std::fwrite(recordsData.data(), 1, recordsData.size(), f) == recordsData.size() );
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok) {
+        std::remove( tmpPath.c_str() );
+
+        return false;
+    }
+#ifdef __NATRON_WIN32__
+    std::remove( indexPath.c_str() );
+#endif
+    if (std::rename( tmpPath.c_str(), indexPath.c_str() ) != 0) {
+        std::remove( tmpPath.c_str() );
+
+        return false;
+    }
+
+    ///The index now contains everything: start a new journal
+    std::FILE* journal = createJournal(joinPath(directory, NATRON_CACHE_JOURNAL_FILE_NAME), cacheVersion);
+    if (journal) {
+        std::fclose(journal);
+    }
+
+    return true;
+}
+
+} // namespace Natron
@@ -0,0 +1,159 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_CACHEINDEX_H_
+#define NATRON_ENGINE_CACHEINDEX_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <string>
+#include <list>
+#include <cstddef>
+
+#include "Global/GlobalDefines.h"
+
+#define NATRON_CACHE_INDEX_FILE_NAME "index." NATRON_CACHE_FILE_EXT
+#define NATRON_CACHE_JOURNAL_FILE_NAME "journal." NATRON_CACHE_FILE_EXT
+
+namespace Natron {
+
+struct CacheIndexPrivate;
+
+/**
+ * @brief The persistent table of contents of a disk cache. It is made of 2 files living in the cache directory:
+ *
+ * - The index: a fixed-layout file written when the application exits cleanly. It starts with a header, followed by an
+ * open-addressing hash table of (hash key, record offset) slots and then by the records themselves. It is memory-mapped
+ * when opened and records are only decoded when the cache looks-up their hash key, so that opening it takes a constant
+ * time regardless of the number of entries.
+ *
+ * - The journal: an append-only log of the entries written to (insert) or removed from (remove) the disk since the
+ * index was written. It is replayed on top of the index when opening, so that the cache survives a crash.
+ *
+ * A record holds the file path of the entry, which identifies it uniquely, its hash key, its size and time and an opaque
+ * blob in which the Cache serializes the key and params of the entry.
+ *
+ * Records which have been handed to the cache with take() are said to be adopted: they are then managed by the cache
+ * like any other entry and the index no longer reports them.
+ *
+ * Thread-safety: all functions are MT-safe.
+ **/
+class CacheIndex
+{
+public:
+
+    struct Record
+    {
+        U64 hash;
+        U64 size; //< size in bytes of the entry data
+        int time;
+        std::string filePath;
+        std::string blob;
+
+        Record()
+        : hash(0)
+        , size(0)
+        , time(0)
+        , filePath()
+        , blob()
+        {
+        }
+    };
+
+    CacheIndex();
+
+    ~CacheIndex();
+
+    /**
+     * @brief Maps the index and replays the journal found in the given directory, then opens the journal to append
+     * new events to it. Returns false if neither files exist or if they were written by a different cacheVersion,
+     * in which case the index is still opened (empty) for journaling.
+     **/
+    bool open(const std::string & directory, unsigned int cacheVersion);
+
+    /**
+     * @brief Closes the index and the journal.
+     **/
+    void close();
+
+    bool isOpened() const;
+
+    /**
+     * @brief Returns true if either the index or the journal exists in the given directory
+     **/
+    static bool existsInDirectory(const std::string & directory);
+
+    /**
+     * @brief Removes from the index all records matching the given hash key that were not adopted yet and returns them.
+     **/
+    void take(U64 hash, std::list<Record>* records);
+
+    /**
+     * @brief Removes from the index any record that was not adopted yet. This is used to evict entries from
+     * the disk cache that were not used since the application started. Returns false if there is no such record left.
+     **/
+    bool takeAny(Record* record);
+
+    /**
+     * @brief Returns the sum of the size of the records not adopted yet
+     **/
+    U64 getNotAdoptedSize() const;
+
+    /**
+     * @brief Appends all the records not adopted yet to the given list.
+     **/
+    void getNotAdopted(std::list<Record>* records) const;
+
+    /**
+     * @brief Appends to the journal that the entry described by the given record has been written to the disk.
+     * The record's blob must contain the serialization of the entry.
+     **/
+    void appendInsert(const Record & record);
+
+    /**
+     * @brief Appends to the journal that the entry with the given hash and file path has been removed from the disk.
+     **/
+    void appendRemove(U64 hash, const std::string & filePath);
+
+    /**
+     * @brief Writes to the journal the events appended since the last call. appendInsert() and appendRemove() are
+     * called while the cache holds the lock of a shard: they only queue the events so that the file I/O happens here,
+     * once the caller has released its locks.
+     * Returns true if the journal grew too much and should be compacted with rewrite(). It returns true only once
+     * until the index is rewritten, so that concurrent callers do not all compact it.
+     **/
+    bool flushJournal();
+
+    /**
+     * @brief To be called before gathering the adopted records passed to rewrite(): the events appended in-between
+     * are written to the new journal so that none of them is lost.
+     **/
+    void beginRewrite();
+
+    /**
+     * @brief Writes a new index file containing the given adopted records and the records not adopted yet, then reopens
+     * it so that journaling goes on. The given records remain adopted. Returns false if the index could not be written,
+     * in which case the previous index and journal are kept.
+     **/
+    bool rewrite(const std::list<Record> & adopted);
+
+    /**
+     * @brief Writes a new index file containing exactly the given records and truncates the journal.
+     * The index file is first written to a temporary file, then renamed, so that a crash never
+     * leaves a partially written index. The index must be closed.
+     **/
+    static bool write(const std::string & directory, unsigned int cacheVersion, const std::list<Record> & records);
+
+private:
+
+    CacheIndexPrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_CACHEINDEX_H_
@@ -182,6 +182,7 @@ KeyFrame::getRightDerivative() const
 Curve::Curve()
     : _imp(new CurvePrivate)
 {
+    _imp->refreshSnapshot();
 }
 
 Curve::Curve(KnobI *owner,int dimensionInOwner)
@@ -265,6 +266,7 @@ Curve::Curve(KnobI *owner,int dimensionInOwner)
         }
     }
     assert(found);
+    _imp->refreshSnapshot();
 }
 
 Curve::Curve(const Curve & other)
@@ -289,6 +291,7 @@ Curve::clearKeyFrames()
     QWriteLocker l(&_imp->_lock);
 
     _imp->keyFrames.clear();
+    _imp->refreshSnapshot();
 }
 
 bool
@@ -307,6 +310,7 @@ Curve::clone(const Curve & other)
 
     _imp->keyFrames.clear();
     std::transform( otherKeys.begin(), otherKeys.end(), std::inserter( _imp->keyFrames, _imp->keyFrames.begin() ), KeyFrameCloner() );
+    _imp->refreshSnapshot();
 }
 
 void
@@ -332,6 +336,7 @@ Curve::clone(const Curve & other,
         }
         _imp->keyFrames.insert(k);
     }
+    _imp->refreshSnapshot();
 }
 
 double
@@ -439,6 +444,7 @@ Curve::removeKeyFrame(KeyFrameSet::const_iterator it)
     if (mustRefreshNext) {
         refreshDerivatives( eCurveChangedReasonDerivativesChanged,find( nextKey.getTime() ) );
     }
+    _imp->refreshSnapshot();
 }
 
 void
@@ -482,6 +488,7 @@ Curve::removeKeyFramesBeforeTime(double time,std::list<int>* keyframeRemoved)
     if (!_imp->keyFrames.empty()) {
         refreshDerivatives(Curve::eCurveChangedReasonKeyframeChanged, _imp->keyFrames.begin());
     }
+    _imp->refreshSnapshot();
 }
 
 void
@@ -502,7 +509,7 @@ Curve::removeKeyFramesAfterTime(double time,std::list<int>* keyframeRemoved)
         --last;
         refreshDerivatives(Curve::eCurveChangedReasonKeyframeChanged, last);
     }
-
+    _imp->refreshSnapshot();
 }
 
 bool
@@ -712,46 +719,231 @@ interParams(const KeyFrameSet &keyFrames,
     }
 }
 
-double
-Curve::getValueAt(double t,bool doClamp) const
+/************************************CURVESNAPSHOT************************************/
+
+CurveSnapshot::CurveSnapshot(const KeyFrameSet & keys,
+                             bool isParametric,
+                             bool canDerive_)
+    : times()
+      , values()
+      , leftDerivatives()
+      , rightDerivatives()
+      , interpolations()
+      , canBake(false)
+      , canDerive(canDerive_)
+      , lookupsCount(0)
+      , bakedTable(0)
 {
-    QReadLocker l(&_imp->_lock);
+    times.reserve( keys.size() );
+    values.reserve( keys.size() );
+    leftDerivatives.reserve( keys.size() );
+    rightDerivatives.reserve( keys.size() );
+    interpolations.reserve( keys.size() );
+    for (KeyFrameSet::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        times.push_back( it->getTime() );
+        values.push_back( it->getValue() );
+        leftDerivatives.push_back( it->getLeftDerivative() );
+        rightDerivatives.push_back( it->getRightDerivative() );
+        interpolations.push_back( it->getInterpolation() );
+    }
 
-    if ( _imp->keyFrames.empty() ) {
-        throw std::runtime_error("Curve has no control points!");
+    ///Parametric curves are not evaluated at frames
+    if ( !isParametric && !times.empty() ) {
+        double span = std::ceil( times.back() ) - std::floor( times.front() );
+        canBake = span * NATRON_CURVE_BAKED_TABLE_SUBFRAMES < NATRON_CURVE_BAKED_TABLE_MAX_SAMPLES;
     }
+}
 
-    // even when there is only one keyframe, there may be tangents!
-    //if (_imp->keyFrames.size() == 1) {
-    //    //if there's only 1 keyframe, don't bother interpolating
-    //    return (*_imp->keyFrames.begin()).getValue();
-    //}
+CurveSnapshot::~CurveSnapshot()
+{
+#if QT_VERSION < 0x050000
+    delete (CurveBakedTable*)bakedTable;
+#else
+    delete bakedTable.load();
+#endif
+}
+
+void
+CurveSnapshot::interParams(double t,
+                           double *tcur,
+                           double *vcur,
+                           double *vcurDerivRight,
+                           Natron::KeyframeTypeEnum *interp,
+                           double *tnext,
+                           double *vnext,
+                           double *vnextDerivLeft,
+                           Natron::KeyframeTypeEnum *interpNext) const
+{
+    ///Same as the interParams function above, on the arrays
+    assert( !times.empty() );
+    // find the first keyframe with time greater than t
+    std::size_t up = std::upper_bound(times.begin(), times.end(), t) - times.begin();
+    if (up == 0) {
+        //if all keys have a greater time
+        // get the first keyframe
+        *tnext = times[0];
+        *vnext = values[0];
+        *vnextDerivLeft = leftDerivatives[0];
+        *interpNext = interpolations[0];
+        *tcur = *tnext - 1.;
+        *vcur = *vnext;
+        *vcurDerivRight = 0.;
+        *interp = Natron::eKeyframeTypeNone;
+    } else if ( up == times.size() ) {
+        //if we found no key that has a greater time
+        // get the last keyframe
+        std::size_t last = times.size() - 1;
+        *tcur = times[last];
+        *vcur = values[last];
+        *vcurDerivRight = rightDerivatives[last];
+        *interp = interpolations[last];
+        *tnext = *tcur + 1.;
+        *vnext = *vcur;
+        *vnextDerivLeft = 0.;
+        *interpNext = Natron::eKeyframeTypeNone;
+    } else {
+        // between two keyframes
+        std::size_t cur = up - 1;
+        *tcur = times[cur];
+        *vcur = values[cur];
+        *vcurDerivRight = rightDerivatives[cur];
+        *interp = interpolations[cur];
+        *tnext = times[up];
+        *vnext = values[up];
+        *vnextDerivLeft = leftDerivatives[up];
+        *interpNext = interpolations[up];
+    }
+}
+
+double
+CurveSnapshot::getValueAt(double t) const
+{
     double tcur,tnext;
     double vcurDerivRight,vnextDerivLeft,vcur,vnext;
     Natron::KeyframeTypeEnum interp,interpNext;
-    KeyFrame k(t,0.);
-    // find the first keyframe with time greater than t
-    KeyFrameSet::const_iterator itup;
-    itup = _imp->keyFrames.upper_bound(k);
-    interParams(_imp->keyFrames,
-                t,
-                itup,
-                &tcur,
-                &vcur,
-                &vcurDerivRight,
-                &interp,
-                &tnext,
-                &vnext,
-                &vnextDerivLeft,
-                &interpNext);
 
-    double v = Natron::interpolate(tcur,vcur,
-                                   vcurDerivRight,
-                                   vnextDerivLeft,
-                                   tnext,vnext,
-                                   t,
-                                   interp,
-                                   interpNext);
+    interParams(t, &tcur, &vcur, &vcurDerivRight, &interp, &tnext, &vnext, &vnextDerivLeft, &interpNext);
+
+    return Natron::interpolate(tcur,vcur,
+                               vcurDerivRight,
+                               vnextDerivLeft,
+                               tnext,vnext,
+                               t,
+                               interp,
+                               interpNext);
+}
+
+double
+CurveSnapshot::getDerivativeAt(double t) const
+{
+    double tcur,tnext;
+    double vcurDerivRight,vnextDerivLeft,vcur,vnext;
+    Natron::KeyframeTypeEnum interp,interpNext;
+
+    interParams(t, &tcur, &vcur, &vcurDerivRight, &interp, &tnext, &vnext, &vnextDerivLeft, &interpNext);
+
+    return Natron::derive(tcur,vcur,
+                          vcurDerivRight,
+                          vnextDerivLeft,
+                          tnext,vnext,
+                          t,
+                          interp,
+                          interpNext);
+}
+
+const CurveBakedTable*
+CurveSnapshot::getBakedTable() const
+{
+#if QT_VERSION < 0x050000
+    CurveBakedTable* table = bakedTable;
+#else
+    CurveBakedTable* table = bakedTable.load();
+#endif
+    if (table || !canBake) {
+        return table;
+    }
+
+    ///Only the thread doing the NATRON_CURVE_LOOKUPS_BEFORE_BAKING-th lookup bakes the table
+    if (lookupsCount.fetchAndAddRelaxed(1) != NATRON_CURVE_LOOKUPS_BEFORE_BAKING - 1) {
+        return 0;
+    }
+
+    table = new CurveBakedTable;
+    table->firstTime = std::floor( times.front() );
+    int samplesCount = (int)( ( std::ceil( times.back() ) - table->firstTime ) * NATRON_CURVE_BAKED_TABLE_SUBFRAMES ) + 1;
+    table->values.resize(samplesCount);
+    if (canDerive) {
+        table->derivatives.resize(samplesCount);
+    }
+    for (int i = 0; i < samplesCount; ++i) {
+        double t = table->firstTime + (double)i / NATRON_CURVE_BAKED_TABLE_SUBFRAMES;
+        table->values[i] = getValueAt(t);
+        if (canDerive) {
+            table->derivatives[i] = getDerivativeAt(t);
+        }
+    }
+    bakedTable.fetchAndStoreOrdered(table);
+
+    return table;
+}
+
+void
+CurvePrivate::refreshSnapshot()
+{
+    if (snapshotRefreshDeferred > 0) {
+        snapshotOutdated = true;
+
+        return;
+    }
+    snapshotOutdated = false;
+
+    CurveSnapshot* newSnapshot = new CurveSnapshot(keyFrames, isParametric, type == eCurveTypeDouble);
+    CurveSnapshot* oldSnapshot = snapshot.fetchAndStoreOrdered(newSnapshot);
+
+    if (oldSnapshot) {
+        QMutexLocker l(&retiredSnapshotsMutex);
+        retiredSnapshots.push_back(oldSnapshot);
+        retiredSnapshotsCount.ref();
+    }
+    reclaimRetiredSnapshots();
+}
+
+void
+CurvePrivate::reclaimRetiredSnapshots() const
+{
+    std::list<CurveSnapshot*> toDelete;
+    {
+        QMutexLocker l(&retiredSnapshotsMutex);
+        ///Threads starting to read after the check can only get the published snapshot
+        if (snapshotReaders.fetchAndAddOrdered(0) != 0) {
+            return;
+        }
+        toDelete.swap(retiredSnapshots);
+        retiredSnapshotsCount.fetchAndStoreOrdered(0);
+    }
+    for (std::list<CurveSnapshot*>::iterator it = toDelete.begin(); it != toDelete.end(); ++it) {
+        delete *it;
+    }
+}
+
+double
+Curve::getValueAt(double t,bool doClamp) const
+{
+    ///Lock-free: this is called very often by render threads
+    CurveSnapshotReader snapshot(*_imp);
+
+    if ( snapshot->times.empty() ) {
+        throw std::runtime_error("Curve has no control points!");
+    }
+
+    double v;
+    const CurveBakedTable* table = snapshot->getBakedTable();
+    int sample = table ? table->sampleIndex(t) : -1;
+    if (sample != -1) {
+        v = table->values[sample];
+    } else {
+        v = snapshot->getValueAt(t);
+    }
 
     if ( doClamp && mustClamp() ) {
         v = clampValueToCurveYRange(v);
@@ -777,57 +969,29 @@ Curve::getValueAt(double t,bool doClamp) const
 double
 Curve::getDerivativeAt(double t) const
 {
-    QReadLocker l(&_imp->_lock);
+    CurveSnapshotReader snapshot(*_imp);
 
-    if ( _imp->keyFrames.empty() ) {
+    if ( snapshot->times.empty() ) {
         throw std::runtime_error("Curve has no control points!");
     }
     assert(_imp->type == CurvePrivate::eCurveTypeDouble); // only real-valued curves can be derived
 
-    // even when there is only one keyframe, there may be tangents!
-    //if (_imp->keyFrames.size() == 1) {
-    //    //if there's only 1 keyframe, don't bother interpolating
-    //    return (*_imp->keyFrames.begin()).getValue();
-    //}
-    double tcur,tnext;
-    double vcurDerivRight,vnextDerivLeft,vcur,vnext;
-    Natron::KeyframeTypeEnum interp,interpNext;
-    KeyFrame k(t,0.);
-    // find the first keyframe with time greater than t
-    KeyFrameSet::const_iterator itup;
-    itup = _imp->keyFrames.upper_bound(k);
-    interParams(_imp->keyFrames,
-                t,
-                itup,
-                &tcur,
-                &vcur,
-                &vcurDerivRight,
-                &interp,
-                &tnext,
-                &vnext,
-                &vnextDerivLeft,
-                &interpNext);
-
     double d;
+    const CurveBakedTable* table = snapshot->getBakedTable();
+    int sample = table && !table->derivatives.empty() ? table->sampleIndex(t) : -1;
+    if (sample != -1) {
+        d = table->derivatives[sample];
+    } else {
+        d = snapshot->getDerivativeAt(t);
+    }
 
     if ( mustClamp() ) {
-        std::pair<double,double> minmax = getCurveYRange();
-        d = Natron::derive_clamp(tcur,vcur,
-                                 vcurDerivRight,
-                                 vnextDerivLeft,
-                                 tnext,vnext,
-                                 t,
-                                 minmax.first, minmax.second,
-                                 interp,
-                                 interpNext);
-    } else {
-        d = Natron::derive(tcur,vcur,
-                           vcurDerivRight,
-                           vnextDerivLeft,
-                           tnext,vnext,
-                           t,
-                           interp,
-                           interpNext);
+        ///Same as Natron::derive_clamp: the function is clamped at t, the derivative is 0
+        std::pair<double,double> minmax = getCurveYRange_internal();
+        double v = sample != -1 ? table->values[sample] : snapshot->getValueAt(t);
+        if ( (v <= minmax.first) || (v >= minmax.second) ) {
+            d = 0.;
+        }
     }
 
     return d;
@@ -944,6 +1108,13 @@ std::pair<double,double>  Curve::getCurveYRange() const
 {
     QReadLocker l(&_imp->_lock);
 
+    return getCurveYRange_internal();
+}
+
+std::pair<double,double>
+Curve::getCurveYRange_internal() const
+{
+    // PRIVATE - should not lock
     if ( !mustClamp() ) {
         throw std::logic_error("Curve::getCurveYRange() called for a curve without owner or Y range");
     }
@@ -974,7 +1145,7 @@ Curve::clampValueToCurveYRange(double v) const
 {
     // PRIVATE - should not lock
     ////clamp to min/max if the owner of the curve is a Double or Int knob.
-    std::pair<double,double> minmax = getCurveYRange();
+    std::pair<double,double> minmax = getCurveYRange_internal();
 
     if (v > minmax.second) {
         return minmax.second;
@@ -1193,9 +1364,8 @@ Curve::setCurveInterpolation(Natron::KeyframeTypeEnum interp)
                ( _imp->type == CurvePrivate::eCurveTypeIntConstantInterp) ) && ( interp != Natron::eKeyframeTypeConstant) ) {
             return;
         }
-        for (int i = 0; i < (int)_imp->keyFrames.size(); ++i) {
-            KeyFrameSet::iterator it = _imp->keyFrames.begin();
-            std::advance(it, i);
+        CurveSnapshotBatch batch(*_imp);
+        for (KeyFrameSet::iterator it = _imp->keyFrames.begin(); it != _imp->keyFrames.end(); ++it) {
             if ( interp != it->getInterpolation() ) {
                 it = setKeyframeInterpolation_internal(it, interp);
             }
@@ -1334,6 +1504,8 @@ Curve::evaluateCurveChanged(CurveChangedReasonEnum reason,
             next = refreshDerivatives(eCurveChangedReasonDerivativesChanged,next);
         }
     }
+    ///This invalidates the baked table of the previous snapshot
+    _imp->refreshSnapshot();
 
     return key;
 }
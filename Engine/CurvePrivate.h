@@ -18,7 +18,12 @@
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
 #endif
+#include <list>
+#include <vector>
 #include <QReadWriteLock>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
 
 #include "Engine/Rect.h"
 #include "Engine/Variant.h"
@@ -26,10 +31,96 @@
 #include "Engine/KnobTypes.h"
 #include "Engine/KnobFile.h"
 
+///Number of samples per frame in the baked table of a curve: values are baked every 0.25 frame
+#define NATRON_CURVE_BAKED_TABLE_SUBFRAMES 4
+
+///Curves spanning more frames than what fits in this number of samples are never baked
+#define NATRON_CURVE_BAKED_TABLE_MAX_SAMPLES 16384
+
+///The table is baked once a snapshot has been read this number of times, so that curves being edited
+///interactively (e.g: while dragging a keyframe) are not baked after each modification
+#define NATRON_CURVE_LOOKUPS_BEFORE_BAKING 64
+
 class Curve;
 class KeyFrame;
 class KnobI;
 
+/**
+ * @brief The values and derivatives of a curve sampled at regular times, starting at firstTime.
+ **/
+struct CurveBakedTable
+{
+    double firstTime;
+    std::vector<double> values;
+    std::vector<double> derivatives; //< empty if the curve cannot be derived
+
+    CurveBakedTable()
+        : firstTime(0.)
+          , values()
+          , derivatives()
+    {
+    }
+
+    ///Returns the index of the sample at time t or -1 if t was not baked
+    int sampleIndex(double t) const
+    {
+        double x = (t - firstTime) * NATRON_CURVE_BAKED_TABLE_SUBFRAMES;
+
+        if ( (x < 0.) || ( x >= (double)values.size() ) ) {
+            return -1;
+        }
+        int i = (int)x;
+
+        return (double)i == x ? i : -1;
+    }
+};
+
+/**
+ * @brief An immutable copy of the keyframes of a curve, stored in arrays. getValueAt() and getDerivativeAt()
+ * read the current snapshot without taking the curve lock. A new snapshot is published whenever the keyframes change.
+ **/
+struct CurveSnapshot
+{
+    std::vector<double> times;
+    std::vector<double> values;
+    std::vector<double> leftDerivatives;
+    std::vector<double> rightDerivatives;
+    std::vector<Natron::KeyframeTypeEnum> interpolations;
+    bool canBake;
+    bool canDerive;
+
+    ///Number of lookups of this snapshot, see NATRON_CURVE_LOOKUPS_BEFORE_BAKING
+    mutable QAtomicInt lookupsCount;
+
+    ///NULL until the table is baked
+    mutable QAtomicPointer<CurveBakedTable> bakedTable;
+
+    CurveSnapshot(const KeyFrameSet & keys,
+                  bool isParametric,
+                  bool canDerive);
+
+    ~CurveSnapshot();
+
+    ///Same as the Curve functions, without clamping
+    double getValueAt(double t) const;
+    double getDerivativeAt(double t) const;
+
+    ///Returns NULL if the table is not baked (yet)
+    const CurveBakedTable* getBakedTable() const;
+
+private:
+
+    void interParams(double t,
+                     double *tcur,
+                     double *vcur,
+                     double *vcurDerivRight,
+                     Natron::KeyframeTypeEnum *interp,
+                     double *tnext,
+                     double *vnext,
+                     double *vnextDerivLeft,
+                     Natron::KeyframeTypeEnum *interpNext) const;
+};
+
 struct CurvePrivate
 {
     enum CurveTypeEnum
@@ -52,6 +143,21 @@ struct CurvePrivate
     bool hasYRange;
     mutable QReadWriteLock _lock; //< the plug-ins can call getValueAt at any moment and we must make sure the user is not playing around
 
+    ///The snapshot of keyFrames read by getValueAt(), never NULL. It is replaced under the write lock.
+    QAtomicPointer<CurveSnapshot> snapshot;
+
+    ///The number of threads currently reading a snapshot. Replaced snapshots are deleted when it is 0.
+    mutable QAtomicInt snapshotReaders;
+
+    ///Replaced snapshots which may still be read. They are deleted by the last reader leaving or by the next replacement.
+    mutable QMutex retiredSnapshotsMutex;
+    mutable std::list<CurveSnapshot*> retiredSnapshots;
+    mutable QAtomicInt retiredSnapshotsCount;
+
+    ///While > 0, refreshSnapshot() only marks the snapshot as outdated, see CurveSnapshotBatch. Protected by _lock.
+    int snapshotRefreshDeferred;
+    bool snapshotOutdated;
+
 
     CurvePrivate()
         : keyFrames()
@@ -65,15 +171,57 @@ struct CurvePrivate
           , yMax(INT_MAX)
           , hasYRange(false)
           , _lock(QReadWriteLock::Recursive)
+          , snapshot(0)
+          , snapshotReaders(0)
+          , retiredSnapshotsMutex()
+          , retiredSnapshots()
+          , retiredSnapshotsCount(0)
+          , snapshotRefreshDeferred(0)
+          , snapshotOutdated(false)
     {
     }
 
     CurvePrivate(const CurvePrivate & other)
         : _lock(QReadWriteLock::Recursive)
+          , snapshot(0)
+          , snapshotReaders(0)
+          , retiredSnapshotsMutex()
+          , retiredSnapshots()
+          , retiredSnapshotsCount(0)
+          , snapshotRefreshDeferred(0)
+          , snapshotOutdated(false)
     {
         *this = other;
     }
 
+    ~CurvePrivate()
+    {
+        delete loadSnapshot();
+        for (std::list<CurveSnapshot*>::iterator it = retiredSnapshots.begin(); it != retiredSnapshots.end(); ++it) {
+            delete *it;
+        }
+    }
+
+    CurveSnapshot* loadSnapshot() const
+    {
+#if QT_VERSION < 0x050000
+        return snapshot;
+#else
+        return snapshot.load();
+#endif
+    }
+
+    /**
+     * @brief Publishes a new snapshot of keyFrames. Must be called with the write lock held, after each change of keyFrames.
+     * Within a CurveSnapshotBatch, the snapshot is only published when the batch ends.
+     **/
+    void refreshSnapshot();
+
+    /**
+     * @brief Deletes the retired snapshots if no thread is reading a snapshot. Called from any thread.
+     **/
+    void reclaimRetiredSnapshots() const;
+
     void operator=(const CurvePrivate & other)
     {
         keyFrames = other.keyFrames;
@@ -86,7 +234,70 @@ struct CurvePrivate
         yMin = other.yMin;
         yMax = other.yMax;
         hasYRange = other.hasYRange;
+        refreshSnapshot();
+    }
+};
+
+/**
+ * @brief Publishes a single snapshot for all the changes made to the keyframes during the lifetime of the object,
+ * instead of one per keyframe. The write lock must be held for the whole lifetime of the object.
+ **/
+class CurveSnapshotBatch
+{
+public:
+
+    CurveSnapshotBatch(CurvePrivate & curve)
+        : _curve(curve)
+    {
+        ++_curve.snapshotRefreshDeferred;
     }
+
+    ~CurveSnapshotBatch()
+    {
+        if ( (--_curve.snapshotRefreshDeferred == 0) && _curve.snapshotOutdated ) {
+            _curve.refreshSnapshot();
+        }
+    }
+
+private:
+
+    CurvePrivate & _curve;
+};
+
+/**
+ * @brief Holds the current snapshot of a curve for the duration of a lookup.
+ **/
+class CurveSnapshotReader
+{
+public:
+
+    CurveSnapshotReader(const CurvePrivate & curve)
+        : _curve(curve)
+          , _snapshot(0)
+    {
+        ///Register as a reader before loading the pointer, so that refreshSnapshot() cannot delete it
+        _curve.snapshotReaders.ref();
+        _snapshot = _curve.loadSnapshot();
+        assert(_snapshot);
+    }
+
+    ~CurveSnapshotReader()
+    {
+        ///The last reader to leave deletes the snapshots replaced while it was reading
+        if ( !_curve.snapshotReaders.deref() && (_curve.retiredSnapshotsCount.fetchAndAddOrdered(0) > 0) ) {
+            _curve.reclaimRetiredSnapshots();
+        }
+    }
+
+    const CurveSnapshot* operator->() const
+    {
+        return _snapshot;
+    }
+
+private:
+
+    const CurvePrivate & _curve;
+    const CurveSnapshot* _snapshot;
 };
 
 
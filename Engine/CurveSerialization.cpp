@@ -10,6 +10,13 @@
 
 #include "CurveSerialization.h"
 
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+CLANG_DIAG_OFF(unused-parameter)
+#include <boost/archive/binary_iarchive.hpp>
+CLANG_DIAG_ON(unused-parameter)
+#include <boost/archive/binary_oarchive.hpp>
+#endif
+
 // explicit template instantiations
 
 
@@ -17,3 +24,7 @@ template void Curve::serialize<boost::archive::xml_iarchive>(boost::archive::xml
                                                              const unsigned int file_version);
 template void Curve::serialize<boost::archive::xml_oarchive>(boost::archive::xml_oarchive & ar,
                                                              const unsigned int file_version);
+template void Curve::serialize<boost::archive::binary_iarchive>(boost::archive::binary_iarchive & ar,
+                                                                const unsigned int file_version);
+template void Curve::serialize<boost::archive::binary_oarchive>(boost::archive::binary_oarchive & ar,
+                                                                const unsigned int file_version);
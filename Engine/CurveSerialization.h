@@ -37,8 +37,15 @@ void
 Curve::serialize(Archive & ar,
                  const unsigned int /*version*/)
 {
-    QReadLocker l(&_imp->_lock);
-    ar & boost::serialization::make_nvp("KeyFrameSet",_imp->keyFrames);
+    if (Archive::is_loading::value) {
+        ///Loading replaces the keyframes and publishes a new snapshot: this is a write
+        QWriteLocker l(&_imp->_lock);
+        ar & boost::serialization::make_nvp("KeyFrameSet",_imp->keyFrames);
+        _imp->refreshSnapshot();
+    } else {
+        QReadLocker l(&_imp->_lock);
+        ar & boost::serialization::make_nvp("KeyFrameSet",_imp->keyFrames);
+    }
 }
 
 #endif // NATRON_ENGINE_CURVESERIALIZATION_H_
@@ -0,0 +1,258 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "DedicatedThreadPool.h"
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
+
+using namespace Natron;
+
+namespace {
+
+/**
+ * @brief A call of DedicatedThreadPool::run()
+ **/
+struct Job
+{
+    const DedicatedThreadPool::IndexFunction* func;
+    int n;
+    QAtomicInt nextIndex; //< the next index to hand out
+    QMutex mutex; //< protects runningThreads and failed
+    QWaitCondition doneCond;
+    int runningThreads; //< number of threads working on the job
+    bool failed;
+
+    Job(const DedicatedThreadPool::IndexFunction* func,
+        int n,
+        int runningThreads)
+    : func(func)
+    , n(n)
+    , nextIndex()
+    , mutex()
+    , doneCond()
+    , runningThreads(runningThreads)
+    , failed(false)
+    {
+    }
+};
+
+class Worker;
+
+} // anon namespace
+
+struct Natron::DedicatedThreadPoolPrivate
+{
+    mutable QMutex poolMutex; //< protects workers, idleWorkers, the jobs of the workers and quit
+    std::vector<Worker*> workers;
+
+    ///The parked workers. The last one to be parked is the first one to be woken up, so that a plug-in calling
+    ///multiThread repeatedly keeps running on the same threads.
+    std::vector<Worker*> idleWorkers;
+    QAtomicInt activeThreads;
+    bool quit;
+
+    DedicatedThreadPoolPrivate()
+    : poolMutex()
+    , workers()
+    , idleWorkers()
+    , activeThreads()
+    , quit(false)
+    {
+    }
+
+    ///Parks worker after it finished working on job, then tells the waiting thread if job is done
+    void onJobFinished(Worker* worker, Job* job, bool failed);
+};
+
+namespace {
+
+class Worker
+    : public QThread
+{
+    DedicatedThreadPoolPrivate* _pool;
+    int _index;
+
+public:
+
+    ///Protected by the poolMutex
+    Job* job;
+    QWaitCondition wakeUpCond;
+
+    Worker(DedicatedThreadPoolPrivate* pool,
+           int index)
+    : QThread()
+    , _pool(pool)
+    , _index(index)
+    , job(0)
+    , wakeUpCond()
+    {
+    }
+
+    DedicatedThreadPoolPrivate* getPool() const
+    {
+        return _pool;
+    }
+
+    int getIndex() const
+    {
+        return _index;
+    }
+
+private:
+
+    virtual void run() OVERRIDE
+    {
+        for (;;) {
+            Job* current;
+            {
+                QMutexLocker l(&_pool->poolMutex);
+                while (!job && !_pool->quit) {
+                    wakeUpCond.wait(&_pool->poolMutex);
+                }
+                if (!job) {
+                    return;
+                }
+                current = job;
+            }
+
+            bool failed = false;
+            for (;;) {
+                int i = current->nextIndex.fetchAndAddOrdered(1);
+                if (i >= current->n) {
+                    break;
+                }
+                try {
+                    (*current->func)(i);
+                } catch (...) {
+                    failed = true;
+                }
+            }
+            _pool->onJobFinished(this, current, failed);
+        }
+    }
+};
+
+} // anon namespace
+
+void
+DedicatedThreadPoolPrivate::onJobFinished(Worker* worker,
+                                          Job* job,
+                                          bool failed)
+{
+    {
+        QMutexLocker l(&poolMutex);
+        assert(worker->job == job);
+        worker->job = 0;
+        idleWorkers.push_back(worker);
+        activeThreads.fetchAndAddOrdered(-1);
+    }
+
+    ///The waiting thread destroys the job as soon as it sees runningThreads == 0, so it must not be accessed after the mutex is released
+    QMutexLocker l(&job->mutex);
+    if (failed) {
+        job->failed = true;
+    }
+    if (--job->runningThreads == 0) {
+        job->doneCond.wakeAll();
+    }
+}
+
+DedicatedThreadPool::DedicatedThreadPool()
+: _imp( new DedicatedThreadPoolPrivate() )
+{
+}
+
+DedicatedThreadPool::~DedicatedThreadPool()
+{
+    {
+        QMutexLocker l(&_imp->poolMutex);
+        assert( _imp->idleWorkers.size() == _imp->workers.size() );
+        _imp->quit = true;
+        for (std::size_t i = 0; i < _imp->workers.size(); ++i) {
+            _imp->workers[i]->wakeUpCond.wakeOne();
+        }
+    }
+    for (std::size_t i = 0; i < _imp->workers.size(); ++i) {
+        _imp->workers[i]->wait();
+        delete _imp->workers[i];
+    }
+    delete _imp;
+}
+
+bool
+DedicatedThreadPool::run(int n,
+                         int maxConcurrentThreads,
+                         const IndexFunction & func)
+{
+    if (n <= 0) {
+        return true;
+    }
+
+    int nThreads = std::max( 1, std::min(n, maxConcurrentThreads) );
+    Job job(&func, n, nThreads);
+    {
+        QMutexLocker l(&_imp->poolMutex);
+        for (int i = 0; i < nThreads; ++i) {
+            Worker* worker;
+            if ( !_imp->idleWorkers.empty() ) {
+                worker = _imp->idleWorkers.back();
+                _imp->idleWorkers.pop_back();
+                worker->job = &job;
+                worker->wakeUpCond.wakeOne();
+            } else {
+                worker = new Worker( _imp, (int)_imp->workers.size() );
+                _imp->workers.push_back(worker);
+                worker->job = &job;
+                worker->start();
+            }
+            _imp->activeThreads.fetchAndAddOrdered(1);
+        }
+    }
+
+    QMutexLocker l(&job.mutex);
+    while (job.runningThreads > 0) {
+        job.doneCond.wait(&job.mutex);
+    }
+
+    return !job.failed;
+}
+
+int
+DedicatedThreadPool::getActiveThreadCount() const
+{
+    return (int)_imp->activeThreads;
+}
+
+int
+DedicatedThreadPool::getIdleThreadCount() const
+{
+    QMutexLocker l(&_imp->poolMutex);
+
+    return (int)_imp->idleWorkers.size();
+}
+
+int
+DedicatedThreadPool::getCurrentThreadIndex() const
+{
+    Worker* worker = dynamic_cast<Worker*>( QThread::currentThread() );
+
+    if ( worker && (worker->getPool() == _imp) ) {
+        return worker->getIndex();
+    }
+
+    return -1;
+}
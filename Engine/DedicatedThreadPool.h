@@ -0,0 +1,80 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_DEDICATEDTHREADPOOL_H_
+#define NATRON_ENGINE_DEDICATEDTHREADPOOL_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#ifndef Q_MOC_RUN
+#include <boost/function.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+
+namespace Natron {
+
+struct DedicatedThreadPoolPrivate;
+
+/**
+ * @brief A pool of threads dedicated to the OpenFX multi-thread suite, used when the effects do not run their
+ * multi-thread functions on the render thread pool (see AppManager::getUseThreadPool()): some plug-ins misbehave when
+ * their functions run on threads which also run the tasks of the renderer.
+ *
+ * The threads are created on demand and are parked between two calls of run() instead of being created and destroyed
+ * by each call. A thread keeps its identity, and its index in the pool (see getCurrentThreadIndex()), for the lifetime
+ * of the pool. The indexes of a call are handed out dynamically: a thread which is done with an index takes the next
+ * one, so that a slow index does not hold back the others.
+ *
+ * Thread-safety: all functions are MT-safe.
+ **/
+class DedicatedThreadPool
+{
+public:
+
+    typedef boost::function<void (int)> IndexFunction;
+
+    DedicatedThreadPool();
+
+    /**
+     * @brief Stops the threads of the pool. No call of run() may be running.
+     **/
+    ~DedicatedThreadPool();
+
+    /**
+     * @brief Calls func(i) for each i in [0, n) on at most maxConcurrentThreads threads of the pool, and returns
+     * when all the calls are done. The calling thread does not run any index, it waits.
+     * Returns false if any of the calls threw an exception.
+     **/
+    bool run(int n,
+             int maxConcurrentThreads,
+             const IndexFunction & func);
+
+    /**
+     * @brief Returns the number of threads of the pool which are running a call of run().
+     **/
+    int getActiveThreadCount() const;
+
+    /**
+     * @brief Returns the number of threads of the pool which are parked.
+     **/
+    int getIdleThreadCount() const;
+
+    /**
+     * @brief Returns the index in the pool of the calling thread, or -1 if it is not a thread of this pool.
+     **/
+    int getCurrentThreadIndex() const;
+
+private:
+
+    DedicatedThreadPoolPrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_DEDICATEDTHREADPOOL_H_
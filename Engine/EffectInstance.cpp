@@ -17,7 +17,6 @@
 
 #include <map>
 #include <sstream>
-#include <QtConcurrentMap>
 #include <QReadWriteLock>
 #include <QCoreApplication>
 #include <QtConcurrentRun>
@@ -45,6 +44,8 @@
 #include "Engine/ThreadStorage.h"
 #include "Engine/Settings.h"
 #include "Engine/RotoContext.h"
+#include "Engine/RenderThreadPool.h"
+#include "Engine/Profiler.h"
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/Transform.h"
 #include "Engine/DiskCacheNode.h"
@@ -420,7 +421,8 @@ struct EffectInstance::Implementation
         img->getRestToRender_trimap(roi,restToRender, &isBeingRenderedElseWhere);
         
         bool ab = _publicInterface->aborted();
-        {
+        if (isBeingRenderedElseWhere) {
+            ProfilerScope profile(_publicInterface, kProfilerActionWaitImage);
             QMutexLocker kk(&ibr->lock);
             while (!ab && isBeingRenderedElseWhere && !ibr->renderFailed) {
                 ibr->cond.wait(&ibr->lock);
@@ -687,7 +689,11 @@ void
 EffectInstance::lock(const boost::shared_ptr<Natron::Image>& entry)
 {
     boost::shared_ptr<Node> n = _node.lock();
-    n->lock(entry);
+    if ( !n->tryLock(entry) ) {
+        ///The image is being rendered by another thread
+        ProfilerScope profile(this, kProfilerActionWaitImage);
+        n->lock(entry);
+    }
 }
 
 
@@ -734,7 +740,8 @@ EffectInstance::setParallelRenderArgs(int time,
                                       U64 nodeHash,
                                       U64 rotoAge,
                                       bool canSetValue,
-                                      const TimeLine* timeline)
+                                      const TimeLine* timeline,
+                                      const QAtomicInt* backgroundAbort)
 {
     ParallelRenderArgs& args = _imp->frameRenderArgs.localData();
     args.canSetValue = canSetValue;
@@ -748,6 +755,7 @@ EffectInstance::setParallelRenderArgs(int time,
     args.rotoAge = rotoAge;
     
     args.canAbort = canAbort;
+    args.backgroundAbort = backgroundAbort;
     
     ++args.validArgs;
     
@@ -829,6 +837,9 @@ EffectInstance::aborted() const
                     return ret;
                 }
                 
+            } else if (args.backgroundAbort) {
+                ///Background caching of the viewer, aborted by any user interaction
+                return (int)*args.backgroundAbort != 0 || !getNode()->isActivated();
             } else {
                 ///Rendering is playback or render on disk, we rely on the _imp->renderAborted flag for this.
 
@@ -1516,9 +1527,14 @@ EffectInstance::getImageFromCacheAndConvertIfNeeded(bool useCache,
             }
         }
     }
+    bool isFromInputImages = isCached;
     
     if (!isCached) {
+        ProfilerScope profile(this, kProfilerActionCacheMiss);
         isCached = !useDiskCache ? Natron::getImageFromCache(key,&cachedImages) : Natron::getImageFromDiskCache(key, &cachedImages);
+        if (isCached) {
+            profile.setAction(kProfilerActionCacheHit);
+        }
     }
     
     if (isCached) {
@@ -1543,10 +1559,14 @@ EffectInstance::getImageFromCacheAndConvertIfNeeded(bool useCache,
                 }
             }
             
-            ///Throw away images that are not even what the node want to render
+            ///Throw away images that are not even what the node want to render.
+            ///Images given by the caller that were already converted to the requested format (e.g: the input of
+            ///a sequential writer converted by the render threads) are used as is.
             if (imgComps != nodePrefComps || imgDepth != nodePrefDepth) {
-                appPTR->removeFromNodeCache(*it);
-                continue;
+                if (!isFromInputImages || imgComps != components || imgDepth != bitdepth) {
+                    appPTR->removeFromNodeCache(*it);
+                    continue;
+                }
             }
             
             if (imgMMlevel == mipMapLevel && Image::hasEnoughDataToConvert(imgComps,components) &&
@@ -1628,6 +1648,7 @@ EffectInstance::getImageFromCacheAndConvertIfNeeded(bool useCache,
                 } else {
                     img.reset(new Image(key, imageParams));
                 }
+                ProfilerScope profile(this, kProfilerActionConvert);
                 imageToConvert->downscaleMipMap(imageToConvert->getBounds(),
                                                 imageToConvert->getMipMapLevel(), img->getMipMapLevel() ,
                                                 useCache && imageToConvert->usesBitMap(),
@@ -1806,7 +1827,7 @@ public:
 boost::shared_ptr<Natron::Image>
 EffectInstance::renderRoI(const RenderRoIArgs & args)
 {
-   
+    ProfilerScope profile(this, kProfilerActionRenderRoI);
     ParallelRenderArgs& frameRenderArgs = _imp->frameRenderArgs.localData();
     if (!frameRenderArgs.validArgs) {
         qDebug() << "Thread-storage for the render of the frame was not set, this is a bug.";
@@ -2406,6 +2427,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args)
             RectI bounds;
             rod.toPixelEnclosing(args.mipMapLevel, par, &bounds);
             downscaledImage.reset( new Natron::Image(outputComponents, rod, downscaledImageBounds, args.mipMapLevel, image->getPixelAspectRatio(), outputDepth, true) );
+            ProfilerScope profile(this, kProfilerActionConvert);
             image->downscaleMipMap(image->getBounds(), 0, args.mipMapLevel, true, downscaledImage.get());
         }
     }
@@ -2505,6 +2527,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args)
     if (renderRetCode != eRenderRoIStatusRenderFailed && renderFullScaleThenDownscale && renderScaleOneUpstreamIfRenderScaleSupportDisabled) {
         assert(image->getMipMapLevel() == 0);
         roi.intersect(image->getBounds(), &roi);
+        ProfilerScope profile(this, kProfilerActionConvert);
         image->downscaleMipMap(roi, 0, args.mipMapLevel, false, downscaledImage.get());
     }
     
@@ -2516,6 +2539,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args)
         boost::shared_ptr<Image> tmp( new Image(args.components, rod, downscaledImage->getBounds(), mipMapLevel,downscaledImage->getPixelAspectRatio(), args.bitdepth, false) );
         
         bool unPremultIfNeeded = getOutputPremultiplication() == eImagePremultiplicationPremultiplied;
+        ProfilerScope profile(this, kProfilerActionConvert);
         downscaledImage->convertToFormat(downscaledImage->getBounds(),
                                getApp()->getDefaultColorSpaceForBitDepth(downscaledImage->getBitDepth()),
                                getApp()->getDefaultColorSpaceForBitDepth(args.bitdepth),
@@ -2940,9 +2964,9 @@ EffectInstance::renderRoIInternal(SequenceTime time,
             ///If the plug-in is eRenderSafetyFullySafeFrame that means it wants the host to perform SMP aka slice up the RoI into chunks
             ///but if the effect doesn't support tiles it won't work.
             ///Also check that the number of threads indicating by the settings are appropriate for this render mode.
+            ///Nested host frame threading does not oversubscribe the render thread pool: there is no need to check how busy it is.
             if ( !tilesSupported || (nbThreads == -1) || (nbThreads == 1) ||
-                ( (nbThreads == 0) && (appPTR->getHardwareIdealThreadCount() == 1) ) ||
-                 ( QThreadPool::globalInstance()->activeThreadCount() >= QThreadPool::globalInstance()->maxThreadCount() ) ) {
+                ( (nbThreads == 0) && (appPTR->getHardwareIdealThreadCount() == 1) ) ) {
                 safety = eRenderSafetyFullySafe;
             } else {
                 if ( !getApp()->getProject()->tryLock() ) {
@@ -2960,9 +2984,10 @@ EffectInstance::renderRoIInternal(SequenceTime time,
         case eRenderSafetyFullySafeFrame: {     // the plugin will not perform any per frame SMP threading
             // we can split the frame in tiles and do per frame SMP threading (see kOfxImageEffectPluginPropHostFrameThreading)
             if (nbThreads == 0) {
-                nbThreads = QThreadPool::globalInstance()->maxThreadCount();
+                nbThreads = appPTR->getRenderThreadPool()->getMaxThreadCount();
             }
-            std::vector<RectI> splitRects = downscaledRectToRender.splitIntoSmallerRects(nbThreads);
+            ///Split in more tiles than threads so that the threads done first steal the remaining tiles
+            std::vector<RectI> splitRects = downscaledRectToRender.splitIntoSmallerRects(nbThreads * NATRON_RENDER_TILES_PER_THREAD);
             
             TiledRenderingFunctorArgs tiledArgs;
             tiledArgs.args = &args;
@@ -2976,8 +3001,8 @@ EffectInstance::renderRoIInternal(SequenceTime time,
             tiledArgs.par = par;
             tiledArgs.renderFullScaleThenDownscale = renderFullScaleThenDownscale;
 //#define NATRON_HOSTFRAMETHREADING_SEQUENTIAL // sequential execution of host threading
-#ifdef NATRON_HOSTFRAMETHREADING_SEQUENTIAL
             std::vector<EffectInstance::RenderingFunctorRetEnum> ret(splitRects.size());
+#ifdef NATRON_HOSTFRAMETHREADING_SEQUENTIAL
             for (size_t i = 0; i < splitRects.size(); ++i) {
                 ret[i] = tiledRenderingFunctor(tiledArgs,
                                                frameArgs,
@@ -2986,14 +3011,15 @@ EffectInstance::renderRoIInternal(SequenceTime time,
             }
 #else
             // the bitmap is checked again at the beginning of EffectInstance::tiledRenderingFunctor()
-            QFuture<EffectInstance::RenderingFunctorRetEnum> ret = QtConcurrent::mapped( splitRects,
-                                                                                    boost::bind(&EffectInstance::tiledRenderingFunctor,
-                                                                                                this,
-                                                                                                tiledArgs,
-                                                                                                frameArgs,
-                                                                                                true,
-                                                                                                _1) );
-            ret.waitForFinished();
+            // A tile that throws is left to eRenderingFunctorRetFailed
+            appPTR->getRenderThreadPool()->mapped( splitRects,
+                                                   boost::bind(&EffectInstance::tiledRenderingFunctor,
+                                                               this,
+                                                               tiledArgs,
+                                                               frameArgs,
+                                                               true,
+                                                               _1),
+                                                   &ret );
 #endif
             ///never call endsequence render here if the render is sequential
 
@@ -3008,11 +3034,7 @@ EffectInstance::renderRoIInternal(SequenceTime time,
                 }
             }
             
-#ifdef NATRON_HOSTFRAMETHREADING_SEQUENTIAL
             std::vector<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
-#else
-            QFuture<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
-#endif
             for (it2 = ret.begin(); it2 != ret.end(); ++it2) {
                 if ( (*it2) == EffectInstance::eRenderingFunctorRetFailed ) {
                     renderStatus = eStatusFailed;
@@ -3104,19 +3126,35 @@ EffectInstance::tiledRenderingFunctor(const TiledRenderingFunctorArgs& args,
                                      bool setThreadLocalStorage,
                                      const RectI & downscaledRectToRender )
 {
-    return tiledRenderingFunctor(*args.args,
-                                 frameArgs,
-                                 args.inputImages,
-                                 setThreadLocalStorage,
-                                 args.renderFullScaleThenDownscale,
-                                 args.renderUseScaleOneInputs,
-                                 args.isSequentialRender,
-                                 args.isRenderResponseToUserInteraction,
-                                 downscaledRectToRender,
-                                 args.par,
-                                 args.downscaledImage,
-                                 args.fullScaleImage,
-                                 args.renderMappedImage);
+    ///The thread which started the host frame threading renders tiles too. The tile sets up and then invalidates
+    ///the thread-local render args and input images, so those of the calling thread are restored afterwards.
+    bool restoreCallerStorage = _imp->renderArgs.hasLocalData() && _imp->renderArgs.localData()._validArgs;
+    RenderArgs callerArgs;
+    std::list<boost::shared_ptr<Natron::Image> > callerInputImages;
+    if (restoreCallerStorage) {
+        callerArgs = _imp->renderArgs.localData();
+        callerInputImages = _imp->inputImages.localData();
+    }
+
+    RenderingFunctorRetEnum ret = tiledRenderingFunctor(*args.args,
+                                                        frameArgs,
+                                                        args.inputImages,
+                                                        setThreadLocalStorage,
+                                                        args.renderFullScaleThenDownscale,
+                                                        args.renderUseScaleOneInputs,
+                                                        args.isSequentialRender,
+                                                        args.isRenderResponseToUserInteraction,
+                                                        downscaledRectToRender,
+                                                        args.par,
+                                                        args.downscaledImage,
+                                                        args.fullScaleImage,
+                                                        args.renderMappedImage);
+    if (restoreCallerStorage) {
+        _imp->renderArgs.localData() = callerArgs;
+        _imp->inputImages.localData() = callerInputImages;
+    }
+
+    return ret;
 }
 
 EffectInstance::RenderingFunctorRetEnum
@@ -3237,7 +3275,8 @@ EffectInstance::tiledRenderingFunctor(const RenderArgs & args,
                                                                   frameArgs.canAbort,
                                                                   frameArgs.nodeHash,
                                                                   frameArgs.canSetValue,
-                                                                  frameArgs.timeline) );
+                                                                  frameArgs.timeline,
+                                                                  frameArgs.backgroundAbort) );
         
         scopedInputImages.reset(new InputImagesHolder_RAII(inputImages,&_imp->inputImages));
     }
@@ -3303,6 +3342,7 @@ EffectInstance::tiledRenderingFunctor(const RenderArgs & args,
             ///of the multi-threading.
             if (mipMapLevel != 0 && !renderUseScaleOneInputs) {
                 assert(fullScaleImage != downscaledImage);
+                ProfilerScope profile(this, kProfilerActionConvert);
                 fullScaleImage->downscaleMipMap( renderRectToRender, 0, mipMapLevel, false,downscaledImage.get() );
                 downscaledImage->markForRendered(downscaledRectToRender);
             } else {
@@ -3803,6 +3843,7 @@ EffectInstance::render_public(SequenceTime time,
                               boost::shared_ptr<Natron::Image> output)
 {
     NON_RECURSIVE_ACTION();
+    ProfilerScope profile(this, kProfilerActionRender);
     return render(time, originalScale, mappedScale, roi, view, isSequentialRender, isRenderResponseToUserInteraction, output);
 
 }
@@ -3882,6 +3923,7 @@ EffectInstance::isIdentity_public(U64 hash,
             /// Don't call isIdentity if plugin is sequential only.
             if (getSequentialPreference() != Natron::eSequentialPreferenceOnlySequential) {
                 try {
+                    ProfilerScope profile(this, kProfilerActionIsIdentity);
                     ret = isIdentity(time, scale,rod, par, view, inputTime, inputNb);
                 } catch (...) {
                     throw;
@@ -3935,6 +3977,7 @@ EffectInstance::getRegionOfDefinition_public(U64 hash,
         scaleOne.x = scaleOne.y = 1.;
         {
             RECURSIVE_ACTION();
+            ProfilerScope profile(this, kProfilerActionGetRoD);
             ret = getRegionOfDefinition(hash,time, supportsRenderScaleMaybe() == eSupportsNo ? scaleOne : scale, view, rod);
             
             if ( (ret != eStatusOK) && (ret != eStatusReplyDefault) ) {
@@ -3972,6 +4015,7 @@ EffectInstance::getRegionsOfInterest_public(SequenceTime time,
     NON_RECURSIVE_ACTION();
     assert(outputRoD.x2 >= outputRoD.x1 && outputRoD.y2 >= outputRoD.y1);
     assert(renderWindow.x2 >= renderWindow.x1 && renderWindow.y2 >= renderWindow.y1);
+    ProfilerScope profile(this, kProfilerActionGetRoI);
     getRegionsOfInterest(time, scale, outputRoD, renderWindow, view,ret);
     
 }
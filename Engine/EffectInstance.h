@@ -51,6 +51,7 @@
 #define PLUGINID_NATRON_OUTPUT    (NATRON_ORGANIZATION_DOMAIN_TOPLEVEL "." NATRON_ORGANIZATION_DOMAIN_SUB ".built-in.Output")
 #define PLUGINID_NATRON_BACKDROP  (NATRON_ORGANIZATION_DOMAIN_TOPLEVEL "." NATRON_ORGANIZATION_DOMAIN_SUB ".built-in.BackDrop")
 
+class QAtomicInt;
 class Hash64;
 class Format;
 class TimeLine;
@@ -108,6 +109,11 @@ struct ParallelRenderArgs
     ///Can the plug-in call setValue while the action is active
     bool canSetValue;
     
+    ///When non NULL, this is a background render of the viewer cache (see ViewerBackgroundCacheScheduler)
+    ///which is aborted as soon as this flag is non zero. It is not related to the renderAborted flag used
+    ///by playback so that both can run concurrently.
+    const QAtomicInt* backgroundAbort;
+    
     ParallelRenderArgs()
     : time(0)
     , timeline(0)
@@ -119,6 +125,7 @@ struct ParallelRenderArgs
     , isSequentialRender(false)
     , canAbort(false)
     , canSetValue(false)
+    , backgroundAbort(0)
     {
         
     }
@@ -532,7 +539,8 @@ public:
                                U64 nodeHash,
                                U64 rotoAge,
                                bool canSetValue,
-                               const TimeLine* timeline);
+                               const TimeLine* timeline,
+                               const QAtomicInt* backgroundAbort = 0);
 
     /**
      *@returns whether the effect was flagged with canSetValue = true or false
@@ -59,6 +59,7 @@ SOURCES += \
     AppInstance.cpp \
     AppInstanceWrapper.cpp \
     AppManager.cpp \
+    AsyncLogger.cpp \
     BackDrop.cpp \
     BlockingBackgroundRender.cpp \
     Curve.cpp \
@@ -73,6 +74,7 @@ SOURCES += \
     Hash64.cpp \
     HistogramCPU.cpp \
     Image.cpp \
+    ImageKernels.cpp \
     ImageKey.cpp \
     ImageParamsSerialization.cpp \
     Interpolation.cpp \
@@ -85,6 +87,8 @@ SOURCES += \
     Log.cpp \
     Lut.cpp \
     MemoryFile.cpp \
+    MemoryPool.cpp \
+    CacheIndex.cpp \
     Node.cpp \
     NodeGroup.cpp \
     NodeGroupWrapper.cpp \
@@ -93,6 +97,7 @@ SOURCES += \
     NonKeyParamsSerialization.cpp \
     NodeSerialization.cpp \
     NodeGroupSerialization.cpp \
+    NativeExpression.cpp \
     NoOp.cpp \
     OfxClipInstance.cpp \
     OfxHost.cpp \
@@ -106,12 +111,17 @@ SOURCES += \
     Plugin.cpp \
     PluginMemory.cpp \
     ProcessHandler.cpp \
+    Profiler.cpp \
     Project.cpp \
+    ProjectBinaryFormat.cpp \
     ProjectPrivate.cpp \
     ProjectSerialization.cpp \
     PySideCompat.cpp \
     Rect.cpp \
+    RenderThreadPool.cpp \
+    DedicatedThreadPool.cpp \
     RotoContext.cpp \
+    RotoRasterizer.cpp \
     RotoSerialization.cpp  \
     RotoWrapper.cpp \
     ScriptObject.cpp \
@@ -165,6 +175,7 @@ HEADERS += \
     AppInstance.h \
     AppInstanceWrapper.h \
     AppManager.h \
+    AsyncLogger.h \
     BackDrop.h \
     BlockingBackgroundRender.h \
     Cache.h \
@@ -188,6 +199,7 @@ HEADERS += \
     HistogramCPU.h \
     ImageInfo.h \
     Image.h \
+    ImageKernels.h \
     ImageKey.h \
     ImageLocker.h \
     ImageSerialization.h \
@@ -207,9 +219,12 @@ HEADERS += \
     LRUHashTable.h \
     Lut.h \
     MemoryFile.h \
+    MemoryPool.h \
+    CacheIndex.h \
     Node.h \
     NodeGroup.h \
     NodeGroupSerialization.h \
+    NativeExpression.h \
     NodeGroupWrapper.h \
     NodeGraphI.h \
     NodeWrapper.h \
@@ -232,13 +247,18 @@ HEADERS += \
     Plugin.h \
     PluginMemory.h \
     ProcessHandler.h \
+    Profiler.h \
     Project.h \
+    ProjectBinaryFormat.h \
     ProjectPrivate.h \
     ProjectSerialization.h \
     Pyside_Engine_Python.h \
     Rect.h \
+    RenderThreadPool.h \
+    DedicatedThreadPool.h \
     RotoContext.h \
     RotoContextPrivate.h \
+    RotoRasterizer.h \
     RotoSerialization.h \
     RotoWrapper.h \
     ScriptObject.h \
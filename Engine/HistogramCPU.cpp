@@ -12,8 +12,22 @@
 #include <algorithm>
 #include <QMutex>
 #include <QWaitCondition>
+#include <QtCore/QAtomicInt>
+
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#endif
 
 #include "Engine/Image.h"
+#include "Engine/ImageKernels.h"
+#include "Engine/AppManager.h"
+#include "Engine/RenderThreadPool.h"
+
+///The number of bins of the histograms that are counted, before being smoothed and downsampled to the requested bins count
+#define NATRON_HISTOGRAM_UPSCALE 5
+
+///A histogram of the luminance of the pixels rather than of one of their channels
+#define NATRON_HISTOGRAM_CHANNEL_LUMINANCE -1
 
 
 struct HistogramRequest
@@ -91,6 +105,9 @@ struct HistogramCPUPrivate
     QMutex mustQuitMutex;
     bool mustQuit;
 
+    ///Incremented by each request: a computation is abandoned as soon as a more recent request is posted
+    QAtomicInt requestsCount;
+
     HistogramCPUPrivate()
         : requestCond()
           , requestMutex()
@@ -100,6 +117,7 @@ struct HistogramCPUPrivate
           , mustQuitCond()
           , mustQuitMutex()
           , mustQuit(false)
+          , requestsCount()
     {
     }
 };
@@ -129,6 +147,7 @@ HistogramCPU::computeHistogram(int mode,      //< corresponds to the enum Histog
     QMutexLocker locker(&_imp->requestMutex);
 
     _imp->requests.push_back( HistogramRequest(binsCount,mode,image,rect,vmin,vmax,smoothingKernelSize) );
+    _imp->requestsCount.fetchAndAddOrdered(1);
     if (!isRunning() && !_imp->mustQuit) {
         quitLocker.unlock();
         start(HighestPriority);
@@ -197,76 +216,137 @@ HistogramCPU::getMostRecentlyProducedHistogram(std::vector<float>* histogram1,
     return true;
 }
 
-///putting these in an anonymous namespace will yield this error on gcc 4.2:
-///"function has not external linkage"
-struct pix_red
-{
-    static float val(float *pix)
-    {
-        return pix[0];
-    }
-};
+namespace {
 
-struct pix_green
+/**
+ * @brief The histograms of a request, counted in a single pass on the image by the threads of the render thread pool.
+ * The rows of the rectangle are split in chunks, each chunk counts its pixels in its own partial histograms
+ * which are summed once all the chunks are done.
+ **/
+struct HistogramPass
 {
-    static float val(float *pix)
-    {
-        return pix[1];
-    }
-};
+    const HistogramRequest* request;
+    int nHistograms;
+    int channels[3]; //< the component read by each histogram or NATRON_HISTOGRAM_CHANNEL_LUMINANCE
+    int binsCount;
+    float scale; //< binsCount / (vmax - vmin)
+    int rowsPerChunk;
+    const QAtomicInt* requestsCount;
+    int requestIndex; //< the value of requestsCount when the request was taken
+    std::vector<std::vector<unsigned int> > partials; //< nHistograms * binsCount counts per chunk
 
-struct pix_blue
-{
-    static float val(float *pix)
+    bool isSuperseded() const
     {
-        return pix[2];
+        return (int)*requestsCount != requestIndex;
     }
 };
 
-struct pix_alpha
+void
+countHistogramChunk(HistogramPass* pass,
+                    int chunk)
 {
-    static float val(float *pix)
-    {
-        return pix[3];
+    const HistogramRequest & request = *pass->request;
+    const int width = request.rect.width();
+    const int y1 = request.rect.y1 + chunk * pass->rowsPerChunk;
+    const int y2 = std::min(request.rect.y2, y1 + pass->rowsPerChunk);
+    const int nComps = (int)request.image->getComponentsCount();
+    const int nHistograms = pass->nHistograms;
+    std::vector<unsigned int> & counts = pass->partials[chunk];
+
+    counts.assign(nHistograms * pass->binsCount, 0);
+
+    ///Images with less components (e.g: Alpha) use their last component for the missing ones
+    int offsets[4];
+    for (int c = 0; c < 4; ++c) {
+        offsets[c] = std::min(c, nComps - 1);
     }
-};
 
-struct pix_lum
-{
-    static float val(float *pix)
-    {
-        return 0.299 * pix[0] + 0.587 * pix[1] + 0.114 * pix[2];
+    std::vector<float> values(nHistograms * width);
+    std::vector<int> bins(width);
+    for (int y = y1; y < y2; ++y) {
+        if ( pass->isSuperseded() ) {
+            return;
+        }
+        ///All the values of the row are gathered in a single pass on the pixels
+        const float* pix = (const float*)request.image->pixelAt(request.rect.x1, y);
+        for (int x = 0; x < width; ++x, pix += nComps) {
+            for (int h = 0; h < nHistograms; ++h) {
+                const int channel = pass->channels[h];
+                values[h * width + x] = channel == NATRON_HISTOGRAM_CHANNEL_LUMINANCE ?
+                                        0.299f * pix[offsets[0]] + 0.587f * pix[offsets[1]] + 0.114f * pix[offsets[2]] :
+                                        pix[offsets[channel]];
+            }
+        }
+        for (int h = 0; h < nHistograms; ++h) {
+            Natron::ImageKernels::computeHistogramBins(&values[h * width], &bins[0], width, (float)request.vmin, (float)request.vmax,
+                                                       pass->scale, pass->binsCount);
+            unsigned int* histo = &counts[h * pass->binsCount];
+            for (int x = 0; x < width; ++x) {
+                if (bins[x] >= 0) {
+                    ++histo[bins[x]];
+                }
+            }
+        }
     }
-};
-
+}
 
-template <float pix_func(float*)>
-void
-computeHisto(const HistogramRequest & request,
-             int upscale,
-             std::vector<float> *histo)
+/**
+ * @brief Counts the histograms of the request in histos, NATRON_HISTOGRAM_UPSCALE times more bins than requested.
+ * Returns false if a more recent request was posted in the meantime, or if the counting failed.
+ **/
+bool
+countHistograms(const HistogramRequest & request,
+                const QAtomicInt & requestsCount,
+                int requestIndex,
+                int nHistograms,
+                const int* channels,
+                std::vector<float>* histos)
 {
-    assert(histo);
-    histo->resize(request.binsCount * upscale);
-    std::fill(histo->begin(), histo->end(), 0.f);
-    double binSize = (request.vmax - request.vmin) / histo->size();
-
     ///Images come from the viewer which is in float.
     assert(request.image->getBitDepth() == Natron::eImageBitDepthFloat);
 
-    for (int y = request.rect.bottom(); y < request.rect.top(); ++y) {
-        for (int x = request.rect.left(); x < request.rect.right(); ++x) {
-            float *pix = (float*)request.image->pixelAt(x, y);
-            float v = pix_func(pix);
-            if ( (request.vmin <= v) && (v < request.vmax) ) {
-                int index = (int)( (v - request.vmin) / binSize );
-                assert( 0 <= index && index < (int)histo->size() );
-                (*histo)[index] += 1.f;
+    HistogramPass pass;
+    pass.request = &request;
+    pass.nHistograms = nHistograms;
+    for (int h = 0; h < nHistograms; ++h) {
+        pass.channels[h] = channels[h];
+    }
+    pass.binsCount = request.binsCount * NATRON_HISTOGRAM_UPSCALE;
+    pass.scale = (float)(pass.binsCount / (request.vmax - request.vmin));
+    pass.requestsCount = &requestsCount;
+    pass.requestIndex = requestIndex;
+
+    int height = request.rect.height();
+    int nChunks = 0;
+    if ( (request.rect.width() > 0) && (height > 0) ) {
+        Natron::RenderThreadPool* pool = appPTR->getRenderThreadPool();
+        nChunks = std::min(height, pool->getMaxThreadCount() * NATRON_RENDER_TILES_PER_THREAD);
+        pass.rowsPerChunk = (height + nChunks - 1) / nChunks;
+        nChunks = (height + pass.rowsPerChunk - 1) / pass.rowsPerChunk;
+        pass.partials.resize(nChunks);
+        if ( !pool->parallelFor( nChunks, boost::bind(countHistogramChunk, &pass, _1) ) ) {
+            return false;
+        }
+    }
+    if ( pass.isSuperseded() ) {
+        return false;
+    }
+
+    for (int h = 0; h < nHistograms; ++h) {
+        histos[h].assign(pass.binsCount, 0.f);
+        for (int chunk = 0; chunk < nChunks; ++chunk) {
+            const unsigned int* counts = &pass.partials[chunk][h * pass.binsCount];
+            for (int i = 0; i < pass.binsCount; ++i) {
+                histos[h][i] += (float)counts[i];
             }
         }
     }
+
+    return true;
 }
 
+} // anon namespace
+
 /// IIR Gaussian filter: recursive implementation.
 
 static void
@@ -403,63 +483,15 @@ iir_1d_filter(SrcIterator src,
     }
 } // iir_1d_filter
 
+///Smoothes the histogram counted with NATRON_HISTOGRAM_UPSCALE times more bins than requested and downsamples it to histo
 static void
-computeHistogramStatic(const HistogramRequest & request,
-                       boost::shared_ptr<FinishedHistogram> ret,
-                       int histogramIndex)
+smoothHistogram(const HistogramRequest & request,
+                std::vector<float> & histo_upscaled,
+                std::vector<float>* histo)
 {
-    const int upscale = 5;
-    std::vector<float> *histo = 0;
-
-    switch (histogramIndex) {
-    case 1:
-        histo = &ret->histogram1;
-        break;
-    case 2:
-        histo = &ret->histogram2;
-        break;
-    case 3:
-        histo = &ret->histogram3;
-        break;
-    default:
-        break;
-    }
-    assert(histo);
-
-    /// keep the mode parameter in sync with Histogram::DisplayModeEnum
-
-    int mode = request.mode;
-
-    ///if the mode is RGB, adjust the mode to either R,G or B depending on the histogram index
-    if (mode == 0) {
-        mode = histogramIndex + 2;
-    }
-
-    ret->pixelsCount = request.rect.area();
-    // a histogram with upscale more bins
-    std::vector<float> histo_upscaled;
-    switch (mode) {
-    case 1:     //< A
-        computeHisto<&pix_alpha::val>(request, upscale, &histo_upscaled);
-        break;
-    case 2:     //<Y
-        computeHisto<&pix_lum::val>(request, upscale, &histo_upscaled);
-        break;
-    case 3:     //< R
-        computeHisto<&pix_red::val>(request, upscale, &histo_upscaled);
-        break;
-    case 4:     //< G
-        computeHisto<&pix_green::val>(request, upscale, &histo_upscaled);
-        break;
-    case 5:     //< B
-        computeHisto<&pix_blue::val>(request, upscale, &histo_upscaled);
-        break;
-
-    default:
-        assert(false);
-        break;
-    }
+    const int upscale = NATRON_HISTOGRAM_UPSCALE;
     double sigma = upscale;
+
     if (request.smoothingKernelSize > 1) {
         sigma *= request.smoothingKernelSize;
     }
@@ -483,13 +515,14 @@ computeHistogramStatic(const HistogramRequest & request,
             std::advance (it_in,upscale);
         }
     }
-} // computeHistogramStatic
+} // smoothHistogram
 
 void
 HistogramCPU::run()
 {
     for (;; ) {
         HistogramRequest request;
+        int requestIndex;
         {
             QMutexLocker l(&_imp->requestMutex);
             while ( _imp->requests.empty() ) {
@@ -502,6 +535,7 @@ HistogramCPU::run()
 
             ///ignore all other requests pending
             _imp->requests.clear();
+            requestIndex = (int)_imp->requestsCount;
         }
 
         {
@@ -519,26 +553,43 @@ HistogramCPU::run()
         ret->vmin = request.vmin;
         ret->vmax = request.vmax;
         ret->mipMapLevel = request.image->getMipMapLevel();
+        ret->pixelsCount = request.rect.area();
 
-
+        /// keep the mode parameter in sync with Histogram::DisplayModeEnum
+        int nHistograms = 1;
+        int channels[3];
         switch (request.mode) {
         case 0:     //< RGB
-            computeHistogramStatic(request, ret, 1);
-            computeHistogramStatic(request, ret, 2);
-            computeHistogramStatic(request, ret, 3);
+            nHistograms = 3;
+            channels[0] = 0;
+            channels[1] = 1;
+            channels[2] = 2;
+            break;
+        case 1:     //< A
+            channels[0] = 3;
+            break;
+        case 2:     //< Y
+            channels[0] = NATRON_HISTOGRAM_CHANNEL_LUMINANCE;
             break;
-        case 1:
-        case 2:
-        case 3:
-        case 4:
-        case 5:
-            computeHistogramStatic(request, ret, 1);
+        case 3:     //< R
+        case 4:     //< G
+        case 5:     //< B
+            channels[0] = request.mode - 3;
             break;
         default:
             assert(false);     //< unknown case.
-            break;
+            continue;
         }
 
+        std::vector<float> histos_upscaled[3];
+        if ( !countHistograms(request, _imp->requestsCount, requestIndex, nHistograms, channels, histos_upscaled) ) {
+            ///superseded by a more recent request, or failed
+            continue;
+        }
+        std::vector<float>* histos[3] = { &ret->histogram1, &ret->histogram2, &ret->histogram3 };
+        for (int h = 0; h < nHistograms; ++h) {
+            smoothHistogram(request, histos_upscaled[h], histos[h]);
+        }
 
         {
             QMutexLocker l(&_imp->producedMutex);
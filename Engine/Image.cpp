@@ -15,86 +15,251 @@
 
 #include "Image.h"
 
+#include <vector>
+#include <algorithm>
+
 #include <QDebug>
 #ifndef Q_MOC_RUN
 #include <boost/math/special_functions/fpclassify.hpp>
 #endif
 #include "Engine/AppManager.h"
+#include "Engine/ImageKernels.h"
 #include "Engine/Lut.h"
 
 using namespace Natron;
 
-#define BM_GET(i,j) &_map[( i - _bounds.bottom() ) * _bounds.width() + ( j - _bounds.left() )]
-
 #define PIXEL_UNAVAILABLE 2
 
+namespace {
+
+///The low bit of each pixel of a bitmap word
+const U64 kBitmapLowBits = 0x5555555555555555ULL;
+
+///Mask of the low bits of the n pixels of a bitmap word starting at pixel first
+inline U64
+lowBitsMask(int first,
+            int n)
+{
+    assert(first >= 0 && n > 0 && first + n <= NATRON_BITMAP_PIXELS_PER_WORD);
+    U64 mask = n == NATRON_BITMAP_PIXELS_PER_WORD ? kBitmapLowBits : ( ( (U64)1 << (2 * n) ) - 1 ) & kBitmapLowBits;
+
+    return mask << (2 * first);
+}
+
+///The low bit of each pixel which is not 0 is set
+inline U64
+nonZeroPixels(U64 w)
+{
+    return (w | (w >> 1) ) & kBitmapLowBits;
+}
+
+///The low bit of each pixel which is 1 is set
+inline U64
+renderedPixels(U64 w)
+{
+    return w & ~(w >> 1) & kBitmapLowBits;
+}
+
+///The low bit of each pixel which is PIXEL_UNAVAILABLE is set
+inline U64
+unavailablePixels(U64 w)
+{
+    return (w >> 1) & ~w & kBitmapLowBits;
+}
+
+///Returns the end of the tile containing the coordinate x, where the tiles start at origin, clamped to end
+inline int
+tileEnd(int x,
+        int origin,
+        int end)
+{
+    return std::min(end, origin + ( (x - origin) / NATRON_BITMAP_TILE_SIZE + 1 ) * NATRON_BITMAP_TILE_SIZE);
+}
+
+/**
+ * @brief Returns true if none of the pixels of row y in [x1,x2) is 0. In trimap mode, *metUnavailablePixel is set
+ * to true if one of them is being rendered elsewhere.
+ **/
+template <int trimap>
+bool
+isRowSegmentMarked(const Bitmap& bm,
+                   int y,
+                   int x1,
+                   int x2,
+                   bool* metUnavailablePixel)
+{
+    const RectI & bounds = bm.getBounds();
+    const U64* row = bm.getPackedRow(y);
+
+    for (int x = x1; x < x2; ) {
+        int xEnd = tileEnd(x, bounds.x1, x2);
+        Bitmap::TileStateEnum state = bm.getTileStateAt(x, y);
+        if (state == Bitmap::eTileStateNotRendered) {
+            return false;
+        } else if (state == Bitmap::eTileStateMixed) {
+            for (int i = x - bounds.x1; i < xEnd - bounds.x1; ) {
+                int first = i % NATRON_BITMAP_PIXELS_PER_WORD;
+                int n = std::min(NATRON_BITMAP_PIXELS_PER_WORD - first, xEnd - bounds.x1 - i);
+                U64 w = row[i / NATRON_BITMAP_PIXELS_PER_WORD];
+                U64 mask = lowBitsMask(first, n);
+                if (~nonZeroPixels(w) & mask) {
+                    return false;
+                } else if ( trimap && (unavailablePixels(w) & mask) ) {
+                    *metUnavailablePixel = true;
+                }
+                i += n;
+            }
+        }
+        x = xEnd;
+    }
+
+    return true;
+}
+
+///Same as isRowSegmentMarked for the column x in [y1,y2)
+template <int trimap>
+bool
+isColumnSegmentMarked(const Bitmap& bm,
+                      int x,
+                      int y1,
+                      int y2,
+                      bool* metUnavailablePixel)
+{
+    const RectI & bounds = bm.getBounds();
+
+    for (int y = y1; y < y2; ) {
+        int yEnd = tileEnd(y, bounds.y1, y2);
+        Bitmap::TileStateEnum state = bm.getTileStateAt(x, y);
+        if (state == Bitmap::eTileStateNotRendered) {
+            return false;
+        } else if (state == Bitmap::eTileStateMixed) {
+            for (int i = y; i < yEnd; ++i) {
+                char pix = bm.getValueAt(x, i);
+                if (!pix) {
+                    return false;
+                } else if (trimap && pix == PIXEL_UNAVAILABLE) {
+                    *metUnavailablePixel = true;
+                }
+            }
+        }
+        y = yEnd;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns true if none of the pixels of row y in [x1,x2) is rendered. In trimap mode, it also returns false
+ * if a pixel being rendered elsewhere is met first, in which case *metUnavailablePixel is set to true.
+ **/
 template <int trimap>
-RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const std::vector<char>& _map,
+bool
+isRowSegmentClear(const Bitmap& bm,
+                  int y,
+                  int x1,
+                  int x2,
+                  bool* metUnavailablePixel)
+{
+    const RectI & bounds = bm.getBounds();
+    const U64* row = bm.getPackedRow(y);
+
+    for (int x = x1; x < x2; ) {
+        int xEnd = tileEnd(x, bounds.x1, x2);
+        Bitmap::TileStateEnum state = bm.getTileStateAt(x, y);
+        if (state == Bitmap::eTileStateRendered) {
+            return false;
+        } else if (state == Bitmap::eTileStateMixed) {
+            for (int i = x - bounds.x1; i < xEnd - bounds.x1; ) {
+                int first = i % NATRON_BITMAP_PIXELS_PER_WORD;
+                int n = std::min(NATRON_BITMAP_PIXELS_PER_WORD - first, xEnd - bounds.x1 - i);
+                U64 w = row[i / NATRON_BITMAP_PIXELS_PER_WORD];
+                U64 mask = lowBitsMask(first, n);
+                U64 rendered = renderedPixels(w) & mask;
+                U64 unavailable = trimap ? unavailablePixels(w) & mask : 0;
+                if (rendered | unavailable) {
+                    ///the first pixel which is not 0 decides, as pixels are scanned from left to right
+                    U64 firstMarked = (rendered | unavailable) & ( ~(rendered | unavailable) + 1 );
+                    if (firstMarked & unavailable) {
+                        *metUnavailablePixel = true;
+                    }
+
+                    return false;
+                }
+                i += n;
+            }
+        }
+        x = xEnd;
+    }
+
+    return true;
+}
+
+///Same as isRowSegmentClear for the column x in [y1,y2)
+template <int trimap>
+bool
+isColumnSegmentClear(const Bitmap& bm,
+                     int x,
+                     int y1,
+                     int y2,
+                     bool* metUnavailablePixel)
+{
+    const RectI & bounds = bm.getBounds();
+
+    for (int y = y1; y < y2; ) {
+        int yEnd = tileEnd(y, bounds.y1, y2);
+        Bitmap::TileStateEnum state = bm.getTileStateAt(x, y);
+        if (state == Bitmap::eTileStateRendered) {
+            return false;
+        } else if (state == Bitmap::eTileStateMixed) {
+            for (int i = y; i < yEnd; ++i) {
+                char pix = bm.getValueAt(x, i);
+                if (pix == 1) {
+                    return false;
+                } else if (trimap && pix == PIXEL_UNAVAILABLE) {
+                    *metUnavailablePixel = true;
+
+                    return false;
+                }
+            }
+        }
+        y = yEnd;
+    }
+
+    return true;
+}
+
+} // anon namespace
+
+template <int trimap>
+RectI minimalNonMarkedBbox_internal(const RectI& roi, const Bitmap& bm,
                                     bool* isBeingRenderedElsewhere)
 {
     RectI bbox;
     
-    roi.intersect(_bounds, &bbox); // be safe
-    //find bottom
+    roi.intersect(bm.getBounds(), &bbox); // be safe
+    //find bottom. Only the columns of the roi are scanned, the bitmap may be much larger.
     for (int i = bbox.bottom(); i < bbox.top(); ++i) {
-        const char* buf = BM_GET(i, _bounds.left());
-        
-        if (trimap) {
-            
-            const char* lineEnd = buf + _bounds.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (!*buf) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    metUnavailablePixel = true;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else if (metUnavailablePixel) {
+        bool metUnavailablePixel = false;
+        if ( isRowSegmentMarked<trimap>(bm, i, bbox.left(), bbox.right(), &metUnavailablePixel) ) {
+            bbox.set_bottom(bbox.bottom() + 1);
+            if (trimap && metUnavailablePixel) {
                 *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
             }
         } else {
-            if ( !memchr( buf, 0, _bounds.width() ) ) {
-                bbox.set_bottom(bbox.bottom() + 1);
-            } else {
-                break;
-            }
+            break;
         }
     }
     
     //find top (will do zero iteration if the bbox is already empty)
     for (int i = bbox.top() - 1; i >= bbox.bottom(); --i) {
-        const char* buf = BM_GET(i, _bounds.left());
-        
-        if (trimap) {
-            
-            const char* lineEnd = buf + _bounds.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (!*buf) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    metUnavailablePixel = true;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else if (metUnavailablePixel) {
+        bool metUnavailablePixel = false;
+        if ( isRowSegmentMarked<trimap>(bm, i, bbox.left(), bbox.right(), &metUnavailablePixel) ) {
+            bbox.set_top(bbox.top() - 1);
+            if (trimap && metUnavailablePixel) {
                 *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
             }
-            
         } else {
-            if ( !memchr( buf, 0, _bounds.width() ) ) {
-                bbox.set_top(bbox.top() - 1);
-            } else {
-                break;
-            }
+            break;
         }
     }
     
@@ -105,22 +270,8 @@ RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const
     
     //find left
     for (int j = bbox.left(); j < bbox.right(); ++j) {
-        const char* pix = BM_GET(bbox.bottom(), j);
-
         bool metUnavailablePixel = false;
-
-        for (int i = bbox.bottom(); i < bbox.top(); ++i, pix += _bounds.width()) {
-            if (!*pix) {
-                pix = 0;
-                break;
-            }
-            
-            else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-                metUnavailablePixel = true;
-            }
-            
-        }
-        if (pix) {
+        if ( isColumnSegmentMarked<trimap>(bm, j, bbox.bottom(), bbox.top(), &metUnavailablePixel) ) {
             bbox.set_left(bbox.left() + 1);
             if (trimap && metUnavailablePixel) {
                 *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
@@ -132,28 +283,12 @@ RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const
     
     //find right
     for (int j = bbox.right() - 1; j >= bbox.left(); --j) {
-        const char* pix = BM_GET(bbox.bottom(), j);
-
         bool metUnavailablePixel = false;
-
-        for (int i = bbox.bottom(); i < bbox.top(); ++i, pix += _bounds.width()) {
-            if (!*pix) {
-                pix = 0;
-                break;
-            }
-
-            else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-                metUnavailablePixel = true;
-            }
-
-        }
-        if (pix) {
+        if ( isColumnSegmentMarked<trimap>(bm, j, bbox.bottom(), bbox.top(), &metUnavailablePixel) ) {
             bbox.set_right(bbox.right() - 1);
-
             if (trimap && metUnavailablePixel) {
                 *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
             }
-
         } else {
             break;
         }
@@ -166,10 +301,10 @@ RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const
 
 template <int trimap>
 void
-minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std::vector<char>& _map,
+minimalNonMarkedRects_internal(const RectI & roi,const Bitmap& bm,
                                std::list<RectI>& ret,bool* isBeingRenderedElsewhere)
 {
-    RectI bboxM = minimalNonMarkedBbox_internal<trimap>(roi, _bounds, _map, isBeingRenderedElsewhere);
+    RectI bboxM = minimalNonMarkedBbox_internal<trimap>(roi, bm, isBeingRenderedElsewhere);
     
     //#define NATRON_BITMAP_DISABLE_OPTIMIZATION
 #ifdef NATRON_BITMAP_DISABLE_OPTIMIZATION
@@ -208,37 +343,15 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     RectI bboxA = bboxX;
     bboxA.set_top( bboxX.bottom() );
     for (int i = bboxX.bottom(); i < bboxX.top(); ++i) {
-        const char* buf = BM_GET(i, bboxX.left());
-        if (trimap) {
-            const char* lineEnd = buf + bboxX.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (*buf == 1) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    buf = 0;
-                    metUnavailablePixel = true;
-                    break;
-                }
-                ++buf;
-            }
-            if (buf) {
-                bboxX.set_bottom(bboxX.bottom() + 1);
-                bboxA.set_top( bboxX.bottom() );
-            } else {
-                if (metUnavailablePixel) {
-                    *isBeingRenderedElsewhere = true;
-                }
-                break;
-            }
+        bool metUnavailablePixel = false;
+        if ( isRowSegmentClear<trimap>(bm, i, bboxX.left(), bboxX.right(), &metUnavailablePixel) ) {
+            bboxX.set_bottom(bboxX.bottom() + 1);
+            bboxA.set_top( bboxX.bottom() );
         } else {
-            if ( !memchr( buf, 1, bboxX.width() ) ) {
-                bboxX.set_bottom(bboxX.bottom() + 1);
-                bboxA.set_top( bboxX.bottom() );
-            } else {
-                break;
+            if (trimap && metUnavailablePixel) {
+                *isBeingRenderedElsewhere = true;
             }
+            break;
         }
     }
     if ( !bboxA.isNull() ) { // empty boxes should not be pushed
@@ -250,110 +363,60 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     RectI bboxB = bboxX;
     bboxB.set_bottom( bboxX.top() );
     for (int i = bboxX.top() - 1; i >= bboxX.bottom(); --i) {
-        const char* buf = BM_GET(i, bboxX.left());
-        
-        if (trimap) {
-            const char* lineEnd = buf + bboxX.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (*buf == 1) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    buf = 0;
-                    metUnavailablePixel = true;
-                    break;
-                }
-                ++buf;
-            }
-            if (buf) {
-                bboxX.set_top(bboxX.top() - 1);
-                bboxB.set_bottom( bboxX.top() );
-            } else {
-                if (metUnavailablePixel) {
-                    *isBeingRenderedElsewhere = true;
-                }
-                break;
-            }
+        bool metUnavailablePixel = false;
+        if ( isRowSegmentClear<trimap>(bm, i, bboxX.left(), bboxX.right(), &metUnavailablePixel) ) {
+            bboxX.set_top(bboxX.top() - 1);
+            bboxB.set_bottom( bboxX.top() );
         } else {
-            if ( !memchr( buf, 1, bboxX.width() ) ) {
-                bboxX.set_top(bboxX.top() - 1);
-                bboxB.set_bottom( bboxX.top() );
-            } else {
-                break;
+            if (trimap && metUnavailablePixel) {
+                *isBeingRenderedElsewhere = true;
             }
-            
+            break;
         }
     }
     if ( !bboxB.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxB);
     }
     
-	//find left
-	RectI bboxC = bboxX;
-	bboxC.set_right( bboxX.left() );
-	if (bboxX.bottom() < bboxX.top()) {
-		for (int j = bboxX.left(); j < bboxX.right(); ++j) {
-			const char* pix = BM_GET(bboxX.bottom(), j);
-
-			bool metUnavailablePixel = false;
-
-			for (int i = bboxX.bottom(); i < bboxX.top(); ++i, pix += _bounds.width()) {
-				if (*pix == 1) {
-					pix = 0;
-					break;
-				} else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-					pix = 0;
-					metUnavailablePixel = true;
-					break;
-				}
-			}
-			if (pix) {
-				bboxX.set_left(bboxX.left() + 1);
-				bboxC.set_right( bboxX.left() );
-			} else {
-				if (metUnavailablePixel) {
-					*isBeingRenderedElsewhere = true;
-				}
-				break;
-			}
-		}
-	}
+    //find left
+    RectI bboxC = bboxX;
+    bboxC.set_right( bboxX.left() );
+    if (bboxX.bottom() < bboxX.top()) {
+        for (int j = bboxX.left(); j < bboxX.right(); ++j) {
+            bool metUnavailablePixel = false;
+            if ( isColumnSegmentClear<trimap>(bm, j, bboxX.bottom(), bboxX.top(), &metUnavailablePixel) ) {
+                bboxX.set_left(bboxX.left() + 1);
+                bboxC.set_right( bboxX.left() );
+            } else {
+                if (trimap && metUnavailablePixel) {
+                    *isBeingRenderedElsewhere = true;
+                }
+                break;
+            }
+        }
+    }
     if ( !bboxC.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxC);
     }
 
-	//find right
-	RectI bboxD = bboxX;
-	bboxD.set_left( bboxX.right() );
-	if (bboxX.bottom() < bboxX.top()) {
-		for (int j = bboxX.right() - 1; j >= bboxX.left(); --j) {
-			const char* pix = BM_GET(bboxX.bottom(), j);
-
-			bool metUnavailablePixel = false;
-
-			for (int i = bboxX.bottom(); i < bboxX.top(); ++i, pix += _bounds.width()) {
-				if (*pix == 1) {
-					pix = 0;
-					break;
-				} else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-					pix = 0;
-					metUnavailablePixel = true;
-					break;
-				}
-			}
-			if (pix) {
-				bboxX.set_right(bboxX.right() - 1);
-				bboxD.set_left( bboxX.right() );
-			} else {
-				if (metUnavailablePixel) {
-					*isBeingRenderedElsewhere = true;
-				}
-				break;
-			}
-		}
-	}
-	if ( !bboxD.isNull() ) { // empty boxes should not be pushed
+    //find right
+    RectI bboxD = bboxX;
+    bboxD.set_left( bboxX.right() );
+    if (bboxX.bottom() < bboxX.top()) {
+        for (int j = bboxX.right() - 1; j >= bboxX.left(); --j) {
+            bool metUnavailablePixel = false;
+            if ( isColumnSegmentClear<trimap>(bm, j, bboxX.bottom(), bboxX.top(), &metUnavailablePixel) ) {
+                bboxX.set_right(bboxX.right() - 1);
+                bboxD.set_left( bboxX.right() );
+            } else {
+                if (trimap && metUnavailablePixel) {
+                    *isBeingRenderedElsewhere = true;
+                }
+                break;
+            }
+        }
+    }
+    if ( !bboxD.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxD);
     }
     
@@ -378,7 +441,7 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     assert( bboxD.bottom() == bboxX.bottom() );
     
     // get the bounding box of what's left (the X rectangle in the drawing above)
-    bboxX = minimalNonMarkedBbox_internal<trimap>(bboxX,_bounds,_map,isBeingRenderedElsewhere);
+    bboxX = minimalNonMarkedBbox_internal<trimap>(bboxX,bm,isBeingRenderedElsewhere);
     
     if ( !bboxX.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxX);
@@ -391,78 +454,235 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
 RectI
 Bitmap::minimalNonMarkedBbox(const RectI & roi) const
 {
-    return minimalNonMarkedBbox_internal<0>(roi, _bounds, _map, NULL);
+    return minimalNonMarkedBbox_internal<0>(roi, *this, NULL);
 }
 
 void
 Bitmap::minimalNonMarkedRects(const RectI & roi,std::list<RectI>& ret) const
 {
-    minimalNonMarkedRects_internal<0>(roi, _bounds, _map,ret , NULL);
+    minimalNonMarkedRects_internal<0>(roi, *this,ret , NULL);
 }
 
 #if NATRON_ENABLE_TRIMAP
 RectI
 Bitmap::minimalNonMarkedBbox_trimap(const RectI & roi,bool* isBeingRenderedElsewhere) const
 {
-    return minimalNonMarkedBbox_internal<1>(roi, _bounds, _map, isBeingRenderedElsewhere);
+    return minimalNonMarkedBbox_internal<1>(roi, *this, isBeingRenderedElsewhere);
 }
 
 
 void
 Bitmap::minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,bool* isBeingRenderedElsewhere) const
 {
-    minimalNonMarkedRects_internal<1>(roi, _bounds, _map ,ret , isBeingRenderedElsewhere);
+    minimalNonMarkedRects_internal<1>(roi, *this,ret , isBeingRenderedElsewhere);
 } 
 #endif
 
 void
 Natron::Bitmap::markForRendered(const RectI & roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    for (int i = roi.bottom(); i < roi.top(); ++i, buf += _bounds.width()) {
-        memset( buf, 1, roi.width() );
-    }
+    fill(roi, 1);
 }
 
 #if NATRON_ENABLE_TRIMAP
 void
 Natron::Bitmap::markForRendering(const RectI & roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    for (int i = roi.bottom(); i < roi.top(); ++i, buf += _bounds.width()) {
-        memset( buf, PIXEL_UNAVAILABLE , roi.width() );
-    }
+    fill(roi, PIXEL_UNAVAILABLE);
 }
 #endif
 
 void
 Natron::Bitmap::clear(const RectI& roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    for (int i = roi.bottom(); i < roi.top(); ++i, buf += _bounds.width()) {
-        memset( buf, 0 , roi.width() );
+    fill(roi, 0);
+}
+
+void
+Natron::Bitmap::allocate()
+{
+    if ( _bounds.isNull() ) {
+        _wordsPerRow = 0;
+        _tilesPerRow = 0;
+        _map.clear();
+        _tiles.clear();
+
+        return;
     }
+    _wordsPerRow = (_bounds.width() + NATRON_BITMAP_PIXELS_PER_WORD - 1) / NATRON_BITMAP_PIXELS_PER_WORD;
+    _map.assign(_wordsPerRow * _bounds.height(), 0);
+
+    _tilesPerRow = (_bounds.width() + NATRON_BITMAP_TILE_SIZE - 1) / NATRON_BITMAP_TILE_SIZE;
+    int nTileRows = (_bounds.height() + NATRON_BITMAP_TILE_SIZE - 1) / NATRON_BITMAP_TILE_SIZE;
+    _tiles.assign(_tilesPerRow * nTileRows, (char)eTileStateNotRendered);
 }
 
-const char*
-Natron::Bitmap::getBitmapAt(int x,
-                            int y) const
+void
+Natron::Bitmap::fill(const RectI& roi,
+                     char value)
 {
-    if ( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) ) {
-        return BM_GET(y,x);
-    } else {
-        return NULL;
+    if ( roi.isNull() ) {
+        return;
     }
+    assert(roi.x1 >= _bounds.x1 && roi.x2 <= _bounds.x2 && roi.y1 >= _bounds.y1 && roi.y2 <= _bounds.y2);
+
+    const U64 pattern = (U64)value * kBitmapLowBits;
+    const int i1 = roi.x1 - _bounds.x1;
+    const int i2 = roi.x2 - _bounds.x1;
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        U64* row = getWritableRow(y);
+        for (int i = i1; i < i2; ) {
+            int first = i % NATRON_BITMAP_PIXELS_PER_WORD;
+            int n = std::min(NATRON_BITMAP_PIXELS_PER_WORD - first, i2 - i);
+            U64 lowBits = lowBitsMask(first, n);
+            U64 mask = lowBits | (lowBits << 1);
+            U64 & w = row[i / NATRON_BITMAP_PIXELS_PER_WORD];
+            w = (w & ~mask) | (pattern & mask);
+            i += n;
+        }
+    }
+    updateTilesInternal(roi, value);
 }
 
-char*
-Natron::Bitmap::getBitmapAt(int x,
-                            int y)
+void
+Natron::Bitmap::updateTiles(const RectI& roi)
 {
-    if ( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) ) {
-        return BM_GET(y,x);
-    } else {
-        return NULL;
+    updateTilesInternal(roi, -1);
+}
+
+void
+Natron::Bitmap::updateTilesInternal(const RectI& roi,
+                                    int value)
+{
+    RectI area;
+    if ( _tiles.empty() || !roi.intersect(_bounds, &area) ) {
+        return;
+    }
+
+    int tx1 = (area.x1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int tx2 = (area.x2 - 1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty1 = (area.y1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int ty2 = (area.y2 - 1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    TileStateEnum filledState = value == 0 ? eTileStateNotRendered : (value == 1 ? eTileStateRendered : eTileStateMixed);
+
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx) {
+            RectI tile;
+            tile.x1 = _bounds.x1 + tx * NATRON_BITMAP_TILE_SIZE;
+            tile.y1 = _bounds.y1 + ty * NATRON_BITMAP_TILE_SIZE;
+            tile.x2 = std::min(tile.x1 + NATRON_BITMAP_TILE_SIZE, _bounds.x2);
+            tile.y2 = std::min(tile.y1 + NATRON_BITMAP_TILE_SIZE, _bounds.y2);
+
+            char & state = _tiles[ty * _tilesPerRow + tx];
+            if ( value != -1 && ( area.contains(tile) || (filledState != eTileStateMixed && state == filledState) ) ) {
+                ///The tile was entirely filled, or partially filled with the value it already had everywhere
+                state = filledState;
+            } else {
+                state = computeTileState(tile);
+            }
+        }
+    }
+}
+
+Natron::Bitmap::TileStateEnum
+Natron::Bitmap::computeTileState(const RectI& tile) const
+{
+    bool hasNonZero = false;
+    bool hasOtherThanOne = false;
+    const int i1 = tile.x1 - _bounds.x1;
+    const int i2 = tile.x2 - _bounds.x1;
+    for (int y = tile.y1; y < tile.y2; ++y) {
+        const U64* row = getPackedRow(y);
+        ///tiles start on a word boundary
+        for (int i = i1; i < i2; i += NATRON_BITMAP_PIXELS_PER_WORD) {
+            U64 w = row[i / NATRON_BITMAP_PIXELS_PER_WORD];
+            U64 mask = lowBitsMask(0, std::min(NATRON_BITMAP_PIXELS_PER_WORD, i2 - i));
+            hasNonZero |= (nonZeroPixels(w) & mask) != 0;
+            hasOtherThanOne |= (~renderedPixels(w) & mask) != 0;
+        }
+        if (hasNonZero && hasOtherThanOne) {
+            return eTileStateMixed;
+        }
+    }
+    if (!hasNonZero) {
+        return eTileStateNotRendered;
+    } else if (!hasOtherThanOne) {
+        return eTileStateRendered;
+    }
+
+    return eTileStateMixed;
+}
+
+void
+Natron::Bitmap::unpackRow(int x1,
+                          int x2,
+                          int y,
+                          char* dst) const
+{
+    assert(x1 >= _bounds.x1 && x2 <= _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2);
+    const U64* row = getPackedRow(y);
+    for (int i = x1 - _bounds.x1; i < x2 - _bounds.x1; ++i, ++dst) {
+        *dst = (char)( ( row[i / NATRON_BITMAP_PIXELS_PER_WORD] >> ( 2 * (i % NATRON_BITMAP_PIXELS_PER_WORD) ) ) & 3 );
+    }
+}
+
+void
+Natron::Bitmap::packRow(int x1,
+                        int x2,
+                        int y,
+                        const char* src)
+{
+    assert(x1 >= _bounds.x1 && x2 <= _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2);
+    U64* row = getWritableRow(y);
+    const int i2 = x2 - _bounds.x1;
+    for (int i = x1 - _bounds.x1; i < i2; ) {
+        int first = i % NATRON_BITMAP_PIXELS_PER_WORD;
+        int n = std::min(NATRON_BITMAP_PIXELS_PER_WORD - first, i2 - i);
+        U64 bits = 0;
+        for (int k = n - 1; k >= 0; --k) {
+            bits = (bits << 2) | (U64)(src[k] & 3);
+        }
+        U64 lowBits = lowBitsMask(first, n);
+        U64 mask = lowBits | (lowBits << 1);
+        U64 & w = row[i / NATRON_BITMAP_PIXELS_PER_WORD];
+        w = (w & ~mask) | (bits << (2 * first));
+        src += n;
+        i += n;
+    }
+}
+
+void
+Natron::Bitmap::copyRow(int x1,
+                        int x2,
+                        int y,
+                        const Bitmap& other)
+{
+    const U64* srcRow = other.getPackedRow(y);
+    U64* dstRow = getWritableRow(y);
+    const int srcOffset = _bounds.x1 - other._bounds.x1;
+    const int i2 = x2 - _bounds.x1;
+
+    ///Each chunk lies within a single word of the destination, the source pixels are shifted into place
+    for (int i = x1 - _bounds.x1; i < i2; ) {
+        int first = i % NATRON_BITMAP_PIXELS_PER_WORD;
+        int n = std::min(NATRON_BITMAP_PIXELS_PER_WORD - first, i2 - i);
+        int srcIndex = i + srcOffset;
+        int srcShift = 2 * (srcIndex % NATRON_BITMAP_PIXELS_PER_WORD);
+        U64 bits = srcRow[srcIndex / NATRON_BITMAP_PIXELS_PER_WORD] >> srcShift;
+        if ( srcShift && (srcShift + 2 * n > 64) ) {
+            bits |= srcRow[srcIndex / NATRON_BITMAP_PIXELS_PER_WORD + 1] << (64 - srcShift);
+        }
+        U64 lowBits = lowBitsMask(0, n);
+        bits &= lowBits | (lowBits << 1);
+        ///Pixels being rendered in other are not rendered in this bitmap
+        U64 unavailable = unavailablePixels(bits);
+        bits &= ~( unavailable | (unavailable << 1) );
+
+        U64 dstLowBits = lowBitsMask(first, n);
+        U64 dstMask = dstLowBits | (dstLowBits << 1);
+        U64 & w = dstRow[i / NATRON_BITMAP_PIXELS_PER_WORD];
+        w = (w & ~dstMask) | (bits << (2 * first));
+        i += n;
     }
 }
 
@@ -950,9 +1170,7 @@ Image::halveRoIForDepth(const RectI & roi,
     QReadLocker k2(&_lock);
     
     const PIX* const srcPixels      = (const PIX*)pixelAt(srcBounds.x1,   srcBounds.y1);
-    const char* const srcBmPixels   = _bitmap.getBitmapAt(srcBmBounds.x1, srcBmBounds.y1);
     PIX* const dstPixels          = (PIX*)output->pixelAt(dstBounds.x1,   dstBounds.y1);
-    char* const dstBmPixels = output->_bitmap.getBitmapAt(dstBmBounds.x1, dstBmBounds.y1);
 
     int srcRowSize = srcBounds.width() * nComponents;
     int dstRowSize = dstBounds.width() * nComponents;
@@ -961,17 +1179,30 @@ Image::halveRoIForDepth(const RectI & roi,
     const PIX* const srcData = srcPixels - (srcBounds.x1 * nComponents + srcRowSize * srcBounds.y1);
     PIX* const dstData       = dstPixels - (dstBounds.x1 * nComponents + dstRowSize * dstBounds.y1);
 
+    // The bitmaps are packed: the 2 src rows covered by a dst row are unpacked to one char per pixel
+    // in srcBmRows, and the halved dst row is packed back from dstBmRow.
     const int srcBmRowSize = srcBmBounds.width();
-    const int dstBmRowSize = dstBmBounds.width();
-
-    const char* const srcBmData = srcBmPixels - (srcBmBounds.x1 + srcBmRowSize * srcBmBounds.y1);
-    char* const dstBmData       = dstBmPixels - (dstBmBounds.x1 + dstBmRowSize * dstBmBounds.y1);
+    std::vector<char> srcBmRows, dstBmRow;
+    const int srcBmX1 = std::max(srcBmBounds.x1, dstRoI.x1 * 2);
+    const int srcBmX2 = std::min(srcBmBounds.x2, dstRoI.x2 * 2);
+    if (copyBitMap) {
+        srcBmRows.resize(2 * srcBmRowSize);
+        dstBmRow.resize( dstBmBounds.width() );
+    }
+    // offset pointers so that srcBmData and dstBmData correspond to column 0
+    const char* const srcBmData = copyBitMap ? &srcBmRows[0] - srcBmBounds.x1 : 0;
+    char* const dstBmData       = copyBitMap ? &dstBmRow[0] - dstBmBounds.x1 : 0;
+
+    // The dst cols in [kernelX1, kernelX2) cover 2 src cols that are both within srcBounds: on rows that
+    // also cover 2 src rows, they are halved by the SIMD kernels.
+    const int kernelX1 = std::max( dstRoI.x1, (int)std::ceil(srcBounds.x1 / 2.) );
+    const int kernelX2 = std::min( dstRoI.x2, (int)std::floor(srcBounds.x2 / 2.) );
 
     for (int y = dstRoI.y1; y < dstRoI.y2; ++y) {
         const PIX* const srcLineStart    = srcData + y * 2 * srcRowSize;
         PIX* const dstLineStart          = dstData + y     * dstRowSize;
-        const char* const srcBmLineStart = srcBmData + y * 2 * srcBmRowSize;
-        char* const dstBmLineStart       = dstBmData + y     * dstBmRowSize;
+        const char* const srcBmLineStart = srcBmData;
+        char* const dstBmLineStart       = dstBmData;
 
         // The current dst row, at y, covers the src rows y*2 (thisRow) and y*2+1 (nextRow).
         // Check that if are within srcBounds.
@@ -981,6 +1212,15 @@ Image::halveRoIForDepth(const RectI & roi,
 
         int sumH = (int)pickNextRow + (int)pickThisRow;
         assert(sumH == 1 || sumH == 2);
+
+        if (copyBitMap && srcBmX1 < srcBmX2) {
+            if (pickThisRow) {
+                _bitmap.unpackRow(srcBmX1, srcBmX2, srcy, &srcBmRows[srcBmX1 - srcBmBounds.x1]);
+            }
+            if (pickNextRow) {
+                _bitmap.unpackRow(srcBmX1, srcBmX2, srcy + 1, &srcBmRows[srcBmRowSize + srcBmX1 - srcBmBounds.x1]);
+            }
+        }
         
         for (int x = dstRoI.x1; x < dstRoI.x2; ++x) {
             const PIX* const srcPixStart    = srcLineStart   + x * 2 * nComponents;
@@ -988,6 +1228,15 @@ Image::halveRoIForDepth(const RectI & roi,
             PIX* const dstPixStart          = dstLineStart   + x * nComponents;
             char* const dstBmPixStart       = dstBmLineStart + x;
 
+            if ( (x == kernelX1) && (sumH == 2) && (kernelX1 < kernelX2) ) {
+                ImageKernels::halveRows(srcPixStart, srcPixStart + srcRowSize, dstPixStart, kernelX2 - kernelX1, nComponents);
+                if (copyBitMap) {
+                    ImageKernels::halveBitmapRows(srcBmPixStart, srcBmPixStart + srcBmRowSize, dstBmPixStart, kernelX2 - kernelX1);
+                }
+                x = kernelX2 - 1;
+                continue;
+            }
+
             // The current dst col, at y, covers the src cols x*2 (thisCol) and x*2+1 (nextCol).
             // Check that if are within srcBounds.
             int srcx = x * 2;
@@ -1047,6 +1296,13 @@ Image::halveRoIForDepth(const RectI & roi,
                 assert(dstBmPixStart[0] == 0 || dstBmPixStart[0] == 1);
             }
         }
+
+        if (copyBitMap) {
+            output->_bitmap.packRow(dstRoI.x1, dstRoI.x2, y, &dstBmRow[dstRoI.x1 - dstBmBounds.x1]);
+        }
+    }
+    if (copyBitMap) {
+        output->_bitmap.updateTiles(dstRoI);
     }
 
 } // halveRoIForDepth
@@ -1163,7 +1419,7 @@ Image::downscaleMipMap(const RectI & roi,
 //    roiCanonical.toPixelEnclosing(toLevel, par , &dstRoI);
     unsigned int downscaleLvls = toLevel - fromLevel;
 
-    assert(!copyBitMap || _bitmap.getBitmap());
+    assert( !copyBitMap || usesBitMap() );
     
     RectI dstRoI  = roi.downscalePowerOfTwoSmallestEnclosing(downscaleLvls);
     
@@ -1267,6 +1523,17 @@ Image::upscaleMipMapForDepth(const RectI & roi,
         for (int xo = dstRoi.x1; xo < dstRoi.x2; ++xi, srcPix += components, xo += xcount, dstPixFirst += xcount * components) {
             xcount = scale + xo - xi * scale;
             //assert(0 < xcount && xcount <= scale);
+            if (xcount == scale) {
+                // all the following src pixels are entirely replicated, except maybe the last one
+                int nFullPixels = (dstRoi.x2 - xo) / scale;
+                if (nFullPixels > 0) {
+                    ImageKernels::upscaleRow(srcPix, dstPixFirst, nFullPixels, scale, components);
+                    xi += nFullPixels - 1;
+                    srcPix += (nFullPixels - 1) * components;
+                    xcount = nFullPixels * scale;
+                    continue;
+                }
+            }
             // replicate srcPix as many times as necessary
             PIX * dstPix = dstPixFirst;
             //assert((srcPix-(PIX*)pixelAt(srcRoi.x1, srcRoi.y1)) % components == 0);
@@ -1740,15 +2007,10 @@ Image::copyBitmapRowPortion(int x1, int x2,int y, const Image& other)
 void
 Bitmap::copyRowPortion(int x1,int x2,int y,const Bitmap& other)
 {
-    const char* srcBitmap = other.getBitmapAt(x1, y);
-    char* dstBitmap = getBitmapAt(x1, y);
-    const char* end = dstBitmap + (x2 - x1);
-    while (dstBitmap < end) {
-        *dstBitmap = *srcBitmap == PIXEL_UNAVAILABLE ? 0 : *srcBitmap;
-        ++dstBitmap;
-        ++srcBitmap;
-    }
-    
+    assert(x1 >= _bounds.x1 && x2 <= _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2);
+    assert(x1 >= other._bounds.x1 && x2 <= other._bounds.x2 && y >= other._bounds.y1 && y < other._bounds.y2);
+    copyRow(x1, x2, y, other);
+    updateTiles( RectI(x1, y, x2, y + 1) );
 }
 
 void
@@ -1766,28 +2028,232 @@ Bitmap::copyBitmapPortion(const RectI& roi, const Bitmap& other)
     assert(roi.x1 >= _bounds.x1 && roi.x2 <= _bounds.x2 && roi.y1 >= _bounds.y1 && roi.y2 <= _bounds.y2);
     assert(roi.x1 >= other._bounds.x1 && roi.x2 <= other._bounds.x2 && roi.y1 >= other._bounds.y1 && roi.y2 <= other._bounds.y2);
     
-    int srcRowSize = other._bounds.width();
-    int dstRowSize = _bounds.width();
-    
-    const char* srcBitmap = other.getBitmapAt(roi.x1, roi.y1);
-    char* dstBitmap = getBitmapAt(roi.x1, roi.y1);
-    
-    for (int y = roi.y1; y < roi.y2; ++y,
-         srcBitmap += srcRowSize,
-         dstBitmap += dstRowSize) {
-        
-        const char* srcCur = srcBitmap;
-        const char* srcEnd = srcBitmap + roi.width();
-        char* dstCur = dstBitmap;
-        while (srcCur < srcEnd) {
-            *dstCur = *srcCur == PIXEL_UNAVAILABLE ? 0 : *srcCur;
-            ++srcCur;
-            ++dstCur;
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        copyRow(roi.x1, roi.x2, y, other);
+    }
+    updateTiles(roi);
+}
+
+///Converts the n values of src, separated by srcDelta elements, to the n values of dst separated by dstDelta elements.
+///Rows of contiguous values are converted by the ImageKernels.
+template <typename SRCPIX,typename DSTPIX>
+bool
+convertDepthContiguous(const SRCPIX* /*src*/,
+                       DSTPIX* /*dst*/,
+                       int /*n*/)
+{
+    return false;
+}
+
+template <typename PIX>
+bool
+convertDepthContiguous(const PIX* src,
+                       PIX* dst,
+                       int n)
+{
+    std::copy(src, src + n, dst);
+
+    return true;
+}
+
+static bool
+convertDepthContiguous(const float* src,
+                       unsigned char* dst,
+                       int n)
+{
+    ImageKernels::convertFloatToByte(src, dst, n);
+
+    return true;
+}
+
+static bool
+convertDepthContiguous(const float* src,
+                       unsigned short* dst,
+                       int n)
+{
+    ImageKernels::convertFloatToShort(src, dst, n);
+
+    return true;
+}
+
+static bool
+convertDepthContiguous(const unsigned char* src,
+                       float* dst,
+                       int n)
+{
+    ImageKernels::convertByteToFloat(src, dst, n);
+
+    return true;
+}
+
+static bool
+convertDepthContiguous(const unsigned short* src,
+                       float* dst,
+                       int n)
+{
+    ImageKernels::convertShortToFloat(src, dst, n);
+
+    return true;
+}
+
+template <typename SRCPIX,typename DSTPIX>
+void
+convertDepthRow(const SRCPIX* src,
+                int srcDelta,
+                DSTPIX* dst,
+                int dstDelta,
+                int n)
+{
+    if ( (srcDelta == 1) && (dstDelta == 1) && convertDepthContiguous(src, dst, n) ) {
+        return;
+    }
+    for (int x = 0; x < n; ++x, src += srcDelta, dst += dstDelta) {
+        *dst = convertPixelDepth<SRCPIX, DSTPIX>(*src);
+    }
+}
+
+template <typename PIX,int maxValue>
+void
+invertRow(PIX* pixels,
+          int delta,
+          int n)
+{
+    for (int x = 0; x < n; ++x, pixels += delta) {
+        *pixels = maxValue - *pixels;
+    }
+}
+
+template <typename PIX>
+void
+fillRow(PIX* pixels,
+        int delta,
+        int n,
+        PIX value)
+{
+    for (int x = 0; x < n; ++x, pixels += delta) {
+        *pixels = value;
+    }
+}
+
+///Converts n values separated by srcDelta elements from the colorspace of srcLut to linear float.
+///If srcLut is NULL, only the depth is converted.
+static void
+toLinearFloatRow(const unsigned char* src,
+                 int srcDelta,
+                 float* dst,
+                 int n,
+                 const Natron::Color::Lut* srcLut)
+{
+    if (srcLut) {
+        srcLut->fromColorSpaceUint8ToLinearFloatFast(src, srcDelta, dst, n);
+    } else {
+        convertDepthRow(src, srcDelta, dst, 1, n);
+    }
+}
+
+static void
+toLinearFloatRow(const unsigned short* src,
+                 int srcDelta,
+                 float* dst,
+                 int n,
+                 const Natron::Color::Lut* srcLut)
+{
+    if (srcLut) {
+        for (int x = 0; x < n; ++x, src += srcDelta) {
+            dst[x] = srcLut->fromColorSpaceUint16ToLinearFloatFast(*src);
+        }
+    } else {
+        convertDepthRow(src, srcDelta, dst, 1, n);
+    }
+}
+
+static void
+toLinearFloatRow(const float* src,
+                 int srcDelta,
+                 float* dst,
+                 int n,
+                 const Natron::Color::Lut* srcLut)
+{
+    if (srcLut) {
+        for (int x = 0; x < n; ++x, src += srcDelta) {
+            dst[x] = srcLut->fromColorSpaceFloatToLinearFloat(*src);
         }
+    } else {
+        convertDepthRow(src, srcDelta, dst, 1, n);
+    }
+}
+
+///Converts the n contiguous linear float values of src to the colorspace of dstLut into n values of dst separated by dstDelta elements.
+///If dstLut is NULL, only the depth is converted.
+///For 8-bit images the quantization error is diffused along the row, from start to the end and then from start - 1 to
+///the beginning of the row. quantized must hold at least n values.
+static void
+fromLinearFloatRow(const float* src,
+                   unsigned short* quantized,
+                   unsigned char* dst,
+                   int dstDelta,
+                   int n,
+                   int start,
+                   const Natron::Color::Lut* dstLut)
+{
+    if (dstLut) {
+        dstLut->toColorSpaceUint8xxFromLinearFloatFast(src, 1, quantized, n);
+    } else {
+        for (int x = 0; x < n; ++x) {
+            quantized[x] = Color::floatToInt<0xff01>(src[x]);
+        }
+    }
+    unsigned error = 0x80;
+    for (int x = start; x < n; ++x) {
+        error = (error & 0xff) + quantized[x];
+        dst[x * dstDelta] = (unsigned char)(error >> 8);
+    }
+    error = 0x80;
+    for (int x = start - 1; x >= 0; --x) {
+        error = (error & 0xff) + quantized[x];
+        dst[x * dstDelta] = (unsigned char)(error >> 8);
+    }
+}
+
+static void
+fromLinearFloatRow(const float* src,
+                   unsigned short* /*quantized*/,
+                   unsigned short* dst,
+                   int dstDelta,
+                   int n,
+                   int /*start*/,
+                   const Natron::Color::Lut* dstLut)
+{
+    if (dstLut) {
+        for (int x = 0; x < n; ++x, dst += dstDelta) {
+            *dst = dstLut->toColorSpaceUint16FromLinearFloatFast(src[x]);
+        }
+    } else {
+        convertDepthRow(src, 1, dst, dstDelta, n);
+    }
+}
+
+static void
+fromLinearFloatRow(const float* src,
+                   unsigned short* /*quantized*/,
+                   float* dst,
+                   int dstDelta,
+                   int n,
+                   int /*start*/,
+                   const Natron::Color::Lut* dstLut)
+{
+    if (dstLut) {
+        for (int x = 0; x < n; ++x, dst += dstDelta) {
+            *dst = dstLut->toColorSpaceFloatFromLinearFloat(src[x]);
+        }
+    } else {
+        convertDepthRow(src, 1, dst, dstDelta, n);
     }
 }
 
 ///Fast version when components are the same
+///Each row is converted one channel at a time so that the colorspace and depth branches are taken once per row
+///and that contiguous rows are converted by the SIMD kernels.
 template <typename SRCPIX,typename DSTPIX,int srcMaxValue,int dstMaxValue>
 void
 convertToFormatInternal_sameComps(const RectI & renderWindow,
@@ -1805,8 +2271,6 @@ convertToFormatInternal_sameComps(const RectI & renderWindow,
         return;
     }
 
-    Natron::ImageBitDepthEnum dstDepth = dstImg.getBitDepth();
-    Natron::ImageBitDepthEnum srcDepth = srcImg.getBitDepth();
     int nComp = (int)srcImg.getComponentsCount();
     const Natron::Color::Lut* srcLut = lutFromColorspace(srcColorSpace);
     const Natron::Color::Lut* dstLut = lutFromColorspace(dstColorSpace);
@@ -1818,78 +2282,42 @@ convertToFormatInternal_sameComps(const RectI & renderWindow,
     if (intersection.isNull()) {
         return;
     }
-    for (int y = 0; y < intersection.height(); ++y) {
-        int start = rand() % intersection.width();
-        const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
-        DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
-        const SRCPIX* srcStart = srcPixels;
-        DSTPIX* dstStart = dstPixels;
-
-        for (int backward = 0; backward < 2; ++backward) {
-            int x = backward ? start - 1 : start;
-            int end = backward ? -1 : intersection.width();
-            unsigned error[3] = {
-                0x80,0x80,0x80
-            };
-
-            while ( x != end && x >= 0 && x < intersection.width() ) {
-                for (int k = 0; k < nComp; ++k) {
-                    if ( k == 3 || (!srcLut && !dstLut) ) {
-                        DSTPIX pix = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[k]);
-                        dstPixels[k] = invert ? dstMaxValue - pix : pix;
 
-                    } else {
-                        float pixFloat;
-
-                        if (srcLut) {
-                            if (srcDepth == eImageBitDepthByte) {
-                                pixFloat = srcLut->fromColorSpaceUint8ToLinearFloatFast(srcPixels[k]);
-                            } else if (srcDepth == eImageBitDepthShort) {
-                                pixFloat = srcLut->fromColorSpaceUint16ToLinearFloatFast(srcPixels[k]);
-                            } else {
-                                pixFloat = srcLut->fromColorSpaceFloatToLinearFloat(srcPixels[k]);
-                            }
-                        } else {
-                            pixFloat = convertPixelDepth<SRCPIX, float>(srcPixels[k]);
-                        }
-
-
-                        DSTPIX pix;
-                        if (dstDepth == eImageBitDepthByte) {
-                            ///small increase in perf we use Luts. This should be anyway the most used case.
-                            error[k] = (error[k] & 0xff) + ( dstLut ? dstLut->toColorSpaceUint8xxFromLinearFloatFast(pixFloat) :
-                                                             Color::floatToInt<0xff01>(pixFloat) );
-                            pix = error[k] >> 8;
-                        } else if (dstDepth == eImageBitDepthShort) {
-                            pix = dstLut ? dstLut->toColorSpaceUint16FromLinearFloatFast(pixFloat) :
-                                  convertPixelDepth<float, DSTPIX>(pixFloat);
-                        } else {
-                            if (dstLut) {
-                                pixFloat = dstLut->toColorSpaceFloatFromLinearFloat(pixFloat);
-                            }
-                            pix = convertPixelDepth<float, DSTPIX>(pixFloat);
-                        }
-                        dstPixels[k] = invert ? dstMaxValue - pix : pix;
-                    }
-                }
+    int width = intersection.width();
+    ///scratch rows of a single channel
+    std::vector<float> linear(width);
+    std::vector<unsigned short> quantized(width);
 
-                if (backward) {
-                    --x;
-                    srcPixels -= nComp;
-                    dstPixels -= nComp;
+    for (int y = 0; y < intersection.height(); ++y) {
+        ///Start of the line for error diffusion
+        int start = rand() % width;
+        const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1, intersection.y1 + y);
+        DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1, intersection.y1 + y);
+
+        if (!srcLut && !dstLut) {
+            ///the whole row is contiguous
+            convertDepthRow(srcPixels, 1, dstPixels, 1, width * nComp);
+            if (invert) {
+                invertRow<DSTPIX, dstMaxValue>(dstPixels, 1, width * nComp);
+            }
+        } else {
+            for (int k = 0; k < nComp; ++k) {
+                if (k == 3) {
+                    convertDepthRow(srcPixels + k, nComp, dstPixels + k, nComp, width);
                 } else {
-                    ++x;
-                    srcPixels += nComp;
-                    dstPixels += nComp;
+                    toLinearFloatRow(srcPixels + k, nComp, &linear[0], width, srcLut);
+                    fromLinearFloatRow(&linear[0], &quantized[0], dstPixels + k, nComp, width, start, dstLut);
+                }
+                if (invert) {
+                    invertRow<DSTPIX, dstMaxValue>(dstPixels + k, nComp, width);
                 }
             }
-            srcPixels = srcStart - nComp;
-            dstPixels = dstStart - nComp;
         }
+    }
 
-        if (copyBitmap) {
-            dstImg.copyBitmapRowPortion(intersection.x1, intersection.x2, intersection.y1 + y, srcImg);
-        }
+    if (copyBitmap) {
+        ///copied at once so that the tiles of the bitmap are updated only once
+        dstImg.copyBitmapPortion(intersection, srcImg);
     }
 } // convertToFormatInternal_sameComps
 
@@ -1938,7 +2366,6 @@ convertToFormatInternal(const RectI & renderWindow,
     }
 
     Natron::ImageBitDepthEnum dstDepth = dstImg.getBitDepth();
-    Natron::ImageBitDepthEnum srcDepth = dstDepth;
 
     ///special case comp == alpha && channelForAlpha = -1 clear out the mask
     if ( dstNComps == 1 && (channelForAlpha == -1) ) {
@@ -1957,159 +2384,95 @@ convertToFormatInternal(const RectI & renderWindow,
 
     const Natron::Color::Lut* srcLut = lutFromColorspace(srcColorSpace);
     const Natron::Color::Lut* dstLut = lutFromColorspace(dstColorSpace);
-    
+
+    ///In this case we've RGB or RGBA input and outputs
+    bool unpremultChannel = (srcImg.getComponents() == Natron::eImageComponentRGBA &&
+                             dstImg.getComponents() == Natron::eImageComponentRGB &&
+                             requiresUnpremult);
+
+    int width = intersection.width();
+    ///scratch rows of a single channel
+    std::vector<float> linear(width);
+    std::vector<float> alphaForUnPremult(unpremultChannel ? width : 0);
+    std::vector<unsigned short> quantized(width);
+
     for (int y = 0; y < intersection.height(); ++y) {
-        
+
         ///Start of the line for error diffusion
-        int start = rand() % intersection.width();
-        
-        const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
-        
-        DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
-        
-        const SRCPIX* srcStart = srcPixels;
-        DSTPIX* dstStart = dstPixels;
+        int start = rand() % width;
 
-        for (int backward = 0; backward < 2; ++backward) {
-            
-            ///We do twice the loop, once from starting point to end and once from starting point - 1 to real start
-            int x = backward ? start - 1 : start;
-            
-            //End is pointing to the first pixel outside the line a la stl
-            int end = backward ? -1 : intersection.width();
-            unsigned error[3] = {
-                0x80,0x80,0x80
-            };
-
-            while ( x != end && x >= 0 && x < intersection.width() ) {
-                if (dstNComps == 1) {
-                    ///If we're converting to alpha, we just have to handle pixel depth conversion
-                    DSTPIX pix;
-
-                    // convertPixelDepth is optimized when SRCPIX == DSTPIX
-
-                    switch (srcNComps) {
-                        case 4:
-                            pix = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[channelForAlpha]);
-                            break;
-                        case 3:
-                            // RGB is opaque but the channelForAlpha can be 0-2
-                            pix = convertPixelDepth<SRCPIX, DSTPIX>(channelForAlpha == -1 ? 0. : srcPixels[channelForAlpha]);
-                            break;
-                        case 1:
-                            pix  = convertPixelDepth<SRCPIX, DSTPIX>(*srcPixels);
-                            break;
-                    }
+        const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1, intersection.y1 + y);
+        DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1, intersection.y1 + y);
 
-                    dstPixels[0] = invert ? dstMaxValue - pix: pix;
-                } else {
-                    
-                    if (srcNComps == 1) {
-                        ///If we're converting from alpha, R G and B are 0.
-                        //assert(dstNComps == 3 || dstNComps == 4);
-                        for (int k = 0; k < std::min(3, dstNComps); ++k) {
-                            dstPixels[k] = invert ? dstMaxValue : 0;
-                        }
-                        if (dstNComps == 4) {
-                            DSTPIX pix = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[0]);
-                            dstPixels[dstNComps - 1] = invert ? dstMaxValue - pix: pix;
-                        }
+        if (dstNComps == 1) {
+            ///If we're converting to alpha, we just have to handle pixel depth conversion
+            if (srcNComps == 1) {
+                convertDepthRow(srcPixels, 1, dstPixels, 1, width);
+            } else {
+                // RGB is opaque but the channelForAlpha can be 0-2
+                convertDepthRow(srcPixels + channelForAlpha, srcNComps, dstPixels, 1, width);
+            }
+            if (invert) {
+                invertRow<DSTPIX, dstMaxValue>(dstPixels, 1, width);
+            }
+        } else if (srcNComps == 1) {
+            ///If we're converting from alpha, R G and B are 0.
+            for (int k = 0; k < std::min(3, dstNComps); ++k) {
+                fillRow<DSTPIX>(dstPixels + k, dstNComps, width, invert ? dstMaxValue : 0);
+            }
+            if (dstNComps == 4) {
+                convertDepthRow(srcPixels, 1, dstPixels + dstNComps - 1, dstNComps, width);
+                if (invert) {
+                    invertRow<DSTPIX, dstMaxValue>(dstPixels + dstNComps - 1, dstNComps, width);
+                }
+            }
+        } else {
+            ///In this case we've RGB or RGBA input and outputs
+            assert(srcImg.getComponents() != dstImg.getComponents());
+
+            if (unpremultChannel) {
+                convertDepthRow(srcPixels + srcNComps - 1, srcNComps, &alphaForUnPremult[0], 1, width);
+            }
+
+            for (int k = 0; k < dstNComps; ++k) {
+                if (k == 3) {
+                    ///For alpha channel, fill with 0, we reach here only if converting RGB-->RGBA
+                    DSTPIX pix = convertPixelDepth<float, DSTPIX>(0.f);
+                    fillRow<DSTPIX>(dstPixels + k, dstNComps, width, invert ? dstMaxValue - pix : pix);
+                    continue;
+                } else if (!srcLut && !dstLut) {
+                    if (dstDepth == eImageBitDepthByte) {
+                        convertDepthRow(srcPixels + k, srcNComps, &linear[0], 1, width);
+                        fromLinearFloatRow(&linear[0], &quantized[0], dstPixels + k, dstNComps, width, start, 0);
                     } else {
-                        ///In this case we've RGB or RGBA input and outputs
-                        assert(srcImg.getComponents() != dstImg.getComponents());
-                        
-                        bool unpremultChannel = (srcImg.getComponents() == Natron::eImageComponentRGBA &&
-                                                 dstImg.getComponents() == Natron::eImageComponentRGB &&
-                                                 requiresUnpremult);
-                        
-                        ///This is only set if unpremultChannel is true
-                        float alphaForUnPremult;
-                        if (unpremultChannel) {
-                            alphaForUnPremult = convertPixelDepth<SRCPIX, float>(srcPixels[srcNComps - 1]);
-                        } else {
-                            alphaForUnPremult = 0.;
+                        convertDepthRow(srcPixels + k, srcNComps, dstPixels + k, dstNComps, width);
+                    }
+                } else {
+                    ///Unpremult before doing colorspace conversion from linear to X
+                    if (unpremultChannel) {
+                        convertDepthRow(srcPixels + k, srcNComps, &linear[0], 1, width);
+                        for (int x = 0; x < width; ++x) {
+                            linear[x] = alphaForUnPremult[x] == 0.f ? 0.f : linear[x] / alphaForUnPremult[x];
                         }
-                        
-                        for (int k = 0; k < dstNComps; ++k) {
-                            if (k == 3) {
-                                ///For alpha channel, fill with 1, we reach here only if converting RGB-->RGBA
-                                DSTPIX pix = convertPixelDepth<float, DSTPIX>(0.f);
-                                dstPixels[k] = invert ? dstMaxValue - pix : pix;
-
-                            } else if (!srcLut && !dstLut) {
-                                DSTPIX pix;
-                                if (dstDepth == eImageBitDepthByte) {
-                                    float pixFloat = convertPixelDepth<SRCPIX, float>(srcPixels[k]);
-                                    error[k] = (error[k] & 0xff) + ( dstLut ? dstLut->toColorSpaceUint8xxFromLinearFloatFast(pixFloat) :
-                                                                    Color::floatToInt<0xff01>(pixFloat) );
-                                    pix = error[k] >> 8;
-
-                                } else {
-                                    pix = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[k]);
-                                }
-                                dstPixels[k] = invert ? dstMaxValue - pix : pix;
-                            } else {
-                                ///For RGB channels
-                                float pixFloat;
-                                
-                                ///Unpremult before doing colorspace conversion from linear to X
-                                if (unpremultChannel) {
-                                    pixFloat = convertPixelDepth<SRCPIX, float>(srcPixels[k]);
-                                    pixFloat = alphaForUnPremult == 0.f ? 0. : pixFloat / alphaForUnPremult;
-                                    if (srcLut) {
-                                        pixFloat = srcLut->fromColorSpaceFloatToLinearFloat(pixFloat);
-                                    }
-
-                                } else if (srcLut) {
-                                    if (srcDepth == eImageBitDepthByte) {
-                                        pixFloat = srcLut->fromColorSpaceUint8ToLinearFloatFast(srcPixels[k]);
-                                    } else if (srcDepth == eImageBitDepthShort) {
-                                        pixFloat = srcLut->fromColorSpaceUint16ToLinearFloatFast(srcPixels[k]);
-                                    } else {
-                                        pixFloat = srcLut->fromColorSpaceFloatToLinearFloat(srcPixels[k]);
-                                    }
-                                } else {
-                                    pixFloat = convertPixelDepth<SRCPIX, float>(srcPixels[k]);
-                                }
-
-                                ///Apply dst color-space
-                                DSTPIX pix;
-                                if (dstDepth == eImageBitDepthByte) {
-                                    error[k] = (error[k] & 0xff) + ( dstLut ? dstLut->toColorSpaceUint8xxFromLinearFloatFast(pixFloat) :
-                                                                    Color::floatToInt<0xff01>(pixFloat) );
-                                    pix = error[k] >> 8;
-
-                                } else if (dstDepth == eImageBitDepthShort) {
-                                    pix = dstLut ? dstLut->toColorSpaceUint16FromLinearFloatFast(pixFloat) :
-                                    convertPixelDepth<float, DSTPIX>(pixFloat);
-
-                                } else {
-                                    if (dstLut) {
-                                        pixFloat = dstLut->toColorSpaceFloatFromLinearFloat(pixFloat);
-                                    }
-                                    pix = convertPixelDepth<float, DSTPIX>(pixFloat);
-                                }
-                                dstPixels[k] = invert ? dstMaxValue - pix : pix;
+                        if (srcLut) {
+                            for (int x = 0; x < width; ++x) {
+                                linear[x] = srcLut->fromColorSpaceFloatToLinearFloat(linear[x]);
                             }
                         }
+                    } else {
+                        toLinearFloatRow(srcPixels + k, srcNComps, &linear[0], width, srcLut);
                     }
-                }
 
-                if (backward) {
-                    --x;
-                    srcPixels -= srcNComps;
-                    dstPixels -= dstNComps;
-                } else {
-                    ++x;
-                    srcPixels += srcNComps;
-                    dstPixels += dstNComps;
+                    ///Apply dst color-space
+                    fromLinearFloatRow(&linear[0], &quantized[0], dstPixels + k, dstNComps, width, start, dstLut);
+                }
+                if (invert) {
+                    invertRow<DSTPIX, dstMaxValue>(dstPixels + k, dstNComps, width);
                 }
             }
-            srcPixels = srcStart - srcNComps;
-            dstPixels = dstStart - dstNComps;
         }
     }
-    
+
     if (copyBitmap) {
         dstImg.copyBitmapPortion(intersection, srcImg);
     }
@@ -33,26 +33,56 @@ CLANG_DIAG_ON(deprecated)
 #include "Engine/OutputSchedulerThread.h"
 
 
+/**
+ * @brief The size in pixels of the square tiles a Bitmap is divided into, starting from the bottom left corner of its bounds.
+ * It must be a multiple of NATRON_BITMAP_PIXELS_PER_WORD.
+ **/
+#define NATRON_BITMAP_TILE_SIZE 128
+
+///The number of pixels packed in each 64 bits word of a Bitmap
+#define NATRON_BITMAP_PIXELS_PER_WORD 32
+
 namespace Natron {
 
-    
+    /**
+     * @brief Marks which pixels of an image are rendered (1), not rendered (0) or being rendered by another thread (2, trimap only).
+     * The state of each pixel is packed on 2 bits, each row starting on a new 64 bits word, so that the bitmap can be scanned
+     * a word at a time.
+     * On top of the per-pixel map, the state of each tile of NATRON_BITMAP_TILE_SIZE x NATRON_BITMAP_TILE_SIZE pixels is kept
+     * up to date by all the functions writing to the bitmap, so that looking for the non rendered parts of a region only
+     * has to read the pixels of the tiles that are partially rendered.
+     **/
     class Bitmap
     {
     public:
+        
+        enum TileStateEnum
+        {
+            eTileStateNotRendered = 0, //< all the pixels of the tile are 0
+            eTileStateRendered, //< all the pixels of the tile are 1
+            eTileStateMixed //< anything else
+        };
+        
         Bitmap(const RectI & bounds)
             : _bounds(bounds)
-            , _map( bounds.area() )
+            , _map()
+            , _wordsPerRow(0)
+            , _tiles()
+            , _tilesPerRow(0)
         {
             //Do not assert !rod.isNull() : An empty image can be created for entries that correspond to
             // "identities" images (i.e: images that are just a link to another image). See EffectInstance :
             // "!!!Note that if isIdentity is true it will allocate an empty image object with 0 bytes of data."
             //assert(!rod.isNull());
-            std::fill(_map.begin(), _map.end(), 0);
+            allocate();
         }
 
         Bitmap()
             : _bounds()
             , _map()
+            , _wordsPerRow(0)
+            , _tiles()
+            , _tilesPerRow(0)
         {
         }
 
@@ -60,9 +90,7 @@ namespace Natron {
         {
             assert(_map.size() == 0);
             _bounds = bounds;
-            _map.resize( _bounds.area() );
-
-            std::fill(_map.begin(), _map.end(), 0);
+            allocate();
         }
 
         ~Bitmap()
@@ -72,13 +100,19 @@ namespace Natron {
         
         void setTo1()
         {
-            std::fill(_map.begin(),_map.end(),1);
+            fill(_bounds, 1);
         }
 
         const RectI & getBounds() const
         {
             return _bounds;
         }
+        
+        ///The memory used by the bitmap, in bytes
+        std::size_t getMemorySize() const
+        {
+            return _map.size() * sizeof(U64) + _tiles.size();
+        }
 
 #if NATRON_ENABLE_TRIMAP
         void minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,bool* isBeingRenderedElsewhere) const;
@@ -99,26 +133,69 @@ namespace Natron {
         
         void clear(const RectI& roi);
 
-        const char* getBitmap() const
+        ///Returns the value of the (x,y) pixel, which must be within the bounds
+        char getValueAt(int x,int y) const
         {
-            return &_map.front();
+            assert( x >= _bounds.x1 && x < _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2 );
+            int i = x - _bounds.x1;
+            return (char)( ( getPackedRow(y)[i / NATRON_BITMAP_PIXELS_PER_WORD] >> ( 2 * (i % NATRON_BITMAP_PIXELS_PER_WORD) ) ) & 3 );
         }
-
-        char* getBitmap()
+        
+        ///The words of the row y, which must be within the bounds. The pixel x is at index x - getBounds().x1.
+        const U64* getPackedRow(int y) const
         {
-            return &_map.front();
+            return &_map[(y - _bounds.y1) * _wordsPerRow];
         }
-
-        const char* getBitmapAt(int x,int y) const;
-        char* getBitmapAt(int x,int y);
+        
+        ///Writes the values of the pixels [x1,x2) of row y to dst, one char per pixel
+        void unpackRow(int x1,int x2,int y,char* dst) const;
+        
+        ///Sets the values of the pixels [x1,x2) of row y from src, one char per pixel.
+        ///updateTiles() must be called once the rows are written.
+        void packRow(int x1,int x2,int y,const char* src);
         
         void copyRowPortion(int x1,int x2,int y,const Bitmap& other);
         
         void copyBitmapPortion(const RectI& roi, const Bitmap& other);
         
+        /**
+         * @brief Recomputes the state of the tiles intersecting roi. This must be called after writing pixels with packRow().
+         **/
+        void updateTiles(const RectI& roi);
+        
+        ///The (x,y) pixel must be within the bounds
+        TileStateEnum getTileStateAt(int x,int y) const
+        {
+            assert( x >= _bounds.x1 && x < _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2 );
+            return (TileStateEnum)_tiles[( (y - _bounds.y1) / NATRON_BITMAP_TILE_SIZE ) * _tilesPerRow + (x - _bounds.x1) / NATRON_BITMAP_TILE_SIZE];
+        }
+        
     private:
+        
+        ///Allocates the map and the tiles for the bounds, all the pixels being 0
+        void allocate();
+        
+        U64* getWritableRow(int y)
+        {
+            return &_map[(y - _bounds.y1) * _wordsPerRow];
+        }
+        
+        ///Fills the roi with value and updates the tiles it intersects
+        void fill(const RectI& roi,char value);
+        
+        ///Copies the pixels [x1,x2) of row y from other, pixels being rendered in other are copied as not rendered
+        void copyRow(int x1,int x2,int y,const Bitmap& other);
+        
+        ///If value is not -1, roi was just filled with it, otherwise the tiles partially covered by roi are scanned
+        void updateTilesInternal(const RectI& roi,int value);
+        
+        TileStateEnum computeTileState(const RectI& tile) const;
+        
         RectI _bounds;
-        std::vector<char> _map;
+        std::vector<U64> _map; //< 2 bits per pixel, _wordsPerRow words per row
+        int _wordsPerRow;
+        std::vector<char> _tiles; //< one TileStateEnum per tile, row by row from the bottom left tile
+        int _tilesPerRow;
     };
 
     class Image
@@ -208,7 +285,7 @@ namespace Natron {
         };
         virtual size_t size() const OVERRIDE FINAL
         {
-            return dataSize() + _bitmap.getBounds().area();
+            return dataSize() + _bitmap.getMemorySize();
         }
 
 
@@ -264,18 +341,6 @@ namespace Natron {
      * @brief Same as getElementsCount(getComponents()) * getBounds().width()
      **/
         unsigned int getRowElements() const;
-        const char* getBitmapAt(int x,
-                                int y) const
-        {
-            return this->_bitmap.getBitmapAt(x,y);
-        }
-
-        char* getBitmapAt(int x,
-                          int y)
-        {
-            return this->_bitmap.getBitmapAt(x,y);
-        }
-
         /**
      * @brief Returns a list of portions of image that are not yet rendered within the
      * region of interest given. This internally uses the bitmap to know what portion
@@ -0,0 +1,1505 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "ImageKernels.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/Lut.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NATRON_IMAGE_KERNELS_X86
+#endif
+
+#ifdef NATRON_IMAGE_KERNELS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+// MSVC lets any function use any intrinsic
+#define NATRON_TARGET_SSE2
+#define NATRON_TARGET_AVX2
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+// The translation unit is compiled for the baseline architecture, only the functions below may use these instructions
+#define NATRON_TARGET_SSE2 __attribute__( ( target("sse2") ) )
+#define NATRON_TARGET_AVX2 __attribute__( ( target("avx2") ) )
+#endif
+#endif
+
+using namespace Natron::ImageKernels;
+
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// CPU features detection
+
+#ifdef NATRON_IMAGE_KERNELS_X86
+void
+cpuid(int leaf,
+      int subLeaf,
+      int info[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subLeaf);
+#else
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    __cpuid_count(leaf, subLeaf, a, b, c, d);
+    info[0] = (int)a;
+    info[1] = (int)b;
+    info[2] = (int)c;
+    info[3] = (int)d;
+#endif
+}
+
+///Returns the features enabled by the OS in the XCR0 register
+U64
+xgetbv0()
+{
+#ifdef _MSC_VER
+    return (U64)_xgetbv(0);
+#else
+    unsigned int eax, edx;
+    // xgetbv, encoded so that old assemblers accept it
+    __asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ( (U64)edx << 32 ) | eax;
+#endif
+}
+#endif // NATRON_IMAGE_KERNELS_X86
+
+InstructionSetEnum
+detectInstructionSet()
+{
+#ifdef NATRON_IMAGE_KERNELS_X86
+    int info[4];
+    cpuid(0, 0, info);
+    int nIds = info[0];
+    if (nIds < 1) {
+        return eInstructionSetScalar;
+    }
+    cpuid(1, 0, info);
+    bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+    if (!hasSSE2) {
+        return eInstructionSetScalar;
+    }
+    bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+    bool hasAVX = (info[2] & (1 << 28)) != 0;
+    ///The OS must save the YMM registers on context switches, otherwise AVX instructions are unusable
+    if ( (nIds >= 7) && hasOSXSAVE && hasAVX && ( (xgetbv0() & 0x6) == 0x6 ) ) {
+        cpuid(7, 0, info);
+        if ( (info[1] & (1 << 5)) != 0 ) {
+            return eInstructionSetAVX2;
+        }
+    }
+
+    return eInstructionSetSSE2;
+#else
+    return eInstructionSetScalar;
+#endif
+}
+
+///Detected before main() so that no thread can race on it
+const InstructionSetEnum gSupportedInstructionSet = detectInstructionSet();
+
+///Only lowered by the tests, before any kernel runs
+InstructionSetEnum gInstructionSet = gSupportedInstructionSet;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ordered dithering
+
+/**
+ * @brief The 16x16 Bayer matrix of dithering thresholds in [0, 255], for each of them the thresholds of the 3 color
+ * components of a BGRA texel are stored as 16-bit words (the alpha word is 0) so that the SSE2 kernel can load them directly.
+ **/
+struct DitherMatrix
+{
+    unsigned short thresholds[16][16][4];
+
+    DitherMatrix()
+    {
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 16; ++x) {
+                ///The bits of the coordinates are interleaved in reverse order
+                int t = 0;
+                for (int bit = 0; bit < 4; ++bit) {
+                    t = (t << 2) | ( ( ( (x >> bit) ^ (y >> bit) ) & 1 ) << 1 ) | ( (y >> bit) & 1 );
+                }
+                thresholds[y][x][0] = thresholds[y][x][1] = thresholds[y][x][2] = (unsigned short)t;
+                thresholds[y][x][3] = 0;
+            }
+        }
+    }
+};
+
+///Initialized before main(), never modified afterwards
+const DitherMatrix gDitherMatrix;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scalar kernels: these compute exactly what Image::halveRoIForDepth and Image::upscaleMipMapForDepth compute
+
+template <typename PIX>
+void
+halveRowsScalar(const PIX* row0,
+                const PIX* row1,
+                PIX* dst,
+                int dstWidth,
+                int nComps)
+{
+    for (int x = 0; x < dstWidth; ++x, row0 += 2 * nComps, row1 += 2 * nComps, dst += nComps) {
+        for (int k = 0; k < nComps; ++k) {
+            ///a b
+            ///c d
+            const PIX a = row0[k];
+            const PIX b = row0[k + nComps];
+            const PIX c = row1[k];
+            const PIX d = row1[k + nComps];
+            dst[k] = (a + b + c + d) / 4;
+        }
+    }
+}
+
+void
+halveBitmapRowsScalar(const char* row0,
+                      const char* row1,
+                      char* dst,
+                      int dstWidth)
+{
+    for (int x = 0; x < dstWidth; ++x, row0 += 2, row1 += 2, ++dst) {
+        *dst = (row0[0] == 1 && row0[1] == 1 && row1[0] == 1 && row1[1] == 1) ? 1 : 0;
+    }
+}
+
+template <typename PIX>
+void
+upscaleRowScalar(const PIX* src,
+                 PIX* dst,
+                 int srcWidth,
+                 int scale,
+                 int nComps)
+{
+    for (int x = 0; x < srcWidth; ++x, src += nComps) {
+        for (int i = 0; i < scale; ++i, dst += nComps) {
+            for (int c = 0; c < nComps; ++c) {
+                dst[c] = src[c];
+            }
+        }
+    }
+}
+
+template <int numvals, typename DSTPIX>
+void
+convertFloatToIntScalar(const float* src,
+                        DSTPIX* dst,
+                        int n)
+{
+    for (int i = 0; i < n; ++i) {
+        // NaN != NaN
+        dst[i] = src[i] != src[i] ? 0 : (DSTPIX)Natron::Color::floatToInt<numvals>(src[i]);
+    }
+}
+
+template <int numvals, typename SRCPIX>
+void
+convertIntToFloatScalar(const SRCPIX* src,
+                        float* dst,
+                        int n)
+{
+    for (int i = 0; i < n; ++i) {
+        dst[i] = Natron::Color::intToFloat<numvals>(src[i]);
+    }
+}
+
+void
+computeHistogramBinsScalar(const float* src,
+                           int* dst,
+                           int n,
+                           float vmin,
+                           float vmax,
+                           float scale,
+                           int binsCount)
+{
+    const int lastBin = binsCount - 1;
+
+    for (int i = 0; i < n; ++i) {
+        const float v = src[i];
+        // false for NaNs
+        if ( (vmin <= v) && (v < vmax) ) {
+            ///(v - vmin) * scale may round up to binsCount for values just below vmax
+            const int bin = (int)( (v - vmin) * scale );
+            dst[i] = bin < lastBin ? bin : lastBin;
+        } else {
+            dst[i] = -1;
+        }
+    }
+}
+
+inline void
+updateMinMax(float v,
+             float* mini,
+             float* maxi)
+{
+    // false for NaNs
+    if (v < *mini) {
+        *mini = v;
+    }
+    if (v > *maxi) {
+        *maxi = v;
+    }
+}
+
+template <int nComps, Natron::DisplayChannelsEnum channels>
+void
+findMinMaxScalar(const float* src,
+                 int width,
+                 float* vmin,
+                 float* vmax)
+{
+    float mini = *vmin;
+    float maxi = *vmax;
+
+    for (int x = 0; x < width; ++x, src += nComps) {
+        const float r = nComps >= 3 ? src[0] : 0.f;
+        const float g = nComps >= 3 ? src[1] : 0.f;
+        const float b = nComps >= 3 ? src[2] : 0.f;
+        const float a = nComps == 4 ? src[3] : (nComps == 3 ? 1.f : src[0]);
+        switch (channels) {
+        case Natron::eDisplayChannelsRGB:
+            updateMinMax(r, &mini, &maxi);
+            updateMinMax(g, &mini, &maxi);
+            updateMinMax(b, &mini, &maxi);
+            break;
+        case Natron::eDisplayChannelsY:
+            updateMinMax(0.299f * r + 0.587f * g + 0.114f * b, &mini, &maxi);
+            break;
+        case Natron::eDisplayChannelsR:
+            updateMinMax(r, &mini, &maxi);
+            break;
+        case Natron::eDisplayChannelsG:
+            updateMinMax(g, &mini, &maxi);
+            break;
+        case Natron::eDisplayChannelsB:
+            updateMinMax(b, &mini, &maxi);
+            break;
+        case Natron::eDisplayChannelsA:
+            updateMinMax(a, &mini, &maxi);
+            break;
+        }
+    }
+    *vmin = mini;
+    *vmax = maxi;
+}
+
+///Same as the hipart() function of Lut.cpp: the index of a float in the look-up tables of Natron::Color::Lut
+inline unsigned int
+lutIndex(float v)
+{
+    unsigned int bits;
+
+    std::memcpy( &bits, &v, sizeof(float) );
+
+    return bits >> 16;
+}
+
+inline unsigned int
+floatToByte(float v)
+{
+    // NaN != NaN
+    return v != v ? 0 : (unsigned int)Natron::Color::floatToInt<256>(v);
+}
+
+void
+convertRGBAToBGRA8Scalar(const float* src,
+                         unsigned int* dst,
+                         int width,
+                         int x,
+                         int y,
+                         const unsigned short* toUint8xx)
+{
+    const unsigned short (*thresholds)[4] = gDitherMatrix.thresholds[y & 15];
+
+    for (int i = 0; i < width; ++i, src += 4) {
+        unsigned int r, g, b;
+        if (toUint8xx) {
+            const unsigned int t = thresholds[(x + i) & 15][0];
+            r = (toUint8xx[lutIndex(src[0])] + t) >> 8;
+            g = (toUint8xx[lutIndex(src[1])] + t) >> 8;
+            b = (toUint8xx[lutIndex(src[2])] + t) >> 8;
+        } else {
+            r = floatToByte(src[0]);
+            g = floatToByte(src[1]);
+            b = floatToByte(src[2]);
+        }
+        dst[i] = (floatToByte(src[3]) << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+///sum is the accumulated coverage of the pixels on the left of the row
+void
+accumulateCoverageScalar(const float* deltas,
+                         float* coverage,
+                         int n,
+                         float sum)
+{
+    for (int i = 0; i < n; ++i) {
+        sum += deltas[i];
+        const float c = std::fabs(sum);
+        coverage[i] = c < 1.f ? c : 1.f;
+    }
+}
+
+#ifdef NATRON_IMAGE_KERNELS_X86
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels. They handle the pixels they can and leave the remaining ones to the scalar kernels.
+// For 3 components, each pixel is computed in a 4-lanes register whose last lane overlaps the next pixel:
+// it is overwritten when the next pixel is computed, hence the last pixel of the row is left to the scalar kernel.
+
+inline int
+loadInt(const void* p)
+{
+    int ret;
+    std::memcpy(&ret, p, sizeof(int));
+    return ret;
+}
+
+inline void
+storeInt(void* p,
+         int v)
+{
+    std::memcpy(p, &v, sizeof(int));
+}
+
+///Packs 4 unsigned 32-bit integers lower than 65536 into the 4 lower unsigned 16-bit integers (SSE2 has no packus_epi32)
+NATRON_TARGET_SSE2 inline __m128i
+packU32ToU16SSE2(__m128i v)
+{
+    v = _mm_sub_epi32( v, _mm_set1_epi32(0x8000) );
+    v = _mm_packs_epi32(v, v);
+
+    return _mm_add_epi16( v, _mm_set1_epi16( (short)0x8000 ) );
+}
+
+NATRON_TARGET_SSE2 void
+halveRowsSSE2(const float* row0,
+              const float* row1,
+              float* dst,
+              int dstWidth,
+              int nComps)
+{
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    int x = 0;
+
+    ///The sums are made in the same order as the scalar code: ((a + b) + c) + d, and x / 4 == x * 0.25 exactly
+    if (nComps == 4) {
+        for (; x < dstWidth; ++x, row0 += 8, row1 += 8, dst += 4) {
+            __m128 s = _mm_add_ps( _mm_loadu_ps(row0), _mm_loadu_ps(row0 + 4) );
+            s = _mm_add_ps( s, _mm_loadu_ps(row1) );
+            s = _mm_add_ps( s, _mm_loadu_ps(row1 + 4) );
+            _mm_storeu_ps( dst, _mm_mul_ps(s, quarter) );
+        }
+    } else if (nComps == 1) {
+        for (; x + 4 <= dstWidth; x += 4, row0 += 8, row1 += 8, dst += 4) {
+            __m128 v0 = _mm_loadu_ps(row0);
+            __m128 v1 = _mm_loadu_ps(row0 + 4);
+            __m128 s = _mm_add_ps( _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(2, 0, 2, 0) ), _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            v0 = _mm_loadu_ps(row1);
+            v1 = _mm_loadu_ps(row1 + 4);
+            s = _mm_add_ps( s, _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(2, 0, 2, 0) ) );
+            s = _mm_add_ps( s, _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            _mm_storeu_ps( dst, _mm_mul_ps(s, quarter) );
+        }
+    } else if (nComps == 3) {
+        for (; x + 1 < dstWidth; ++x, row0 += 6, row1 += 6, dst += 3) {
+            __m128 s = _mm_add_ps( _mm_loadu_ps(row0), _mm_loadu_ps(row0 + 3) );
+            s = _mm_add_ps( s, _mm_loadu_ps(row1) );
+            s = _mm_add_ps( s, _mm_loadu_ps(row1 + 3) );
+            _mm_storeu_ps( dst, _mm_mul_ps(s, quarter) );
+        }
+    }
+    halveRowsScalar(row0, row1, dst, dstWidth - x, nComps);
+}
+
+NATRON_TARGET_SSE2 void
+halveRowsSSE2(const unsigned char* row0,
+              const unsigned char* row1,
+              unsigned char* dst,
+              int dstWidth,
+              int nComps)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+
+    ///The sums are made on 16 bits and divided by 4 with a shift, which is what the integer division does on positive values
+    if (nComps == 4) {
+        for (; x + 2 <= dstWidth; x += 2, row0 += 16, row1 += 16, dst += 8) {
+            __m128i v = _mm_loadu_si128( (const __m128i*)row0 );
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            __m128i s = _mm_add_epi16( _mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi) );
+            v = _mm_loadu_si128( (const __m128i*)row1 );
+            lo = _mm_unpacklo_epi8(v, zero);
+            hi = _mm_unpackhi_epi8(v, zero);
+            s = _mm_add_epi16( s, _mm_add_epi16( _mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi) ) );
+            s = _mm_srli_epi16(s, 2);
+            _mm_storel_epi64( (__m128i*)dst, _mm_packus_epi16(s, s) );
+        }
+    } else if (nComps == 1) {
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        for (; x + 8 <= dstWidth; x += 8, row0 += 16, row1 += 16, dst += 8) {
+            __m128i v = _mm_loadu_si128( (const __m128i*)row0 );
+            __m128i s = _mm_add_epi16( _mm_and_si128(v, mask), _mm_srli_epi16(v, 8) );
+            v = _mm_loadu_si128( (const __m128i*)row1 );
+            s = _mm_add_epi16( s, _mm_add_epi16( _mm_and_si128(v, mask), _mm_srli_epi16(v, 8) ) );
+            s = _mm_srli_epi16(s, 2);
+            _mm_storel_epi64( (__m128i*)dst, _mm_packus_epi16(s, s) );
+        }
+    } else if (nComps == 3) {
+        for (; x + 1 < dstWidth; ++x, row0 += 6, row1 += 6, dst += 3) {
+            __m128i s = _mm_add_epi16( _mm_unpacklo_epi8(_mm_cvtsi32_si128( loadInt(row0) ), zero),
+                                       _mm_unpacklo_epi8(_mm_cvtsi32_si128( loadInt(row0 + 3) ), zero) );
+            s = _mm_add_epi16( s, _mm_unpacklo_epi8(_mm_cvtsi32_si128( loadInt(row1) ), zero) );
+            s = _mm_add_epi16( s, _mm_unpacklo_epi8(_mm_cvtsi32_si128( loadInt(row1 + 3) ), zero) );
+            s = _mm_srli_epi16(s, 2);
+            storeInt( dst, _mm_cvtsi128_si32( _mm_packus_epi16(s, s) ) );
+        }
+    }
+    halveRowsScalar(row0, row1, dst, dstWidth - x, nComps);
+}
+
+NATRON_TARGET_SSE2 void
+halveRowsSSE2(const unsigned short* row0,
+              const unsigned short* row1,
+              unsigned short* dst,
+              int dstWidth,
+              int nComps)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+
+    ///The sums are made on 32 bits, 4 * 65535 does not fit on 16 bits
+    if (nComps == 4) {
+        for (; x < dstWidth; ++x, row0 += 8, row1 += 8, dst += 4) {
+            __m128i v = _mm_loadu_si128( (const __m128i*)row0 );
+            __m128i s = _mm_add_epi32( _mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero) );
+            v = _mm_loadu_si128( (const __m128i*)row1 );
+            s = _mm_add_epi32( s, _mm_add_epi32( _mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero) ) );
+            s = _mm_srli_epi32(s, 2);
+            _mm_storel_epi64( (__m128i*)dst, packU32ToU16SSE2(s) );
+        }
+    } else if (nComps == 1) {
+        const __m128i mask = _mm_set1_epi32(0x0000FFFF);
+        for (; x + 4 <= dstWidth; x += 4, row0 += 8, row1 += 8, dst += 4) {
+            __m128i v = _mm_loadu_si128( (const __m128i*)row0 );
+            __m128i s = _mm_add_epi32( _mm_and_si128(v, mask), _mm_srli_epi32(v, 16) );
+            v = _mm_loadu_si128( (const __m128i*)row1 );
+            s = _mm_add_epi32( s, _mm_add_epi32( _mm_and_si128(v, mask), _mm_srli_epi32(v, 16) ) );
+            s = _mm_srli_epi32(s, 2);
+            _mm_storel_epi64( (__m128i*)dst, packU32ToU16SSE2(s) );
+        }
+    } else if (nComps == 3) {
+        for (; x + 1 < dstWidth; ++x, row0 += 6, row1 += 6, dst += 3) {
+            __m128i s = _mm_add_epi32( _mm_unpacklo_epi16(_mm_loadl_epi64( (const __m128i*)row0 ), zero),
+                                       _mm_unpacklo_epi16(_mm_loadl_epi64( (const __m128i*)(row0 + 3) ), zero) );
+            s = _mm_add_epi32( s, _mm_unpacklo_epi16(_mm_loadl_epi64( (const __m128i*)row1 ), zero) );
+            s = _mm_add_epi32( s, _mm_unpacklo_epi16(_mm_loadl_epi64( (const __m128i*)(row1 + 3) ), zero) );
+            s = _mm_srli_epi32(s, 2);
+            _mm_storel_epi64( (__m128i*)dst, packU32ToU16SSE2(s) );
+        }
+    }
+    halveRowsScalar(row0, row1, dst, dstWidth - x, nComps);
+}
+
+///Returns in the lower byte of each 16-bit lane 0xFF if both bytes of the lane are 1, 0 otherwise
+NATRON_TARGET_SSE2 inline __m128i
+bitmapPairsRenderedSSE2(__m128i v)
+{
+    __m128i rendered = _mm_cmpeq_epi8( v, _mm_set1_epi8(1) );
+
+    return _mm_and_si128( rendered, _mm_srli_epi16(rendered, 8) );
+}
+
+NATRON_TARGET_SSE2 void
+halveBitmapRowsSSE2(const char* row0,
+                    const char* row1,
+                    char* dst,
+                    int dstWidth)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    int x = 0;
+
+    for (; x + 16 <= dstWidth; x += 16, row0 += 32, row1 += 32, dst += 16) {
+        __m128i lo = _mm_and_si128( bitmapPairsRenderedSSE2( _mm_loadu_si128( (const __m128i*)row0 ) ),
+                                    bitmapPairsRenderedSSE2( _mm_loadu_si128( (const __m128i*)row1 ) ) );
+        __m128i hi = _mm_and_si128( bitmapPairsRenderedSSE2( _mm_loadu_si128( (const __m128i*)(row0 + 16) ) ),
+                                    bitmapPairsRenderedSSE2( _mm_loadu_si128( (const __m128i*)(row1 + 16) ) ) );
+        _mm_storeu_si128( (__m128i*)dst, _mm_and_si128(_mm_packus_epi16(lo, hi), one) );
+    }
+    halveBitmapRowsScalar(row0, row1, dst, dstWidth - x);
+}
+
+///Pixels of 1, 2, 4, 8 or 16 bytes are broadcast to a full register which is stored as many times as needed
+NATRON_TARGET_SSE2 bool
+upscaleRowSSE2(const unsigned char* src,
+               unsigned char* dst,
+               int srcWidth,
+               int scale,
+               int pixelSize)
+{
+    if ( (pixelSize != 1) && (pixelSize != 2) && (pixelSize != 4) && (pixelSize != 8) && (pixelSize != 16) ) {
+        return false;
+    }
+    const int dstPixelsSize = scale * pixelSize;
+    for (int x = 0; x < srcWidth; ++x, src += pixelSize, dst += dstPixelsSize) {
+        __m128i v;
+        switch (pixelSize) {
+        case 1:
+            v = _mm_set1_epi8(*(const char*)src);
+            break;
+        case 2: {
+            short s;
+            std::memcpy( &s, src, sizeof(short) );
+            v = _mm_set1_epi16(s);
+            break;
+        }
+        case 4:
+            v = _mm_set1_epi32( loadInt(src) );
+            break;
+        case 8:
+            v = _mm_loadl_epi64( (const __m128i*)src );
+            v = _mm_unpacklo_epi64(v, v);
+            break;
+        default:
+            v = _mm_loadu_si128( (const __m128i*)src );
+            break;
+        }
+        int i = 0;
+        for (; i + 16 <= dstPixelsSize; i += 16) {
+            _mm_storeu_si128( (__m128i*)(dst + i), v );
+        }
+        ///16 is a multiple of pixelSize: the remaining bytes are whole pixels
+        for (; i < dstPixelsSize; i += pixelSize) {
+            std::memcpy(dst + i, src, pixelSize);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Same as Color::floatToInt<maxValue + 1> on 4 values: the rounding of value * maxValue + 0.5 is made
+ * exactly with integers since the sum can't be computed exactly in single precision. NaNs give 0.
+ **/
+NATRON_TARGET_SSE2 inline __m128i
+floatToIntSSE2(__m128 v,
+               __m128 maxValueFloat,
+               __m128i maxValue)
+{
+    __m128 p = _mm_mul_ps(v, maxValueFloat);
+    __m128i i = _mm_cvttps_epi32(p);
+    // p - i is exact: add 1 (subtract the -1 mask) when the fractional part is >= 0.5
+    __m128 frac = _mm_sub_ps( p, _mm_cvtepi32_ps(i) );
+    i = _mm_sub_epi32( i, _mm_castps_si128( _mm_cmpge_ps( frac, _mm_set1_ps(0.5f) ) ) );
+    __m128i geOne = _mm_castps_si128( _mm_cmpge_ps( v, _mm_set1_ps(1.f) ) );
+    i = _mm_or_si128( _mm_andnot_si128(geOne, i), _mm_and_si128(geOne, maxValue) );
+    // false for values <= 0 and NaNs
+    __m128i gtZero = _mm_castps_si128( _mm_cmpgt_ps( v, _mm_setzero_ps() ) );
+
+    return _mm_and_si128(gtZero, i);
+}
+
+NATRON_TARGET_SSE2 void
+convertFloatToByteSSE2(const float* src,
+                       unsigned char* dst,
+                       int n)
+{
+    const __m128 maxValueFloat = _mm_set1_ps(255.f);
+    const __m128i maxValue = _mm_set1_epi32(255);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i r0 = floatToIntSSE2(_mm_loadu_ps(src + i), maxValueFloat, maxValue);
+        __m128i r1 = floatToIntSSE2(_mm_loadu_ps(src + i + 4), maxValueFloat, maxValue);
+        __m128i r2 = floatToIntSSE2(_mm_loadu_ps(src + i + 8), maxValueFloat, maxValue);
+        __m128i r3 = floatToIntSSE2(_mm_loadu_ps(src + i + 12), maxValueFloat, maxValue);
+        _mm_storeu_si128( (__m128i*)(dst + i), _mm_packus_epi16( _mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3) ) );
+    }
+    convertFloatToIntScalar<256>(src + i, dst + i, n - i);
+}
+
+NATRON_TARGET_SSE2 void
+convertFloatToShortSSE2(const float* src,
+                        unsigned short* dst,
+                        int n)
+{
+    const __m128 maxValueFloat = _mm_set1_ps(65535.f);
+    const __m128i maxValue = _mm_set1_epi32(65535);
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16( (short)0x8000 );
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i r0 = _mm_sub_epi32(floatToIntSSE2(_mm_loadu_ps(src + i), maxValueFloat, maxValue), bias32);
+        __m128i r1 = _mm_sub_epi32(floatToIntSSE2(_mm_loadu_ps(src + i + 4), maxValueFloat, maxValue), bias32);
+        _mm_storeu_si128( (__m128i*)(dst + i), _mm_add_epi16(_mm_packs_epi32(r0, r1), bias16) );
+    }
+    convertFloatToIntScalar<65536>(src + i, dst + i, n - i);
+}
+
+NATRON_TARGET_SSE2 void
+convertByteToFloatSSE2(const unsigned char* src,
+                       float* dst,
+                       int n)
+{
+    // intToFloat divides by the max value, so do we: multiplying by its inverse would not be exact
+    const __m128 maxValueFloat = _mm_set1_ps(255.f);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(src + i) );
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_ps( dst + i, _mm_div_ps(_mm_cvtepi32_ps( _mm_unpacklo_epi16(lo, zero) ), maxValueFloat) );
+        _mm_storeu_ps( dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps( _mm_unpackhi_epi16(lo, zero) ), maxValueFloat) );
+        _mm_storeu_ps( dst + i + 8, _mm_div_ps(_mm_cvtepi32_ps( _mm_unpacklo_epi16(hi, zero) ), maxValueFloat) );
+        _mm_storeu_ps( dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps( _mm_unpackhi_epi16(hi, zero) ), maxValueFloat) );
+    }
+    convertIntToFloatScalar<256>(src + i, dst + i, n - i);
+}
+
+NATRON_TARGET_SSE2 void
+convertShortToFloatSSE2(const unsigned short* src,
+                        float* dst,
+                        int n)
+{
+    const __m128 maxValueFloat = _mm_set1_ps(65535.f);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128( (const __m128i*)(src + i) );
+        _mm_storeu_ps( dst + i, _mm_div_ps(_mm_cvtepi32_ps( _mm_unpacklo_epi16(v, zero) ), maxValueFloat) );
+        _mm_storeu_ps( dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps( _mm_unpackhi_epi16(v, zero) ), maxValueFloat) );
+    }
+    convertIntToFloatScalar<65536>(src + i, dst + i, n - i);
+}
+
+NATRON_TARGET_SSE2 void
+computeHistogramBinsSSE2(const float* src,
+                         int* dst,
+                         int n,
+                         float vmin,
+                         float vmax,
+                         float scale,
+                         int binsCount)
+{
+    const __m128 vmin4 = _mm_set1_ps(vmin);
+    const __m128 vmax4 = _mm_set1_ps(vmax);
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128i lastBin = _mm_set1_epi32(binsCount - 1);
+    const __m128i allOnes = _mm_set1_epi32(-1);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        // false for NaNs
+        __m128i inRange = _mm_castps_si128( _mm_and_ps( _mm_cmple_ps(vmin4, v), _mm_cmplt_ps(v, vmax4) ) );
+        __m128i bin = _mm_cvttps_epi32( _mm_mul_ps(_mm_sub_ps(v, vmin4), scale4) );
+        __m128i over = _mm_cmpgt_epi32(bin, lastBin);
+        bin = _mm_or_si128( _mm_andnot_si128(over, bin), _mm_and_si128(over, lastBin) );
+        // -1 for the values out of range
+        _mm_storeu_si128( (__m128i*)(dst + i), _mm_or_si128( bin, _mm_andnot_si128(inRange, allOnes) ) );
+    }
+    computeHistogramBinsScalar(src + i, dst + i, n - i, vmin, vmax, scale, binsCount);
+}
+
+///The operands order makes NaNs keep the current bound, like the comparisons of updateMinMax
+#define NATRON_MIN_MAX_SSE2(v, mini, maxi) \
+    mini = _mm_min_ps(v, mini); \
+    maxi = _mm_max_ps(v, maxi);
+
+///Only the RGBA pixels (each pixel is a register) and the values of Alpha images are reduced in registers
+template <int nComps, Natron::DisplayChannelsEnum channels>
+NATRON_TARGET_SSE2 void
+findMinMaxSSE2(const float* src,
+               int width,
+               float* vmin,
+               float* vmax)
+{
+    __m128 mini = _mm_set1_ps( std::numeric_limits<float>::infinity() );
+    __m128 maxi = _mm_set1_ps( -std::numeric_limits<float>::infinity() );
+    int x = 0;
+
+    if (nComps == 4) {
+        if (channels == Natron::eDisplayChannelsY) {
+            const __m128 rCoeff = _mm_set1_ps(0.299f);
+            const __m128 gCoeff = _mm_set1_ps(0.587f);
+            const __m128 bCoeff = _mm_set1_ps(0.114f);
+            for (; x + 4 <= width; x += 4, src += 16) {
+                __m128 r = _mm_loadu_ps(src);
+                __m128 g = _mm_loadu_ps(src + 4);
+                __m128 b = _mm_loadu_ps(src + 8);
+                __m128 a = _mm_loadu_ps(src + 12);
+                _MM_TRANSPOSE4_PS(r, g, b, a);
+                __m128 lum = _mm_add_ps( _mm_add_ps( _mm_mul_ps(rCoeff, r), _mm_mul_ps(gCoeff, g) ), _mm_mul_ps(bCoeff, b) );
+                NATRON_MIN_MAX_SSE2(lum, mini, maxi);
+            }
+        } else {
+            ///each lane holds the range of one channel
+            for (; x < width; ++x, src += 4) {
+                __m128 v = _mm_loadu_ps(src);
+                NATRON_MIN_MAX_SSE2(v, mini, maxi);
+            }
+        }
+    } else if ( (nComps == 1) && (channels == Natron::eDisplayChannelsA) ) {
+        for (; x + 4 <= width; x += 4, src += 4) {
+            __m128 v = _mm_loadu_ps(src);
+            NATRON_MIN_MAX_SSE2(v, mini, maxi);
+        }
+    }
+
+    float laneMin[4], laneMax[4];
+    _mm_storeu_ps(laneMin, mini);
+    _mm_storeu_ps(laneMax, maxi);
+    for (int i = 0; i < 4; ++i) {
+        bool used;
+        if ( (nComps == 4) && (channels != Natron::eDisplayChannelsY) ) {
+            switch (channels) {
+            case Natron::eDisplayChannelsRGB:
+                used = i < 3;
+                break;
+            case Natron::eDisplayChannelsR:
+                used = i == 0;
+                break;
+            case Natron::eDisplayChannelsG:
+                used = i == 1;
+                break;
+            case Natron::eDisplayChannelsB:
+                used = i == 2;
+                break;
+            default:
+                used = i == 3;
+                break;
+            }
+        } else {
+            used = true;
+        }
+        ///lanes which did not see any value (or only NaNs) hold infinities that compare false
+        if ( used && (laneMin[i] < *vmin) ) {
+            *vmin = laneMin[i];
+        }
+        if ( used && (laneMax[i] > *vmax) ) {
+            *vmax = laneMax[i];
+        }
+    }
+    findMinMaxScalar<nComps, channels>(src, width - x, vmin, vmax);
+}
+
+///Looks up the B, G and R values of the RGBA pixel v in toUint8xx, as the first 4 16-bit words of the result (the 4th one is 0)
+NATRON_TARGET_SSE2 inline __m128i
+lookupBGRSSE2(__m128 v,
+              const unsigned short* toUint8xx)
+{
+    ///The look-up index of each component is the most significant word of its 32-bit lane
+    __m128i bits = _mm_castps_si128(v);
+
+    return _mm_setr_epi16(toUint8xx[_mm_extract_epi16(bits, 5)],
+                          toUint8xx[_mm_extract_epi16(bits, 3)],
+                          toUint8xx[_mm_extract_epi16(bits, 1)],
+                          0, 0, 0, 0, 0);
+}
+
+///Each iteration converts 4 pixels. Without a gather instruction the table look-ups are scalar, but they are
+///the only scalar part of the conversion.
+NATRON_TARGET_SSE2 void
+convertRGBAToBGRA8SSE2(const float* src,
+                       unsigned int* dst,
+                       int width,
+                       int x,
+                       int y,
+                       const unsigned short* toUint8xx)
+{
+    const unsigned short (*thresholds)[4] = gDitherMatrix.thresholds[y & 15];
+    const __m128 maxValueFloat = _mm_set1_ps(255.f);
+    const __m128i maxValue = _mm_set1_epi32(255);
+    int i = 0;
+
+    for (; i + 4 <= width; i += 4, src += 16) {
+        __m128 p0 = _mm_loadu_ps(src);
+        __m128 p1 = _mm_loadu_ps(src + 4);
+        __m128 p2 = _mm_loadu_ps(src + 8);
+        __m128 p3 = _mm_loadu_ps(src + 12);
+        __m128 alphas = _mm_shuffle_ps( _mm_shuffle_ps( p0, p1, _MM_SHUFFLE(3, 3, 3, 3) ),
+                                        _mm_shuffle_ps( p2, p3, _MM_SHUFFLE(3, 3, 3, 3) ),
+                                        _MM_SHUFFLE(2, 0, 2, 0) );
+        __m128i a = _mm_slli_epi32(floatToIntSSE2(alphas, maxValueFloat, maxValue), 24);
+        __m128i bgr;
+        if (toUint8xx) {
+            __m128i bgr01 = _mm_unpacklo_epi64( lookupBGRSSE2(p0, toUint8xx), lookupBGRSSE2(p1, toUint8xx) );
+            __m128i bgr23 = _mm_unpacklo_epi64( lookupBGRSSE2(p2, toUint8xx), lookupBGRSSE2(p3, toUint8xx) );
+            __m128i t01 = _mm_unpacklo_epi64( _mm_loadl_epi64( (const __m128i*)thresholds[(x + i) & 15] ),
+                                              _mm_loadl_epi64( (const __m128i*)thresholds[(x + i + 1) & 15] ) );
+            __m128i t23 = _mm_unpacklo_epi64( _mm_loadl_epi64( (const __m128i*)thresholds[(x + i + 2) & 15] ),
+                                              _mm_loadl_epi64( (const __m128i*)thresholds[(x + i + 3) & 15] ) );
+            ///The sums are at most 0xff00 + 0xff and do not overflow
+            bgr01 = _mm_srli_epi16(_mm_add_epi16(bgr01, t01), 8);
+            bgr23 = _mm_srli_epi16(_mm_add_epi16(bgr23, t23), 8);
+            bgr = _mm_packus_epi16(bgr01, bgr23);
+        } else {
+            ///Swap R and B in each pixel, the alpha lane is dropped by the mask below
+            __m128i c0 = _mm_shuffle_epi32(floatToIntSSE2(p0, maxValueFloat, maxValue), _MM_SHUFFLE(3, 0, 1, 2) );
+            __m128i c1 = _mm_shuffle_epi32(floatToIntSSE2(p1, maxValueFloat, maxValue), _MM_SHUFFLE(3, 0, 1, 2) );
+            __m128i c2 = _mm_shuffle_epi32(floatToIntSSE2(p2, maxValueFloat, maxValue), _MM_SHUFFLE(3, 0, 1, 2) );
+            __m128i c3 = _mm_shuffle_epi32(floatToIntSSE2(p3, maxValueFloat, maxValue), _MM_SHUFFLE(3, 0, 1, 2) );
+            bgr = _mm_and_si128( _mm_packus_epi16( _mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3) ), _mm_set1_epi32(0x00ffffff) );
+        }
+        _mm_storeu_si128( (__m128i*)(dst + i), _mm_or_si128(bgr, a) );
+    }
+    convertRGBAToBGRA8Scalar(src, dst + i, width - i, x + i, y, toUint8xx);
+}
+
+///The prefix sum of each register is computed in 2 shifted additions, the last lane carries the sum to the next register
+NATRON_TARGET_SSE2 void
+accumulateCoverageSSE2(const float* deltas,
+                       float* coverage,
+                       int n)
+{
+    const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32(0x7fffffff) );
+    const __m128 one = _mm_set1_ps(1.f);
+    __m128 carry = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(deltas + i);
+        v = _mm_add_ps( v, _mm_castsi128_ps( _mm_slli_si128(_mm_castps_si128(v), 4) ) );
+        v = _mm_add_ps( v, _mm_castsi128_ps( _mm_slli_si128(_mm_castps_si128(v), 8) ) );
+        v = _mm_add_ps(v, carry);
+        carry = _mm_shuffle_ps( v, v, _MM_SHUFFLE(3, 3, 3, 3) );
+        _mm_storeu_ps( coverage + i, _mm_min_ps(_mm_and_ps(v, absMask), one) );
+    }
+    accumulateCoverageScalar( deltas + i, coverage + i, n - i, _mm_cvtss_f32(carry) );
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels. Only the cases where the 256-bit lanes map cleanly onto the pixels are implemented,
+// the others (and the remaining pixels) are left to the SSE2 kernels.
+
+///Puts the 64-bit quarters of v in the order 0, 2, 1, 3, undoing the per 128-bit lane interleaving of shuffles and packs
+#define NATRON_AVX2_SHUFFLE_QUARTERS _MM_SHUFFLE(3, 1, 2, 0)
+
+NATRON_TARGET_AVX2 void
+halveRowsAVX2(const float* row0,
+              const float* row1,
+              float* dst,
+              int dstWidth,
+              int nComps)
+{
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    int x = 0;
+
+    if (nComps == 4) {
+        for (; x + 2 <= dstWidth; x += 2, row0 += 16, row1 += 16, dst += 8) {
+            __m256 v0 = _mm256_loadu_ps(row0);
+            __m256 v1 = _mm256_loadu_ps(row0 + 8);
+            __m256 s = _mm256_add_ps( _mm256_permute2f128_ps(v0, v1, 0x20), _mm256_permute2f128_ps(v0, v1, 0x31) );
+            v0 = _mm256_loadu_ps(row1);
+            v1 = _mm256_loadu_ps(row1 + 8);
+            s = _mm256_add_ps( s, _mm256_permute2f128_ps(v0, v1, 0x20) );
+            s = _mm256_add_ps( s, _mm256_permute2f128_ps(v0, v1, 0x31) );
+            _mm256_storeu_ps( dst, _mm256_mul_ps(s, quarter) );
+        }
+    } else if (nComps == 1) {
+        for (; x + 8 <= dstWidth; x += 8, row0 += 16, row1 += 16, dst += 8) {
+            __m256 v0 = _mm256_loadu_ps(row0);
+            __m256 v1 = _mm256_loadu_ps(row0 + 8);
+            __m256 s = _mm256_add_ps( _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE(2, 0, 2, 0) ), _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            v0 = _mm256_loadu_ps(row1);
+            v1 = _mm256_loadu_ps(row1 + 8);
+            s = _mm256_add_ps( s, _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE(2, 0, 2, 0) ) );
+            s = _mm256_add_ps( s, _mm256_shuffle_ps( v0, v1, _MM_SHUFFLE(3, 1, 3, 1) ) );
+            s = _mm256_mul_ps(s, quarter);
+            s = _mm256_castpd_ps( _mm256_permute4x64_pd(_mm256_castps_pd(s), NATRON_AVX2_SHUFFLE_QUARTERS) );
+            _mm256_storeu_ps(dst, s);
+        }
+    }
+    halveRowsSSE2(row0, row1, dst, dstWidth - x, nComps);
+}
+
+NATRON_TARGET_AVX2 void
+halveRowsAVX2(const unsigned char* row0,
+              const unsigned char* row1,
+              unsigned char* dst,
+              int dstWidth,
+              int nComps)
+{
+    int x = 0;
+
+    if (nComps == 1) {
+        const __m256i mask = _mm256_set1_epi16(0x00FF);
+        for (; x + 16 <= dstWidth; x += 16, row0 += 32, row1 += 32, dst += 16) {
+            __m256i v = _mm256_loadu_si256( (const __m256i*)row0 );
+            __m256i s = _mm256_add_epi16( _mm256_and_si256(v, mask), _mm256_srli_epi16(v, 8) );
+            v = _mm256_loadu_si256( (const __m256i*)row1 );
+            s = _mm256_add_epi16( s, _mm256_add_epi16( _mm256_and_si256(v, mask), _mm256_srli_epi16(v, 8) ) );
+            s = _mm256_srli_epi16(s, 2);
+            s = _mm256_permute4x64_epi64(_mm256_packus_epi16(s, s), NATRON_AVX2_SHUFFLE_QUARTERS);
+            _mm_storeu_si128( (__m128i*)dst, _mm256_castsi256_si128(s) );
+        }
+    }
+    halveRowsSSE2(row0, row1, dst, dstWidth - x, nComps);
+}
+
+NATRON_TARGET_AVX2 void
+halveRowsAVX2(const unsigned short* row0,
+              const unsigned short* row1,
+              unsigned short* dst,
+              int dstWidth,
+              int nComps)
+{
+    int x = 0;
+
+    if (nComps == 1) {
+        const __m256i mask = _mm256_set1_epi32(0x0000FFFF);
+        for (; x + 8 <= dstWidth; x += 8, row0 += 16, row1 += 16, dst += 8) {
+            __m256i v = _mm256_loadu_si256( (const __m256i*)row0 );
+            __m256i s = _mm256_add_epi32( _mm256_and_si256(v, mask), _mm256_srli_epi32(v, 16) );
+            v = _mm256_loadu_si256( (const __m256i*)row1 );
+            s = _mm256_add_epi32( s, _mm256_add_epi32( _mm256_and_si256(v, mask), _mm256_srli_epi32(v, 16) ) );
+            s = _mm256_srli_epi32(s, 2);
+            s = _mm256_permute4x64_epi64(_mm256_packus_epi32(s, s), NATRON_AVX2_SHUFFLE_QUARTERS);
+            _mm_storeu_si128( (__m128i*)dst, _mm256_castsi256_si128(s) );
+        }
+    }
+    halveRowsSSE2(row0, row1, dst, dstWidth - x, nComps);
+}
+
+NATRON_TARGET_AVX2 inline __m256i
+bitmapPairsRenderedAVX2(__m256i v)
+{
+    __m256i rendered = _mm256_cmpeq_epi8( v, _mm256_set1_epi8(1) );
+
+    return _mm256_and_si256( rendered, _mm256_srli_epi16(rendered, 8) );
+}
+
+NATRON_TARGET_AVX2 void
+halveBitmapRowsAVX2(const char* row0,
+                    const char* row1,
+                    char* dst,
+                    int dstWidth)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    int x = 0;
+
+    for (; x + 32 <= dstWidth; x += 32, row0 += 64, row1 += 64, dst += 32) {
+        __m256i lo = _mm256_and_si256( bitmapPairsRenderedAVX2( _mm256_loadu_si256( (const __m256i*)row0 ) ),
+                                       bitmapPairsRenderedAVX2( _mm256_loadu_si256( (const __m256i*)row1 ) ) );
+        __m256i hi = _mm256_and_si256( bitmapPairsRenderedAVX2( _mm256_loadu_si256( (const __m256i*)(row0 + 32) ) ),
+                                       bitmapPairsRenderedAVX2( _mm256_loadu_si256( (const __m256i*)(row1 + 32) ) ) );
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), NATRON_AVX2_SHUFFLE_QUARTERS);
+        _mm256_storeu_si256( (__m256i*)dst, _mm256_and_si256(packed, one) );
+    }
+    halveBitmapRowsSSE2(row0, row1, dst, dstWidth - x);
+}
+
+#endif // NATRON_IMAGE_KERNELS_X86
+
+template <typename PIX>
+void
+halveRowsInternal(const PIX* row0,
+                  const PIX* row1,
+                  PIX* dst,
+                  int dstWidth,
+                  int nComps,
+                  InstructionSetEnum is)
+{
+    if (is > gSupportedInstructionSet) {
+        is = gSupportedInstructionSet;
+    }
+    switch (is) {
+#ifdef NATRON_IMAGE_KERNELS_X86
+    case eInstructionSetAVX2:
+        halveRowsAVX2(row0, row1, dst, dstWidth, nComps);
+        break;
+    case eInstructionSetSSE2:
+        halveRowsSSE2(row0, row1, dst, dstWidth, nComps);
+        break;
+#endif
+    default:
+        halveRowsScalar(row0, row1, dst, dstWidth, nComps);
+        break;
+    }
+}
+
+template <typename PIX>
+void
+upscaleRowInternal(const PIX* src,
+                   PIX* dst,
+                   int srcWidth,
+                   int scale,
+                   int nComps,
+                   InstructionSetEnum is)
+{
+    if (is > gSupportedInstructionSet) {
+        is = gSupportedInstructionSet;
+    }
+#ifdef NATRON_IMAGE_KERNELS_X86
+    ///Replicating pixels is bound by the memory bandwidth, SSE2 stores are enough
+    if ( (is >= eInstructionSetSSE2) &&
+         upscaleRowSSE2( (const unsigned char*)src, (unsigned char*)dst, srcWidth, scale, (int)sizeof(PIX) * nComps ) ) {
+        return;
+    }
+#endif
+    upscaleRowScalar(src, dst, srcWidth, scale, nComps);
+}
+
+///Bit depth conversions are bound by the memory bandwidth, SSE2 is enough
+#ifdef NATRON_IMAGE_KERNELS_X86
+#define NATRON_CONVERT_DEPTH(is, sse2Func, scalarFunc, src, dst, n) \
+    if ( (is) >= eInstructionSetSSE2 && gSupportedInstructionSet >= eInstructionSetSSE2 ) { \
+        sse2Func(src, dst, n); \
+    } else { \
+        scalarFunc(src, dst, n); \
+    }
+#else
+#define NATRON_CONVERT_DEPTH(is, sse2Func, scalarFunc, src, dst, n) \
+    scalarFunc(src, dst, n);
+#endif
+
+} // anon namespace
+
+namespace Natron {
+namespace ImageKernels {
+
+InstructionSetEnum
+getSupportedInstructionSet()
+{
+    return gSupportedInstructionSet;
+}
+
+InstructionSetEnum
+getInstructionSet()
+{
+    return gInstructionSet;
+}
+
+void
+setInstructionSet(InstructionSetEnum is)
+{
+    gInstructionSet = is > gSupportedInstructionSet ? gSupportedInstructionSet : is;
+}
+
+void
+halveRows(const unsigned char* row0,
+          const unsigned char* row1,
+          unsigned char* dst,
+          int dstWidth,
+          int nComps,
+          InstructionSetEnum is)
+{
+    halveRowsInternal(row0, row1, dst, dstWidth, nComps, is);
+}
+
+void
+halveRows(const unsigned short* row0,
+          const unsigned short* row1,
+          unsigned short* dst,
+          int dstWidth,
+          int nComps,
+          InstructionSetEnum is)
+{
+    halveRowsInternal(row0, row1, dst, dstWidth, nComps, is);
+}
+
+void
+halveRows(const float* row0,
+          const float* row1,
+          float* dst,
+          int dstWidth,
+          int nComps,
+          InstructionSetEnum is)
+{
+    halveRowsInternal(row0, row1, dst, dstWidth, nComps, is);
+}
+
+void
+halveRows(const unsigned char* row0,
+          const unsigned char* row1,
+          unsigned char* dst,
+          int dstWidth,
+          int nComps)
+{
+    halveRowsInternal(row0, row1, dst, dstWidth, nComps, gInstructionSet);
+}
+
+void
+halveRows(const unsigned short* row0,
+          const unsigned short* row1,
+          unsigned short* dst,
+          int dstWidth,
+          int nComps)
+{
+    halveRowsInternal(row0, row1, dst, dstWidth, nComps, gInstructionSet);
+}
+
+void
+halveRows(const float* row0,
+          const float* row1,
+          float* dst,
+          int dstWidth,
+          int nComps)
+{
+    halveRowsInternal(row0, row1, dst, dstWidth, nComps, gInstructionSet);
+}
+
+void
+halveBitmapRows(const char* row0,
+                const char* row1,
+                char* dst,
+                int dstWidth,
+                InstructionSetEnum is)
+{
+    if (is > gSupportedInstructionSet) {
+        is = gSupportedInstructionSet;
+    }
+    switch (is) {
+#ifdef NATRON_IMAGE_KERNELS_X86
+    case eInstructionSetAVX2:
+        halveBitmapRowsAVX2(row0, row1, dst, dstWidth);
+        break;
+    case eInstructionSetSSE2:
+        halveBitmapRowsSSE2(row0, row1, dst, dstWidth);
+        break;
+#endif
+    default:
+        halveBitmapRowsScalar(row0, row1, dst, dstWidth);
+        break;
+    }
+}
+
+void
+halveBitmapRows(const char* row0,
+                const char* row1,
+                char* dst,
+                int dstWidth)
+{
+    halveBitmapRows(row0, row1, dst, dstWidth, gInstructionSet);
+}
+
+void
+upscaleRow(const unsigned char* src,
+           unsigned char* dst,
+           int srcWidth,
+           int scale,
+           int nComps,
+           InstructionSetEnum is)
+{
+    upscaleRowInternal(src, dst, srcWidth, scale, nComps, is);
+}
+
+void
+upscaleRow(const unsigned short* src,
+           unsigned short* dst,
+           int srcWidth,
+           int scale,
+           int nComps,
+           InstructionSetEnum is)
+{
+    upscaleRowInternal(src, dst, srcWidth, scale, nComps, is);
+}
+
+void
+upscaleRow(const float* src,
+           float* dst,
+           int srcWidth,
+           int scale,
+           int nComps,
+           InstructionSetEnum is)
+{
+    upscaleRowInternal(src, dst, srcWidth, scale, nComps, is);
+}
+
+void
+upscaleRow(const unsigned char* src,
+           unsigned char* dst,
+           int srcWidth,
+           int scale,
+           int nComps)
+{
+    upscaleRowInternal(src, dst, srcWidth, scale, nComps, gInstructionSet);
+}
+
+void
+upscaleRow(const unsigned short* src,
+           unsigned short* dst,
+           int srcWidth,
+           int scale,
+           int nComps)
+{
+    upscaleRowInternal(src, dst, srcWidth, scale, nComps, gInstructionSet);
+}
+
+void
+upscaleRow(const float* src,
+           float* dst,
+           int srcWidth,
+           int scale,
+           int nComps)
+{
+    upscaleRowInternal(src, dst, srcWidth, scale, nComps, gInstructionSet);
+}
+
+void
+convertFloatToByte(const float* src,
+                   unsigned char* dst,
+                   int n,
+                   InstructionSetEnum is)
+{
+    NATRON_CONVERT_DEPTH(is, convertFloatToByteSSE2, convertFloatToIntScalar<256>, src, dst, n);
+}
+
+void
+convertFloatToShort(const float* src,
+                    unsigned short* dst,
+                    int n,
+                    InstructionSetEnum is)
+{
+    NATRON_CONVERT_DEPTH(is, convertFloatToShortSSE2, convertFloatToIntScalar<65536>, src, dst, n);
+}
+
+void
+convertByteToFloat(const unsigned char* src,
+                   float* dst,
+                   int n,
+                   InstructionSetEnum is)
+{
+    NATRON_CONVERT_DEPTH(is, convertByteToFloatSSE2, convertIntToFloatScalar<256>, src, dst, n);
+}
+
+void
+convertShortToFloat(const unsigned short* src,
+                    float* dst,
+                    int n,
+                    InstructionSetEnum is)
+{
+    NATRON_CONVERT_DEPTH(is, convertShortToFloatSSE2, convertIntToFloatScalar<65536>, src, dst, n);
+}
+
+void
+convertFloatToByte(const float* src,
+                   unsigned char* dst,
+                   int n)
+{
+    convertFloatToByte(src, dst, n, gInstructionSet);
+}
+
+void
+convertFloatToShort(const float* src,
+                    unsigned short* dst,
+                    int n)
+{
+    convertFloatToShort(src, dst, n, gInstructionSet);
+}
+
+void
+convertByteToFloat(const unsigned char* src,
+                   float* dst,
+                   int n)
+{
+    convertByteToFloat(src, dst, n, gInstructionSet);
+}
+
+void
+convertShortToFloat(const unsigned short* src,
+                    float* dst,
+                    int n)
+{
+    convertShortToFloat(src, dst, n, gInstructionSet);
+}
+
+template <Natron::DisplayChannelsEnum channels>
+void
+findMinMaxForChannels(const float* src,
+                      int width,
+                      int nComps,
+                      float* vmin,
+                      float* vmax,
+                      InstructionSetEnum is)
+{
+#ifdef NATRON_IMAGE_KERNELS_X86
+    if ( (is >= eInstructionSetSSE2) && (gSupportedInstructionSet >= eInstructionSetSSE2) ) {
+        switch (nComps) {
+        case 4:
+            findMinMaxSSE2<4, channels>(src, width, vmin, vmax);
+            break;
+        case 3:
+            findMinMaxScalar<3, channels>(src, width, vmin, vmax);
+            break;
+        case 1:
+            findMinMaxSSE2<1, channels>(src, width, vmin, vmax);
+            break;
+        default:
+            break;
+        }
+
+        return;
+    }
+#endif
+    switch (nComps) {
+    case 4:
+        findMinMaxScalar<4, channels>(src, width, vmin, vmax);
+        break;
+    case 3:
+        findMinMaxScalar<3, channels>(src, width, vmin, vmax);
+        break;
+    case 1:
+        findMinMaxScalar<1, channels>(src, width, vmin, vmax);
+        break;
+    default:
+        break;
+    }
+}
+
+///Bin indices are consumed by scattered increments which dominate the cost, SSE2 is enough
+void
+computeHistogramBins(const float* src,
+                     int* dst,
+                     int n,
+                     float vmin,
+                     float vmax,
+                     float scale,
+                     int binsCount,
+                     InstructionSetEnum is)
+{
+#ifdef NATRON_IMAGE_KERNELS_X86
+    if ( (is >= eInstructionSetSSE2) && (gSupportedInstructionSet >= eInstructionSetSSE2) ) {
+        computeHistogramBinsSSE2(src, dst, n, vmin, vmax, scale, binsCount);
+
+        return;
+    }
+#endif
+    computeHistogramBinsScalar(src, dst, n, vmin, vmax, scale, binsCount);
+}
+
+void
+computeHistogramBins(const float* src,
+                     int* dst,
+                     int n,
+                     float vmin,
+                     float vmax,
+                     float scale,
+                     int binsCount)
+{
+    computeHistogramBins(src, dst, n, vmin, vmax, scale, binsCount, gInstructionSet);
+}
+
+///Reductions are bound by the memory bandwidth, SSE2 is enough
+void
+findMinMax(const float* src,
+           int width,
+           int nComps,
+           Natron::DisplayChannelsEnum channels,
+           float* vmin,
+           float* vmax,
+           InstructionSetEnum is)
+{
+    switch (channels) {
+    case Natron::eDisplayChannelsRGB:
+        findMinMaxForChannels<Natron::eDisplayChannelsRGB>(src, width, nComps, vmin, vmax, is);
+        break;
+    case Natron::eDisplayChannelsR:
+        findMinMaxForChannels<Natron::eDisplayChannelsR>(src, width, nComps, vmin, vmax, is);
+        break;
+    case Natron::eDisplayChannelsG:
+        findMinMaxForChannels<Natron::eDisplayChannelsG>(src, width, nComps, vmin, vmax, is);
+        break;
+    case Natron::eDisplayChannelsB:
+        findMinMaxForChannels<Natron::eDisplayChannelsB>(src, width, nComps, vmin, vmax, is);
+        break;
+    case Natron::eDisplayChannelsA:
+        findMinMaxForChannels<Natron::eDisplayChannelsA>(src, width, nComps, vmin, vmax, is);
+        break;
+    case Natron::eDisplayChannelsY:
+        findMinMaxForChannels<Natron::eDisplayChannelsY>(src, width, nComps, vmin, vmax, is);
+        break;
+    }
+}
+
+void
+findMinMax(const float* src,
+           int width,
+           int nComps,
+           Natron::DisplayChannelsEnum channels,
+           float* vmin,
+           float* vmax)
+{
+    findMinMax(src, width, nComps, channels, vmin, vmax, gInstructionSet);
+}
+
+///The table look-ups dominate the cost when converting to a color-space, SSE2 is enough
+void
+convertRGBAToBGRA8(const float* src,
+                   unsigned int* dst,
+                   int width,
+                   int x,
+                   int y,
+                   const unsigned short* toUint8xx,
+                   InstructionSetEnum is)
+{
+#ifdef NATRON_IMAGE_KERNELS_X86
+    if ( (is >= eInstructionSetSSE2) && (gSupportedInstructionSet >= eInstructionSetSSE2) ) {
+        convertRGBAToBGRA8SSE2(src, dst, width, x, y, toUint8xx);
+
+        return;
+    }
+#endif
+    convertRGBAToBGRA8Scalar(src, dst, width, x, y, toUint8xx);
+}
+
+void
+convertRGBAToBGRA8(const float* src,
+                   unsigned int* dst,
+                   int width,
+                   int x,
+                   int y,
+                   const unsigned short* toUint8xx)
+{
+    convertRGBAToBGRA8(src, dst, width, x, y, toUint8xx, gInstructionSet);
+}
+
+///The dependency chain of the prefix sum does not get shorter with wider registers, SSE2 is enough
+void
+accumulateCoverage(const float* deltas,
+                   float* coverage,
+                   int n,
+                   InstructionSetEnum is)
+{
+#ifdef NATRON_IMAGE_KERNELS_X86
+    if ( (is >= eInstructionSetSSE2) && (gSupportedInstructionSet >= eInstructionSetSSE2) ) {
+        accumulateCoverageSSE2(deltas, coverage, n);
+
+        return;
+    }
+#endif
+    accumulateCoverageScalar(deltas, coverage, n, 0.f);
+}
+
+void
+accumulateCoverage(const float* deltas,
+                   float* coverage,
+                   int n)
+{
+    accumulateCoverage(deltas, coverage, n, gInstructionSet);
+}
+
+} // namespace ImageKernels
+} // namespace Natron
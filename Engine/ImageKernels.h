@@ -0,0 +1,133 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_IMAGEKERNELS_H_
+#define NATRON_ENGINE_IMAGEKERNELS_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "Global/Enums.h"
+
+/**
+ * @brief Row kernels used by the mipmapping and format conversion functions of Natron::Image. Each kernel has a scalar implementation,
+ * which computes exactly what the templated Image functions compute, and SSE2/AVX2 implementations which
+ * produce bit-exact results. The implementation is selected at runtime by detecting the features of the CPU.
+ **/
+namespace Natron {
+namespace ImageKernels {
+
+enum InstructionSetEnum
+{
+    eInstructionSetScalar = 0,
+    eInstructionSetSSE2,
+    eInstructionSetAVX2
+};
+
+/**
+ * @brief Returns the most capable instruction set supported by both the CPU and the OS. It is detected once.
+ **/
+InstructionSetEnum getSupportedInstructionSet();
+
+/**
+ * @brief Returns the instruction set used by the kernels when none is passed explicitly, that is the supported
+ * instruction set unless it was lowered by setInstructionSet().
+ **/
+InstructionSetEnum getInstructionSet();
+
+/**
+ * @brief Restricts the kernels to the given instruction set (which is clamped to the supported one).
+ * This is used by the tests to compare the implementations.
+ **/
+void setInstructionSet(InstructionSetEnum is);
+
+/**
+ * @brief Halves 2 consecutive rows (row0 and row1) of nComps-components pixels into dst:
+ * dst[x*nComps+k] = (row0[2x] + row0[2x+1] + row1[2x] + row1[2x+1]) / 4 for every component k.
+ * For integer depths the sum is truncated like an integer division.
+ * All the 4 source pixels of each of the dstWidth destination pixels must exist.
+ **/
+void halveRows(const unsigned char* row0, const unsigned char* row1, unsigned char* dst, int dstWidth, int nComps);
+void halveRows(const unsigned short* row0, const unsigned short* row1, unsigned short* dst, int dstWidth, int nComps);
+void halveRows(const float* row0, const float* row1, float* dst, int dstWidth, int nComps);
+
+void halveRows(const unsigned char* row0, const unsigned char* row1, unsigned char* dst, int dstWidth, int nComps, InstructionSetEnum is);
+void halveRows(const unsigned short* row0, const unsigned short* row1, unsigned short* dst, int dstWidth, int nComps, InstructionSetEnum is);
+void halveRows(const float* row0, const float* row1, float* dst, int dstWidth, int nComps, InstructionSetEnum is);
+
+/**
+ * @brief Same as halveRows for a bitmap: a destination pixel is marked as rendered (1) only if its 4 source pixels
+ * are. Pixels being rendered by another thread (PIXEL_UNAVAILABLE) count as not rendered.
+ **/
+void halveBitmapRows(const char* row0, const char* row1, char* dst, int dstWidth);
+void halveBitmapRows(const char* row0, const char* row1, char* dst, int dstWidth, InstructionSetEnum is);
+
+/**
+ * @brief Replicates each of the srcWidth pixels of src scale times horizontally into dst.
+ **/
+void upscaleRow(const unsigned char* src, unsigned char* dst, int srcWidth, int scale, int nComps);
+void upscaleRow(const unsigned short* src, unsigned short* dst, int srcWidth, int scale, int nComps);
+void upscaleRow(const float* src, float* dst, int srcWidth, int scale, int nComps);
+
+void upscaleRow(const unsigned char* src, unsigned char* dst, int srcWidth, int scale, int nComps, InstructionSetEnum is);
+void upscaleRow(const unsigned short* src, unsigned short* dst, int srcWidth, int scale, int nComps, InstructionSetEnum is);
+void upscaleRow(const float* src, float* dst, int srcWidth, int scale, int nComps, InstructionSetEnum is);
+
+/**
+ * @brief Bit depth conversions of n contiguous values, equivalent to Color::floatToInt<256>, Color::floatToInt<65536>,
+ * Color::intToFloat<256> and Color::intToFloat<65536> applied to each value. NaNs are converted to 0.
+ **/
+void convertFloatToByte(const float* src, unsigned char* dst, int n);
+void convertFloatToShort(const float* src, unsigned short* dst, int n);
+void convertByteToFloat(const unsigned char* src, float* dst, int n);
+void convertShortToFloat(const unsigned short* src, float* dst, int n);
+
+void convertFloatToByte(const float* src, unsigned char* dst, int n, InstructionSetEnum is);
+void convertFloatToShort(const float* src, unsigned short* dst, int n, InstructionSetEnum is);
+void convertByteToFloat(const unsigned char* src, float* dst, int n, InstructionSetEnum is);
+void convertShortToFloat(const unsigned short* src, float* dst, int n, InstructionSetEnum is);
+
+/**
+ * @brief Computes the histogram bin of each of the n contiguous values of src: dst[i] = (int)( (src[i] - vmin) * scale )
+ * clamped to binsCount - 1, or -1 if src[i] is not in [vmin, vmax) (or is NaN). scale is binsCount / (vmax - vmin).
+ **/
+void computeHistogramBins(const float* src, int* dst, int n, float vmin, float vmax, float scale, int binsCount);
+void computeHistogramBins(const float* src, int* dst, int n, float vmin, float vmax, float scale, int binsCount, InstructionSetEnum is);
+
+/**
+ * @brief Lowers *vmin and raises *vmax to the range of the values displayed by the viewer for the width pixels of the row src
+ * of nComps (1, 3 or 4) components, as computed by the auto-contrast: channels R, G, B or A, all of R, G and B for
+ * eDisplayChannelsRGB, or the luminance 0.299 R + 0.587 G + 0.114 B for eDisplayChannelsY.
+ * Missing channels are 0 (or 1 for the alpha channel of RGB images). NaNs are ignored.
+ * Both bounds are exact, but when the range ends at zero its sign may differ from the scalar implementation.
+ **/
+void findMinMax(const float* src, int width, int nComps, Natron::DisplayChannelsEnum channels, float* vmin, float* vmax);
+void findMinMax(const float* src, int width, int nComps, Natron::DisplayChannelsEnum channels, float* vmin, float* vmax, InstructionSetEnum is);
+
+/**
+ * @brief Converts the width pixels of the row src of RGBA floats to the 8-bit BGRA texels of the viewer:
+ * dst[i] = (A << 24) | (R << 16) | (G << 8) | B, where A = Color::floatToInt<256>(alpha).
+ * If toUint8xx is NULL, R, G and B are quantized the same way. Otherwise toUint8xx is the look-up table of a
+ * color-space (see Lut::getToUint8xxTable()) and the components are dithered with a 16x16 ordered dither matrix,
+ * whose phase is given by the coordinates x,y of the first pixel in the texture: the same image always gives
+ * the same texture, whichever thread converts it. NaNs are converted to 0 when quantized linearly.
+ **/
+void convertRGBAToBGRA8(const float* src, unsigned int* dst, int width, int x, int y, const unsigned short* toUint8xx);
+void convertRGBAToBGRA8(const float* src, unsigned int* dst, int width, int x, int y, const unsigned short* toUint8xx, InstructionSetEnum is);
+
+/**
+ * @brief Integrates the n signed area deltas of a row accumulated by a scanline rasterizer into the coverage of its pixels:
+ * coverage[i] = min(1, |deltas[0] + ... + deltas[i]|). The SSE2 implementation sums in a different order, hence the results
+ * may differ from the scalar ones by a few ulps.
+ **/
+void accumulateCoverage(const float* deltas, float* coverage, int n);
+void accumulateCoverage(const float* deltas, float* coverage, int n, InstructionSetEnum is);
+
+} // namespace ImageKernels
+} // namespace Natron
+
+#endif // NATRON_ENGINE_IMAGEKERNELS_H_
@@ -16,13 +16,24 @@
 #include <Python.h>
 
 #include <cassert>
+#include <vector>
+#include <list>
 
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
 #endif
 
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
 
 #include "Global/Macros.h"
+#include "Global/GlobalDefines.h"
+
+/**
+ * @brief The number of buckets of an ImageLockRegistry. Must be a power of 2.
+ **/
+#define NATRON_IMAGE_LOCK_REGISTRY_BUCKETS 16
 
 
 template<typename EntryType>
@@ -103,6 +114,179 @@ public:
 
 };
 
+/**
+ * @brief Implementation of LockManagerI keeping track of the entries being rendered.
+ * Entries are spread in buckets by their hash key, each bucket having its own mutex, so that threads
+ * locking different entries rarely contend. A thread waiting for an entry waits on a condition
+ * specific to that entry, allocated only when there is contention: unlocking an entry wakes up
+ * a single thread waiting for it and none of the threads waiting for other entries.
+ *
+ * EntryType must provide getHashKey().
+ **/
+template<typename EntryType>
+class ImageLockRegistry
+    : public LockManagerI<EntryType>
+{
+    struct LockedEntry
+    {
+        boost::shared_ptr<EntryType> entry;
+        bool locked; //< false only while the entry is being handed over to a waiting thread
+        int nWaiters;
+        QWaitCondition* cond; //< allocated by the first waiting thread
+
+        LockedEntry(const boost::shared_ptr<EntryType>& entry)
+        : entry(entry)
+        , locked(true)
+        , nWaiters(0)
+        , cond(0)
+        {
+        }
+    };
+
+    struct Bucket
+    {
+        QMutex mutex;
+        std::vector<LockedEntry> entries; //< only a few entries: a linear search is the fastest
+    };
+
+    mutable Bucket _buckets[NATRON_IMAGE_LOCK_REGISTRY_BUCKETS];
+    QAtomicInt _contentionCount;
+
+public:
+
+    ImageLockRegistry()
+    : LockManagerI<EntryType>()
+    , _contentionCount()
+    {
+    }
+
+    virtual ~ImageLockRegistry()
+    {
+        for (int i = 0; i < NATRON_IMAGE_LOCK_REGISTRY_BUCKETS; ++i) {
+            assert( _buckets[i].entries.empty() );
+        }
+    }
+
+    virtual void lock(const boost::shared_ptr<EntryType>& entry) OVERRIDE FINAL
+    {
+        Bucket & bucket = getBucket(entry);
+        QMutexLocker l(&bucket.mutex);
+        typename std::vector<LockedEntry>::iterator it = find(bucket, entry);
+
+        if ( it == bucket.entries.end() ) {
+            bucket.entries.push_back( LockedEntry(entry) );
+
+            return;
+        } else if (!it->locked) {
+            it->locked = true;
+
+            return;
+        }
+
+        ///Another thread is rendering the entry: wait for it to unlock the entry
+        _contentionCount.fetchAndAddRelaxed(1);
+        if (!it->cond) {
+            it->cond = new QWaitCondition;
+        }
+        QWaitCondition* cond = it->cond;
+        ++it->nWaiters;
+        for (;;) {
+            cond->wait(&bucket.mutex);
+            ///The entry can't be removed while it has waiters, but the vector may have been reallocated
+            it = find(bucket, entry);
+            assert( it != bucket.entries.end() );
+            if (!it->locked) {
+                break;
+            }
+        }
+        --it->nWaiters;
+        it->locked = true;
+    }
+
+    virtual bool tryLock(const boost::shared_ptr<EntryType>& entry) OVERRIDE FINAL
+    {
+        Bucket & bucket = getBucket(entry);
+        QMutexLocker l(&bucket.mutex);
+        typename std::vector<LockedEntry>::iterator it = find(bucket, entry);
+
+        if ( it == bucket.entries.end() ) {
+            bucket.entries.push_back( LockedEntry(entry) );
+
+            return true;
+        } else if (!it->locked) {
+            it->locked = true;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    virtual void unlock(const boost::shared_ptr<EntryType>& entry) OVERRIDE FINAL
+    {
+        Bucket & bucket = getBucket(entry);
+        QMutexLocker l(&bucket.mutex);
+        typename std::vector<LockedEntry>::iterator it = find(bucket, entry);
+
+        ///The entry must exist, otherwise this is a bug
+        assert( it != bucket.entries.end() && it->locked );
+        if (it->nWaiters > 0) {
+            ///Hand the entry over to one of the threads waiting for it
+            it->locked = false;
+            it->cond->wakeOne();
+        } else {
+            delete it->cond;
+            *it = bucket.entries.back();
+            bucket.entries.pop_back();
+        }
+    }
+
+    /**
+     * @brief Appends all the entries currently locked to entries
+     **/
+    void getLockedEntries(std::list<boost::shared_ptr<EntryType> >* entries) const
+    {
+        for (int i = 0; i < NATRON_IMAGE_LOCK_REGISTRY_BUCKETS; ++i) {
+            QMutexLocker l(&_buckets[i].mutex);
+            for (typename std::vector<LockedEntry>::const_iterator it = _buckets[i].entries.begin(); it != _buckets[i].entries.end(); ++it) {
+                entries->push_back(it->entry);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of times a thread had to wait in lock() for an entry because another thread was rendering it.
+     * Failed calls to tryLock() are not counted, since callers usually fall back on lock().
+     **/
+    U64 getContentionCount() const
+    {
+        return (U64)(int)_contentionCount;
+    }
+
+private:
+
+    Bucket & getBucket(const boost::shared_ptr<EntryType>& entry) const
+    {
+        U64 hash = (U64)entry->getHashKey();
+
+        ///fold the high bits of the key so that they are all used to pick the bucket
+        return _buckets[(hash ^ (hash >> 17) ^ (hash >> 37)) & (NATRON_IMAGE_LOCK_REGISTRY_BUCKETS - 1)];
+    }
+
+    static typename std::vector<LockedEntry>::iterator find(Bucket & bucket,
+                                                            const boost::shared_ptr<EntryType>& entry)
+    {
+        typename std::vector<LockedEntry>::iterator it = bucket.entries.begin();
+        for (; it != bucket.entries.end(); ++it) {
+            if (it->entry == entry) {
+                break;
+            }
+        }
+
+        return it;
+    }
+};
+
 namespace Natron {
     class Image;
     class FrameEntry;
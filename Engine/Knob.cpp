@@ -21,9 +21,12 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QThread>
 #include <QtCore/QDebug>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QAtomicInt>
 
 #include "Global/GlobalDefines.h"
 #include "Engine/Node.h"
+#include "Engine/NodeGroup.h"
 #include "Engine/ViewerInstance.h"
 #include "Engine/TimeLine.h"
 #include "Engine/Curve.h"
@@ -39,6 +42,7 @@
 #include "Engine/Hash64.h"
 #include "Engine/StringAnimationManager.h"
 #include "Engine/DockablePanelI.h"
+#include "Engine/NativeExpression.h"
 
 
 using namespace Natron;
@@ -195,9 +199,257 @@ struct Expr
     
     PyObject* code;
     
-    Expr() : expression(), originalExpression(), hasRet(false),  code(0){}
+    ///Set if the expression could be compiled natively, in which case it is evaluated without Python.
+    boost::shared_ptr<Natron::NativeExpression> native;
+    
+    ///Same as native, read without taking the expressionMutex by render threads
+    QAtomicPointer<Natron::NativeExpression> nativePtr;
+    
+    ///The names the expression was resolved against when it was last compiled natively
+    std::set<std::string> resolvedNames;
+    
+    Expr() : expression(), originalExpression(), hasRet(false),  code(0), native(), nativePtr(0), resolvedNames() {}
+};
+
+static Natron::NativeExpression*
+loadNativeExpression(const QAtomicPointer<Natron::NativeExpression>& ptr)
+{
+#if QT_VERSION < 0x050000
+    return ptr;
+#else
+    return ptr.load();
+#endif
+}
+
+namespace {
+
+/**
+ * @brief A knob read by a native expression. The knob is held weakly so that the expression does not keep
+ * a deleted node alive: reading it afterwards fails and the expression is handed back to Python.
+ **/
+class KnobExpressionParam : public Natron::NativeExpressionParam
+{
+public:
+    
+    KnobExpressionParam(const boost::shared_ptr<KnobI>& knob)
+    : _knob(knob)
+    , _isInt(dynamic_cast<Knob<int>*>( knob.get() ))
+    , _isBool(dynamic_cast<Knob<bool>*>( knob.get() ))
+    , _isDouble(dynamic_cast<Knob<double>*>( knob.get() ))
+    , _isColor(dynamic_cast<Color_Knob*>( knob.get() ) != 0)
+    , _dimension( knob->getDimension() )
+    {
+        assert(_isInt || _isBool || _isDouble);
+    }
+    
+    virtual ~KnobExpressionParam() {}
+    
+    virtual int getDimension() const OVERRIDE FINAL
+    {
+        return _dimension;
+    }
+    
+    virtual bool isColor() const OVERRIDE FINAL
+    {
+        return _isColor;
+    }
+    
+    virtual Natron::ExpressionValue::TypeEnum getType() const OVERRIDE FINAL
+    {
+        if (_isInt) {
+            return Natron::ExpressionValue::eTypeInt;
+        } else if (_isBool) {
+            return Natron::ExpressionValue::eTypeBool;
+        } else {
+            return Natron::ExpressionValue::eTypeFloat;
+        }
+    }
+    
+    virtual bool getValue(int dimension,double* value) const OVERRIDE FINAL
+    {
+        boost::shared_ptr<KnobI> knob = _knob.lock();
+        if (!knob) {
+            return false;
+        }
+        if (_isInt) {
+            *value = _isInt->getValue(dimension);
+        } else if (_isBool) {
+            *value = _isBool->getValue(dimension) ? 1. : 0.;
+        } else {
+            *value = _isDouble->getValue(dimension);
+        }
+        return true;
+    }
+    
+    virtual bool getValueAtTime(int time,int dimension,double* value) const OVERRIDE FINAL
+    {
+        boost::shared_ptr<KnobI> knob = _knob.lock();
+        if (!knob) {
+            return false;
+        }
+        if (_isInt) {
+            *value = _isInt->getValueAtTime(time, dimension);
+        } else if (_isBool) {
+            *value = _isBool->getValueAtTime(time, dimension) ? 1. : 0.;
+        } else {
+            *value = _isDouble->getValueAtTime(time, dimension);
+        }
+        return true;
+    }
+    
+    boost::shared_ptr<KnobI> getKnob() const
+    {
+        return _knob.lock();
+    }
+    
+private:
+    
+    boost::weak_ptr<KnobI> _knob;
+    
+    ///Only valid while _knob can be locked
+    Knob<int>* _isInt;
+    Knob<bool>* _isBool;
+    Knob<double>* _isDouble;
+    bool _isColor;
+    int _dimension;
 };
 
+/**
+ * @brief Resolves the names of an expression the same way they are declared in Python by
+ * KnobI::declareCurrentKnobVariable_Python: thisNode and the nodes in the scope of the node holding the knob.
+ **/
+class KnobExpressionResolver : public Natron::NativeExpressionResolver
+{
+public:
+    
+    KnobExpressionResolver(const KnobI* knob,const NodePtr& node)
+    : _knob(knob)
+    , _node(node)
+    , _nodesInScope()
+    , _resolvedNames()
+    {
+        boost::shared_ptr<NodeCollection> collection = node->getGroup();
+        if (!collection) {
+            return;
+        }
+        NodeGroup* isContainerGrp = dynamic_cast<NodeGroup*>( collection.get() );
+        if (isContainerGrp) {
+            _nodesInScope.push_back( isContainerGrp->getNode() );
+        }
+        NodeList siblings = collection->getNodes();
+        NodeGroup* isGrp = dynamic_cast<NodeGroup*>( node->getLiveInstance() );
+        if (isGrp) {
+            NodeList children = isGrp->getNodes();
+            siblings.insert( siblings.end(), children.begin(), children.end() );
+        }
+        for (NodeList::iterator it = siblings.begin(); it != siblings.end(); ++it) {
+            if ( (*it)->isActivated() && !(*it)->getParentMultiInstance() ) {
+                _nodesInScope.push_back(*it);
+            }
+        }
+    }
+    
+    virtual ~KnobExpressionResolver() {}
+    
+    virtual boost::shared_ptr<Natron::NativeExpressionParam> resolveParam(const std::string& nodeName,
+                                                                          const std::string& paramName) const OVERRIDE FINAL
+    {
+        boost::shared_ptr<Natron::NativeExpressionParam> ret;
+        _resolvedNames.insert(nodeName);
+        NodePtr node;
+        if (nodeName == "thisNode") {
+            node = _node;
+        } else {
+            ///Nodes within a group are declared as attributes of the group (e.g: Group1.Blur1), these are left to Python
+            for (std::list<NodePtr>::const_iterator it = _nodesInScope.begin(); it != _nodesInScope.end(); ++it) {
+                if ( (*it)->getFullyQualifiedName() == nodeName ) {
+                    node = *it;
+                }
+            }
+        }
+        if (!node) {
+            return ret;
+        }
+        boost::shared_ptr<KnobI> knob = node->getKnobByName(paramName);
+        if ( !knob || knob.get() == _knob ) {
+            return ret;
+        }
+        ///Only parameters whose Python get() returns numbers, see ParameterWrapper.cpp
+        bool isColor = dynamic_cast<Color_Knob*>( knob.get() ) != 0;
+        bool isSupported = dynamic_cast<Int_Knob*>( knob.get() ) || dynamic_cast<Double_Knob*>( knob.get() ) ||
+        dynamic_cast<Bool_Knob*>( knob.get() ) || dynamic_cast<Choice_Knob*>( knob.get() ) || isColor;
+        int dim = knob->getDimension();
+        if ( !isSupported || (isColor && dim != 3 && dim != 4) || (!isColor && dim > 3) ) {
+            return ret;
+        }
+        
+        ///Refuse expressions that would end-up reading this knob again
+        KnobHelper* isHelper = dynamic_cast<KnobHelper*>( knob.get() );
+        if ( isHelper && isHelper->isNativeExpressionReading(_knob) ) {
+            return ret;
+        }
+        ret.reset( new KnobExpressionParam(knob) );
+        return ret;
+    }
+    
+    virtual bool isNameInScope(const std::string& name) const OVERRIDE FINAL
+    {
+        _resolvedNames.insert(name);
+        if (name == "thisNode" || name == "thisParam") {
+            return true;
+        }
+        for (std::list<NodePtr>::const_iterator it = _nodesInScope.begin(); it != _nodesInScope.end(); ++it) {
+            std::string fullName = (*it)->getFullyQualifiedName();
+            if ( fullName.substr( 0, fullName.find('.') ) == name ) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    /**
+     * @brief The names whose resolution decided the outcome of the compilation: only a change of the nodes bearing
+     * one of these names can change the compiled program.
+     **/
+    const std::set<std::string>& getResolvedNames() const
+    {
+        return _resolvedNames;
+    }
+    
+private:
+    
+    const KnobI* _knob;
+    NodePtr _node;
+    std::list<NodePtr> _nodesInScope;
+    mutable std::set<std::string> _resolvedNames;
+};
+
+///Two programs compiled from the same expression are the same if they read the same knobs
+bool
+isSameNativeProgram(const boost::shared_ptr<Natron::NativeExpression>& a,
+                    const boost::shared_ptr<Natron::NativeExpression>& b)
+{
+    if (!a || !b) {
+        return a == b;
+    }
+    const std::vector<boost::shared_ptr<Natron::NativeExpressionParam> >& aParams = a->getParams();
+    const std::vector<boost::shared_ptr<Natron::NativeExpressionParam> >& bParams = b->getParams();
+    if ( aParams.size() != bParams.size() ) {
+        return false;
+    }
+    for (std::size_t i = 0; i < aParams.size(); ++i) {
+        KnobExpressionParam* aParam = dynamic_cast<KnobExpressionParam*>( aParams[i].get() );
+        KnobExpressionParam* bParam = dynamic_cast<KnobExpressionParam*>( bParams[i].get() );
+        boost::shared_ptr<KnobI> aKnob = aParam ? aParam->getKnob() : boost::shared_ptr<KnobI>();
+        if ( !aKnob || !bParam || (aKnob != bParam->getKnob()) ) {
+            return false;
+        }
+    }
+    return true;
+}
+    
+} // anon namespace
+
 
 struct KnobHelperPrivate
 {
@@ -265,6 +517,15 @@ struct KnobHelperPrivate
     mutable QMutex expressionMutex;
     std::vector<Expr> expressions;
     
+    ///The number of threads currently evaluating a native expression of this knob
+    mutable QAtomicInt nativeExpressionReaders;
+    
+    ///Native expressions that were replaced while render threads may still be evaluating them. They are released
+    ///as soon as no thread is evaluating, by the last reader leaving or by the next replacement.
+    mutable QMutex retiredNativeExpressionsMutex;
+    mutable std::list<boost::shared_ptr<Natron::NativeExpression> > retiredNativeExpressions;
+    mutable QAtomicInt retiredNativeExpressionsCount;
+    
     KnobHelperPrivate(KnobHelper* publicInterface_,
                       KnobHolder*  holder_,
                       int dimension_,
@@ -308,6 +569,10 @@ struct KnobHelperPrivate
     , dimensionNames(dimension_)
     , expressionMutex()
     , expressions()
+    , nativeExpressionReaders(0)
+    , retiredNativeExpressionsMutex()
+    , retiredNativeExpressions()
+    , retiredNativeExpressionsCount(0)
     {
         mustCloneGuiCurves.resize(dimension);
         mustCloneInternalCurves.resize(dimension);
@@ -319,6 +584,32 @@ struct KnobHelperPrivate
     }
     
     void parseListenersFromExpression(int dimension);
+    
+    ///Called once native is no longer published, with or without the expressionMutex held
+    void retireNativeExpression(const boost::shared_ptr<Natron::NativeExpression>& native)
+    {
+        {
+            QMutexLocker l(&retiredNativeExpressionsMutex);
+            retiredNativeExpressions.push_back(native);
+            retiredNativeExpressionsCount.ref();
+        }
+        reclaimRetiredNativeExpressions();
+    }
+    
+    ///Releases the retired native expressions if no thread is evaluating one
+    void reclaimRetiredNativeExpressions() const
+    {
+        std::list<boost::shared_ptr<Natron::NativeExpression> > toRelease;
+        {
+            QMutexLocker l(&retiredNativeExpressionsMutex);
+            ///Threads starting to evaluate after the check can only load the published programs
+            if (nativeExpressionReaders.fetchAndAddOrdered(0) != 0) {
+                return;
+            }
+            toRelease.swap(retiredNativeExpressions);
+            retiredNativeExpressionsCount.fetchAndStoreOrdered(0);
+        }
+    }
 };
 
 
@@ -1048,6 +1339,9 @@ KnobHelper::evaluateValueChange(int dimension,
     AppInstance* app = 0;
     if (_imp->holder) {
         app = _imp->holder->getApp();
+        if (reason != Natron::eValueChangedReasonTimeChanged) {
+            _imp->holder->incrementSerializationAge();
+        }
     }
     
     bool guiFrozen = app && _imp->gui && _imp->gui->isGuiFrozenForPlayback();
@@ -1553,6 +1847,9 @@ KnobHelper::setExpressionInternal(int dimension,const std::string& expression,bo
         _imp->expressions[dimension].originalExpression = expression;
     }
     
+    //Compile the expression natively if possible so that it can be evaluated without the GIL
+    compileNativeExpression(dimension, false);
+    
     //Parse listeners of the expression, to keep track of dependencies to indicate them to the user.
     if (getHolder()) {
         QMutexLocker k(&_expressionRecursionLevelMutex);
@@ -1584,6 +1881,12 @@ KnobHelper::clearExpression(int dimension,bool clearResults)
         _imp->expressions[dimension].originalExpression.clear();
         Py_XDECREF(_imp->expressions[dimension].code); //< new ref
         _imp->expressions[dimension].code = 0;
+        _imp->expressions[dimension].resolvedNames.clear();
+        if (_imp->expressions[dimension].native) {
+            _imp->expressions[dimension].nativePtr.fetchAndStoreOrdered(0);
+            _imp->retireNativeExpression(_imp->expressions[dimension].native);
+            _imp->expressions[dimension].native.reset();
+        }
     }
     {
         std::list<KnobI*> dependencies;
@@ -1633,6 +1936,7 @@ void
 KnobHelper::expressionChanged(int dimension)
 {
     if (_imp->holder) {
+        _imp->holder->incrementSerializationAge();
         _imp->holder->updateHasAnimation();
     }
     
@@ -1682,6 +1986,127 @@ KnobHelper::executeExpression(int dimension) const
     
 }
 
+bool
+KnobHelper::evaluateNativeExpression(int dimension,Natron::ExpressionValue* result) const
+{
+    ///This is called for every getValue() call on a knob with an expression: do not lock anything here
+    if ( dimension < 0 || dimension >= (int)_imp->expressions.size() ) {
+        return false;
+    }
+    ///Register as a reader before loading the pointer, so that the program cannot be released while it is evaluated
+    _imp->nativeExpressionReaders.ref();
+    Natron::NativeExpression* native = loadNativeExpression(_imp->expressions[dimension].nativePtr);
+    ///Same as the frame variable declared in Python by declareCurrentKnobVariable_Python
+    bool ok = native && native->evaluate(getCurrentTime(), dimension, result);
+    ///The last reader to leave releases the programs replaced while it was evaluating
+    if ( !_imp->nativeExpressionReaders.deref() && (_imp->retiredNativeExpressionsCount.fetchAndAddOrdered(0) > 0) ) {
+        _imp->reclaimRetiredNativeExpressions();
+    }
+    return ok;
+}
+
+bool
+KnobHelper::isNativeExpressionReading(const KnobI* knob) const
+{
+    std::list<boost::shared_ptr<KnobI> > reads;
+    {
+        QMutexLocker k(&_imp->expressionMutex);
+        for (std::size_t i = 0; i < _imp->expressions.size(); ++i) {
+            if (!_imp->expressions[i].native) {
+                continue;
+            }
+            const std::vector<boost::shared_ptr<Natron::NativeExpressionParam> >& params = _imp->expressions[i].native->getParams();
+            for (std::size_t j = 0; j < params.size(); ++j) {
+                KnobExpressionParam* param = dynamic_cast<KnobExpressionParam*>( params[j].get() );
+                boost::shared_ptr<KnobI> read = param ? param->getKnob() : boost::shared_ptr<KnobI>();
+                if (read) {
+                    reads.push_back(read);
+                }
+            }
+        }
+    }
+    for (std::list<boost::shared_ptr<KnobI> >::iterator it = reads.begin(); it != reads.end(); ++it) {
+        if (it->get() == knob) {
+            return true;
+        }
+        KnobHelper* isHelper = dynamic_cast<KnobHelper*>( it->get() );
+        if ( isHelper && isHelper->isNativeExpressionReading(knob) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+KnobHelper::compileNativeExpression(int dimension,
+                                    bool clearResults)
+{
+    std::string expression;
+    bool hasRet;
+    {
+        QMutexLocker k(&_imp->expressionMutex);
+        expression = _imp->expressions[dimension].originalExpression;
+        hasRet = _imp->expressions[dimension].hasRet;
+    }
+    
+    boost::shared_ptr<Natron::NativeExpression> native;
+    std::set<std::string> resolvedNames;
+    EffectInstance* effect = dynamic_cast<EffectInstance*>( getHolder() );
+    if ( !expression.empty() && !hasRet && effect && effect->getNode() ) {
+        KnobExpressionResolver resolver( this, effect->getNode() );
+        std::string error;
+        native = Natron::NativeExpression::compile(expression, &resolver, &error);
+        resolvedNames = resolver.getResolvedNames();
+    }
+    
+    {
+        QMutexLocker k(&_imp->expressionMutex);
+        Expr& expr = _imp->expressions[dimension];
+        if (expr.originalExpression != expression) {
+            return;
+        }
+        expr.resolvedNames = resolvedNames;
+        ///Keep the program render threads may be evaluating, as well as the results cached by Python, if nothing changed
+        if ( isSameNativeProgram(native, expr.native) ) {
+            return;
+        }
+        expr.nativePtr.fetchAndStoreOrdered( native.get() );
+        ///Render threads may still be evaluating the previous program
+        if (expr.native) {
+            _imp->retireNativeExpression(expr.native);
+        }
+        expr.native = native;
+    }
+    ///Results cached by Python may have been computed against other nodes
+    if (clearResults) {
+        clearExpressionsResults(dimension);
+    }
+}
+
+void
+KnobHelper::refreshNativeExpressions(const std::list<std::string>& nodeNames)
+{
+    for (int i = 0; i < (int)_imp->expressions.size(); ++i) {
+        bool mustCompile = false;
+        {
+            QMutexLocker k(&_imp->expressionMutex);
+            const std::set<std::string>& resolvedNames = _imp->expressions[i].resolvedNames;
+            if ( resolvedNames.empty() ) {
+                continue;
+            }
+            ///An expression may refer to a node by its fully qualified name, its script-name or the name of its top-level group
+            for (std::list<std::string>::const_iterator it = nodeNames.begin(); it != nodeNames.end() && !mustCompile; ++it) {
+                mustCompile = resolvedNames.count(*it) ||
+                resolvedNames.count( it->substr( 0, it->find('.') ) ) ||
+                resolvedNames.count( it->substr(it->rfind('.') + 1) );
+            }
+        }
+        if (mustCompile) {
+            compileNativeExpression(i, true);
+        }
+    }
+}
+
 std::string
 KnobHelper::getExpression(int dimension) const
 {
@@ -2441,6 +2866,8 @@ struct KnobHolder::KnobHolderPrivate
     mutable QMutex hasAnimationMutex;
     bool hasAnimation;
     
+    U64 serializationAge; //< protected by serializationAgeMutex
+    
     DockablePanelI* settingsPanel;
     
     KnobHolderPrivate(AppInstance* appInstance_)
@@ -2462,6 +2889,7 @@ struct KnobHolder::KnobHolderPrivate
     , knobsFrozen(false)
     , hasAnimationMutex()
     , hasAnimation(false)
+    , serializationAge(0)
     , settingsPanel(0)
 
     {
@@ -2497,8 +2925,11 @@ void
 KnobHolder::addKnob(boost::shared_ptr<KnobI> k)
 {
     assert(QThread::currentThread() == qApp->thread());
-    QMutexLocker kk(&_imp->knobsMutex);
-    _imp->knobs.push_back(k);
+    {
+        QMutexLocker kk(&_imp->knobsMutex);
+        _imp->knobs.push_back(k);
+    }
+    incrementSerializationAge();
 }
 
 void
@@ -2507,15 +2938,18 @@ KnobHolder::insertKnob(int index, const boost::shared_ptr<KnobI>& k)
     if (index < 0) {
         return;
     }
-    QMutexLocker kk(&_imp->knobsMutex);
-    
-    if (index >= (int)_imp->knobs.size()) {
-        _imp->knobs.push_back(k);
-    } else {
-        std::vector<boost::shared_ptr<KnobI> >::iterator it = _imp->knobs.begin();
-        std::advance(it, index);
-        _imp->knobs.insert(it, k);
+    {
+        QMutexLocker kk(&_imp->knobsMutex);
+        
+        if (index >= (int)_imp->knobs.size()) {
+            _imp->knobs.push_back(k);
+        } else {
+            std::vector<boost::shared_ptr<KnobI> >::iterator it = _imp->knobs.begin();
+            std::advance(it, index);
+            _imp->knobs.insert(it, k);
+        }
     }
+    incrementSerializationAge();
 }
 
 void
@@ -2561,11 +2995,11 @@ KnobHolder::removeDynamicKnob(KnobI* knob)
         for (std::vector<boost::shared_ptr<KnobI> >::iterator it2 = _imp->knobs.begin(); it2 != _imp->knobs.end(); ++it2) {
             if (it2->get() == knob && (*it2)->isDynamicallyCreated()) {
                 _imp->knobs.erase(it2);
-                return;
+                break;
             }
         }
     }
-    
+    incrementSerializationAge();
 }
 
 void
@@ -2574,6 +3008,7 @@ KnobHolder::moveKnobOneStepUp(KnobI* knob)
     if (!knob->isUserKnob()) {
         return;
     }
+    incrementSerializationAge();
     boost::shared_ptr<KnobI> parent = knob->getParentKnob();
     Group_Knob* parentIsGrp = dynamic_cast<Group_Knob*>(parent.get());
     Page_Knob* parentIsPage = dynamic_cast<Page_Knob*>(parent.get());
@@ -2610,6 +3045,7 @@ KnobHolder::moveKnobOneStepDown(KnobI* knob)
     if (!knob->isUserKnob()) {
         return;
     }
+    incrementSerializationAge();
     boost::shared_ptr<KnobI> parent = knob->getParentKnob();
     Group_Knob* parentIsGrp = dynamic_cast<Group_Knob*>(parent.get());
     Page_Knob* parentIsPage = dynamic_cast<Page_Knob*>(parent.get());
@@ -2953,6 +3389,27 @@ KnobHolder::isEvaluationBlocked() const
     return _imp->evaluationBlocked > 0;
 }
 
+///Serialization ages are drawn from a counter shared by all holders so that a holder recreated in place of another one
+///never reports the same age
+static QMutex serializationAgeMutex;
+static U64 serializationAgeCounter = 0;
+
+void
+KnobHolder::incrementSerializationAge()
+{
+    QMutexLocker l(&serializationAgeMutex);
+    
+    _imp->serializationAge = ++serializationAgeCounter;
+}
+
+U64
+KnobHolder::getSerializationAge() const
+{
+    QMutexLocker l(&serializationAgeMutex);
+    
+    return _imp->serializationAge;
+}
+
 KnobHolder::MultipleParamsEditEnum
 KnobHolder::getMultipleParamsEditLevel() const
 {
@@ -41,6 +41,7 @@ class StringAnimationManager;
 
 namespace Natron {
 class OfxParamOverlayInteract;
+struct ExpressionValue;
 }
 
 class DockablePanelI;
@@ -1140,6 +1141,13 @@ protected:
     
     ///The return value must be Py_DECRREF
     PyObject* executeExpression(int dimension) const;
+    
+    /**
+     * @brief Evaluates the expression of the given dimension at the current time without Python if it could be compiled natively.
+     * This does not take the GIL and can be called from any thread.
+     * Returns false if there is no native expression or if it failed, in which case Python must be used.
+     **/
+    bool evaluateNativeExpression(int dimension,Natron::ExpressionValue* result) const;
 
 public:
 
@@ -1160,6 +1168,26 @@ public:
 
     virtual void getListeners(std::list<KnobI*> & listeners) const OVERRIDE FINAL;
     
+    /**
+     * @brief Returns true if the natively compiled expressions of this knob read the given knob, directly
+     * or through the native expressions of other knobs.
+     **/
+    bool isNativeExpressionReading(const KnobI* knob) const;
+    
+    /**
+     * @brief Compiles again the native expressions of this knob which were resolved against one of the given node names,
+     * so that they use the nodes currently in scope the same way Python would. This must be called with the fully
+     * qualified names of the nodes whenever a node is created, renamed, activated or deactivated.
+     * The program and the results cached by Python are kept if the expression still reads the same knobs.
+     **/
+    void refreshNativeExpressions(const std::list<std::string>& nodeNames);
+    
+private:
+    
+    ///Compiles natively the expression of the given dimension, or removes its native program if it cannot be compiled.
+    ///If clearResults is true, the results cached by Python are cleared when the native program changes.
+    void compileNativeExpression(int dimension,bool clearResults);
+    
 protected:
 
 
@@ -1498,6 +1526,12 @@ public:
 private:
     
     T evaluateExpression(int dimension) const;
+    
+    ///Returns false if the result of a native expression cannot be converted the way pyObjectToType would
+    bool nativeResultToType(const Natron::ExpressionValue& v,T* ret) const;
+    
+    ///Returns false if the expression of the given dimension must be evaluated by Python
+    bool getNativeExpressionValue(int dimension,bool clamp,T* ret) const;
 
     //////////////////////////////////////////////////////////////////////
     /////////////////////////////////// End implementation of KnobI
@@ -1769,6 +1803,16 @@ public:
     
     bool isEvaluationBlocked() const;
 
+    /**
+     * @brief The serialization age is incremented every time the value, animation or expression of a knob changes
+     * and every time a knob is added, removed or moved, regardless of whether the change triggers an evaluation.
+     * Unlike the knobs age of a node, it tells whether the serialization of the holder may have changed.
+     * Ages are unique across all holders.
+     **/
+    void incrementSerializationAge();
+
+    U64 getSerializationAge() const;
+
     void appendValueChange(KnobI* knob,Natron::ValueChangedReasonEnum reason);
     
 protected:
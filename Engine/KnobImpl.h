@@ -19,6 +19,7 @@
 #include "Knob.h"
 
 #include <cfloat>
+#include <climits>
 #include <stdexcept>
 #include <string>
 
@@ -42,6 +43,7 @@ GCC_DIAG_ON(unused-parameter)
 #include "Engine/TimeLine.h"
 #include "Engine/EffectInstance.h"
 #include "Engine/KnobTypes.h"
+#include "Engine/NativeExpression.h"
 
 
 ///template specializations
@@ -331,6 +333,56 @@ Knob<std::string>::pyObjectToType(PyObject* o) const
     return std::string(Natron::PY3String_asString(o));
 }
 
+template <>
+bool
+Knob<int>::nativeResultToType(const Natron::ExpressionValue& v,int* ret) const
+{
+    ///PyInt_AsLong fails on floats
+    if ( v.type == Natron::ExpressionValue::eTypeFloat || v.value < INT_MIN || v.value > INT_MAX ) {
+        return false;
+    }
+    *ret = (int)v.value;
+    return true;
+}
+
+template <>
+bool
+Knob<bool>::nativeResultToType(const Natron::ExpressionValue& v,bool* ret) const
+{
+    *ret = v.value != 0.;
+    return true;
+}
+
+template <>
+bool
+Knob<double>::nativeResultToType(const Natron::ExpressionValue& v,double* ret) const
+{
+    *ret = v.value;
+    return true;
+}
+
+template <>
+bool
+Knob<std::string>::nativeResultToType(const Natron::ExpressionValue& /*v*/,std::string* /*ret*/) const
+{
+    ///String expressions are always evaluated by Python
+    return false;
+}
+
+template <typename T>
+bool
+Knob<T>::getNativeExpressionValue(int dimension,bool clamp,T* ret) const
+{
+    Natron::ExpressionValue v;
+    if ( !evaluateNativeExpression(dimension, &v) || !nativeResultToType(v, ret) ) {
+        return false;
+    }
+    if (clamp) {
+        *ret = clampToMinMax(*ret,dimension);
+    }
+    return true;
+}
+
 template <typename T>
 T Knob<T>::evaluateExpression(int dimension) const
 {
@@ -416,6 +468,12 @@ template <typename T>
 T
 Knob<T>::getValue(int dimension,bool clamp) const
 {
+    ///Natively compiled expressions are evaluated without locking and are cheap enough not to go through the results cache
+    T nativeRet;
+    if ( getNativeExpressionValue(dimension, clamp, &nativeRet) ) {
+        return nativeRet;
+    }
+    
     std::string hasExpr = getExpression(dimension);
     if (!hasExpr.empty()) {
         
@@ -565,6 +623,12 @@ Knob<T>::getValueAtTime(double time,
         throw std::invalid_argument("Knob::getValueAtTime(): Dimension out of range");
     }
     
+    ///Natively compiled expressions are evaluated without locking and are cheap enough not to go through the results cache
+    T nativeRet;
+    if ( getNativeExpressionValue(dimension, clamp, &nativeRet) ) {
+        return nativeRet;
+    }
+    
     std::string hasExpr = getExpression(dimension);
     if (!hasExpr.empty()) {
         
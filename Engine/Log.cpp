@@ -23,34 +23,58 @@
 #include <cstdarg>
 #include <cstdlib>
 #include <string>
+#include <map>
+#include <vector>
 
 #include <QFile>
 #include <QTextStream>
 #include <QMutex>
+#include <QCoreApplication>
+
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#endif
 
 #include "Global/GlobalDefines.h"
+#include "Engine/AsyncLogger.h"
+
+namespace {
+
+enum LogRecordKindEnum
+{
+    eLogRecordKindBeginFunction = 0,
+    eLogRecordKindPrint,
+    eLogRecordKindEndFunction
+};
 
+} // anon namespace
 
 namespace Natron {
 class LogPrivate
 {
 public:
 
-    QMutex _lock;
+    QMutex _lock; //< protects the file and the stream, which are written by the flusher thread of the logger
     QFile* _file;
     QTextStream* _stream;
-    int _beginsCount;
+    std::map<int, int> _beginsCount; //< per thread, only accessed by the flusher thread
+    boost::scoped_ptr<AsyncLogger> _logger;
 
     LogPrivate()
         : _lock()
           , _file(NULL)
           , _stream(NULL)
-          , _beginsCount(0)
+          , _beginsCount()
+          , _logger()
     {
+        _logger.reset( new AsyncLogger( boost::bind(&LogPrivate::write, this, _1, _2) ) );
     }
 
     ~LogPrivate()
     {
+        ///Flushes the records left before closing the file
+        _logger.reset();
         if (_stream) {
             delete _stream;
         }
@@ -64,6 +88,11 @@ public:
     {
         QMutexLocker locker(&_lock);
 
+        openInternal(fileName);
+    }
+
+    void openInternal(const std::string & fileName)
+    {
         if (_file) {
             return;
         }
@@ -72,71 +101,110 @@ public:
         _stream = new QTextStream(_file);
     }
 
-    void beginFunction(const std::string & callerName,
-                       const std::string & function)
+    void indent(int beginsCount)
     {
-        if (!_file) {
-            QString filename(NATRON_APPLICATION_NAME + QString("_log") + QString::number( QCoreApplication::instance()->applicationPid() ) + ".txt");
-            open( filename.toStdString() );
+        for (int i = 0; i < beginsCount; ++i) {
+            *_stream << "    ";
         }
-        QMutexLocker locker(&_lock);
-        _stream->operator <<("********************************************************************************\n");
-        for (int i = 0; i < _beginsCount; ++i) {
-            _stream->operator <<("    ");
+    }
+
+    ///Writes the thread and the time of the record, in microseconds
+    void writeHeader(const LogRecord & r)
+    {
+        *_stream << "[T" << r.threadIndex << ' ' << (qulonglong)r.timestamp << "] ";
+    }
+
+    void writeFunction(const char* tag,
+                       const LogRecord & r,
+                       int beginsCount)
+    {
+        indent(beginsCount);
+        writeHeader(r);
+        *_stream << tag << r.node << "    " << r.action << '\n';
+    }
+
+    void writeText(const char* text,
+                   int beginsCount)
+    {
+        indent(beginsCount);
+        std::size_t column = 0;
+        for (std::size_t i = 0; text[i] != '\0'; ++i, ++column) {
+            *_stream << text[i];
+            if ( (column >= 80) && (text[i] == ' ') ) { // format to 80 columns, at the end of a word
+                *_stream << '\n';
+                indent(beginsCount);
+                column = 0;
+            }
         }
-        _stream->operator <<("START ");
-        _stream->operator <<( callerName.c_str() );
-        _stream->operator <<("    ");
-        _stream->operator <<( function.c_str() );
-        _stream->operator <<('\n');
-        _stream->flush();
-        ++_beginsCount;
+        *_stream << '\n';
     }
 
-    void print(const std::string & log)
+    ///Called by the flusher thread of the logger
+    void write(const std::vector<LogRecord> & records,
+               int dropped)
     {
         QMutexLocker locker(&_lock);
 
-        assert(_file);
-        for (int i = 0; i < _beginsCount; ++i) {
-            _stream->operator <<("    ");
+        if (!_file) {
+            QString filename(NATRON_APPLICATION_NAME + QString("_log") + QString::number( QCoreApplication::applicationPid() ) + ".txt");
+            openInternal( filename.toStdString() );
         }
-        QString str( log.c_str() );
-        for (int i = 0; i < str.size(); ++i) {
-            _stream->operator <<( str.at(i).toAscii() );
-            if ( (i % 80 == 0) && (i != 0) ) { // format to 80 columns
-                /*Find closest word end and insert a new line*/
-                ++i;
-                while ( i < str.size() && str.at(i) != QChar(' ') ) {
-                    _stream->operator <<( str.at(i).toAscii() );
-                    ++i;
+        if (dropped > 0) {
+            *_stream << "**** " << dropped << " records were dropped because the log could not be flushed fast enough\n";
+        }
+        for (std::vector<LogRecord>::const_iterator it = records.begin(); it != records.end(); ++it) {
+            int & beginsCount = _beginsCount[it->threadIndex];
+            switch (it->kind) {
+            case eLogRecordKindBeginFunction:
+                *_stream << "********************************************************************************\n";
+                writeFunction("START ", *it, beginsCount);
+                ++beginsCount;
+                break;
+            case eLogRecordKindEndFunction:
+                if (beginsCount > 0) {
+                    --beginsCount;
+                }
+                writeFunction("STOP ", *it, beginsCount);
+                break;
+            default: {
+                indent(beginsCount);
+                writeHeader(*it);
+                if (it->node[0] != '\0') {
+                    *_stream << it->node << ' ';
+                }
+                if (it->frame != NATRON_LOG_RECORD_NO_FRAME) {
+                    *_stream << "frame " << it->frame << ' ';
                 }
-                _stream->operator <<('\n');
-                for (int i = 0; i < _beginsCount; ++i) {
-                    _stream->operator <<("    ");
+                if (it->action[0] != '\0') {
+                    *_stream << it->action << ' ';
                 }
+                *_stream << '\n';
+                writeText(it->message, beginsCount + 1);
+                break;
+            }
             }
         }
-        _stream->operator <<( log.c_str() );
-        _stream->operator <<('\n');
         _stream->flush();
     }
 
+    void beginFunction(const std::string & callerName,
+                       const std::string & function)
+    {
+        _logger->log(eLogRecordKindBeginFunction, callerName.c_str(), NATRON_LOG_RECORD_NO_FRAME, function.c_str(), "");
+    }
+
+    void print(const std::string & node,
+               int frame,
+               const std::string & action,
+               const std::string & log)
+    {
+        _logger->log( eLogRecordKindPrint, node.c_str(), frame, action.c_str(), log.c_str() );
+    }
+
     void endFunction(const std::string & callerName,
                      const std::string & function)
     {
-        QMutexLocker locker(&_lock);
-
-        --_beginsCount;
-        for (int i = 0; i < _beginsCount; ++i) {
-            _stream->operator <<("    ");
-        }
-        _stream->operator <<("STOP ");
-        _stream->operator <<( callerName.c_str() );
-        _stream->operator <<("    ");
-        _stream->operator <<( function.c_str() );
-        _stream->operator <<('\n');
-        _stream->flush();
+        _logger->log(eLogRecordKindEndFunction, callerName.c_str(), NATRON_LOG_RECORD_NO_FRAME, function.c_str(), "");
     }
 };
 
@@ -166,7 +234,16 @@ Log::beginFunction(const std::string & callerName,
 void
 Log::print(const std::string & log)
 {
-    Log::instance()->_imp->print(log);
+    Log::instance()->_imp->print(std::string(), NATRON_LOG_RECORD_NO_FRAME, std::string(), log);
+}
+
+void
+Log::printRecord(const std::string & node,
+                 int frame,
+                 const std::string & action,
+                 const std::string & log)
+{
+    Log::instance()->_imp->print(node, frame, action, log);
 }
 
 void
@@ -176,11 +253,9 @@ Log::print(const char *format,
     va_list args;
 
     va_start(args, format);
-    char buf[10000];
-    sprintf(buf, format, args);
+    ///Formatted directly into the record, see AsyncLogger::vlog()
+    Log::instance()->_imp->_logger->vlog(eLogRecordKindPrint, "", NATRON_LOG_RECORD_NO_FRAME, "", format, args);
     va_end(args);
-    std::string str(buf);
-    Log::print(str);
 }
 
 void
@@ -189,5 +264,11 @@ Log::endFunction(const std::string & callerName,
 {
     Log::instance()->_imp->endFunction(callerName,function);
 }
+
+void
+Log::flush()
+{
+    Log::instance()->_imp->_logger->flush();
+}
 } //namespace Natron
 #endif // ifdef NATRON_LOG
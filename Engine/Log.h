@@ -23,6 +23,12 @@
 
 namespace Natron {
 class LogPrivate;
+
+/**
+ * @brief The log of the application. The functions only write a record in a buffer of the calling thread, the records
+ * are formatted and written to the file by a background thread (see AsyncLogger), so that logging does not make the
+ * render threads wait for the I/O. The calls of beginFunction() and endFunction() are nested per thread.
+ **/
 class Log
     : public Singleton<Natron::Log>
 {
@@ -59,11 +65,23 @@ public:
      **/
     static void print(const char *format, ...);
 
+    /**
+     * @brief Same as print for a record related to an action of a node at a given frame. Any of node, frame
+     * (NATRON_LOG_RECORD_NO_FRAME) and action may be left empty.
+     **/
+    static void printRecord(const std::string & node, int frame, const std::string & action, const std::string & log);
+
     /**
      * @brief Ends a function in the log. It will print a new delimiter
      * and a STOP tag. This is used to bracket a call to print.
      **/
     static void endFunction(const std::string & callerName,const std::string & function);
+
+    /**
+     * @brief Blocks until everything logged so far is written to the file.
+     **/
+    static void flush();
+
     static bool enabled()
     {
         return true;
@@ -108,11 +126,22 @@ public:
     {
     }
 
+    static void printRecord(const std::string &,
+                            int,
+                            const std::string &,
+                            const std::string & )
+    {
+    }
+
     static void endFunction(const std::string &,
                             const std::string & )
     {
     }
 
+    static void flush()
+    {
+    }
+
     static bool enabled()
     {
         return false;
@@ -231,6 +231,30 @@ Lut::toColorSpaceUint8xxFromLinearFloatFast(float v) const
     return toFunc_hipart_to_uint8xx[hipart(v)];
 }
 
+void
+Lut::toColorSpaceUint8xxFromLinearFloatFast(const float* from,
+                                            int inDelta,
+                                            unsigned short* to,
+                                            int W) const
+{
+    assert(init_);
+    for (int i = 0; i < W; ++i, from += inDelta) {
+        to[i] = toFunc_hipart_to_uint8xx[hipart(*from)];
+    }
+}
+
+void
+Lut::fromColorSpaceUint8ToLinearFloatFast(const unsigned char* from,
+                                          int inDelta,
+                                          float* to,
+                                          int W) const
+{
+    assert(init_);
+    for (int i = 0; i < W; ++i, from += inDelta) {
+        to[i] = fromFunc_uint8_to_float[*from];
+    }
+}
+
 // the following only works for increasing LUTs
 unsigned short
 Lut::toColorSpaceUint16FromLinearFloatFast(float v) const
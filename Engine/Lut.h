@@ -239,6 +239,25 @@ public:
      */
     float fromColorSpaceUint16ToLinearFloatFast(unsigned short v) const;
 
+    /* @brief Returns the look-up table used by toColorSpaceUint8xxFromLinearFloatFast(float): it has 0x10000 entries
+     * and is indexed by the 16 most significant bits of the float. Used by the vectorized kernels of ImageKernels.
+     * validate() must have been called.
+     */
+    const unsigned short* getToUint8xxTable() const
+    {
+        return toFunc_hipart_to_uint8xx;
+    }
+
+    /* @brief Same as toColorSpaceUint8xxFromLinearFloatFast(float) for the W values of from,
+     * which are separated by inDelta elements.
+     */
+    void toColorSpaceUint8xxFromLinearFloatFast(const float* from, int inDelta, unsigned short* to, int W) const;
+
+    /* @brief Same as fromColorSpaceUint8ToLinearFloatFast(unsigned char) for the W values of from,
+     * which are separated by inDelta elements.
+     */
+    void fromColorSpaceUint8ToLinearFloatFast(const unsigned char* from, int inDelta, float* to, int W) const;
+
 
     /////@TODO the following functions expects a float input buffer, one could extend it to cover all bitdepths.
 
@@ -0,0 +1,222 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "MemoryPool.h"
+
+#include <map>
+#include <vector>
+#include <new>
+#include <cstdlib>
+
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+
+#include "Global/Macros.h"
+#ifdef __NATRON_WIN32__
+#include <malloc.h>
+#endif
+
+namespace {
+
+///Below that size, blocks are rounded to a multiple of the alignment rather than to a size class
+#define NATRON_MEMORY_POOL_MIN_CLASS_SIZE 4096
+
+void*
+systemAlignedAlloc(std::size_t nBytes)
+{
+    void* ret = 0;
+#ifdef __NATRON_WIN32__
+    ret = _aligned_malloc(nBytes, NATRON_MEMORY_POOL_ALIGNMENT);
+#else
+    if (posix_memalign(&ret, NATRON_MEMORY_POOL_ALIGNMENT, nBytes) != 0) {
+        ret = 0;
+    }
+#endif
+    return ret;
+}
+
+void
+systemAlignedFree(void* ptr)
+{
+#ifdef __NATRON_WIN32__
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+typedef std::map<std::size_t, std::vector<void*> > FreeLists;
+
+struct MemoryPoolPrivate
+{
+    QMutex lock; //< protects all members
+    FreeLists freeLists; //< released blocks, indexed by size class
+    Natron::MemoryPoolStats stats;
+
+    MemoryPoolPrivate()
+    : lock()
+    , freeLists()
+    , stats()
+    {
+        stats.maxPooledBytes = NATRON_MEMORY_POOL_DEFAULT_MAX_POOLED_SIZE;
+    }
+
+    ~MemoryPoolPrivate()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (FreeLists::iterator it = freeLists.begin(); it != freeLists.end(); ++it) {
+            for (std::vector<void*>::iterator it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+                systemAlignedFree(*it2);
+            }
+        }
+        freeLists.clear();
+        stats.bytesPooled = 0;
+    }
+
+    /**
+     * @brief Frees the pooled blocks of the largest size classes until the pooled size fits in the budget.
+     * Large blocks are the most expensive to keep around and the least likely to be re-used.
+     **/
+    void trim()
+    {
+        while ( stats.bytesPooled > stats.maxPooledBytes && !freeLists.empty() ) {
+            FreeLists::iterator last = freeLists.end();
+            --last;
+            while ( !last->second.empty() && stats.bytesPooled > stats.maxPooledBytes ) {
+                systemAlignedFree( last->second.back() );
+                last->second.pop_back();
+                stats.bytesPooled -= last->first;
+                ++stats.nSystemFrees;
+            }
+            if ( last->second.empty() ) {
+                freeLists.erase(last);
+            }
+        }
+    }
+};
+
+///Constructed before main() so that no thread can race on its initialization
+MemoryPoolPrivate gPool;
+
+MemoryPoolPrivate&
+pool()
+{
+    return gPool;
+}
+
+} // anon namespace
+
+namespace Natron {
+
+std::size_t
+MemoryPool::getSizeClass(std::size_t nBytes)
+{
+    if (nBytes <= NATRON_MEMORY_POOL_MIN_CLASS_SIZE) {
+        return (nBytes + NATRON_MEMORY_POOL_ALIGNMENT - 1) & ~( (std::size_t)NATRON_MEMORY_POOL_ALIGNMENT - 1 );
+    }
+    ///Find the power of 2 p such that p < nBytes <= 2p, then round up to the next quarter of p
+    std::size_t p = NATRON_MEMORY_POOL_MIN_CLASS_SIZE;
+    while ( (p << 1) < nBytes ) {
+        p <<= 1;
+    }
+    std::size_t quarter = p >> 2;
+    return p + ( (nBytes - p + quarter - 1) / quarter ) * quarter;
+}
+
+void*
+MemoryPool::allocate(std::size_t nBytes)
+{
+    if (nBytes == 0) {
+        return 0;
+    }
+    std::size_t sizeClass = getSizeClass(nBytes);
+    MemoryPoolPrivate& p = pool();
+    {
+        QMutexLocker k(&p.lock);
+        ++p.stats.nAllocations;
+        p.stats.bytesInUse += sizeClass;
+        FreeLists::iterator found = p.freeLists.find(sizeClass);
+        if ( found != p.freeLists.end() && !found->second.empty() ) {
+            void* ret = found->second.back();
+            found->second.pop_back();
+            p.stats.bytesPooled -= sizeClass;
+            ++p.stats.nRecycledAllocations;
+            return ret;
+        }
+    }
+
+    ///Do not hold the lock while calling the system allocator
+    void* ret = systemAlignedAlloc(sizeClass);
+    if (!ret) {
+        ///The pool may hold blocks of other size classes: give them back to the system and retry once
+        clear();
+        ret = systemAlignedAlloc(sizeClass);
+    }
+    if (!ret) {
+        QMutexLocker k(&p.lock);
+        p.stats.bytesInUse -= sizeClass;
+        throw std::bad_alloc();
+    }
+    return ret;
+}
+
+void
+MemoryPool::release(void* ptr,
+                    std::size_t nBytes)
+{
+    if (!ptr) {
+        return;
+    }
+    std::size_t sizeClass = getSizeClass(nBytes);
+    MemoryPoolPrivate& p = pool();
+    {
+        QMutexLocker k(&p.lock);
+        ++p.stats.nReleases;
+        p.stats.bytesInUse = sizeClass > p.stats.bytesInUse ? 0 : p.stats.bytesInUse - sizeClass;
+        if (p.stats.bytesPooled + sizeClass <= p.stats.maxPooledBytes) {
+            p.freeLists[sizeClass].push_back(ptr);
+            p.stats.bytesPooled += sizeClass;
+            return;
+        }
+        ++p.stats.nSystemFrees;
+    }
+    systemAlignedFree(ptr);
+}
+
+void
+MemoryPool::setMaximumPooledSize(std::size_t nBytes)
+{
+    MemoryPoolPrivate& p = pool();
+    QMutexLocker k(&p.lock);
+    p.stats.maxPooledBytes = nBytes;
+    p.trim();
+}
+
+void
+MemoryPool::clear()
+{
+    MemoryPoolPrivate& p = pool();
+    QMutexLocker k(&p.lock);
+    p.clear();
+}
+
+void
+MemoryPool::getStats(MemoryPoolStats* stats)
+{
+    MemoryPoolPrivate& p = pool();
+    QMutexLocker k(&p.lock);
+    *stats = p.stats;
+}
+
+} // namespace Natron
@@ -0,0 +1,97 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_MEMORYPOOL_H_
+#define NATRON_ENGINE_MEMORYPOOL_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <cstddef>
+
+#include "Global/GlobalDefines.h"
+
+///Alignment in bytes of all the blocks returned by the MemoryPool (a cache line, and enough for any SIMD register)
+#define NATRON_MEMORY_POOL_ALIGNMENT 64
+
+///Default maximum amount of memory kept in the pool by released blocks, waiting to be recycled
+#define NATRON_MEMORY_POOL_DEFAULT_MAX_POOLED_SIZE (512ULL * 1024ULL * 1024ULL)
+
+namespace Natron {
+
+struct MemoryPoolStats
+{
+    U64 nAllocations; //< total number of calls to allocate()
+    U64 nRecycledAllocations; //< allocations that were served by a block previously released to the pool
+    U64 nReleases; //< total number of calls to release()
+    U64 nSystemFrees; //< released blocks that were given back to the system because the pool was full
+    std::size_t bytesInUse; //< bytes currently handed out to callers (size classes, not requested sizes)
+    std::size_t bytesPooled; //< bytes currently held by the pool, waiting to be recycled
+    std::size_t maxPooledBytes;
+
+    MemoryPoolStats()
+    : nAllocations(0)
+    , nRecycledAllocations(0)
+    , nReleases(0)
+    , nSystemFrees(0)
+    , bytesInUse(0)
+    , bytesPooled(0)
+    , maxPooledBytes(0)
+    {
+    }
+};
+
+/**
+ * @brief A process-wide size-class pool of uninitialized, NATRON_MEMORY_POOL_ALIGNMENT-bytes aligned memory blocks.
+ * Requested sizes are rounded up to a size class (4 classes per power of 2, so at most 25% of the block is unused)
+ * and released blocks are kept in a free-list per size class, so that once a graph reached its steady state
+ * (e.g: during playback) the images of a frame re-use the blocks released by the previous frames instead of going
+ * through the system allocator.
+ *
+ * Unlike std::vector::resize, the memory returned is NOT zero-initialized.
+ *
+ * Thread-safety: all functions are MT-safe.
+ **/
+class MemoryPool
+{
+public:
+
+    /**
+     * @brief Returns a block of at least nBytes bytes. The block must be released with release() passing the same nBytes.
+     * Returns NULL if nBytes is 0.
+     * WARNING: This function throws a std::bad_alloc if the allocation fails.
+     **/
+    static void* allocate(std::size_t nBytes);
+
+    /**
+     * @brief Gives back a block previously returned by allocate(nBytes) to the pool. If the pool already holds more
+     * than its maximum pooled size, the block is freed right away.
+     **/
+    static void release(void* ptr, std::size_t nBytes);
+
+    /**
+     * @brief Returns the size in bytes of the block that allocate(nBytes) would return.
+     **/
+    static std::size_t getSizeClass(std::size_t nBytes);
+
+    /**
+     * @brief Set the maximum amount of memory that the pool keeps for recycling. Released blocks
+     * in excess are freed.
+     **/
+    static void setMaximumPooledSize(std::size_t nBytes);
+
+    /**
+     * @brief Frees all the blocks currently held by the pool. Blocks in use are not affected.
+     **/
+    static void clear();
+
+    static void getStats(MemoryPoolStats* stats);
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_MEMORYPOOL_H_
@@ -0,0 +1,1287 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "NativeExpression.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+///Python ints are unbounded: integer results are only exact in a double up to 2^53, beyond that let Python compute them
+#define NATRON_NATIVE_EXPRESSION_MAX_EXACT_INT 9007199254740992.
+
+#define NATRON_NATIVE_EXPRESSION_PI 3.141592653589793238462643383279502884
+#define NATRON_NATIVE_EXPRESSION_E 2.718281828459045235360287471352662498
+
+using namespace Natron;
+
+namespace {
+
+enum OpEnum
+{
+    eOpConst = 0,
+    eOpFrame,
+    eOpDimension,
+    eOpParam, //< index: the param, arg: the dimension or -1 to pop it from the stack
+    eOpParamAtTime, //< same as eOpParam, the time is popped from the stack
+    eOpNeg,
+    eOpPos,
+    eOpNot,
+    eOpAdd,
+    eOpSub,
+    eOpMul,
+    eOpDiv,
+    eOpFloorDiv,
+    eOpMod,
+    eOpPow,
+    eOpLess,
+    eOpLessEqual,
+    eOpGreater,
+    eOpGreaterEqual,
+    eOpEqual,
+    eOpNotEqual,
+    eOpJump, //< arg: offset to the next instruction to execute, relative to this one
+    eOpJumpIfFalse, //< pops the condition
+    eOpJumpIfFalseOrPop, //< keeps the value if jumping, used by "and"
+    eOpJumpIfTrueOrPop, //< keeps the value if jumping, used by "or"
+    eOpCall //< index: the function, arg: the number of arguments
+};
+
+enum FunctionEnum
+{
+    eFunctionAbs = 0,
+    eFunctionMin,
+    eFunctionMax,
+    eFunctionInt,
+    eFunctionFloat,
+    eFunctionRound,
+    eFunctionPow,
+    eFunctionMathSin,
+    eFunctionMathCos,
+    eFunctionMathTan,
+    eFunctionMathAsin,
+    eFunctionMathAcos,
+    eFunctionMathAtan,
+    eFunctionMathAtan2,
+    eFunctionMathSinh,
+    eFunctionMathCosh,
+    eFunctionMathTanh,
+    eFunctionMathSqrt,
+    eFunctionMathExp,
+    eFunctionMathLog,
+    eFunctionMathLog10,
+    eFunctionMathPow,
+    eFunctionMathFabs,
+    eFunctionMathFloor,
+    eFunctionMathCeil,
+    eFunctionMathTrunc,
+    eFunctionMathFmod,
+    eFunctionMathHypot,
+    eFunctionMathDegrees,
+    eFunctionMathRadians
+};
+
+struct FunctionDesc
+{
+    const char* name;
+    FunctionEnum function;
+    int minArgs;
+    int maxArgs; //< -1 for unlimited
+};
+
+const FunctionDesc builtinFunctions[] = {
+    { "abs", eFunctionAbs, 1, 1 },
+    { "min", eFunctionMin, 2, -1 },
+    { "max", eFunctionMax, 2, -1 },
+    { "int", eFunctionInt, 1, 1 },
+    { "float", eFunctionFloat, 1, 1 },
+    { "round", eFunctionRound, 1, 1 },
+    { "pow", eFunctionPow, 2, 2 },
+    { 0, eFunctionAbs, 0, 0 }
+};
+
+const FunctionDesc mathFunctions[] = {
+    { "sin", eFunctionMathSin, 1, 1 },
+    { "cos", eFunctionMathCos, 1, 1 },
+    { "tan", eFunctionMathTan, 1, 1 },
+    { "asin", eFunctionMathAsin, 1, 1 },
+    { "acos", eFunctionMathAcos, 1, 1 },
+    { "atan", eFunctionMathAtan, 1, 1 },
+    { "atan2", eFunctionMathAtan2, 2, 2 },
+    { "sinh", eFunctionMathSinh, 1, 1 },
+    { "cosh", eFunctionMathCosh, 1, 1 },
+    { "tanh", eFunctionMathTanh, 1, 1 },
+    { "sqrt", eFunctionMathSqrt, 1, 1 },
+    { "exp", eFunctionMathExp, 1, 1 },
+    { "log", eFunctionMathLog, 1, 2 },
+    { "log10", eFunctionMathLog10, 1, 1 },
+    { "pow", eFunctionMathPow, 2, 2 },
+    { "fabs", eFunctionMathFabs, 1, 1 },
+    { "floor", eFunctionMathFloor, 1, 1 },
+    { "ceil", eFunctionMathCeil, 1, 1 },
+    { "trunc", eFunctionMathTrunc, 1, 1 },
+    { "fmod", eFunctionMathFmod, 2, 2 },
+    { "hypot", eFunctionMathHypot, 2, 2 },
+    { "degrees", eFunctionMathDegrees, 1, 1 },
+    { "radians", eFunctionMathRadians, 1, 1 },
+    { 0, eFunctionAbs, 0, 0 }
+};
+
+const FunctionDesc*
+findFunction(const FunctionDesc* table,const std::string& name)
+{
+    for (const FunctionDesc* it = table; it->name; ++it) {
+        if (name == it->name) {
+            return it;
+        }
+    }
+    return 0;
+}
+
+struct Instruction
+{
+    OpEnum op;
+    ExpressionValue constant;
+    int index;
+    int arg;
+
+    Instruction(OpEnum op_,int index_ = 0,int arg_ = 0)
+    : op(op_)
+    , constant()
+    , index(index_)
+    , arg(arg_)
+    {
+    }
+};
+
+//////////////////////////////////////////////////////////////////////
+///////////////////////////////// Tokenizer
+//////////////////////////////////////////////////////////////////////
+
+enum TokenTypeEnum
+{
+    eTokenEnd = 0,
+    eTokenNumber,
+    eTokenName,
+    eTokenOperator
+};
+
+struct Token
+{
+    TokenTypeEnum type;
+    std::string text;
+    ExpressionValue number;
+};
+
+bool
+isNameStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool
+isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool
+tokenize(const std::string& expression,std::vector<Token>* tokens,std::string* error)
+{
+    static const char* operators[] = { "**", "//", "<=", ">=", "==", "!=",
+                                       "+", "-", "*", "/", "%", "<", ">", "(", ")", ",", ".", 0 };
+    std::size_t i = 0;
+    const std::size_t n = expression.size();
+    while (i < n) {
+        char c = expression[i];
+        if (c == ' ' || c == '\t') {
+            ++i;
+            continue;
+        }
+        Token tok;
+        if ( isDigit(c) || ( c == '.' && i + 1 < n && isDigit(expression[i + 1]) ) ) {
+            std::size_t start = i;
+            bool isFloat = false;
+            while ( i < n && isDigit(expression[i]) ) {
+                ++i;
+            }
+            if (i < n && expression[i] == '.') {
+                isFloat = true;
+                ++i;
+                while ( i < n && isDigit(expression[i]) ) {
+                    ++i;
+                }
+            }
+            if ( i < n && (expression[i] == 'e' || expression[i] == 'E') ) {
+                ++i;
+                if ( i < n && (expression[i] == '+' || expression[i] == '-') ) {
+                    ++i;
+                }
+                if ( i >= n || !isDigit(expression[i]) ) {
+                    *error = "invalid number: " + expression.substr(start, i - start);
+                    return false;
+                }
+                isFloat = true;
+                while ( i < n && isDigit(expression[i]) ) {
+                    ++i;
+                }
+            }
+            if ( i < n && ( isNameStart(expression[i]) || isDigit(expression[i]) ) ) {
+                ///Hexadecimal, complex numbers, etc... are left to Python
+                *error = "unsupported number: " + expression.substr(start, i - start + 1);
+                return false;
+            }
+            tok.type = eTokenNumber;
+            tok.text = expression.substr(start, i - start);
+            if (!isFloat) {
+                ///Python 3 does not allow leading zeros in integers
+                if ( tok.text.size() > 1 && tok.text[0] == '0' && tok.text.find_first_not_of('0') != std::string::npos ) {
+                    *error = "invalid integer: " + tok.text;
+                    return false;
+                }
+                tok.number.value = std::strtod(tok.text.c_str(), 0);
+                tok.number.type = ExpressionValue::eTypeInt;
+                if (tok.number.value > NATRON_NATIVE_EXPRESSION_MAX_EXACT_INT) {
+                    *error = "integer too large: " + tok.text;
+                    return false;
+                }
+            } else {
+                tok.number.value = std::strtod(tok.text.c_str(), 0);
+                tok.number.type = ExpressionValue::eTypeFloat;
+            }
+        } else if ( isNameStart(c) ) {
+            std::size_t start = i;
+            while ( i < n && ( isNameStart(expression[i]) || isDigit(expression[i]) ) ) {
+                ++i;
+            }
+            tok.type = eTokenName;
+            tok.text = expression.substr(start, i - start);
+        } else {
+            const char** op = operators;
+            for (; *op; ++op) {
+                std::size_t len = std::strlen(*op);
+                if (expression.compare(i, len, *op) == 0) {
+                    break;
+                }
+            }
+            if (!*op) {
+                *error = std::string("unsupported character: ") + c;
+                return false;
+            }
+            tok.type = eTokenOperator;
+            tok.text = *op;
+            i += tok.text.size();
+        }
+        tokens->push_back(tok);
+    }
+    Token end;
+    end.type = eTokenEnd;
+    tokens->push_back(end);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+///////////////////////////////// Compiler
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Recursive descent parser following the grammar of Python expressions, emitting the program as it goes.
+ **/
+class Compiler
+{
+public:
+
+    Compiler(const std::vector<Token>& tokens,
+             const NativeExpressionResolver* resolver,
+             std::vector<Instruction>* code,
+             std::vector<boost::shared_ptr<NativeExpressionParam> >* params)
+    : _tokens(tokens)
+    , _pos(0)
+    , _resolver(resolver)
+    , _code(code)
+    , _params(params)
+    , _error()
+    {
+    }
+
+    bool compile(std::string* error)
+    {
+        bool ok = parseTest() && expectEnd();
+        if ( ok && (int)_code->size() > NATRON_NATIVE_EXPRESSION_MAX_INSTRUCTIONS ) {
+            _error = "expression too long";
+            ok = false;
+        }
+        if (!ok) {
+            *error = _error;
+        }
+        return ok;
+    }
+
+private:
+
+    const Token& peek() const
+    {
+        return _tokens[_pos];
+    }
+
+    bool isOperator(const char* op) const
+    {
+        return peek().type == eTokenOperator && peek().text == op;
+    }
+
+    bool isName(const char* name) const
+    {
+        return peek().type == eTokenName && peek().text == name;
+    }
+
+    bool fail(const std::string& error)
+    {
+        if ( _error.empty() ) {
+            _error = error;
+        }
+        return false;
+    }
+
+    bool expectOperator(const char* op)
+    {
+        if ( !isOperator(op) ) {
+            return fail(std::string("expected ") + op);
+        }
+        ++_pos;
+        return true;
+    }
+
+    bool expectName(std::string* name)
+    {
+        if (peek().type != eTokenName) {
+            return fail("expected a name");
+        }
+        *name = peek().text;
+        ++_pos;
+        return true;
+    }
+
+    bool expectEnd()
+    {
+        if (peek().type != eTokenEnd) {
+            return fail("unsupported syntax near " + peek().text);
+        }
+        return true;
+    }
+
+    void emit(const Instruction& ins)
+    {
+        _code->push_back(ins);
+    }
+
+    void emitConst(const ExpressionValue& v)
+    {
+        Instruction ins(eOpConst);
+        ins.constant = v;
+        emit(ins);
+    }
+
+    int emitJump(OpEnum op)
+    {
+        emit( Instruction(op) );
+        return (int)_code->size() - 1;
+    }
+
+    ///Makes the jump at index land on the next emitted instruction
+    void patchJump(int index)
+    {
+        (*_code)[index].arg = (int)_code->size() - index;
+    }
+
+    // test: or_test ['if' or_test 'else' test]
+    bool parseTest()
+    {
+        std::size_t valueStart = _code->size();
+        if ( !parseOrTest() ) {
+            return false;
+        }
+        if ( !isName("if") ) {
+            return true;
+        }
+        ++_pos;
+
+        ///The condition is evaluated first: move the code of the value after it. Jumps are relative so it can be moved as is.
+        std::vector<Instruction> valueCode(_code->begin() + valueStart, _code->end());
+        _code->erase(_code->begin() + valueStart, _code->end());
+        if ( !parseOrTest() ) {
+            return false;
+        }
+        int jumpToElse = emitJump(eOpJumpIfFalse);
+        _code->insert( _code->end(), valueCode.begin(), valueCode.end() );
+        int jumpToEnd = emitJump(eOpJump);
+        patchJump(jumpToElse);
+        if ( !isName("else") ) {
+            return fail("expected else");
+        }
+        ++_pos;
+        if ( !parseTest() ) {
+            return false;
+        }
+        patchJump(jumpToEnd);
+        return true;
+    }
+
+    // or_test: and_test ('or' and_test)*
+    bool parseOrTest()
+    {
+        if ( !parseAndTest() ) {
+            return false;
+        }
+        while ( isName("or") ) {
+            ++_pos;
+            int jump = emitJump(eOpJumpIfTrueOrPop);
+            if ( !parseAndTest() ) {
+                return false;
+            }
+            patchJump(jump);
+        }
+        return true;
+    }
+
+    // and_test: not_test ('and' not_test)*
+    bool parseAndTest()
+    {
+        if ( !parseNotTest() ) {
+            return false;
+        }
+        while ( isName("and") ) {
+            ++_pos;
+            int jump = emitJump(eOpJumpIfFalseOrPop);
+            if ( !parseNotTest() ) {
+                return false;
+            }
+            patchJump(jump);
+        }
+        return true;
+    }
+
+    // not_test: 'not' not_test | comparison
+    bool parseNotTest()
+    {
+        if ( isName("not") ) {
+            ++_pos;
+            if ( !parseNotTest() ) {
+                return false;
+            }
+            emit( Instruction(eOpNot) );
+            return true;
+        }
+        return parseComparison();
+    }
+
+    bool peekComparison(OpEnum* op) const
+    {
+        static const struct { const char* text; OpEnum op; } comparisons[] = {
+            { "<", eOpLess }, { "<=", eOpLessEqual }, { ">", eOpGreater }, { ">=", eOpGreaterEqual },
+            { "==", eOpEqual }, { "!=", eOpNotEqual }, { 0, eOpEqual }
+        };
+        for (int i = 0; comparisons[i].text; ++i) {
+            if ( isOperator(comparisons[i].text) ) {
+                *op = comparisons[i].op;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // comparison: arith (comp_op arith)?   Chained comparisons are left to Python.
+    bool parseComparison()
+    {
+        if ( !parseArith() ) {
+            return false;
+        }
+        OpEnum op;
+        if ( peekComparison(&op) ) {
+            ++_pos;
+            if ( !parseArith() ) {
+                return false;
+            }
+            emit( Instruction(op) );
+            if ( peekComparison(&op) ) {
+                return fail("chained comparisons are not supported");
+            }
+        }
+        return true;
+    }
+
+    // arith: term (('+'|'-') term)*
+    bool parseArith()
+    {
+        if ( !parseTerm() ) {
+            return false;
+        }
+        for (;;) {
+            OpEnum op;
+            if ( isOperator("+") ) {
+                op = eOpAdd;
+            } else if ( isOperator("-") ) {
+                op = eOpSub;
+            } else {
+                return true;
+            }
+            ++_pos;
+            if ( !parseTerm() ) {
+                return false;
+            }
+            emit( Instruction(op) );
+        }
+    }
+
+    // term: factor (('*'|'/'|'//'|'%') factor)*
+    bool parseTerm()
+    {
+        if ( !parseFactor() ) {
+            return false;
+        }
+        for (;;) {
+            OpEnum op;
+            if ( isOperator("*") ) {
+                op = eOpMul;
+            } else if ( isOperator("/") ) {
+                op = eOpDiv;
+            } else if ( isOperator("//") ) {
+                op = eOpFloorDiv;
+            } else if ( isOperator("%") ) {
+                op = eOpMod;
+            } else {
+                return true;
+            }
+            ++_pos;
+            if ( !parseFactor() ) {
+                return false;
+            }
+            emit( Instruction(op) );
+        }
+    }
+
+    // factor: ('+'|'-') factor | power
+    bool parseFactor()
+    {
+        if ( isOperator("-") || isOperator("+") ) {
+            OpEnum op = isOperator("-") ? eOpNeg : eOpPos;
+            ++_pos;
+            if ( !parseFactor() ) {
+                return false;
+            }
+            emit( Instruction(op) );
+            return true;
+        }
+        return parsePower();
+    }
+
+    // power: atom ['**' factor]
+    bool parsePower()
+    {
+        if ( !parseAtom() ) {
+            return false;
+        }
+        if ( isOperator("**") ) {
+            ++_pos;
+            if ( !parseFactor() ) {
+                return false;
+            }
+            emit( Instruction(eOpPow) );
+        }
+        return true;
+    }
+
+    ///Parses "(arg, arg, ...)" and returns the number of arguments. Keyword arguments are not supported.
+    bool parseArguments(int* nArgs)
+    {
+        if ( !expectOperator("(") ) {
+            return false;
+        }
+        *nArgs = 0;
+        if ( isOperator(")") ) {
+            ++_pos;
+            return true;
+        }
+        for (;;) {
+            if ( !parseTest() ) {
+                return false;
+            }
+            ++*nArgs;
+            if ( isOperator(",") ) {
+                ++_pos;
+                continue;
+            }
+            return expectOperator(")");
+        }
+    }
+
+    bool parseCall(const FunctionDesc* function)
+    {
+        int nArgs;
+        if ( !parseArguments(&nArgs) ) {
+            return false;
+        }
+        if ( nArgs < function->minArgs || (function->maxArgs != -1 && nArgs > function->maxArgs) ) {
+            return fail(std::string("wrong number of arguments to ") + function->name);
+        }
+        emit( Instruction(eOpCall, (int)function->function, nArgs) );
+        return true;
+    }
+
+    ///Returns true if name would be hidden by a variable of the Python scope
+    bool isShadowed(const std::string& name)
+    {
+        if ( _resolver && _resolver->isNameInScope(name) ) {
+            fail(name + " is redefined in the scope of the expression");
+            return true;
+        }
+        return false;
+    }
+
+    ///If the last instruction is an integer constant, removes it and returns its value
+    bool popIntegerConstant(int* value)
+    {
+        if ( _code->empty() ) {
+            return false;
+        }
+        const Instruction& last = _code->back();
+        if (last.op != eOpConst || last.constant.type == ExpressionValue::eTypeFloat) {
+            return false;
+        }
+        *value = (int)last.constant.value;
+        _code->pop_back();
+        return true;
+    }
+
+    bool parseParam(const std::string& nodeName)
+    {
+        std::string paramName,method;
+        if ( !expectOperator(".") || !expectName(&paramName) ) {
+            return false;
+        }
+        boost::shared_ptr<NativeExpressionParam> param;
+        if (_resolver) {
+            param = _resolver->resolveParam(nodeName, paramName);
+        }
+        if (!param) {
+            return fail(nodeName + "." + paramName + " cannot be read natively");
+        }
+        if ( !expectOperator(".") || !expectName(&method) ) {
+            return false;
+        }
+        _params->push_back(param);
+        int paramIndex = (int)_params->size() - 1;
+
+        int nArgs;
+        if ( !parseArguments(&nArgs) ) {
+            return false;
+        }
+
+        if (method == "get") {
+            if (nArgs > 1) {
+                return fail("wrong number of arguments to get");
+            }
+            int dimension = 0;
+            if (param->getDimension() > 1) {
+                ///get() returns a tuple for multi-dimensional parameters
+                std::string member;
+                if ( !expectOperator(".") || !expectName(&member) ) {
+                    return false;
+                }
+                static const char* xyz[] = { "x", "y", "z", 0 };
+                static const char* rgba[] = { "r", "g", "b", "a", 0 };
+                const char** members = param->isColor() ? rgba : xyz;
+                dimension = -1;
+                for (int i = 0; members[i]; ++i) {
+                    if (member == members[i]) {
+                        dimension = i;
+                    }
+                }
+                if ( param->isColor() && dimension == 3 && param->getDimension() == 3 ) {
+                    if (nArgs != 0) {
+                        return fail("unsupported color member");
+                    }
+                    ///ColorTuple.a is always 1 for RGB parameters
+                    emitConst( ExpressionValue(1., ExpressionValue::eTypeFloat) );
+                    return true;
+                }
+                if ( dimension < 0 || dimension >= param->getDimension() ) {
+                    return fail("unknown member " + member);
+                }
+            }
+            emit( Instruction(nArgs == 0 ? eOpParam : eOpParamAtTime, paramIndex, dimension) );
+        } else if (method == "getValue") {
+            if (nArgs > 1) {
+                return fail("wrong number of arguments to getValue");
+            }
+            int dimension = 0;
+            if ( nArgs == 1 && !popIntegerConstant(&dimension) ) {
+                dimension = -1;
+            }
+            emit( Instruction(eOpParam, paramIndex, dimension) );
+        } else if (method == "getValueAtTime") {
+            if (nArgs < 1 || nArgs > 2) {
+                return fail("wrong number of arguments to getValueAtTime");
+            }
+            int dimension = 0;
+            if ( nArgs == 2 && !popIntegerConstant(&dimension) ) {
+                dimension = -1;
+            }
+            emit( Instruction(eOpParamAtTime, paramIndex, dimension) );
+        } else {
+            return fail("unsupported method " + method);
+        }
+        return true;
+    }
+
+    // atom: NUMBER | NAME ... | '(' test ')'
+    bool parseAtom()
+    {
+        const Token& tok = peek();
+        if (tok.type == eTokenNumber) {
+            ++_pos;
+            emitConst(tok.number);
+        } else if ( isOperator("(") ) {
+            ++_pos;
+            if ( !parseTest() || !expectOperator(")") ) {
+                return false;
+            }
+        } else if (tok.type == eTokenName) {
+            std::string name = tok.text;
+            ++_pos;
+            if (name == "True" || name == "False") {
+                emitConst( ExpressionValue(name == "True" ? 1. : 0., ExpressionValue::eTypeBool) );
+            } else if (name == "frame" || name == "dimension") {
+                if ( isShadowed(name) ) {
+                    return false;
+                }
+                emit( Instruction(name == "frame" ? eOpFrame : eOpDimension) );
+            } else if (name == "math") {
+                std::string member;
+                if ( isShadowed(name) || !expectOperator(".") || !expectName(&member) ) {
+                    return false;
+                }
+                if (member == "pi") {
+                    emitConst( ExpressionValue(NATRON_NATIVE_EXPRESSION_PI, ExpressionValue::eTypeFloat) );
+                } else if (member == "e") {
+                    emitConst( ExpressionValue(NATRON_NATIVE_EXPRESSION_E, ExpressionValue::eTypeFloat) );
+                } else {
+                    const FunctionDesc* function = findFunction(mathFunctions, member);
+                    if (!function) {
+                        return fail("unsupported function math." + member);
+                    }
+                    if ( !parseCall(function) ) {
+                        return false;
+                    }
+                }
+            } else if ( const FunctionDesc* function = findFunction(builtinFunctions, name) ) {
+                if ( isShadowed(name) || !parseCall(function) ) {
+                    return false;
+                }
+            } else if ( name == "thisParam" || !isOperator(".") ) {
+                ///Reading the parameter from its own expression is left to Python which handles the recursion
+                return fail("unsupported name " + name);
+            } else if ( !parseParam(name) ) {
+                return false;
+            }
+        } else {
+            return fail("unsupported syntax near " + tok.text);
+        }
+
+        ///Subscripts, attributes and calls on the result are left to Python
+        if ( isOperator("(") || isOperator(".") ) {
+            return fail("unsupported syntax near " + peek().text);
+        }
+        return true;
+    }
+
+    const std::vector<Token>& _tokens;
+    std::size_t _pos;
+    const NativeExpressionResolver* _resolver;
+    std::vector<Instruction>* _code;
+    std::vector<boost::shared_ptr<NativeExpressionParam> >* _params;
+    std::string _error;
+};
+
+//////////////////////////////////////////////////////////////////////
+///////////////////////////////// Evaluation
+//////////////////////////////////////////////////////////////////////
+
+///The evaluation stack holds plain structs: ExpressionValue has a constructor which would be run for every
+///slot of the stack at each evaluation
+struct StackSlot
+{
+    double value;
+    ExpressionValue::TypeEnum type;
+};
+
+inline ExpressionValue
+load(const StackSlot& s)
+{
+    return ExpressionValue(s.value, s.type);
+}
+
+inline void
+store(const ExpressionValue& v,StackSlot* s)
+{
+    s->value = v.value;
+    s->type = v.type;
+}
+
+inline bool
+isTrue(const StackSlot& v)
+{
+    return v.value != 0.;
+}
+
+inline bool
+isFinite(double v)
+{
+    return v == v && v - v == 0.;
+}
+
+inline bool
+isNaN(double v)
+{
+    return v != v;
+}
+
+inline ExpressionValue
+makeFloat(double v)
+{
+    return ExpressionValue(v, ExpressionValue::eTypeFloat);
+}
+
+///Integers that cannot be represented exactly make the evaluation fail
+inline bool
+makeInt(double v,ExpressionValue* ret)
+{
+    if (std::fabs(v) > NATRON_NATIVE_EXPRESSION_MAX_EXACT_INT) {
+        return false;
+    }
+    *ret = ExpressionValue(v, ExpressionValue::eTypeInt);
+    return true;
+}
+
+inline bool
+makeNumber(bool isInt,double v,ExpressionValue* ret)
+{
+    if (isInt) {
+        return makeInt(v, ret);
+    }
+    *ret = makeFloat(v);
+    return true;
+}
+
+inline bool
+bothIntegers(const ExpressionValue& a,const ExpressionValue& b)
+{
+    return a.type != ExpressionValue::eTypeFloat && b.type != ExpressionValue::eTypeFloat;
+}
+
+///Same as float_divmod in CPython's floatobject.c: the modulo has the sign of the divisor
+///and the quotient is rounded towards negative infinity.
+void
+pythonDivMod(double vx,double wx,double* floorDiv,double* modulo)
+{
+    double mod = std::fmod(vx, wx);
+    double div = (vx - mod) / wx;
+    if (mod) {
+        if ( (wx < 0) != (mod < 0) ) {
+            mod += wx;
+            div -= 1.0;
+        }
+    } else {
+        mod = wx < 0 ? -0.0 : 0.0;
+    }
+    double floordiv;
+    if (div) {
+        floordiv = std::floor(div);
+        if (div - floordiv > 0.5) {
+            floordiv += 1.0;
+        }
+    } else {
+        floordiv = (vx / wx) < 0 ? -0.0 : 0.0;
+    }
+    *floorDiv = floordiv;
+    *modulo = mod;
+}
+
+bool
+evaluatePow(const ExpressionValue& a,const ExpressionValue& b,ExpressionValue* ret)
+{
+    if ( bothIntegers(a, b) && b.value >= 0 ) {
+        return makeInt(std::pow(a.value, b.value), ret);
+    }
+    if (a.value == 0. && b.value < 0) {
+        ///ZeroDivisionError
+        return false;
+    }
+    if ( a.value < 0 && isFinite(b.value) && std::floor(b.value) != b.value ) {
+        ///Python returns a complex number
+        return false;
+    }
+    double r = std::pow(a.value, b.value);
+    if ( !isFinite(r) && isFinite(a.value) && isFinite(b.value) ) {
+        ///OverflowError
+        return false;
+    }
+    *ret = makeFloat(r);
+    return true;
+}
+
+///Rounds half to even like Python 3's round()
+double
+roundHalfEven(double x)
+{
+    double f = std::floor(x);
+    double diff = x - f;
+    if (diff > 0.5) {
+        return f + 1.;
+    } else if (diff < 0.5) {
+        return f;
+    } else {
+        return std::fmod(f, 2.) == 0. ? f : f + 1.;
+    }
+}
+
+bool
+callMathFunction(FunctionEnum function,const StackSlot* args,int nArgs,ExpressionValue* ret)
+{
+    double x = args[0].value;
+    double y = nArgs > 1 ? args[1].value : 0.;
+    double r;
+    switch (function) {
+    case eFunctionMathSin: r = std::sin(x); break;
+    case eFunctionMathCos: r = std::cos(x); break;
+    case eFunctionMathTan: r = std::tan(x); break;
+    case eFunctionMathAsin: r = std::asin(x); break;
+    case eFunctionMathAcos: r = std::acos(x); break;
+    case eFunctionMathAtan: r = std::atan(x); break;
+    case eFunctionMathAtan2: r = std::atan2(x, y); break;
+    case eFunctionMathSinh: r = std::sinh(x); break;
+    case eFunctionMathCosh: r = std::cosh(x); break;
+    case eFunctionMathTanh: r = std::tanh(x); break;
+    case eFunctionMathSqrt: r = std::sqrt(x); break;
+    case eFunctionMathExp: r = std::exp(x); break;
+    case eFunctionMathLog:
+        r = std::log(x);
+        if (nArgs > 1) {
+            double den = std::log(y);
+            if (den == 0.) {
+                ///ZeroDivisionError
+                return false;
+            }
+            r /= den;
+        }
+        break;
+    case eFunctionMathLog10: r = std::log10(x); break;
+    case eFunctionMathPow: r = std::pow(x, y); break;
+    case eFunctionMathFabs: r = std::fabs(x); break;
+    case eFunctionMathFmod: r = std::fmod(x, y); break;
+    case eFunctionMathHypot: r = ::hypot(x, y); break;
+    case eFunctionMathDegrees: r = x * (180. / NATRON_NATIVE_EXPRESSION_PI); break;
+    case eFunctionMathRadians: r = x * (NATRON_NATIVE_EXPRESSION_PI / 180.); break;
+    case eFunctionMathFloor:
+    case eFunctionMathCeil:
+    case eFunctionMathTrunc:
+        if (args[0].type != ExpressionValue::eTypeFloat) {
+            return makeInt(x, ret);
+        }
+        if ( !isFinite(x) ) {
+            return false;
+        }
+        r = function == eFunctionMathFloor ? std::floor(x) : (function == eFunctionMathCeil ? std::ceil(x) : (x < 0 ? std::ceil(x) : std::floor(x)));
+        return makeInt(r, ret);
+    default:
+        return false;
+    }
+
+    ///The math module raises ValueError/OverflowError where the C library returns NaN/infinity for finite arguments
+    bool argsFinite = isFinite(x) && (nArgs < 2 || isFinite(y));
+    bool argsNaN = isNaN(x) || (nArgs > 1 && isNaN(y));
+    if ( isNaN(r) && !argsNaN ) {
+        return false;
+    }
+    if ( !isFinite(r) && !isNaN(r) && argsFinite ) {
+        return false;
+    }
+    *ret = makeFloat(r);
+    return true;
+}
+
+bool
+callFunction(FunctionEnum function,const StackSlot* args,int nArgs,ExpressionValue* ret)
+{
+    switch (function) {
+    case eFunctionAbs:
+        if (args[0].type == ExpressionValue::eTypeFloat) {
+            *ret = makeFloat( std::fabs(args[0].value) );
+            return true;
+        }
+        return makeInt(std::fabs(args[0].value), ret);
+    case eFunctionMin:
+    case eFunctionMax: {
+        const StackSlot* best = &args[0];
+        for (int i = 1; i < nArgs; ++i) {
+            if ( function == eFunctionMin ? (args[i].value < best->value) : (args[i].value > best->value) ) {
+                best = &args[i];
+            }
+        }
+        *ret = load(*best);
+        return true;
+    }
+    case eFunctionInt: {
+        double x = args[0].value;
+        if ( !isFinite(x) ) {
+            return false;
+        }
+        return makeInt(x < 0 ? std::ceil(x) : std::floor(x), ret);
+    }
+    case eFunctionFloat:
+        *ret = makeFloat(args[0].value);
+        return true;
+    case eFunctionRound:
+        if ( !isFinite(args[0].value) ) {
+            return false;
+        }
+        return makeInt(args[0].type == ExpressionValue::eTypeFloat ? roundHalfEven(args[0].value) : args[0].value, ret);
+    case eFunctionPow:
+        return evaluatePow(load(args[0]), load(args[1]), ret);
+    default:
+        return callMathFunction(function, args, nArgs, ret);
+    }
+}
+
+bool
+evaluateBinary(OpEnum op,const ExpressionValue& a,const ExpressionValue& b,ExpressionValue* ret)
+{
+    bool isInt = bothIntegers(a, b);
+    switch (op) {
+    case eOpAdd:
+        return makeNumber(isInt, a.value + b.value, ret);
+    case eOpSub:
+        return makeNumber(isInt, a.value - b.value, ret);
+    case eOpMul:
+        return makeNumber(isInt, a.value * b.value, ret);
+    case eOpDiv:
+        if (b.value == 0.) {
+            return false;
+        }
+        *ret = makeFloat(a.value / b.value);
+        return true;
+    case eOpFloorDiv:
+    case eOpMod: {
+        if (b.value == 0.) {
+            return false;
+        }
+        double floorDiv,mod;
+        pythonDivMod(a.value, b.value, &floorDiv, &mod);
+        return makeNumber(isInt, op == eOpFloorDiv ? floorDiv : mod, ret);
+    }
+    case eOpPow:
+        return evaluatePow(a, b, ret);
+    case eOpLess:
+        *ret = ExpressionValue(a.value < b.value, ExpressionValue::eTypeBool);
+        return true;
+    case eOpLessEqual:
+        *ret = ExpressionValue(a.value <= b.value, ExpressionValue::eTypeBool);
+        return true;
+    case eOpGreater:
+        *ret = ExpressionValue(a.value > b.value, ExpressionValue::eTypeBool);
+        return true;
+    case eOpGreaterEqual:
+        *ret = ExpressionValue(a.value >= b.value, ExpressionValue::eTypeBool);
+        return true;
+    case eOpEqual:
+        *ret = ExpressionValue(a.value == b.value, ExpressionValue::eTypeBool);
+        return true;
+    case eOpNotEqual:
+        *ret = ExpressionValue(a.value != b.value, ExpressionValue::eTypeBool);
+        return true;
+    default:
+        return false;
+    }
+}
+
+///Python only accepts integers (or booleans) for times and dimensions
+inline bool
+toInteger(const StackSlot& v,int* ret)
+{
+    if (v.type == ExpressionValue::eTypeFloat) {
+        return false;
+    }
+    *ret = (int)v.value;
+    return true;
+}
+
+} // anon namespace
+
+struct Natron::NativeExpressionPrivate
+{
+    std::vector<Instruction> code;
+    std::vector<boost::shared_ptr<NativeExpressionParam> > params;
+
+    NativeExpressionPrivate()
+    : code()
+    , params()
+    {
+    }
+};
+
+NativeExpression::NativeExpression()
+: _imp( new NativeExpressionPrivate() )
+{
+}
+
+NativeExpression::~NativeExpression()
+{
+}
+
+boost::shared_ptr<NativeExpression>
+NativeExpression::compile(const std::string& expression,
+                          const NativeExpressionResolver* resolver,
+                          std::string* error)
+{
+    boost::shared_ptr<NativeExpression> ret;
+    std::vector<Token> tokens;
+    if ( !tokenize(expression, &tokens, error) ) {
+        return ret;
+    }
+    boost::shared_ptr<NativeExpression> expr( new NativeExpression() );
+    Compiler compiler(tokens, resolver, &expr->_imp->code, &expr->_imp->params);
+    if ( !compiler.compile(error) ) {
+        return ret;
+    }
+    ret = expr;
+    return ret;
+}
+
+const std::vector<boost::shared_ptr<NativeExpressionParam> >&
+NativeExpression::getParams() const
+{
+    return _imp->params;
+}
+
+bool
+NativeExpression::evaluate(double frame,int dimension,ExpressionValue* result) const
+{
+    ///Each instruction pushes at most one value
+    StackSlot stack[NATRON_NATIVE_EXPRESSION_MAX_INSTRUCTIONS];
+    int top = 0;
+
+    const Instruction* code = &_imp->code.front();
+    const int codeSize = (int)_imp->code.size();
+    int pc = 0;
+    while (pc < codeSize) {
+        const Instruction& ins = code[pc];
+        switch (ins.op) {
+        case eOpConst:
+            store(ins.constant, &stack[top++]);
+            break;
+        case eOpFrame:
+            stack[top].value = frame;
+            stack[top].type = std::floor(frame) == frame ? ExpressionValue::eTypeInt : ExpressionValue::eTypeFloat;
+            ++top;
+            break;
+        case eOpDimension:
+            stack[top].value = dimension;
+            stack[top].type = ExpressionValue::eTypeInt;
+            ++top;
+            break;
+        case eOpParam:
+        case eOpParamAtTime: {
+            int dim = ins.arg;
+            if ( dim == -1 && !toInteger(stack[--top], &dim) ) {
+                return false;
+            }
+            const NativeExpressionParam* param = _imp->params[ins.index].get();
+            if ( dim < 0 || dim >= param->getDimension() ) {
+                return false;
+            }
+            double value;
+            if (ins.op == eOpParam) {
+                if ( !param->getValue(dim, &value) ) {
+                    return false;
+                }
+            } else {
+                int time;
+                if ( !toInteger(stack[--top], &time) || !param->getValueAtTime(time, dim, &value) ) {
+                    return false;
+                }
+            }
+            stack[top].value = value;
+            stack[top].type = param->getType();
+            ++top;
+            break;
+        }
+        case eOpNeg:
+        case eOpPos: {
+            StackSlot& v = stack[top - 1];
+            if (v.type == ExpressionValue::eTypeBool) {
+                v.type = ExpressionValue::eTypeInt;
+            }
+            if (ins.op == eOpNeg) {
+                v.value = -v.value;
+            }
+            break;
+        }
+        case eOpNot:
+            stack[top - 1].value = isTrue(stack[top - 1]) ? 0. : 1.;
+            stack[top - 1].type = ExpressionValue::eTypeBool;
+            break;
+        case eOpJump:
+            pc += ins.arg;
+            continue;
+        case eOpJumpIfFalse:
+            if ( !isTrue(stack[--top]) ) {
+                pc += ins.arg;
+                continue;
+            }
+            break;
+        case eOpJumpIfFalseOrPop:
+            if ( !isTrue(stack[top - 1]) ) {
+                pc += ins.arg;
+                continue;
+            }
+            --top;
+            break;
+        case eOpJumpIfTrueOrPop:
+            if ( isTrue(stack[top - 1]) ) {
+                pc += ins.arg;
+                continue;
+            }
+            --top;
+            break;
+        case eOpCall: {
+            top -= ins.arg;
+            ExpressionValue ret;
+            if ( !callFunction( (FunctionEnum)ins.index, &stack[top], ins.arg, &ret ) ) {
+                return false;
+            }
+            store(ret, &stack[top++]);
+            break;
+        }
+        default: {
+            ExpressionValue ret;
+            if ( !evaluateBinary( ins.op, load(stack[top - 2]), load(stack[top - 1]), &ret ) ) {
+                return false;
+            }
+            --top;
+            store(ret, &stack[top - 1]);
+            break;
+        }
+        }
+        ++pc;
+    }
+    assert(top == 1);
+    *result = load(stack[0]);
+    return true;
+}
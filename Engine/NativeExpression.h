@@ -0,0 +1,149 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_NATIVEEXPRESSION_H_
+#define NATRON_ENGINE_NATIVEEXPRESSION_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+
+///Expressions compiling to more instructions than this are left to Python
+#define NATRON_NATIVE_EXPRESSION_MAX_INSTRUCTIONS 256
+
+/**
+ * @brief Natively compiled knob expressions.
+ *
+ * Single-line expressions using only the common subset of Python found in knob expressions (arithmetic, comparisons,
+ * boolean operators, conditional expressions, the math module, frame, dimension and the values of other parameters)
+ * are compiled to a small stack-based program which can be evaluated on any thread without taking the Python GIL.
+ * The evaluation follows the semantics of Python 3: int and float values are distinguished, / is a true division,
+ * // and % round towards negative infinity, etc. Whenever Python would raise an exception (division by zero, math domain
+ * error, overflow...) the evaluation fails and the caller is expected to run the expression through Python instead,
+ * so that errors are reported the usual way.
+ **/
+namespace Natron {
+
+struct ExpressionValue
+{
+    enum TypeEnum
+    {
+        eTypeBool = 0,
+        eTypeInt,
+        eTypeFloat
+    };
+
+    double value;
+    TypeEnum type;
+
+    ExpressionValue()
+    : value(0.)
+    , type(eTypeInt)
+    {
+    }
+
+    ExpressionValue(double value_,TypeEnum type_)
+    : value(value_)
+    , type(type_)
+    {
+    }
+};
+
+/**
+ * @brief A parameter whose value is read by a native expression. The getters are called from any thread while the
+ * expression is evaluated and must not require the Python GIL.
+ **/
+class NativeExpressionParam
+{
+public:
+
+    virtual ~NativeExpressionParam() {}
+
+    virtual int getDimension() const = 0;
+
+    /**
+     * @brief Whether get() returns a tuple with r,g,b,a members (color parameters) instead of x,y,z.
+     **/
+    virtual bool isColor() const = 0;
+
+    virtual ExpressionValue::TypeEnum getType() const = 0;
+
+    /**
+     * @brief Equivalent of param.getValue(dimension). Returns false if the value cannot be read.
+     **/
+    virtual bool getValue(int dimension,double* value) const = 0;
+
+    /**
+     * @brief Equivalent of param.getValueAtTime(time,dimension). Returns false if the value cannot be read.
+     **/
+    virtual bool getValueAtTime(int time,int dimension,double* value) const = 0;
+};
+
+/**
+ * @brief Resolves the names used by an expression when it is compiled.
+ **/
+class NativeExpressionResolver
+{
+public:
+
+    virtual ~NativeExpressionResolver() {}
+
+    /**
+     * @brief Returns the parameter designated by nodeName.paramName in the expression, where nodeName is either thisNode
+     * or the script-name of a node in the scope of the expression. Returns NULL if it cannot be read natively.
+     **/
+    virtual boost::shared_ptr<NativeExpressionParam> resolveParam(const std::string& nodeName,const std::string& paramName) const = 0;
+
+    /**
+     * @brief Returns true if name is declared in the scope of the Python expression, in which case it would hide
+     * the builtin function or variable with the same name.
+     **/
+    virtual bool isNameInScope(const std::string& name) const = 0;
+};
+
+struct NativeExpressionPrivate;
+class NativeExpression
+{
+public:
+
+    /**
+     * @brief Compiles the given single-line expression. Returns NULL and sets error if the expression uses anything outside of
+     * the supported subset, in which case it must be evaluated by Python.
+     **/
+    static boost::shared_ptr<NativeExpression> compile(const std::string& expression,
+                                                       const NativeExpressionResolver* resolver,
+                                                       std::string* error);
+
+    ~NativeExpression();
+
+    /**
+     * @brief Evaluates the expression with the given values for the frame and dimension variables.
+     * This is thread-safe, never locks and never allocates memory. Returns false if Python would have raised an
+     * exception, or if a parameter could not be read.
+     **/
+    bool evaluate(double frame,int dimension,ExpressionValue* result) const;
+
+    /**
+     * @brief The parameters read by the expression, in the order they appear.
+     **/
+    const std::vector<boost::shared_ptr<NativeExpressionParam> >& getParams() const;
+
+private:
+
+    NativeExpression();
+
+    boost::scoped_ptr<NativeExpressionPrivate> _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_NATIVEEXPRESSION_H_
@@ -35,6 +35,7 @@
 #include "Engine/TimeLine.h"
 #include "Engine/Lut.h"
 #include "Engine/Image.h"
+#include "Engine/ImageLocker.h"
 #include "Engine/Project.h"
 #include "Engine/EffectInstance.h"
 #include "Engine/Log.h"
@@ -147,8 +148,6 @@ struct Node::Implementation
     , afterFrameRender()
     , afterRender()
     , rotoContext()
-    , imagesBeingRenderedMutex()
-    , imageBeingRenderedCond()
     , imagesBeingRendered()
     , supportedDepths()
     , isMultiInstance(false)
@@ -295,9 +294,7 @@ struct Node::Implementation
     
     boost::shared_ptr<RotoContext> rotoContext; //< valid when the node has a rotoscoping context (i.e: paint context)
     
-    mutable QMutex imagesBeingRenderedMutex;
-    QWaitCondition imageBeingRenderedCond;
-    std::list< boost::shared_ptr<Image> > imagesBeingRendered; ///< a list of all the images being rendered simultaneously
+    ImageLockRegistry<Image> imagesBeingRendered; ///< the images being rendered simultaneously
     
     std::list <Natron::ImageBitDepthEnum> supportedDepths;
     
@@ -1469,6 +1466,12 @@ Node::setNameInternal(const std::string& name)
                         break;
                     }
                 }
+                
+                ///Native expressions resolved the node names when they were compiled
+                std::list<std::string> names;
+                names.push_back(fullOldName);
+                names.push_back(fullySpecifiedName);
+                getApp()->getProject()->refreshNativeExpressions(names);
             }
         } else { //if (!oldName.empty()) {
             declareNodeVariableToPython(fullySpecifiedName);
@@ -2885,6 +2888,7 @@ Node::deactivate(const std::list< Node* > & outputsToDisconnect,
         _imp->runOnNodeDeleteCB();
     }
     
+    getApp()->getProject()->refreshNativeExpressions( std::list<std::string>( 1, getFullyQualifiedName() ) );
 } // deactivate
 
 void
@@ -2968,6 +2972,8 @@ Node::activate(const std::list< Node* > & outputsToRestore,
     }
     Q_EMIT activated(triggerRender);
     
+    getApp()->getProject()->refreshNativeExpressions( std::list<std::string>( 1, getFullyQualifiedName() ) );
+    
     _imp->runOnNodeCreatedCB(true);
 } // activate
 
@@ -3858,48 +3864,25 @@ Node::isMaskEnabled(int inputNb) const
 void
 Node::lock(const boost::shared_ptr<Natron::Image> & image)
 {
-    
-    QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    std::list<boost::shared_ptr<Natron::Image> >::iterator it =
-    std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
-    
-    while ( it != _imp->imagesBeingRendered.end() ) {
-        _imp->imageBeingRenderedCond.wait(&_imp->imagesBeingRenderedMutex);
-        it = std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
-    }
-    ///Okay the image is not used by any other thread, claim that we want to use it
-    assert( it == _imp->imagesBeingRendered.end() );
-    _imp->imagesBeingRendered.push_back(image);
+    _imp->imagesBeingRendered.lock(image);
 }
 
 bool
 Node::tryLock(const boost::shared_ptr<Natron::Image> & image)
 {
-    
-    QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    std::list<boost::shared_ptr<Natron::Image> >::iterator it =
-    std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
-    
-    if ( it != _imp->imagesBeingRendered.end() ) {
-        return false;
-    }
-    ///Okay the image is not used by any other thread, claim that we want to use it
-    assert( it == _imp->imagesBeingRendered.end() );
-    _imp->imagesBeingRendered.push_back(image);
-    return true;
+    return _imp->imagesBeingRendered.tryLock(image);
 }
 
 void
 Node::unlock(const boost::shared_ptr<Natron::Image> & image)
 {
-    QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    std::list<boost::shared_ptr<Natron::Image> >::iterator it =
-    std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
-    ///The image must exist, otherwise this is a bug
-    assert( it != _imp->imagesBeingRendered.end() );
-    _imp->imagesBeingRendered.erase(it);
-    ///Notify all waiting threads that we're finished
-    _imp->imageBeingRenderedCond.wakeAll();
+    _imp->imagesBeingRendered.unlock(image);
+}
+
+U64
+Node::getImageLockContentionCount() const
+{
+    return _imp->imagesBeingRendered.getContentionCount();
 }
 
 boost::shared_ptr<Natron::Image>
@@ -3907,9 +3890,9 @@ Node::getImageBeingRendered(int time,
                             unsigned int mipMapLevel,
                             int view)
 {
-    QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    for (std::list<boost::shared_ptr<Natron::Image> >::iterator it = _imp->imagesBeingRendered.begin();
-         it != _imp->imagesBeingRendered.end(); ++it) {
+    std::list<boost::shared_ptr<Natron::Image> > images;
+    _imp->imagesBeingRendered.getLockedEntries(&images);
+    for (std::list<boost::shared_ptr<Natron::Image> >::iterator it = images.begin(); it != images.end(); ++it) {
         const Natron::ImageKey &key = (*it)->getKey();
         if ( (key._view == view) && ((*it)->getMipMapLevel() == mipMapLevel) && (key._time == time) ) {
             return *it;
@@ -4316,10 +4299,11 @@ Node::setParallelRenderArgs(int time,
                             bool canAbort,
                             U64 nodeHash,
                             bool canSetValue,
-                            const TimeLine* timeline)
+                            const TimeLine* timeline,
+                            const QAtomicInt* backgroundAbort)
 {
     std::list<Natron::Node*> marked;
-    setParallelRenderArgsInternal(time, view, isRenderUserInteraction, isSequential, nodeHash,canAbort, canSetValue, timeline, marked);
+    setParallelRenderArgsInternal(time, view, isRenderUserInteraction, isSequential, nodeHash,canAbort, canSetValue, timeline, backgroundAbort, marked);
 }
 
 void
@@ -4395,6 +4379,7 @@ Node::setParallelRenderArgsInternal(int time,
                                     bool canAbort,
                                     bool canSetValue,
                                     const TimeLine* timeline,
+                                    const QAtomicInt* backgroundAbort,
                                     std::list<Natron::Node*>& markedNodes)
 {
     ///If marked, we alredy set render args
@@ -4410,7 +4395,7 @@ Node::setParallelRenderArgsInternal(int time,
         rotoAge = 0;
     }
     
-    _imp->liveInstance->setParallelRenderArgs(time, view, isRenderUserInteraction, isSequential, canAbort, nodeHash, rotoAge,canSetValue, timeline);
+    _imp->liveInstance->setParallelRenderArgs(time, view, isRenderUserInteraction, isSequential, canAbort, nodeHash, rotoAge,canSetValue, timeline, backgroundAbort);
     
     
     ///Wait for the main-thread to be done dequeuing the connect actions queue
@@ -4445,7 +4430,7 @@ Node::setParallelRenderArgsInternal(int time,
     for (int i = 0; i < maxInpu; ++i) {
         boost::shared_ptr<Node> input = getInput(i);
         if (input) {
-            input->setParallelRenderArgsInternal(time, view, isRenderUserInteraction, isSequential, input->getHashValue(),canAbort, canSetValue,  timeline, markedNodes);
+            input->setParallelRenderArgsInternal(time, view, isRenderUserInteraction, isSequential, input->getHashValue(),canAbort, canSetValue,  timeline, backgroundAbort, markedNodes);
             
         }
     }
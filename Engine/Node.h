@@ -49,6 +49,7 @@ class KnobI;
 class ViewerInstance;
 class Format;
 class TimeLine;
+class QAtomicInt;
 class NodeSerialization;
 class KnobSerialization;
 class KnobHolder;
@@ -655,6 +656,11 @@ public:
     void lock(const boost::shared_ptr<Natron::Image>& entry);
     bool tryLock(const boost::shared_ptr<Natron::Image>& entry);
     void unlock(const boost::shared_ptr<Natron::Image>& entry);
+    
+    /**
+     * @brief Returns the number of times a thread had to wait for an image of this node to be rendered by another thread.
+     **/
+    U64 getImageLockContentionCount() const;
 
 
     /**
@@ -777,7 +783,8 @@ public:
                                bool canAbort,
                                U64 nodeHash,
                                bool canSetValue,
-                               const TimeLine* timeline);
+                               const TimeLine* timeline,
+                               const QAtomicInt* backgroundAbort = 0);
     
     void invalidateParallelRenderArgs();
     
@@ -990,6 +997,7 @@ private:
                                        bool canAbort,
                                        bool canSetValue,
                                        const TimeLine* timeline,
+                                       const QAtomicInt* backgroundAbort,
                                        std::list<Natron::Node*>& markedNodes);
     
 
@@ -1069,10 +1077,11 @@ public:
                              bool canAbort,
                              U64 nodeHash,
                              bool canSetValue,
-                             const TimeLine* timeline)
+                             const TimeLine* timeline,
+                             const QAtomicInt* backgroundAbort = 0)
     : node(n)
     {
-        node->setParallelRenderArgs(time,view,isRenderUserInteraction,isSequential,canAbort,nodeHash,canSetValue,timeline);
+        node->setParallelRenderArgs(time,view,isRenderUserInteraction,isSequential,canAbort,nodeHash,canSetValue,timeline,backgroundAbort);
     }
     
     ~ParallelRenderArgsSetter()
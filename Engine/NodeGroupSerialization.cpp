@@ -35,116 +35,137 @@ NodeCollectionSerialization::initialize(const NodeCollection& group)
     }
 }
 
+static QString
+getGroupLabel(const boost::shared_ptr<NodeCollection>& group)
+{
+    NodeGroup* isNodeGroup = dynamic_cast<NodeGroup*>(group.get());
+    if (isNodeGroup) {
+        return isNodeGroup->getNode()->getLabel().c_str();
+    } else {
+        return QObject::tr("top-level");
+    }
+}
+
 bool
 NodeCollectionSerialization::restoreFromSerialization(const std::list< boost::shared_ptr<NodeSerialization> > & serializedNodes,
                                                       const boost::shared_ptr<NodeCollection>& group,
                                                       bool* hasProjectAWriter)
 {
+    group->getApplication()->updateProjectLoadStatus(QObject::tr("Creating nodes in group: ") + getGroupLabel(group));
+    
+    ///If a parent of a multi-instance node doesn't exist anymore but the children do, we must recreate the parent.
+    ///Problem: we have lost the nodes connections. To do so we restore them using the serialization of a child.
+    ///This map contains all the parents that must be reconnected and the child serialization
+    ParentsToReconnectMap parentsToReconnect;
+    
+    bool ok = true;
+    for (std::list< boost::shared_ptr<NodeSerialization> >::const_iterator it = serializedNodes.begin(); it != serializedNodes.end(); ++it) {
+        if (!restoreNode(*it, serializedNodes, group, hasProjectAWriter, &parentsToReconnect)) {
+            ok = false;
+        }
+    }
     
+    if (!restoreLinks(serializedNodes, group, parentsToReconnect)) {
+        ok = false;
+    }
+    return ok;
+}
 
-    bool mustShowErrorsLog = false;
+bool
+NodeCollectionSerialization::restoreNode(const boost::shared_ptr<NodeSerialization>& serialization,
+                                         const std::list< boost::shared_ptr<NodeSerialization> > & serializedNodes,
+                                         const boost::shared_ptr<NodeCollection>& group,
+                                         bool* hasProjectAWriter,
+                                         ParentsToReconnectMap* parentsToReconnect)
+{
+    std::string pluginID = serialization->getPluginID();
     
-    NodeGroup* isNodeGroup = dynamic_cast<NodeGroup*>(group.get());
-    QString groupName;
-    if (isNodeGroup) {
-        groupName = isNodeGroup->getNode()->getLabel().c_str();
-    } else {
-        groupName = QObject::tr("top-level");
+    if ( appPTR->isBackground() && (pluginID == PLUGINID_NATRON_VIEWER || pluginID == "Viewer") ) {
+        //if the node is a viewer, don't try to load it in background mode
+        return true;
     }
-    group->getApplication()->updateProjectLoadStatus(QObject::tr("Creating nodes in group: ") + groupName);
     
-    ///If a parent of a multi-instance node doesn't exist anymore but the children do, we must recreate the parent.
-    ///Problem: we have lost the nodes connections. To do so we restore them using the serialization of a child.
-    ///This map contains all the parents that must be reconnected and an iterator to the child serialization
-    std::map<boost::shared_ptr<Natron::Node>, std::list<boost::shared_ptr<NodeSerialization> >::const_iterator > parentsToReconnect;
+    ///If the node is a multiinstance child find in all the serialized nodes if the parent exists.
+    ///If not, create it
     
-    int nodesRestored = 0;
-    for (std::list< boost::shared_ptr<NodeSerialization> >::const_iterator it = serializedNodes.begin(); it != serializedNodes.end(); ++it) {
-       
-        ++nodesRestored;
-        
-        std::string pluginID = (*it)->getPluginID();
+    if ( !serialization->getMultiInstanceParentName().empty() ) {
         
-        if ( appPTR->isBackground() && (pluginID == PLUGINID_NATRON_VIEWER || pluginID == "Viewer") ) {
-            //if the node is a viewer, don't try to load it in background mode
-            continue;
+        bool foundParent = false;
+        for (std::list< boost::shared_ptr<NodeSerialization> >::const_iterator it2 = serializedNodes.begin();
+             it2 != serializedNodes.end(); ++it2) {
+            
+            if ( (*it2)->getNodeScriptName() == serialization->getMultiInstanceParentName() ) {
+                foundParent = true;
+                break;
+            }
+            
         }
-        
-        ///If the node is a multiinstance child find in all the serialized nodes if the parent exists.
-        ///If not, create it
-        
-        if ( !(*it)->getMultiInstanceParentName().empty() ) {
+        if (!foundParent) {
+            ///Maybe it was created so far by another child who created it so look into the nodes
             
-            bool foundParent = false;
-            for (std::list< boost::shared_ptr<NodeSerialization> >::const_iterator it2 = serializedNodes.begin();
-                 it2 != serializedNodes.end(); ++it2) {
-                
-                if ( (*it2)->getNodeScriptName() == (*it)->getMultiInstanceParentName() ) {
-                    foundParent = true;
-                    break;
-                }
-                
+            NodePtr parent = group->getNodeByName(serialization->getMultiInstanceParentName());
+            if (parent) {
+                foundParent = true;
             }
+            ///Create the parent
             if (!foundParent) {
-                ///Maybe it was created so far by another child who created it so look into the nodes
-                
-                NodePtr parent = group->getNodeByName((*it)->getMultiInstanceParentName());
-                if (parent) {
-                    foundParent = true;
-                }
-                ///Create the parent
-                if (!foundParent) {
-                    boost::shared_ptr<Natron::Node> parent = group->getApplication()->createNode(CreateNodeArgs( pluginID.c_str(),
-                                                                                                        "",
-                                                                                                        (*it)->getPluginMajorVersion(),
-                                                                                                        (*it)->getPluginMinorVersion(),
-                                                                                                        true,
-                                                                                                        INT_MIN,
-                                                                                                        INT_MIN,
-                                                                                                        true,
-                                                                                                        true,
-                                                                                                        QString(),
-                                                                                                        CreateNodeArgs::DefaultValuesList(),
-                                                                                                        group));
-                    parent->setScriptName( (*it)->getMultiInstanceParentName().c_str() );
-                    parentsToReconnect.insert( std::make_pair(parent, it) );
-                }
-            }
-        }
-        
-        boost::shared_ptr<Natron::Node> n = group->getApplication()->loadNode( LoadNodeArgs(pluginID.c_str()
-                                                                                               ,(*it)->getMultiInstanceParentName()
-                                                                                               ,(*it)->getPluginMajorVersion()
-                                                                                               ,(*it)->getPluginMinorVersion(),it->get(),false,group) );
-        if (!n) {
-            QString text( QObject::tr("The node ") );
-            text.append( pluginID.c_str() );
-            text.append( QObject::tr(" was found in the script but doesn't seem \n"
-                                     "to exist in the currently loaded plug-ins.") );
-            appPTR->writeToOfxLog_mt_safe(text);
-            mustShowErrorsLog = true;
-            continue;
-        }
-        if ( n->isOutputNode() ) {
-            *hasProjectAWriter = true;
-        }
-        
-        const std::list<boost::shared_ptr<NodeSerialization> >& children = (*it)->getNodesCollection();
-        if (!children.empty()) {
-            NodeGroup* isGrp = dynamic_cast<NodeGroup*>(n->getLiveInstance());
-            if (isGrp) {
-                boost::shared_ptr<Natron::EffectInstance> sharedEffect = isGrp->shared_from_this();
-                boost::shared_ptr<NodeGroup> sharedGrp = boost::dynamic_pointer_cast<NodeGroup>(sharedEffect);
-                NodeCollectionSerialization::restoreFromSerialization(children, sharedGrp , hasProjectAWriter);
-            } else {
-                assert(n->isMultiInstance());
-                NodeCollectionSerialization::restoreFromSerialization(children, group, hasProjectAWriter);
+                boost::shared_ptr<Natron::Node> parent = group->getApplication()->createNode(CreateNodeArgs( pluginID.c_str(),
+                                                                                                    "",
+                                                                                                    serialization->getPluginMajorVersion(),
+                                                                                                    serialization->getPluginMinorVersion(),
+                                                                                                    true,
+                                                                                                    INT_MIN,
+                                                                                                    INT_MIN,
+                                                                                                    true,
+                                                                                                    true,
+                                                                                                    QString(),
+                                                                                                    CreateNodeArgs::DefaultValuesList(),
+                                                                                                    group));
+                parent->setScriptName( serialization->getMultiInstanceParentName().c_str() );
+                parentsToReconnect->insert( std::make_pair(parent, serialization) );
             }
         }
     }
     
+    boost::shared_ptr<Natron::Node> n = group->getApplication()->loadNode( LoadNodeArgs(pluginID.c_str()
+                                                                                           ,serialization->getMultiInstanceParentName()
+                                                                                           ,serialization->getPluginMajorVersion()
+                                                                                           ,serialization->getPluginMinorVersion(),serialization.get(),false,group) );
+    if (!n) {
+        QString text( QObject::tr("The node ") );
+        text.append( pluginID.c_str() );
+        text.append( QObject::tr(" was found in the script but doesn't seem \n"
+                                 "to exist in the currently loaded plug-ins.") );
+        appPTR->writeToOfxLog_mt_safe(text);
+        return false;
+    }
+    if ( n->isOutputNode() ) {
+        *hasProjectAWriter = true;
+    }
+    
+    const std::list<boost::shared_ptr<NodeSerialization> >& children = serialization->getNodesCollection();
+    if (!children.empty()) {
+        NodeGroup* isGrp = dynamic_cast<NodeGroup*>(n->getLiveInstance());
+        if (isGrp) {
+            boost::shared_ptr<Natron::EffectInstance> sharedEffect = isGrp->shared_from_this();
+            boost::shared_ptr<NodeGroup> sharedGrp = boost::dynamic_pointer_cast<NodeGroup>(sharedEffect);
+            NodeCollectionSerialization::restoreFromSerialization(children, sharedGrp , hasProjectAWriter);
+        } else {
+            assert(n->isMultiInstance());
+            NodeCollectionSerialization::restoreFromSerialization(children, group, hasProjectAWriter);
+        }
+    }
+    return true;
+}
+
+bool
+NodeCollectionSerialization::restoreLinks(const std::list< boost::shared_ptr<NodeSerialization> > & serializedNodes,
+                                          const boost::shared_ptr<NodeCollection>& group,
+                                          const ParentsToReconnectMap & parentsToReconnect)
+{
+    bool mustShowErrorsLog = false;
     
-    group->getApplication()->updateProjectLoadStatus(QObject::tr("Restoring graph links in group: ") + groupName);
+    group->getApplication()->updateProjectLoadStatus(QObject::tr("Restoring graph links in group: ") + getGroupLabel(group));
 
     NodeList nodes = group->getNodes();
     
@@ -195,9 +216,8 @@ NodeCollectionSerialization::restoreFromSerialization(const std::list< boost::sh
     }
     
     ///Also reconnect parents of multiinstance nodes that were created on the fly
-    for (std::map<boost::shared_ptr<Natron::Node>, std::list<boost::shared_ptr<NodeSerialization> >::const_iterator >::const_iterator
-         it = parentsToReconnect.begin(); it != parentsToReconnect.end(); ++it) {
-        const std::vector<std::string> & inputs = (*it->second)->getInputs();
+    for (ParentsToReconnectMap::const_iterator it = parentsToReconnect.begin(); it != parentsToReconnect.end(); ++it) {
+        const std::vector<std::string> & inputs = it->second->getInputs();
         for (U32 j = 0; j < inputs.size(); ++j) {
             if ( !inputs[j].empty() && !group->connectNodes(j, inputs[j],it->first.get()) ) {
                 std::string message = std::string("Failed to connect node ") + it->first->getPluginLabel() + " to " + inputs[j];
@@ -65,10 +65,45 @@ public:
         _serializedNodes.push_back(s);
     }
     
+    /**
+     * @brief Moves the serialization of the nodes to nodes, leaving the collection empty.
+     **/
+    void takeNodesSerialization(std::list< boost::shared_ptr<NodeSerialization> >* nodes)
+    {
+        nodes->clear();
+        nodes->swap(_serializedNodes);
+    }
+    
+    ///The parents of multi-instance nodes that were created on the fly, mapped to the serialization of one of their children
+    typedef std::map<boost::shared_ptr<Natron::Node>, boost::shared_ptr<NodeSerialization> > ParentsToReconnectMap;
+    
+    /**
+     * @brief Creates the nodes of serializedNodes in group and connects them.
+     * Returns false if something could not be restored, in which case the reason was written to the log.
+     **/
     static bool restoreFromSerialization(const std::list< boost::shared_ptr<NodeSerialization> > & serializedNodes,
                                          const boost::shared_ptr<NodeCollection>& group,
                                          bool* hasProjectAWriter);
     
+    /**
+     * @brief Creates the node of serialization in group, along with the nodes of its own group if any. This is the first
+     * half of restoreFromSerialization(), which allows creating the nodes as their serialization is decoded:
+     * serializedNodes are the serializations decoded so far (including this one), in which the parent of a multi-instance
+     * child is looked up. restoreLinks() must be called once all the nodes of the group were created.
+     **/
+    static bool restoreNode(const boost::shared_ptr<NodeSerialization>& serialization,
+                            const std::list< boost::shared_ptr<NodeSerialization> > & serializedNodes,
+                            const boost::shared_ptr<NodeCollection>& group,
+                            bool* hasProjectAWriter,
+                            ParentsToReconnectMap* parentsToReconnect);
+    
+    /**
+     * @brief Connects the nodes created by restoreNode() and restores the links of their knobs.
+     **/
+    static bool restoreLinks(const std::list< boost::shared_ptr<NodeSerialization> > & serializedNodes,
+                             const boost::shared_ptr<NodeCollection>& group,
+                             const ParentsToReconnectMap & parentsToReconnect);
+    
 private:
                                          
     friend class boost::serialization::access;
@@ -1470,7 +1470,8 @@ OfxEffectInstance::getRegionsOfInterest(SequenceTime time,
 
 
     if ( (stat != kOfxStatOK) && (stat != kOfxStatReplyDefault) ) {
-        appPTR->writeToOfxLog_mt_safe(QString( getNode()->getScriptName_mt_safe().c_str() ) + "Failed to specify the region of interest from inputs.");
+        appPTR->writeToOfxLog_mt_safe(getNode()->getScriptName_mt_safe(), time, kOfxImageEffectActionGetRegionsOfInterest,
+                                      "Failed to specify the region of interest from inputs.");
     }
     if (stat != kOfxStatReplyDefault) {
         
@@ -2465,9 +2466,8 @@ OfxEffectInstance::knobChanged(KnobI* k,
         }
     }
     if ( (stat != kOfxStatOK) && (stat != kOfxStatReplyDefault) ) {
-        QString err( QString( getNode()->getScriptName_mt_safe().c_str() ) + ": An error occured while changing parameter " +
-                    k->getDescription().c_str() );
-        appPTR->writeToOfxLog_mt_safe(err);
+        QString err( QString("An error occured while changing parameter ") + k->getDescription().c_str() );
+        appPTR->writeToOfxLog_mt_safe(getNode()->getScriptName_mt_safe(), time, kOfxActionInstanceChanged, err);
         
         return;
     }
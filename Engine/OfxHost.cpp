@@ -21,17 +21,16 @@
 #include <cctype> // tolower
 #include <algorithm> // transform
 #include <string>
+#include <vector>
 CLANG_DIAG_OFF(deprecated-register) //'register' storage class specifier is deprecated
 #include <QtCore/QDir>
 #include <QtCore/QMutex>
-#include <QtCore/QThreadPool>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 CLANG_DIAG_ON(deprecated-register)
 #ifdef OFX_SUPPORTS_MULTITHREAD
 #include <QtCore/QThread>
 #include <QtCore/QThreadStorage>
-#include <QtConcurrentMap>
 #include <boost/bind.hpp>
 #endif
 
@@ -65,6 +64,8 @@ CLANG_DIAG_ON(deprecated-register)
 #include "Engine/StandardPaths.h"
 #include "Engine/Settings.h"
 #include "Engine/Node.h"
+#include "Engine/RenderThreadPool.h"
+#include "Engine/DedicatedThreadPool.h"
 
 using namespace Natron;
 
@@ -711,10 +712,10 @@ Natron::OfxHost::setThreadAsActionCaller(bool actionCaller)
 
 namespace {
     
-///Using QtConcurrent doesn't work with The Foundry Furnace plug-ins because they expect fresh threads
-///to be created. As QtConcurrent's thread-pool recycles thread, it seems to make Furnace crash.
+///Using a thread pool doesn't work with The Foundry Furnace plug-ins because they expect fresh threads
+///to be created. As the render thread pool recycles threads, it seems to make Furnace crash.
 ///We think this is because Furnace must keep an internal thread-local state that becomes then dirty
-///if we re-use the same thread.
+///if we re-use the same thread for other tasks: the threads of the dedicated thread pool only run the calls of multiThread.
 
 static OfxStatus
 threadFunctionWrapper(OfxThreadFunctionV1 func,
@@ -741,52 +742,16 @@ threadFunctionWrapper(OfxThreadFunctionV1 func,
     return ret;
 }
 
-    
-
-    
-class OfxThread
-    : public QThread
+///Runs the index threadIndex of a call of multiThread on a thread of the dedicated thread pool
+static void
+runOnDedicatedThread(OfxThreadFunctionV1 func,
+                     unsigned int threadMax,
+                     void *customArg,
+                     std::vector<OfxStatus>* status,
+                     int threadIndex)
 {
-public:
-    OfxThread(OfxThreadFunctionV1 func,
-              unsigned int threadIndex,
-              unsigned int threadMax,
-              void *customArg,
-              OfxStatus *stat)
-        : _func(func)
-          , _threadIndex(threadIndex)
-          , _threadMax(threadMax)
-          , _customArg(customArg)
-          , _stat(stat)
-    {
-    }
-
-    void run() OVERRIDE
-    {
-        assert(_threadIndex < _threadMax);
-        std::list<int>& localData = gThreadIndex.localData();
-        localData.push_back((int)_threadIndex);
-        
-        assert(*_stat == kOfxStatFailed);
-        try {
-            _func(_threadIndex, _threadMax, _customArg);
-            *_stat = kOfxStatOK;
-        } catch (const std::bad_alloc & ba) {
-            *_stat = kOfxStatErrMemory;
-        } catch (...) {
-        }
-
-        ///reset back the index otherwise it could mess up the indexes if the same thread is re-used
-        localData.pop_back();
-    }
-
-private:
-    OfxThreadFunctionV1 *_func;
-    unsigned int _threadIndex;
-    unsigned int _threadMax;
-    void *_customArg;
-    OfxStatus *_stat;
-};
+    (*status)[threadIndex] = threadFunctionWrapper(func, (unsigned int)threadIndex, threadMax, customArg);
+}
 
 }
 
@@ -840,13 +805,12 @@ Natron::OfxHost::multiThread(OfxThreadFunctionV1 func,
         }
         
         /// DON'T set the maximum thread count, this is a global application setting, and see the documentation excerpt above
-        //QThreadPool::globalInstance()->setMaxThreadCount(nThreads);
-        QFuture<OfxStatus> future = QtConcurrent::mapped( threadIndexes, boost::bind(::threadFunctionWrapper,func, _1, nThreads, customArg) );
-        future.waitForFinished();
-        ///DON'T reset back to the original value the maximum thread count
-        //QThreadPool::globalInstance()->setMaxThreadCount(QThread::idealThreadCount());
-        
-        for (QFuture<OfxStatus>::const_iterator it = future.begin(); it != future.end(); ++it) {
+        ///The render thread pool runs the calls of multiThread made from within a render (e.g. when the host frame
+        ///threading is also used) on the threads that are already running instead of oversubscribing the CPU.
+        std::vector<OfxStatus> status;
+        appPTR->getRenderThreadPool()->mapped( threadIndexes, boost::bind(::threadFunctionWrapper, func, _1, nThreads, customArg), &status );
+
+        for (std::vector<OfxStatus>::const_iterator it = status.begin(); it != status.end(); ++it) {
             OfxStatus stat = *it;
             if (stat != kOfxStatOK) {
                 return stat;
@@ -854,45 +818,14 @@ Natron::OfxHost::multiThread(OfxThreadFunctionV1 func,
         }
 
     } else {
-        QVector<OfxStatus> status(nThreads); // vector for the return status of each thread
-        status.fill(kOfxStatFailed); // by default, a thread fails
-        {
-            // at most maxConcurrentThread should be running at the same time
-            QVector<OfxThread*> threads(nThreads);
-            for (unsigned int i = 0; i < nThreads; ++i) {
-                threads[i] = new OfxThread(func, i, nThreads, customArg, &status[i]);
-            }
-            unsigned int i = 0; // index of next thread to launch
-            unsigned int running = 0; // number of running threads
-            unsigned int j = 0; // index of first running thread. all threads before this one are finished running
-            while (j < nThreads) {
-                // have no more than maxConcurrentThread threads launched at the same time
-                int threadsStarted = 0;
-                while (i < nThreads && running < maxConcurrentThread) {
-                    threads[i]->start();
-                    ++i;
-                    ++running;
-                    ++threadsStarted;
-                }
-                
-                ///We just started threadsStarted threads
-                appPTR->fetchAndAddNRunningThreads(threadsStarted);
-                
-                // now we've got at most maxConcurrentThread running. wait for each thread and launch a new one
-                threads[j]->wait();
-                assert( !threads[j]->isRunning() );
-                assert( threads[j]->isFinished() );
-                delete threads[j];
-                ++j;
-                --running;
-                
-                ///We just stopped 1 thread
-                appPTR->fetchAndAddNRunningThreads(-1);
-            }
-            assert(running == 0);
-        }
+        ///The threads of the dedicated pool are parked between the calls, and each of them takes the next index
+        ///as soon as it is done with the previous one, at most maxConcurrentThread of them working on this call.
+        std::vector<OfxStatus> status(nThreads, kOfxStatFailed);
+        appPTR->getDedicatedThreadPool()->run( nThreads, maxConcurrentThread,
+                                               boost::bind(::runOnDedicatedThread, func, nThreads, customArg, &status, _1) );
+
         // check the return status of each thread, return the first error found
-        for (QVector<OfxStatus>::const_iterator it = status.begin(); it != status.end(); ++it) {
+        for (std::vector<OfxStatus>::const_iterator it = status.begin(); it != status.end(); ++it) {
             OfxStatus stat = *it;
             if (stat != kOfxStatOK) {
                 return stat;
@@ -919,19 +852,13 @@ Natron::OfxHost::multiThreadNumCPUS(unsigned int *nCPUs) const
     if (nThreadsToRender == -1) {
         *nCPUs = 1;
     } else {
-        // activeThreadCount may be negative (for example if releaseThread() is called)
-        int activeThreadsCount = QThreadPool::globalInstance()->activeThreadCount();
-        
-        // Add the number of threads already running by the multiThreadSuite + parallel renders
-        activeThreadsCount += appPTR->getNRunningThreads();
-        
-        // Clamp to 0
-        activeThreadsCount = std::max( 0, activeThreadsCount);
+        // The threads busy with the parallel renders, the host frame threading and the calls of multiThread
+        int activeThreadsCount = appPTR->getNActiveThreads();
         
         assert(activeThreadsCount >= 0);
         
         // better than QThread::idealThreadCount();, because it can be set by a global preference:
-        int maxThreadsCount = QThreadPool::globalInstance()->maxThreadCount();
+        int maxThreadsCount = appPTR->getRenderThreadPool()->getMaxThreadCount();
         assert(maxThreadsCount >= 0);
         
         if (nThreadsPerEffect == 0) {
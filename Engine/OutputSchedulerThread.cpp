@@ -18,6 +18,8 @@
 #include <iostream>
 #include <set>
 #include <list>
+#include <vector>
+#include <algorithm>
 #include <QMetaType>
 #include <QMutex>
 #include <QWaitCondition>
@@ -29,6 +31,8 @@
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QRunnable>
+#include <QAtomicInt>
+#include <QElapsedTimer>
 
 #include "Global/MemoryInfo.h"
 
@@ -47,6 +51,15 @@
 
 #define NATRON_FPS_REFRESH_RATE_SECONDS 1.5
 
+///How long the viewer must be left alone before frames are pre-rendered in the background
+#define NATRON_BACKGROUND_CACHING_IDLE_DELAY_MS 300
+
+///How many frames may wait for the writer thread of a sequential writer before the scheduler blocks
+#define NATRON_SEQUENTIAL_WRITER_QUEUE_MAX_FRAMES 3
+
+///The channel used as alpha when converting the image fed to a writer
+#define NATRON_WRITER_CHANNEL_FOR_ALPHA 3
+
 
 using namespace Natron;
 
@@ -113,6 +126,7 @@ struct RunArgs
 struct RenderThread {
     RenderThreadTask* thread;
     bool active;
+    bool hasFrameInFlight; //< true from when the thread picks a frame until it asks for the next one
 };
 typedef std::list<RenderThread> RenderThreads;
 
@@ -136,6 +150,19 @@ struct OutputSchedulerThreadPrivate
     QWaitCondition bufCondition;
     mutable QMutex bufMutex;
     
+    ///The following are protected by bufMutex
+    U64 bufferedBytes; //< the sum of the sizeInRAM() of the frames in buf
+    U64 bufferMaximumBytes; //< the memory budget of buf, refreshed in startRender()
+    U64 largestFrameBytes; //< the largest frame appended to buf since startRender(), to anticipate the frames in flight
+    int nFramesInFlight; //< the number of frames being rendered by the render threads
+    U64 peakBufferedBytes;
+    int peakBufferedFrames;
+    
+    ///Back-pressure statistics of the current render, protected by framesToRenderMutex
+    U64 blockedTimeUs; //< cumulated time the render threads waited because the buffer was full
+    int nBlockedWaits;
+    QElapsedTimer renderTimer;
+    
     bool working; // true when the scheduler is currently having render threads doing work
     mutable QMutex workingMutex;
     
@@ -213,6 +240,15 @@ struct OutputSchedulerThreadPrivate
     : buf()
     , bufCondition()
     , bufMutex()
+    , bufferedBytes(0)
+    , bufferMaximumBytes(0)
+    , largestFrameBytes(0)
+    , nFramesInFlight(0)
+    , peakBufferedBytes(0)
+    , peakBufferedFrames(0)
+    , blockedTimeUs(0)
+    , nBlockedWaits(0)
+    , renderTimer()
     , working(false)
     , workingMutex()
     , hasQuit(false)
@@ -265,6 +301,13 @@ struct OutputSchedulerThreadPrivate
         k.view = view;
         k.frame = image;
         std::pair<FrameBuffer::iterator,bool> ret = buf.insert(k);
+        if (ret.second && image) {
+            U64 frameBytes = image->sizeInRAM();
+            bufferedBytes += frameBytes;
+            largestFrameBytes = std::max(largestFrameBytes, frameBytes);
+            peakBufferedBytes = std::max(peakBufferedBytes, bufferedBytes);
+            peakBufferedFrames = std::max(peakBufferedFrames, (int)buf.size());
+        }
         return ret.second;
     }
     
@@ -280,6 +323,7 @@ struct OutputSchedulerThreadPrivate
             if (it->time == time) {
                 if (it->frame) {
                     frames.push_back(*it);
+                    bufferedBytes -= it->frame->sizeInRAM();
                 }
             } else {
                 newBuf.insert(*it);
@@ -294,6 +338,27 @@ struct OutputSchedulerThreadPrivate
         assert(!bufMutex.tryLock());
         
         buf.clear();
+        bufferedBytes = 0;
+    }
+    
+    /**
+     * @brief Returns true if the render threads must wait for the buffered frames to be consumed before rendering another
+     * frame: that is when the buffered frames and the frames being rendered would exceed the memory budget.
+     * The buffer is never full when empty so that the frame expected by the scheduler can always be rendered.
+     **/
+    bool isBufferFull() const
+    {
+        ///Private, shouldn't lock
+        assert(!bufMutex.tryLock());
+        
+        return !buf.empty() && bufferedBytes + (U64)nFramesInFlight * largestFrameBytes >= bufferMaximumBytes;
+    }
+    
+    static U64 getBufferMaximumBytes()
+    {
+        boost::shared_ptr<Settings> settings = appPTR->getCurrentSettings();
+        
+        return (U64)( getSystemTotalRAM_conditionnally() * settings->getRamMaximumPercent() * settings->getRenderBufferMaximumPercent() );
     }
     
     void appendRunnable(RenderThreadTask* runnable)
@@ -301,6 +366,7 @@ struct OutputSchedulerThreadPrivate
         RenderThread r;
         r.thread = runnable;
         r.active = true;
+        r.hasFrameInFlight = false;
         renderThreads.push_back(r);
         runnable->start();
         
@@ -673,43 +739,57 @@ int
 OutputSchedulerThread::pickFrameToRender(RenderThreadTask* thread)
 {
     ///Flag the thread as inactive
+    bool hadFrameInFlight;
     {
         QMutexLocker l(&_imp->renderThreadsMutex);
         RenderThreads::iterator found = _imp->getRunnableIterator(thread);
         assert(found != _imp->renderThreads.end());
         found->active = false;
+        hadFrameInFlight = found->hasFrameInFlight;
+        found->hasFrameInFlight = false;
         
         ///Wake up the scheduler if it is waiting for all threads do be inactive
         _imp->allRenderThreadsInactiveCond.wakeOne();
     }
     
-    ///Simple heuristic to limit the size of the internal buffer.
-    ///If the buffer grows too much, we will keep shared ptr to images, hence keep them in RAM which
-    ///can lead to RAM issue for the end user.
+    ///Limit the size of the internal buffer: it keeps shared ptr to images, hence keeps them in RAM.
     ///We can end up in this situation for very simple graphs where the rendering of the output node (the writer or viewer)
     ///is much slower than things upstream, hence the buffer grows quickly, and fills up the RAM.
-    int nbThreadsHardware = appPTR->getHardwareIdealThreadCount();
+    ///The limit is expressed in bytes so that it does not depend on the size of the frames rendered.
     bool bufferFull;
     {
         QMutexLocker k(&_imp->bufMutex);
-        bufferFull = (int)_imp->buf.size() >= nbThreadsHardware * 3;
+        if (hadFrameInFlight) {
+            --_imp->nFramesInFlight;
+        }
+        bufferFull = _imp->isBufferFull();
     }
     
     QMutexLocker l(&_imp->framesToRenderMutex);
+    bool wasBlocked = false;
+    QElapsedTimer blockedTimer;
     while ((bufferFull || _imp->framesToRender.empty()) && !thread->mustQuit() ) {
         
         ///Notify that we're no longer doing work
         thread->notifyIsRunning(false);
         
+        if (bufferFull && !wasBlocked && !_imp->framesToRender.empty()) {
+            wasBlocked = true;
+            ++_imp->nBlockedWaits;
+            blockedTimer.start();
+        }
         
         _imp->framesToRenderNotEmptyCond.wait(&_imp->framesToRenderMutex);
         
         {
             QMutexLocker k(&_imp->bufMutex);
-            bufferFull = (int)_imp->buf.size() >= nbThreadsHardware * 3;
+            bufferFull = _imp->isBufferFull();
         }
     }
     
+    if (wasBlocked) {
+        _imp->blockedTimeUs += (U64)blockedTimer.nsecsElapsed() / 1000;
+    }
    
     if (!_imp->framesToRender.empty()) {
         
@@ -726,6 +806,11 @@ OutputSchedulerThread::pickFrameToRender(RenderThreadTask* thread)
             RenderThreads::iterator found = _imp->getRunnableIterator(thread);
             assert(found != _imp->renderThreads.end());
             found->active = true;
+            found->hasFrameInFlight = true;
+        }
+        {
+            QMutexLocker k(&_imp->bufMutex);
+            ++_imp->nFramesInFlight;
         }
         
         return ret;
@@ -738,15 +823,67 @@ OutputSchedulerThread::pickFrameToRender(RenderThreadTask* thread)
 }
 
 
+void
+OutputSchedulerThread::reportBufferStatistics()
+{
+    U64 peakBytes,maximumBytes;
+    int peakFrames;
+    {
+        QMutexLocker l(&_imp->bufMutex);
+        peakBytes = _imp->peakBufferedBytes;
+        maximumBytes = _imp->bufferMaximumBytes;
+        peakFrames = _imp->peakBufferedFrames;
+    }
+    U64 blockedTimeUs;
+    int nBlockedWaits;
+    qint64 renderTimeMs;
+    {
+        QMutexLocker l(&_imp->framesToRenderMutex);
+        blockedTimeUs = _imp->blockedTimeUs;
+        nBlockedWaits = _imp->nBlockedWaits;
+        renderTimeMs = _imp->renderTimer.elapsed();
+    }
+    
+    ///Only sequential renders use the buffer
+    if (peakFrames == 0) {
+        return;
+    }
+    
+    QString message = QString(_imp->outputEffect->getScriptName_mt_safe().c_str()) +
+    QObject::tr(": render buffer peaked at %1 frame(s) using %2 (limit %3), render threads waited %4 s for it to drain "
+                "(%5 time(s)) during a render of %6 s")
+    .arg(peakFrames)
+    .arg(printAsRAM(peakBytes))
+    .arg(printAsRAM(maximumBytes))
+    .arg((double)blockedTimeUs / 1000000., 0, 'f', 2)
+    .arg(nBlockedWaits)
+    .arg((double)renderTimeMs / 1000., 0, 'f', 2);
+    
+    if ( appPTR->isBackground() ) {
+        std::cout << message.toStdString() << std::endl;
+    } else {
+        appPTR->writeToOfxLog_mt_safe(message);
+    }
+}
+
 void
 OutputSchedulerThread::notifyThreadAboutToQuit(RenderThreadTask* thread)
 {
-    QMutexLocker l(&_imp->renderThreadsMutex);
-    RenderThreads::iterator found = _imp->getRunnableIterator(thread);
-    if (found != _imp->renderThreads.end()) {
-        found->active = false;
-        _imp->allRenderThreadsInactiveCond.wakeOne();
-        _imp->allRenderThreadsQuitCond.wakeOne();
+    bool hadFrameInFlight = false;
+    {
+        QMutexLocker l(&_imp->renderThreadsMutex);
+        RenderThreads::iterator found = _imp->getRunnableIterator(thread);
+        if (found != _imp->renderThreads.end()) {
+            found->active = false;
+            hadFrameInFlight = found->hasFrameInFlight;
+            found->hasFrameInFlight = false;
+            _imp->allRenderThreadsInactiveCond.wakeOne();
+            _imp->allRenderThreadsQuitCond.wakeOne();
+        }
+    }
+    if (hadFrameInFlight) {
+        QMutexLocker k(&_imp->bufMutex);
+        --_imp->nFramesInFlight;
     }
 }
 
@@ -774,6 +911,21 @@ OutputSchedulerThread::startRender()
     
     aboutToStartRender();
     
+    ///Refresh the memory budget of the buffer and reset the back-pressure statistics
+    {
+        QMutexLocker l(&_imp->bufMutex);
+        _imp->bufferMaximumBytes = OutputSchedulerThreadPrivate::getBufferMaximumBytes();
+        _imp->largestFrameBytes = 0;
+        _imp->peakBufferedBytes = 0;
+        _imp->peakBufferedFrames = 0;
+    }
+    {
+        QMutexLocker l(&_imp->framesToRenderMutex);
+        _imp->blockedTimeUs = 0;
+        _imp->nBlockedWaits = 0;
+        _imp->renderTimer.start();
+    }
+    
     ///Flag that we're now doing work
     {
         QMutexLocker l(&_imp->workingMutex);
@@ -843,6 +995,8 @@ OutputSchedulerThread::stopRender()
         _imp->waitForRenderThreadsToBeDone();
     }
     
+    ///Wait for the frames handed to the output effect to be processed
+    finishProcessingFrames( isAbortRequested() );
     
     ///If the output effect is sequential (only WriteFFMPEG for now)
     Natron::SequentialPreferenceEnum pref = _imp->outputEffect->getSequentialPreference();
@@ -889,6 +1043,10 @@ OutputSchedulerThread::stopRender()
             _imp->working = false;
         }
         
+        if ( _imp->outputEffect->isWriter() ) {
+            reportBufferStatistics();
+        }
+        
         ///Clear any frames that were processed ahead
         {
             QMutexLocker l2(&_imp->bufMutex);
@@ -1088,10 +1246,11 @@ OutputSchedulerThread::run()
                 
                 
                 ////////////
-                /////At this point the frame has been processed by the output device
+                /////At this point the frame has been processed by the output device, unless it only queued it
                 
-                
-                notifyFrameRendered(expectedTimeToRender,0,1,eSchedulingPolicyOrdered);
+                if (!isProcessingFramesAsynchronously()) {
+                    notifyFrameRendered(expectedTimeToRender,0,1,eSchedulingPolicyOrdered);
+                }
                 
                 ///////////
                 /// End of the loop, refresh bufferEmpty
@@ -1138,7 +1297,7 @@ OutputSchedulerThread::adjustNumberOfThreads(int* newNThreads)
     
     int userSettingParallelThreads = appPTR->getCurrentSettings()->getNumberOfParallelRenders();
     
-    int runningThreads = appPTR->getNRunningThreads() + QThreadPool::globalInstance()->activeThreadCount();
+    int runningThreads = appPTR->getNActiveThreads();
     
     
     int currentParallelRenders = getNRenderThreads();
@@ -1230,6 +1389,13 @@ OutputSchedulerThread::notifyFrameRendered(int frame,
     }
 }
 
+bool
+OutputSchedulerThread::isAbortRequested()
+{
+    QMutexLocker l(&_imp->abortedRequestedMutex);
+    return _imp->abortRequested > 0;
+}
+
 void
 OutputSchedulerThread::appendToBuffer_internal(double time,int view,const boost::shared_ptr<BufferableObject>& frame,bool wakeThread)
 {
@@ -1784,16 +1950,218 @@ RenderThreadTask::notifyIsRunning(bool running)
 //////////////////////// DefaultScheduler ////////////
 
 
+/**
+ * @brief Calls the render action of a sequential writer (e.g: WriteFFMPEG) on its own thread so that encoding
+ * a frame overlaps with the rendering of the next ones. The scheduler thread still hands the frames in order and only
+ * blocks when NATRON_SEQUENTIAL_WRITER_QUEUE_MAX_FRAMES frames are already waiting.
+ * It also gathers the time spent in each stage of the pipeline so it can be reported at the end of the render.
+ **/
+class SequentialWriterThread : public QThread
+{
+public:
+    
+    SequentialWriterThread(DefaultScheduler* scheduler)
+    : QThread()
+    , _scheduler(scheduler)
+    , _queueMutex()
+    , _queueNotEmptyCond()
+    , _queueNotFullCond()
+    , _queue()
+    , _isWriting(false)
+    , _mustQuit(false)
+    , _statsMutex()
+    , _renderTimer()
+    , _renderTimeUs(0)
+    , _conversionTimeUs(0)
+    , _handOffWaitTimeUs(0)
+    , _writeTimeUs(0)
+    , _writerIdleTimeUs(0)
+    , _nFramesWritten(0)
+    {
+        setObjectName("SequentialWriterThread");
+    }
+    
+    virtual ~SequentialWriterThread()
+    {
+    }
+    
+    /**
+     * @brief Queues frames to be written, blocking while the queue is full. Called by the scheduler thread.
+     **/
+    void appendFrames(const BufferedFrames& frames)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        {
+            QMutexLocker k(&_queueMutex);
+            while ( (int)_queue.size() >= NATRON_SEQUENTIAL_WRITER_QUEUE_MAX_FRAMES && !_mustQuit ) {
+                _queueNotFullCond.wait(&_queueMutex);
+            }
+            _queue.push_back(frames);
+            _queueNotEmptyCond.wakeOne();
+        }
+        QMutexLocker k(&_statsMutex);
+        _handOffWaitTimeUs += (U64)timer.nsecsElapsed() / 1000;
+    }
+    
+    /**
+     * @brief Blocks until all queued frames are written. If discardPendingFrames is true, frames that are not
+     * being written yet are dropped instead.
+     **/
+    void waitForQueueEmpty(bool discardPendingFrames)
+    {
+        QMutexLocker k(&_queueMutex);
+        if (discardPendingFrames) {
+            _queue.clear();
+        }
+        while ( (!_queue.empty() || _isWriting) && !_mustQuit ) {
+            _queueNotFullCond.wait(&_queueMutex);
+        }
+    }
+    
+    void quitThread()
+    {
+        {
+            QMutexLocker k(&_queueMutex);
+            _mustQuit = true;
+            _queue.clear();
+            _queueNotEmptyCond.wakeAll();
+            _queueNotFullCond.wakeAll();
+        }
+        wait();
+    }
+    
+    void resetStatistics()
+    {
+        QMutexLocker k(&_statsMutex);
+        _renderTimer.start();
+        _renderTimeUs = 0;
+        _conversionTimeUs = 0;
+        _handOffWaitTimeUs = 0;
+        _writeTimeUs = 0;
+        _writerIdleTimeUs = 0;
+        _nFramesWritten = 0;
+    }
+    
+    void addInputFrameStatistics(U64 renderTimeUs,U64 conversionTimeUs)
+    {
+        QMutexLocker k(&_statsMutex);
+        _renderTimeUs += renderTimeUs;
+        _conversionTimeUs += conversionTimeUs;
+    }
+    
+    /**
+     * @brief Prints how long each stage of the pipeline took, summed over all threads for the render stages.
+     **/
+    void reportStatistics(const std::string& writerName)
+    {
+        QString message;
+        {
+            QMutexLocker k(&_statsMutex);
+            if (_nFramesWritten == 0) {
+                return;
+            }
+            message = QString(writerName.c_str()) +
+            QObject::tr(": wrote %1 frame(s) in %2 s. Render threads: rendering %3 s, converting %4 s. "
+                        "Writer thread: writing %5 s, waiting for frames %6 s. Scheduler waited %7 s for the writer.")
+            .arg(_nFramesWritten)
+            .arg((double)_renderTimer.elapsed() / 1000., 0, 'f', 2)
+            .arg((double)_renderTimeUs / 1000000., 0, 'f', 2)
+            .arg((double)_conversionTimeUs / 1000000., 0, 'f', 2)
+            .arg((double)_writeTimeUs / 1000000., 0, 'f', 2)
+            .arg((double)_writerIdleTimeUs / 1000000., 0, 'f', 2)
+            .arg((double)_handOffWaitTimeUs / 1000000., 0, 'f', 2);
+        }
+        if ( appPTR->isBackground() ) {
+            std::cout << message.toStdString() << std::endl;
+        } else {
+            appPTR->writeToOfxLog_mt_safe(message);
+        }
+    }
+    
+private:
+    
+    virtual void run() OVERRIDE FINAL
+    {
+        for (;;) {
+            BufferedFrames frames;
+            {
+                QElapsedTimer idleTimer;
+                idleTimer.start();
+                QMutexLocker k(&_queueMutex);
+                while (_queue.empty() && !_mustQuit) {
+                    _queueNotEmptyCond.wait(&_queueMutex);
+                }
+                if (_mustQuit) {
+                    return;
+                }
+                frames = _queue.front();
+                _queue.pop_front();
+                _isWriting = true;
+                
+                QMutexLocker l(&_statsMutex);
+                _writerIdleTimeUs += (U64)idleTimer.nsecsElapsed() / 1000;
+            }
+            
+            QElapsedTimer writeTimer;
+            writeTimer.start();
+            _scheduler->writeFrames(frames);
+            
+            {
+                QMutexLocker l(&_statsMutex);
+                _writeTimeUs += (U64)writeTimer.nsecsElapsed() / 1000;
+                ++_nFramesWritten;
+            }
+            
+            ///Report progress only now that the frame is written, so that an abort does not show unwritten frames as done
+            if ( !_scheduler->isAbortRequested() ) {
+                _scheduler->notifyFrameRendered(frames.front().time, 0, 1, eSchedulingPolicyOrdered);
+            }
+            
+            QMutexLocker k(&_queueMutex);
+            _isWriting = false;
+            _queueNotFullCond.wakeAll();
+        }
+    }
+    
+    DefaultScheduler* _scheduler;
+    
+    ///Protects _queue, _isWriting and _mustQuit
+    QMutex _queueMutex;
+    QWaitCondition _queueNotEmptyCond;
+    QWaitCondition _queueNotFullCond;
+    std::list<BufferedFrames> _queue;
+    bool _isWriting;
+    bool _mustQuit;
+    
+    ///Protects the statistics below
+    QMutex _statsMutex;
+    QElapsedTimer _renderTimer;
+    U64 _renderTimeUs,_conversionTimeUs,_handOffWaitTimeUs,_writeTimeUs,_writerIdleTimeUs;
+    int _nFramesWritten;
+};
+
 DefaultScheduler::DefaultScheduler(RenderEngine* engine,Natron::OutputEffectInstance* effect)
 : OutputSchedulerThread(engine,effect,eProcessFrameBySchedulerThread)
 , _effect(effect)
+, _writerThread()
 {
     engine->setPlaybackMode(ePlaybackModeOnce);
 }
 
 DefaultScheduler::~DefaultScheduler()
 {
-    
+    if (_writerThread) {
+        _writerThread->quitThread();
+    }
+}
+
+void
+DefaultScheduler::notifyInputFrameRendered(U64 renderTimeUs,U64 conversionTimeUs)
+{
+    if (_writerThread) {
+        _writerThread->addInputFrameStatistics(renderTimeUs, conversionTimeUs);
+    }
 }
 
 class DefaultRenderFrameRunnable : public RenderThreadTask
@@ -1801,8 +2169,9 @@ class DefaultRenderFrameRunnable : public RenderThreadTask
     
 public:
     
-    DefaultRenderFrameRunnable(Natron::OutputEffectInstance* writer,OutputSchedulerThread* scheduler)
+    DefaultRenderFrameRunnable(Natron::OutputEffectInstance* writer,DefaultScheduler* scheduler)
     : RenderThreadTask(writer,scheduler)
+    , _defaultScheduler(scheduler)
     {
         
     }
@@ -1897,6 +2266,9 @@ private:
                                                                    false,
                                                                    _imp->output->getApp()->getTimeLine().get());
                     
+                    QElapsedTimer stageTimer;
+                    stageTimer.start();
+                    
                     boost::shared_ptr<Natron::Image> img =
                     activeInputToRender->renderRoI( EffectInstance::RenderRoIArgs(time, //< the time at which to render
                                                                                   scale, //< the scale at which to render
@@ -1910,6 +2282,12 @@ private:
                     
                     ///If we need sequential rendering, pass the image to the output scheduler that will ensure the sequential ordering
                     if (!renderDirectly) {
+                        U64 renderTimeUs = (U64)stageTimer.nsecsElapsed() / 1000;
+                        stageTimer.restart();
+                        if (img) {
+                            img = convertToWriterFormat(activeInputToRender, img);
+                        }
+                        _defaultScheduler->notifyInputFrameRendered(renderTimeUs, (U64)stageTimer.nsecsElapsed() / 1000);
                         _imp->scheduler->appendToBuffer(time, i, boost::dynamic_pointer_cast<BufferableObject>(img));
                     } else {
                         _imp->scheduler->notifyFrameRendered(time,i,viewsCount,eSchedulingPolicyFFA);
@@ -1924,6 +2302,44 @@ private:
             _imp->scheduler->notifyRenderFailure(std::string("Error while rendering: ") + e.what());
         }
     }
+    
+    /**
+     * @brief Converts the image rendered by the input of a sequential writer to the components and bit depth the writer
+     * fetches, the same way renderRoI would have done it on the writer thread. Doing it here spreads the conversion
+     * over the render threads instead.
+     **/
+    ImagePtr
+    convertToWriterFormat(Natron::EffectInstance* input,const ImagePtr& img) const
+    {
+        ImageComponentsEnum writerComponents;
+        ImageBitDepthEnum writerDepth;
+        _imp->output->getPreferredDepthAndComponents(0, &writerComponents, &writerDepth);
+        if ( (writerComponents == img->getComponents()) && (writerDepth == img->getBitDepth()) ) {
+            return img;
+        }
+        
+        ///Keep the key of the input image so the writer finds it when fetching its input
+        boost::shared_ptr<ImageParams> oldParams = img->getParams();
+        boost::shared_ptr<ImageParams> params = Image::makeParams(0,
+                                                                  oldParams->getRoD(),
+                                                                  img->getBounds(),
+                                                                  oldParams->getPixelAspectRatio(),
+                                                                  img->getMipMapLevel(),
+                                                                  oldParams->isRodProjectFormat(),
+                                                                  writerComponents,
+                                                                  writerDepth,
+                                                                  oldParams->getFramesNeeded());
+        ImagePtr converted( new Image(img->getKey(), params) );
+        
+        bool unPremultIfNeeded = input->getOutputPremultiplication() == eImagePremultiplicationPremultiplied;
+        img->convertToFormat(img->getBounds(),
+                             input->getApp()->getDefaultColorSpaceForBitDepth( img->getBitDepth() ),
+                             input->getApp()->getDefaultColorSpaceForBitDepth(writerDepth),
+                             NATRON_WRITER_CHANNEL_FOR_ALPHA, false, false, unPremultIfNeeded, converted.get());
+        return converted;
+    }
+    
+    DefaultScheduler* _defaultScheduler;
 };
 
 RenderThreadTask*
@@ -1943,6 +2359,33 @@ DefaultScheduler::createRunnable()
  **/
 void
 DefaultScheduler::processFrame(const BufferedFrames& frames)
+{
+    assert(!frames.empty());
+    if (_writerThread) {
+        ///Let the writer thread encode it while the scheduler moves on to the next frame
+        _writerThread->appendFrames(frames);
+    } else {
+        writeFrames(frames);
+    }
+}
+
+bool
+DefaultScheduler::isProcessingFramesAsynchronously() const
+{
+    return _writerThread.get() != 0;
+}
+
+void
+DefaultScheduler::finishProcessingFrames(bool aborted)
+{
+    if (_writerThread) {
+        _writerThread->waitForQueueEmpty(aborted);
+        _writerThread->reportStatistics( _effect->getScriptName_mt_safe() );
+    }
+}
+
+void
+DefaultScheduler::writeFrames(const BufferedFrames& frames)
 {
     assert(!frames.empty());
     //Only consider the first frame, we shouldn't have multiple view here anyway.
@@ -1994,7 +2437,7 @@ DefaultScheduler::processFrame(const BufferedFrames& frames)
                                                    rod,
                                                    components,
                                                    imageDepth,
-                                                   3,
+                                                   NATRON_WRITER_CHANNEL_FOR_ALPHA,
                                                    false,
                                                    inputImages);
         try {
@@ -2070,6 +2513,15 @@ DefaultScheduler::aboutToStartRender()
         _effect->setCurrentFrame(last);
     }
     
+    ///Sequential writers encode on their own thread
+    if (getSchedulingPolicy() == Natron::eSchedulingPolicyOrdered) {
+        if (!_writerThread) {
+            _writerThread.reset(new SequentialWriterThread(this));
+            _writerThread->start();
+        }
+        _writerThread->resetStatistics();
+    }
+    
     bool isBackGround = appPTR->isBackground();
     
     if (!isBackGround) {
@@ -2306,6 +2758,12 @@ struct RenderEnginePrivate
     
     ViewerCurrentFrameRequestScheduler* currentFrameScheduler;
     
+    ///Only for viewers, created on the first call to renderCurrentFrame
+    ViewerBackgroundCacheScheduler* backgroundCacheScheduler;
+    
+    ///The direction of the last playback, followed by the background caching
+    OutputSchedulerThread::RenderDirectionEnum lastPlaybackDirection;
+    
     RenderEnginePrivate(Natron::OutputEffectInstance* output)
     : schedulerCreationLock()
     , scheduler(0)
@@ -2313,6 +2771,8 @@ struct RenderEnginePrivate
     , pbModeMutex()
     , pbMode(ePlaybackModeLoop)
     , currentFrameScheduler(0)
+    , backgroundCacheScheduler(0)
+    , lastPlaybackDirection(OutputSchedulerThread::eRenderDirectionForward)
     {
         
     }
@@ -2326,6 +2786,7 @@ RenderEngine::RenderEngine(Natron::OutputEffectInstance* output)
 
 RenderEngine::~RenderEngine()
 {
+    delete _imp->backgroundCacheScheduler;
     delete _imp->currentFrameScheduler;
     delete _imp->scheduler;
 }
@@ -2346,6 +2807,10 @@ RenderEngine::renderFrameRange(int firstFrame,int lastFrame,OutputSchedulerThrea
         }
     }
     
+    if (_imp->backgroundCacheScheduler) {
+        _imp->backgroundCacheScheduler->abortRendering();
+    }
+    _imp->lastPlaybackDirection = forward;
     _imp->scheduler->renderFrameRange(firstFrame, lastFrame, forward);
 }
 
@@ -2360,6 +2825,10 @@ RenderEngine::renderFromCurrentFrame(OutputSchedulerThread::RenderDirectionEnum
         }
     }
     
+    if (_imp->backgroundCacheScheduler) {
+        _imp->backgroundCacheScheduler->abortRendering();
+    }
+    _imp->lastPlaybackDirection = forward;
     _imp->scheduler->renderFromCurrentFrame(forward);
 }
 
@@ -2394,7 +2863,18 @@ RenderEngine::renderCurrentFrame(bool canAbort)
         _imp->currentFrameScheduler = new ViewerCurrentFrameRequestScheduler(isViewer);
     }
     
+    ///Abort the frames pre-rendered in the background before starting the render of the current frame
+    if (!_imp->backgroundCacheScheduler) {
+        _imp->backgroundCacheScheduler = new ViewerBackgroundCacheScheduler(isViewer);
+    }
+    _imp->backgroundCacheScheduler->abortRendering();
+    
     _imp->currentFrameScheduler->renderCurrentFrame(canAbort);
+    
+    ///When the user wants everything to run in the main thread, do not spawn background threads
+    if (appPTR->getCurrentSettings()->getNumberOfThreads() != -1) {
+        _imp->backgroundCacheScheduler->restart(isViewer->getTimeline()->currentFrame(), _imp->lastPlaybackDirection);
+    }
 }
 
 
@@ -2409,6 +2889,10 @@ RenderEngine::quitEngine()
     if (_imp->currentFrameScheduler) {
         _imp->currentFrameScheduler->quitThread();
     }
+    
+    if (_imp->backgroundCacheScheduler) {
+        _imp->backgroundCacheScheduler->quitThreads();
+    }
 }
 
 bool
@@ -2423,8 +2907,12 @@ RenderEngine::hasThreadsAlive() const
     if (_imp->currentFrameScheduler) {
         currentFrameSchedulerRunning = _imp->currentFrameScheduler->isRunning();
     }
+    bool backgroundCacheSchedulerRunning = false;
+    if (_imp->backgroundCacheScheduler) {
+        backgroundCacheSchedulerRunning = _imp->backgroundCacheScheduler->hasThreadsAlive();
+    }
     
-    return schedulerRunning || currentFrameSchedulerRunning;
+    return schedulerRunning || currentFrameSchedulerRunning || backgroundCacheSchedulerRunning;
 }
 
 bool
@@ -2448,6 +2936,9 @@ RenderEngine::hasThreadsWorking() const
 void
 RenderEngine::abortRendering(bool blocking)
 {
+    if (_imp->backgroundCacheScheduler) {
+        _imp->backgroundCacheScheduler->abortRendering();
+    }
     if (_imp->scheduler) {
         _imp->scheduler->abortRendering(blocking);
     }
@@ -2890,3 +3381,331 @@ ViewerCurrentFrameRequestScheduler::renderCurrentFrame(bool canAbort)
         }
     }
 }
+
+////////////////////////ViewerBackgroundCacheScheduler////////////////////////
+
+class ViewerBackgroundCacheThread : public QThread
+{
+    ViewerBackgroundCacheSchedulerPrivate* _imp;
+    int _generation;
+    
+public:
+    
+    ViewerBackgroundCacheThread(ViewerBackgroundCacheSchedulerPrivate* imp,int generation)
+    : QThread()
+    , _imp(imp)
+    , _generation(generation)
+    {
+        setObjectName("ViewerBackgroundCacheThread");
+    }
+    
+    virtual ~ViewerBackgroundCacheThread()
+    {
+        
+    }
+    
+private:
+    
+    virtual void run() OVERRIDE FINAL;
+};
+
+struct ViewerBackgroundCacheSchedulerPrivate
+{
+    ViewerInstance* viewer;
+    
+    mutable QMutex framesMutex; //< protects all the fields below
+    QWaitCondition framesCond;
+    std::list<int> framesToRender;
+    
+    ///The abort flag of the frames rendered since the last call to restart(), it is replaced on each call
+    boost::shared_ptr<QAtomicInt> abortFlag;
+    
+    ///Measures the time elapsed since the last call to restart()
+    QElapsedTimer idleTimer;
+    
+    ///The size in bytes of the last texture pre-rendered, to anticipate whether the next one fits in the cache
+    U64 lastFrameBytes;
+    
+    int nThreadsWorking;
+    
+    ///Incremented by quitThreads(): threads started with another generation must quit
+    int threadsGeneration;
+    std::vector<ViewerBackgroundCacheThread*> threads;
+    
+    ///Threads asked to quit which may still be aborting their frame
+    std::list<ViewerBackgroundCacheThread*> quittingThreads;
+    
+    ViewerBackgroundCacheSchedulerPrivate(ViewerInstance* viewer)
+    : viewer(viewer)
+    , framesMutex()
+    , framesCond()
+    , framesToRender()
+    , abortFlag(new QAtomicInt(0))
+    , idleTimer()
+    , lastFrameBytes(0)
+    , nThreadsWorking(0)
+    , threadsGeneration(0)
+    , threads()
+    , quittingThreads()
+    {
+        idleTimer.start();
+    }
+    
+    ///Must be called with framesMutex locked
+    void abortCurrentFrames()
+    {
+        abortFlag->fetchAndStoreOrdered(1);
+        abortFlag.reset(new QAtomicInt(0));
+        framesToRender.clear();
+    }
+    
+    bool isViewerCacheFull() const
+    {
+        return appPTR->getViewerCacheMemorySize() + lastFrameBytes > appPTR->getViewerCacheMaximumMemorySize();
+    }
+    
+    ///Must be called with framesMutex locked
+    void deleteFinishedThreads()
+    {
+        for (std::list<ViewerBackgroundCacheThread*>::iterator it = quittingThreads.begin(); it != quittingThreads.end();) {
+            if ( (*it)->isFinished() ) {
+                ///The thread returned from run(), this does not block
+                (*it)->wait();
+                delete *it;
+                it = quittingThreads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    void runThread(int generation);
+    
+    /**
+     * @brief Renders the given frame into the viewer cache, the result is never displayed.
+     * Returns the size of the texture rendered, or 0 if the frame was already cached or could not be rendered.
+     **/
+    U64 renderFrame(int time,const boost::shared_ptr<QAtomicInt>& abortFlag);
+};
+
+void
+ViewerBackgroundCacheScheduler::getFramesToPreRender(int time,
+                                                     int first,
+                                                     int last,
+                                                     OutputSchedulerThread::RenderDirectionEnum direction,
+                                                     std::list<int>* frames)
+{
+    int step = direction == OutputSchedulerThread::eRenderDirectionForward ? 1 : -1;
+    int ahead = time + step;
+    int behind = time - step;
+    
+    while ((ahead >= first && ahead <= last) || (behind >= first && behind <= last)) {
+        for (int i = 0; i < 2 && ahead >= first && ahead <= last; ++i, ahead += step) {
+            frames->push_back(ahead);
+        }
+        if (behind >= first && behind <= last) {
+            frames->push_back(behind);
+            behind -= step;
+        }
+    }
+}
+
+void
+ViewerBackgroundCacheThread::run()
+{
+    _imp->runThread(_generation);
+}
+
+void
+ViewerBackgroundCacheSchedulerPrivate::runThread(int generation)
+{
+    QMutexLocker k(&framesMutex);
+    for (;;) {
+        
+        if (generation != threadsGeneration) {
+            return;
+        }
+        
+        if (framesToRender.empty()) {
+            framesCond.wait(&framesMutex);
+            continue;
+        }
+        
+        ///Wait for the user to leave the viewer alone
+        qint64 idleTime = idleTimer.elapsed();
+        if (idleTime < NATRON_BACKGROUND_CACHING_IDLE_DELAY_MS) {
+            framesCond.wait(&framesMutex, (unsigned long)(NATRON_BACKGROUND_CACHING_IDLE_DELAY_MS - idleTime));
+            continue;
+        }
+        
+        ///Do not evict the frames that were already cached to make room for the frames pre-rendered
+        if (isViewerCacheFull()) {
+            framesToRender.clear();
+            continue;
+        }
+        
+        int time = framesToRender.front();
+        framesToRender.pop_front();
+        boost::shared_ptr<QAtomicInt> frameAbortFlag = abortFlag;
+        ++nThreadsWorking;
+        
+        k.unlock();
+        U64 bytes = renderFrame(time, frameAbortFlag);
+        k.relock();
+        
+        --nThreadsWorking;
+        if (bytes > 0) {
+            lastFrameBytes = bytes;
+        }
+    }
+}
+
+U64
+ViewerBackgroundCacheSchedulerPrivate::renderFrame(int time,
+                                                   const boost::shared_ptr<QAtomicInt>& frameAbortFlag)
+{
+    if ( !viewer->getUiContext() || (int)*frameAbortFlag ) {
+        return 0;
+    }
+    
+    int viewsCount = viewer->getRenderViewsCount();
+    int view = viewsCount > 0 ? viewer->getViewerCurrentView() : 0;
+    U64 viewerHash = viewer->getHash();
+    boost::shared_ptr<ViewerInstance::ViewerArgs> args[2];
+    
+    Natron::StatusEnum status[2] = {
+        eStatusFailed, eStatusFailed
+    };
+    
+    for (int i = 0; i < 2; ++i) {
+        args[i].reset(new ViewerInstance::ViewerArgs);
+        args[i]->backgroundAbort = frameAbortFlag;
+        status[i] = viewer->getRenderViewerArgsAndCheckCache(time, true, true, view, i, viewerHash, args[i].get());
+        
+        ///The texture is already in the cache
+        if (args[i]->params && args[i]->params->ramBuffer) {
+            args[i].reset();
+        }
+    }
+    
+    if ( (status[0] == eStatusFailed && status[1] == eStatusFailed) ||
+         status[0] == eStatusReplyDefault || status[1] == eStatusReplyDefault ||
+         (!args[0] && !args[1]) ) {
+        return 0;
+    }
+    
+    U64 bytes = 0;
+    for (int i = 0; i < 2; ++i) {
+        if (args[i] && args[i]->params) {
+            bytes += args[i]->params->bytesCount;
+        }
+    }
+    
+    Natron::StatusEnum stat;
+    try {
+        stat = viewer->renderViewer(view, false, true, viewerHash, true, args);
+    } catch (...) {
+        stat = eStatusFailed;
+    }
+    
+    ///Errors are reported when rendering the current frame, not here
+    return (stat == eStatusFailed || (int)*frameAbortFlag) ? 0 : bytes;
+}
+
+ViewerBackgroundCacheScheduler::ViewerBackgroundCacheScheduler(ViewerInstance* viewer)
+: _imp(new ViewerBackgroundCacheSchedulerPrivate(viewer))
+{
+    
+}
+
+ViewerBackgroundCacheScheduler::~ViewerBackgroundCacheScheduler()
+{
+    quitThreads();
+    
+    ///The threads use the viewer: they must be done before it is deleted. They were aborted before, so this should not wait long
+    std::list<ViewerBackgroundCacheThread*> threads;
+    {
+        QMutexLocker k(&_imp->framesMutex);
+        threads.swap(_imp->quittingThreads);
+    }
+    for (std::list<ViewerBackgroundCacheThread*>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        (*it)->wait();
+        delete *it;
+    }
+}
+
+void
+ViewerBackgroundCacheScheduler::restart(int time,
+                                        OutputSchedulerThread::RenderDirectionEnum direction)
+{
+    std::list<int> frames;
+    
+    ///Textures are only stored in the viewer cache when the user RoI and the auto-contrast are disabled
+    if ( appPTR->getCurrentSettings()->isBackgroundViewerCachingEnabled() && _imp->viewer->isUsingViewerCache() ) {
+        int first,last;
+        _imp->viewer->getTimelineBounds(&first, &last);
+        getFramesToPreRender(time, first, last, direction, &frames);
+    }
+    
+    QMutexLocker k(&_imp->framesMutex);
+    _imp->abortCurrentFrames();
+    if ( frames.empty() ) {
+        return;
+    }
+    _imp->framesToRender.swap(frames);
+    _imp->idleTimer.restart();
+    
+    if ( _imp->threads.empty() ) {
+        _imp->deleteFinishedThreads();
+        ///Leave at least half of the cores to the interactive renders
+        int nThreads = std::max(1, QThread::idealThreadCount() / 2);
+        for (int i = 0; i < nThreads; ++i) {
+            ViewerBackgroundCacheThread* thread = new ViewerBackgroundCacheThread(_imp.get(), _imp->threadsGeneration);
+            _imp->threads.push_back(thread);
+            thread->start(QThread::LowestPriority);
+        }
+    } else {
+        _imp->framesCond.wakeAll();
+    }
+}
+
+void
+ViewerBackgroundCacheScheduler::abortRendering()
+{
+    QMutexLocker k(&_imp->framesMutex);
+    _imp->abortCurrentFrames();
+}
+
+void
+ViewerBackgroundCacheScheduler::quitThreads()
+{
+    QMutexLocker k(&_imp->framesMutex);
+    ///The frames being rendered check the abort flag cooperatively, do not wait for them
+    _imp->abortCurrentFrames();
+    ++_imp->threadsGeneration;
+    _imp->framesCond.wakeAll();
+    _imp->quittingThreads.insert( _imp->quittingThreads.end(), _imp->threads.begin(), _imp->threads.end() );
+    _imp->threads.clear();
+    _imp->deleteFinishedThreads();
+}
+
+bool
+ViewerBackgroundCacheScheduler::hasThreadsAlive() const
+{
+    QMutexLocker k(&_imp->framesMutex);
+    for (std::size_t i = 0; i < _imp->threads.size(); ++i) {
+        if ( _imp->threads[i]->isRunning() ) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+bool
+ViewerBackgroundCacheScheduler::hasThreadsWorking() const
+{
+    QMutexLocker k(&_imp->framesMutex);
+    
+    return _imp->nThreadsWorking > 0 || !_imp->framesToRender.empty();
+}
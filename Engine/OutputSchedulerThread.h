@@ -16,6 +16,8 @@
 // "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
 #include <Python.h>
 
+#include <list>
+
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -370,6 +372,24 @@ protected:
      **/
     virtual void onRenderStopped(bool /*aborted*/) {}
     
+    /**
+     * @brief Called by stopRender() once all render threads are done and before the end of the sequence
+     * is notified to the output effect. Schedulers processing frames asynchronously must wait for them here.
+     * @param aborted If true, frames that were not processed yet may be dropped.
+     **/
+    virtual void finishProcessingFrames(bool /*aborted*/) {}
+    
+    /**
+     * @brief Returns true if processFrame() only queues the frames. The scheduler thread then does not call
+     * notifyFrameRendered() itself: it must be called once the frames are actually processed.
+     **/
+    virtual bool isProcessingFramesAsynchronously() const { return false; }
+    
+    /**
+     * @brief Returns true if abortRendering() was called for the current render.
+     **/
+    bool isAbortRequested();
+    
     RenderEngine* getEngine() const;
     
     void runCallback(const QString& callback);
@@ -410,6 +430,12 @@ private:
 
     void stopRender();
     
+    /**
+     * @brief Reports how much the buffer of frames rendered ahead was used during the render and how long
+     * the render threads waited for it to drain.
+     **/
+    void reportBufferStatistics();
+    
     void renderInternal();
     
     boost::scoped_ptr<OutputSchedulerThreadPrivate> _imp;
@@ -419,6 +445,7 @@ private:
 namespace Natron {
 class OutputEffectInstance;
 }
+class SequentialWriterThread;
 class DefaultScheduler : public OutputSchedulerThread
 {
 public:
@@ -427,9 +454,26 @@ public:
     
     virtual ~DefaultScheduler();
     
+    /**
+     * @brief Called by the render threads once they rendered the input of a sequential writer, with the time
+     * spent rendering it and converting it to the format expected by the writer.
+     **/
+    void notifyInputFrameRendered(U64 renderTimeUs,U64 conversionTimeUs);
 
 private:
     
+    friend class SequentialWriterThread;
+    
+    /**
+     * @brief Calls the render action of the writer on the given frames. For sequential writers this is
+     * called by the writer thread, in the order the frames were handed to processFrame().
+     **/
+    void writeFrames(const BufferedFrames& frames);
+    
+    virtual void finishProcessingFrames(bool aborted) OVERRIDE FINAL;
+    
+    virtual bool isProcessingFramesAsynchronously() const OVERRIDE FINAL WARN_UNUSED_RETURN;
+    
     virtual void processFrame(const BufferedFrames& frames) OVERRIDE FINAL;
     
     virtual void timelineStepOne(RenderDirectionEnum direction) OVERRIDE FINAL;
@@ -453,6 +497,9 @@ private:
 
     
     Natron::OutputEffectInstance* _effect;
+    
+    ///Encodes the frames of sequential writers while the render threads keep rendering. Only created for sequential writers.
+    boost::scoped_ptr<SequentialWriterThread> _writerThread;
 };
 
 
@@ -539,6 +586,61 @@ private:
     
 };
 
+/**
+ * @brief Pre-renders the frames around the current frame into the viewer cache while the viewer is idle, at the current
+ * mipmap level, so that scrubbing and playback around the playhead are served from the cache.
+ * Frames are rendered by low priority threads, ahead of the current frame in the direction of the last playback first.
+ * Each call to restart() or abortRendering() aborts the frames being pre-rendered immediately.
+ * Pre-rendering stops when the viewer cache is full, i.e: when it reaches the playback cache RAM percentage.
+ **/
+struct ViewerBackgroundCacheSchedulerPrivate;
+class ViewerBackgroundCacheScheduler
+{
+public:
+    
+    ViewerBackgroundCacheScheduler(ViewerInstance* viewer);
+    
+    ~ViewerBackgroundCacheScheduler();
+    
+    /**
+     * @brief Aborts the frames being pre-rendered and pre-renders the frames around time once the viewer has been idle
+     * for a while. MT-safe
+     **/
+    void restart(int time,OutputSchedulerThread::RenderDirectionEnum direction);
+    
+    /**
+     * @brief Aborts the frames being pre-rendered and forgets the frames left to pre-render. MT-safe
+     **/
+    void abortRendering();
+    
+    /**
+     * @brief Aborts the frames being pre-rendered and tells all the threads to quit, without waiting for them: they only
+     * finish aborting their current frame. Threads that are done are deleted by the next calls, the others by the destructor.
+     **/
+    void quitThreads();
+    
+    /**
+     * @brief Returns true if threads which were not asked to quit are running.
+     **/
+    bool hasThreadsAlive() const;
+    
+    bool hasThreadsWorking() const;
+    
+    /**
+     * @brief Returns the frames in [first,last] around time in the order they should be pre-rendered:
+     * two frames ahead in the given direction for each frame behind.
+     **/
+    static void getFramesToPreRender(int time,
+                                     int first,
+                                     int last,
+                                     OutputSchedulerThread::RenderDirectionEnum direction,
+                                     std::list<int>* frames);
+    
+private:
+    
+    boost::scoped_ptr<ViewerBackgroundCacheSchedulerPrivate> _imp;
+};
+
 
 /**
  * @brief This class manages multiple OutputThreadScheduler so that each render request gets processed as soon as possible.
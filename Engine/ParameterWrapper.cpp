@@ -745,7 +745,7 @@ ColorParam::get(int frame) const
     ret.r = _colorKnob->getValueAtTime(frame, 0);
     ret.g = _colorKnob->getValueAtTime(frame, 1);
     ret.b = _colorKnob->getValueAtTime(frame, 2);
-    ret.a = _colorKnob->getDimension() == 4 ? _colorKnob->getValueAtTime(frame, 2) : 1.;
+    ret.a = _colorKnob->getDimension() == 4 ? _colorKnob->getValueAtTime(frame, 3) : 1.;
     return ret;
 }
 
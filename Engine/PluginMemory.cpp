@@ -16,29 +16,60 @@
 #include "PluginMemory.h"
 
 #include <stdexcept>
-#include <vector>
+#include <cassert>
 
 #include "Global/Macros.h"
 CLANG_DIAG_OFF(deprecated)
 #include <QMutex>
+#include <QAtomicPointer>
 CLANG_DIAG_ON(deprecated)
+#include "Engine/AppManager.h"
 #include "Engine/EffectInstance.h"
+#include "Engine/MemoryPool.h"
 
 
 struct PluginMemory::Implementation
 {
     Implementation(Natron::EffectInstance* effect_)
-        : data()
+        : data(0)
+          , nBytes(0)
           , locked(0)
           , mutex()
           , effect(effect_)
     {
     }
 
-    std::vector<char> data;
+    ///The block, allocated by the MemoryPool. It is only changed under the mutex while the memory is not locked,
+    ///so that getPtr() can read it without taking the mutex.
+    QAtomicPointer<char> data;
+    std::size_t nBytes; //< the size requested by the plug-in
     int locked;
-    QMutex mutex;
+    QMutex mutex; //< protects nBytes, locked and the writes of data
     Natron::EffectInstance* effect;
+
+    char* getData() const
+    {
+#if QT_VERSION < 0x050000
+        return data;
+#else
+        return data.load();
+#endif
+    }
+
+    ///Gives the block back to the pool and stops accounting it. Must be called under the mutex.
+    void release()
+    {
+        if (!nBytes) {
+            return;
+        }
+        Natron::MemoryPool::release(getData(), nBytes);
+        data.fetchAndStoreOrdered(0);
+        if (effect) {
+            effect->unregisterPluginMemory(nBytes);
+        }
+        appPTR->registerPluginMemoryInNodeCache( -(qint64)nBytes );
+        nBytes = 0;
+    }
 };
 
 PluginMemory::PluginMemory(Natron::EffectInstance* effect)
@@ -54,6 +85,10 @@ PluginMemory::~PluginMemory()
     if (_imp->effect) {
         _imp->effect->removePluginMemoryPointer(this);
     }
+    QMutexLocker l(&_imp->mutex);
+    ///The effect may be being destroyed (see EffectInstance::clearPluginMemoryChunks()): only give the block back
+    _imp->effect = 0;
+    _imp->release();
 }
 
 bool
@@ -63,35 +98,58 @@ PluginMemory::alloc(size_t nBytes)
 
     if (_imp->locked) {
         return false;
-    } else {
-        _imp->data.resize(nBytes);
+    }
+    if ( _imp->nBytes && ( Natron::MemoryPool::getSizeClass(_imp->nBytes) == Natron::MemoryPool::getSizeClass(nBytes) ) ) {
+        ///The block already held fits: keep it rather than going through the pool
         if (_imp->effect) {
-            _imp->effect->registerPluginMemory( _imp->data.size() );
+            _imp->effect->unregisterPluginMemory(_imp->nBytes);
+            _imp->effect->registerPluginMemory(nBytes);
         }
+        appPTR->registerPluginMemoryInNodeCache( (qint64)nBytes - (qint64)_imp->nBytes );
+        _imp->nBytes = nBytes;
 
         return true;
     }
+    _imp->release();
+    if (!nBytes) {
+        return true;
+    }
+
+    ///As for the cache entries, make room for the block before allocating it
+    appPTR->checkCacheFreeMemoryIsGoodEnough();
+
+    ///The memory is not initialized: the OpenFX specification does not require it and plug-ins
+    ///allocating scratch buffers for each render would pay for it
+    char* block = (char*)Natron::MemoryPool::allocate(nBytes); // may throw std::bad_alloc
+    _imp->data.fetchAndStoreOrdered(block);
+    _imp->nBytes = nBytes;
+    if (_imp->effect) {
+        _imp->effect->registerPluginMemory(nBytes);
+    }
+    appPTR->registerPluginMemoryInNodeCache( (qint64)nBytes );
+    l.unlock();
+
+    ///The plug-in memory counts against the budget of the node cache: evict the images it pushed out of it
+    appPTR->clearExceedingEntriesFromNodeCache();
+
+    return true;
 }
 
 void
 PluginMemory::freeMem()
 {
     QMutexLocker l(&_imp->mutex);
-    if (_imp->effect) {
-        _imp->effect->unregisterPluginMemory( _imp->data.size() );
-    }
-    _imp->data.clear();
+
+    _imp->release();
     _imp->locked = 0;
 }
 
 void*
 PluginMemory::getPtr()
 {
-    QMutexLocker l(&_imp->mutex);
-
-    assert(_imp->data.size() == 0 || (_imp->data.size() > 0 && &_imp->data.front()));
-
-    return (void*)( &_imp->data.front() );
+    ///No lock: the block of a locked memory cannot change (see alloc()), and the plug-ins may only
+    ///access the memory while it is locked
+    return (void*)_imp->getData();
 }
 
 void
@@ -36,18 +36,20 @@ public:
      * can clear this memory when in situation of low memory or when the node is no longer used.
      * On the other hand if the parameter is set to NULL, the memory will not be registered and will live
      * until the plug-in decides to free the memory.
+     * In both cases the memory is served by the MemoryPool and counts against the budget of the node cache.
      **/
     PluginMemory(Natron::EffectInstance* effect);
 
     ~PluginMemory();
 
     ///throws std::bad_alloc if the allocation failed. Returns false if the memory is already locked.
-    ///Returns true on success.
+    ///Returns true on success. The memory is aligned on NATRON_MEMORY_POOL_ALIGNMENT bytes and is not initialized.
     bool alloc(size_t nBytes);
 
     ///Frees the memory, it doesn't have to be unlocked.
     void freeMem();
 
+    ///Does not take any lock: it may be called concurrently with the other functions as long as the memory is locked.
     void* getPtr();
 
     void lock();
@@ -0,0 +1,236 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "Profiler.h"
+
+#include <list>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThreadStorage>
+
+#ifndef Q_MOC_RUN
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "Engine/EffectInstance.h"
+
+using namespace Natron;
+
+namespace {
+
+struct ProfilerEvent
+{
+    std::string nodeName;
+    const char* action;
+    U64 start;
+    U64 duration;
+};
+
+/**
+ * @brief The events recorded by a thread. The mutex is only contended while the trace is written or cleared.
+ * The buffer outlives its thread, so that the events of the threads which are done can still be written.
+ **/
+struct ThreadEvents
+{
+    QMutex mutex;
+    int threadIndex;
+    std::string threadName;
+    std::vector<ProfilerEvent> events;
+
+    ThreadEvents(int threadIndex,
+                 const std::string & threadName)
+    : mutex()
+    , threadIndex(threadIndex)
+    , threadName(threadName)
+    , events()
+    {
+    }
+};
+
+typedef boost::shared_ptr<ThreadEvents> ThreadEventsPtr;
+
+struct ProfilerData
+{
+    QAtomicInt enabled;
+    QElapsedTimer clock;
+    QMutex threadsMutex; //< protects threads
+    std::list<ThreadEventsPtr> threads;
+
+    ProfilerData()
+    : enabled()
+    , clock()
+    , threadsMutex()
+    , threads()
+    {
+        clock.start();
+    }
+};
+
+ProfilerData gProfiler;
+QThreadStorage<ThreadEventsPtr> gThreadEvents;
+
+ThreadEvents*
+getThreadEvents()
+{
+    if ( !gThreadEvents.hasLocalData() ) {
+        QMutexLocker l(&gProfiler.threadsMutex);
+        int index = (int)gProfiler.threads.size();
+        std::string name = QThread::currentThread()->objectName().toStdString();
+        if ( name.empty() ) {
+            std::stringstream ss;
+            ss << "Thread " << index;
+            name = ss.str();
+        }
+        ThreadEventsPtr events( new ThreadEvents(index, name) );
+        gProfiler.threads.push_back(events);
+        gThreadEvents.setLocalData(events);
+    }
+
+    return gThreadEvents.localData().get();
+}
+
+void
+writeJSONString(std::ostream & os,
+                const std::string & str)
+{
+    os << '"';
+    for (std::size_t i = 0; i < str.size(); ++i) {
+        unsigned char c = (unsigned char)str[i];
+        if ( (c == '"') || (c == '\\') ) {
+            os << '\\' << (char)c;
+        } else if (c < 0x20) {
+            const char* hex = "0123456789abcdef";
+            os << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+        } else {
+            os << (char)c;
+        }
+    }
+    os << '"';
+}
+
+} // anon namespace
+
+bool
+Profiler::isEnabled()
+{
+    return (int)gProfiler.enabled != 0;
+}
+
+void
+Profiler::setEnabled(bool enabled)
+{
+    gProfiler.enabled.fetchAndStoreOrdered(enabled ? 1 : 0);
+}
+
+U64
+Profiler::getTimestamp()
+{
+    return (U64)gProfiler.clock.nsecsElapsed() / 1000;
+}
+
+void
+Profiler::addEvent(const std::string & nodeName,
+                   const char* action,
+                   U64 startUs,
+                   U64 endUs)
+{
+    ThreadEvents* events = getThreadEvents();
+    ProfilerEvent e;
+
+    e.nodeName = nodeName;
+    e.action = action;
+    e.start = startUs;
+    e.duration = endUs > startUs ? endUs - startUs : 0;
+
+    QMutexLocker l(&events->mutex);
+    events->events.push_back(e);
+}
+
+void
+Profiler::clear()
+{
+    QMutexLocker l(&gProfiler.threadsMutex);
+
+    for (std::list<ThreadEventsPtr>::iterator it = gProfiler.threads.begin(); it != gProfiler.threads.end(); ++it) {
+        QMutexLocker k(&(*it)->mutex);
+        (*it)->events.clear();
+    }
+}
+
+std::size_t
+Profiler::getEventsCount()
+{
+    QMutexLocker l(&gProfiler.threadsMutex);
+    std::size_t count = 0;
+
+    for (std::list<ThreadEventsPtr>::iterator it = gProfiler.threads.begin(); it != gProfiler.threads.end(); ++it) {
+        QMutexLocker k(&(*it)->mutex);
+        count += (*it)->events.size();
+    }
+
+    return count;
+}
+
+bool
+Profiler::writeChromeTrace(const std::string & filename,
+                           std::string* error)
+{
+    std::ofstream ofile( filename.c_str() );
+
+    if ( !ofile.good() ) {
+        *error = "Failed to open " + filename + " for writing";
+
+        return false;
+    }
+
+    ///See the "Trace Event Format" document: each action is a complete ("X") event, timestamps are in microseconds
+    ofile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    QMutexLocker l(&gProfiler.threadsMutex);
+    for (std::list<ThreadEventsPtr>::iterator it = gProfiler.threads.begin(); it != gProfiler.threads.end(); ++it) {
+        QMutexLocker k(&(*it)->mutex);
+        if ( (*it)->events.empty() ) {
+            continue;
+        }
+        ofile << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << (*it)->threadIndex << ",\"args\":{\"name\":";
+        writeJSONString(ofile, (*it)->threadName);
+        ofile << "}}";
+        first = false;
+        for (std::vector<ProfilerEvent>::const_iterator e = (*it)->events.begin(); e != (*it)->events.end(); ++e) {
+            ofile << ",\n{\"name\":";
+            writeJSONString(ofile, e->nodeName + ' ' + e->action);
+            ofile << ",\"cat\":\"" << e->action << "\",\"ph\":\"X\",\"ts\":" << e->start << ",\"dur\":" << e->duration
+                  << ",\"pid\":1,\"tid\":" << (*it)->threadIndex << ",\"args\":{\"node\":";
+            writeJSONString(ofile, e->nodeName);
+            ofile << "}}";
+        }
+    }
+    ofile << "\n]}\n";
+    ofile.close();
+    if ( ofile.fail() ) {
+        *error = "Failed to write " + filename;
+
+        return false;
+    }
+
+    return true;
+}
+
+void
+ProfilerScope::end()
+{
+    Profiler::addEvent( _effect->getScriptName_mt_safe(), _action, _start, Profiler::getTimestamp() );
+}
@@ -0,0 +1,128 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_PROFILER_H_
+#define NATRON_ENGINE_PROFILER_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <string>
+
+#ifndef Q_MOC_RUN
+#include <boost/noncopyable.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+
+///Names of the actions recorded by the profiler, used as event categories in the trace
+#define kProfilerActionRenderRoI "renderRoI"
+#define kProfilerActionGetRoD "getRoD"
+#define kProfilerActionGetRoI "getRoI"
+#define kProfilerActionIsIdentity "isIdentity"
+#define kProfilerActionRender "render"
+#define kProfilerActionConvert "convert"
+#define kProfilerActionCacheHit "cacheHit"
+#define kProfilerActionCacheMiss "cacheMiss"
+#define kProfilerActionWaitImage "waitImageBeingRendered"
+
+namespace Natron {
+
+class EffectInstance;
+
+/**
+ * @brief An opt-in profiler of the render graph: when enabled, it records the wall time of each action of each node
+ * (see the kProfilerAction* names above) along with the thread that ran it, and dumps them as a Chrome trace
+ * which can be opened in chrome://tracing or https://ui.perfetto.dev
+ *
+ * Each thread records its events in its own buffer, so that recording never contends with other render threads.
+ * When disabled, recording an action costs a single atomic read.
+ *
+ * Thread-safety: all functions are MT-safe.
+ **/
+class Profiler
+{
+public:
+
+    static bool isEnabled();
+
+    static void setEnabled(bool enabled);
+
+    /**
+     * @brief Returns the time in microseconds elapsed since the profiler was first used. This is a monotonic clock.
+     **/
+    static U64 getTimestamp();
+
+    /**
+     * @brief Records an action of the node nodeName which ran in the calling thread from startUs to endUs.
+     * action must be a string literal, since only the pointer is stored.
+     **/
+    static void addEvent(const std::string & nodeName, const char* action, U64 startUs, U64 endUs);
+
+    /**
+     * @brief Removes all the events recorded so far.
+     **/
+    static void clear();
+
+    /**
+     * @brief Returns the number of events recorded so far, by all threads.
+     **/
+    static std::size_t getEventsCount();
+
+    /**
+     * @brief Writes all the events recorded so far in the Chrome trace event format (JSON).
+     * Returns false and sets error if the file could not be written.
+     **/
+    static bool writeChromeTrace(const std::string & filename, std::string* error);
+};
+
+/**
+ * @brief Records the time spent in a scope as an action of the given effect. Does nothing if the profiler
+ * was disabled when the scope was entered.
+ **/
+class ProfilerScope
+    : boost::noncopyable
+{
+public:
+
+    ProfilerScope(const EffectInstance* effect,
+                  const char* action)
+    : _effect(0)
+    , _action(action)
+    , _start(0)
+    {
+        if ( Profiler::isEnabled() ) {
+            _effect = effect;
+            _start = Profiler::getTimestamp();
+        }
+    }
+
+    ~ProfilerScope()
+    {
+        if (_effect) {
+            end();
+        }
+    }
+
+    ///Changes the action recorded when the scope ends, e.g: once the result of a cache lookup is known
+    void setAction(const char* action)
+    {
+        _action = action;
+    }
+
+private:
+
+    void end();
+
+    const EffectInstance* _effect;
+    const char* _action;
+    U64 _start;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_PROFILER_H_
@@ -15,6 +15,8 @@
 #include "Project.h"
 
 #include <fstream>
+#include <sstream>
+#include <set>
 #include <algorithm>
 #include <ios>
 #include <cstdlib> // strtoul
@@ -38,6 +40,12 @@
 #include <QHostInfo>
 #include <QFileInfo>
 
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+CLANG_DIAG_OFF(unused-parameter)
+#include <boost/archive/binary_iarchive.hpp>
+CLANG_DIAG_ON(unused-parameter)
+#include <boost/archive/binary_oarchive.hpp>
+#endif
 
 #include "Engine/AppManager.h"
 #include "Engine/AppInstance.h"
@@ -47,6 +55,7 @@
 #include "Engine/Node.h"
 #include "Engine/ViewerInstance.h"
 #include "Engine/ProjectSerialization.h"
+#include "Engine/ProjectBinaryFormat.h"
 #include "Engine/Settings.h"
 #include "Engine/KnobFile.h"
 #include "Engine/StandardPaths.h"
@@ -104,9 +113,7 @@ Project::Project(AppInstance* appInstance)
 Project::~Project()
 {
     ///wait for all autosaves to finish
-    for (std::list<boost::shared_ptr<QFutureWatcher<void> > >::iterator it = _imp->autoSaveFutures.begin(); it != _imp->autoSaveFutures.end(); ++it) {
-        (*it)->waitForFinished();
-    }
+    _imp->waitForAutoSaveWrites();
     
     ///Don't clear autosaves if the program is shutting down by user request.
     ///Even if the user replied she/he didn't want to save the current work, we keep an autosave of it.
@@ -219,15 +226,17 @@ Project::loadProjectInternal(const QString & path,
     }
     
     bool ret = false;
+    ///The format is recognized by the content of the file: auto-saves are binary whatever their extension
+    bool binary = isBinaryProjectFile( filePath.toStdString() );
     std::ifstream ifile;
     try {
         ifile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        ifile.open(filePath.toStdString().c_str(),std::ifstream::in);
+        ifile.open(filePath.toStdString().c_str(),binary ? std::ifstream::in | std::ifstream::binary : std::ifstream::in);
     } catch (const std::ifstream::failure & e) {
         throw std::runtime_error( std::string("Exception occured when opening file ") + filePath.toStdString() + ": " + e.what() );
     }
     
-    if (NATRON_VERSION_MAJOR == 1 && NATRON_VERSION_MINOR == 0 && NATRON_VERSION_REVISION == 0) {
+    if (!binary && NATRON_VERSION_MAJOR == 1 && NATRON_VERSION_MINOR == 0 && NATRON_VERSION_REVISION == 0) {
         
         ///Try to determine if the project was made during Natron v1.0.0 - RC2 or RC3 to detect a bug we introduced at that time
         ///in the BezierCP class serialisation
@@ -258,21 +267,25 @@ Project::loadProjectInternal(const QString & path,
             QMutexLocker k(&_imp->isLoadingProjectMutex);
             _imp->isLoadingProjectInternal = true;
         }
-        boost::archive::xml_iarchive iArchive(ifile);
-        bool bgProject;
-        iArchive >> boost::serialization::make_nvp("Background_project", bgProject);
-        ProjectSerialization projectSerializationObj( getApp() );
-        iArchive >> boost::serialization::make_nvp("Project", projectSerializationObj);
-        
-        ret = load(projectSerializationObj,name,path,isAutoSave,realFilePath);
-        
-        {
-            QMutexLocker k(&_imp->isLoadingProjectMutex);
-            _imp->isLoadingProjectInternal = false;
-        }
-        
-        if (!bgProject) {
-            getApp()->loadProjectGui(iArchive);
+        if (binary) {
+            ret = loadBinaryProject(ifile,name,path,isAutoSave,realFilePath);
+        } else {
+            boost::archive::xml_iarchive iArchive(ifile);
+            bool bgProject;
+            iArchive >> boost::serialization::make_nvp("Background_project", bgProject);
+            ProjectSerialization projectSerializationObj( getApp() );
+            iArchive >> boost::serialization::make_nvp("Project", projectSerializationObj);
+            
+            ret = load(projectSerializationObj,name,path,isAutoSave,realFilePath);
+            
+            {
+                QMutexLocker k(&_imp->isLoadingProjectMutex);
+                _imp->isLoadingProjectInternal = false;
+            }
+            
+            if (!bgProject) {
+                getApp()->loadProjectGui(iArchive);
+            }
         }
     } catch (const boost::archive::archive_exception & e) {
         ifile.close();
@@ -326,11 +339,310 @@ Project::loadProjectInternal(const QString & path,
     return ret;
 }
 
+template <typename T>
+static void
+encodeBinaryRecord(const T & obj,
+                   const char* name,
+                   std::string* payload)
+{
+    std::ostringstream ss;
+    {
+        boost::archive::binary_oarchive oArchive(ss);
+        oArchive << boost::serialization::make_nvp(name, obj);
+    }
+    *payload = ss.str();
+}
+
+template <typename T>
+static void
+decodeBinaryRecord(const std::string & payload,
+                   const char* name,
+                   T* obj)
+{
+    std::istringstream ss(payload);
+    boost::archive::binary_iarchive iArchive(ss);
+    iArchive >> boost::serialization::make_nvp(name, *obj);
+}
+
+///Decodes the record of a top-level node and creates the node. It is connected by NodeCollectionSerialization::restoreLinks
+static bool
+restoreBinaryNode(const std::string & payload,
+                  const boost::shared_ptr<NodeCollection> & group,
+                  std::list< boost::shared_ptr<NodeSerialization> >* serializedNodes,
+                  NodeCollectionSerialization::ParentsToReconnectMap* parentsToReconnect,
+                  bool* hasProjectAWriter)
+{
+    boost::shared_ptr<NodeSerialization> nodeSerialization(new NodeSerialization);
+    decodeBinaryRecord(payload, "item", nodeSerialization.get());
+    serializedNodes->push_back(nodeSerialization);
+
+    return NodeCollectionSerialization::restoreNode(nodeSerialization, *serializedNodes, group, hasProjectAWriter, parentsToReconnect);
+}
+
+bool
+Project::loadBinaryProject(std::istream & stream,
+                           const QString & name,
+                           const QString & path,
+                           bool isAutoSave,
+                           const QString & realFilePath)
+{
+    ProjectBinaryReader reader(stream);
+    ProjectRecordTypeEnum type;
+    std::string payload;
+
+    ///An auto-save journal is replayed first, so that only the last version of each record is decoded
+    bool isJournal = reader.getFileType() == eProjectBinaryFileTypeJournal;
+    ProjectJournalState journal;
+    if (isJournal) {
+        if ( !readProjectJournal(reader, &journal) ) {
+            throw std::runtime_error("The auto-save journal is empty");
+        }
+        payload.swap(journal.project);
+    } else if ( !reader.readRecord(&type, &payload) || (type != eProjectRecordTypeProject) ) {
+        throw std::runtime_error("The binary project does not start with the project settings");
+    }
+    ProjectSerialization projectSerializationObj( getApp() );
+    decodeBinaryRecord(payload, "Project", &projectSerializationObj);
+    _imp->restoreSettingsFromSerialization(projectSerializationObj, path, isAutoSave, realFilePath);
+
+    ///Create each node as soon as its record is decoded, instead of decoding the whole graph first.
+    ///The nodes are connected once they all exist.
+    getApp()->updateProjectLoadStatus( tr("Creating nodes in group: ") + tr("top-level") );
+    boost::shared_ptr<NodeCollection> group = shared_from_this();
+    std::list< boost::shared_ptr<NodeSerialization> > serializedNodes;
+    NodeCollectionSerialization::ParentsToReconnectMap parentsToReconnect;
+    bool hasProjectAWriter = false;
+    bool ok = true;
+    std::string guiPayload;
+    if (isJournal) {
+        for (std::list< std::pair<std::string, std::string> >::iterator it = journal.nodes.begin(); it != journal.nodes.end(); ++it) {
+            if ( !restoreBinaryNode(it->second, group, &serializedNodes, &parentsToReconnect, &hasProjectAWriter) ) {
+                ok = false;
+            }
+            std::string().swap(it->second);
+        }
+        guiPayload.swap(journal.gui);
+    } else {
+        while ( reader.readRecord(&type, &payload) ) {
+            if (type == eProjectRecordTypeNode) {
+                if ( !restoreBinaryNode(payload, group, &serializedNodes, &parentsToReconnect, &hasProjectAWriter) ) {
+                    ok = false;
+                }
+            } else if (type == eProjectRecordTypeGui) {
+                guiPayload.swap(payload);
+            }
+            ///Records of other types were written by a more recent version: skip them
+        }
+    }
+    if ( !NodeCollectionSerialization::restoreLinks(serializedNodes, group, parentsToReconnect) ) {
+        ok = false;
+    }
+    _imp->finishRestoration(projectSerializationObj, hasProjectAWriter, name, path, isAutoSave, realFilePath);
+
+    Format f;
+    getProjectDefaultFormat(&f);
+    Q_EMIT formatChanged(f);
+
+    {
+        QMutexLocker k(&_imp->isLoadingProjectMutex);
+        _imp->isLoadingProjectInternal = false;
+    }
+
+    ///The layout of the GUI is embedded as XML, see encodeBinaryProject()
+    if ( !guiPayload.empty() ) {
+        std::istringstream ss(guiPayload);
+        boost::archive::xml_iarchive guiArchive(ss);
+        getApp()->loadProjectGui(guiArchive);
+    }
+
+    return ok;
+} // loadBinaryProject
+
+void
+Project::encodeBinaryProject(std::string* data) const
+{
+    ProjectSerialization projectSerializationObj( getApp() );
+    save(&projectSerializationObj);
+    std::list< boost::shared_ptr<NodeSerialization> > serializedNodes;
+    projectSerializationObj.takeNodesSerialization(&serializedNodes);
+
+    ProjectBinaryWriter writer;
+    std::string payload;
+    encodeBinaryRecord(projectSerializationObj, "Project", &payload);
+    writer.writeRecord(eProjectRecordTypeProject, payload);
+    for (std::list< boost::shared_ptr<NodeSerialization> >::const_iterator it = serializedNodes.begin(); it != serializedNodes.end(); ++it) {
+        encodeBinaryRecord(**it, "item", &payload);
+        writer.writeRecord(eProjectRecordTypeNode, payload);
+    }
+    ///The GUI only knows how to serialize itself in XML: embed it as is
+    if ( !appPTR->isBackground() ) {
+        std::ostringstream ss;
+        {
+            boost::archive::xml_oarchive guiArchive(ss);
+            getApp()->saveProjectGui(guiArchive);
+        }
+        writer.writeRecord( eProjectRecordTypeGui, ss.str() );
+    }
+    writer.finish();
+    writer.takeData(data);
+}
+
+///Appends to hash what the serialization of the node depends on: the serialization age of the effect, which is
+///incremented by any change made to its knobs even if it does not trigger an evaluation, the plug-in ID, so that a node
+///recreated under the same name is never mistaken for the previous one, its names and the names of the nodes it is linked to.
+///Unlike the hash of the node, it does not depend on the inputs: a change only marks the node which changed.
+static void
+appendNodeJournalHash(const NodePtr & node,
+                      Hash64* hash)
+{
+    hash->append( node->getLiveInstance()->getSerializationAge() );
+    hash->append( node->getKnobsAge() );
+    Hash64_appendQString( hash, QString( node->getPluginID().c_str() ) );
+    Hash64_appendQString( hash, QString( node->getScriptName_mt_safe().c_str() ) );
+    Hash64_appendQString( hash, QString( node->getLabel_mt_safe().c_str() ) );
+
+    std::vector<std::string> inputNames;
+    node->getInputNames(inputNames);
+    hash->append<U32>( (U32)inputNames.size() );
+    for (U32 i = 0; i < inputNames.size(); ++i) {
+        Hash64_appendQString( hash, QString( inputNames[i].c_str() ) );
+    }
+    NodePtr masterNode = node->getMasterNode();
+    if (masterNode) {
+        Hash64_appendQString( hash, QString( masterNode->getFullyQualifiedName().c_str() ) );
+    }
+
+    ///The nodes of a group and the children of a multi-instance node are serialized with it
+    NodeList children;
+    NodeGroup* isGroup = dynamic_cast<NodeGroup*>( node->getLiveInstance() );
+    if (isGroup) {
+        isGroup->getActiveNodes(&children);
+    } else {
+        node->getChildrenMultiInstance(&children);
+    }
+    hash->append<U32>( (U32)children.size() );
+    for (NodeList::iterator it = children.begin(); it != children.end(); ++it) {
+        if ( (*it)->isActivated() ) {
+            appendNodeJournalHash(*it, hash);
+        }
+    }
+}
+
+static U64
+computeNodeJournalHash(const NodePtr & node)
+{
+    Hash64 hash;
+
+    appendNodeJournalHash(node, &hash);
+    hash.computeHash();
+
+    return hash.value();
+}
+
+///The journal is compacted once its file is this many times bigger than the state it describes
+#define NATRON_AUTOSAVE_JOURNAL_MAX_GROWTH 2
+
+void
+Project::encodeAutoSaveJournal(bool startJournal,
+                               std::string* data,
+                               bool* compact)
+{
+    AutoSaveJournal & journal = _imp->autoSaveJournal;
+
+    if (startJournal) {
+        journal.reset();
+    }
+    ProjectBinaryWriter writer(eProjectBinaryFileTypeJournal, startJournal);
+    std::string payload;
+
+    ///The project settings and the layout of the GUI are small: compare their serialization to what the journal holds
+    {
+        ProjectSerialization projectSerializationObj( getApp() );
+        projectSerializationObj.initialize(this, false);
+        encodeBinaryRecord(projectSerializationObj, "Project", &payload);
+        if (startJournal || payload != journal.project) {
+            writer.writeRecord(eProjectRecordTypeProject, payload);
+            journal.liveSize += payload.size();
+            journal.liveSize -= journal.project.size();
+            journal.project.swap(payload);
+        }
+    }
+
+    ///The nodes are only serialized if they changed since they were last written
+    NodeList nodes;
+    getActiveNodes(&nodes);
+    std::set<std::string> liveNodes;
+    for (NodeList::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+        if ( (*it)->getParentMultiInstance() ) {
+            continue;
+        }
+        std::string scriptName = (*it)->getScriptName_mt_safe();
+        liveNodes.insert(scriptName);
+        U64 hash = computeNodeJournalHash(*it);
+        std::map<std::string, AutoSaveJournal::JournaledNode>::iterator found = journal.nodes.find(scriptName);
+        if ( ( found != journal.nodes.end() ) && (found->second.hash == hash) ) {
+            continue;
+        }
+        NodeSerialization serialization(*it);
+        encodeBinaryRecord(serialization, "item", &payload);
+        writer.writeJournalNodeRecord(scriptName, payload);
+
+        AutoSaveJournal::JournaledNode & journaled = journal.nodes[scriptName];
+        journal.liveSize += payload.size();
+        journal.liveSize -= journaled.size;
+        journaled.hash = hash;
+        journaled.size = payload.size();
+    }
+    for (std::map<std::string, AutoSaveJournal::JournaledNode>::iterator it = journal.nodes.begin(); it != journal.nodes.end();) {
+        if ( liveNodes.find(it->first) == liveNodes.end() ) {
+            writer.writeJournalNodeRemovedRecord(it->first);
+            journal.liveSize -= it->second.size;
+            journal.nodes.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    if ( !appPTR->isBackground() ) {
+        std::ostringstream ss;
+        {
+            boost::archive::xml_oarchive guiArchive(ss);
+            getApp()->saveProjectGui(guiArchive);
+        }
+        payload = ss.str();
+        if (startJournal || payload != journal.gui) {
+            writer.writeRecord(eProjectRecordTypeGui, payload);
+            journal.liveSize += payload.size();
+            journal.liveSize -= journal.gui.size();
+            journal.gui.swap(payload);
+        }
+    }
+
+    *compact = false;
+    if ( !startJournal && (writer.getRecordsCount() == 0) ) {
+        data->clear();
+
+        return;
+    }
+    writer.finish();
+    writer.takeData(data);
+
+    if (startJournal) {
+        journal.fileSize = data->size();
+    } else {
+        journal.fileSize += data->size();
+        if (journal.fileSize > NATRON_AUTOSAVE_JOURNAL_MAX_GROWTH * journal.liveSize) {
+            *compact = true;
+            journal.fileSize = journal.liveSize;
+        }
+    }
+} // encodeAutoSaveJournal
 
 QString
 Project::saveProject(const QString & path,
                      const QString & name,
-                     bool autoS)
+                     bool autoS,
+                     bool writeInBackground)
 {
     {
         QMutexLocker l(&_imp->isLoadingProjectMutex);
@@ -348,6 +660,9 @@ Project::saveProject(const QString & path,
         }
     }
 
+    ///An auto-save still being written must not land after the files it is replaced by
+    _imp->waitForAutoSaveWrites();
+
     QString ret;
     try {
         if (!autoS) {
@@ -357,14 +672,18 @@ Project::saveProject(const QString & path,
             
             ///We just saved, any auto-save left is then worthless
             removeAutoSaves();
+            _imp->autoSaveJournal.reset();
 
             //}
         } else {
             
-            ///Clean auto-saves before saving a new one
-            removeAutoSaves();
+            ///Clean auto-saves before saving a new one, unless it is appended to the journal.
+            ///A render save is not an auto-save of the project: it does not replace the journal.
+            if ( !name.contains("RENDER_SAVE") && !_imp->autoSaveJournal.canAppend() ) {
+                removeAutoSaves();
+            }
             
-            ret = saveProjectInternal(path,name,true);
+            ret = saveProjectInternal(path,name,true,writeInBackground);
         }
     } catch (const std::exception & e) {
         if (!autoS) {
@@ -379,9 +698,6 @@ Project::saveProject(const QString & path,
         _imp->isSavingProject = false;
     }
     
-    ///Save caches ToC
-    appPTR->saveCaches();
-    
     return ret;
 }
 
@@ -402,10 +718,103 @@ fileCopy(const QString & source,
     return success;
 }
 
+///Writes data to tmpFilename, then copies it over filePath, so that a failure does not corrupt an existing file
+static bool
+writeProjectFile(const std::string & data,
+                 const QString & tmpFilename,
+                 const QString & filePath)
+{
+    {
+        QFile tmpFile(tmpFilename);
+        if ( !tmpFile.open(QFile::WriteOnly | QFile::Truncate) ||
+             ( tmpFile.write( data.data(), (qint64)data.size() ) != (qint64)data.size() ) ) {
+            tmpFile.close();
+            QFile::remove(tmpFilename);
+
+            return false;
+        }
+    }
+
+    QFile::remove(filePath);
+    int nAttemps = 0;
+    bool success = fileCopy(tmpFilename, filePath);
+    while ( !success && nAttemps < 10 ) {
+        ++nAttemps;
+        success = fileCopy(tmpFilename, filePath);
+    }
+
+    QFile::remove(tmpFilename);
+
+    return success;
+}
+
+///Replays the journal and writes it back with the last version of each record only
+static bool
+compactAutoSaveJournal(const QString & tmpFilename,
+                       const QString & filePath)
+{
+    std::string data;
+    try {
+        std::ifstream ifile(filePath.toStdString().c_str(), std::ifstream::in | std::ifstream::binary);
+        ProjectBinaryReader reader(ifile);
+        ProjectJournalState state;
+        if ( !readProjectJournal(reader, &state) ) {
+            return false;
+        }
+        writeProjectJournal(state, &data);
+    } catch (const std::exception & e) {
+        qDebug() << "Failed to compact the auto-save journal:" << e.what();
+
+        return false;
+    }
+
+    return writeProjectFile(data, tmpFilename, filePath);
+}
+
+///Writes a whole auto-save, or appends the records of an auto-save to the journal at filePath
+static bool
+writeAutoSaveData(const std::string & data,
+                  bool appendToJournal,
+                  bool compactJournal,
+                  const QString & tmpFilename,
+                  const QString & filePath)
+{
+    if (!appendToJournal) {
+        return writeProjectFile(data, tmpFilename, filePath);
+    }
+    {
+        QFile file(filePath);
+        if ( !file.open(QFile::WriteOnly | QFile::Append) ||
+             ( file.write( data.data(), (qint64)data.size() ) != (qint64)data.size() ) ) {
+            file.close();
+            ///Records appended after a partial write would not be read back: the next auto-save starts a new journal
+            QFile::remove(filePath);
+
+            return false;
+        }
+    }
+
+    return !compactJournal || compactAutoSaveJournal(tmpFilename, filePath);
+}
+
+///Run by a thread of the global thread pool, once the project was encoded on the main thread
+static void
+writeAutoSaveFile(const std::string & data,
+                  bool appendToJournal,
+                  bool compactJournal,
+                  const QString & tmpFilename,
+                  const QString & filePath)
+{
+    if ( !writeAutoSaveData(data, appendToJournal, compactJournal, tmpFilename, filePath) ) {
+        qDebug() << "Auto-save failure: cannot write" << filePath;
+    }
+}
+
 QString
 Project::saveProjectInternal(const QString & path,
                              const QString & name,
-                             bool autoSave)
+                             bool autoSave,
+                             bool writeInBackground)
 {
     QDateTime time = QDateTime::currentDateTime();
     QString timeStr = time.toString();
@@ -419,6 +828,10 @@ Project::saveProjectInternal(const QString & path,
     QString actualFileName = name;
     
     bool isRenderSave = name.contains("RENDER_SAVE");
+
+    ///Auto-saves are appended to the journal started by the first of them, see encodeAutoSaveJournal()
+    bool useJournal = autoSave && !isRenderSave;
+    bool appendToJournal = useJournal && _imp->autoSaveJournal.canAppend();
     
     if (autoSave) {
         
@@ -455,7 +868,9 @@ Project::saveProjectInternal(const QString & path,
         }
     }
     QString filePath;
-    if (autoSave) {
+    if (appendToJournal) {
+        filePath = _imp->autoSaveJournal.filePath;
+    } else if (autoSave) {
         filePath = Project::autoSavesDir() + QDir::separator() + actualFileName;
         _imp->lastAutoSaveFilePath = filePath;
     } else {
@@ -488,6 +903,9 @@ Project::saveProjectInternal(const QString & path,
             assert(ret);
             if (ret) {
                 filePath = QString(PY3String_asString(ret).c_str());
+                if ( appendToJournal && (filePath != _imp->autoSaveJournal.filePath) ) {
+                    appendToJournal = false;
+                }
                 bool ok = Natron::interpretPythonScript("del ret\n", &err, 0);
                 assert(ok);
                 (void)ok;
@@ -503,17 +921,22 @@ Project::saveProjectInternal(const QString & path,
     tmpFilename.append( QDir::separator() );
     tmpFilename.append( QString::number( time.toMSecsSinceEpoch() ) );
 
+    ///Auto-saves, which are only read back by this application, always use the binary format
+    bool binary = autoSave || QFileInfo(filePath).suffix() == NATRON_PROJECT_BINARY_FILE_EXT;
+
     std::ofstream ofile;
-    try {
-        ofile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        ofile.open(tmpFilename.toStdString().c_str(),std::ofstream::out);
-    } catch (const std::ofstream::failure & e) {
-        throw std::runtime_error( std::string("Exception occured when opening file ") + tmpFilename.toStdString() + ": " + e.what() );
-    }
+    if (!binary) {
+        try {
+            ofile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+            ofile.open(tmpFilename.toStdString().c_str(),std::ofstream::out);
+        } catch (const std::ofstream::failure & e) {
+            throw std::runtime_error( std::string("Exception occured when opening file ") + tmpFilename.toStdString() + ": " + e.what() );
+        }
 
-    if ( !ofile.good() ) {
-        qDebug() << "Failed to open file " << tmpFilename.toStdString().c_str();
-        throw std::runtime_error( "Failed to open file " + tmpFilename.toStdString() );
+        if ( !ofile.good() ) {
+            qDebug() << "Failed to open file " << tmpFilename.toStdString().c_str();
+            throw std::runtime_error( "Failed to open file " + tmpFilename.toStdString() );
+        }
     }
 
     ///Fix file paths before saving.
@@ -530,35 +953,71 @@ Project::saveProjectInternal(const QString & path,
         _imp->natronVersion->setValue(generateUserFriendlyNatronVersionName(),0);
     }
     
+    ///The binary encoding is a snapshot of the graph: once it is done, the graph may change while the file is written
+    std::string binaryData;
+    bool compactJournal = false;
     try {
-        boost::archive::xml_oarchive oArchive(ofile);
-        bool bgProject = appPTR->isBackground();
-        oArchive << boost::serialization::make_nvp("Background_project",bgProject);
-        ProjectSerialization projectSerializationObj( getApp() );
-        save(&projectSerializationObj);
-        oArchive << boost::serialization::make_nvp("Project",projectSerializationObj);
-        if (!bgProject) {
-            getApp()->saveProjectGui(oArchive);
+        if (useJournal) {
+            encodeAutoSaveJournal(!appendToJournal, &binaryData, &compactJournal);
+            _imp->autoSaveJournal.filePath = filePath;
+            _imp->lastAutoSaveFilePath = filePath;
+        } else if (binary) {
+            encodeBinaryProject(&binaryData);
+        } else {
+            boost::archive::xml_oarchive oArchive(ofile);
+            bool bgProject = appPTR->isBackground();
+            oArchive << boost::serialization::make_nvp("Background_project",bgProject);
+            ProjectSerialization projectSerializationObj( getApp() );
+            save(&projectSerializationObj);
+            oArchive << boost::serialization::make_nvp("Project",projectSerializationObj);
+            if (!bgProject) {
+                getApp()->saveProjectGui(oArchive);
+            }
         }
     } catch (...) {
-        ofile.close();
+        if (!binary) {
+            ofile.close();
+        }
         if (!autoSave) {
             ///Reset the old project path in case of failure.
             _imp->autoSetProjectDirectory(oldProjectPath);
         }
+        if (useJournal) {
+            ///The journal state may no longer match its file
+            _imp->autoSaveJournal.reset();
+        }
         throw;
     }
 
-    ofile.close();
+    if (binary) {
+        if ( binaryData.empty() ) {
+            ///Nothing changed since the previous auto-save
+        } else if (writeInBackground) {
+            boost::shared_ptr<QFutureWatcher<void> > watcher(new QFutureWatcher<void>);
+            QObject::connect(watcher.get(), SIGNAL(finished()), this, SLOT(onAutoSaveFutureFinished()));
+            watcher->setFuture( QtConcurrent::run(writeAutoSaveFile, binaryData, appendToJournal, compactJournal, tmpFilename, filePath) );
+            _imp->autoSaveFutures.push_back(watcher);
+        } else if ( !writeAutoSaveData(binaryData, appendToJournal, compactJournal, tmpFilename, filePath) ) {
+            if (useJournal) {
+                _imp->autoSaveJournal.reset();
+            }
+            if (!autoSave) {
+                _imp->autoSetProjectDirectory(oldProjectPath);
+            }
+            throw std::runtime_error( "Failed to write file " + filePath.toStdString() );
+        }
+    } else {
+        ofile.close();
+
+        QFile::remove(filePath);
+        int nAttemps = 0;
 
-    QFile::remove(filePath);
-    int nAttemps = 0;
+        while ( nAttemps < 10 && !fileCopy(tmpFilename, filePath) ) {
+            ++nAttemps;
+        }
 
-    while ( nAttemps < 10 && !fileCopy(tmpFilename, filePath) ) {
-        ++nAttemps;
+        QFile::remove(tmpFilename);
     }
-
-    QFile::remove(tmpFilename);
     
     if (!autoSave) {
         _imp->projectName = name;
@@ -584,7 +1043,7 @@ Project::autoSave()
         return;
     }
 
-    saveProject(_imp->projectPath, _imp->projectName, true);
+    saveProject(_imp->projectPath, _imp->projectName, true, true);
 }
 
 void
@@ -620,10 +1079,9 @@ Project::onAutoSaveTimerTriggered()
     bool canAutoSave = !hasNodeRendering() && !getApp()->isShowingDialog();
 
     if (canAutoSave) {
-        boost::shared_ptr<QFutureWatcher<void> > watcher(new QFutureWatcher<void>);
-        QObject::connect(watcher.get(), SIGNAL(finished()), this, SLOT(onAutoSaveFutureFinished()));
-        watcher->setFuture(QtConcurrent::run(this,&Project::autoSave));
-        _imp->autoSaveFutures.push_back(watcher);
+        ///The project is encoded here in the main thread, so that it is not modified while being serialized,
+        ///and the file is written in a separate thread.
+        autoSave();
     } else {
         ///If the auto-save failed because a render is in progress, try every 2 seconds to auto-save.
         ///We don't use the user-provided timeout interval here because it could be an inapropriate value.
@@ -643,6 +1101,26 @@ void Project::onAutoSaveFutureFinished()
     }
 }
 
+///Returns the size of the name of the project file encoded in the name of the auto-save entry (see saveProjectInternal),
+///or -1 if entry is not an auto-save
+static int
+getAutoSaveProjectFileNameSize(const QString & entry)
+{
+    const char* extensions[2] = { NATRON_PROJECT_FILE_EXT, NATRON_PROJECT_BINARY_FILE_EXT };
+
+    for (int i = 0; i < 2; ++i) {
+        QString searchStr('.');
+        searchStr.append(extensions[i]);
+        searchStr.append('.');
+        int suffixPos = entry.indexOf(searchStr);
+        if (suffixPos != -1) {
+            return suffixPos + searchStr.size() - 1;
+        }
+    }
+
+    return -1;
+}
+
 bool
 Project::findAndTryLoadAutoSave()
 {
@@ -651,12 +1129,9 @@ Project::findAndTryLoadAutoSave()
 
     for (int i = 0; i < entries.size(); ++i) {
         const QString & entry = entries.at(i);
-        QString searchStr('.');
-        searchStr.append(NATRON_PROJECT_FILE_EXT);
-        searchStr.append('.');
-        int suffixPos = entry.indexOf(searchStr);
-        if (suffixPos != -1 && !entry.contains("RENDER_SAVE")) {
-            QString filename = entry.left(suffixPos + searchStr.size() - 1);
+        int fileNameSize = getAutoSaveProjectFileNameSize(entry);
+        if (fileNameSize != -1 && !entry.contains("RENDER_SAVE")) {
+            QString filename = entry.left(fileNameSize);
             bool exists = false;
 
             if ( !filename.contains(NATRON_PROJECT_UNTITLED) ) {
@@ -1389,11 +1864,7 @@ Project::removeAutoSaves()
             continue;
         }
         
-        QString searchStr('.');
-        searchStr.append(NATRON_PROJECT_FILE_EXT);
-        searchStr.append('.');
-        int suffixPos = entry.indexOf(searchStr);
-        if (suffixPos != -1) {
+        if (getAutoSaveProjectFileNameSize(entry) != -1) {
             QFile::remove(savesDir.path() + QDir::separator() + entry);
         }
     }
@@ -1440,6 +1911,7 @@ Project::reset()
         _imp->autoSaveTimer->stop();
         _imp->additionalFormats.clear();
     }
+    _imp->autoSaveJournal.reset();
     _imp->timeline->removeAllKeyframesIndicators();
     const std::vector<boost::shared_ptr<KnobI> > & knobs = getKnobs();
 
@@ -1976,6 +2448,34 @@ Project::isProjectClosing() const
     return _imp->projectClosing;
 }
     
+static void
+refreshNativeExpressionsRecursive(const NodeList & nodes,
+                                  const std::list<std::string> & nodeNames)
+{
+    for (NodeList::const_iterator it = nodes.begin(); it != nodes.end(); ++it) {
+        const std::vector<boost::shared_ptr<KnobI> > & knobs = (*it)->getKnobs();
+        for (U32 i = 0; i < knobs.size(); ++i) {
+            KnobHelper* isHelper = dynamic_cast<KnobHelper*>( knobs[i].get() );
+            if (isHelper) {
+                isHelper->refreshNativeExpressions(nodeNames);
+            }
+        }
+        NodeGroup* isGroup = dynamic_cast<NodeGroup*>( (*it)->getLiveInstance() );
+        if (isGroup) {
+            refreshNativeExpressionsRecursive(isGroup->getNodes(), nodeNames);
+        }
+    }
+}
+
+void
+Project::refreshNativeExpressions(const std::list<std::string> & nodeNames)
+{
+    if ( isLoadingProject() || isProjectClosing() ) {
+        return;
+    }
+    refreshNativeExpressionsRecursive(getNodes(), nodeNames);
+}
+
 bool
 Project::isFrameRangeLocked() const
 {
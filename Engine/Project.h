@@ -17,6 +17,7 @@
 
 #include <map>
 #include <vector>
+#include <iosfwd>
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/noncopyable.hpp>
 #include <boost/enable_shared_from_this.hpp>
@@ -67,13 +68,16 @@ public:
     /**
      * @brief Saves the project with the given path and name corresponding to a file on disk.
      * @param autoSave If true then it will save the project in a temporary file instead (see autoSave()).
+     * The project is saved in the binary format if autoSave is true or if name has the NATRON_PROJECT_BINARY_FILE_EXT extension.
+     * @param writeInBackground If true, this function returns as soon as the project was encoded in the binary format
+     * and the file is written by another thread.
      * @returns The actual filepath of the file saved
      **/
-    QString saveProject(const QString & path,const QString & name,bool autoSave);
+    QString saveProject(const QString & path,const QString & name,bool autoSave,bool writeInBackground = false);
 
     /**
      * @brief Same as saveProject except that it will save the project in a temporary file
-     * so it doesn't overwrite the project.
+     * so it doesn't overwrite the project. The file is written in the background.
      **/
     void autoSave();
 
@@ -82,6 +86,13 @@ public:
      **/
     void triggerAutoSave();
 
+    /**
+     * @brief Encodes the records of the auto-save journal for what changed since the previous auto-save, or the whole
+     * project if startJournal is true. Leaves data empty if nothing changed.
+     * compact is set to true if the journal should be compacted once the records are appended.
+     **/
+    void encodeAutoSaveJournal(bool startJournal,std::string* data,bool* compact);
+
     /**
      * @brief Returns the path to where the auto save files are stored on disk.
      **/
@@ -240,6 +251,13 @@ public:
     std::string getOnNodeDeleteCB() const;
     
     bool isProjectClosing() const;
+    
+    /**
+     * @brief Compiles again the native expressions of the project referring to one of the given nodes,
+     * see KnobHelper::refreshNativeExpressions().
+     * Does nothing while the project is loading or closing: expressions are restored once all the nodes exist.
+     **/
+    void refreshNativeExpressions(const std::list<std::string>& nodeNames);
 
     bool isFrameRangeLocked() const;
     
@@ -289,7 +307,17 @@ private:
 
     bool loadProjectInternal(const QString & path,const QString & name,bool isAutoSave,const QString& realFilePath);
 
-    QString saveProjectInternal(const QString & path,const QString & name,bool autosave = false);
+    QString saveProjectInternal(const QString & path,const QString & name,bool autosave = false,bool writeInBackground = false);
+
+    /**
+     * @brief Loads a project saved in the binary format: the nodes are created as their records are decoded.
+     **/
+    bool loadBinaryProject(std::istream & stream,const QString& name,const QString& path,bool isAutoSave,const QString& realFilePath);
+
+    /**
+     * @brief Encodes the project in the binary format (see ProjectBinaryFormat.h)
+     **/
+    void encodeBinaryProject(std::string* data) const;
 
     
     
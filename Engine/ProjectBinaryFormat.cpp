@@ -0,0 +1,355 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "ProjectBinaryFormat.h"
+
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <cstring>
+#include <cassert>
+
+using namespace Natron;
+
+///The payloads are read by chunks of this size, so that a corrupted size does not allocate more than the file holds
+#define NATRON_PROJECT_BINARY_READ_CHUNK_SIZE (1 << 20)
+
+namespace {
+
+void
+appendU32(std::string* data,
+          unsigned int value)
+{
+    for (int i = 0; i < 4; ++i) {
+        data->push_back( (char)( (value >> (8 * i)) & 0xff ) );
+    }
+}
+
+void
+appendU64(std::string* data,
+          unsigned long long value)
+{
+    for (int i = 0; i < 8; ++i) {
+        data->push_back( (char)( (value >> (8 * i)) & 0xff ) );
+    }
+}
+
+///Returns false if the stream ended before size bytes could be read
+bool
+readBytes(std::istream & stream,
+          char* bytes,
+          std::size_t size)
+{
+    stream.read(bytes, size);
+
+    return (std::size_t)stream.gcount() == size;
+}
+
+bool
+readU32(std::istream & stream,
+        unsigned int* value)
+{
+    unsigned char bytes[4];
+
+    if ( !readBytes(stream, (char*)bytes, 4) ) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+        *value |= (unsigned int)bytes[i] << (8 * i);
+    }
+
+    return true;
+}
+
+bool
+readU64(std::istream & stream,
+        unsigned long long* value)
+{
+    unsigned char bytes[8];
+
+    if ( !readBytes(stream, (char*)bytes, 8) ) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 8; ++i) {
+        *value |= (unsigned long long)bytes[i] << (8 * i);
+    }
+
+    return true;
+}
+
+///A journal node record is the size of the script name, the script name, then the payload
+void
+splitJournalNodeRecord(const std::string & record,
+                       std::string* scriptName,
+                       std::string* payload)
+{
+    unsigned int nameSize = 0;
+
+    if (record.size() >= 4) {
+        for (int i = 0; i < 4; ++i) {
+            nameSize |= (unsigned int)(unsigned char)record[i] << (8 * i);
+        }
+    }
+    if ( (record.size() < 4) || (record.size() - 4 < nameSize) ) {
+        throw std::runtime_error("The auto-save journal is corrupted");
+    }
+    scriptName->assign(record, 4, nameSize);
+    if (payload) {
+        payload->assign(record, 4 + nameSize, std::string::npos);
+    }
+}
+
+typedef std::list< std::pair<std::string, std::string> > NodesList;
+
+///The nodes of the journal state by script name
+typedef std::map<std::string, NodesList::iterator> NodesMap;
+
+///A record read after the last commit
+struct PendingRecord
+{
+    ProjectRecordTypeEnum type;
+    std::string payload;
+};
+
+} // anon namespace
+
+ProjectBinaryWriter::ProjectBinaryWriter(ProjectBinaryFileTypeEnum fileType,
+                                         bool writeHeader)
+: _fileType(fileType)
+, _data()
+, _nRecords(0)
+, _finished(false)
+{
+    assert(writeHeader || fileType == eProjectBinaryFileTypeJournal);
+    if (writeHeader) {
+        _data.append(fileType == eProjectBinaryFileTypeJournal ? NATRON_PROJECT_JOURNAL_MAGIC : NATRON_PROJECT_BINARY_MAGIC,
+                     NATRON_PROJECT_BINARY_MAGIC_SIZE);
+        appendU32(&_data, NATRON_PROJECT_BINARY_FORMAT_VERSION);
+    }
+}
+
+void
+ProjectBinaryWriter::writeRecord(ProjectRecordTypeEnum type,
+                                 const std::string & payload)
+{
+    assert(!_finished);
+    appendU32(&_data, (unsigned int)type);
+    appendU64( &_data, (unsigned long long)payload.size() );
+    _data.append(payload);
+    ++_nRecords;
+}
+
+void
+ProjectBinaryWriter::writeJournalNodeRecord(const std::string & scriptName,
+                                            const std::string & payload)
+{
+    assert(!_finished && _fileType == eProjectBinaryFileTypeJournal);
+    appendU32(&_data, (unsigned int)eProjectRecordTypeJournalNode);
+    appendU64( &_data, (unsigned long long)(4 + scriptName.size() + payload.size()) );
+    appendU32( &_data, (unsigned int)scriptName.size() );
+    _data.append(scriptName);
+    _data.append(payload);
+    ++_nRecords;
+}
+
+void
+ProjectBinaryWriter::writeJournalNodeRemovedRecord(const std::string & scriptName)
+{
+    assert(_fileType == eProjectBinaryFileTypeJournal);
+    writeRecord(eProjectRecordTypeJournalNodeRemoved, scriptName);
+}
+
+void
+ProjectBinaryWriter::finish()
+{
+    if (_fileType == eProjectBinaryFileTypeJournal) {
+        writeRecord( eProjectRecordTypeJournalCommit, std::string() );
+    } else {
+        writeRecord( eProjectRecordTypeEnd, std::string() );
+    }
+    --_nRecords;
+    _finished = true;
+}
+
+void
+ProjectBinaryWriter::takeData(std::string* data)
+{
+    assert(_finished);
+    data->clear();
+    data->swap(_data);
+}
+
+ProjectBinaryReader::ProjectBinaryReader(std::istream & stream)
+: _stream(stream)
+, _fileType(eProjectBinaryFileTypeProject)
+, _formatVersion(0)
+, _ended(false)
+{
+    _stream.exceptions(std::ios_base::goodbit);
+
+    char magic[NATRON_PROJECT_BINARY_MAGIC_SIZE];
+    if ( !readBytes(_stream, magic, NATRON_PROJECT_BINARY_MAGIC_SIZE) ) {
+        throw std::runtime_error("The file is not a binary project");
+    }
+    if ( !std::memcmp(magic, NATRON_PROJECT_JOURNAL_MAGIC, NATRON_PROJECT_BINARY_MAGIC_SIZE) ) {
+        _fileType = eProjectBinaryFileTypeJournal;
+    } else if ( std::memcmp(magic, NATRON_PROJECT_BINARY_MAGIC, NATRON_PROJECT_BINARY_MAGIC_SIZE) ) {
+        throw std::runtime_error("The file is not a binary project");
+    }
+    if ( !readU32(_stream, &_formatVersion) ) {
+        throw std::runtime_error("The binary project file is truncated");
+    }
+    if (_formatVersion > NATRON_PROJECT_BINARY_FORMAT_VERSION) {
+        throw std::runtime_error("The binary project was saved by a more recent version of the application");
+    }
+}
+
+bool
+ProjectBinaryReader::readRecord(ProjectRecordTypeEnum* type,
+                                std::string* payload)
+{
+    if (_ended) {
+        return false;
+    }
+
+    unsigned int typeValue;
+    unsigned long long size;
+    bool ok = readU32(_stream, &typeValue) && readU64(_stream, &size);
+
+    payload->clear();
+    while (ok && size > 0) {
+        std::size_t chunk = size < NATRON_PROJECT_BINARY_READ_CHUNK_SIZE ? (std::size_t)size : NATRON_PROJECT_BINARY_READ_CHUNK_SIZE;
+        std::size_t offset = payload->size();
+        payload->resize(offset + chunk);
+        ok = readBytes(_stream, &(*payload)[offset], chunk);
+        size -= chunk;
+    }
+    if (!ok) {
+        _ended = true;
+        if (_fileType == eProjectBinaryFileTypeJournal) {
+            ///The application stopped while appending to the journal
+            payload->clear();
+
+            return false;
+        }
+        throw std::runtime_error("The binary project file is truncated");
+    }
+
+    *type = (ProjectRecordTypeEnum)typeValue;
+    if (*type == eProjectRecordTypeEnd) {
+        _ended = true;
+
+        return false;
+    }
+
+    return true;
+}
+
+bool
+Natron::isBinaryProjectFile(const std::string & filePath)
+{
+    std::ifstream file(filePath.c_str(), std::ios::in | std::ios::binary);
+
+    if ( !file.good() ) {
+        return false;
+    }
+    char magic[NATRON_PROJECT_BINARY_MAGIC_SIZE];
+    if ( !readBytes(file, magic, NATRON_PROJECT_BINARY_MAGIC_SIZE) ) {
+        return false;
+    }
+
+    return !std::memcmp(magic, NATRON_PROJECT_BINARY_MAGIC, NATRON_PROJECT_BINARY_MAGIC_SIZE) ||
+           !std::memcmp(magic, NATRON_PROJECT_JOURNAL_MAGIC, NATRON_PROJECT_BINARY_MAGIC_SIZE);
+}
+
+bool
+Natron::readProjectJournal(ProjectBinaryReader & reader,
+                           ProjectJournalState* state)
+{
+    assert(reader.getFileType() == eProjectBinaryFileTypeJournal);
+
+    state->project.clear();
+    state->nodes.clear();
+    state->gui.clear();
+    NodesMap nodesByName;
+
+    ///The records are only applied to the state once their commit was read
+    std::list<PendingRecord> pending;
+    bool committed = false;
+    PendingRecord record;
+    while ( reader.readRecord(&record.type, &record.payload) ) {
+        if (record.type != eProjectRecordTypeJournalCommit) {
+            pending.push_back(PendingRecord());
+            pending.back().type = record.type;
+            pending.back().payload.swap(record.payload);
+            continue;
+        }
+        committed = true;
+        for (std::list<PendingRecord>::iterator it = pending.begin(); it != pending.end(); ++it) {
+            switch (it->type) {
+            case eProjectRecordTypeProject:
+                state->project.swap(it->payload);
+                break;
+            case eProjectRecordTypeGui:
+                state->gui.swap(it->payload);
+                break;
+            case eProjectRecordTypeJournalNode: {
+                std::string scriptName;
+                std::string payload;
+                splitJournalNodeRecord(it->payload, &scriptName, &payload);
+                NodesMap::iterator found = nodesByName.find(scriptName);
+                if ( found != nodesByName.end() ) {
+                    found->second->second.swap(payload);
+                } else {
+                    state->nodes.push_back( std::make_pair(scriptName, std::string()) );
+                    state->nodes.back().second.swap(payload);
+                    NodesList::iterator last = state->nodes.end();
+                    --last;
+                    nodesByName.insert( std::make_pair(scriptName, last) );
+                }
+                break;
+            }
+            case eProjectRecordTypeJournalNodeRemoved: {
+                NodesMap::iterator found = nodesByName.find(it->payload);
+                if ( found != nodesByName.end() ) {
+                    state->nodes.erase(found->second);
+                    nodesByName.erase(found);
+                }
+                break;
+            }
+            default:
+                ///Written by a more recent version: skip it
+                break;
+            }
+        }
+        pending.clear();
+    }
+
+    return committed;
+}
+
+void
+Natron::writeProjectJournal(const ProjectJournalState & state,
+                            std::string* data)
+{
+    ProjectBinaryWriter writer(eProjectBinaryFileTypeJournal);
+
+    writer.writeRecord(eProjectRecordTypeProject, state.project);
+    for (NodesList::const_iterator it = state.nodes.begin(); it != state.nodes.end(); ++it) {
+        writer.writeJournalNodeRecord(it->first, it->second);
+    }
+    if ( !state.gui.empty() ) {
+        writer.writeRecord(eProjectRecordTypeGui, state.gui);
+    }
+    writer.finish();
+    writer.takeData(data);
+}
@@ -0,0 +1,175 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_PROJECTBINARYFORMAT_H_
+#define NATRON_ENGINE_PROJECTBINARYFORMAT_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <string>
+#include <istream>
+#include <list>
+#include <utility>
+
+#ifndef Q_MOC_RUN
+#include <boost/noncopyable.hpp>
+#endif
+
+///The first bytes of a binary project file
+#define NATRON_PROJECT_BINARY_MAGIC "NTPB"
+#define NATRON_PROJECT_BINARY_MAGIC_SIZE 4
+
+///The first bytes of an auto-save journal, which has the same header as a binary project
+#define NATRON_PROJECT_JOURNAL_MAGIC "NTPJ"
+
+///Version of the container. The payloads of the records have their own versioning (the boost serialization class versions).
+#define NATRON_PROJECT_BINARY_FORMAT_VERSION 1
+
+namespace Natron {
+
+enum ProjectRecordTypeEnum
+{
+    eProjectRecordTypeEnd = 0, //< the last record of the file, so that a truncated file is detected
+    eProjectRecordTypeProject, //< the ProjectSerialization, without the nodes
+    eProjectRecordTypeNode, //< the NodeSerialization of a top-level node, with the nodes of its group if any
+    eProjectRecordTypeGui, //< the layout of the GUI, as an XML archive
+    eProjectRecordTypeJournalNode, //< journal only: the script name of a top-level node followed by its NodeSerialization
+    eProjectRecordTypeJournalNodeRemoved, //< journal only: the script name of a top-level node which was removed
+    eProjectRecordTypeJournalCommit //< journal only: the records before it describe a consistent state of the project
+};
+
+/**
+ * @brief An auto-save journal is a binary project whose records are appended by each auto-save: it starts with the
+ * records of the whole project, then each auto-save appends the records which changed since the previous one,
+ * followed by a commit record. Records after the last commit were being written when the application stopped: they
+ * are ignored, and so is a truncated record.
+ **/
+enum ProjectBinaryFileTypeEnum
+{
+    eProjectBinaryFileTypeProject = 0,
+    eProjectBinaryFileTypeJournal
+};
+
+/**
+ * @brief Encodes a binary project file in memory. The file is a header (the magic and the format version) followed by
+ * records, each being a type and a size followed by the payload. The integers are little-endian whatever the platform.
+ * The payloads are opaque to this class: records of a type unknown to the reader are skipped, so that types can be
+ * added without changing the format version.
+ **/
+class ProjectBinaryWriter
+    : boost::noncopyable
+{
+public:
+
+    /**
+     * @brief If writeHeader is false, the records are meant to be appended to an existing journal.
+     **/
+    explicit ProjectBinaryWriter(ProjectBinaryFileTypeEnum fileType = eProjectBinaryFileTypeProject,
+                                 bool writeHeader = true);
+
+    void writeRecord(ProjectRecordTypeEnum type, const std::string & payload);
+
+    ///Journal only
+    void writeJournalNodeRecord(const std::string & scriptName, const std::string & payload);
+    void writeJournalNodeRemovedRecord(const std::string & scriptName);
+
+    /**
+     * @brief Returns the number of records written so far, not counting the end or commit record.
+     **/
+    int getRecordsCount() const
+    {
+        return _nRecords;
+    }
+
+    /**
+     * @brief Writes the end record of a project, or the commit record of a journal. No record can be written afterwards.
+     **/
+    void finish();
+
+    /**
+     * @brief Moves the encoded file to data, leaving the writer empty.
+     **/
+    void takeData(std::string* data);
+
+private:
+
+    ProjectBinaryFileTypeEnum _fileType;
+    std::string _data;
+    int _nRecords;
+    bool _finished;
+};
+
+/**
+ * @brief Decodes the records of a binary project file one by one, so that the caller does not need to hold the whole
+ * file in memory.
+ **/
+class ProjectBinaryReader
+    : boost::noncopyable
+{
+public:
+
+    /**
+     * @brief Reads the header. Throws std::runtime_error if the stream is not a binary project nor a journal or was
+     * written by a more recent version of the format.
+     * The exceptions of the stream are disabled: the reader checks what it reads itself.
+     **/
+    explicit ProjectBinaryReader(std::istream & stream);
+
+    ProjectBinaryFileTypeEnum getFileType() const
+    {
+        return _fileType;
+    }
+
+    unsigned int getFormatVersion() const
+    {
+        return _formatVersion;
+    }
+
+    /**
+     * @brief Reads the next record. Returns false once the end record was read.
+     * Throws std::runtime_error if the file is truncated, unless it is a journal in which case this returns false.
+     **/
+    bool readRecord(ProjectRecordTypeEnum* type, std::string* payload);
+
+private:
+
+    std::istream & _stream;
+    ProjectBinaryFileTypeEnum _fileType;
+    unsigned int _formatVersion;
+    bool _ended;
+};
+
+/**
+ * @brief Returns true if the file at filePath starts with the binary project or the journal magic.
+ **/
+bool isBinaryProjectFile(const std::string & filePath);
+
+/**
+ * @brief The state of the project described by a journal: the last version of each record.
+ **/
+struct ProjectJournalState
+{
+    std::string project;
+    std::list< std::pair<std::string, std::string> > nodes; //< script name and payload, in the order the nodes were first written
+    std::string gui;
+};
+
+/**
+ * @brief Replays the records of the journal read by reader up to its last commit.
+ * Returns false if the journal has no commit.
+ **/
+bool readProjectJournal(ProjectBinaryReader & reader, ProjectJournalState* state);
+
+/**
+ * @brief Encodes a journal holding state only. Replaying a journal and writing it back this way compacts it.
+ **/
+void writeProjectJournal(const ProjectJournalState & state, std::string* data);
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_PROJECTBINARYFORMAT_H_
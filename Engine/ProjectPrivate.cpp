@@ -70,6 +70,8 @@ ProjectPrivate::ProjectPrivate(Natron::Project* project)
     , isSavingProjectMutex()
     , isSavingProject(false)
     , autoSaveTimer( new QTimer() )
+    , autoSaveFutures()
+    , autoSaveJournal()
     , projectClosing(false)
     
 {
@@ -85,6 +87,27 @@ ProjectPrivate::restoreFromSerialization(const ProjectSerialization & obj,
                                          bool isAutoSave,
                                          const QString& realFilePath)
 {
+    restoreSettingsFromSerialization(obj, path, isAutoSave, realFilePath);
+    
+    /// 3) Restore the nodes
+    
+    bool hasProjectAWriter = false;
+    
+    bool ok = NodeCollectionSerialization::restoreFromSerialization(obj.getNodesSerialization().getNodesSerialization(),
+                                                                    _publicInterface->shared_from_this(), &hasProjectAWriter);
+
+    finishRestoration(obj, hasProjectAWriter, name, path, isAutoSave, realFilePath);
+    
+    return ok;
+
+} // restoreFromSerialization
+
+void
+ProjectPrivate::restoreSettingsFromSerialization(const ProjectSerialization & obj,
+                                                 const QString& path,
+                                                 bool isAutoSave,
+                                                 const QString& realFilePath)
+{
     
     /*1st OFF RESTORE THE PROJECT KNOBS*/
 
@@ -158,16 +181,16 @@ ProjectPrivate::restoreFromSerialization(const ProjectSerialization & obj,
 
     /// 2) restore the timeline
     timeline->seekFrame(obj.getCurrentTime(), false, 0, Natron::eTimelineChangeReasonPlaybackSeek);
+} // restoreSettingsFromSerialization
 
-    
-    /// 3) Restore the nodes
-    
-    bool hasProjectAWriter = false;
-    
-    bool ok = NodeCollectionSerialization::restoreFromSerialization(obj.getNodesSerialization().getNodesSerialization(),
-                                                                    _publicInterface->shared_from_this(), &hasProjectAWriter);
-
-
+void
+ProjectPrivate::finishRestoration(const ProjectSerialization & obj,
+                                  bool hasProjectAWriter,
+                                  const QString& name,
+                                  const QString& path,
+                                  bool isAutoSave,
+                                  const QString& realFilePath)
+{
     if ( !hasProjectAWriter && appPTR->isBackground() ) {
         _publicInterface->clearNodes(true);
         throw std::invalid_argument("Project file is missing a writer node. This project cannot render anything.");
@@ -209,10 +232,7 @@ ProjectPrivate::restoreFromSerialization(const ProjectSerialization & obj,
     if (obj.getVersion() < PROJECT_SERIALIZATION_REMOVES_TIMELINE_BOUNDS) {
         _publicInterface->recomputeFrameRangeFromReaders();
     }
-    
-    return ok;
-
-} // restoreFromSerialization
+} // finishRestoration
 
 bool
 ProjectPrivate::findFormat(int index,
@@ -289,6 +309,14 @@ ProjectPrivate::autoSetProjectDirectory(const QString& path)
         envVars->setValue(newEnv, 0);
     }
 }
+
+void
+ProjectPrivate::waitForAutoSaveWrites()
+{
+    for (std::list<boost::shared_ptr<QFutureWatcher<void> > >::iterator it = autoSaveFutures.begin(); it != autoSaveFutures.end(); ++it) {
+        (*it)->waitForFinished();
+    }
+}
     
 
     
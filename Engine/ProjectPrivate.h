@@ -17,10 +17,12 @@
 
 #include <map>
 #include <list>
+#include <string>
 #include "Global/Macros.h"
 CLANG_DIAG_OFF(deprecated)
 CLANG_DIAG_OFF(uninitialized)
 #include <QDateTime>
+#include <QFile>
 #include <QString>
 #include <QFuture>
 #include <QFutureWatcher>
@@ -29,6 +31,7 @@ CLANG_DIAG_ON(deprecated)
 CLANG_DIAG_ON(uninitialized)
 
 
+#include "Global/GlobalDefines.h"
 #include "Engine/Format.h"
 #include "Engine/KnobTypes.h"
 #include "Engine/KnobFile.h"
@@ -60,6 +63,60 @@ generateStringFromFormat(const Format & f)
     return formatStr;
 }
 
+/**
+ * @brief What the auto-save journal holds as of the last auto-save (see Project::autoSave).
+ * Only accessed by the main thread.
+ **/
+struct AutoSaveJournal
+{
+    ///A top-level node as it was last written to the journal
+    struct JournaledNode
+    {
+        U64 hash; //< see computeNodeJournalHash() in Project.cpp
+        std::size_t size; //< the size of its serialization
+
+        JournaledNode()
+        : hash(0)
+        , size(0)
+        {
+        }
+    };
+
+    QString filePath; //< empty until the first auto-save
+    std::string project; //< the serialization of the project settings
+    std::string gui; //< the serialization of the GUI layout
+    std::map<std::string, JournaledNode> nodes; //< by script name
+    std::size_t fileSize; //< the size of the file once the pending writes are done
+    std::size_t liveSize; //< the size of the file once compacted
+
+    AutoSaveJournal()
+    : filePath()
+    , project()
+    , gui()
+    , nodes()
+    , fileSize(0)
+    , liveSize(0)
+    {
+    }
+
+    ///False if the next auto-save must start a new journal
+    bool canAppend() const
+    {
+        return !filePath.isEmpty() && QFile::exists(filePath);
+    }
+
+    ///The next auto-save starts a new journal
+    void reset()
+    {
+        filePath.clear();
+        project.clear();
+        gui.clear();
+        nodes.clear();
+        fileSize = 0;
+        liveSize = 0;
+    }
+};
+
 struct ProjectPrivate
 {
     Natron::Project* _publicInterface;
@@ -112,12 +169,23 @@ struct ProjectPrivate
     bool isSavingProject; //< true when the project is saving
     boost::shared_ptr<QTimer> autoSaveTimer;
     std::list<boost::shared_ptr<QFutureWatcher<void> > > autoSaveFutures;
+    AutoSaveJournal autoSaveJournal;
     bool projectClosing;
     
     ProjectPrivate(Natron::Project* project);
 
     bool restoreFromSerialization(const ProjectSerialization & obj,const QString& name,const QString& path,bool isAutoSave,const QString& realFilePath);
 
+    /**
+     * @brief The steps of restoreFromSerialization() before and after the nodes are created, so that the nodes can be
+     * created as they are decoded (see Project::loadBinaryProject)
+     **/
+    void restoreSettingsFromSerialization(const ProjectSerialization & obj,const QString& path,bool isAutoSave,const QString& realFilePath);
+    void finishRestoration(const ProjectSerialization & obj,bool hasProjectAWriter,const QString& name,const QString& path,bool isAutoSave,const QString& realFilePath);
+
+    ///Blocks until the auto-saves being written in the background are on disk
+    void waitForAutoSaveWrites();
+
     bool findFormat(int index,Format* format) const;
     
     /**
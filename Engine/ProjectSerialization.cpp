@@ -21,11 +21,14 @@
 
 
 void
-ProjectSerialization::initialize(const Natron::Project* project)
+ProjectSerialization::initialize(const Natron::Project* project,
+                                 bool serializeNodes)
 {
     ///All the code in this function is MT-safe
 
-    _nodes.initialize(*project);
+    if (serializeNodes) {
+        _nodes.initialize(*project);
+    }
     
     project->getAdditionalFormats(&_additionalFormats);
 
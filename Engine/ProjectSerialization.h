@@ -79,7 +79,11 @@ public:
         return _version;
     }
     
-    void initialize(const Natron::Project* project);
+    /**
+     * @brief If serializeNodes is false, only the project settings are serialized: the auto-save journal
+     * serializes the nodes on its own.
+     **/
+    void initialize(const Natron::Project* project,bool serializeNodes = true);
 
     SequenceTime getCurrentTime() const
     {
@@ -101,6 +105,12 @@ public:
         return _nodes;
     }
 
+    ///The binary project format encodes each top-level node in a record of its own, apart from the project
+    void takeNodesSerialization(std::list< boost::shared_ptr<NodeSerialization> >* nodes)
+    {
+        _nodes.takeNodesSerialization(nodes);
+    }
+
     qint64 getCreationDate() const
     {
         return _creationDate;
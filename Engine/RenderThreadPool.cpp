@@ -0,0 +1,438 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "RenderThreadPool.h"
+
+#include <deque>
+#include <algorithm>
+#include <cassert>
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QAtomicInt>
+
+using namespace Natron;
+
+namespace {
+
+/**
+ * @brief A parallel loop started by parallelFor()
+ **/
+struct Job
+{
+    const RenderThreadPool::IndexFunction* func;
+    QMutex mutex; //< protects remaining and failed
+    QWaitCondition doneCond;
+    int remaining; //< number of indexes not done yet
+    bool failed;
+
+    Job(const RenderThreadPool::IndexFunction* func,
+        int n)
+    : func(func)
+    , mutex()
+    , doneCond()
+    , remaining(n)
+    , failed(false)
+    {
+    }
+};
+
+struct Task
+{
+    Job* job;
+    int index;
+
+    Task()
+    : job(0)
+    , index(0)
+    {
+    }
+
+    Task(Job* job,
+         int index)
+    : job(job)
+    , index(index)
+    {
+    }
+};
+
+struct TaskQueue
+{
+    QMutex mutex;
+    std::deque<Task> tasks;
+};
+
+class Worker;
+
+} // anon namespace
+
+struct Natron::RenderThreadPoolPrivate
+{
+    mutable QMutex poolMutex; //< protects workers, queues and quit
+    QWaitCondition workAvailableCond;
+    std::vector<Worker*> workers;
+    QAtomicInt maxThreadCount; //< only written under poolMutex, read by the workers before taking a task
+    bool quit;
+
+    ///One deque per worker, allocated up-front so that thieves can browse them without locking poolMutex.
+    ///The first nStartedWorkers deques are in use.
+    std::vector<TaskQueue*> queues;
+    QAtomicInt nStartedWorkers;
+
+    ///Tasks pushed by threads that are not workers of the pool
+    TaskQueue sharedQueue;
+
+    ///Number of tasks pushed and not taken yet, used to put workers to sleep
+    QAtomicInt pendingTasks;
+    QAtomicInt stolenTasks;
+
+    ///Number of workers running a task
+    QAtomicInt activeWorkers;
+
+    RenderThreadPoolPrivate(int maxThreadCount);
+
+    ~RenderThreadPoolPrivate();
+
+    static int threadCountOrIdeal(int maxThreadCount)
+    {
+        if (maxThreadCount <= 0) {
+            maxThreadCount = QThread::idealThreadCount();
+        }
+
+        return std::max(1, maxThreadCount);
+    }
+
+    int getCurrentWorkerIndex() const;
+
+    void startWorkers();
+
+    void pushTasks(int workerIndex, Job* job, int first, int last);
+
+    ///Takes any task for the idle worker workerIndex: the last task of its own deque, then the first task of
+    ///the shared queue, then the first task of the deque of another worker.
+    bool takeAnyTask(int workerIndex, Task* task);
+
+    ///Takes the last task of the given job in the given queue
+    bool takeJobTask(TaskQueue* queue, Job* job, Task* task);
+
+    void runTask(const Task & task);
+};
+
+namespace {
+
+class Worker
+    : public QThread
+{
+    RenderThreadPoolPrivate* _pool;
+    int _index;
+
+public:
+
+    Worker(RenderThreadPoolPrivate* pool,
+           int index)
+    : QThread()
+    , _pool(pool)
+    , _index(index)
+    {
+    }
+
+    RenderThreadPoolPrivate* getPool() const
+    {
+        return _pool;
+    }
+
+    int getIndex() const
+    {
+        return _index;
+    }
+
+private:
+
+    virtual void run() OVERRIDE
+    {
+        for (;;) {
+            Task task;
+            if ( ( _index < (int)_pool->maxThreadCount ) && _pool->takeAnyTask(_index, &task) ) {
+                _pool->activeWorkers.fetchAndAddRelaxed(1);
+                _pool->runTask(task);
+                _pool->activeWorkers.fetchAndAddRelaxed(-1);
+                continue;
+            }
+
+            QMutexLocker l(&_pool->poolMutex);
+            if (_pool->quit) {
+                return;
+            }
+            ///pendingTasks is checked under poolMutex, which pushTasks() locks to wake us up, so no wake-up can be missed
+            if ( ( (int)_pool->pendingTasks == 0 ) || ( _index >= (int)_pool->maxThreadCount ) ) {
+                _pool->workAvailableCond.wait(&_pool->poolMutex);
+            }
+        }
+    }
+};
+
+} // anon namespace
+
+RenderThreadPoolPrivate::RenderThreadPoolPrivate(int maxThreadCount)
+: poolMutex()
+, workAvailableCond()
+, workers()
+, maxThreadCount( threadCountOrIdeal(maxThreadCount) )
+, quit(false)
+, queues()
+, nStartedWorkers()
+, sharedQueue()
+, pendingTasks()
+, stolenTasks()
+, activeWorkers()
+{
+}
+
+RenderThreadPoolPrivate::~RenderThreadPoolPrivate()
+{
+    {
+        QMutexLocker l(&poolMutex);
+        quit = true;
+        workAvailableCond.wakeAll();
+    }
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->wait();
+        delete workers[i];
+    }
+    for (std::size_t i = 0; i < queues.size(); ++i) {
+        delete queues[i];
+    }
+}
+
+int
+RenderThreadPoolPrivate::getCurrentWorkerIndex() const
+{
+    Worker* worker = dynamic_cast<Worker*>( QThread::currentThread() );
+
+    if ( worker && (worker->getPool() == this) ) {
+        return worker->getIndex();
+    }
+
+    return -1;
+}
+
+void
+RenderThreadPoolPrivate::startWorkers()
+{
+    QMutexLocker l(&poolMutex);
+
+    if ( quit || ( (int)workers.size() >= (int)maxThreadCount ) ) {
+        return;
+    }
+    ///The deques can't be reallocated once thieves browse them: reserve enough for any reasonable thread count
+    if ( queues.empty() ) {
+        queues.resize( std::max( (int)maxThreadCount, 4 * QThread::idealThreadCount() ) );
+        for (std::size_t i = 0; i < queues.size(); ++i) {
+            queues[i] = new TaskQueue;
+        }
+    }
+    int nWorkers = std::min( (int)maxThreadCount, (int)queues.size() );
+    while ( (int)workers.size() < nWorkers ) {
+        Worker* worker = new Worker( this, (int)workers.size() );
+        workers.push_back(worker);
+        nStartedWorkers.fetchAndAddOrdered(1);
+        worker->start();
+    }
+}
+
+void
+RenderThreadPoolPrivate::pushTasks(int workerIndex,
+                                   Job* job,
+                                   int first,
+                                   int last)
+{
+    TaskQueue* queue = workerIndex == -1 ? &sharedQueue : queues[workerIndex];
+    {
+        QMutexLocker l(&queue->mutex);
+        ///pushed in reverse order so that the owner pops them in order
+        for (int i = last - 1; i >= first; --i) {
+            queue->tasks.push_back( Task(job, i) );
+        }
+    }
+    pendingTasks.fetchAndAddOrdered(last - first);
+
+    QMutexLocker l(&poolMutex);
+    workAvailableCond.wakeAll();
+}
+
+bool
+RenderThreadPoolPrivate::takeAnyTask(int workerIndex,
+                                     Task* task)
+{
+    {
+        TaskQueue* own = queues[workerIndex];
+        QMutexLocker l(&own->mutex);
+        if ( !own->tasks.empty() ) {
+            *task = own->tasks.back();
+            own->tasks.pop_back();
+            pendingTasks.fetchAndAddOrdered(-1);
+
+            return true;
+        }
+    }
+    {
+        QMutexLocker l(&sharedQueue.mutex);
+        if ( !sharedQueue.tasks.empty() ) {
+            *task = sharedQueue.tasks.front();
+            sharedQueue.tasks.pop_front();
+            pendingTasks.fetchAndAddOrdered(-1);
+
+            return true;
+        }
+    }
+
+    ///Steal from the other workers, starting with the next one so that thieves spread over the victims
+    int nWorkers = (int)nStartedWorkers;
+    for (int i = 1; i < nWorkers; ++i) {
+        TaskQueue* victim = queues[(workerIndex + i) % nWorkers];
+        QMutexLocker l(&victim->mutex);
+        if ( !victim->tasks.empty() ) {
+            *task = victim->tasks.front();
+            victim->tasks.pop_front();
+            pendingTasks.fetchAndAddOrdered(-1);
+            stolenTasks.fetchAndAddRelaxed(1);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+RenderThreadPoolPrivate::takeJobTask(TaskQueue* queue,
+                                     Job* job,
+                                     Task* task)
+{
+    QMutexLocker l(&queue->mutex);
+
+    ///The tasks of the job are usually on top of the queue, unless other threads pushed to the same (shared) queue
+    for (std::deque<Task>::reverse_iterator it = queue->tasks.rbegin(); it != queue->tasks.rend(); ++it) {
+        if (it->job == job) {
+            *task = *it;
+            queue->tasks.erase( --(it.base()) );
+            pendingTasks.fetchAndAddOrdered(-1);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+RenderThreadPoolPrivate::runTask(const Task & task)
+{
+    Job* job = task.job;
+    bool failed = false;
+
+    try {
+        (*job->func)(task.index);
+    } catch (...) {
+        failed = true;
+    }
+
+    ///The waiting thread destroys the job as soon as it sees remaining == 0, so it must not be accessed after the mutex is released
+    QMutexLocker l(&job->mutex);
+    if (failed) {
+        job->failed = true;
+    }
+    if (--job->remaining == 0) {
+        job->doneCond.wakeAll();
+    }
+}
+
+RenderThreadPool::RenderThreadPool(int maxThreadCount)
+: _imp( new RenderThreadPoolPrivate(maxThreadCount) )
+{
+}
+
+RenderThreadPool::~RenderThreadPool()
+{
+    delete _imp;
+}
+
+void
+RenderThreadPool::setMaxThreadCount(int maxThreadCount)
+{
+    QMutexLocker l(&_imp->poolMutex);
+
+    _imp->maxThreadCount.fetchAndStoreOrdered( RenderThreadPoolPrivate::threadCountOrIdeal(maxThreadCount) );
+    ///wake up the workers that went idle because they were above the previous count
+    _imp->workAvailableCond.wakeAll();
+}
+
+int
+RenderThreadPool::getMaxThreadCount() const
+{
+    return (int)_imp->maxThreadCount;
+}
+
+int
+RenderThreadPool::getActiveThreadCount() const
+{
+    return (int)_imp->activeWorkers;
+}
+
+bool
+RenderThreadPool::isWorkerThread() const
+{
+    return _imp->getCurrentWorkerIndex() != -1;
+}
+
+U64
+RenderThreadPool::getStolenTasksCount() const
+{
+    return (U64)(int)_imp->stolenTasks;
+}
+
+bool
+RenderThreadPool::parallelFor(int n,
+                              const IndexFunction & func)
+{
+    if (n <= 0) {
+        return true;
+    }
+
+    Job job(&func, n);
+    Task task(&job, 0);
+
+    if ( (n > 1) && (getMaxThreadCount() > 1) ) {
+        _imp->startWorkers();
+        int workerIndex = _imp->getCurrentWorkerIndex();
+        _imp->pushTasks(workerIndex, &job, 1, n);
+
+        ///The calling thread takes part in the loop: it runs the first index, then the tasks of the job that were not stolen
+        _imp->runTask(task);
+        TaskQueue* queue = workerIndex == -1 ? &_imp->sharedQueue : _imp->queues[workerIndex];
+        while ( _imp->takeJobTask(queue, &job, &task) ) {
+            _imp->runTask(task);
+        }
+    } else {
+        for (int i = 0; i < n; ++i) {
+            task.index = i;
+            _imp->runTask(task);
+        }
+    }
+
+    ///Wait for the tasks stolen by other threads
+    QMutexLocker l(&job.mutex);
+    while (job.remaining > 0) {
+        job.doneCond.wait(&job.mutex);
+    }
+
+    return !job.failed;
+}
@@ -0,0 +1,134 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_RENDERTHREADPOOL_H_
+#define NATRON_ENGINE_RENDERTHREADPOOL_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <vector>
+
+#ifndef Q_MOC_RUN
+#include <boost/function.hpp>
+#endif
+
+#include "Global/GlobalDefines.h"
+
+/**
+ * @brief The number of tiles per thread the render window is split into by the host frame threading.
+ * Small tiles balance the load between the threads: a thread which is done steals the remaining tiles of the others.
+ **/
+#define NATRON_RENDER_TILES_PER_THREAD 4
+
+namespace Natron {
+
+struct RenderThreadPoolPrivate;
+
+/**
+ * @brief A work-stealing thread pool used to run the parallel loops of the renderer: the host frame threading
+ * of EffectInstance, the OpenFX multi-thread suite and the viewer texture fill.
+ *
+ * Each worker thread owns a deque of tasks: it pushes and pops the tasks of the loops it starts at the back of its deque,
+ * and when it runs out of work it steals tasks at the front of the deques of the other workers. Threads which are not
+ * workers of the pool push their tasks to a shared queue.
+ *
+ * Loops may be nested: a thread waiting for a loop to finish executes the remaining tasks of that loop instead of blocking,
+ * and never runs a task of another loop while waiting, so that nested loops cannot deadlock nor steal a lock
+ * held by the waiting thread.
+ *
+ * Thread-safety: all functions are MT-safe.
+ **/
+class RenderThreadPool
+{
+public:
+
+    typedef boost::function<void (int)> IndexFunction;
+
+    /**
+     * @brief Creates a pool of maxThreadCount workers. If maxThreadCount is 0, QThread::idealThreadCount() is used.
+     * Worker threads are started on demand, by the first loop that needs them.
+     **/
+    explicit RenderThreadPool(int maxThreadCount = 0);
+
+    ~RenderThreadPool();
+
+    /**
+     * @brief Sets the maximum number of worker threads. Workers above that count go idle.
+     * If maxThreadCount is 0, QThread::idealThreadCount() is used.
+     **/
+    void setMaxThreadCount(int maxThreadCount);
+
+    int getMaxThreadCount() const;
+
+    /**
+     * @brief Returns the number of workers which are running a task. The threads which wait in parallelFor() are not counted.
+     **/
+    int getActiveThreadCount() const;
+
+    /**
+     * @brief Returns true if the calling thread is a worker of this pool.
+     **/
+    bool isWorkerThread() const;
+
+    /**
+     * @brief Calls func(i) for each i in [0, n) using the workers of the pool and the calling thread, and returns
+     * when all the calls are done. Returns false if any of the calls threw an exception.
+     **/
+    bool parallelFor(int n, const IndexFunction & func);
+
+    /**
+     * @brief Same as QtConcurrent::mapped(), but blocking: (*results)[i] = func(inputs[i]) for each input.
+     **/
+    template <typename IN, typename OUT, typename FUNC>
+    bool mapped(const std::vector<IN> & inputs,
+                FUNC func,
+                std::vector<OUT>* results)
+    {
+        results->resize( inputs.size() );
+        MappedFunctor<IN, OUT, FUNC> f(inputs, func, results);
+
+        return parallelFor( (int)inputs.size(), f );
+    }
+
+    /**
+     * @brief Returns the number of tasks that were stolen by a worker from the deque of another worker since the pool was created.
+     **/
+    U64 getStolenTasksCount() const;
+
+private:
+
+    template <typename IN, typename OUT, typename FUNC>
+    class MappedFunctor
+    {
+        const std::vector<IN>* _inputs;
+        FUNC _func;
+        std::vector<OUT>* _results;
+
+    public:
+
+        MappedFunctor(const std::vector<IN> & inputs,
+                      FUNC func,
+                      std::vector<OUT>* results)
+        : _inputs(&inputs)
+        , _func(func)
+        , _results(results)
+        {
+        }
+
+        void operator()(int i)
+        {
+            (*_results)[i] = _func( (*_inputs)[i] );
+        }
+    };
+
+    RenderThreadPoolPrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_RENDERTHREADPOOL_H_
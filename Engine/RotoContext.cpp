@@ -21,6 +21,7 @@
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
 
 #include "Global/MemoryInfo.h"
 #include "Engine/RotoContextPrivate.h"
@@ -33,6 +34,7 @@
 #include "Engine/Hash64.h"
 #include "Engine/Settings.h"
 #include "Engine/Format.h"
+#include "Engine/RotoRasterizer.h"
 #include "Engine/RotoSerialization.h"
 #include "Engine/Transform.h"
 
@@ -40,6 +42,17 @@ using namespace Natron;
 
 ////////////////////////////////////ControlPoint////////////////////////////////////
 
+///Discards the tessellations cached by the bezier of a control point, to be called whenever the point changes
+static void
+invalidateHolderCache(const boost::weak_ptr<Bezier> & holder)
+{
+    boost::shared_ptr<Bezier> bezier = holder.lock();
+
+    if (bezier) {
+        bezier->invalidateTessellationCache();
+    }
+}
+
 BezierCP::BezierCP()
     : _imp( new BezierCPPrivate(boost::shared_ptr<Bezier>()) )
 {
@@ -129,6 +142,7 @@ BezierCP::setPositionAtTime(int time,
         k.setInterpolation(Natron::eKeyframeTypeLinear);
         _imp->curveY->addKeyFrame(k);
     }
+    invalidateHolderCache(_imp->holder);
 }
 
 void
@@ -137,9 +151,12 @@ BezierCP::setStaticPosition(double x,
 {
     ///only called on the main-thread
     assert( QThread::currentThread() == qApp->thread() );
-    QMutexLocker l(&_imp->staticPositionMutex);
-    _imp->x = x;
-    _imp->y = y;
+    {
+        QMutexLocker l(&_imp->staticPositionMutex);
+        _imp->x = x;
+        _imp->y = y;
+    }
+    invalidateHolderCache(_imp->holder);
 }
 
 void
@@ -148,9 +165,12 @@ BezierCP::setLeftBezierStaticPosition(double x,
 {
     ///only called on the main-thread
     assert( QThread::currentThread() == qApp->thread() );
-    QMutexLocker l(&_imp->staticPositionMutex);
-    _imp->leftX = x;
-    _imp->leftY = y;
+    {
+        QMutexLocker l(&_imp->staticPositionMutex);
+        _imp->leftX = x;
+        _imp->leftY = y;
+    }
+    invalidateHolderCache(_imp->holder);
 }
 
 void
@@ -159,9 +179,12 @@ BezierCP::setRightBezierStaticPosition(double x,
 {
     ///only called on the main-thread
     assert( QThread::currentThread() == qApp->thread() );
-    QMutexLocker l(&_imp->staticPositionMutex);
-    _imp->rightX = x;
-    _imp->rightY = y;
+    {
+        QMutexLocker l(&_imp->staticPositionMutex);
+        _imp->rightX = x;
+        _imp->rightY = y;
+    }
+    invalidateHolderCache(_imp->holder);
 }
 
 bool
@@ -283,6 +306,7 @@ BezierCP::setLeftBezierPointAtTime(int time,
         k.setInterpolation(Natron::eKeyframeTypeLinear);
         _imp->curveLeftBezierY->addKeyFrame(k);
     }
+    invalidateHolderCache(_imp->holder);
 }
 
 void
@@ -303,6 +327,7 @@ BezierCP::setRightBezierPointAtTime(int time,
         k.setInterpolation(Natron::eKeyframeTypeLinear);
         _imp->curveRightBezierY->addKeyFrame(k);
     }
+    invalidateHolderCache(_imp->holder);
 }
 
 
@@ -324,6 +349,7 @@ BezierCP::removeAnimation(int currentTime)
     _imp->curveRightBezierX->clearKeyFrames();
     _imp->curveLeftBezierY->clearKeyFrames();
     _imp->curveRightBezierY->clearKeyFrames();
+    invalidateHolderCache(_imp->holder);
 }
 
 void
@@ -352,6 +378,7 @@ BezierCP::removeKeyframe(int time)
         _imp->curveRightBezierY->removeKeyFrameWithTime(time);
     } catch (...) {
     }
+    invalidateHolderCache(_imp->holder);
 }
 
 
@@ -398,6 +425,7 @@ BezierCP::setKeyFrameInterpolation(Natron::KeyframeTypeEnum interp,int index)
     _imp->curveLeftBezierY->setKeyFrameInterpolation(interp, index);
     _imp->curveRightBezierX->setKeyFrameInterpolation(interp, index);
     _imp->curveRightBezierY->setKeyFrameInterpolation(interp, index);
+    invalidateHolderCache(_imp->holder);
 }
 
 int
@@ -728,6 +756,7 @@ BezierCP::clone(const BezierCP & other)
         _imp->masterTrack = other._imp->masterTrack;
         _imp->offsetTime = other._imp->offsetTime;
     }
+    invalidateHolderCache(_imp->holder);
 }
 
 bool
@@ -766,9 +795,12 @@ BezierCP::slaveTo(SequenceTime offsetTime,
 {
     assert( QThread::currentThread() == qApp->thread() );
     assert(!_imp->masterTrack);
-    QWriteLocker l(&_imp->masterMutex);
-    _imp->masterTrack = track;
-    _imp->offsetTime = offsetTime;
+    {
+        QWriteLocker l(&_imp->masterMutex);
+        _imp->masterTrack = track;
+        _imp->offsetTime = offsetTime;
+    }
+    invalidateHolderCache(_imp->holder);
 }
 
 void
@@ -776,8 +808,11 @@ BezierCP::unslave()
 {
     assert( QThread::currentThread() == qApp->thread() );
     assert(_imp->masterTrack);
-    QWriteLocker l(&_imp->masterMutex);
-    _imp->masterTrack.reset();
+    {
+        QWriteLocker l(&_imp->masterMutex);
+        _imp->masterTrack.reset();
+    }
+    invalidateHolderCache(_imp->holder);
 }
 
 boost::shared_ptr<Double_Knob>
@@ -1975,7 +2010,7 @@ bezierSegmentEval(const BezierCP & first,
                   int time,
                   unsigned int mipMapLevel,
                   int nbPointsPerSegment,
-                  std::list< Point >* points, ///< output
+                  std::vector< Point >* points, ///< output
                   RectD* bbox = NULL) ///< input/output (optional)
 {
     Point p0,p1,p2,p3;
@@ -2015,6 +2050,145 @@ bezierSegmentEval(const BezierCP & first,
     }
 }
 
+///Merges the bounding box src into bbox, which may be empty (with infinite bounds)
+static void
+mergeBoundingBox(const RectD & src,
+                 RectD* bbox) ///< input/output
+{
+    bbox->x1 = std::min(bbox->x1, src.x1);
+    bbox->x2 = std::max(bbox->x2, src.x2);
+    bbox->y1 = std::min(bbox->y1, src.y1);
+    bbox->y2 = std::max(bbox->y2, src.y2);
+}
+
+static int
+cacheKeyTime(const BezierPolylineKey & key)
+{
+    return key.time;
+}
+
+static int
+cacheKeyTime(const std::pair<int, unsigned int> & key)
+{
+    return key.first;
+}
+
+///Inserts value in the cache of a bezier, discarding the entries at the times which are the farthest from the time of key
+///if the cache is full: when scrubbing or playing, the times nearby are the ones which are going to be needed again.
+template <typename KEY, typename VALUE>
+static void
+insertInTessellationCache(const KEY & key,
+                          const VALUE & value,
+                          std::map<KEY, VALUE>* cache)
+{
+    int time = cacheKeyTime(key);
+
+    while (cache->size() >= NATRON_BEZIER_TESSELLATION_CACHE_SIZE) {
+        typename std::map<KEY, VALUE>::iterator first = cache->begin();
+        typename std::map<KEY, VALUE>::iterator last = cache->end();
+        --last;
+        if ( (time - cacheKeyTime(first->first)) >= (cacheKeyTime(last->first) - time) ) {
+            cache->erase(first);
+        } else {
+            cache->erase(last);
+        }
+    }
+    (*cache)[key] = value;
+}
+
+void
+BezierPrivate::invalidateCache()
+{
+    QMutexLocker l(&cacheMutex);
+
+    ++cacheAge;
+    polylines.clear();
+    shapes.clear();
+}
+
+bool
+BezierPrivate::hasSlavedPoints() const
+{
+    // PRIVATE - should not lock
+
+    for (BezierCPs::const_iterator it = points.begin(); it != points.end(); ++it) {
+        if ( (*it)->isSlaved() ) {
+            return true;
+        }
+    }
+    for (BezierCPs::const_iterator it = featherPoints.begin(); it != featherPoints.end(); ++it) {
+        if ( (*it)->isSlaved() ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+boost::shared_ptr<const BezierPolyline>
+BezierPrivate::getPolyline(int time,
+                           unsigned int mipMapLevel,
+                           int nbPointsPerSegment,
+                           bool feather) const
+{
+    // PRIVATE - should not lock
+
+    ///The points slaved to a track move with it without notifying the bezier
+    bool cacheable = !hasSlavedPoints();
+    BezierPolylineKey key;
+
+    key.time = time;
+    key.mipMapLevel = mipMapLevel;
+    key.nbPointsPerSegment = nbPointsPerSegment;
+    key.feather = feather;
+
+    U64 age;
+    {
+        QMutexLocker l(&cacheMutex);
+        if (cacheable) {
+            BezierPolylineCache::const_iterator found = polylines.find(key);
+            if ( found != polylines.end() ) {
+                return found->second;
+            }
+        }
+        age = cacheAge;
+    }
+
+    boost::shared_ptr<BezierPolyline> polyline(new BezierPolyline);
+    polyline->bbox.x1 = std::numeric_limits<double>::infinity();
+    polyline->bbox.x2 = -std::numeric_limits<double>::infinity();
+    polyline->bbox.y1 = std::numeric_limits<double>::infinity();
+    polyline->bbox.y2 = -std::numeric_limits<double>::infinity();
+
+    if (nbPointsPerSegment == 0) {
+        bezierSegmentListBboxUpdate(feather ? featherPoints : points, finished, time, mipMapLevel, &polyline->bbox);
+    } else if ( !points.empty() ) {
+        ///The segment joining the last point to the first one exists only if the curve is finished
+        const BezierCPs & cps = feather ? featherPoints : points;
+        BezierCPs::const_iterator next = cps.begin();
+        ++next;
+        for (BezierCPs::const_iterator it = cps.begin(); it != cps.end(); ++it,++next) {
+            if ( next == cps.end() ) {
+                if (!finished) {
+                    break;
+                }
+                next = cps.begin();
+            }
+            bezierSegmentEval(*(*it),*(*next), time, mipMapLevel, nbPointsPerSegment, &polyline->points, &polyline->bbox);
+        }
+    }
+
+    if (cacheable) {
+        QMutexLocker l(&cacheMutex);
+        ///The control points may have been modified since the age was read
+        if (age == cacheAge) {
+            insertInTessellationCache(key, boost::shared_ptr<const BezierPolyline>(polyline), &polylines);
+        }
+    }
+
+    return polyline;
+} // getPolyline
+
 /**
  * @brief Determines if the point (x,y) lies on the bezier curve segment defined by first and last.
  * @returns True if the point is close (according to the acceptance) to the curve, false otherwise.
@@ -2164,6 +2338,7 @@ Bezier::clone(const RotoItem* other)
         }
         _imp->finished = otherBezier->_imp->finished;
     }
+    _imp->invalidateCache();
     RotoDrawableItem::clone(other);
     Q_EMIT cloned();
 }
@@ -2242,6 +2417,7 @@ Bezier::addControlPoint(double x,
         }
         _imp->featherPoints.insert(_imp->featherPoints.end(),fp);
     }
+    _imp->invalidateCache();
     Q_EMIT controlPointAdded();
     return p;
 }
@@ -2382,6 +2558,7 @@ Bezier::addControlPointAfterIndex(int index,
             setKeyframe(currentTime);
         }
     }
+    _imp->invalidateCache();
     Q_EMIT controlPointAdded();
     return p;
 } // addControlPointAfterIndex
@@ -2428,6 +2605,16 @@ Bezier::isPointOnCurve(double x,
         return -1;
     }
 
+    ///The curves lie within the bounding boxes of their control polygons, which are cached: most of the beziers
+    ///are far from the point and are rejected without evaluating their segments
+    {
+        RectD bbox = _imp->getPolyline(time, 0, 0, false)->bbox;
+        mergeBoundingBox(_imp->getPolyline(time, 0, 0, true)->bbox, &bbox);
+        if ( (x < bbox.x1 - distance) || (x > bbox.x2 + distance) || (y < bbox.y1 - distance) || (y > bbox.y2 + distance) ) {
+            return -1;
+        }
+    }
+
     ///For each segment find out if the point lies on the bezier
     int index = 0;
 
@@ -2470,8 +2657,11 @@ Bezier::setCurveFinished(bool finished)
 {
     ///only called on the main-thread
     assert( QThread::currentThread() == qApp->thread() );
-    QMutexLocker l(&itemMutex);
-    _imp->finished = finished;
+    {
+        QMutexLocker l(&itemMutex);
+        _imp->finished = finished;
+    }
+    _imp->invalidateCache();
 }
 
 bool
@@ -2508,6 +2698,7 @@ Bezier::removeControlPointByIndex(int index)
         std::advance(itF, index);
         _imp->featherPoints.erase(itF);
     }
+    _imp->invalidateCache();
     Q_EMIT controlPointRemoved();
 }
 
@@ -3256,6 +3447,24 @@ Bezier::getKeyframesCount() const
     }
 }
 
+void
+Bezier::invalidateTessellationCache()
+{
+    _imp->invalidateCache();
+}
+
+boost::shared_ptr<const BezierPolyline>
+Bezier::getPolylineAtTime(int time,
+                          unsigned int mipMapLevel,
+                          int nbPointsPerSegment,
+                          bool feather) const
+{
+    assert(nbPointsPerSegment > 1);
+    QMutexLocker l(&itemMutex);
+
+    return _imp->getPolyline(time, mipMapLevel, nbPointsPerSegment, feather);
+}
+
 void
 Bezier::evaluateAtTime_DeCasteljau(int time,
                                    unsigned int mipMapLevel,
@@ -3263,21 +3472,11 @@ Bezier::evaluateAtTime_DeCasteljau(int time,
                                    std::list< Natron::Point >* points,
                                    RectD* bbox) const
 {
-    QMutexLocker l(&itemMutex);
-    BezierCPs::const_iterator next = _imp->points.begin();
+    boost::shared_ptr<const BezierPolyline> polyline = getPolylineAtTime(time, mipMapLevel, nbPointsPerSegment, false);
 
-    if ( _imp->points.empty() ) {
-        return;
-    }
-    ++next;
-    for (BezierCPs::const_iterator it = _imp->points.begin(); it != _imp->points.end(); ++it,++next) {
-        if ( next == _imp->points.end() ) {
-            if (!_imp->finished) {
-                break;
-            }
-            next = _imp->points.begin();
-        }
-        bezierSegmentEval(*(*it),*(*next), time,mipMapLevel, nbPointsPerSegment, points,bbox);
+    points->insert( points->end(), polyline->points.begin(), polyline->points.end() );
+    if (bbox) {
+        mergeBoundingBox(polyline->bbox, bbox);
     }
 }
 
@@ -3289,11 +3488,23 @@ Bezier::evaluateFeatherPointsAtTime_DeCasteljau(int time,
                                                 std::list< Natron::Point >* points, ///< output
                                                 RectD* bbox) const ///< output
 {
+    if (evaluateIfEqual) {
+        boost::shared_ptr<const BezierPolyline> polyline = getPolylineAtTime(time, mipMapLevel, nbPointsPerSegment, true);
+
+        points->insert( points->end(), polyline->points.begin(), polyline->points.end() );
+        if (bbox) {
+            mergeBoundingBox(polyline->bbox, bbox);
+        }
+
+        return;
+    }
+
     QMutexLocker l(&itemMutex);
 
     if ( _imp->points.empty() ) {
         return;
     }
+    std::vector<Point> evaluated;
     BezierCPs::const_iterator itCp = _imp->points.begin();
     BezierCPs::const_iterator next = _imp->featherPoints.begin();
     ++next;
@@ -3309,18 +3520,18 @@ Bezier::evaluateFeatherPointsAtTime_DeCasteljau(int time,
             }
             nextCp = _imp->points.begin();
         }
-        if ( !evaluateIfEqual && bezierSegmenEqual(time, **itCp, **nextCp, **it, **next) ) {
+        if ( bezierSegmenEqual(time, **itCp, **nextCp, **it, **next) ) {
             continue;
         }
 
-        bezierSegmentEval(*(*it),*(*next), time, mipMapLevel, nbPointsPerSegment, points, bbox);
+        bezierSegmentEval(*(*it),*(*next), time, mipMapLevel, nbPointsPerSegment, &evaluated, bbox);
     }
+    points->insert( points->end(), evaluated.begin(), evaluated.end() );
 }
 
 RectD
 Bezier::getBoundingBox(int time) const
 {
-    std::list<Point> pts;
     RectD bbox; // a very empty bbox
 
     bbox.x1 = std::numeric_limits<double>::infinity();
@@ -3328,13 +3539,14 @@ Bezier::getBoundingBox(int time) const
     bbox.y1 = std::numeric_limits<double>::infinity();
     bbox.y2 = -std::numeric_limits<double>::infinity();
 
-    QMutexLocker l(&itemMutex);
-    bezierSegmentListBboxUpdate(_imp->points, _imp->finished, time, 0, &bbox);
+    {
+        QMutexLocker l(&itemMutex);
+        mergeBoundingBox(_imp->getPolyline(time, 0, 0, false)->bbox, &bbox);
 #pragma message WARN("TODO: use featherPointsAtDistance")
-    // BUG https://github.com/MrKepzie/Natron/issues/145 : the feather Bezier must be moved by featherdistance before RoD computation!
-    bezierSegmentListBboxUpdate(_imp->featherPoints, _imp->finished, time, 0, &bbox);
-    
-    
+        // BUG https://github.com/MrKepzie/Natron/issues/145 : the feather Bezier must be moved by featherdistance before RoD computation!
+        mergeBoundingBox(_imp->getPolyline(time, 0, 0, true)->bbox, &bbox);
+    }
+
     // EDIT: Partial fix, just pad the BBOX by the feather distance. This might not be accurate but gives at least something
     // enclosing the real bbox and close enough
     double featherDistance = getFeatherDistance(time);
@@ -3739,6 +3951,7 @@ Bezier::load(const RotoItemSerialization & obj)
             _imp->featherPoints.push_back(fp);
         }
     }
+    _imp->invalidateCache();
     RotoDrawableItem::load(obj);
 }
 
@@ -5448,59 +5661,75 @@ RotoContext::renderMask(bool useCache,
     RectI clippedRoI;
     roi.intersect(pixelRod, &clippedRoI);
 
-    cairo_format_t cairoImgFormat;
-    switch (components) {
-    case Natron::eImageComponentAlpha:
-        cairoImgFormat = CAIRO_FORMAT_A8;
-        break;
-    case Natron::eImageComponentRGB:
-        cairoImgFormat = CAIRO_FORMAT_RGB24;
-        break;
-    case Natron::eImageComponentRGBA:
-        cairoImgFormat = CAIRO_FORMAT_ARGB32;
-        break;
-    default:
-        cairoImgFormat = CAIRO_FORMAT_A8;
-        break;
+    bool hasInvertedShape = false;
+#ifdef NATRON_ROTO_INVERTIBLE
+    for (std::list< boost::shared_ptr<Bezier> >::iterator it = splines.begin(); it != splines.end(); ++it) {
+        if ( (*it)->getInverted(time) ) {
+            hasInvertedShape = true;
+            break;
+        }
     }
+#endif
 
-    ////Allocate the cairo temporary buffer
-    cairo_surface_t* cairoImg = cairo_image_surface_create( cairoImgFormat, pixelRod.width(), pixelRod.height() );
-    cairo_surface_set_device_offset(cairoImg, -pixelRod.x1, -pixelRod.y1);
-    if (cairo_surface_status(cairoImg) != CAIRO_STATUS_SUCCESS) {
-        appPTR->removeFromNodeCache(image);
+    bool rendered = true;
+    if (!hasInvertedShape) {
+        ///Only the RoI is rendered
+        rendered = _imp->renderInternal(splines, mipmapLevel, time, clippedRoI, image.get());
+    } else {
+        cairo_format_t cairoImgFormat;
+        switch (components) {
+        case Natron::eImageComponentAlpha:
+            cairoImgFormat = CAIRO_FORMAT_A8;
+            break;
+        case Natron::eImageComponentRGB:
+            cairoImgFormat = CAIRO_FORMAT_RGB24;
+            break;
+        case Natron::eImageComponentRGBA:
+            cairoImgFormat = CAIRO_FORMAT_ARGB32;
+            break;
+        default:
+            cairoImgFormat = CAIRO_FORMAT_A8;
+            break;
+        }
 
-        return image;
-    }
-    cairo_t* cr = cairo_create(cairoImg);
-    //cairo_set_fill_rule(cr, CAIRO_FILL_RULE_EVEN_ODD); // creates holes on self-overlapping shapes
-    cairo_set_fill_rule(cr, CAIRO_FILL_RULE_WINDING);
+        ////Allocate the cairo temporary buffer
+        cairo_surface_t* cairoImg = cairo_image_surface_create( cairoImgFormat, pixelRod.width(), pixelRod.height() );
+        cairo_surface_set_device_offset(cairoImg, -pixelRod.x1, -pixelRod.y1);
+        if (cairo_surface_status(cairoImg) != CAIRO_STATUS_SUCCESS) {
+            appPTR->removeFromNodeCache(image);
+
+            return image;
+        }
+        cairo_t* cr = cairo_create(cairoImg);
+        //cairo_set_fill_rule(cr, CAIRO_FILL_RULE_EVEN_ODD); // creates holes on self-overlapping shapes
+        cairo_set_fill_rule(cr, CAIRO_FILL_RULE_WINDING);
 
-    ///We could also propose the user to render a mask to SVG
-    _imp->renderInternal(cr, cairoImg, splines,mipmapLevel,time);
+        ///We could also propose the user to render a mask to SVG
+        _imp->renderInternal(cr, cairoImg, splines,mipmapLevel,time);
 
-    switch (depth) {
-    case Natron::eImageBitDepthFloat:
-        convertCairoImageToNatronImage<float, 1>(cairoImg, image.get(), pixelRod);
-        break;
-    case Natron::eImageBitDepthByte:
-        convertCairoImageToNatronImage<unsigned char, 255>(cairoImg, image.get(), pixelRod);
-        break;
-    case Natron::eImageBitDepthShort:
-        convertCairoImageToNatronImage<unsigned short, 65535>(cairoImg, image.get(), pixelRod);
-        break;
-    case Natron::eImageBitDepthNone:
-        assert(false);
-        break;
-    }
+        switch (depth) {
+        case Natron::eImageBitDepthFloat:
+            convertCairoImageToNatronImage<float, 1>(cairoImg, image.get(), pixelRod);
+            break;
+        case Natron::eImageBitDepthByte:
+            convertCairoImageToNatronImage<unsigned char, 255>(cairoImg, image.get(), pixelRod);
+            break;
+        case Natron::eImageBitDepthShort:
+            convertCairoImageToNatronImage<unsigned short, 65535>(cairoImg, image.get(), pixelRod);
+            break;
+        case Natron::eImageBitDepthNone:
+            assert(false);
+            break;
+        }
 
-    cairo_destroy(cr);
-    ////Free the buffer used by Cairo
-    cairo_surface_destroy(cairoImg);
+        cairo_destroy(cr);
+        ////Free the buffer used by Cairo
+        cairo_surface_destroy(cairoImg);
+    }
 
 
     ////////////////////////////////////
-    if ( node->aborted() ) {
+    if ( !rendered || node->aborted() ) {
         //if render was aborted, remove the frame from the cache as it contains only garbage
         appPTR->removeFromNodeCache(image);
     } else {
@@ -5516,6 +5745,242 @@ RotoContext::renderMask(bool useCache,
     return image;
 } // renderMask
 
+///The operator parameter indexes cairo_operator_t, the native rasterizer uses the same order
+BOOST_STATIC_ASSERT( (int)eRotoCompositingOperatorOver == (int)CAIRO_OPERATOR_OVER );
+BOOST_STATIC_ASSERT( (int)eRotoCompositingOperatorHslLuminosity == (int)CAIRO_OPERATOR_HSL_LUMINOSITY );
+
+/**
+ * @brief Tessellates the bezier at the given time: its inner polygon, and the feather patches which join it to the
+ * feather contour, that is the polygon of the feather points moved by featherDist along its normals.
+ * The coordinates are in pixels at the given mipmap level.
+ **/
+static void
+tessellateBezier(const Bezier & bezier,
+                 int time,
+                 unsigned int mipmapLevel,
+                 double featherDist,
+                 RotoShapeTessellation* tessellation)
+{
+    ///Adjust the feather distance so it takes the mipmap level into account
+    if (mipmapLevel != 0) {
+        featherDist /= (1 << mipmapLevel);
+    }
+
+#pragma message WARN("the following code very stange. Why evaluate 49 Bezier points when you only need to consider the end points?")
+    // PLEASE EXPLAIN THAT ``ALGORITHM''
+
+    ///here is the polygon of the feather bezier
+    ///This is used only if the feather distance is different of 0 and the feather points equal
+    ///the control points in order to still be able to apply the feather distance.
+    std::list<Point> featherPolygon;
+    std::list<Point> bezierPolygon;
+    RectD featherPolyBBox( std::numeric_limits<double>::infinity(),
+                           std::numeric_limits<double>::infinity(),
+                           -std::numeric_limits<double>::infinity(),
+                           -std::numeric_limits<double>::infinity() );
+
+    bezier.evaluateFeatherPointsAtTime_DeCasteljau(time, mipmapLevel, 50, true, &featherPolygon, &featherPolyBBox);
+    bezier.evaluateAtTime_DeCasteljau(time, mipmapLevel, 50, &bezierPolygon, NULL);
+
+    assert( !featherPolygon.empty() );
+
+    tessellation->polygon.assign( bezierPolygon.begin(), bezierPolygon.end() );
+    tessellation->featherPatches.clear();
+
+    std::list<Point>::iterator cur = featherPolygon.begin();
+    std::list<Point>::iterator next = cur;
+    ++next;
+    std::list<Point>::iterator prev = featherPolygon.end();
+    --prev;
+    std::list<Point>::iterator bezIT = bezierPolygon.begin();
+    std::list<Point>::iterator prevBez = bezierPolygon.end();
+    --prevBez;
+    double absFeatherDist = std::abs(featherDist);
+    Point p1 = *cur;
+    double norm = sqrt( (next->x - prev->x) * (next->x - prev->x) + (next->y - prev->y) * (next->y - prev->y) );
+    assert(norm != 0);
+    double dx = -( (next->y - prev->y) / norm );
+    double dy = ( (next->x - prev->x) / norm );
+    p1.x = cur->x + dx;
+    p1.y = cur->y + dy;
+
+
+#pragma message WARN("pointInPolygon should not be used, see comment")
+    /*
+       The pointInPolygon function should not be used.
+       The algorithm to know which side is the outside of a polygon consists in computing the global polygon orientation.
+       To compute the orientation, compute its surface. If positive the polygon is clockwise, if negative it's counterclockwise.
+       to compute the surface, take the starting point of the polygon, and imagine a fan made of all the triangles
+       pointing at this point. The surface of a tringle is half the cross-product of two of its sides issued from
+       the same point (the starting point of the polygon, in this case.
+       The orientation of a polygon has to be computed only once for each modification of the polygon (whenever it's edited), and
+       should be stored with the polygon.
+       Of course an 8-shaped polygon doesn't have an outside, but it still has an orientation. The feather direction
+       should follow this orientation.
+     */
+    bool inside = Bezier::pointInPolygon(p1, featherPolygon,featherPolyBBox,Bezier::eFillRuleOddEven);
+    if ( ( !inside && (featherDist < 0) ) || ( inside && (featherDist > 0) ) ) {
+        p1.x = cur->x - dx * absFeatherDist;
+        p1.y = cur->y - dy * absFeatherDist;
+    } else {
+        p1.x = cur->x + dx * absFeatherDist;
+        p1.y = cur->y + dy * absFeatherDist;
+    }
+
+    Point origin = p1;
+
+    ++prev; ++next; ++cur; ++bezIT; ++prevBez;
+
+    for (;; ++prev,++cur,++next,++bezIT,++prevBez) { // for each point in polygon
+        if ( next == featherPolygon.end() ) {
+            next = featherPolygon.begin();
+        }
+        if ( prev == featherPolygon.end() ) {
+            prev = featherPolygon.begin();
+        }
+        if ( bezIT == bezierPolygon.end() ) {
+            bezIT = bezierPolygon.begin();
+        }
+        if ( prevBez == bezierPolygon.end() ) {
+            prevBez = bezierPolygon.begin();
+        }
+        bool mustStop = false;
+        if ( cur == featherPolygon.end() ) {
+            mustStop = true;
+            cur = featherPolygon.begin();
+        }
+
+        ///skip it
+        if ( (cur->x == prev->x) && (cur->y == prev->y) ) {
+            continue;
+        }
+
+        Point p2;
+        if (!mustStop) {
+            norm = sqrt( (next->x - prev->x) * (next->x - prev->x) + (next->y - prev->y) * (next->y - prev->y) );
+            assert(norm != 0);
+            dx = -( (next->y - prev->y) / norm );
+            dy = ( (next->x - prev->x) / norm );
+            p2.x = cur->x + dx;
+            p2.y = cur->y + dy;
+
+#pragma message WARN("pointInPolygon should not be used, see comment")
+            /*
+               The pointInPolygon function should not be used.
+               The algorithm to know which side is the outside of a polygon consists in computing the global polygon orientation.
+               To compute the orientation, compute its surface. If positive the polygon is clockwise, if negative it's counterclockwise.
+               to compute the surface, take the starting point of the polygon, and imagine a fan made of all the triangles
+               pointing at this point. The surface of a tringle is half the cross-product of two of its sides issued from
+               the same point (the starting point of the polygon, in this case.
+               The orientation of a polygon has to be computed only once for each modification of the polygon (whenever it's edited), and
+               should be stored with the polygon.
+               Of course an 8-shaped polygon doesn't have an outside, but it still has an orientation. The feather direction
+               should follow this orientation.
+             */
+            inside = Bezier::pointInPolygon(p2, featherPolygon, featherPolyBBox,Bezier::eFillRuleOddEven);
+            if ( ( !inside && (featherDist < 0) ) || ( inside && (featherDist > 0) ) ) {
+                p2.x = cur->x - dx * absFeatherDist;
+                p2.y = cur->y - dy * absFeatherDist;
+            } else {
+                p2.x = cur->x + dx * absFeatherDist;
+                p2.y = cur->y + dy * absFeatherDist;
+            }
+        } else {
+            p2 = origin;
+        }
+
+        ///the patch goes from the bezier (p0, p3) to the feather contour (p1, p2)
+        RotoFeatherPatch patch;
+        patch.p[0] = *prevBez;
+        patch.p[1] = p1;
+        patch.p[2] = p2;
+        patch.p[3] = *bezIT;
+        tessellation->featherPatches.push_back(patch);
+
+        if (mustStop) {
+            break;
+        }
+
+        p1 = p2;
+    }  // for each point in polygon
+
+    tessellation->computeBoundingBox();
+} // tessellateBezier
+
+boost::shared_ptr<const RotoShapeTessellation>
+Bezier::getShapeTessellation(int time,
+                             unsigned int mipMapLevel) const
+{
+    double featherDist = getFeatherDistance(time);
+    bool cacheable;
+    {
+        QMutexLocker l(&itemMutex);
+        cacheable = !_imp->hasSlavedPoints();
+    }
+    std::pair<int, unsigned int> key(time, mipMapLevel);
+    U64 age;
+    {
+        QMutexLocker l(&_imp->cacheMutex);
+        if (cacheable) {
+            BezierShapeCache::const_iterator found = _imp->shapes.find(key);
+            if ( ( found != _imp->shapes.end() ) && (found->second.featherDistance == featherDist) ) {
+                return found->second.tessellation;
+            }
+        }
+        age = _imp->cacheAge;
+    }
+
+    boost::shared_ptr<RotoShapeTessellation> tessellation(new RotoShapeTessellation);
+    tessellateBezier(*this, time, mipMapLevel, featherDist, tessellation.get());
+
+    if (cacheable) {
+        QMutexLocker l(&_imp->cacheMutex);
+        ///The control points may have been modified since the age was read
+        if (age == _imp->cacheAge) {
+            BezierShapeCacheEntry entry;
+            entry.featherDistance = featherDist;
+            entry.tessellation = tessellation;
+            insertInTessellationCache(key, entry, &_imp->shapes);
+        }
+    }
+
+    return tessellation;
+}
+
+///Returns true if the bezier must be rendered at the given time
+static bool
+isBezierRendered(const Bezier & bezier,
+                 int time)
+{
+    ///render the bezier only if finished (closed) and activated
+    return bezier.isCurveFinished() && bezier.isActivated(time) && bezier.getControlPointsCount() > 1;
+}
+
+bool
+RotoContextPrivate::renderInternal(const std::list< boost::shared_ptr<Bezier> > & splines,
+                                   unsigned int mipmapLevel,
+                                   int time,
+                                   const RectI & roi,
+                                   Natron::Image* image)
+{
+    std::vector<RotoRasterizerShape> shapes;
+
+    for (std::list<boost::shared_ptr<Bezier> >::const_iterator it2 = splines.begin(); it2 != splines.end(); ++it2) {
+        if ( !isBezierRendered(**it2, time) ) {
+            continue;
+        }
+        shapes.push_back( RotoRasterizerShape() );
+        RotoRasterizerShape & shape = shapes.back();
+        shape.tessellation = (*it2)->getShapeTessellation(time, mipmapLevel);
+        (*it2)->getColor(time, shape.color);
+        shape.opacity = (*it2)->getOpacity(time);
+        shape.fallOff = (*it2)->getFeatherFallOff(time);
+        shape.compositingOperator = (RotoCompositingOperatorEnum)(*it2)->getCompositingOperator();
+    }
+
+    return RotoRasterizer::renderShapes( shapes, roi, image, appPTR->getRenderThreadPool() );
+}
+
 void
 RotoContextPrivate::renderInternal(cairo_t* cr,
                                    cairo_surface_t* cairoImg,
@@ -5531,15 +5996,13 @@ RotoContextPrivate::renderInternal(cairo_t* cr,
     // maybe the inner polygon should be made of mesh patterns too?
     cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
     for (std::list<boost::shared_ptr<Bezier> >::const_iterator it2 = splines.begin(); it2 != splines.end(); ++it2) {
-        ///render the bezier only if finished (closed) and activated
-        if ( !(*it2)->isCurveFinished() || !(*it2)->isActivated(time) || ( (*it2)->getControlPointsCount() <= 1 ) ) {
+        if ( !isBezierRendered(**it2, time) ) {
             continue;
         }
 
 
         double fallOff = (*it2)->getFeatherFallOff(time);
         double fallOffInverse = 1. / fallOff;
-        double featherDist = (*it2)->getFeatherDistance(time);
         double opacity = (*it2)->getOpacity(time);
 #ifdef NATRON_ROTO_INVERTIBLE
         bool inverted = (*it2)->getInverted(time);
@@ -5572,139 +6035,15 @@ RotoContextPrivate::renderInternal(cairo_t* cr,
             continue;
         }
 
-        ///Adjust the feather distance so it takes the mipmap level into account
-        if (mipmapLevel != 0) {
-            featherDist /= (1 << mipmapLevel);
-        }
-
-#pragma message WARN("the following code very stange. Why evaluate 49 Bezier points when you only need to consider the end points?")
-        // PLEASE EXPLAIN THAT ``ALGORITHM''
-
-        ///here is the polygon of the feather bezier
-        ///This is used only if the feather distance is different of 0 and the feather points equal
-        ///the control points in order to still be able to apply the feather distance.
-        std::list<Point> featherPolygon;
-        std::list<Point> bezierPolygon;
-        RectD featherPolyBBox( std::numeric_limits<double>::infinity(),
-                               std::numeric_limits<double>::infinity(),
-                               -std::numeric_limits<double>::infinity(),
-                               -std::numeric_limits<double>::infinity() );
+        boost::shared_ptr<const RotoShapeTessellation> tessellation = (*it2)->getShapeTessellation(time, mipmapLevel);
 
-        (*it2)->evaluateFeatherPointsAtTime_DeCasteljau(time, mipmapLevel, 50, true, &featherPolygon, &featherPolyBBox);
-        (*it2)->evaluateAtTime_DeCasteljau(time, mipmapLevel, 50, &bezierPolygon, NULL);
-
-
-        assert( !featherPolygon.empty() );
-
-        std::list<Point> featherContour;
-        std::list<Point>::iterator cur = featherPolygon.begin();
-        std::list<Point>::iterator next = cur;
-        ++next;
-        std::list<Point>::iterator prev = featherPolygon.end();
-        --prev;
-        std::list<Point>::iterator bezIT = bezierPolygon.begin();
-        std::list<Point>::iterator prevBez = bezierPolygon.end();
-        --prevBez;
-        double absFeatherDist = std::abs(featherDist);
-        Point p1 = *cur;
-        double norm = sqrt( (next->x - prev->x) * (next->x - prev->x) + (next->y - prev->y) * (next->y - prev->y) );
-        assert(norm != 0);
-        double dx = -( (next->y - prev->y) / norm );
-        double dy = ( (next->x - prev->x) / norm );
-        p1.x = cur->x + dx;
-        p1.y = cur->y + dy;
-
-
-#pragma message WARN("pointInPolygon should not be used, see comment")
-        /*
-           The pointInPolygon function should not be used.
-           The algorithm to know which side is the outside of a polygon consists in computing the global polygon orientation.
-           To compute the orientation, compute its surface. If positive the polygon is clockwise, if negative it's counterclockwise.
-           to compute the surface, take the starting point of the polygon, and imagine a fan made of all the triangles
-           pointing at this point. The surface of a tringle is half the cross-product of two of its sides issued from
-           the same point (the starting point of the polygon, in this case.
-           The orientation of a polygon has to be computed only once for each modification of the polygon (whenever it's edited), and
-           should be stored with the polygon.
-           Of course an 8-shaped polygon doesn't have an outside, but it still has an orientation. The feather direction
-           should follow this orientation.
-         */
-        bool inside = Bezier::pointInPolygon(p1, featherPolygon,featherPolyBBox,Bezier::eFillRuleOddEven);
-        if ( ( !inside && (featherDist < 0) ) || ( inside && (featherDist > 0) ) ) {
-            p1.x = cur->x - dx * absFeatherDist;
-            p1.y = cur->y - dy * absFeatherDist;
-        } else {
-            p1.x = cur->x + dx * absFeatherDist;
-            p1.y = cur->y + dy * absFeatherDist;
-        }
-
-        Point origin = p1;
-        featherContour.push_back(p1);
-
-        ++prev; ++next; ++cur; ++bezIT; ++prevBez;
-
-        for (;; ++prev,++cur,++next,++bezIT,++prevBez) { // for each point in polygon
-            if ( next == featherPolygon.end() ) {
-                next = featherPolygon.begin();
-            }
-            if ( prev == featherPolygon.end() ) {
-                prev = featherPolygon.begin();
-            }
-            if ( bezIT == bezierPolygon.end() ) {
-                bezIT = bezierPolygon.begin();
-            }
-            if ( prevBez == bezierPolygon.end() ) {
-                prevBez = bezierPolygon.begin();
-            }
-            bool mustStop = false;
-            if ( cur == featherPolygon.end() ) {
-                mustStop = true;
-                cur = featherPolygon.begin();
-            }
-
-            ///skip it
-            if ( (cur->x == prev->x) && (cur->y == prev->y) ) {
-                continue;
-            }
-
-            Point p0, p0p1, p1p0, p2, p2p3, p3p2, p3;
-            p0.x = prevBez->x;
-            p0.y = prevBez->y;
-            p3.x = bezIT->x;
-            p3.y = bezIT->y;
-
-            if (!mustStop) {
-                norm = sqrt( (next->x - prev->x) * (next->x - prev->x) + (next->y - prev->y) * (next->y - prev->y) );
-                assert(norm != 0);
-                dx = -( (next->y - prev->y) / norm );
-                dy = ( (next->x - prev->x) / norm );
-                p2.x = cur->x + dx;
-                p2.y = cur->y + dy;
-
-#pragma message WARN("pointInPolygon should not be used, see comment")
-                /*
-                   The pointInPolygon function should not be used.
-                   The algorithm to know which side is the outside of a polygon consists in computing the global polygon orientation.
-                   To compute the orientation, compute its surface. If positive the polygon is clockwise, if negative it's counterclockwise.
-                   to compute the surface, take the starting point of the polygon, and imagine a fan made of all the triangles
-                   pointing at this point. The surface of a tringle is half the cross-product of two of its sides issued from
-                   the same point (the starting point of the polygon, in this case.
-                   The orientation of a polygon has to be computed only once for each modification of the polygon (whenever it's edited), and
-                   should be stored with the polygon.
-                   Of course an 8-shaped polygon doesn't have an outside, but it still has an orientation. The feather direction
-                   should follow this orientation.
-                 */
-                inside = Bezier::pointInPolygon(p2, featherPolygon, featherPolyBBox,Bezier::eFillRuleOddEven);
-                if ( ( !inside && (featherDist < 0) ) || ( inside && (featherDist > 0) ) ) {
-                    p2.x = cur->x - dx * absFeatherDist;
-                    p2.y = cur->y - dy * absFeatherDist;
-                } else {
-                    p2.x = cur->x + dx * absFeatherDist;
-                    p2.y = cur->y + dy * absFeatherDist;
-                }
-            } else {
-                p2 = origin;
-            }
-            featherContour.push_back(p2);
+        for (std::vector<RotoFeatherPatch>::const_iterator patch = tessellation->featherPatches.begin();
+             patch != tessellation->featherPatches.end(); ++patch) {
+            const Point & p0 = patch->p[0];
+            const Point & p1 = patch->p[1];
+            const Point & p2 = patch->p[2];
+            const Point & p3 = patch->p[3];
+            Point p0p1, p1p0, p2p3, p3p2;
 
             ///linear interpolation
             p0p1.x = (p0.x * fallOff * 2. + fallOffInverse * p1.x) / (fallOff * 2. + fallOffInverse);
@@ -5749,13 +6088,7 @@ RotoContextPrivate::renderInternal(cairo_t* cr,
             assert(cairo_pattern_status(mesh) == CAIRO_STATUS_SUCCESS);
 
             cairo_mesh_pattern_end_patch(mesh);
-
-            if (mustStop) {
-                break;
-            }
-
-            p1 = p2;
-        }  // for each point in polygon
+        }  // for each patch
 
         cairo_set_source_rgba(cr, shapeColor[0], shapeColor[1], shapeColor[2], opacity);
 
@@ -19,6 +19,7 @@
 #include <list>
 #include <set>
 #include <string>
+#include <vector>
 
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/scoped_ptr.hpp>
@@ -46,6 +47,7 @@ CLANG_DIAG_ON(deprecated-declarations)
 namespace Natron {
 class Image;
 class Node;
+struct RotoShapeTessellation;
 }
 namespace boost {
 namespace serialization {
@@ -516,6 +518,16 @@ private:
  **/
 
 
+/**
+ * @brief The points evaluated along a bezier (or along its feather) at a given time, and the bounding box of the control
+ * polygons of its segments.
+ **/
+struct BezierPolyline
+{
+    std::vector<Natron::Point> points;
+    RectD bbox;
+};
+
 struct BezierPrivate;
 class Bezier
     : public RotoDrawableItem
@@ -723,11 +735,33 @@ public:
                                                  RectD* bbox) const;
 
     /**
-     * @brief Returns the bounding box of the bezier. The last value computed by evaluateAtTime_DeCasteljau will be returned,
-     * otherwise if it has never been called, evaluateAtTime_DeCasteljau will be called to compute the bounding box.
+     * @brief Same as evaluateAtTime_DeCasteljau, or as evaluateFeatherPointsAtTime_DeCasteljau with evaluateIfEqual
+     * if feather is true, but the polyline is shared with the tessellation cache of the bezier instead of being copied.
+     **/
+    boost::shared_ptr<const BezierPolyline> getPolylineAtTime(int time,
+                                                              unsigned int mipMapLevel,
+                                                              int nbPointsPerSegment,
+                                                              bool feather) const;
+
+    /**
+     * @brief Returns the tessellation of the bezier and of its feather used to render it at the given time, in pixels
+     * at the given mipmap level.
+     **/
+    boost::shared_ptr<const Natron::RotoShapeTessellation> getShapeTessellation(int time,unsigned int mipMapLevel) const;
+
+    /**
+     * @brief Returns the bounding box of the bezier, that is the bounding box of the control polygons of the bezier and of
+     * its feather, padded by the feather distance.
      **/
     RectD getBoundingBox(int time) const;
 
+    /**
+     * @brief The polylines, bounding boxes and tessellations above are cached per time and mipmap level until the
+     * control points are modified. This discards them, it is called by the control points whenever they change.
+     * The control points slaved to a track move with it, so the beziers which have some are never cached.
+     **/
+    void invalidateTessellationCache();
+
     /**
      * @brief Returns a const ref to the control points of the bezier curve. This can only ever be called on the main thread.
      **/
@@ -148,6 +148,44 @@ struct BezierCPPrivate
 class BezierCP;
 typedef std::list< boost::shared_ptr<BezierCP> > BezierCPs;
 
+///The number of polylines (and of shape tessellations) a Bezier keeps in its cache
+#define NATRON_BEZIER_TESSELLATION_CACHE_SIZE 64
+
+///Identifies a polyline in the cache of a Bezier
+struct BezierPolylineKey
+{
+    int time;
+    unsigned int mipMapLevel;
+    int nbPointsPerSegment; //< 0 if only the bounding box of the control polygons is computed
+    bool feather;
+
+    bool operator<(const BezierPolylineKey & other) const
+    {
+        if (time != other.time) {
+            return time < other.time;
+        }
+        if (mipMapLevel != other.mipMapLevel) {
+            return mipMapLevel < other.mipMapLevel;
+        }
+        if (nbPointsPerSegment != other.nbPointsPerSegment) {
+            return nbPointsPerSegment < other.nbPointsPerSegment;
+        }
+
+        return !feather && other.feather;
+    }
+};
+
+///A shape tessellation in the cache of a Bezier. The feather distance is a parameter of the item and not of its
+///control points, so the tessellation is valid only as long as it does not change.
+struct BezierShapeCacheEntry
+{
+    double featherDistance;
+    boost::shared_ptr<const Natron::RotoShapeTessellation> tessellation;
+};
+
+typedef std::map<BezierPolylineKey, boost::shared_ptr<const BezierPolyline> > BezierPolylineCache;
+typedef std::map<std::pair<int, unsigned int>, BezierShapeCacheEntry> BezierShapeCache;
+
 
 struct BezierPrivate
 {
@@ -160,6 +198,11 @@ struct BezierPrivate
     double featherPointsAtDistanceVal; //< the distance value used to compute featherPointsAtDistance. if == 0., use featherPoints. if Bezier::getFeatherDistance() returns a different value, featherPointsAtDistance must be updated.
     bool finished; //< when finished is true, the last point of the list is connected to the first point of the list.
 
+    mutable QMutex cacheMutex; //< protects cacheAge, polylines and shapes
+    U64 cacheAge; //< incremented whenever the control points change, so that a tessellation computed meanwhile is not cached
+    mutable BezierPolylineCache polylines;
+    mutable BezierShapeCache shapes;
+
     BezierPrivate()
         : points()
           , featherPoints()
@@ -167,9 +210,29 @@ struct BezierPrivate
           , featherPointsAtDistance()
           , featherPointsAtDistanceVal(0.)
           , finished(false)
+          , cacheMutex()
+          , cacheAge(0)
+          , polylines()
+          , shapes()
     {
     }
 
+    /**
+     * @brief Discards the cached polylines and shape tessellations.
+     **/
+    void invalidateCache();
+
+    /**
+     * @brief Returns true if one of the control points or feather points is slaved to a track.
+     **/
+    bool hasSlavedPoints() const;
+
+    /**
+     * @brief Returns the polyline of the control points, or of the feather points if feather is true, evaluated at the given time.
+     * If nbPointsPerSegment is 0 only its bounding box is computed. The polyline is looked up in the cache first.
+     **/
+    boost::shared_ptr<const BezierPolyline> getPolyline(int time,unsigned int mipMapLevel,int nbPointsPerSegment,bool feather) const;
+
     bool hasKeyframeAtTime(int time) const
     {
         // PRIVATE - should not lock
@@ -676,6 +739,17 @@ struct RotoContextPrivate
         ++age;
     }
 
+    /**
+     * @brief Renders the splines with the native rasterizer (see RotoRasterizer.h) into the pixels of roi of image.
+     * Returns false if the rendering failed.
+     **/
+    bool renderInternal(const std::list< boost::shared_ptr<Bezier> > & splines,unsigned int mipmapLevel,int time,
+                        const RectI & roi,Natron::Image* image);
+
+    /**
+     * @brief Renders the splines with cairo into cairoImg. This is only used for the inverted shapes, which the native
+     * rasterizer does not handle.
+     **/
     void renderInternal(cairo_t* cr,cairo_surface_t* cairoImg,const std::list< boost::shared_ptr<Bezier> > & splines,
                         unsigned int mipmapLevel,int time);
 
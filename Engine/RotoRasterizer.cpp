@@ -0,0 +1,895 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include "RotoRasterizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <boost/bind.hpp>
+
+#include "Engine/Image.h"
+#include "Engine/ImageKernels.h"
+#include "Engine/Lut.h"
+#include "Engine/RenderThreadPool.h"
+
+///Number of intervals of the table giving the alpha across a feather patch
+#define NATRON_ROTO_FEATHER_TABLE_SIZE 256
+
+using namespace Natron;
+
+void
+RotoShapeTessellation::computeBoundingBox()
+{
+    double xmin = std::numeric_limits<double>::infinity();
+    double ymin = std::numeric_limits<double>::infinity();
+    double xmax = -std::numeric_limits<double>::infinity();
+    double ymax = -std::numeric_limits<double>::infinity();
+
+    for (std::vector<Natron::Point>::const_iterator it = polygon.begin(); it != polygon.end(); ++it) {
+        xmin = std::min(xmin, it->x);
+        ymin = std::min(ymin, it->y);
+        xmax = std::max(xmax, it->x);
+        ymax = std::max(ymax, it->y);
+    }
+    for (std::vector<RotoFeatherPatch>::const_iterator it = featherPatches.begin(); it != featherPatches.end(); ++it) {
+        for (int i = 0; i < 4; ++i) {
+            xmin = std::min(xmin, it->p[i].x);
+            ymin = std::min(ymin, it->p[i].y);
+            xmax = std::max(xmax, it->p[i].x);
+            ymax = std::max(ymax, it->p[i].y);
+        }
+    }
+    if ( (xmin <= xmax) && (ymin <= ymax) ) {
+        bbox = RectD(xmin, ymin, xmax, ymax);
+    } else {
+        bbox.clear();
+    }
+}
+
+namespace {
+
+struct PreparedShape
+{
+    const RotoShapeTessellation* tessellation;
+    RotoCompositingOperatorEnum op;
+    ///The premultiplied color of the shape where it is fully covered
+    float src[4];
+    ///The operator changes the destination outside of the shape
+    bool unbounded;
+    ///The pixels which may be changed by the shape
+    RectI bounds;
+    ///The alpha across the feather patches, relative to the opacity
+    float featherAlpha[NATRON_ROTO_FEATHER_TABLE_SIZE + 1];
+};
+
+struct RenderContext
+{
+    std::vector<PreparedShape> shapes;
+    RectI window;
+    int nComps;
+    void* pixels;
+    int rowElements;
+    int rowsPerBand;
+};
+
+inline float
+clamp01(float v)
+{
+    // NaNs go to 0
+    return v > 0.f ? (v < 1.f ? v : 1.f) : 0.f;
+}
+
+inline double
+clamp(double v,
+      double vmin,
+      double vmax)
+{
+    return v > vmin ? (v < vmax ? v : vmax) : vmin;
+}
+
+/**
+ * @brief The cairo mesh patches had the control points (2F p0 + p1 / F) / (2F + 1 / F) and (F p0 + 2 p1 / F) / (F + 2 / F)
+ * on the sides going from the inner point p0 to the outer point p1, where F is the fall-off. The point of parameter u
+ * of these sides is at the fraction f(u) = 3 (1-u)^2 u a + 3 (1-u) u^2 b + u^3 of the way to p1, with a = 1 / (2F^2 + 1)
+ * and b = 2 / (F^2 + 2), and the alpha of the patch was interpolated linearly in u. The mesh was both the source and
+ * the mask of the paint, hence the alpha at the fraction s of the way to the outer contour is (1 - f^-1(s))^2.
+ **/
+void
+computeFeatherAlpha(double fallOff,
+                    float* table)
+{
+    fallOff = std::max(fallOff, 0.);
+    const double a = 1. / (2. * fallOff * fallOff + 1.);
+    const double b = 2. / (fallOff * fallOff + 2.);
+
+    for (int i = 0; i <= NATRON_ROTO_FEATHER_TABLE_SIZE; ++i) {
+        const double s = (double)i / NATRON_ROTO_FEATHER_TABLE_SIZE;
+        ///f is increasing from 0 to 1 because 0 <= a <= b <= 1
+        double lo = 0.;
+        double hi = 1.;
+        for (int k = 0; k < 32; ++k) {
+            const double u = (lo + hi) / 2.;
+            const double f = 3. * (1. - u) * (1. - u) * u * a + 3. * (1. - u) * u * u * b + u * u * u;
+            if (f < s) {
+                lo = u;
+            } else {
+                hi = u;
+            }
+        }
+        const double u = (lo + hi) / 2.;
+        table[i] = (float)( (1. - u) * (1. - u) );
+    }
+}
+
+inline float
+featherAlphaAt(const float* table,
+               double s)
+{
+    const double x = clamp(s, 0., 1.) * NATRON_ROTO_FEATHER_TABLE_SIZE;
+    const int i = std::min( (int)x, NATRON_ROTO_FEATHER_TABLE_SIZE - 1 );
+    const float t = (float)(x - i);
+
+    return table[i] + (table[i + 1] - table[i]) * t;
+}
+
+inline double
+cross(double ax,
+      double ay,
+      double bx,
+      double by)
+{
+    return ax * by - ay * bx;
+}
+
+/**
+ * @brief Returns the parameter s in [0,1] of the point (x,y) of the patch, where the patch is p0 + e s + f v + g s v
+ * with e = p1 - p0, f = p3 - p0, g = p0 - p1 + p2 - p3: 0 on the inner side and 1 on the outer side.
+ * Points outside the patch (centers of the pixels partially covered by it) get the parameter of the closest side.
+ **/
+double
+featherParameter(const RotoFeatherPatch & patch,
+                 double x,
+                 double y)
+{
+    const Natron::Point* p = patch.p;
+    const double ex = p[1].x - p[0].x, ey = p[1].y - p[0].y;
+    const double fx = p[3].x - p[0].x, fy = p[3].y - p[0].y;
+    const double gx = p[0].x - p[1].x + p[2].x - p[3].x, gy = p[0].y - p[1].y + p[2].y - p[3].y;
+    const double hx = x - p[0].x, hy = y - p[0].y;
+    const double k2 = cross(gx, gy, fx, fy);
+    const double k1 = cross(ex, ey, fx, fy) + cross(hx, hy, gx, gy);
+    const double k0 = cross(hx, hy, ex, ey);
+    double roots[2];
+    int nRoots = 0;
+
+    if ( std::fabs(k2) <= 1e-9 * std::fabs(k1) ) {
+        ///the inner and outer sides are parallel: v is the root of a linear equation
+        if (k1 != 0.) {
+            roots[nRoots++] = -k0 / k1;
+        }
+    } else {
+        const double delta = k1 * k1 - 4. * k0 * k2;
+        if (delta >= 0.) {
+            const double w = std::sqrt(delta);
+            roots[nRoots++] = (-k1 - w) / (2. * k2);
+            roots[nRoots++] = (-k1 + w) / (2. * k2);
+        }
+    }
+
+    ///keep the solution closest to the patch
+    double best = 0.;
+    double bestDistance = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < nRoots; ++i) {
+        const double v = roots[i];
+        const double dx = ex + gx * v;
+        const double dy = ey + gy * v;
+        double s;
+        if ( std::fabs(dx) >= std::fabs(dy) ) {
+            if (dx == 0.) {
+                continue;
+            }
+            s = (hx - fx * v) / dx;
+        } else {
+            s = (hy - fy * v) / dy;
+        }
+        const double distance = std::max( std::max(-s, s - 1.), std::max(-v, v - 1.) );
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = s;
+        }
+    }
+    if ( bestDistance == std::numeric_limits<double>::infinity() ) {
+        ///degenerate patch: project on the side from p0 to p1
+        const double norm2 = ex * ex + ey * ey;
+        best = norm2 > 0. ? (hx * ex + hy * ey) / norm2 : 0.;
+    }
+
+    return clamp(best, 0., 1.);
+}
+
+/**
+ * @brief Accumulates the signed area deltas of the line (x0,y0)-(x1,y1), whose abscissae are in [0, width], into the
+ * height rows of deltas, which are width + 2 elements apart: once the deltas of a closed path are accumulated, the prefix sum
+ * of the deltas of a row is the signed coverage of its pixels. The rows are the pixels [y, y+1) relative to the origin
+ * of the region.
+ **/
+void
+accumulateLine(float* deltas,
+               int width,
+               int height,
+               double x0,
+               double y0,
+               double x1,
+               double y1)
+{
+    if (y0 == y1) {
+        return;
+    }
+    float dir = 1.f;
+    if (y0 > y1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        dir = -1.f;
+    }
+    const double dxdy = (x1 - x0) / (y1 - y0);
+    const int rowBegin = std::max( 0, (int)std::floor(y0) );
+    const int rowEnd = std::min( height, (int)std::ceil(y1) );
+    const int stride = width + 2;
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        const double ya = std::max( (double)y, y0 );
+        const double yb = std::min( (double)(y + 1), y1 );
+        const double xa = clamp(x0 + (ya - y0) * dxdy, 0., width);
+        const double xb = clamp(x0 + (yb - y0) * dxdy, 0., width);
+        const double d = (yb - ya) * dir;
+        const double xl = std::min(xa, xb);
+        const double xr = std::max(xa, xb);
+        const double xlFloor = std::floor(xl);
+        const int xli = (int)xlFloor;
+        const int xri = (int)std::ceil(xr);
+        float* row = deltas + y * stride;
+
+        if (xri <= xli + 1) {
+            ///the line crosses a single pixel: the part of the pixel on its right is covered
+            const double xmf = 0.5 * (xl + xr) - xlFloor;
+            row[xli] += (float)( d * (1. - xmf) );
+            row[xli + 1] += (float)(d * xmf);
+        } else {
+            ///the coverage grows linearly between the pixels xli and xri, with quadratic ends
+            const double s = 1. / (xr - xl);
+            const double xlf = xl - xlFloor;
+            const double a0 = 0.5 * s * (1. - xlf) * (1. - xlf);
+            const double xrf = xr - xri + 1.;
+            const double am = 0.5 * s * xrf * xrf;
+            row[xli] += (float)(d * a0);
+            if (xri == xli + 2) {
+                row[xli + 1] += (float)( d * (1. - a0 - am) );
+            } else {
+                const double a1 = s * (1.5 - xlf);
+                row[xli + 1] += (float)( d * (a1 - a0) );
+                for (int x = xli + 2; x < xri - 1; ++x) {
+                    row[x] += (float)(d * s);
+                }
+                const double a2 = a1 + (xri - xli - 3) * s;
+                row[xri - 1] += (float)( d * (1. - a2 - am) );
+            }
+            row[xri] += (float)(d * am);
+        }
+    }
+}
+
+/**
+ * @brief Same as accumulateLine() for any line: the parts on the left of 0 or on the right of width are moved onto these
+ * borders, which preserves the coverage of the pixels of the region.
+ **/
+void
+accumulateEdge(float* deltas,
+               int width,
+               int height,
+               double x0,
+               double y0,
+               double x1,
+               double y1)
+{
+    if ( (y0 == y1) || ( (y0 <= 0.) && (y1 <= 0.) ) || ( (y0 >= height) && (y1 >= height) ) ) {
+        return;
+    }
+    double t[4];
+    int n = 0;
+    t[n++] = 0.;
+    if ( (x0 < 0.) != (x1 < 0.) ) {
+        t[n++] = -x0 / (x1 - x0);
+    }
+    if ( (x0 > width) != (x1 > width) ) {
+        t[n++] = (width - x0) / (x1 - x0);
+    }
+    if ( (n == 3) && (t[1] > t[2]) ) {
+        std::swap(t[1], t[2]);
+    }
+    t[n++] = 1.;
+
+    double xa = x0, ya = y0;
+    for (int i = 1; i < n; ++i) {
+        const double xb = i == n - 1 ? x1 : x0 + (x1 - x0) * t[i];
+        const double yb = i == n - 1 ? y1 : y0 + (y1 - y0) * t[i];
+        accumulateLine(deltas, width, height, clamp(xa, 0., width), ya, clamp(xb, 0., width), yb);
+        xa = xb;
+        ya = yb;
+    }
+}
+
+inline float
+lum(const float* c)
+{
+    return 0.3f * c[0] + 0.59f * c[1] + 0.11f * c[2];
+}
+
+void
+clipColor(float* c)
+{
+    const float l = lum(c);
+    const float n = std::min( c[0], std::min(c[1], c[2]) );
+    const float x = std::max( c[0], std::max(c[1], c[2]) );
+
+    for (int k = 0; k < 3; ++k) {
+        if ( (n < 0.f) && (l - n > 0.f) ) {
+            c[k] = l + (c[k] - l) * l / (l - n);
+        }
+        if ( (x > 1.f) && (x - l > 0.f) ) {
+            c[k] = l + (c[k] - l) * (1.f - l) / (x - l);
+        }
+    }
+}
+
+void
+setLum(float* c,
+       float l)
+{
+    const float d = l - lum(c);
+
+    c[0] += d;
+    c[1] += d;
+    c[2] += d;
+    clipColor(c);
+}
+
+inline float
+sat(const float* c)
+{
+    return std::max( c[0], std::max(c[1], c[2]) ) - std::min( c[0], std::min(c[1], c[2]) );
+}
+
+void
+setSat(float* c,
+       float s)
+{
+    int imax = 0, imin = 0;
+
+    for (int k = 1; k < 3; ++k) {
+        if (c[k] > c[imax]) {
+            imax = k;
+        }
+        if (c[k] < c[imin]) {
+            imin = k;
+        }
+    }
+    if (imax == imin) {
+        c[0] = c[1] = c[2] = 0.f;
+
+        return;
+    }
+    const int imid = 3 - imax - imin;
+    c[imid] = (c[imid] - c[imin]) * s / (c[imax] - c[imin]);
+    c[imax] = s;
+    c[imin] = 0.f;
+}
+
+inline float
+screen(float cb,
+       float cs)
+{
+    return cb + cs - cb * cs;
+}
+
+///The separable blend modes of the PDF specification, which are the ones of cairo
+float
+blendChannel(RotoCompositingOperatorEnum op,
+             float cb,
+             float cs)
+{
+    switch (op) {
+    case eRotoCompositingOperatorMultiply:
+
+        return cb * cs;
+    case eRotoCompositingOperatorScreen:
+
+        return screen(cb, cs);
+    case eRotoCompositingOperatorOverlay:
+
+        return cb <= 0.5f ? 2.f * cb * cs : screen(cs, 2.f * cb - 1.f);
+    case eRotoCompositingOperatorDarken:
+
+        return std::min(cb, cs);
+    case eRotoCompositingOperatorLighten:
+
+        return std::max(cb, cs);
+    case eRotoCompositingOperatorColorDodge:
+        if (cb <= 0.f) {
+            return 0.f;
+        }
+
+        return cs >= 1.f ? 1.f : std::min( 1.f, cb / (1.f - cs) );
+    case eRotoCompositingOperatorColorBurn:
+        if (cb >= 1.f) {
+            return 1.f;
+        }
+
+        return cs <= 0.f ? 0.f : 1.f - std::min( 1.f, (1.f - cb) / cs );
+    case eRotoCompositingOperatorHardLight:
+
+        return cs <= 0.5f ? 2.f * cb * cs : screen(cb, 2.f * cs - 1.f);
+    case eRotoCompositingOperatorSoftLight: {
+        if (cs <= 0.5f) {
+            return cb - (1.f - 2.f * cs) * cb * (1.f - cb);
+        }
+        const float d = cb <= 0.25f ? ( (16.f * cb - 12.f) * cb + 4.f ) * cb : std::sqrt(cb);
+
+        return cb + (2.f * cs - 1.f) * (d - cb);
+    }
+    case eRotoCompositingOperatorDifference:
+
+        return std::fabs(cs - cb);
+    case eRotoCompositingOperatorExclusion:
+
+        return cs + cb - 2.f * cs * cb;
+    default:
+        assert(false);
+
+        return cs;
+    }
+}
+
+/**
+ * @brief Composites the premultiplied source s over the premultiplied destination d with the blend mode op:
+ * the colors are blended where both are opaque and the alpha is the one of over.
+ **/
+void
+blendPixel(RotoCompositingOperatorEnum op,
+           const float* s,
+           float* d)
+{
+    const float sa = s[3];
+    const float da = d[3];
+    float cs[3], cb[3], b[3];
+
+    for (int k = 0; k < 3; ++k) {
+        cs[k] = sa > 0.f ? s[k] / sa : 0.f;
+        cb[k] = da > 0.f ? d[k] / da : 0.f;
+    }
+    switch (op) {
+    case eRotoCompositingOperatorHslHue:
+        std::copy(cs, cs + 3, b);
+        setSat( b, sat(cb) );
+        setLum( b, lum(cb) );
+        break;
+    case eRotoCompositingOperatorHslSaturation:
+        std::copy(cb, cb + 3, b);
+        setSat( b, sat(cs) );
+        setLum( b, lum(cb) );
+        break;
+    case eRotoCompositingOperatorHslColor:
+        std::copy(cs, cs + 3, b);
+        setLum( b, lum(cb) );
+        break;
+    case eRotoCompositingOperatorHslLuminosity:
+        std::copy(cb, cb + 3, b);
+        setLum( b, lum(cs) );
+        break;
+    default:
+        for (int k = 0; k < 3; ++k) {
+            b[k] = blendChannel(op, cb[k], cs[k]);
+        }
+        break;
+    }
+    for (int k = 0; k < 3; ++k) {
+        d[k] = (1.f - da) * s[k] + (1.f - sa) * d[k] + sa * da * b[k];
+    }
+    d[3] = sa + da - sa * da;
+}
+
+/**
+ * @brief Composites the premultiplied source s with the premultiplied destination d, with the given operator
+ * (except clear, source and dest which are handled by compositeRow()).
+ **/
+void
+compositePixel(RotoCompositingOperatorEnum op,
+               const float* s,
+               float* d)
+{
+    const float sa = s[3];
+    const float da = d[3];
+    float fs, fd;
+
+    switch (op) {
+    case eRotoCompositingOperatorOver:
+        fs = 1.f;
+        fd = 1.f - sa;
+        break;
+    case eRotoCompositingOperatorIn:
+        fs = da;
+        fd = 0.f;
+        break;
+    case eRotoCompositingOperatorOut:
+        fs = 1.f - da;
+        fd = 0.f;
+        break;
+    case eRotoCompositingOperatorAtop:
+        fs = da;
+        fd = 1.f - sa;
+        break;
+    case eRotoCompositingOperatorDestOver:
+        fs = 1.f - da;
+        fd = 1.f;
+        break;
+    case eRotoCompositingOperatorDestIn:
+        fs = 0.f;
+        fd = sa;
+        break;
+    case eRotoCompositingOperatorDestOut:
+        fs = 0.f;
+        fd = 1.f - sa;
+        break;
+    case eRotoCompositingOperatorDestAtop:
+        fs = 1.f - da;
+        fd = sa;
+        break;
+    case eRotoCompositingOperatorXor:
+        fs = 1.f - da;
+        fd = 1.f - sa;
+        break;
+    case eRotoCompositingOperatorAdd:
+        fs = 1.f;
+        fd = 1.f;
+        break;
+    case eRotoCompositingOperatorSaturate:
+        ///the source is scaled down so that its alpha fits what is left over the destination
+        fs = sa > 1.f - da ? (1.f - da) / sa : 1.f;
+        fd = 1.f;
+        break;
+    default:
+        blendPixel(op, s, d);
+
+        return;
+    }
+    for (int k = 0; k < 4; ++k) {
+        d[k] = clamp01(s[k] * fs + d[k] * fd);
+    }
+}
+
+/**
+ * @brief Composites the shape, covered by mask, with the n RGBA pixels of rgba.
+ **/
+void
+compositeRow(const PreparedShape & shape,
+             const float* mask,
+             float* rgba,
+             int n)
+{
+    const float* src = shape.src;
+
+    switch (shape.op) {
+    case eRotoCompositingOperatorDest:
+
+        return;
+    case eRotoCompositingOperatorClear:
+    case eRotoCompositingOperatorSource: {
+        ///these operators are bounded by the shape: the destination is interpolated towards their result by the coverage
+        const float zero[4] = {0.f, 0.f, 0.f, 0.f};
+        const float* res = shape.op == eRotoCompositingOperatorClear ? zero : src;
+        for (int i = 0; i < n; ++i, rgba += 4) {
+            const float m = std::min(mask[i], 1.f);
+            if (m > 0.f) {
+                for (int k = 0; k < 4; ++k) {
+                    rgba[k] += (res[k] - rgba[k]) * m;
+                }
+            }
+        }
+
+        return;
+    }
+    default:
+        break;
+    }
+    for (int i = 0; i < n; ++i, rgba += 4) {
+        const float m = std::min(mask[i], 1.f);
+        ///a transparent source leaves the destination unchanged, except for the unbounded operators
+        if ( (m > 0.f) || shape.unbounded ) {
+            const float s[4] = { src[0] * m, src[1] * m, src[2] * m, src[3] * m };
+            compositePixel(shape.op, s, rgba);
+        }
+    }
+}
+
+template <typename PIX, int maxValue>
+inline float
+toFloat(PIX v)
+{
+    return (float)v / maxValue;
+}
+
+template <typename PIX, int maxValue>
+inline PIX
+fromFloat(float v)
+{
+    return (PIX)Natron::Color::floatToInt<maxValue + 1>(v);
+}
+
+template <>
+inline float
+fromFloat<float, 1>(float v)
+{
+    return v;
+}
+
+///Like cairo, the pixels without alpha are opaque and the alpha images have no color
+template <typename PIX, int maxValue>
+void
+loadRow(const PIX* pix,
+        int nComps,
+        int n,
+        float* rgba)
+{
+    for (int i = 0; i < n; ++i, pix += nComps, rgba += 4) {
+        switch (nComps) {
+        case 1:
+            rgba[0] = rgba[1] = rgba[2] = 0.f;
+            rgba[3] = toFloat<PIX, maxValue>(pix[0]);
+            break;
+        case 3:
+            for (int k = 0; k < 3; ++k) {
+                rgba[k] = toFloat<PIX, maxValue>(pix[k]);
+            }
+            rgba[3] = 1.f;
+            break;
+        default:
+            for (int k = 0; k < 4; ++k) {
+                rgba[k] = toFloat<PIX, maxValue>(pix[k]);
+            }
+            break;
+        }
+    }
+}
+
+template <typename PIX, int maxValue>
+void
+storeRow(const float* rgba,
+         int nComps,
+         int n,
+         PIX* pix)
+{
+    for (int i = 0; i < n; ++i, pix += nComps, rgba += 4) {
+        if (nComps == 1) {
+            pix[0] = fromFloat<PIX, maxValue>(rgba[3]);
+        } else {
+            for (int k = 0; k < nComps; ++k) {
+                pix[k] = fromFloat<PIX, maxValue>(rgba[k]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Adds the coverage of the inner polygon and of the feather patches of the shape, weighted by their alpha,
+ * to the mask of the pixels of region.
+ **/
+void
+rasterizeShape(const PreparedShape & shape,
+               const RectI & region,
+               std::vector<float>* deltas,
+               std::vector<float>* coverage,
+               float* mask)
+{
+    const RotoShapeTessellation & tess = *shape.tessellation;
+    const int rw = region.width();
+    const int rh = region.height();
+    const double ox = region.x1;
+    const double oy = region.y1;
+
+    const std::size_t nPoints = tess.polygon.size();
+    if (nPoints > 2) {
+        deltas->assign( (rw + 2) * rh, 0.f );
+        for (std::size_t i = 0; i < nPoints; ++i) {
+            const Natron::Point & p0 = tess.polygon[i];
+            const Natron::Point & p1 = tess.polygon[i + 1 < nPoints ? i + 1 : 0];
+            accumulateEdge(&deltas->front(), rw, rh, p0.x - ox, p0.y - oy, p1.x - ox, p1.y - oy);
+        }
+        for (int y = 0; y < rh; ++y) {
+            ImageKernels::accumulateCoverage(&deltas->front() + y * (rw + 2), mask + y * rw, rw);
+        }
+    }
+
+    for (std::vector<RotoFeatherPatch>::const_iterator it = tess.featherPatches.begin(); it != tess.featherPatches.end(); ++it) {
+        const Natron::Point* p = it->p;
+        double xmin = p[0].x, xmax = p[0].x, ymin = p[0].y, ymax = p[0].y;
+        for (int i = 1; i < 4; ++i) {
+            xmin = std::min(xmin, p[i].x);
+            xmax = std::max(xmax, p[i].x);
+            ymin = std::min(ymin, p[i].y);
+            ymax = std::max(ymax, p[i].y);
+        }
+        const RectI patchBounds( (int)std::floor(xmin), (int)std::floor(ymin), (int)std::ceil(xmax), (int)std::ceil(ymax) );
+        RectI patchRect;
+        if ( !patchBounds.intersect(region, &patchRect) ) {
+            continue;
+        }
+        const int pw = patchRect.width();
+        const int ph = patchRect.height();
+        const double px = patchRect.x1;
+        const double py = patchRect.y1;
+        deltas->assign( (pw + 2) * ph, 0.f );
+        for (int i = 0; i < 4; ++i) {
+            const Natron::Point & p0 = p[i];
+            const Natron::Point & p1 = p[(i + 1) & 3];
+            accumulateEdge(&deltas->front(), pw, ph, p0.x - px, p0.y - py, p1.x - px, p1.y - py);
+        }
+        for (int y = 0; y < ph; ++y) {
+            ImageKernels::accumulateCoverage(&deltas->front() + y * (pw + 2), &coverage->front(), pw);
+            float* maskRow = mask + (patchRect.y1 - region.y1 + y) * rw + (patchRect.x1 - region.x1);
+            for (int x = 0; x < pw; ++x) {
+                const float c = (*coverage)[x];
+                if (c > 0.f) {
+                    const double s = featherParameter(*it, px + x + 0.5, py + y + 0.5);
+                    maskRow[x] += c * featherAlphaAt(shape.featherAlpha, s);
+                }
+            }
+        }
+    }
+} // rasterizeShape
+
+template <typename PIX, int maxValue>
+void
+renderBand(const RenderContext* ctx,
+           int band)
+{
+    const RectI & window = ctx->window;
+    const RectI bandRect( window.x1, window.y1 + band * ctx->rowsPerBand,
+                          window.x2, std::min(window.y2, window.y1 + (band + 1) * ctx->rowsPerBand) );
+    const int nComps = ctx->nComps;
+
+    for (int y = bandRect.y1; y < bandRect.y2; ++y) {
+        PIX* pix = (PIX*)ctx->pixels + (y - window.y1) * ctx->rowElements;
+        std::memset( pix, 0, bandRect.width() * nComps * sizeof(PIX) );
+    }
+
+    std::vector<float> deltas;
+    std::vector<float> coverage(bandRect.width() + 2);
+    std::vector<float> mask;
+    std::vector<float> rgba(bandRect.width() * 4);
+    for (std::vector<PreparedShape>::const_iterator it = ctx->shapes.begin(); it != ctx->shapes.end(); ++it) {
+        RectI region;
+        if ( !it->bounds.intersect(bandRect, &region) ) {
+            continue;
+        }
+        const int rw = region.width();
+        mask.assign(rw * region.height(), 0.f);
+        rasterizeShape(*it, region, &deltas, &coverage, &mask.front());
+        for (int y = region.y1; y < region.y2; ++y) {
+            PIX* pix = (PIX*)ctx->pixels + (y - window.y1) * ctx->rowElements + (region.x1 - window.x1) * nComps;
+            loadRow<PIX, maxValue>(pix, nComps, rw, &rgba.front());
+            compositeRow(*it, &mask.front() + (y - region.y1) * rw, &rgba.front(), rw);
+            storeRow<PIX, maxValue>(&rgba.front(), nComps, rw, pix);
+        }
+    }
+}
+} // anon namespace
+
+bool
+RotoRasterizer::renderShapes(const std::vector<RotoRasterizerShape> & shapes,
+                             const RectI & window,
+                             Natron::ImageBitDepthEnum depth,
+                             int nComps,
+                             void* pixels,
+                             int rowElements,
+                             Natron::RenderThreadPool* pool)
+{
+    assert(nComps == 1 || nComps == 3 || nComps == 4);
+    if ( window.isNull() ) {
+        return true;
+    }
+
+    RenderContext ctx;
+    ctx.window = window;
+    ctx.nComps = nComps;
+    ctx.pixels = pixels;
+    ctx.rowElements = rowElements;
+    ctx.shapes.reserve( shapes.size() );
+    for (std::vector<RotoRasterizerShape>::const_iterator it = shapes.begin(); it != shapes.end(); ++it) {
+        if ( !it->tessellation || (it->compositingOperator == eRotoCompositingOperatorDest) ) {
+            continue;
+        }
+        ctx.shapes.push_back( PreparedShape() );
+        PreparedShape & shape = ctx.shapes.back();
+        shape.tessellation = it->tessellation.get();
+        shape.op = it->compositingOperator;
+        const float opacity = clamp01( (float)it->opacity );
+        for (int k = 0; k < 3; ++k) {
+            shape.src[k] = clamp01( (float)it->color[k] ) * opacity;
+        }
+        shape.src[3] = opacity;
+        shape.unbounded = shape.op == eRotoCompositingOperatorIn || shape.op == eRotoCompositingOperatorOut ||
+                          shape.op == eRotoCompositingOperatorDestIn || shape.op == eRotoCompositingOperatorDestAtop;
+        if (shape.unbounded) {
+            shape.bounds = window;
+        } else {
+            const RectD & bbox = shape.tessellation->bbox;
+            RectI bounds( (int)std::floor(bbox.x1), (int)std::floor(bbox.y1), (int)std::ceil(bbox.x2), (int)std::ceil(bbox.y2) );
+            if ( bbox.isNull() || !bounds.intersect(window, &shape.bounds) ) {
+                ctx.shapes.pop_back();
+                continue;
+            }
+        }
+        computeFeatherAlpha(it->fallOff, shape.featherAlpha);
+    }
+
+    const int height = window.height();
+    const int nThreads = pool ? pool->getMaxThreadCount() : 1;
+    int nBands = std::min(height, nThreads * NATRON_RENDER_TILES_PER_THREAD);
+    ctx.rowsPerBand = (height + nBands - 1) / nBands;
+    nBands = (height + ctx.rowsPerBand - 1) / ctx.rowsPerBand;
+
+    void (*func)(const RenderContext*, int) = 0;
+    switch (depth) {
+    case Natron::eImageBitDepthByte:
+        func = renderBand<unsigned char, 255>;
+        break;
+    case Natron::eImageBitDepthShort:
+        func = renderBand<unsigned short, 65535>;
+        break;
+    case Natron::eImageBitDepthFloat:
+        func = renderBand<float, 1>;
+        break;
+    case Natron::eImageBitDepthNone:
+        assert(false);
+
+        return false;
+    }
+
+    if (pool && nBands > 1) {
+        return pool->parallelFor( nBands, boost::bind(func, &ctx, _1) );
+    }
+    try {
+        for (int band = 0; band < nBands; ++band) {
+            func(&ctx, band);
+        }
+    } catch (...) {
+        return false;
+    }
+
+    return true;
+} // renderShapes
+
+bool
+RotoRasterizer::renderShapes(const std::vector<RotoRasterizerShape> & shapes,
+                             const RectI & window,
+                             Natron::Image* image,
+                             Natron::RenderThreadPool* pool)
+{
+    if ( window.isNull() ) {
+        return true;
+    }
+    assert( image->getBounds().contains(window) );
+
+    return renderShapes( shapes, window, image->getBitDepth(), (int)image->getComponentsCount(),
+                         image->pixelAt(window.x1, window.y1), (int)image->getRowElements(), pool );
+}
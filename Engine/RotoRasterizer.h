@@ -0,0 +1,154 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef NATRON_ENGINE_ROTORASTERIZER_H_
+#define NATRON_ENGINE_ROTORASTERIZER_H_
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/Rect.h"
+
+/**
+ * @brief Native rasterizer of the roto masks.
+ *
+ * Each shape is tessellated once into its inner polygon and the patches of its feather band, then the render window is split
+ * into bands of rows which are rendered in parallel. For each band the shapes are rasterized in order: the anti-aliased
+ * coverage of the polygon and of the feather patches is accumulated with signed areas (see ImageKernels::accumulateCoverage())
+ * and the shape is composited directly into the pixels of the image, in its bit depth.
+ *
+ * The result matches what cairo renders from the same tessellation (the renderer used before, which is kept as the reference
+ * of the tests), except that the edges of the inner polygon are anti-aliased and that the polygon and its feather are
+ * composited in a single pass, hence without seam between them.
+ **/
+namespace Natron {
+class Image;
+class RenderThreadPool;
+
+/**
+ * @brief The compositing operators of the shapes, in the order of the operator parameter of the roto items,
+ * which is also the order of cairo_operator_t. The semantics are the ones of cairo.
+ **/
+enum RotoCompositingOperatorEnum
+{
+    eRotoCompositingOperatorClear = 0,
+    eRotoCompositingOperatorSource,
+    eRotoCompositingOperatorOver,
+    eRotoCompositingOperatorIn,
+    eRotoCompositingOperatorOut,
+    eRotoCompositingOperatorAtop,
+    eRotoCompositingOperatorDest,
+    eRotoCompositingOperatorDestOver,
+    eRotoCompositingOperatorDestIn,
+    eRotoCompositingOperatorDestOut,
+    eRotoCompositingOperatorDestAtop,
+    eRotoCompositingOperatorXor,
+    eRotoCompositingOperatorAdd,
+    eRotoCompositingOperatorSaturate,
+    eRotoCompositingOperatorMultiply,
+    eRotoCompositingOperatorScreen,
+    eRotoCompositingOperatorOverlay,
+    eRotoCompositingOperatorDarken,
+    eRotoCompositingOperatorLighten,
+    eRotoCompositingOperatorColorDodge,
+    eRotoCompositingOperatorColorBurn,
+    eRotoCompositingOperatorHardLight,
+    eRotoCompositingOperatorSoftLight,
+    eRotoCompositingOperatorDifference,
+    eRotoCompositingOperatorExclusion,
+    eRotoCompositingOperatorHslHue,
+    eRotoCompositingOperatorHslSaturation,
+    eRotoCompositingOperatorHslColor,
+    eRotoCompositingOperatorHslLuminosity
+};
+
+/**
+ * @brief A patch of the feather band of a shape: p[0] and p[3] are on the inner polygon, where the alpha is the opacity of the shape,
+ * p[1] and p[2] are on the outer contour, where it is 0. The patch is the bilinear interpolation of its corners.
+ **/
+struct RotoFeatherPatch
+{
+    Natron::Point p[4];
+};
+
+/**
+ * @brief The geometry of a shape at a given time, in pixel coordinates at the mipmap level of the render.
+ **/
+struct RotoShapeTessellation
+{
+    ///The inner polygon, filled with the non-zero winding rule. The pixels crossed by the edges of the parts of the
+    ///polygon which overlap get the sum of the coverages of these parts.
+    std::vector<Natron::Point> polygon;
+    std::vector<RotoFeatherPatch> featherPatches;
+
+    ///The bounding box of the polygon and of the patches
+    RectD bbox;
+
+    RotoShapeTessellation()
+        : polygon()
+        , featherPatches()
+        , bbox()
+    {
+    }
+
+    ///Computes bbox from the polygon and the patches
+    void computeBoundingBox();
+};
+
+struct RotoRasterizerShape
+{
+    boost::shared_ptr<const RotoShapeTessellation> tessellation;
+    double color[3];
+    double opacity;
+    ///Controls the alpha along the feather patches, as the curvature of the cairo mesh patches did
+    double fallOff;
+    RotoCompositingOperatorEnum compositingOperator;
+
+    RotoRasterizerShape()
+        : tessellation()
+        , opacity(1.)
+        , fallOff(1.)
+        , compositingOperator(eRotoCompositingOperatorOver)
+    {
+        color[0] = color[1] = color[2] = 1.;
+    }
+};
+
+namespace RotoRasterizer {
+
+/**
+ * @brief Clears the pixels of window and renders the shapes into them, in order. The pixels are nComps (1, 3 or 4) components
+ * of the given depth, premultiplied, and pixels points to the pixel (window.x1, window.y1): the pixel (x,y) covers
+ * [x, x+1) x [y, y+1) and its components start at element (y - window.y1) * rowElements + (x - window.x1) * nComps.
+ * Like cairo, RGB pixels are considered opaque by the operators.
+ * The bands are rendered by the workers of pool, or by the calling thread if pool is NULL.
+ * Returns false if the rendering of a band failed.
+ **/
+bool renderShapes(const std::vector<RotoRasterizerShape> & shapes,
+                  const RectI & window,
+                  Natron::ImageBitDepthEnum depth,
+                  int nComps,
+                  void* pixels,
+                  int rowElements,
+                  Natron::RenderThreadPool* pool);
+
+/**
+ * @brief Same as above, for the pixels of image in window, which must be within its bounds.
+ **/
+bool renderShapes(const std::vector<RotoRasterizerShape> & shapes,
+                  const RectI & window,
+                  Natron::Image* image,
+                  Natron::RenderThreadPool* pool);
+} // namespace RotoRasterizer
+} // namespace Natron
+
+#endif // NATRON_ENGINE_ROTORASTERIZER_H_
@@ -31,6 +31,7 @@
 #include "Engine/Plugin.h"
 #include "Engine/Node.h"
 #include "Engine/ViewerInstance.h"
+#include "Engine/RenderThreadPool.h"
 #include "Engine/StandardPaths.h"
 #include "SequenceParsing.h"
 
@@ -764,6 +765,15 @@ Settings::initializeKnobs()
                                        "which have multiple outputs, or their parameter \"Force caching\" checked or if one of its "
                                        "output has its settings panel opened.");
     _cachingTab->addKnob(_aggressiveCaching);
+
+    _backgroundViewerCaching = Natron::createKnob<Bool_Knob>(this, "Pre-render frames around the current frame when idle");
+    _backgroundViewerCaching->setName("backgroundViewerCaching");
+    _backgroundViewerCaching->setAnimationEnabled(false);
+    _backgroundViewerCaching->setHintToolTip("When checked, while the viewer is idle " NATRON_APPLICATION_NAME " uses low priority "
+                                             "threads to render the frames ahead of and behind the current frame into the viewer cache, "
+                                             "favoring the direction of the last playback. Any interaction stops it immediately. "
+                                             "It stops as well when the playback cache is full (see the playback cache RAM percentage).");
+    _cachingTab->addKnob(_backgroundViewerCaching);
     
     _maxRAMPercent = Natron::createKnob<Int_Knob>(this, "Maximum amount of RAM memory used for caching (% of total RAM)");
     _maxRAMPercent->setName("maxRAMPercent");
@@ -807,6 +817,25 @@ Settings::initializeKnobs()
     _maxPlaybackLabel->setAnimationEnabled(false);
     _cachingTab->addKnob(_maxPlaybackLabel);
 
+    _maxRenderBufferPercent = Natron::createKnob<Int_Knob>(this, "Render buffer RAM percentage (% of maximum RAM used for caching)");
+    _maxRenderBufferPercent->setName("maxRenderBufferPercent");
+    _maxRenderBufferPercent->setAnimationEnabled(false);
+    _maxRenderBufferPercent->setMinimum(0);
+    _maxRenderBufferPercent->setMaximum(100);
+    _maxRenderBufferPercent->setHintToolTip("This setting indicates the percentage of the maximum RAM used for caching "
+                                            "that the frames rendered ahead during playback or when rendering a sequence in order "
+                                            "(e.g: with a movie writer) may use while they wait to be displayed or written. "
+                                            "When this limit is reached, the render threads wait for the frames to be consumed.");
+    _maxRenderBufferPercent->setAddNewLine(false);
+    _cachingTab->addKnob(_maxRenderBufferPercent);
+
+    _maxRenderBufferLabel = Natron::createKnob<String_Knob>(this, "");
+    _maxRenderBufferLabel->setName("maxRenderBufferLabel");
+    _maxRenderBufferLabel->setIsPersistant(false);
+    _maxRenderBufferLabel->setAsLabel();
+    _maxRenderBufferLabel->setAnimationEnabled(false);
+    _cachingTab->addKnob(_maxRenderBufferLabel);
+
     _unreachableRAMPercent = Natron::createKnob<Int_Knob>(this, "System RAM to keep free (% of total RAM)");
     _unreachableRAMPercent->setName("unreachableRAMPercent");
     _unreachableRAMPercent->setAnimationEnabled(false);
@@ -988,6 +1017,7 @@ Settings::setCachingLabels()
 
     _maxRAMLabel->setValue(printAsRAM(maxRAM).toStdString(), 0);
     _maxPlaybackLabel->setValue(printAsRAM( (U64)( maxRAM * ( (double)maxPlaybackPercent / 100. ) ) ).toStdString(), 0);
+    _maxRenderBufferLabel->setValue(printAsRAM( (U64)( maxRAM * ( (double)_maxRenderBufferPercent->getValue() / 100. ) ) ).toStdString(), 0);
 
     _unreachableRAMLabel->setValue(printAsRAM( (double)systemTotalRam * ( (double)_unreachableRAMPercent->getValue() / 100. ) ).toStdString(), 0);
 }
@@ -1042,8 +1072,10 @@ Settings::setDefaultValues()
     _ocioStartupCheck->setDefaultValue(true);
 
     _aggressiveCaching->setDefaultValue(false);
+    _backgroundViewerCaching->setDefaultValue(true);
     _maxRAMPercent->setDefaultValue(50,0);
     _maxPlayBackPercent->setDefaultValue(25,0);
+    _maxRenderBufferPercent->setDefaultValue(20,0);
     _unreachableRAMPercent->setDefaultValue(5);
     _maxViewerDiskCacheGB->setDefaultValue(5,0);
     _maxDiskCacheNodeGB->setDefaultValue(10,0);
@@ -1461,6 +1493,8 @@ Settings::onKnobValueChanged(KnobI* k,
             appPTR->setPlaybackCacheMaximumSize( getRamPlaybackMaximumPercent() );
         }
         setCachingLabels();
+    } else if ( k == _maxRenderBufferPercent.get() ) {
+        setCachingLabels();
     } else if ( k == _diskCachePath.get() ) {
         appPTR->setDiskCacheLocation(_diskCachePath->getValue().c_str());
     } else if ( k == _numberOfThreads.get() ) {
@@ -1468,11 +1502,14 @@ Settings::onKnobValueChanged(KnobI* k,
         appPTR->setNThreadsToRender(nbThreads);
         if (nbThreads == -1) {
             QThreadPool::globalInstance()->setMaxThreadCount(1);
+            appPTR->getRenderThreadPool()->setMaxThreadCount(1);
             appPTR->abortAnyProcessing();
         } else if (nbThreads == 0) {
             QThreadPool::globalInstance()->setMaxThreadCount( QThread::idealThreadCount() );
+            appPTR->getRenderThreadPool()->setMaxThreadCount(0);
         } else {
             QThreadPool::globalInstance()->setMaxThreadCount(nbThreads);
+            appPTR->getRenderThreadPool()->setMaxThreadCount(nbThreads);
         }
     } else if ( k == _nThreadsPerEffect.get() ) {
         appPTR->setNThreadsPerEffect( getNumberOfThreadsPerEffect() );
@@ -1567,6 +1604,12 @@ Settings::getRamPlaybackMaximumPercent() const
     return (double)_maxPlayBackPercent->getValue() / 100.;
 }
 
+double
+Settings::getRenderBufferMaximumPercent() const
+{
+    return (double)_maxRenderBufferPercent->getValue() / 100.;
+}
+
 U64
 Settings::getMaximumViewerDiskCacheSize() const
 {
@@ -2451,6 +2494,12 @@ Settings::isAggressiveCachingEnabled() const
     return _aggressiveCaching->getValue();
 }
 
+bool
+Settings::isBackgroundViewerCachingEnabled() const
+{
+    return _backgroundViewerCaching->getValue();
+}
+
 bool
 Settings::isAutoTurboEnabled() const
 {
@@ -74,6 +74,9 @@ public:
 
     double getRamPlaybackMaximumPercent() const;
 
+    ///The percentage of the maximum RAM used for caching that the frames rendered ahead by the OutputSchedulerThread may use
+    double getRenderBufferMaximumPercent() const;
+
     U64 getMaximumViewerDiskCacheSize() const;
     
     U64 getMaximumDiskCacheNodeSize() const;
@@ -225,6 +228,8 @@ public:
     
     bool isAggressiveCachingEnabled() const;
     
+    bool isBackgroundViewerCachingEnabled() const;
+    
     bool isAutoTurboEnabled() const;
     
     void setAutoTurboModeEnabled(bool e);
@@ -301,9 +306,12 @@ private:
     boost::shared_ptr<Page_Knob> _cachingTab;
 
     boost::shared_ptr<Bool_Knob> _aggressiveCaching;
+    boost::shared_ptr<Bool_Knob> _backgroundViewerCaching;
     ///The percentage of the value held by _maxRAMPercent to dedicate to playback cache (viewer cache's in-RAM portion) only
     boost::shared_ptr<Int_Knob> _maxPlayBackPercent;
     boost::shared_ptr<String_Knob> _maxPlaybackLabel;
+    boost::shared_ptr<Int_Knob> _maxRenderBufferPercent;
+    boost::shared_ptr<String_Knob> _maxRenderBufferLabel;
 
     ///The percentage of the system total's RAM to dedicate to caching in theory. In practise this is limited
     ///by _unreachableRamPercent that determines how much RAM should be left free for other use on the computer
@@ -20,7 +20,6 @@
 
 CLANG_DIAG_OFF(deprecated)
 #include <QtCore/QtGlobal>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt<<(
 #include <QtCore/QFutureWatcher>
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
@@ -44,6 +43,8 @@ CLANG_DIAG_ON(deprecated)
 #include "Engine/OpenGLViewerI.h"
 #include "Engine/Image.h"
 #include "Engine/OutputSchedulerThread.h"
+#include "Engine/RenderThreadPool.h"
+#include "Engine/ImageKernels.h"
 
 #ifndef M_LN2
 #define M_LN2       0.693147180559945309417232121458176568  /* loge(2)        */
@@ -70,6 +71,11 @@ static void renderFunctor(std::pair<int,int> yRange,
                           const RenderViewerArgs & args,
                           ViewerInstance* viewer,
                           void *buffer);
+static void renderStripFunctor(const std::vector<std::pair<int,int> >* splitRows,
+                               const RenderViewerArgs & args,
+                               ViewerInstance* viewer,
+                               void *buffer,
+                               int stripIndex);
 
 /**
  *@brief Actually converting to ARGB... but it is called BGRA by
@@ -365,6 +371,8 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
 {
     U64 renderAge = _imp->getRenderAge(textureIndex);
     
+    ///Background renders are never displayed, they must not change what the viewer shows
+    const bool isBackgroundRender = (bool)outArgs->backgroundAbort;
     
     if (textureIndex == 0) {
         QMutexLocker l(&_imp->activeInputsMutex);
@@ -382,11 +390,16 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
     }
     
     if (!outArgs->activeInputToRender || !checkTreeCanRender(outArgs->activeInputToRender->getNode().get())) {
-        Q_EMIT disconnectTextureRequest(textureIndex);
+        if (!isBackgroundRender) {
+            Q_EMIT disconnectTextureRequest(textureIndex);
+        }
         return eStatusFailed;
     }
     
-    {
+    if (isBackgroundRender) {
+        ///Leave the forced refresh to the next render of the current frame
+        outArgs->forceRender = false;
+    } else {
         QMutexLocker forceRenderLocker(&_imp->forceRenderMutex);
         outArgs->forceRender = _imp->forceRender;
         _imp->forceRender = false;
@@ -448,7 +461,8 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
                                                    canAbort,
                                                    outArgs->activeInputHash,
                                                    false,
-                                                   getTimeline().get());
+                                                   getTimeline().get(),
+                                                   outArgs->backgroundAbort.get());
 
     
     ///Get the RoD here to be able to figure out what is the RoI of the Viewer.
@@ -456,7 +470,9 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
                                                                         supportsRS ==  eSupportsNo ? scaleOne : scale,
                                                                         view, &rod, &isRodProjectFormat);
     if (stat == eStatusFailed) {
-        Q_EMIT disconnectTextureRequest(textureIndex);
+        if (!isBackgroundRender) {
+            Q_EMIT disconnectTextureRequest(textureIndex);
+        }
         if (!isSequential) {
             _imp->checkAndUpdateRenderAge(textureIndex,renderAge);
         }
@@ -490,7 +506,9 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
     _imp->uiContext->getImageRectangleDisplayedRoundedToTileSize(rod, par, mipMapLevel);
     
     if ( (roi.width() == 0) || (roi.height() == 0) ) {
-        Q_EMIT disconnectTextureRequest(textureIndex);
+        if (!isBackgroundRender) {
+            Q_EMIT disconnectTextureRequest(textureIndex);
+        }
         outArgs->params.reset();
         if (!isSequential) {
             _imp->checkAndUpdateRenderAge(textureIndex,renderAge);
@@ -761,7 +779,8 @@ ViewerInstance::renderViewer_internal(int view,
                                            canAbort,
                                            inArgs.activeInputHash,
                                            false,
-                                           getTimeline().get());
+                                           getTimeline().get(),
+                                           inArgs.backgroundAbort.get());
 
         
         
@@ -806,8 +825,8 @@ ViewerInstance::renderViewer_internal(int view,
     
    
     ///We check that the render age is still OK and that no other renders were triggered, in which case we should not need to
-    ///refresh the viewer.
-    if (!_imp->checkAgeNoUpdate(inArgs.params->textureIndex,inArgs.params->renderAge)) {
+    ///refresh the viewer. Background renders only fill the cache and are never displayed, so they are not concerned.
+    if (!inArgs.backgroundAbort && !_imp->checkAgeNoUpdate(inArgs.params->textureIndex,inArgs.params->renderAge)) {
         if (inArgs.params->cachedFrame) {
             inArgs.params->cachedFrame->setAborted(true);
             appPTR->removeFromViewerCache(inArgs.params->cachedFrame);
@@ -822,127 +841,90 @@ ViewerInstance::renderViewer_internal(int view,
     ViewerColorSpaceEnum srcColorSpace = getApp()->getDefaultColorSpaceForBitDepth( inArgs.params->image->getBitDepth() );
     
     
+    ///Split in more strips of rows than threads so that the render thread pool balances the load
+    Natron::RenderThreadPool* threadPool = appPTR->getRenderThreadPool();
+    // group of group of rows where first is image coordinate, second is texture coordinate
+    std::vector<std::pair<int, int> > splitRows;
     if (singleThreaded) {
-        if (autoContrast) {
-            double vmin, vmax;
-            std::pair<double,double> vMinMax = findAutoContrastVminVmax(inArgs.params->image, channels, roi);
-            vmin = vMinMax.first;
-            vmax = vMinMax.second;
-            
-            ///if vmax - vmin is greater than 1 the gain will be really small and we won't see
-            ///anything in the image
-            if (vmin == vmax) {
-                vmin = vmax - 1.;
-            }
-            inArgs.params->gain = 1 / (vmax - vmin);
-            inArgs.params->offset = -vmin / ( vmax - vmin);
-        }
-        
-        const RenderViewerArgs args( inArgs.params->image,
-                                    inArgs.params->textureRect,
-                                    channels,
-                                    inArgs.params->srcPremult,
-                                    1,
-                                    inArgs.key->getBitDepth(),
-                                    inArgs.params->gain,
-                                    inArgs.params->offset,
-                                    lutFromColorspace(srcColorSpace),
-                                    lutFromColorspace(inArgs.params->lut) );
-        
-        renderFunctor(std::make_pair(roi.y1,roi.y2),
-                      args,
-                      this,
-                      inArgs.params->ramBuffer);
+        splitRows.push_back( std::make_pair(roi.y1, roi.y2) );
     } else {
-        
-        int rowsPerThread = std::ceil( (double)(roi.x2 - roi.x1) / appPTR->getHardwareIdealThreadCount() );
-        // group of group of rows where first is image coordinate, second is texture coordinate
-        QList< std::pair<int, int> > splitRows;
-        
-        bool runInCurrentThread = QThreadPool::globalInstance()->activeThreadCount() >= QThreadPool::globalInstance()->maxThreadCount();
-        
-        if (!runInCurrentThread) {
-            int k = roi.y1;
-            while (k < roi.y2) {
-                int top = k + rowsPerThread;
-                int realTop = top > roi.y2 ? roi.y2 : top;
-                splitRows.push_back( std::make_pair(k,realTop) );
-                k += rowsPerThread;
-            }
+        int nStrips = threadPool->getMaxThreadCount() * NATRON_RENDER_TILES_PER_THREAD;
+        int rowsPerStrip = std::max( 1, (int)std::ceil( (double)roi.height() / nStrips ) );
+        for (int k = roi.y1; k < roi.y2; k += rowsPerStrip) {
+            splitRows.push_back( std::make_pair( k, std::min(k + rowsPerStrip, roi.y2) ) );
         }
-        
-        ///if autoContrast is enabled, find out the vmin/vmax before rendering and mapping against new values
-        if (autoContrast) {
-            rowsPerThread = std::ceil( (double)( roi.width() ) / (double)appPTR->getHardwareIdealThreadCount() );
-            
-            std::vector<RectI> splitRects;
-            
-            double vmin = std::numeric_limits<double>::infinity();
-            double vmax = -std::numeric_limits<double>::infinity();
-            
-            if (!runInCurrentThread) {
-                int k = roi.y1;
-                while (k < roi.y2) {
-                    int top = k + rowsPerThread;
-                    int realTop = top > roi.top() ? roi.top() : top;
-                    splitRects.push_back( RectI(roi.left(), k, roi.right(), realTop) );
-                    k += rowsPerThread;
+    }
+    
+    ///if autoContrast is enabled, find out the vmin/vmax before rendering and mapping against new values
+    if (autoContrast) {
+        double vmin, vmax;
+        if ( !_imp->getAutoContrastRange(inArgs.params->textureIndex, inArgs.params->image, channels, roi, &vmin, &vmax) ) {
+            if (singleThreaded) {
+                std::pair<double,double> vMinMax = findAutoContrastVminVmax(inArgs.params->image, channels, roi);
+                vmin = vMinMax.first;
+                vmax = vMinMax.second;
+            } else {
+                ///the strips are reduced in parallel, then the texture is filled with the same strips
+                std::vector<RectI> splitRects;
+                for (std::size_t i = 0; i < splitRows.size(); ++i) {
+                    splitRects.push_back( RectI(roi.left(), splitRows[i].first, roi.right(), splitRows[i].second) );
                 }
                 
+                std::vector<std::pair<double,double> > vMinMax;
+                threadPool->mapped( splitRects,
+                                    boost::bind(findAutoContrastVminVmax,
+                                                inArgs.params->image,
+                                                channels,
+                                                _1),
+                                    &vMinMax );
                 
-                QFuture<std::pair<double,double> > future = QtConcurrent::mapped( splitRects,
-                                                                                 boost::bind(findAutoContrastVminVmax,
-                                                                                             inArgs.params->image,
-                                                                                             channels,
-                                                                                             _1) );
-                future.waitForFinished();
-                
-                std::pair<double,double> vMinMax;
-                Q_FOREACH ( vMinMax, future.results() ) {
-                    if (vMinMax.first < vmin) {
-                        vmin = vMinMax.first;
+                vmin = std::numeric_limits<double>::infinity();
+                vmax = -std::numeric_limits<double>::infinity();
+                for (std::size_t i = 0; i < vMinMax.size(); ++i) {
+                    if (vMinMax[i].first < vmin) {
+                        vmin = vMinMax[i].first;
                     }
-                    if (vMinMax.second > vmax) {
-                        vmax = vMinMax.second;
+                    if (vMinMax[i].second > vmax) {
+                        vmax = vMinMax[i].second;
                     }
                 }
-            } else { //!runInCurrentThread
-                std::pair<double,double> vMinMax = findAutoContrastVminVmax(inArgs.params->image, channels, roi);
-                vmin = vMinMax.first;
-                vmax = vMinMax.second;
             }
-            
-            if (vmax == vmin) {
-                vmin = vmax - 1.;
-            }
-            
-            inArgs.params->gain = 1 / (vmax - vmin);
-            inArgs.params->offset =  -vmin / (vmax - vmin);
+            _imp->setAutoContrastRange(inArgs.params->textureIndex, inArgs.params->image, channels, roi, vmin, vmax);
         }
         
-        const RenderViewerArgs args(inArgs.params->image,
-                                    inArgs.params->textureRect,
-                                    channels,
-                                    inArgs.params->srcPremult,
-                                    1,
-                                    inArgs.key->getBitDepth(),
-                                    inArgs.params->gain,
-                                    inArgs.params->offset,
-                                    lutFromColorspace(srcColorSpace),
-                                    lutFromColorspace(inArgs.params->lut));
-        if (runInCurrentThread) {
-            renderFunctor(std::make_pair(inArgs.params->textureRect.y1,inArgs.params->textureRect.y2),
-                          args, this, inArgs.params->ramBuffer);
-        } else {
-            QtConcurrent::map( splitRows,
-                              boost::bind(&renderFunctor,
-                                          _1,
-                                          args,
-                                          this,
-                                          inArgs.params->ramBuffer) ).waitForFinished();
+        ///if vmax - vmin is greater than 1 the gain will be really small and we won't see
+        ///anything in the image
+        if (vmax == vmin) {
+            vmin = vmax - 1.;
         }
         
-        
+        inArgs.params->gain = 1 / (vmax - vmin);
+        inArgs.params->offset =  -vmin / (vmax - vmin);
+    }
+    
+    const RenderViewerArgs args(inArgs.params->image,
+                                inArgs.params->textureRect,
+                                channels,
+                                inArgs.params->srcPremult,
+                                1,
+                                inArgs.key->getBitDepth(),
+                                inArgs.params->gain,
+                                inArgs.params->offset,
+                                lutFromColorspace(srcColorSpace),
+                                lutFromColorspace(inArgs.params->lut));
+    if (singleThreaded) {
+        renderFunctor(std::make_pair(roi.y1,roi.y2),
+                      args,
+                      this,
+                      inArgs.params->ramBuffer);
+    } else {
+        threadPool->parallelFor( (int)splitRows.size(),
+                                 boost::bind(&renderStripFunctor,
+                                             &splitRows,
+                                             boost::cref(args),
+                                             this,
+                                             inArgs.params->ramBuffer,
+                                             _1) );
     }
     abortCheck(inArgs.activeInputToRender);
 
@@ -973,103 +955,34 @@ renderFunctor(std::pair<int,int> yRange,
     }
 }
 
-template <int nComps>
+void
+renderStripFunctor(const std::vector<std::pair<int,int> >* splitRows,
+                   const RenderViewerArgs & args,
+                   ViewerInstance* viewer,
+                   void *buffer,
+                   int stripIndex)
+{
+    renderFunctor( (*splitRows)[stripIndex], args, viewer, buffer );
+}
+
 std::pair<double, double>
-findAutoContrastVminVmax_internal(boost::shared_ptr<const Natron::Image> inputImage,
+findAutoContrastVminVmax(boost::shared_ptr<const Natron::Image> inputImage,
                          Natron::DisplayChannelsEnum channels,
                          const RectI & rect)
 {
-    double localVmin = std::numeric_limits<double>::infinity();
-    double localVmax = -std::numeric_limits<double>::infinity();
+    int nComps = (int)inputImage->getComponentsCount();
+    if (nComps != 4 && nComps != 3 && nComps != 1) {
+        return std::make_pair(0,1);
+    }
     
+    float localVmin = std::numeric_limits<float>::infinity();
+    float localVmax = -std::numeric_limits<float>::infinity();
     for (int y = rect.bottom(); y < rect.top(); ++y) {
         const float* src_pixels = (const float*)inputImage->pixelAt(rect.left(),y);
-        ///we fill the scan-line with all the pixels of the input image
-        for (int x = rect.left(); x < rect.right(); ++x) {
-            
-            double r,g,b,a;
-            switch (nComps) {
-                case 4:
-                    r = src_pixels[0];
-                    g = src_pixels[1];
-                    b = src_pixels[2];
-                    a = src_pixels[3];
-                    break;
-                case 3:
-                    r = src_pixels[0];
-                    g = src_pixels[1];
-                    b = src_pixels[2];
-                    a = 1.;
-                    break;
-                case 1:
-                    a = src_pixels[0];
-                    r = g = b = 0.;
-                    break;
-                default:
-                    r = g = b = 0.;
-            }
-            
-            double mini, maxi;
-            switch (channels) {
-                case Natron::eDisplayChannelsRGB:
-                    mini = std::min(std::min(r,g),b);
-                    maxi = std::max(std::max(r,g),b);
-                    break;
-                case Natron::eDisplayChannelsY:
-                    mini = r = 0.299 * r + 0.587 * g + 0.114 * b;
-                    maxi = mini;
-                    break;
-                case Natron::eDisplayChannelsR:
-                    mini = r;
-                    maxi = mini;
-                    break;
-                case Natron::eDisplayChannelsG:
-                    mini = g;
-                    maxi = mini;
-                    break;
-                case Natron::eDisplayChannelsB:
-                    mini = b;
-                    maxi = mini;
-                    break;
-                case Natron::eDisplayChannelsA:
-                    mini = a;
-                    maxi = mini;
-                    break;
-                default:
-                    mini = 0.;
-                    maxi = 0.;
-                    break;
-            }
-            if (mini < localVmin) {
-                localVmin = mini;
-            }
-            if (maxi > localVmax) {
-                localVmax = maxi;
-            }
-            
-            src_pixels += nComps;
-        }
+        Natron::ImageKernels::findMinMax(src_pixels, rect.width(), nComps, channels, &localVmin, &localVmax);
     }
     
     return std::make_pair(localVmin, localVmax);
-}
-
-
-std::pair<double, double>
-findAutoContrastVminVmax(boost::shared_ptr<const Natron::Image> inputImage,
-                         Natron::DisplayChannelsEnum channels,
-                         const RectI & rect)
-{
-    switch (inputImage->getComponents()) {
-        case Natron::eImageComponentRGBA:
-            return findAutoContrastVminVmax_internal<4>(inputImage, channels, rect);
-        case Natron::eImageComponentRGB:
-            return findAutoContrastVminVmax_internal<3>(inputImage, channels, rect);
-        case Natron::eImageComponentAlpha:
-            return findAutoContrastVminVmax_internal<1>(inputImage, channels, rect);
-        default:
-            return std::make_pair(0,1);
-    }
 } // findAutoContrastVminVmax
 
 template <typename PIX,int maxValue,int nComps,bool opaque,int rOffset,int gOffset,int bOffset>
@@ -1083,130 +996,115 @@ scaleToTexture8bits_internal(const std::pair<int,int> & yRange,
     
     const bool luminance = (args.channels == Natron::eDisplayChannelsY);
     
+    ///the look-up table of the dithered conversion to the viewer color-space, or NULL to quantize linearly
+    const unsigned short* toUint8xx = args.colorSpace ? args.colorSpace->getToUint8xxTable() : 0;
+    
     ///offset the output buffer at the starting point
-    output += ( (yRange.first - args.texRect.y1) / args.closestPowerOf2 ) * args.texRect.w;
+    int dstY = (yRange.first - args.texRect.y1) / args.closestPowerOf2;
+    output += dstY * args.texRect.w;
+    
+    const int dstWidth = std::min( args.texRect.w,
+                                   ( (args.texRect.x2 - args.texRect.x1) + args.closestPowerOf2 - 1 ) / args.closestPowerOf2 );
+    if (dstWidth <= 0) {
+        return;
+    }
+    
+    ///each scan-line is first converted to RGBA floats, then packed to 8-bit by ImageKernels::convertRGBAToBGRA8
+    std::vector<float> row(dstWidth * 4);
 
     ///iterating over the scan-lines of the input image
-    int dstY = 0;
     for (int y = yRange.first; y < yRange.second; y += args.closestPowerOf2) {
         
-        int start = (int)( rand() % std::max( ( (args.texRect.x2 - args.texRect.x1) / args.closestPowerOf2 ),1 ) );
         const PIX* src_pixels = (const PIX*)args.inputImage->pixelAt(args.texRect.x1, y);
-        U32* dst_pixels = output + dstY * args.texRect.w;
+        U32* dst_pixels = output;
+        float* row_pixels = &row[0];
         
-        /* go fowards from starting point to end of line: */
-        for (int backward = 0; backward < 2; ++backward) {
-            int dstIndex = backward ? start - 1 : start;
+        for (int dstIndex = 0; dstIndex < dstWidth; ++dstIndex, row_pixels += 4) {
             int srcIndex = dstIndex * args.closestPowerOf2; //< offset from src_pixels
-            assert( backward == 1 || ( srcIndex >= 0 && srcIndex < (args.texRect.x2 - args.texRect.x1) ) );
-
-            unsigned error_r = 0x80;
-            unsigned error_g = 0x80;
-            unsigned error_b = 0x80;
-
-            while (dstIndex < args.texRect.w && dstIndex >= 0) {
-                if ( srcIndex >= ( args.texRect.x2 - args.texRect.x1) ) {
-                    break;
-                } else {
-                    double r,g,b;
-                    int a;
-                    switch (nComps) {
-                        case 4:
-                            r = (src_pixels ? src_pixels[srcIndex * nComps + rOffset] : 0.);
-                            g = (src_pixels ? src_pixels[srcIndex * nComps + gOffset] : 0.);
-                            b = (src_pixels ? src_pixels[srcIndex * nComps + bOffset] : 0.);
-                            if (opaque) {
-                                a = 255;
-                            } else {
-                                a = (src_pixels ? Color::floatToInt<256>(src_pixels[srcIndex * nComps + 3]) : 0);
-                            }
-                            break;
-                        case 3:
-                            r = (src_pixels && rOffset < nComps) ? src_pixels[srcIndex * nComps + rOffset] : 0.;
-                            g = (src_pixels && gOffset < nComps) ? src_pixels[srcIndex * nComps + gOffset] : 0.;
-                            b = (src_pixels && bOffset < nComps) ? src_pixels[srcIndex * nComps + bOffset] : 0.;
-                            a = (src_pixels ? 255 : 0);
-                            break;
-                        case 1:
-                            r = src_pixels ? src_pixels[srcIndex] : 0.;
-                            g = b = r;
-                            a = src_pixels ? 255 : 0;
-                            break;
-                        default:
-                            assert(false);
-                            break;
-                    }
-                    
-                    
-                    switch ( pixelSize ) {
-                    case sizeof(unsigned char): //byte
-                        if (args.srcColorSpace) {
-                            r = args.srcColorSpace->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)r );
-                            g = args.srcColorSpace->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)g );
-                            b = args.srcColorSpace->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)b );
-                        } else {
-                            r = (double)convertPixelDepth<unsigned char, float>( (unsigned char)r );
-                            g = (double)convertPixelDepth<unsigned char, float>( (unsigned char)g );
-                            b = (double)convertPixelDepth<unsigned char, float>( (unsigned char)b );
-                        }
-                        break;
-                    case sizeof(unsigned short): //short
-                        if (args.srcColorSpace) {
-                            r = args.srcColorSpace->fromColorSpaceUint16ToLinearFloatFast( (unsigned short)r );
-                            g = args.srcColorSpace->fromColorSpaceUint16ToLinearFloatFast( (unsigned short)g );
-                            b = args.srcColorSpace->fromColorSpaceUint16ToLinearFloatFast( (unsigned short)b );
-                        } else {
-                            r = (double)convertPixelDepth<unsigned short, float>( (unsigned char)r );
-                            g = (double)convertPixelDepth<unsigned short, float>( (unsigned char)g );
-                            b = (double)convertPixelDepth<unsigned short, float>( (unsigned char)b );
-                        }
-                        break;
-                    case sizeof(float): //float
-                        if (args.srcColorSpace) {
-                            r = args.srcColorSpace->fromColorSpaceFloatToLinearFloat(r);
-                            g = args.srcColorSpace->fromColorSpaceFloatToLinearFloat(g);
-                            b = args.srcColorSpace->fromColorSpaceFloatToLinearFloat(b);
-                        }
-                        break;
-                    default:
-                        break;
-                    }
-
-                    r =  r * args.gain + args.offset;
-                    g =  g * args.gain + args.offset;
-                    b =  b * args.gain + args.offset;
-
-                    if (luminance) {
-                        r = 0.299 * r + 0.587 * g + 0.114 * b;
-                        g = r;
-                        b = r;
-                    }
-
-                    if (!args.colorSpace) {
-                        dst_pixels[dstIndex] = toBGRA(Color::floatToInt<256>(r),
-                                                      Color::floatToInt<256>(g),
-                                                      Color::floatToInt<256>(b),
-                                                      a);
+            float r,g,b,a;
+            switch (nComps) {
+                case 4:
+                    r = (src_pixels ? src_pixels[srcIndex * nComps + rOffset] : 0.f);
+                    g = (src_pixels ? src_pixels[srcIndex * nComps + gOffset] : 0.f);
+                    b = (src_pixels ? src_pixels[srcIndex * nComps + bOffset] : 0.f);
+                    if (opaque) {
+                        a = 1.f;
                     } else {
-                        error_r = (error_r & 0xff) + args.colorSpace->toColorSpaceUint8xxFromLinearFloatFast(r);
-                        error_g = (error_g & 0xff) + args.colorSpace->toColorSpaceUint8xxFromLinearFloatFast(g);
-                        error_b = (error_b & 0xff) + args.colorSpace->toColorSpaceUint8xxFromLinearFloatFast(b);
-                        assert(error_r < 0x10000 && error_g < 0x10000 && error_b < 0x10000);
-                        dst_pixels[dstIndex] = toBGRA( (U8)(error_r >> 8),
-                                                       (U8)(error_g >> 8),
-                                                       (U8)(error_b >> 8),
-                                                       a );
+                        a = (src_pixels ? (float)src_pixels[srcIndex * nComps + 3] : 0.f);
                     }
+                    break;
+                case 3:
+                    r = (src_pixels && rOffset < nComps) ? src_pixels[srcIndex * nComps + rOffset] : 0.f;
+                    g = (src_pixels && gOffset < nComps) ? src_pixels[srcIndex * nComps + gOffset] : 0.f;
+                    b = (src_pixels && bOffset < nComps) ? src_pixels[srcIndex * nComps + bOffset] : 0.f;
+                    a = (src_pixels ? 1.f : 0.f);
+                    break;
+                case 1:
+                    r = src_pixels ? src_pixels[srcIndex] : 0.f;
+                    g = b = r;
+                    a = src_pixels ? 1.f : 0.f;
+                    break;
+                default:
+                    assert(false);
+                    r = g = b = a = 0.f;
+                    break;
+            }
+            
+            
+            switch ( pixelSize ) {
+            case sizeof(unsigned char): //byte
+                if (args.srcColorSpace) {
+                    r = args.srcColorSpace->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)r );
+                    g = args.srcColorSpace->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)g );
+                    b = args.srcColorSpace->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)b );
+                } else {
+                    r = convertPixelDepth<unsigned char, float>( (unsigned char)r );
+                    g = convertPixelDepth<unsigned char, float>( (unsigned char)g );
+                    b = convertPixelDepth<unsigned char, float>( (unsigned char)b );
                 }
-                if (backward) {
-                    --dstIndex;
-                    srcIndex -= args.closestPowerOf2;
+                break;
+            case sizeof(unsigned short): //short
+                if (args.srcColorSpace) {
+                    r = args.srcColorSpace->fromColorSpaceUint16ToLinearFloatFast( (unsigned short)r );
+                    g = args.srcColorSpace->fromColorSpaceUint16ToLinearFloatFast( (unsigned short)g );
+                    b = args.srcColorSpace->fromColorSpaceUint16ToLinearFloatFast( (unsigned short)b );
                 } else {
-                    ++dstIndex;
-                    srcIndex += args.closestPowerOf2;
+                    r = convertPixelDepth<unsigned short, float>( (unsigned char)r );
+                    g = convertPixelDepth<unsigned short, float>( (unsigned char)g );
+                    b = convertPixelDepth<unsigned short, float>( (unsigned char)b );
+                }
+                break;
+            case sizeof(float): //float
+                if (args.srcColorSpace) {
+                    r = args.srcColorSpace->fromColorSpaceFloatToLinearFloat(r);
+                    g = args.srcColorSpace->fromColorSpaceFloatToLinearFloat(g);
+                    b = args.srcColorSpace->fromColorSpaceFloatToLinearFloat(b);
                 }
+                break;
+            default:
+                break;
+            }
+
+            r =  r * args.gain + args.offset;
+            g =  g * args.gain + args.offset;
+            b =  b * args.gain + args.offset;
+
+            if (luminance) {
+                r = 0.299 * r + 0.587 * g + 0.114 * b;
+                g = r;
+                b = r;
             }
+            
+            row_pixels[0] = r;
+            row_pixels[1] = g;
+            row_pixels[2] = b;
+            row_pixels[3] = a;
         }
+        
+        ///the dither matrix is anchored to the texture, so that it does not depend on how the rows are split between threads
+        Natron::ImageKernels::convertRGBAToBGRA8(&row[0], dst_pixels, dstWidth, 0, dstY, toUint8xx);
+        
+        output += args.texRect.w;
         ++dstY;
     }
 } // scaleToTexture8bits_internal
@@ -1679,6 +1577,18 @@ ViewerInstance::isAutoContrastEnabled() const
     return _imp->viewerParamsAutoContrast;
 }
 
+bool
+ViewerInstance::isUsingViewerCache() const
+{
+    // MT-safe
+    if (!_imp->uiContext || _imp->uiContext->isUserRegionOfInterestEnabled()) {
+        return false;
+    }
+    QMutexLocker l(&_imp->viewerParamsMutex);
+
+    return !_imp->viewerParamsAutoContrast;
+}
+
 void
 ViewerInstance::onColorSpaceChanged(Natron::ViewerColorSpaceEnum colorspace)
 {
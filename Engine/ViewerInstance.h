@@ -68,6 +68,10 @@ public:
         boost::shared_ptr<Natron::FrameKey> key;
         boost::shared_ptr<UpdateViewerParams> params;
         boost::shared_ptr<ParallelRenderArgsSetter> frameArgs;
+        
+        ///Set for frames pre-rendered in the viewer cache by the ViewerBackgroundCacheScheduler: the render
+        ///is aborted as soon as the flag is non zero and the result is never displayed.
+        boost::shared_ptr<QAtomicInt> backgroundAbort;
     };
     
     /**
@@ -134,6 +138,12 @@ public:
 
 
     bool isAutoContrastEnabled() const WARN_UNUSED_RETURN;
+    
+    /**
+     * @brief Returns true if the rendered textures are stored in the viewer cache, i.e: when neither
+     * the user RoI nor the auto-contrast is enabled. MT-safe
+     **/
+    bool isUsingViewerCache() const WARN_UNUSED_RETURN;
 
     void onAutoContrastChanged(bool autoContrast,bool refresh);
 
@@ -22,6 +22,9 @@
 #include <QtCore/QWaitCondition>
 #include <QtCore/QThread>
 #include <QtCore/QCoreApplication>
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/weak_ptr.hpp>
+#endif
 
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/FrameEntry.h"
@@ -131,6 +134,29 @@ public:
     bool isSequential;
 };
 
+/**
+ * @brief The auto-contrast range found in the rectangle of an image. It only depends on the pixels of the image,
+ * so that displaying the same image again (e.g: when the gain changes or when the image comes from the cache) does not
+ * scan its pixels again.
+ **/
+struct AutoContrastRange
+{
+    boost::weak_ptr<const Natron::Image> image;
+    Natron::DisplayChannelsEnum channels;
+    RectI roi;
+    double vmin;
+    double vmax;
+
+    AutoContrastRange()
+    : image()
+    , channels(Natron::eDisplayChannelsRGB)
+    , roi()
+    , vmin(0.)
+    , vmax(0.)
+    {
+    }
+};
+
 struct ViewerInstance::ViewerInstancePrivate
 : public QObject, public LockManagerI<Natron::FrameEntry>
 {
@@ -155,6 +181,8 @@ public:
     , lastRenderedHashMutex()
     , lastRenderedHash(0)
     , lastRenderedHashValid(false)
+    , autoContrastMutex()
+    , autoContrastRanges()
     , renderAgeMutex()
     , renderAge()
     , lastRenderAge()
@@ -178,45 +206,17 @@ public:
     
     virtual void lock(const boost::shared_ptr<Natron::FrameEntry>& entry) OVERRIDE FINAL
     {
-
-
-        QMutexLocker l(&textureBeingRenderedMutex);
-        std::list<boost::shared_ptr<Natron::FrameEntry> >::iterator it =
-                std::find(textureBeingRendered.begin(), textureBeingRendered.end(), entry);
-        while ( it != textureBeingRendered.end() ) {
-            textureBeingRenderedCond.wait(&textureBeingRenderedMutex);
-            it = std::find(textureBeingRendered.begin(), textureBeingRendered.end(), entry);
-        }
-        ///Okay the image is not used by any other thread, claim that we want to use it
-        assert( it == textureBeingRendered.end() );
-        textureBeingRendered.push_back(entry);
+        textureBeingRendered.lock(entry);
     }
     
     virtual bool tryLock(const boost::shared_ptr<Natron::FrameEntry>& entry) OVERRIDE FINAL
     {
-        QMutexLocker l(&textureBeingRenderedMutex);
-        std::list<boost::shared_ptr<Natron::FrameEntry> >::iterator it =
-        std::find(textureBeingRendered.begin(), textureBeingRendered.end(), entry);
-        if ( it != textureBeingRendered.end() ) {
-            return false;
-        }
-        ///Okay the image is not used by any other thread, claim that we want to use it
-        assert( it == textureBeingRendered.end() );
-        textureBeingRendered.push_back(entry);
-        return true;
+        return textureBeingRendered.tryLock(entry);
     }
     
     virtual void unlock(const boost::shared_ptr<Natron::FrameEntry>& entry) OVERRIDE FINAL
     {
-
-        QMutexLocker l(&textureBeingRenderedMutex);
-        std::list<boost::shared_ptr<Natron::FrameEntry> >::iterator it =
-                std::find(textureBeingRendered.begin(), textureBeingRendered.end(), entry);
-        ///The image must exist, otherwise this is a bug
-        assert( it != textureBeingRendered.end() );
-        textureBeingRendered.erase(it);
-        ///Notify all waiting threads that we're finished
-        textureBeingRenderedCond.wakeAll();
+        textureBeingRendered.unlock(entry);
     }
 
     U64 getRenderAge(int texIndex)
@@ -240,6 +240,45 @@ public:
         return age >= lastRenderAge[texIndex];
     }
     
+    /**
+     * @brief Returns true if the auto-contrast range of the rectangle roi of image was already found for the texture texIndex
+     **/
+    bool getAutoContrastRange(int texIndex,
+                              const boost::shared_ptr<const Natron::Image>& image,
+                              Natron::DisplayChannelsEnum channels,
+                              const RectI& roi,
+                              double* vmin,
+                              double* vmax) const
+    {
+        QMutexLocker k(&autoContrastMutex);
+        const AutoContrastRange& range = autoContrastRanges[texIndex];
+        
+        ///The image may have been freed and another one allocated at the same address: the weak pointer expires in that case
+        if (range.image.lock() != image || range.channels != channels || range.roi != roi) {
+            return false;
+        }
+        *vmin = range.vmin;
+        *vmax = range.vmax;
+        return true;
+    }
+    
+    void setAutoContrastRange(int texIndex,
+                              const boost::shared_ptr<const Natron::Image>& image,
+                              Natron::DisplayChannelsEnum channels,
+                              const RectI& roi,
+                              double vmin,
+                              double vmax)
+    {
+        QMutexLocker k(&autoContrastMutex);
+        AutoContrastRange& range = autoContrastRanges[texIndex];
+        
+        range.image = image;
+        range.channels = channels;
+        range.roi = roi;
+        range.vmin = vmin;
+        range.vmax = vmax;
+    }
+    
     bool checkAndUpdateRenderAge(int texIndex,U64 age)
     {
         QMutexLocker k(&renderAgeMutex);
@@ -300,9 +339,10 @@ public:
     U64 lastRenderedHash;
     bool lastRenderedHashValid;
     
-    mutable QMutex textureBeingRenderedMutex;
-    QWaitCondition textureBeingRenderedCond;
-    std::list<boost::shared_ptr<Natron::FrameEntry> > textureBeingRendered; ///< a list of all the texture being rendered simultaneously
+    ImageLockRegistry<Natron::FrameEntry> textureBeingRendered; ///< the textures being rendered simultaneously
+    
+    mutable QMutex autoContrastMutex; //< protects autoContrastRanges
+    AutoContrastRange autoContrastRanges[2]; //< the last auto-contrast range found for each texture
     
 private:
     
@@ -106,6 +106,9 @@ CLANG_DIAG_ON(uninitialized)
 #define kShortcutIDActionRenderAll "renderAll"
 #define kShortcutDescActionRenderAll "Render all writers"
 
+#define kShortcutIDActionProfileRenders "profileRenders"
+#define kShortcutDescActionProfileRenders "Profile renders"
+
 #define kShortcutIDActionConnectViewerToInput1 "connectViewerInput1"
 #define kShortcutDescActionConnectViewerToInput1 "Connect viewer to input 1"
 
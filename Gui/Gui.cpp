@@ -77,6 +77,7 @@ CLANG_DIAG_ON(unused-parameter)
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/NodeGroup.h"
 #include "Engine/NoOp.h"
+#include "Engine/Profiler.h"
 
 #include "Gui/GuiApplicationManager.h"
 #include "Gui/GuiAppInstance.h"
@@ -247,6 +248,7 @@ struct GuiPrivate
     QAction *actionsOpenRecentFile[NATRON_MAX_RECENT_FILES];
     ActionWithShortcut *renderAllWriters;
     ActionWithShortcut *renderSelectedNode;
+    ActionWithShortcut *actionProfileRenders;
     ActionWithShortcut* actionConnectInput1;
     ActionWithShortcut* actionConnectInput2;
     ActionWithShortcut* actionConnectInput3;
@@ -420,6 +422,7 @@ struct GuiPrivate
     , actionsOpenRecentFile()
     , renderAllWriters(0)
     , renderSelectedNode(0)
+    , actionProfileRenders(0)
     , actionConnectInput1(0)
     , actionConnectInput2(0)
     , actionConnectInput3(0)
@@ -925,6 +928,14 @@ Gui::createMenuActions()
     _imp->renderSelectedNode = new ActionWithShortcut(kShortcutGroupGlobal,kShortcutIDActionRenderSelected,kShortcutDescActionRenderSelected,this);
     QObject::connect( _imp->renderSelectedNode,SIGNAL( triggered() ),this,SLOT( renderSelectedNode() ) );
 
+    _imp->actionProfileRenders = new ActionWithShortcut(kShortcutGroupGlobal,kShortcutIDActionProfileRenders,kShortcutDescActionProfileRenders,this);
+    _imp->actionProfileRenders->setCheckable(true);
+    ///The profiler may have been enabled from the command line: the trace is then written at exit and
+    ///must not be cleared or stopped from the menu
+    _imp->actionProfileRenders->setChecked( Natron::Profiler::isEnabled() );
+    _imp->actionProfileRenders->setEnabled( !appPTR->isProfilingFromCommandLine() );
+    QObject::connect( _imp->actionProfileRenders,SIGNAL( triggered(bool) ),this,SLOT( toggleRenderProfiling(bool) ) );
+
 
     for (int c = 0; c < NATRON_MAX_RECENT_FILES; ++c) {
         _imp->actionsOpenRecentFile[c] = new QAction(this);
@@ -1032,6 +1043,8 @@ Gui::createMenuActions()
 
     _imp->menuRender->addAction(_imp->renderAllWriters);
     _imp->menuRender->addAction(_imp->renderSelectedNode);
+    _imp->menuRender->addSeparator();
+    _imp->menuRender->addAction(_imp->actionProfileRenders);
 
     _imp->cacheMenu->addAction(_imp->actionClearDiskCache);
     _imp->cacheMenu->addAction(_imp->actionClearPlayBackCache);
@@ -2801,6 +2814,7 @@ Gui::openProject()
     std::vector<std::string> filters;
 
     filters.push_back(NATRON_PROJECT_FILE_EXT);
+    filters.push_back(NATRON_PROJECT_BINARY_FILE_EXT);
     std::string selectedFile =  popOpenFileDialog( false, filters, _imp->_lastLoadProjectOpenedDir.toStdString(),false );
 
     if ( !selectedFile.empty() ) {
@@ -2896,6 +2910,7 @@ Gui::saveProjectAs()
     std::vector<std::string> filter;
 
     filter.push_back(NATRON_PROJECT_FILE_EXT);
+    filter.push_back(NATRON_PROJECT_BINARY_FILE_EXT);
     std::string outFile = popSaveFileDialog( false, filter,_imp->_lastSaveProjectOpenedDir.toStdString(),false );
     if (outFile.size() > 0) {
         if (outFile.find("." NATRON_PROJECT_FILE_EXT) == std::string::npos) {
@@ -4382,6 +4397,41 @@ Gui::renderSelectedNode()
     }
 }
 
+void
+Gui::toggleRenderProfiling(bool enabled)
+{
+    if (enabled) {
+        ///Start a new capture
+        Natron::Profiler::clear();
+        Natron::Profiler::setEnabled(true);
+
+        return;
+    }
+
+    Natron::Profiler::setEnabled(false);
+    if (Natron::Profiler::getEventsCount() == 0) {
+        Natron::informationDialog( tr("Profile renders").toStdString(), tr("Nothing was rendered while profiling.").toStdString() );
+
+        return;
+    }
+
+    std::vector<std::string> filters;
+    filters.push_back("json");
+    SequenceFileDialog dialog( this,filters,false,SequenceFileDialog::eFileDialogModeSave,_imp->_lastSaveProjectOpenedDir.toStdString(),this,false );
+    if ( dialog.exec() ) {
+        std::string filename = dialog.filesToSave();
+        QString filenameCpy( filename.c_str() );
+        QString ext = Natron::removeFileExtension(filenameCpy);
+        if (ext != "json") {
+            filename.append(".json");
+        }
+        std::string error;
+        if ( !Natron::Profiler::writeChromeTrace(filename, &error) ) {
+            Natron::errorDialog( tr("Profile renders").toStdString(), error );
+        }
+    }
+}
+
 void
 Gui::setUndoRedoStackLimit(int limit)
 {
@@ -611,6 +611,11 @@ public Q_SLOTS:
 
     void renderSelectedNode();
 
+    /**
+     * @brief Starts recording the renders with the profiler, or stops and asks where to write the trace
+     **/
+    void toggleRenderProfiling(bool enabled);
+
     void onRotoSelectedToolChanged(int tool);
 
     void onMaxVisibleDockablePanelChanged(int maxPanels);
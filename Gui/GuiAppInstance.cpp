@@ -273,7 +273,7 @@ GuiAppInstance::load(const CLArgs& cl)
             loadPythonScript(info);
             execOnProjectCreatedCallback();
             
-        } else if (info.suffix() == NATRON_PROJECT_FILE_EXT) {
+        } else if (info.suffix() == NATRON_PROJECT_FILE_EXT || info.suffix() == NATRON_PROJECT_BINARY_FILE_EXT) {
             
             ///Otherwise just load the project specified.
             QString name = info.fileName();
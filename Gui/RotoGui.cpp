@@ -867,8 +867,7 @@ RotoGui::drawOverlays(double /*scaleX*/,
             // It should first compute the bbox (this is cheap)
             // then check if the bbox is visible
             // if the bbox is visible, compute the polygon and draw it.
-            std::list< Point > points;
-            (*it)->evaluateAtTime_DeCasteljau(time,0, 100, &points, NULL);
+            boost::shared_ptr<const BezierPolyline> points = (*it)->getPolylineAtTime(time, 0, 100, false);
             
             bool locked = (*it)->isLockedRecursive();
             double curveColor[4];
@@ -880,7 +879,7 @@ RotoGui::drawOverlays(double /*scaleX*/,
             glColor4dv(curveColor);
             
             glBegin(GL_LINE_STRIP);
-            for (std::list<Point >::const_iterator it2 = points.begin(); it2 != points.end(); ++it2) {
+            for (std::vector<Point>::const_iterator it2 = points->points.begin(); it2 != points->points.end(); ++it2) {
                 glVertex2f(it2->x, it2->y);
             }
             glEnd();
@@ -907,6 +907,8 @@ void
 TimeLineGui::onCachedFrameAdded(SequenceTime time)
 {
     _imp->cachedFrames.insert( CachedFrame(time, eStorageModeRAM) );
+    ///Frames may be cached in the background while the timeline is idle
+    update();
 }
 
 void
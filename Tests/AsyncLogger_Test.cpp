@@ -0,0 +1,180 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <cstdarg>
+#include <map>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#endif
+
+#include "Engine/AsyncLogger.h"
+
+using namespace Natron;
+
+namespace {
+
+struct RecordsSink
+{
+    QMutex mutex;
+    std::vector<LogRecord> records;
+    int dropped;
+    int nCalls;
+
+    RecordsSink()
+    : mutex()
+    , records()
+    , dropped(0)
+    , nCalls(0)
+    {
+    }
+
+    void write(const std::vector<LogRecord> & newRecords,
+               int newlyDropped)
+    {
+        QMutexLocker l(&mutex);
+
+        records.insert( records.end(), newRecords.begin(), newRecords.end() );
+        dropped += newlyDropped;
+        ++nCalls;
+    }
+};
+
+class LoggingThread
+    : public QThread
+{
+    AsyncLogger* _logger;
+    int _nRecords;
+
+public:
+
+    LoggingThread(AsyncLogger* logger,
+                  int nRecords)
+    : QThread()
+    , _logger(logger)
+    , _nRecords(nRecords)
+    {
+    }
+
+private:
+
+    virtual void run()
+    {
+        for (int i = 0; i < _nRecords; ++i) {
+            EXPECT_TRUE( _logger->log(1, "node", i, "render", "message") );
+        }
+    }
+};
+
+bool
+logFormatted(AsyncLogger* logger,
+             const char* format,
+             ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    bool ret = logger->vlog(0, "node", 3, "render", format, args);
+    va_end(args);
+
+    return ret;
+}
+
+} // anon namespace
+
+TEST(AsyncLogger,RecordsOfAllThreadsAreFlushed) {
+    RecordsSink sink;
+    AsyncLogger logger( boost::bind(&RecordsSink::write, &sink, _1, _2) );
+    const int nThreads = 4;
+    const int nRecords = 500;
+    std::vector<LoggingThread*> threads;
+
+    for (int i = 0; i < nThreads; ++i) {
+        threads.push_back( new LoggingThread(&logger, nRecords) );
+        threads.back()->start();
+    }
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->wait();
+        delete threads[i];
+    }
+    logger.flush();
+
+    QMutexLocker l(&sink.mutex);
+    ASSERT_EQ( nThreads * nRecords, (int)sink.records.size() );
+    EXPECT_EQ(0, sink.dropped);
+    EXPECT_EQ( 0, logger.getDroppedCount() );
+
+    ///The records of each thread are in order
+    std::map<int, int> nextFrame;
+    std::map<int, U64> lastTimestamp;
+    for (std::size_t i = 0; i < sink.records.size(); ++i) {
+        const LogRecord & r = sink.records[i];
+        EXPECT_EQ(1, r.kind);
+        EXPECT_STREQ("node", r.node);
+        EXPECT_STREQ("render", r.action);
+        EXPECT_EQ(nextFrame[r.threadIndex], r.frame);
+        nextFrame[r.threadIndex] = r.frame + 1;
+        EXPECT_LE(lastTimestamp[r.threadIndex], r.timestamp);
+        lastTimestamp[r.threadIndex] = r.timestamp;
+    }
+    EXPECT_EQ( nThreads, (int)nextFrame.size() );
+}
+
+TEST(AsyncLogger,OverflowingRecordsAreDropped) {
+    RecordsSink sink;
+    ///Do not let the flusher thread run until flush() is called
+    AsyncLogger logger(boost::bind(&RecordsSink::write, &sink, _1, _2), 4, 1000000);
+
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ( i < 4, logger.log("message") );
+    }
+    EXPECT_EQ( 6, logger.getDroppedCount() );
+    logger.flush();
+    {
+        QMutexLocker l(&sink.mutex);
+        EXPECT_EQ( 4, (int)sink.records.size() );
+        EXPECT_EQ(6, sink.dropped);
+        EXPECT_EQ(NATRON_LOG_RECORD_NO_FRAME, sink.records[0].frame);
+    }
+
+    ///The buffer is available again once flushed
+    EXPECT_TRUE( logger.log("message") );
+    logger.flush();
+    QMutexLocker l(&sink.mutex);
+    EXPECT_EQ( 5, (int)sink.records.size() );
+    EXPECT_EQ(6, sink.dropped);
+}
+
+TEST(AsyncLogger,FieldsAreWrittenInPlace) {
+    RecordsSink sink;
+    AsyncLogger logger( boost::bind(&RecordsSink::write, &sink, _1, _2) );
+    std::string longNode(NATRON_LOG_RECORD_NAME_SIZE * 2, 'n');
+    std::string longMessage(NATRON_LOG_RECORD_MESSAGE_SIZE * 2, 'm');
+
+    EXPECT_TRUE( logger.log( 0, longNode.c_str(), 1, "render", longMessage.c_str() ) );
+    EXPECT_TRUE( logFormatted(&logger, "%s %d", "frame", 42) );
+    logger.flush();
+
+    QMutexLocker l(&sink.mutex);
+    ASSERT_EQ( 2, (int)sink.records.size() );
+    ///Strings longer than their field are truncated
+    EXPECT_EQ( longNode.substr(0, NATRON_LOG_RECORD_NAME_SIZE - 1), std::string(sink.records[0].node) );
+    EXPECT_EQ( longMessage.substr(0, NATRON_LOG_RECORD_MESSAGE_SIZE - 1), std::string(sink.records[0].message) );
+    EXPECT_STREQ("render", sink.records[0].action);
+    EXPECT_STREQ("node", sink.records[1].node);
+    EXPECT_EQ(3, sink.records[1].frame);
+    EXPECT_STREQ("frame 42", sink.records[1].message);
+}
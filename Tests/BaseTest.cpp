@@ -21,6 +21,10 @@
 #include "Engine/AppInstance.h"
 #include "Engine/EffectInstance.h"
 #include "Engine/Plugin.h"
+#include "Engine/KnobTypes.h"
+#include "Engine/ProjectBinaryFormat.h"
+
+#include <sstream>
 using namespace Natron;
 
 
@@ -241,3 +245,41 @@ TEST_F(BaseTest,SimpleNodeConnections) {
     disconnectNodes(generator, writer, false);
     connectNodes(generator, writer, 0, true);
 }
+
+///High level test: a change which does not trigger an evaluation must still be written by the next auto-save
+TEST_F(BaseTest,AutoSaveJournalKeepsNonEvaluatingKnobs) {
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    boost::shared_ptr<Project> project = _app->getProject();
+
+    std::string data;
+    bool compact;
+    project->encodeAutoSaveJournal(true, &data, &compact);
+    ASSERT_FALSE( data.empty() );
+
+    ///Nothing changed: nothing to append
+    std::string increment;
+    project->encodeAutoSaveJournal(false, &increment, &compact);
+    EXPECT_TRUE( increment.empty() );
+
+    ///The label knob does not evaluate on change
+    boost::shared_ptr<String_Knob> label = boost::dynamic_pointer_cast<String_Knob>( generator->getKnobByName(kUserLabelKnobName) );
+    ASSERT_TRUE(label.get() != NULL);
+    label->setValue("JournaledLabel", 0);
+    project->encodeAutoSaveJournal(false, &increment, &compact);
+    ASSERT_FALSE( increment.empty() );
+    data.append(increment);
+
+    std::istringstream stream(data);
+    ProjectBinaryReader reader(stream);
+    ProjectJournalState state;
+    ASSERT_TRUE( readProjectJournal(reader, &state) );
+    std::string scriptName = generator->getScriptName();
+    bool found = false;
+    for (std::list< std::pair<std::string, std::string> >::const_iterator it = state.nodes.begin(); it != state.nodes.end(); ++it) {
+        if (it->first == scriptName) {
+            found = true;
+            EXPECT_NE( std::string::npos, it->second.find("JournaledLabel") );
+        }
+    }
+    EXPECT_TRUE(found);
+}
@@ -0,0 +1,291 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <cstdio>
+#include <list>
+#include <string>
+#include <gtest/gtest.h>
+
+#include <QtCore/QDir>
+
+#include "Engine/CacheIndex.h"
+#include "Engine/StandardPaths.h"
+
+using namespace Natron;
+
+#define CACHE_INDEX_TEST_VERSION 3
+
+namespace {
+
+class CacheIndexTest
+    : public ::testing::Test
+{
+protected:
+
+    std::string _directory;
+
+    virtual void SetUp()
+    {
+        QString tempPath = Natron::StandardPaths::writableLocation(Natron::StandardPaths::eStandardLocationTemp);
+        QDir dir(tempPath);
+
+        dir.mkpath("NatronCacheIndexUnitTest");
+        _directory = dir.absoluteFilePath("NatronCacheIndexUnitTest").toStdString();
+        removeFiles();
+    }
+
+    virtual void TearDown()
+    {
+        removeFiles();
+        QDir( QString::fromUtf8( _directory.c_str() ) ).rmdir(".");
+    }
+
+    std::string path(const char* fileName) const
+    {
+        return _directory + '/' + fileName;
+    }
+
+    void removeFiles()
+    {
+        std::remove( path(NATRON_CACHE_INDEX_FILE_NAME).c_str() );
+        std::remove( path(NATRON_CACHE_JOURNAL_FILE_NAME).c_str() );
+    }
+
+    std::string readJournal() const
+    {
+        std::string content;
+        std::FILE* f = std::fopen(path(NATRON_CACHE_JOURNAL_FILE_NAME).c_str(), "rb");
+
+        if (f) {
+            char buf[4096];
+            std::size_t n;
+            while ( ( n = std::fread(buf, 1, sizeof(buf), f) ) > 0 ) {
+                content.append(buf, n);
+            }
+            std::fclose(f);
+        }
+
+        return content;
+    }
+
+    void writeJournal(const std::string & content) const
+    {
+        std::FILE* f = std::fopen(path(NATRON_CACHE_JOURNAL_FILE_NAME).c_str(), "wb");
+
+        ASSERT_TRUE(f != 0);
+        std::fwrite(content.data(), 1, content.size(), f);
+        std::fclose(f);
+    }
+};
+
+CacheIndex::Record
+makeRecord(U64 hash,
+           const std::string & filePath,
+           U64 size)
+{
+    CacheIndex::Record r;
+
+    r.hash = hash;
+    r.filePath = filePath;
+    r.size = size;
+    r.time = (int)size;
+    r.blob = "blob of " + filePath;
+
+    return r;
+}
+
+///Takes the records of the given hash and returns the size of the one with the given path, or 0
+U64
+takeSize(CacheIndex & index,
+         U64 hash,
+         const std::string & filePath)
+{
+    std::list<CacheIndex::Record> records;
+    U64 ret = 0;
+
+    index.take(hash, &records);
+    for (std::list<CacheIndex::Record>::iterator it = records.begin(); it != records.end(); ++it) {
+        if (it->filePath == filePath) {
+            EXPECT_EQ( "blob of " + filePath, it->blob );
+            ret = it->size;
+        }
+    }
+
+    return ret;
+}
+
+} // anon namespace
+
+TEST_F(CacheIndexTest,WriteThenOpen) {
+    std::list<CacheIndex::Record> records;
+
+    records.push_back( makeRecord(1, "a", 10) );
+    records.push_back( makeRecord(1, "b", 20) );
+    records.push_back( makeRecord(2, "c", 30) );
+    ASSERT_TRUE( CacheIndex::write(_directory, CACHE_INDEX_TEST_VERSION, records) );
+    EXPECT_TRUE( CacheIndex::existsInDirectory(_directory) );
+
+    CacheIndex index;
+    ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+    EXPECT_EQ( 60, (int)index.getNotAdoptedSize() );
+
+    ///Both records of a hash key are adopted at once
+    std::list<CacheIndex::Record> taken;
+    index.take(1, &taken);
+    EXPECT_EQ( 2, (int)taken.size() );
+    EXPECT_EQ( 30, (int)index.getNotAdoptedSize() );
+    taken.clear();
+    index.take(1, &taken);
+    EXPECT_TRUE( taken.empty() );
+    EXPECT_EQ( 30, (int)takeSize(index, 2, "c") );
+    EXPECT_EQ( 0, (int)index.getNotAdoptedSize() );
+    index.close();
+
+    ///An index written by another version of the cache is ignored
+    EXPECT_FALSE( index.open(_directory, CACHE_INDEX_TEST_VERSION + 1) );
+    EXPECT_TRUE( index.isOpened() );
+    EXPECT_EQ( 0, (int)index.getNotAdoptedSize() );
+}
+
+TEST_F(CacheIndexTest,JournalIsReplayedOnTopOfIndex) {
+    std::list<CacheIndex::Record> records;
+
+    records.push_back( makeRecord(1, "a", 10) );
+    records.push_back( makeRecord(2, "b", 20) );
+    ASSERT_TRUE( CacheIndex::write(_directory, CACHE_INDEX_TEST_VERSION, records) );
+    {
+        CacheIndex index;
+        ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+        index.appendInsert( makeRecord(3, "c", 30) );
+        index.appendRemove(2, "b");
+        ///A new insert of the same file supersedes the record of the index
+        index.appendInsert( makeRecord(1, "a", 15) );
+        index.flushJournal();
+        ///The index is not closed cleanly, as if the application crashed
+    }
+
+    CacheIndex index;
+    ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+    EXPECT_EQ( 45, (int)index.getNotAdoptedSize() );
+    EXPECT_EQ( 15, (int)takeSize(index, 1, "a") );
+    EXPECT_EQ( 0, (int)takeSize(index, 2, "b") );
+    EXPECT_EQ( 30, (int)takeSize(index, 3, "c") );
+}
+
+TEST_F(CacheIndexTest,TornAndCorruptedTailsAreIgnored) {
+    {
+        CacheIndex index;
+        EXPECT_FALSE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+        index.appendInsert( makeRecord(1, "a", 10) );
+        index.flushJournal();
+    }
+    std::string valid = readJournal();
+
+    ///An event whose write was interrupted: its length goes past the end of the file
+    writeJournal( valid + std::string("\x64\x00\x00\x00\x01\x02\x03\x04\x00", 9) );
+    {
+        CacheIndex index;
+        ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+        EXPECT_EQ( 10, (int)index.getNotAdoptedSize() );
+        ///The torn tail was dropped, hence the events appended now are replayed by the next session
+        index.appendInsert( makeRecord(2, "b", 20) );
+        index.flushJournal();
+    }
+    {
+        CacheIndex index;
+        ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+        EXPECT_EQ( 10, (int)takeSize(index, 1, "a") );
+        EXPECT_EQ( 20, (int)takeSize(index, 2, "b") );
+    }
+
+    ///An event whose checksum does not match its body
+    std::string journal = readJournal();
+    ASSERT_GT( journal.size(), valid.size() );
+    journal[journal.size() - 1] ^= 0x5a;
+    writeJournal(journal);
+    {
+        CacheIndex index;
+        ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+        EXPECT_EQ( 10, (int)index.getNotAdoptedSize() );
+        EXPECT_EQ( 0, (int)takeSize(index, 2, "b") );
+    }
+    EXPECT_EQ( valid, readJournal() );
+}
+
+TEST_F(CacheIndexTest,TakeAnyAdoptsIndexRecordsFirst) {
+    std::list<CacheIndex::Record> records;
+
+    records.push_back( makeRecord(1, "a", 10) );
+    ASSERT_TRUE( CacheIndex::write(_directory, CACHE_INDEX_TEST_VERSION, records) );
+
+    CacheIndex index;
+    ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+    index.appendInsert( makeRecord(2, "b", 20) );
+    index.flushJournal();
+    index.close();
+    ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+
+    std::list<CacheIndex::Record> notAdopted;
+    index.getNotAdopted(&notAdopted);
+    EXPECT_EQ( 2, (int)notAdopted.size() );
+
+    CacheIndex::Record r;
+    ASSERT_TRUE( index.takeAny(&r) );
+    EXPECT_EQ( "a", r.filePath );
+    EXPECT_EQ( 20, (int)index.getNotAdoptedSize() );
+    ASSERT_TRUE( index.takeAny(&r) );
+    EXPECT_EQ( "b", r.filePath );
+    EXPECT_EQ( 0, (int)index.getNotAdoptedSize() );
+    EXPECT_FALSE( index.takeAny(&r) );
+
+    ///Adopted records are no longer reported
+    notAdopted.clear();
+    index.getNotAdopted(&notAdopted);
+    EXPECT_TRUE( notAdopted.empty() );
+    EXPECT_EQ( 0, (int)takeSize(index, 1, "a") );
+}
+
+TEST_F(CacheIndexTest,RewriteKeepsIndexOpened) {
+    std::list<CacheIndex::Record> records;
+
+    records.push_back( makeRecord(1, "a", 10) );
+    records.push_back( makeRecord(2, "b", 20) );
+    ASSERT_TRUE( CacheIndex::write(_directory, CACHE_INDEX_TEST_VERSION, records) );
+    {
+        CacheIndex index;
+        ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+        std::list<CacheIndex::Record> adopted;
+        index.take(1, &adopted);
+        ASSERT_EQ( 1, (int)adopted.size() );
+
+        index.beginRewrite();
+        ///Journaled while the cache gathers the adopted records
+        index.appendInsert( makeRecord(3, "c", 30) );
+        index.flushJournal();
+        ASSERT_TRUE( index.rewrite(adopted) );
+
+        ///The adopted record stays adopted and the other one is still known
+        EXPECT_TRUE( index.isOpened() );
+        EXPECT_EQ( 0, (int)takeSize(index, 1, "a") );
+        EXPECT_EQ( 20, (int)index.getNotAdoptedSize() );
+
+        ///Journaling goes on after the rewrite
+        index.appendInsert( makeRecord(4, "d", 40) );
+        index.flushJournal();
+    }
+
+    CacheIndex index;
+    ASSERT_TRUE( index.open(_directory, CACHE_INDEX_TEST_VERSION) );
+    EXPECT_EQ( 100, (int)index.getNotAdoptedSize() );
+    EXPECT_EQ( 10, (int)takeSize(index, 1, "a") );
+    EXPECT_EQ( 20, (int)takeSize(index, 2, "b") );
+    EXPECT_EQ( 30, (int)takeSize(index, 3, "c") );
+    EXPECT_EQ( 40, (int)takeSize(index, 4, "d") );
+}
@@ -0,0 +1,115 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <list>
+#include <map>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "Engine/Cache.h"
+#include "Engine/Image.h"
+#include "Engine/ImageLocker.h"
+
+#include "BaseTest.h"
+
+using namespace Natron;
+
+namespace {
+
+ImageKey
+makeTestKey(int i)
+{
+    ///Spread the node hashes so that the entries fall in all the shards
+    return Image::makeKey( (U64)i * 0x9e3779b97f4a7c15ULL + 1, false, 0, 0 );
+}
+
+boost::shared_ptr<ImageParams>
+makeTestParams()
+{
+    std::map<int, std::vector<RangeD> > framesNeeded;
+
+    ///A cost of 0 keeps the entry in RAM
+    return Image::makeParams(0, RectD(0, 0, 16, 16), RectI(0, 0, 16, 16), 1., 0, false,
+                             Natron::eImageComponentRGBA, Natron::eImageBitDepthByte, framesNeeded);
+}
+
+///Returns true if the cache holds an entry for the given key
+bool
+isCached(const Cache<Image> & cache,
+         const ImageKey & key)
+{
+    std::list<ImagePtr> entries;
+
+    return cache.get(key, &entries) && !entries.empty();
+}
+
+} // anon namespace
+
+TEST_F(BaseTest,ShardedCacheInsertGetEvict) {
+    Cache<Image> cache("ShardedCacheUnitTest", 1, 1024 * 1024 * 1024, 1.);
+    const int nEntries = 64;
+    boost::shared_ptr<ImageParams> params = makeTestParams();
+    std::vector<ImagePtr> images;
+
+    for (int i = 0; i < nEntries; ++i) {
+        ImageLockerHelper<Image> locker(0);
+        ImagePtr image;
+        EXPECT_FALSE( cache.getOrCreate(makeTestKey(i), params, &locker, &image) );
+        ASSERT_TRUE(image);
+        image->allocateMemory();
+        images.push_back(image);
+    }
+
+    ///Every entry is found again, whichever shard it went to
+    for (int i = 0; i < nEntries; ++i) {
+        std::list<ImagePtr> entries;
+        ASSERT_TRUE( cache.get(makeTestKey(i), &entries) );
+        ASSERT_EQ( 1, (int)entries.size() );
+        EXPECT_EQ( images[i], entries.front() );
+
+        ImagePtr byParam;
+        EXPECT_TRUE( cache.getByParam(makeTestKey(i), params, &byParam) );
+        EXPECT_EQ(images[i], byParam);
+
+        ImageLockerHelper<Image> locker(0);
+        ImagePtr existing;
+        EXPECT_TRUE( cache.getOrCreate(makeTestKey(i), params, &locker, &existing) );
+        EXPECT_EQ(images[i], existing);
+    }
+
+    std::list<ImagePtr> copy;
+    cache.getCopy(&copy);
+    EXPECT_EQ( nEntries, (int)copy.size() );
+    copy.clear();
+
+    ///Removing an entry does not affect the other ones
+    cache.removeEntry(images[0]);
+    EXPECT_FALSE( isCached(cache, makeTestKey(0)) );
+    EXPECT_TRUE( isCached(cache, makeTestKey(1)) );
+
+    ///Entries in use are never evicted
+    EXPECT_FALSE( cache.evictLRUInMemoryEntry() );
+
+    ///Once released, eviction goes through all the shards until they are empty
+    images.clear();
+    int nEvicted = 0;
+    while ( cache.evictLRUInMemoryEntry() ) {
+        ++nEvicted;
+        ASSERT_LE(nEvicted, nEntries);
+    }
+    EXPECT_EQ(nEntries - 1, nEvicted);
+    for (int i = 0; i < nEntries; ++i) {
+        EXPECT_FALSE( isCached(cache, makeTestKey(i)) );
+    }
+    cache.getCopy(&copy);
+    EXPECT_TRUE( copy.empty() );
+
+    cache.waitForDeleterThread();
+}
@@ -8,6 +8,8 @@
 // "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
 #include <Python.h>
 
+#include <vector>
+#include <stdexcept>
 #include <gtest/gtest.h>
 
 #include <QString>
@@ -105,3 +107,60 @@ TEST(Curve,Basic)
 }
 
 
+TEST(Curve,BakedTable)
+{
+    Curve c;
+
+    EXPECT_TRUE( c.addKeyFrame( KeyFrame(0.,0.) ) );
+    EXPECT_TRUE( c.addKeyFrame( KeyFrame(10.,20.) ) );
+    EXPECT_TRUE( c.addKeyFrame( KeyFrame(20.,-5.) ) );
+
+    // values before the table is baked
+    std::vector<double> values,derivatives;
+    for (double t = -5.; t <= 25.; t += 0.125) {
+        values.push_back( c.getValueAt(t) );
+        derivatives.push_back( c.getDerivativeAt(t) );
+    }
+
+    // read enough times for the table to be baked, baked values must be exactly the same
+    for (int i = 0; i < 10; ++i) {
+        int j = 0;
+        for (double t = -5.; t <= 25.; t += 0.125, ++j) {
+            EXPECT_EQ( values[j], c.getValueAt(t) );
+            EXPECT_EQ( derivatives[j], c.getDerivativeAt(t) );
+        }
+    }
+
+    // modifying the curve invalidates the table
+    EXPECT_FALSE( c.addKeyFrame( KeyFrame(10.,30.) ) );
+    EXPECT_EQ( 30., c.getValueAt(10.) );
+    EXPECT_NE( values[(int)( (5. + 5.) * 8 )], c.getValueAt(5.) );
+    c.removeKeyFrameWithTime(20.);
+    EXPECT_EQ( 30., c.getValueAt(20.) );
+    c.clearKeyFrames();
+    EXPECT_FALSE( c.isAnimated() );
+    EXPECT_THROW( c.getValueAt(0.), std::runtime_error );
+}
+
+TEST(Curve,SetCurveInterpolation)
+{
+    Curve c;
+
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE( c.addKeyFrame( KeyFrame(i, (i % 2) * 10.) ) );
+    }
+
+    // the snapshot published once all the keyframes changed must reflect all of them
+    c.setCurveInterpolation(Natron::eKeyframeTypeConstant);
+    KeyFrameSet ks = c.getKeyFrames_mt_safe();
+    for (KeyFrameSet::const_iterator it = ks.begin(); it != ks.end(); ++it) {
+        EXPECT_EQ( Natron::eKeyframeTypeConstant, it->getInterpolation() );
+    }
+    for (int i = 0; i < 99; ++i) {
+        EXPECT_EQ( (i % 2) * 10., c.getValueAt(i + 0.5) );
+    }
+
+    c.setCurveInterpolation(Natron::eKeyframeTypeLinear);
+    EXPECT_EQ( 5., c.getValueAt(0.5) );
+    EXPECT_EQ( 5., c.getValueAt(98.5) );
+}
@@ -0,0 +1,104 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <vector>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThread>
+
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#endif
+
+#include "Engine/DedicatedThreadPool.h"
+
+using namespace Natron;
+
+namespace {
+
+void
+countIndex(std::vector<QAtomicInt>* counts,
+           int i)
+{
+    (*counts)[i].fetchAndAddRelaxed(1);
+}
+
+void
+recordConcurrency(const DedicatedThreadPool* pool,
+                  QAtomicInt* running,
+                  QAtomicInt* maxRunning,
+                  QAtomicInt* notOnPoolThread,
+                  int /*i*/)
+{
+    if (pool->getCurrentThreadIndex() < 0) {
+        notOnPoolThread->fetchAndAddRelaxed(1);
+    }
+    int current = running->fetchAndAddOrdered(1) + 1;
+    for (;;) {
+        int max = *maxRunning;
+        if ( (current <= max) || maxRunning->testAndSetOrdered(max, current) ) {
+            break;
+        }
+    }
+    QThread::yieldCurrentThread();
+    running->fetchAndAddOrdered(-1);
+}
+
+void
+throwOnOddIndex(int i)
+{
+    if (i % 2) {
+        throw std::runtime_error("odd");
+    }
+}
+
+} // anon namespace
+
+TEST(DedicatedThreadPool,RunsEachIndexOnce) {
+    DedicatedThreadPool pool;
+    std::vector<QAtomicInt> counts(1000);
+
+    for (int iteration = 0; iteration < 20; ++iteration) {
+        EXPECT_TRUE( pool.run( (int)counts.size(), 4, boost::bind(countIndex, &counts, _1) ) );
+    }
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        EXPECT_EQ(20, (int)counts[i]);
+    }
+    EXPECT_EQ( 0, pool.getActiveThreadCount() );
+}
+
+TEST(DedicatedThreadPool,ThreadsAreReusedAndBounded) {
+    DedicatedThreadPool pool;
+    QAtomicInt running;
+    QAtomicInt maxRunning;
+    QAtomicInt notOnPoolThread;
+
+    for (int iteration = 0; iteration < 50; ++iteration) {
+        EXPECT_TRUE( pool.run( 64, 3, boost::bind(recordConcurrency, &pool, &running, &maxRunning, &notOnPoolThread, _1) ) );
+    }
+    EXPECT_EQ( 0, (int)notOnPoolThread );
+    EXPECT_LE( (int)maxRunning, 3 );
+    ///The threads are parked between the calls instead of being created by each of them
+    EXPECT_EQ( 3, pool.getIdleThreadCount() );
+    EXPECT_EQ( 0, pool.getActiveThreadCount() );
+    EXPECT_EQ( -1, pool.getCurrentThreadIndex() );
+}
+
+TEST(DedicatedThreadPool,ExceptionsAreReported) {
+    DedicatedThreadPool pool;
+
+    EXPECT_FALSE( pool.run(100, 4, throwOnOddIndex) );
+    ///the pool is still usable afterwards
+    std::vector<QAtomicInt> counts(100);
+    EXPECT_TRUE( pool.run( (int)counts.size(), 4, boost::bind(countIndex, &counts, _1) ) );
+    EXPECT_EQ(1, (int)counts[99]);
+}
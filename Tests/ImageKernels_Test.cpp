@@ -0,0 +1,438 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <iostream>
+#include <limits>
+#include <gtest/gtest.h>
+#include "Engine/ImageKernels.h"
+#include "Engine/Lut.h"
+
+using namespace Natron::ImageKernels;
+
+namespace {
+
+void
+randomValue(unsigned char* v)
+{
+    *v = (unsigned char)(rand() & 0xFF);
+}
+
+void
+randomValue(unsigned short* v)
+{
+    *v = (unsigned short)(rand() & 0xFFFF);
+}
+
+void
+randomValue(float* v)
+{
+    *v = (float)rand() / RAND_MAX * 4.f - 1.f;
+}
+
+template <typename PIX>
+void
+fillRandom(std::vector<PIX>* v)
+{
+    for (std::size_t i = 0; i < v->size(); ++i) {
+        randomValue(&(*v)[i]);
+    }
+}
+
+const char*
+instructionSetName(InstructionSetEnum is)
+{
+    switch (is) {
+    case eInstructionSetAVX2:
+        return "AVX2";
+    case eInstructionSetSSE2:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
+
+///Compares each SIMD implementation with the scalar one for all the widths up to maxWidth, so that every tail is covered
+template <typename PIX>
+void
+checkKernelsBitExact(int maxWidth)
+{
+    srand(2000);
+    for (int is = eInstructionSetSSE2; is <= getSupportedInstructionSet(); ++is) {
+        for (int nComps = 1; nComps <= 4; ++nComps) {
+            for (int w = 1; w <= maxWidth; ++w) {
+                std::vector<PIX> row0(2 * w * nComps), row1(2 * w * nComps);
+                fillRandom(&row0);
+                fillRandom(&row1);
+
+                std::vector<PIX> expected(w * nComps), result(w * nComps);
+                halveRows(&row0[0], &row1[0], &expected[0], w, nComps, eInstructionSetScalar);
+                halveRows(&row0[0], &row1[0], &result[0], w, nComps, (InstructionSetEnum)is);
+                EXPECT_EQ( 0, std::memcmp( &expected[0], &result[0], expected.size() * sizeof(PIX) ) )
+                    << "halveRows " << instructionSetName((InstructionSetEnum)is) << " comps=" << nComps << " width=" << w;
+
+                for (int scale = 2; scale <= 8; scale *= 2) {
+                    std::vector<PIX> upExpected(2 * w * nComps * scale), upResult(2 * w * nComps * scale);
+                    upscaleRow(&row0[0], &upExpected[0], 2 * w, scale, nComps, eInstructionSetScalar);
+                    upscaleRow(&row0[0], &upResult[0], 2 * w, scale, nComps, (InstructionSetEnum)is);
+                    EXPECT_EQ( 0, std::memcmp( &upExpected[0], &upResult[0], upExpected.size() * sizeof(PIX) ) )
+                        << "upscaleRow " << instructionSetName((InstructionSetEnum)is) << " comps=" << nComps << " width=" << w << " scale=" << scale;
+                }
+            }
+        }
+    }
+}
+
+template <typename PIX>
+double
+benchmarkHalveRows(InstructionSetEnum is,
+                   int nComps)
+{
+    const int width = 4096;
+    const int nIterations = 500;
+    std::vector<PIX> row0(2 * width * nComps), row1(2 * width * nComps), dst(width * nComps);
+
+    fillRandom(&row0);
+    fillRandom(&row1);
+    clock_t start = clock();
+    for (int i = 0; i < nIterations; ++i) {
+        halveRows(&row0[0], &row1[0], &dst[0], width, nComps, is);
+    }
+
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+///Returns the throughput of the conversion of a 1920x1080 texture, in MPixels/s
+double
+benchmarkConvertRGBAToBGRA8(InstructionSetEnum is,
+                            const unsigned short* toUint8xx)
+{
+    const int width = 1920;
+    const int height = 1080;
+    std::vector<float> src(width * 4);
+    std::vector<unsigned int> dst(width);
+
+    fillRandom(&src);
+    clock_t start = clock();
+    for (int y = 0; y < height; ++y) {
+        convertRGBAToBGRA8(&src[0], &dst[0], width, 0, y, toUint8xx, is);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    return seconds > 0. ? width * height / seconds / 1e6 : 0.;
+}
+
+} // anon namespace
+
+TEST(ImageKernels,HalveRowsBitExactByte) {
+    checkKernelsBitExact<unsigned char>(67);
+}
+
+TEST(ImageKernels,HalveRowsBitExactShort) {
+    checkKernelsBitExact<unsigned short>(67);
+}
+
+TEST(ImageKernels,HalveRowsBitExactFloat) {
+    checkKernelsBitExact<float>(67);
+}
+
+TEST(ImageKernels,HalveBitmapRowsBitExact) {
+    srand(2000);
+    for (int is = eInstructionSetSSE2; is <= getSupportedInstructionSet(); ++is) {
+        for (int w = 1; w <= 131; ++w) {
+            ///mostly rendered pixels, with some not rendered (0) and unavailable (2) ones
+            std::vector<char> row0(2 * w), row1(2 * w);
+            for (int i = 0; i < 2 * w; ++i) {
+                row0[i] = (rand() % 4 == 0) ? (char)(rand() % 3) : 1;
+                row1[i] = (rand() % 4 == 0) ? (char)(rand() % 3) : 1;
+            }
+            std::vector<char> expected(w), result(w);
+            halveBitmapRows(&row0[0], &row1[0], &expected[0], w, eInstructionSetScalar);
+            halveBitmapRows(&row0[0], &row1[0], &result[0], w, (InstructionSetEnum)is);
+            EXPECT_EQ( 0, std::memcmp(&expected[0], &result[0], w) ) << instructionSetName((InstructionSetEnum)is) << " width=" << w;
+        }
+    }
+}
+
+TEST(ImageKernels,HalveRowsBenchmark) {
+    for (int is = eInstructionSetScalar; is <= getSupportedInstructionSet(); ++is) {
+        std::cout << instructionSetName((InstructionSetEnum)is) << ": "
+                  << "byte RGBA " << benchmarkHalveRows<unsigned char>( (InstructionSetEnum)is, 4 ) << "s, "
+                  << "short RGBA " << benchmarkHalveRows<unsigned short>( (InstructionSetEnum)is, 4 ) << "s, "
+                  << "float RGBA " << benchmarkHalveRows<float>( (InstructionSetEnum)is, 4 ) << "s, "
+                  << "float RGB " << benchmarkHalveRows<float>( (InstructionSetEnum)is, 3 ) << "s, "
+                  << "float Alpha " << benchmarkHalveRows<float>( (InstructionSetEnum)is, 1 ) << "s" << std::endl;
+    }
+}
+
+TEST(ImageKernels,ConvertDepthBitExact) {
+    srand(2000);
+    ///values around the rounding thresholds of both depths, out of range values and NaN
+    std::vector<float> src;
+    for (int i = 0; i < 0x10000; ++i) {
+        float v = i / 65535.f;
+        src.push_back(v);
+        src.push_back( i / 255.f + 0.5f / 255.f );
+        src.push_back( i / 65535.f + 0.5f / 65535.f );
+    }
+    for (int i = 0; i < 1000; ++i) {
+        float v;
+        randomValue(&v);
+        src.push_back(v);
+        src.push_back(v * 1e6f);
+    }
+    src.push_back(0.f);
+    src.push_back(-0.f);
+    src.push_back(1.f);
+    src.push_back(std::numeric_limits<float>::quiet_NaN());
+    src.push_back( std::numeric_limits<float>::infinity() );
+    src.push_back( -std::numeric_limits<float>::infinity() );
+    int n = (int)src.size();
+
+    std::vector<unsigned char> bytes(n), expectedBytes(n);
+    std::vector<unsigned short> shorts(n), expectedShorts(n);
+    std::vector<float> floats(n), expectedFloats(n);
+    convertFloatToByte(&src[0], &expectedBytes[0], n, eInstructionSetScalar);
+    convertFloatToShort(&src[0], &expectedShorts[0], n, eInstructionSetScalar);
+    for (int is = eInstructionSetSSE2; is <= getSupportedInstructionSet(); ++is) {
+        // odd sizes to cover the tails
+        for (int tail = 0; tail < 17; ++tail) {
+            convertFloatToByte(&src[0], &bytes[0], n - tail, (InstructionSetEnum)is);
+            EXPECT_EQ( 0, std::memcmp(&expectedBytes[0], &bytes[0], n - tail) ) << instructionSetName((InstructionSetEnum)is);
+            convertFloatToShort(&src[0], &shorts[0], n - tail, (InstructionSetEnum)is);
+            EXPECT_EQ( 0, std::memcmp( &expectedShorts[0], &shorts[0], (n - tail) * sizeof(unsigned short) ) ) << instructionSetName((InstructionSetEnum)is);
+        }
+
+        convertByteToFloat(&expectedBytes[0], &expectedFloats[0], n, eInstructionSetScalar);
+        convertByteToFloat(&expectedBytes[0], &floats[0], n, (InstructionSetEnum)is);
+        EXPECT_EQ( 0, std::memcmp( &expectedFloats[0], &floats[0], n * sizeof(float) ) ) << instructionSetName((InstructionSetEnum)is);
+        convertShortToFloat(&expectedShorts[0], &expectedFloats[0], n, eInstructionSetScalar);
+        convertShortToFloat(&expectedShorts[0], &floats[0], n, (InstructionSetEnum)is);
+        EXPECT_EQ( 0, std::memcmp( &expectedFloats[0], &floats[0], n * sizeof(float) ) ) << instructionSetName((InstructionSetEnum)is);
+    }
+}
+
+TEST(ImageKernels,HistogramBinsBitExact) {
+    srand(2000);
+    ///values around the bin edges, on both bounds, out of range values and NaN
+    const int binsCount = 1280;
+    const float vmin = -0.25f;
+    const float vmax = 1.5f;
+    const float scale = binsCount / (vmax - vmin);
+    std::vector<float> src;
+    for (int i = 0; i <= binsCount; ++i) {
+        float edge = vmin + i / scale;
+        src.push_back(edge);
+        src.push_back( edge * (1.f + std::numeric_limits<float>::epsilon()) );
+        src.push_back( edge * (1.f - std::numeric_limits<float>::epsilon()) );
+    }
+    for (int i = 0; i < 1000; ++i) {
+        float v;
+        randomValue(&v);
+        src.push_back(v);
+    }
+    src.push_back(vmin);
+    src.push_back(vmax);
+    src.push_back(std::numeric_limits<float>::quiet_NaN());
+    src.push_back( std::numeric_limits<float>::infinity() );
+    src.push_back( -std::numeric_limits<float>::infinity() );
+    int n = (int)src.size();
+
+    std::vector<int> expected(n), result(n);
+    computeHistogramBins(&src[0], &expected[0], n, vmin, vmax, scale, binsCount, eInstructionSetScalar);
+    for (int i = 0; i < n; ++i) {
+        if ( (vmin <= src[i]) && (src[i] < vmax) ) {
+            EXPECT_TRUE(expected[i] >= 0 && expected[i] < binsCount);
+        } else {
+            EXPECT_EQ(-1, expected[i]);
+        }
+    }
+    for (int is = eInstructionSetSSE2; is <= getSupportedInstructionSet(); ++is) {
+        // odd sizes to cover the tails
+        for (int tail = 0; tail < 5; ++tail) {
+            computeHistogramBins(&src[0], &result[0], n - tail, vmin, vmax, scale, binsCount, (InstructionSetEnum)is);
+            EXPECT_EQ( 0, std::memcmp( &expected[0], &result[0], (n - tail) * sizeof(int) ) ) << instructionSetName((InstructionSetEnum)is);
+        }
+    }
+}
+
+TEST(ImageKernels,FindMinMaxExact) {
+    srand(2000);
+    const int maxWidth = 37;
+    std::vector<float> src(maxWidth * 4);
+    fillRandom(&src);
+    src[5] = std::numeric_limits<float>::quiet_NaN();
+    src[22] = std::numeric_limits<float>::quiet_NaN();
+    src[41] = std::numeric_limits<float>::infinity();
+    std::vector<float> nans( maxWidth * 4, std::numeric_limits<float>::quiet_NaN() );
+    const Natron::DisplayChannelsEnum allChannels[6] = {
+        Natron::eDisplayChannelsRGB, Natron::eDisplayChannelsR, Natron::eDisplayChannelsG,
+        Natron::eDisplayChannelsB, Natron::eDisplayChannelsA, Natron::eDisplayChannelsY
+    };
+    const int allComps[3] = { 1, 3, 4 };
+
+    for (int c = 0; c < 6; ++c) {
+        for (int k = 0; k < 3; ++k) {
+            const int nComps = allComps[k];
+            for (int w = 0; w <= maxWidth; ++w) {
+                ///straightforward reference, on the same float values
+                float refMin = std::numeric_limits<float>::infinity();
+                float refMax = -std::numeric_limits<float>::infinity();
+                for (int x = 0; x < w; ++x) {
+                    const float* p = &src[x * nComps];
+                    float r = nComps >= 3 ? p[0] : 0.f;
+                    float g = nComps >= 3 ? p[1] : 0.f;
+                    float b = nComps >= 3 ? p[2] : 0.f;
+                    float a = nComps == 4 ? p[3] : (nComps == 3 ? 1.f : p[0]);
+                    float values[3] = { r, g, b };
+                    int nValues = 1;
+                    switch (allChannels[c]) {
+                    case Natron::eDisplayChannelsRGB:
+                        nValues = 3;
+                        break;
+                    case Natron::eDisplayChannelsG:
+                        values[0] = g;
+                        break;
+                    case Natron::eDisplayChannelsB:
+                        values[0] = b;
+                        break;
+                    case Natron::eDisplayChannelsA:
+                        values[0] = a;
+                        break;
+                    case Natron::eDisplayChannelsY:
+                        values[0] = 0.299f * r + 0.587f * g + 0.114f * b;
+                        break;
+                    default:
+                        break;
+                    }
+                    for (int i = 0; i < nValues; ++i) {
+                        if (values[i] == values[i]) {
+                            refMin = std::min(refMin, values[i]);
+                            refMax = std::max(refMax, values[i]);
+                        }
+                    }
+                }
+                for (int is = eInstructionSetScalar; is <= getSupportedInstructionSet(); ++is) {
+                    float vmin = std::numeric_limits<float>::infinity();
+                    float vmax = -std::numeric_limits<float>::infinity();
+                    findMinMax(&src[0], w, nComps, allChannels[c], &vmin, &vmax, (InstructionSetEnum)is);
+                    EXPECT_TRUE(vmin == refMin && vmax == refMax) << instructionSetName((InstructionSetEnum)is) << " channels=" << c
+                                                                  << " comps=" << nComps << " width=" << w;
+
+                    ///NaNs never change the range
+                    float nanMin = 0.5f;
+                    float nanMax = 0.5f;
+                    findMinMax(&nans[0], w, nComps, Natron::eDisplayChannelsR, &nanMin, &nanMax, (InstructionSetEnum)is);
+                    EXPECT_TRUE( (nanMin == (nComps == 1 && w > 0 ? 0.f : 0.5f)) && (nanMax == 0.5f) ) << instructionSetName((InstructionSetEnum)is);
+                }
+            }
+        }
+    }
+}
+
+TEST(ImageKernels,ConvertRGBAToBGRA8BitExact) {
+    srand(2000);
+    const int maxWidth = 37;
+    std::vector<float> src(maxWidth * 4);
+    fillRandom(&src);
+    src[5] = std::numeric_limits<float>::quiet_NaN();
+    src[19] = std::numeric_limits<float>::quiet_NaN();
+    src[42] = std::numeric_limits<float>::infinity();
+    const Natron::Color::Lut* srgb = Natron::Color::LutManager::sRGBLut();
+    srgb->validate();
+    const unsigned short* tables[2] = { 0, srgb->getToUint8xxTable() };
+
+    for (int t = 0; t < 2; ++t) {
+        for (int w = 0; w <= maxWidth; ++w) {
+            for (int x = 0; x < 20; x += 7) {
+                std::vector<unsigned int> expected(maxWidth), result(maxWidth);
+                convertRGBAToBGRA8(&src[0], &expected[0], w, x, w, tables[t], eInstructionSetScalar);
+                for (int is = eInstructionSetSSE2; is <= getSupportedInstructionSet(); ++is) {
+                    convertRGBAToBGRA8(&src[0], &result[0], w, x, w, tables[t], (InstructionSetEnum)is);
+                    EXPECT_EQ( 0, std::memcmp( &expected[0], &result[0], w * sizeof(unsigned int) ) ) << instructionSetName((InstructionSetEnum)is)
+                                                                                                      << " lut=" << t << " width=" << w << " x=" << x;
+                }
+            }
+        }
+    }
+}
+
+TEST(ImageKernels,ConvertRGBAToBGRA8Dither) {
+    const Natron::Color::Lut* srgb = Natron::Color::LutManager::sRGBLut();
+    srgb->validate();
+    const int width = 256;
+
+    for (int is = eInstructionSetScalar; is <= getSupportedInstructionSet(); ++is) {
+        ///the linear values of the bytes of the color-space are never dithered to another byte
+        std::vector<float> src(width * 4);
+        for (int b = 0; b < width; ++b) {
+            src[b * 4] = src[b * 4 + 1] = src[b * 4 + 2] = srgb->fromColorSpaceUint8ToLinearFloatFast( (unsigned char)b );
+            src[b * 4 + 3] = 1.f;
+        }
+        std::vector<unsigned int> dst(width);
+        for (int y = 0; y < 16; ++y) {
+            convertRGBAToBGRA8(&src[0], &dst[0], width, y, y, srgb->getToUint8xxTable(), (InstructionSetEnum)is);
+            for (int b = 0; b < width; ++b) {
+                EXPECT_EQ(0xff000000 | (b << 16) | (b << 8) | b, dst[b]) << instructionSetName((InstructionSetEnum)is) << " byte=" << b;
+            }
+        }
+
+        ///the 16x16 block holds each threshold once: the sum of the dithered bytes of a value is its 8.8 fixed point value
+        float v = 0.5f * ( srgb->fromColorSpaceUint8ToLinearFloatFast(100) + srgb->fromColorSpaceUint8ToLinearFloatFast(101) );
+        std::vector<float> uniform(16 * 4, v);
+        int sum = 0;
+        for (int y = 0; y < 16; ++y) {
+            convertRGBAToBGRA8(&uniform[0], &dst[0], 16, 0, y, srgb->getToUint8xxTable(), (InstructionSetEnum)is);
+            for (int x = 0; x < 16; ++x) {
+                EXPECT_TRUE( (dst[x] & 0xff) == 100 || (dst[x] & 0xff) == 101 );
+                sum += dst[x] & 0xff;
+            }
+        }
+        EXPECT_EQ(srgb->toColorSpaceUint8xxFromLinearFloatFast(v), sum) << instructionSetName((InstructionSetEnum)is);
+    }
+}
+
+TEST(ImageKernels,ConvertRGBAToBGRA8Benchmark) {
+    const Natron::Color::Lut* srgb = Natron::Color::LutManager::sRGBLut();
+    srgb->validate();
+    for (int is = eInstructionSetScalar; is <= getSupportedInstructionSet(); ++is) {
+        std::cout << instructionSetName((InstructionSetEnum)is) << ": "
+                  << "linear " << benchmarkConvertRGBAToBGRA8( (InstructionSetEnum)is, 0 ) << " MPixels/s, "
+                  << "sRGB " << benchmarkConvertRGBAToBGRA8( (InstructionSetEnum)is, srgb->getToUint8xxTable() ) << " MPixels/s" << std::endl;
+    }
+}
+
+TEST(ImageKernels,AccumulateCoverage) {
+    const int n = 1027;
+    std::vector<float> deltas(n);
+    ///the deltas of a closed row sum to zero, with partial sums in [-2, 2]
+    for (int i = 0; i < n; ++i) {
+        deltas[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    std::vector<float> coverage(n);
+
+    for (int is = eInstructionSetScalar; is <= getSupportedInstructionSet(); ++is) {
+        for (int len = 0; len <= n; len += 1 + len / 3) {
+            accumulateCoverage(&deltas[0], &coverage[0], len, (InstructionSetEnum)is);
+            double sum = 0.;
+            for (int i = 0; i < len; ++i) {
+                sum += deltas[i];
+                double expected = std::min(1., std::fabs(sum));
+                EXPECT_NEAR(expected, coverage[i], 1e-4) << instructionSetName((InstructionSetEnum)is) << " len=" << len << " i=" << i;
+                EXPECT_LE(coverage[i], 1.f);
+            }
+        }
+    }
+}
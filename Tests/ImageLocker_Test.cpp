@@ -0,0 +1,109 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "Engine/ImageLocker.h"
+#include "Engine/RenderThreadPool.h"
+
+namespace {
+
+struct FakeEntry
+{
+    U64 hash;
+    int nRenders; //< only modified while the entry is locked
+    QAtomicInt nThreadsInside;
+
+    FakeEntry(U64 hash)
+    : hash(hash)
+    , nRenders(0)
+    , nThreadsInside()
+    {
+    }
+
+    U64 getHashKey() const
+    {
+        return hash;
+    }
+};
+
+typedef boost::shared_ptr<FakeEntry> FakeEntryPtr;
+
+void
+renderEntry(ImageLockRegistry<FakeEntry>* registry,
+            const std::vector<FakeEntryPtr>* entries,
+            int i)
+{
+    const FakeEntryPtr & entry = (*entries)[i % entries->size()];
+
+    registry->lock(entry);
+    EXPECT_EQ( 0, entry->nThreadsInside.fetchAndAddOrdered(1) );
+    for (int k = 0; k < 1000; ++k) {
+        ++entry->nRenders;
+    }
+    EXPECT_EQ( 1, entry->nThreadsInside.fetchAndAddOrdered(-1) );
+    registry->unlock(entry);
+}
+
+} // anon namespace
+
+TEST(ImageLockRegistry,TryLock) {
+    ImageLockRegistry<FakeEntry> registry;
+    FakeEntryPtr a( new FakeEntry(1) );
+    ///same hash, different entry
+    FakeEntryPtr b( new FakeEntry(1) );
+
+    EXPECT_TRUE( registry.tryLock(a) );
+    EXPECT_FALSE( registry.tryLock(a) );
+    EXPECT_TRUE( registry.tryLock(b) );
+    ///a failed tryLock does not wait
+    EXPECT_EQ( 0, (int)registry.getContentionCount() );
+
+    std::list<FakeEntryPtr> locked;
+    registry.getLockedEntries(&locked);
+    EXPECT_EQ( 2, (int)locked.size() );
+
+    registry.unlock(a);
+    EXPECT_TRUE( registry.tryLock(a) );
+    registry.unlock(a);
+    registry.unlock(b);
+    locked.clear();
+    registry.getLockedEntries(&locked);
+    EXPECT_TRUE( locked.empty() );
+}
+
+TEST(ImageLockRegistry,MutualExclusion) {
+    ImageLockRegistry<FakeEntry> registry;
+    Natron::RenderThreadPool pool(8);
+    std::vector<FakeEntryPtr> entries;
+
+    for (int i = 0; i < 3; ++i) {
+        entries.push_back( FakeEntryPtr( new FakeEntry(i * 7919) ) );
+    }
+    const int nRenders = 300;
+    EXPECT_TRUE( pool.parallelFor( nRenders, boost::bind(renderEntry, &registry, &entries, _1) ) );
+
+    int total = 0;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        total += entries[i]->nRenders;
+    }
+    EXPECT_EQ(nRenders * 1000, total);
+    std::list<FakeEntryPtr> locked;
+    registry.getLockedEntries(&locked);
+    EXPECT_TRUE( locked.empty() );
+}
@@ -14,9 +14,63 @@
 #include <Python.h>
 
 #include <cstring>
+#include <cstdlib>
+#include <vector>
 #include <gtest/gtest.h>
 #include "Engine/Image.h"
 
+namespace {
+
+///Returns true if one of the pixels of rect in the bitmap has the given value
+bool
+containsValue(const Natron::Bitmap & bm,
+              const RectI & rect,
+              char value)
+{
+    for (int y = rect.y1; y < rect.y2; ++y) {
+        for (int x = rect.x1; x < rect.x2; ++x) {
+            if (bm.getValueAt(x, y) == value) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+RectI
+randomRect(const RectI & bounds)
+{
+    int x1 = bounds.x1 + rand() % bounds.width();
+    int y1 = bounds.y1 + rand() % bounds.height();
+    int x2 = x1 + 1 + rand() % (bounds.x2 - x1);
+    int y2 = y1 + 1 + rand() % (bounds.y2 - y1);
+
+    return RectI(x1,y1,x2,y2);
+}
+
+///Bounding box of the pixels which are not marked in roi, computed pixel by pixel
+RectI
+nonMarkedBboxReference(const Natron::Bitmap & bm,
+                       const RectI & roi)
+{
+    RectI bbox;
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        for (int x = roi.x1; x < roi.x2; ++x) {
+            if (bm.getValueAt(x, y) == 0) {
+                if ( bbox.isNull() ) {
+                    bbox = RectI(x,y,x + 1,y + 1);
+                } else {
+                    bbox.merge(x,y,x + 1,y + 1);
+                }
+            }
+        }
+    }
+
+    return bbox;
+}
+
+} // anon namespace
 
 TEST(BitmapTest,SimpleRect) {
     RectI rod(0,0,100,100);
@@ -34,8 +88,7 @@ TEST(BitmapTest,SimpleRect) {
     ASSERT_TRUE(rod == nonRenderedRectsUnion);
 
     ///assert that the "underlying" bitmap is clean
-    const char* map = bm.getBitmap();
-    ASSERT_TRUE( !memchr( map,1,rod.area() ) );
+    ASSERT_TRUE( !containsValue(bm,rod,1) );
 
     RectI halfRoD(0,0,100,50);
     bm.markForRendered(halfRoD);
@@ -49,14 +102,12 @@ TEST(BitmapTest,SimpleRect) {
 
 
     ///assert that the underlying bitmap is marked as expected
-    const char* start = map;
 
     ///check that there are only ones in the rendered half
-    ASSERT_TRUE( !memchr( start,0,halfRoD.area() ) );
+    ASSERT_TRUE( !containsValue(bm,halfRoD,0) );
 
     ///check that there are only 0s in the non rendered half
-    start = map + halfRoD.area();
-    ASSERT_TRUE( !memchr( start,1,halfRoD.area() ) );
+    ASSERT_TRUE( !containsValue(bm,nonRenderedHalf,1) );
 
     ///mark for renderer the other half of the rod
     bm.markForRendered(nonRenderedHalf);
@@ -65,7 +116,93 @@ TEST(BitmapTest,SimpleRect) {
     nonRenderedRects.clear();
     bm.minimalNonMarkedRects(rod, nonRenderedRects);
     ASSERT_TRUE( nonRenderedRects.empty() );
-    ASSERT_TRUE( !memchr( map,0,rod.area() ) );
+    ASSERT_TRUE( !containsValue(bm,rod,0) );
+}
+
+TEST(BitmapTest,Tiles) {
+    srand(2000);
+    ///bounds that are not a multiple of the tile size and do not start at 0
+    RectI bounds(-70,-30,3 * NATRON_BITMAP_TILE_SIZE + 45,2 * NATRON_BITMAP_TILE_SIZE + 17);
+    Natron::Bitmap bm(bounds);
+
+    EXPECT_EQ( Natron::Bitmap::eTileStateNotRendered, bm.getTileStateAt(bounds.x1, bounds.y1) );
+    bm.markForRendered( RectI(bounds.x1,bounds.y1,bounds.x1 + NATRON_BITMAP_TILE_SIZE,bounds.y1 + NATRON_BITMAP_TILE_SIZE) );
+    EXPECT_EQ( Natron::Bitmap::eTileStateRendered, bm.getTileStateAt(bounds.x1, bounds.y1) );
+    EXPECT_EQ( Natron::Bitmap::eTileStateNotRendered, bm.getTileStateAt(bounds.x1 + NATRON_BITMAP_TILE_SIZE, bounds.y1) );
+    bm.clear( RectI(bounds.x1,bounds.y1,bounds.x1 + 1,bounds.y1 + 1) );
+    EXPECT_EQ( Natron::Bitmap::eTileStateMixed, bm.getTileStateAt(bounds.x1, bounds.y1) );
+    bm.markForRendered( RectI(bounds.x1,bounds.y1,bounds.x1 + 1,bounds.y1 + 1) );
+    EXPECT_EQ( Natron::Bitmap::eTileStateRendered, bm.getTileStateAt(bounds.x1, bounds.y1) );
+
+    ///the tile-based searches must find the same regions as a pixel by pixel search
+    for (int iteration = 0; iteration < 200; ++iteration) {
+        if (rand() % 3) {
+            bm.markForRendered( randomRect(bounds) );
+        } else {
+            bm.clear( randomRect(bounds) );
+        }
+        RectI roi = randomRect(bounds);
+        RectI bbox = bm.minimalNonMarkedBbox(roi);
+        RectI expected = nonMarkedBboxReference(bm, roi);
+        if ( expected.isNull() ) {
+            ASSERT_TRUE( bbox.isNull() );
+        } else {
+            ASSERT_TRUE(bbox == expected);
+        }
+
+        ///the rectangles must cover all the non marked pixels and stay within the bbox
+        std::list<RectI> rects;
+        bm.minimalNonMarkedRects(roi, rects);
+        for (int y = roi.y1; y < roi.y2; ++y) {
+            for (int x = roi.x1; x < roi.x2; ++x) {
+                if (bm.getValueAt(x, y) != 0) {
+                    continue;
+                }
+                bool covered = false;
+                for (std::list<RectI>::iterator it = rects.begin(); it != rects.end() && !covered; ++it) {
+                    covered = it->contains(x, y);
+                }
+                ASSERT_TRUE(covered);
+            }
+        }
+        for (std::list<RectI>::iterator it = rects.begin(); it != rects.end(); ++it) {
+            ASSERT_TRUE( !it->isNull() && expected.contains(*it) );
+        }
+    }
+}
+
+TEST(BitmapTest,CopyPortion) {
+    srand(2000);
+    ///the bounds of the two bitmaps are not aligned the same way on the packed words
+    RectI srcBounds(0,0,200,10);
+    RectI dstBounds(-13,-2,190,12);
+    Natron::Bitmap src(srcBounds);
+    Natron::Bitmap dst(dstBounds);
+
+    std::vector<char> row( srcBounds.width() );
+    for (int y = srcBounds.y1; y < srcBounds.y2; ++y) {
+        for (std::size_t i = 0; i < row.size(); ++i) {
+            row[i] = (char)(rand() % 3);
+        }
+        src.packRow(srcBounds.x1, srcBounds.x2, y, &row[0]);
+        std::vector<char> unpacked( row.size() );
+        src.unpackRow(srcBounds.x1, srcBounds.x2, y, &unpacked[0]);
+        ASSERT_TRUE(unpacked == row);
+    }
+    src.updateTiles(srcBounds);
+
+    dst.markForRendered(dstBounds);
+    RectI roi(3,1,187,9);
+    dst.copyBitmapPortion(roi, src);
+    for (int y = dstBounds.y1; y < dstBounds.y2; ++y) {
+        for (int x = dstBounds.x1; x < dstBounds.x2; ++x) {
+            ///pixels being rendered in the source are copied as not rendered
+            char expected = roi.contains(x, y) ? (src.getValueAt(x, y) == 1 ? 1 : 0) : 1;
+            ASSERT_EQ( expected, dst.getValueAt(x, y) );
+        }
+    }
+    EXPECT_EQ( Natron::Bitmap::eTileStateMixed, dst.getTileStateAt(roi.x1, roi.y1) );
+    EXPECT_TRUE(dst.minimalNonMarkedBbox(roi) == nonMarkedBboxReference(dst, roi));
 }
 
 TEST(ImageKeyTest,Equality) {
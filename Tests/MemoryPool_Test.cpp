@@ -0,0 +1,138 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <cstddef>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "Engine/MemoryPool.h"
+
+using namespace Natron;
+
+namespace {
+
+bool
+isAligned(const void* ptr)
+{
+    return ( (std::size_t)ptr & (NATRON_MEMORY_POOL_ALIGNMENT - 1) ) == 0;
+}
+
+} // anon namespace
+
+TEST(MemoryPool,SizeClassBoundaries) {
+    ///Small blocks are rounded to the alignment
+    EXPECT_EQ( 0, (int)MemoryPool::getSizeClass(0) );
+    EXPECT_EQ( 64, (int)MemoryPool::getSizeClass(1) );
+    EXPECT_EQ( 64, (int)MemoryPool::getSizeClass(64) );
+    EXPECT_EQ( 128, (int)MemoryPool::getSizeClass(65) );
+    EXPECT_EQ( 4096, (int)MemoryPool::getSizeClass(4096) );
+
+    ///Then to the next quarter of the power of 2 below
+    EXPECT_EQ( 5120, (int)MemoryPool::getSizeClass(4097) );
+    EXPECT_EQ( 5120, (int)MemoryPool::getSizeClass(5120) );
+    EXPECT_EQ( 6144, (int)MemoryPool::getSizeClass(5121) );
+    EXPECT_EQ( 8192, (int)MemoryPool::getSizeClass(8192) );
+    EXPECT_EQ( 10240, (int)MemoryPool::getSizeClass(8193) );
+
+    for (std::size_t n = 1; n < (1 << 22); n = n * 3 / 2 + 1) {
+        std::size_t sizeClass = MemoryPool::getSizeClass(n);
+        EXPECT_LE(n, sizeClass);
+        EXPECT_EQ( 0, (int)( sizeClass % NATRON_MEMORY_POOL_ALIGNMENT ) );
+        ///At most 25% of a large block is unused
+        if (n > 4096) {
+            EXPECT_LE(sizeClass * 4, n * 5);
+        }
+        ///Rounding is idempotent so that release() finds the class of allocate()
+        EXPECT_EQ( sizeClass, MemoryPool::getSizeClass(sizeClass) );
+    }
+}
+
+TEST(MemoryPool,RecyclesReleasedBlocks) {
+    MemoryPool::clear();
+    MemoryPool::setMaximumPooledSize(NATRON_MEMORY_POOL_DEFAULT_MAX_POOLED_SIZE);
+
+    EXPECT_TRUE( MemoryPool::allocate(0) == 0 );
+
+    MemoryPoolStats before;
+    MemoryPool::getStats(&before);
+
+    void* a = MemoryPool::allocate(100000);
+    ASSERT_TRUE(a != 0);
+    EXPECT_TRUE( isAligned(a) );
+    MemoryPool::release(a, 100000);
+
+    MemoryPoolStats stats;
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( MemoryPool::getSizeClass(100000), stats.bytesPooled );
+
+    ///Another size of the same class gets the same block back
+    void* b = MemoryPool::allocate(100001);
+    EXPECT_EQ(a, b);
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( before.nRecycledAllocations + 1, stats.nRecycledAllocations );
+    EXPECT_EQ( 0, (int)stats.bytesPooled );
+    EXPECT_EQ( before.bytesInUse + MemoryPool::getSizeClass(100001), stats.bytesInUse );
+
+    ///A different class does not
+    void* c = MemoryPool::allocate(200000);
+    ASSERT_TRUE(c != 0);
+    EXPECT_TRUE( isAligned(c) );
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( before.nRecycledAllocations + 1, stats.nRecycledAllocations );
+
+    MemoryPool::release(b, 100001);
+    MemoryPool::release(c, 200000);
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( before.bytesInUse, stats.bytesInUse );
+    EXPECT_EQ( before.nReleases + 3, stats.nReleases );
+
+    MemoryPool::clear();
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( 0, (int)stats.bytesPooled );
+}
+
+TEST(MemoryPool,MaxPooledBytesCap) {
+    MemoryPool::clear();
+    MemoryPool::setMaximumPooledSize(2 * 8192);
+
+    MemoryPoolStats before;
+    MemoryPool::getStats(&before);
+
+    std::vector<void*> blocks;
+    for (int i = 0; i < 3; ++i) {
+        blocks.push_back( MemoryPool::allocate(8192) );
+        ASSERT_TRUE(blocks.back() != 0);
+    }
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        MemoryPool::release(blocks[i], 8192);
+    }
+
+    ///The third block did not fit in the pool and went back to the system
+    MemoryPoolStats stats;
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( 2 * 8192, (int)stats.bytesPooled );
+    EXPECT_EQ( before.nSystemFrees + 1, stats.nSystemFrees );
+
+    ///Lowering the cap frees the blocks in excess right away
+    MemoryPool::setMaximumPooledSize(8192);
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( 8192, (int)stats.bytesPooled );
+    EXPECT_EQ( before.nSystemFrees + 2, stats.nSystemFrees );
+
+    MemoryPool::setMaximumPooledSize(0);
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( 0, (int)stats.bytesPooled );
+    void* a = MemoryPool::allocate(8192);
+    MemoryPool::release(a, 8192);
+    MemoryPool::getStats(&stats);
+    EXPECT_EQ( 0, (int)stats.bytesPooled );
+
+    MemoryPool::setMaximumPooledSize(NATRON_MEMORY_POOL_DEFAULT_MAX_POOLED_SIZE);
+}
@@ -0,0 +1,428 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <iostream>
+#include <gtest/gtest.h>
+#include "Engine/NativeExpression.h"
+
+using namespace Natron;
+
+namespace {
+
+///The time returned by getValue(), standing for the current time of the parameters
+int currentFrame = 0;
+
+///A parameter whose value is a simple function of the time and dimension. The same parameters are declared in Python below.
+class FakeParam : public NativeExpressionParam
+{
+public:
+
+    FakeParam(int dimension,ExpressionValue::TypeEnum type,bool isColor)
+    : _dimension(dimension)
+    , _type(type)
+    , _isColor(isColor)
+    {
+    }
+
+    virtual int getDimension() const { return _dimension; }
+
+    virtual bool isColor() const { return _isColor; }
+
+    virtual ExpressionValue::TypeEnum getType() const { return _type; }
+
+    virtual bool getValue(int dimension,double* value) const
+    {
+        return getValueAtTime(currentFrame, dimension, value);
+    }
+
+    virtual bool getValueAtTime(int time,int dimension,double* value) const
+    {
+        switch (_type) {
+        case ExpressionValue::eTypeFloat:
+            *value = time * 0.5 + dimension + 0.25;
+            break;
+        case ExpressionValue::eTypeInt:
+            *value = time * 3 - dimension;
+            break;
+        case ExpressionValue::eTypeBool:
+            *value = (time % 2 == 0) ? 1. : 0.;
+            break;
+        }
+        return true;
+    }
+
+private:
+
+    int _dimension;
+    ExpressionValue::TypeEnum _type;
+    bool _isColor;
+};
+
+const char* pythonPrelude =
+    "import math\n"
+    "class _Tuple(object):\n"
+    "    pass\n"
+    "class _Param(object):\n"
+    "    def __init__(self, dims, kind, color=False):\n"
+    "        self.dims = dims\n"
+    "        self.kind = kind\n"
+    "        self.color = color\n"
+    "    def _value(self, t, d):\n"
+    "        if not isinstance(t, int) or not isinstance(d, int):\n"
+    "            raise TypeError('wrong argument types')\n"
+    "        if d < 0 or d >= self.dims:\n"
+    "            raise IndexError('dimension out of range')\n"
+    "        if self.kind == 'float':\n"
+    "            return t * 0.5 + d + 0.25\n"
+    "        elif self.kind == 'int':\n"
+    "            return t * 3 - d\n"
+    "        return t % 2 == 0\n"
+    "    def get(self, t=None):\n"
+    "        if t is None:\n"
+    "            t = _currentFrame\n"
+    "        if self.dims == 1:\n"
+    "            return self._value(t, 0)\n"
+    "        ret = _Tuple()\n"
+    "        names = ['r', 'g', 'b', 'a'] if self.color else ['x', 'y', 'z']\n"
+    "        for d in range(self.dims):\n"
+    "            setattr(ret, names[d], self._value(t, d))\n"
+    "        if self.color and self.dims == 3:\n"
+    "            ret.a = 1.\n"
+    "        return ret\n"
+    "    def getValue(self, d=0):\n"
+    "        return self._value(_currentFrame, d)\n"
+    "    def getValueAtTime(self, t, d=0):\n"
+    "        return self._value(t, d)\n"
+    "class _Node(object):\n"
+    "    pass\n"
+    "thisNode = _Node()\n"
+    "thisNode.translate = _Param(2, 'float')\n"
+    "Blur1 = _Node()\n"
+    "Blur1.size = _Param(1, 'float')\n"
+    "Blur1.count = _Param(1, 'int')\n"
+    "Blur1.enabled = _Param(1, 'bool')\n"
+    "Blur1.color = _Param(3, 'float', True)\n";
+
+class FakeResolver : public NativeExpressionResolver
+{
+public:
+
+    virtual boost::shared_ptr<NativeExpressionParam> resolveParam(const std::string& nodeName,const std::string& paramName) const
+    {
+        boost::shared_ptr<NativeExpressionParam> ret;
+        if (nodeName == "thisNode" && paramName == "translate") {
+            ret.reset( new FakeParam(2, ExpressionValue::eTypeFloat, false) );
+        } else if (nodeName == "Blur1") {
+            if (paramName == "size") {
+                ret.reset( new FakeParam(1, ExpressionValue::eTypeFloat, false) );
+            } else if (paramName == "count") {
+                ret.reset( new FakeParam(1, ExpressionValue::eTypeInt, false) );
+            } else if (paramName == "enabled") {
+                ret.reset( new FakeParam(1, ExpressionValue::eTypeBool, false) );
+            } else if (paramName == "color") {
+                ret.reset( new FakeParam(3, ExpressionValue::eTypeFloat, true) );
+            }
+        }
+        return ret;
+    }
+
+    virtual bool isNameInScope(const std::string& name) const
+    {
+        return name == "thisNode" || name == "Blur1" || name == "max";
+    }
+};
+
+class NativeExpressionTest : public ::testing::Test
+{
+protected:
+
+    static void SetUpTestCase()
+    {
+        if ( !Py_IsInitialized() ) {
+            Py_Initialize();
+        }
+        globals = PyDict_New();
+        PyDict_SetItemString( globals, "__builtins__", PyEval_GetBuiltins() );
+        PyObject* ret = PyRun_String(pythonPrelude, Py_file_input, globals, globals);
+        ASSERT_TRUE(ret != NULL);
+        Py_DECREF(ret);
+    }
+
+    static void TearDownTestCase()
+    {
+        Py_XDECREF(globals);
+        globals = 0;
+    }
+
+    static void setPythonVariables(int frame,int dimension)
+    {
+        PyObject* f = PyLong_FromLong(frame);
+        PyObject* d = PyLong_FromLong(dimension);
+        PyDict_SetItemString(globals, "frame", f);
+        PyDict_SetItemString(globals, "_currentFrame", f);
+        PyDict_SetItemString(globals, "dimension", d);
+        Py_DECREF(f);
+        Py_DECREF(d);
+    }
+
+    ///Returns false if Python raised an exception
+    static bool evaluatePython(PyObject* code,ExpressionValue* result)
+    {
+        PyObject* ret = PyEval_EvalCode(code, globals, globals);
+        if (!ret) {
+            PyErr_Clear();
+            return false;
+        }
+        if ( PyBool_Check(ret) ) {
+            *result = ExpressionValue(ret == Py_True ? 1. : 0., ExpressionValue::eTypeBool);
+        } else if ( PyLong_Check(ret) ) {
+            *result = ExpressionValue(PyLong_AsDouble(ret), ExpressionValue::eTypeInt);
+        } else if ( PyComplex_Check(ret) ) {
+            *result = ExpressionValue(PyComplex_RealAsDouble(ret), ExpressionValue::eTypeFloat);
+        } else {
+            *result = ExpressionValue(PyFloat_AsDouble(ret), ExpressionValue::eTypeFloat);
+        }
+        Py_DECREF(ret);
+        return true;
+    }
+
+    static PyObject* globals;
+};
+
+PyObject* NativeExpressionTest::globals = 0;
+
+struct ExpressionCase
+{
+    const char* expression;
+    bool beyondNativeRange; //< Python computes it but the native evaluation must fall back
+};
+
+const ExpressionCase expressionCases[] = {
+    { "1 + 2 * 3", false },
+    { "7 / 2", false },
+    { "7 // 2", false },
+    { "-7 // 2", false },
+    { "7 % -3", false },
+    { "-7.5 % 2", false },
+    { "7.5 // -2", false },
+    { "2 ** 10", false },
+    { "2 ** -1", false },
+    { "-2 ** 2", false },
+    { "2 ** -2 ** 2", false },
+    { "(-8) ** (1.0 / 3)", true }, //< complex result
+    { "0 ** -1", false },
+    { "1 / 0", false },
+    { "1.0 // 0", false },
+    { "5 % 0", false },
+    { "2 ** 60", true },
+    { "1e308 * 10", false },
+    { "1.5e3 + .5 - 1.", false },
+    { "0.1 + 0.2", false },
+    { "frame * 1.1", false },
+    { "frame * 0.5 + dimension", false },
+    { "frame / 3", false },
+    { "frame // 3 + frame % 3", false },
+    { "3 * (2 + frame) ** 2 - 1", false },
+    { "abs(-frame)", false },
+    { "abs(-2.5)", false },
+    { "abs(True)", false },
+    { "min(frame, 3, 2.5)", false },
+    { "int(-2.7)", false },
+    { "int(True)", false },
+    { "float(frame)", false },
+    { "round(2.5)", false },
+    { "round(3.5)", false },
+    { "round(-0.5)", false },
+    { "round(frame / 2)", false },
+    { "pow(2, 0.5)", false },
+    { "pow(frame, 2)", false },
+    { "math.sqrt(2)", false },
+    { "math.sqrt(-1)", false },
+    { "math.log(100, 10)", false },
+    { "math.log(8, 2)", false },
+    { "math.log(0)", false },
+    { "math.log(5, 1)", false },
+    { "math.log10(1000)", false },
+    { "math.exp(1000)", false },
+    { "math.exp(-1000)", false },
+    { "math.floor(-2.5)", false },
+    { "math.ceil(2.1)", false },
+    { "math.trunc(-2.7)", false },
+    { "math.fmod(-7, 3)", false },
+    { "math.fmod(1, 0)", false },
+    { "math.hypot(3, 4)", false },
+    { "math.degrees(math.pi)", false },
+    { "math.radians(180)", false },
+    { "math.atan2(1, -1)", false },
+    { "math.asin(2)", false },
+    { "math.pow(0, -1)", false },
+    { "math.sin(frame * 0.1) * 10", false },
+    { "math.cos(frame) + math.tan(0.5) + math.atan(frame)", false },
+    { "math.sinh(1) + math.cosh(1) + math.tanh(frame)", false },
+    { "math.fabs(-frame)", false },
+    { "math.e ** 2", false },
+    { "1 if frame > 3 else 2", false },
+    { "frame if frame % 2 == 0 else -frame", false },
+    { "10 if 0 else 20 if frame else 30", false },
+    { "(1 if frame else 2.5) * 2", false },
+    { "frame > 2 and frame < 6", false },
+    { "frame and 5", false },
+    { "0 or frame", false },
+    { "0 or 0.0", false },
+    { "not frame", false },
+    { "not frame == 1", false },
+    { "frame != 7 and 1.5 or 2", false },
+    { "True + True", false },
+    { "-True", false },
+    { "+False", false },
+    { "frame <= 1", false },
+    { "frame >= 1.5", false },
+    { "Blur1.size.get()", false },
+    { "Blur1.size.get(frame + 1)", false },
+    { "Blur1.size.get(0.5)", false },
+    { "Blur1.size.getValue()", false },
+    { "Blur1.size.getValue(0)", false },
+    { "Blur1.size.getValue(1)", false },
+    { "Blur1.size.getValue(dimension - 1)", false },
+    { "Blur1.size.getValueAtTime(frame - 2)", false },
+    { "Blur1.size.getValueAtTime(0.5)", false },
+    { "Blur1.count.get() * 2", false },
+    { "Blur1.count.get() / 2", false },
+    { "Blur1.enabled.get() + 1", false },
+    { "1 if Blur1.enabled.get() else Blur1.count.get(3)", false },
+    { "thisNode.translate.get().x + thisNode.translate.get().y", false },
+    { "thisNode.translate.get(frame * 2).y", false },
+    { "thisNode.translate.getValue(dimension)", false },
+    { "thisNode.translate.getValueAtTime(frame, dimension)", false },
+    { "thisNode.translate.getValueAtTime(frame, 2)", false },
+    { "Blur1.color.get().a", false },
+    { "Blur1.color.get().g * 2", false },
+    { "Blur1.color.get(4).b", false },
+};
+
+} // anon namespace
+
+TEST_F(NativeExpressionTest,MatchesPython) {
+    FakeResolver resolver;
+    const int frames[] = { 0, 1, 4, 7, -3 };
+    for (std::size_t i = 0; i < sizeof(expressionCases) / sizeof(expressionCases[0]); ++i) {
+        const ExpressionCase& c = expressionCases[i];
+        std::string error;
+        boost::shared_ptr<NativeExpression> expr = NativeExpression::compile(c.expression, &resolver, &error);
+        ASSERT_TRUE(expr) << c.expression << ": " << error;
+
+        PyObject* code = Py_CompileString(c.expression, "<expression>", Py_eval_input);
+        ASSERT_TRUE(code != NULL) << c.expression;
+
+        for (std::size_t f = 0; f < sizeof(frames) / sizeof(frames[0]); ++f) {
+            const int dimension = 1;
+            currentFrame = frames[f];
+            setPythonVariables(frames[f], dimension);
+
+            ExpressionValue pyRet,nativeRet;
+            bool pyOk = evaluatePython(code, &pyRet);
+            bool nativeOk = expr->evaluate(frames[f], dimension, &nativeRet);
+            EXPECT_EQ(pyOk && !c.beyondNativeRange, nativeOk) << c.expression << " at frame " << frames[f];
+            if (pyOk && nativeOk) {
+                EXPECT_EQ(pyRet.type, nativeRet.type) << c.expression << " at frame " << frames[f];
+                if ( pyRet.value != pyRet.value ) {
+                    EXPECT_NE(nativeRet.value, nativeRet.value) << c.expression << " at frame " << frames[f];
+                } else {
+                    EXPECT_EQ(pyRet.value, nativeRet.value) << c.expression << " at frame " << frames[f];
+                    EXPECT_EQ( std::signbit(pyRet.value), std::signbit(nativeRet.value) ) << c.expression << " at frame " << frames[f];
+                }
+            }
+        }
+        Py_DECREF(code);
+    }
+}
+
+TEST_F(NativeExpressionTest,UnsupportedExpressionsFallBack) {
+    FakeResolver resolver;
+    const char* unsupported[] = {
+        "thisParam.get()",
+        "thisNode.unknown.get()",
+        "Blur2.size.get()",
+        "thisNode.translate.get()",
+        "thisNode.translate.get().w",
+        "Blur1.size.get().x",
+        "Blur1.size.set(1)",
+        "Blur1.size.getValue(0, 1)",
+        "1 < frame < 3",
+        "'a'",
+        "[1, 2][0]",
+        "frame.real",
+        "max(1, 2)", //< max is redefined in the scope by the resolver
+        "min(1)",
+        "math.gamma(1)",
+        "0x10",
+        "012",
+        "1j",
+        "frame if frame",
+        "1 +",
+        "(1",
+        "1 | 2",
+        "lambda: 1",
+        "frame\nframe",
+        "",
+        0
+    };
+    for (int i = 0; unsupported[i]; ++i) {
+        std::string error;
+        boost::shared_ptr<NativeExpression> expr = NativeExpression::compile(unsupported[i], &resolver, &error);
+        EXPECT_FALSE(expr) << unsupported[i];
+        EXPECT_FALSE( error.empty() ) << unsupported[i];
+    }
+}
+
+TEST_F(NativeExpressionTest,Benchmark) {
+    FakeResolver resolver;
+    const char* expressions[] = {
+        "frame * 2 + 1",
+        "math.sin(frame * 0.1) * Blur1.size.get() + (10 if frame > 5 else 20)",
+        "thisNode.translate.getValueAtTime(frame - 1, dimension) * 0.5 + abs(Blur1.count.get() - 3)",
+        0
+    };
+    const int iterations = 100000;
+    for (int i = 0; expressions[i]; ++i) {
+        std::string error;
+        boost::shared_ptr<NativeExpression> expr = NativeExpression::compile(expressions[i], &resolver, &error);
+        ASSERT_TRUE(expr) << expressions[i] << ": " << error;
+        PyObject* code = Py_CompileString(expressions[i], "<expression>", Py_eval_input);
+        ASSERT_TRUE(code != NULL);
+
+        double nativeSum = 0.,pySum = 0.;
+        clock_t start = clock();
+        for (int it = 0; it < iterations; ++it) {
+            ExpressionValue ret;
+            currentFrame = it % 100;
+            ASSERT_TRUE( expr->evaluate(currentFrame, 0, &ret) );
+            nativeSum += ret.value;
+        }
+        double nativeSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        start = clock();
+        for (int it = 0; it < iterations; ++it) {
+            ExpressionValue ret;
+            setPythonVariables(it % 100, 0);
+            ASSERT_TRUE( evaluatePython(code, &ret) );
+            pySum += ret.value;
+        }
+        double pySeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        Py_DECREF(code);
+
+        EXPECT_EQ(pySum, nativeSum);
+        std::cout << expressions[i] << ": native " << nativeSeconds * 1e9 / iterations << " ns, Python "
+                  << pySeconds * 1e9 / iterations << " ns per evaluation" << std::endl;
+    }
+}
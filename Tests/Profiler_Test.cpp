@@ -0,0 +1,96 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <gtest/gtest.h>
+
+#include <QtCore/QDir>
+
+#include "Engine/Profiler.h"
+#include "Engine/RenderThreadPool.h"
+#include "Engine/StandardPaths.h"
+
+using namespace Natron;
+
+namespace {
+
+void
+addRenderEvent(int i)
+{
+    std::stringstream ss;
+    ss << "Node" << (i % 3);
+    U64 start = Profiler::getTimestamp();
+    Profiler::addEvent(ss.str(), kProfilerActionRender, start, start + i);
+}
+
+int
+countOccurrences(const std::string & str,
+                 const std::string & pattern)
+{
+    int count = 0;
+
+    for (std::size_t pos = str.find(pattern); pos != std::string::npos; pos = str.find(pattern, pos + 1)) {
+        ++count;
+    }
+
+    return count;
+}
+
+} // anon namespace
+
+TEST(Profiler,DisabledScopeRecordsNothing) {
+    Profiler::setEnabled(false);
+    Profiler::clear();
+    {
+        ///the effect is never accessed when the profiler is disabled
+        ProfilerScope profile(0, kProfilerActionGetRoD);
+    }
+    EXPECT_EQ( 0, (int)Profiler::getEventsCount() );
+}
+
+TEST(Profiler,ChromeTrace) {
+    Profiler::setEnabled(true);
+    Profiler::clear();
+
+    RenderThreadPool pool(4);
+    EXPECT_TRUE( pool.parallelFor(100, addRenderEvent) );
+    Profiler::addEvent("Quote\"Node", kProfilerActionCacheHit, 10, 5);
+    Profiler::setEnabled(false);
+    EXPECT_EQ( 101, (int)Profiler::getEventsCount() );
+
+    QString tempPath = Natron::StandardPaths::writableLocation(Natron::StandardPaths::eStandardLocationTemp);
+    QDir dir(tempPath);
+    dir.mkpath(".");
+    std::string filename = dir.absoluteFilePath("NatronProfilerUnitTest.json").toStdString();
+    std::string error;
+    ASSERT_TRUE( Profiler::writeChromeTrace(filename, &error) ) << error;
+
+    std::ifstream ifile( filename.c_str() );
+    std::stringstream contents;
+    contents << ifile.rdbuf();
+    std::string trace = contents.str();
+    dir.remove("NatronProfilerUnitTest.json");
+
+    EXPECT_EQ( 0, (int)trace.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[") );
+    EXPECT_EQ( 101, countOccurrences(trace, "\"ph\":\"X\"") );
+    EXPECT_EQ( 100, countOccurrences(trace, "\"cat\":\"render\"") );
+    EXPECT_EQ( 34, countOccurrences(trace, "\"name\":\"Node0 render\"") );
+    ///names are escaped and negative durations are clamped
+    EXPECT_NE( std::string::npos, trace.find("\"name\":\"Quote\\\"Node cacheHit\"") );
+    EXPECT_NE( std::string::npos, trace.find("\"ts\":10,\"dur\":0") );
+    ///one thread_name metadata event per thread that recorded events
+    EXPECT_GE( countOccurrences(trace, "\"ph\":\"M\""), 1 );
+    EXPECT_LE( countOccurrences(trace, "\"ph\":\"M\""), 5 );
+
+    Profiler::clear();
+    EXPECT_EQ( 0, (int)Profiler::getEventsCount() );
+}
@@ -0,0 +1,151 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+#include "Engine/ProjectBinaryFormat.h"
+
+using namespace Natron;
+
+TEST(ProjectBinaryFormat,RecordsAreReadBackInOrder) {
+    std::string data;
+    std::string bigPayload(3 << 20, 'x');
+    bigPayload[12345] = '\0';
+    {
+        ProjectBinaryWriter writer;
+        writer.writeRecord( eProjectRecordTypeProject, std::string("project") );
+        writer.writeRecord( eProjectRecordTypeNode, std::string() );
+        writer.writeRecord(eProjectRecordTypeNode, bigPayload);
+        writer.writeRecord( eProjectRecordTypeGui, std::string("<gui/>") );
+        writer.finish();
+        writer.takeData(&data);
+    }
+    EXPECT_EQ( 0, data.compare(0, NATRON_PROJECT_BINARY_MAGIC_SIZE, NATRON_PROJECT_BINARY_MAGIC) );
+
+    std::istringstream stream(data);
+    ProjectBinaryReader reader(stream);
+    EXPECT_EQ( (unsigned int)NATRON_PROJECT_BINARY_FORMAT_VERSION, reader.getFormatVersion() );
+
+    ProjectRecordTypeEnum type;
+    std::string payload;
+    ASSERT_TRUE( reader.readRecord(&type, &payload) );
+    EXPECT_EQ(eProjectRecordTypeProject, type);
+    EXPECT_EQ("project", payload);
+    ASSERT_TRUE( reader.readRecord(&type, &payload) );
+    EXPECT_EQ(eProjectRecordTypeNode, type);
+    EXPECT_TRUE( payload.empty() );
+    ASSERT_TRUE( reader.readRecord(&type, &payload) );
+    EXPECT_EQ(eProjectRecordTypeNode, type);
+    EXPECT_TRUE(payload == bigPayload);
+    ASSERT_TRUE( reader.readRecord(&type, &payload) );
+    EXPECT_EQ(eProjectRecordTypeGui, type);
+    EXPECT_EQ("<gui/>", payload);
+    EXPECT_FALSE( reader.readRecord(&type, &payload) );
+    ///Reading past the end record is harmless
+    EXPECT_FALSE( reader.readRecord(&type, &payload) );
+}
+
+TEST(ProjectBinaryFormat,InvalidFilesAreRejected) {
+    {
+        std::istringstream stream("<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\" ?>");
+        EXPECT_THROW(ProjectBinaryReader reader(stream), std::runtime_error);
+    }
+
+    std::string data;
+    {
+        ProjectBinaryWriter writer;
+        writer.writeRecord( eProjectRecordTypeNode, std::string(100, 'n') );
+        writer.finish();
+        writer.takeData(&data);
+    }
+
+    ///A file saved by a more recent version
+    {
+        std::string newer(data);
+        newer[NATRON_PROJECT_BINARY_MAGIC_SIZE] = (char)(NATRON_PROJECT_BINARY_FORMAT_VERSION + 1);
+        std::istringstream stream(newer);
+        EXPECT_THROW(ProjectBinaryReader reader(stream), std::runtime_error);
+    }
+
+    ///A file whose end record is missing
+    {
+        std::istringstream stream( data.substr(0, data.size() - 40) );
+        ProjectBinaryReader reader(stream);
+        ProjectRecordTypeEnum type;
+        std::string payload;
+        EXPECT_THROW(reader.readRecord(&type, &payload), std::runtime_error);
+    }
+}
+
+TEST(ProjectBinaryFormat,JournalIsReplayedUpToItsLastCommit) {
+    ProjectJournalState initial;
+    initial.project = "project";
+    initial.nodes.push_back( std::make_pair( std::string("Blur1"), std::string("blur") ) );
+    initial.nodes.push_back( std::make_pair( std::string("Read1"), std::string("read") ) );
+    initial.nodes.push_back( std::make_pair( std::string("Write1"), std::string("write") ) );
+    initial.gui = "<gui/>";
+
+    std::string data;
+    writeProjectJournal(initial, &data);
+    {
+        ///An auto-save: Blur1 changed, Read1 was removed and Grade1 was added
+        ProjectBinaryWriter writer(eProjectBinaryFileTypeJournal, false);
+        writer.writeJournalNodeRecord("Blur1", "blur2");
+        writer.writeJournalNodeRemovedRecord("Read1");
+        writer.writeJournalNodeRecord("Grade1", "grade");
+        EXPECT_EQ( 3, writer.getRecordsCount() );
+        writer.finish();
+        std::string increment;
+        writer.takeData(&increment);
+        data.append(increment);
+    }
+    {
+        ///An auto-save interrupted before its commit
+        ProjectBinaryWriter writer(eProjectBinaryFileTypeJournal, false);
+        writer.writeRecord( eProjectRecordTypeProject, std::string("project2") );
+        writer.writeJournalNodeRemovedRecord("Write1");
+        writer.finish();
+        std::string increment;
+        writer.takeData(&increment);
+        data.append( increment.substr(0, increment.size() - 5) );
+    }
+
+    std::istringstream stream(data);
+    ProjectBinaryReader reader(stream);
+    EXPECT_EQ( eProjectBinaryFileTypeJournal, reader.getFileType() );
+    ProjectJournalState state;
+    ASSERT_TRUE( readProjectJournal(reader, &state) );
+    EXPECT_EQ("project", state.project);
+    EXPECT_EQ("<gui/>", state.gui);
+    ASSERT_EQ( 3, (int)state.nodes.size() );
+    std::list< std::pair<std::string, std::string> >::const_iterator it = state.nodes.begin();
+    EXPECT_EQ("Blur1", it->first);
+    EXPECT_EQ("blur2", it->second);
+    ++it;
+    EXPECT_EQ("Write1", it->first);
+    EXPECT_EQ("write", it->second);
+    ++it;
+    EXPECT_EQ("Grade1", it->first);
+    EXPECT_EQ("grade", it->second);
+
+    ///Compacting the journal keeps the same state
+    std::string compacted;
+    writeProjectJournal(state, &compacted);
+    EXPECT_LT( compacted.size(), data.size() );
+    std::istringstream compactedStream(compacted);
+    ProjectBinaryReader compactedReader(compactedStream);
+    ProjectJournalState compactedState;
+    ASSERT_TRUE( readProjectJournal(compactedReader, &compactedState) );
+    EXPECT_EQ(state.project, compactedState.project);
+    EXPECT_EQ(state.gui, compactedState.gui);
+    EXPECT_TRUE(state.nodes == compactedState.nodes);
+}
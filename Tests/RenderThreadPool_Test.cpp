@@ -0,0 +1,124 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <vector>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+
+#ifndef Q_MOC_RUN
+#include <boost/bind.hpp>
+#endif
+
+#include "Engine/RenderThreadPool.h"
+
+using namespace Natron;
+
+namespace {
+
+void
+countIndex(std::vector<QAtomicInt>* counts,
+           int i)
+{
+    (*counts)[i].fetchAndAddRelaxed(1);
+}
+
+void
+nestedLoop(RenderThreadPool* pool,
+           std::vector<QAtomicInt>* counts,
+           int innerCount,
+           int i)
+{
+    ///The inner loops are started from worker threads of the same pool
+    EXPECT_TRUE( pool->parallelFor( innerCount, boost::bind(countIndex, counts, _1) ) );
+    (*counts)[innerCount + i].fetchAndAddRelaxed(1);
+}
+
+int
+square(int v)
+{
+    return v * v;
+}
+
+void
+throwOnOddIndex(int i)
+{
+    if (i % 2) {
+        throw std::runtime_error("odd");
+    }
+}
+
+} // anon namespace
+
+TEST(RenderThreadPool,ParallelForRunsEachIndexOnce) {
+    RenderThreadPool pool(4);
+    std::vector<QAtomicInt> counts(1000);
+
+    for (int iteration = 0; iteration < 20; ++iteration) {
+        EXPECT_TRUE( pool.parallelFor( (int)counts.size(), boost::bind(countIndex, &counts, _1) ) );
+    }
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        EXPECT_EQ(20, (int)counts[i]);
+    }
+}
+
+TEST(RenderThreadPool,NestedParallelForDoesNotDeadlock) {
+    ///Fewer threads than outer tasks, so that all the workers wait for inner loops at the same time
+    RenderThreadPool pool(2);
+    const int outerCount = 16;
+    const int innerCount = 64;
+    std::vector<QAtomicInt> counts(innerCount + outerCount);
+
+    EXPECT_TRUE( pool.parallelFor( outerCount, boost::bind(nestedLoop, &pool, &counts, innerCount, _1) ) );
+    for (int i = 0; i < innerCount; ++i) {
+        EXPECT_EQ(outerCount, (int)counts[i]);
+    }
+    for (int i = 0; i < outerCount; ++i) {
+        EXPECT_EQ(1, (int)counts[innerCount + i]);
+    }
+}
+
+TEST(RenderThreadPool,Mapped) {
+    RenderThreadPool pool(3);
+    std::vector<int> inputs;
+
+    for (int i = 0; i < 257; ++i) {
+        inputs.push_back(i);
+    }
+    std::vector<int> results;
+    EXPECT_TRUE( pool.mapped(inputs, square, &results) );
+    ASSERT_EQ( inputs.size(), results.size() );
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        EXPECT_EQ(inputs[i] * inputs[i], results[i]);
+    }
+}
+
+TEST(RenderThreadPool,ExceptionsAreReported) {
+    RenderThreadPool pool(4);
+
+    EXPECT_FALSE( pool.parallelFor(100, throwOnOddIndex) );
+    ///the pool is still usable afterwards
+    std::vector<QAtomicInt> counts(100);
+    EXPECT_TRUE( pool.parallelFor( (int)counts.size(), boost::bind(countIndex, &counts, _1) ) );
+    EXPECT_EQ(1, (int)counts[99]);
+}
+
+TEST(RenderThreadPool,SingleThread) {
+    RenderThreadPool pool(4);
+
+    pool.setMaxThreadCount(1);
+    EXPECT_EQ( 1, pool.getMaxThreadCount() );
+    std::vector<QAtomicInt> counts(100);
+    EXPECT_TRUE( pool.parallelFor( (int)counts.size(), boost::bind(countIndex, &counts, _1) ) );
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        EXPECT_EQ(1, (int)counts[i]);
+    }
+}
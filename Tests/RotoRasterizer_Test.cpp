@@ -0,0 +1,495 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <gtest/gtest.h>
+#include <cairo/cairo.h>
+
+#include "Engine/RotoRasterizer.h"
+#include "Engine/RenderThreadPool.h"
+
+using namespace Natron;
+
+namespace {
+
+Natron::Point
+makePoint(double x,
+          double y)
+{
+    Natron::Point p;
+
+    p.x = x;
+    p.y = y;
+
+    return p;
+}
+
+std::vector<Natron::Point>
+rectanglePolygon(double x1,
+                 double y1,
+                 double x2,
+                 double y2)
+{
+    std::vector<Natron::Point> polygon;
+
+    polygon.push_back( makePoint(x1, y1) );
+    polygon.push_back( makePoint(x2, y1) );
+    polygon.push_back( makePoint(x2, y2) );
+    polygon.push_back( makePoint(x1, y2) );
+
+    return polygon;
+}
+
+std::vector<Natron::Point>
+circlePolygon(double cx,
+              double cy,
+              double r,
+              int n)
+{
+    std::vector<Natron::Point> polygon;
+
+    for (int i = 0; i < n; ++i) {
+        double a = 2. * M_PI * i / n;
+        polygon.push_back( makePoint( cx + r * std::cos(a), cy + r * std::sin(a) ) );
+    }
+
+    return polygon;
+}
+
+double
+polygonArea(const std::vector<Natron::Point> & polygon)
+{
+    double area = 0.;
+
+    for (std::size_t i = 0; i < polygon.size(); ++i) {
+        const Natron::Point & p0 = polygon[i];
+        const Natron::Point & p1 = polygon[(i + 1) % polygon.size()];
+        area += p0.x * p1.y - p1.x * p0.y;
+    }
+
+    return std::fabs(area) / 2.;
+}
+
+///The feather patches of a counter-clockwise polygon, whose outer contour is moved by dist along the normals, like the roto shapes
+std::vector<RotoFeatherPatch>
+featherPatches(const std::vector<Natron::Point> & polygon,
+               double dist)
+{
+    const int n = (int)polygon.size();
+    std::vector<Natron::Point> contour(n);
+
+    for (int i = 0; i < n; ++i) {
+        const Natron::Point & prev = polygon[(i + n - 1) % n];
+        const Natron::Point & next = polygon[(i + 1) % n];
+        double norm = std::sqrt( (next.x - prev.x) * (next.x - prev.x) + (next.y - prev.y) * (next.y - prev.y) );
+        contour[i] = makePoint( polygon[i].x + (next.y - prev.y) / norm * dist, polygon[i].y - (next.x - prev.x) / norm * dist );
+    }
+    std::vector<RotoFeatherPatch> patches(n);
+    for (int i = 0; i < n; ++i) {
+        patches[i].p[0] = polygon[(i + n - 1) % n];
+        patches[i].p[1] = contour[(i + n - 1) % n];
+        patches[i].p[2] = contour[i];
+        patches[i].p[3] = polygon[i];
+    }
+
+    return patches;
+}
+
+RotoRasterizerShape
+makeShape(const std::vector<Natron::Point> & polygon,
+          const std::vector<RotoFeatherPatch> & patches,
+          double r,
+          double g,
+          double b,
+          double opacity,
+          RotoCompositingOperatorEnum op)
+{
+    boost::shared_ptr<RotoShapeTessellation> tess(new RotoShapeTessellation);
+
+    tess->polygon = polygon;
+    tess->featherPatches = patches;
+    tess->computeBoundingBox();
+
+    RotoRasterizerShape shape;
+    shape.tessellation = tess;
+    shape.color[0] = r;
+    shape.color[1] = g;
+    shape.color[2] = b;
+    shape.opacity = opacity;
+    shape.fallOff = 1.;
+    shape.compositingOperator = op;
+
+    return shape;
+}
+
+///Renders the shapes in the window (0,0)-(width,height) and returns the components as floats
+template <typename PIX, int maxValue>
+std::vector<float>
+renderNative(const std::vector<RotoRasterizerShape> & shapes,
+             int width,
+             int height,
+             int nComps,
+             Natron::ImageBitDepthEnum depth,
+             RenderThreadPool* pool)
+{
+    ///garbage which must be cleared by the rasterizer
+    std::vector<PIX> pixels(width * height * nComps, (PIX)(0.75 * maxValue));
+    bool ok = RotoRasterizer::renderShapes(shapes, RectI(0, 0, width, height), depth, nComps, &pixels[0], width * nComps, pool);
+
+    EXPECT_TRUE(ok);
+    std::vector<float> values( pixels.size() );
+    for (std::size_t i = 0; i < pixels.size(); ++i) {
+        values[i] = (float)pixels[i] / maxValue;
+    }
+
+    return values;
+}
+
+std::vector<float>
+renderNative(const std::vector<RotoRasterizerShape> & shapes,
+             int width,
+             int height,
+             int nComps,
+             RenderThreadPool* pool = NULL)
+{
+    return renderNative<float, 1>(shapes, width, height, nComps, Natron::eImageBitDepthFloat, pool);
+}
+
+double
+overlap(double a1,
+        double a2,
+        double b1,
+        double b2)
+{
+    return std::max( 0., std::min(a2, b2) - std::max(a1, b1) );
+}
+} // anon namespace
+
+TEST(RotoRasterizer,PolygonCoverage) {
+    const int width = 40, height = 30;
+    std::vector<RotoRasterizerShape> shapes;
+
+    shapes.push_back( makeShape( rectanglePolygon(10.25, 5.5, 30.75, 20.5), std::vector<RotoFeatherPatch>(), 1., 1., 1., 1., eRotoCompositingOperatorOver ) );
+    std::vector<float> alpha = renderNative(shapes, width, height, 1);
+
+    ///the coverage of each pixel is the area of the rectangle within it
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double expected = overlap(x, x + 1, 10.25, 30.75) * overlap(y, y + 1, 5.5, 20.5);
+            EXPECT_NEAR(expected, alpha[y * width + x], 1e-5) << "x=" << x << " y=" << y;
+        }
+    }
+}
+
+TEST(RotoRasterizer,PolygonArea) {
+    const int width = 64, height = 60;
+    std::vector<Natron::Point> circle = circlePolygon(25.4, 23.1, 17.3, 200);
+    std::vector<RotoRasterizerShape> shapes;
+
+    shapes.push_back( makeShape( circle, std::vector<RotoFeatherPatch>(), 1., 1., 1., 1., eRotoCompositingOperatorOver ) );
+    std::vector<float> alpha = renderNative(shapes, width, height, 1);
+    double sum = 0.;
+    for (std::size_t i = 0; i < alpha.size(); ++i) {
+        EXPECT_GE(alpha[i], 0.f);
+        EXPECT_LE(alpha[i], 1.f);
+        sum += alpha[i];
+    }
+    EXPECT_NEAR(polygonArea(circle), sum, 1e-3);
+
+    ///with the non-zero winding rule, turning twice around the circle does not change the covered pixels,
+    ///but the coverages of the pixels on the edges are added
+    std::vector<Natron::Point> twice(circle);
+    twice.insert( twice.end(), circle.begin(), circle.end() );
+    shapes[0] = makeShape( twice, std::vector<RotoFeatherPatch>(), 1., 1., 1., 1., eRotoCompositingOperatorOver );
+    std::vector<float> alphaTwice = renderNative(shapes, width, height, 1);
+    for (std::size_t i = 0; i < alpha.size(); ++i) {
+        EXPECT_NEAR(std::min(1.f, 2.f * alpha[i]), alphaTwice[i], 1e-5);
+    }
+
+    ///partially outside of the window
+    std::vector<Natron::Point> clipped = circlePolygon(5.4, 55.7, 17.3, 200);
+    shapes[0] = makeShape( clipped, std::vector<RotoFeatherPatch>(), 1., 1., 1., 1., eRotoCompositingOperatorOver );
+    std::vector<float> alphaClipped = renderNative(shapes, width, height, 1);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double dx = x + 0.5 - 5.4, dy = y + 0.5 - 55.7;
+            double d = std::sqrt(dx * dx + dy * dy);
+            if (d < 16.) {
+                EXPECT_NEAR(1.f, alphaClipped[y * width + x], 1e-5);
+            } else if (d > 18.) {
+                EXPECT_NEAR(0.f, alphaClipped[y * width + x], 1e-5);
+            }
+        }
+    }
+}
+
+TEST(RotoRasterizer,Feather) {
+    const int width = 80, height = 80;
+    const double radius = 20., feather = 10., opacity = 0.7;
+    std::vector<Natron::Point> circle = circlePolygon(40., 40., radius, 300);
+    std::vector<RotoRasterizerShape> shapes;
+
+    shapes.push_back( makeShape( circle, featherPatches(circle, feather), 1., 1., 1., opacity, eRotoCompositingOperatorOver ) );
+    std::vector<float> alpha = renderNative(shapes, width, height, 1);
+
+    ///the alpha decreases from the opacity inside the shape to 0 outside of the feather, without seam along the shape
+    for (int y = 0; y < height; ++y) {
+        float prev = alpha[y * width + 40];
+        for (int x = 41; x < width; ++x) {
+            float a = alpha[y * width + x];
+            double dx = x + 0.5 - 40., dy = y + 0.5 - 40.;
+            double d = std::sqrt(dx * dx + dy * dy);
+            if (d < radius - 1.) {
+                EXPECT_NEAR(opacity, a, 1e-5) << "x=" << x << " y=" << y;
+            } else if (d > radius + feather + 1.) {
+                EXPECT_NEAR(0.f, a, 1e-5) << "x=" << x << " y=" << y;
+            }
+            if (y == 40) {
+                EXPECT_LE(a, prev + 1e-3) << "x=" << x;
+            }
+            prev = a;
+        }
+    }
+
+    ///with a fall-off of 1, the alpha is (1 - s)^2 at the fraction s of the feather
+    for (int x = 41; x < 70; ++x) {
+        double dx = x + 0.5 - 40.;
+        double s = (std::sqrt(dx * dx + 0.25) - radius) / feather;
+        if ( (s > 0.1) && (s < 0.9) ) {
+            EXPECT_NEAR( opacity * (1. - s) * (1. - s), alpha[40 * width + x], 0.02 ) << "x=" << x;
+        }
+    }
+}
+
+TEST(RotoRasterizer,BandsAndDepths) {
+    const int width = 97, height = 83;
+    std::vector<RotoRasterizerShape> shapes;
+    std::vector<Natron::Point> circle = circlePolygon(40.3, 38.9, 25.1, 150);
+
+    shapes.push_back( makeShape( circle, featherPatches(circle, 7.5), 0.9, 0.4, 0.2, 0.8, eRotoCompositingOperatorOver ) );
+    std::vector<Natron::Point> rect = rectanglePolygon(30.5, 20.25, 90.75, 60.5);
+    shapes.push_back( makeShape( rect, featherPatches(rect, -4.), 0.1, 0.5, 0.7, 0.6, eRotoCompositingOperatorXor ) );
+    shapes.push_back( makeShape( circlePolygon(60., 60., 15., 100), std::vector<RotoFeatherPatch>(), 0.5, 0.5, 0.5, 0.9, eRotoCompositingOperatorMultiply ) );
+
+    for (int nComps = 1; nComps <= 4; ++nComps) {
+        if (nComps == 2) {
+            continue;
+        }
+        std::vector<float> reference = renderNative(shapes, width, height, nComps);
+
+        ///the bands rendered by several threads give the same result
+        RenderThreadPool pool(4);
+        std::vector<float> parallel = renderNative(shapes, width, height, nComps, &pool);
+        for (std::size_t i = 0; i < reference.size(); ++i) {
+            EXPECT_NEAR(reference[i], parallel[i], 1e-5) << "nComps=" << nComps << " i=" << i;
+        }
+
+        ///the integer depths are quantized once per shape
+        std::vector<float> bytes = renderNative<unsigned char, 255>(shapes, width, height, nComps, Natron::eImageBitDepthByte, &pool);
+        std::vector<float> shorts = renderNative<unsigned short, 65535>(shapes, width, height, nComps, Natron::eImageBitDepthShort, &pool);
+        for (std::size_t i = 0; i < reference.size(); ++i) {
+            EXPECT_NEAR(reference[i], bytes[i], 2. / 255) << "nComps=" << nComps << " i=" << i;
+            EXPECT_NEAR(reference[i], shorts[i], 2. / 65535) << "nComps=" << nComps << " i=" << i;
+        }
+    }
+}
+
+TEST(RotoRasterizer,Operators) {
+    const int width = 40, height = 10;
+    const double a1 = 0.6, a2 = 0.5;
+    std::vector<RotoRasterizerShape> shapes;
+
+    ///the first shape covers x in [0, 20), the second x in [10, 30)
+    shapes.push_back( makeShape( rectanglePolygon(0, 0, 20, height), std::vector<RotoFeatherPatch>(), 1., 0., 0., a1, eRotoCompositingOperatorOver ) );
+    shapes.push_back( makeShape( rectanglePolygon(10, 0, 30, height), std::vector<RotoFeatherPatch>(), 0., 1., 0., a2, eRotoCompositingOperatorOver ) );
+
+    struct Expected
+    {
+        RotoCompositingOperatorEnum op;
+        ///the alpha of the columns 5 (first shape only), 15 (both), 25 (second only) and 35 (none)
+        double alpha[4];
+    };
+    const Expected expected[] = {
+        { eRotoCompositingOperatorClear, {a1, 0., 0., 0.} },
+        { eRotoCompositingOperatorSource, {a1, a2, a2, 0.} },
+        { eRotoCompositingOperatorOver, {a1, a2 + a1 * (1 - a2), a2, 0.} },
+        { eRotoCompositingOperatorIn, {0., a2 * a1, 0., 0.} },
+        { eRotoCompositingOperatorOut, {0., a2 * (1 - a1), a2, 0.} },
+        { eRotoCompositingOperatorAtop, {a1, a1, 0., 0.} },
+        { eRotoCompositingOperatorDest, {a1, a1, 0., 0.} },
+        { eRotoCompositingOperatorDestOver, {a1, a1 + a2 * (1 - a1), a2, 0.} },
+        { eRotoCompositingOperatorDestIn, {0., a1 * a2, 0., 0.} },
+        { eRotoCompositingOperatorDestOut, {a1, a1 * (1 - a2), 0., 0.} },
+        { eRotoCompositingOperatorDestAtop, {0., a2, a2, 0.} },
+        { eRotoCompositingOperatorXor, {a1, a2 * (1 - a1) + a1 * (1 - a2), a2, 0.} },
+        { eRotoCompositingOperatorAdd, {a1, std::min(1., a1 + a2), a2, 0.} },
+        { eRotoCompositingOperatorScreen, {a1, a1 + a2 - a1 * a2, a2, 0.} },
+    };
+
+    for (std::size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        shapes[1].compositingOperator = expected[i].op;
+        std::vector<float> rgba = renderNative(shapes, width, height, 4);
+        for (int c = 0; c < 4; ++c) {
+            EXPECT_NEAR(expected[i].alpha[c], rgba[(5 * width + 5 + 10 * c) * 4 + 3], 1e-5) << "operator=" << expected[i].op << " column=" << 5 + 10 * c;
+        }
+    }
+
+    ///multiply: the colors are multiplied where both shapes are opaque
+    shapes[0].opacity = shapes[1].opacity = 1.;
+    shapes[0].color[1] = 0.5;
+    shapes[1].color[0] = 0.8;
+    shapes[1].compositingOperator = eRotoCompositingOperatorMultiply;
+    std::vector<float> rgba = renderNative(shapes, width, height, 4);
+    const float* both = &rgba[(5 * width + 15) * 4];
+    EXPECT_NEAR(0.8, both[0], 1e-5);
+    EXPECT_NEAR(0.5, both[1], 1e-5);
+    EXPECT_NEAR(0., both[2], 1e-5);
+    EXPECT_NEAR(1., both[3], 1e-5);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reference renderings with cairo, which rendered the roto masks before the native rasterizer
+
+namespace {
+
+///Renders the shapes like RotoContextPrivate::renderInternal() did and returns the premultiplied RGBA components as floats
+std::vector<float>
+renderCairo(const std::vector<RotoRasterizerShape> & shapes,
+            int width,
+            int height,
+            cairo_format_t format)
+{
+    cairo_surface_t* surface = cairo_image_surface_create(format, width, height);
+    cairo_t* cr = cairo_create(surface);
+
+    cairo_set_fill_rule(cr, CAIRO_FILL_RULE_WINDING);
+    cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+    for (std::vector<RotoRasterizerShape>::const_iterator it = shapes.begin(); it != shapes.end(); ++it) {
+        const RotoShapeTessellation & tess = *it->tessellation;
+        const double fallOff = it->fallOff;
+        const double fallOffInverse = 1. / fallOff;
+        cairo_set_operator(cr, (cairo_operator_t)it->compositingOperator);
+
+        cairo_pattern_t* mesh = cairo_pattern_create_mesh();
+        for (std::size_t i = 0; i < tess.featherPatches.size(); ++i) {
+            const Natron::Point* p = tess.featherPatches[i].p;
+            Natron::Point p0p1, p1p0, p2p3, p3p2;
+            p0p1.x = (p[0].x * fallOff * 2. + fallOffInverse * p[1].x) / (fallOff * 2. + fallOffInverse);
+            p0p1.y = (p[0].y * fallOff * 2. + fallOffInverse * p[1].y) / (fallOff * 2. + fallOffInverse);
+            p1p0.x = (p[0].x * fallOff + 2. * fallOffInverse * p[1].x) / (fallOff + 2. * fallOffInverse);
+            p1p0.y = (p[0].y * fallOff + 2. * fallOffInverse * p[1].y) / (fallOff + 2. * fallOffInverse);
+            p2p3.x = (p[3].x * fallOff + 2. * fallOffInverse * p[2].x) / (fallOff + 2. * fallOffInverse);
+            p2p3.y = (p[3].y * fallOff + 2. * fallOffInverse * p[2].y) / (fallOff + 2. * fallOffInverse);
+            p3p2.x = (p[3].x * fallOff * 2. + fallOffInverse * p[2].x) / (fallOff * 2. + fallOffInverse);
+            p3p2.y = (p[3].y * fallOff * 2. + fallOffInverse * p[2].y) / (fallOff * 2. + fallOffInverse);
+            cairo_mesh_pattern_begin_patch(mesh);
+            cairo_mesh_pattern_move_to(mesh, p[0].x, p[0].y);
+            cairo_mesh_pattern_curve_to(mesh, p0p1.x, p0p1.y, p1p0.x, p1p0.y, p[1].x, p[1].y);
+            cairo_mesh_pattern_line_to(mesh, p[2].x, p[2].y);
+            cairo_mesh_pattern_curve_to(mesh, p2p3.x, p2p3.y, p3p2.x, p3p2.y, p[3].x, p[3].y);
+            cairo_mesh_pattern_line_to(mesh, p[0].x, p[0].y);
+            cairo_mesh_pattern_set_corner_color_rgba( mesh, 0, it->color[0], it->color[1], it->color[2], std::sqrt(it->opacity) );
+            cairo_mesh_pattern_set_corner_color_rgba(mesh, 1, it->color[0], it->color[1], it->color[2], 0.);
+            cairo_mesh_pattern_set_corner_color_rgba(mesh, 2, it->color[0], it->color[1], it->color[2], 0.);
+            cairo_mesh_pattern_set_corner_color_rgba( mesh, 3, it->color[0], it->color[1], it->color[2], std::sqrt(it->opacity) );
+            cairo_mesh_pattern_end_patch(mesh);
+        }
+
+        cairo_set_source_rgba(cr, it->color[0], it->color[1], it->color[2], it->opacity);
+        cairo_new_path(cr);
+        for (std::size_t i = 0; i < tess.polygon.size(); ++i) {
+            cairo_line_to(cr, tess.polygon[i].x, tess.polygon[i].y);
+        }
+        cairo_close_path(cr);
+        cairo_fill(cr);
+        if ( !tess.featherPatches.empty() ) {
+            cairo_set_source(cr, mesh);
+            cairo_mask(cr, mesh);
+        }
+        cairo_pattern_destroy(mesh);
+    }
+    cairo_surface_flush(surface);
+
+    std::vector<float> rgba(width * height * 4);
+    const unsigned char* data = cairo_image_surface_get_data(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float* dst = &rgba[(y * width + x) * 4];
+            if (format == CAIRO_FORMAT_A8) {
+                dst[0] = dst[1] = dst[2] = 0.f;
+                dst[3] = data[y * stride + x] / 255.f;
+            } else {
+                ///native-endian ARGB words
+                unsigned int argb = *(const unsigned int*)(data + y * stride + x * 4);
+                dst[0] = ( (argb >> 16) & 0xff ) / 255.f;
+                dst[1] = ( (argb >> 8) & 0xff ) / 255.f;
+                dst[2] = (argb & 0xff) / 255.f;
+                dst[3] = format == CAIRO_FORMAT_RGB24 ? 1.f : (argb >> 24) / 255.f;
+            }
+        }
+    }
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+
+    return rgba;
+}
+} // anon namespace
+
+TEST(RotoRasterizer,CairoReferenceOperators) {
+    const int width = 64, height = 48;
+    std::vector<RotoRasterizerShape> shapes;
+
+    ///shapes on pixel boundaries are not anti-aliased: the results only differ by the 8-bit rounding of cairo
+    shapes.push_back( makeShape( rectanglePolygon(8, 8, 40, 40), std::vector<RotoFeatherPatch>(), 0.8, 0.3, 0.1, 0.7, eRotoCompositingOperatorOver ) );
+    shapes.push_back( makeShape( rectanglePolygon(24, 16, 56, 44), std::vector<RotoFeatherPatch>(), 0.2, 0.6, 0.9, 0.6, eRotoCompositingOperatorOver ) );
+
+    for (int op = eRotoCompositingOperatorClear; op <= eRotoCompositingOperatorHslLuminosity; ++op) {
+        shapes[1].compositingOperator = (RotoCompositingOperatorEnum)op;
+        std::vector<float> reference = renderCairo(shapes, width, height, CAIRO_FORMAT_ARGB32);
+        std::vector<float> rgba = renderNative(shapes, width, height, 4);
+        for (std::size_t i = 0; i < rgba.size(); ++i) {
+            EXPECT_NEAR(reference[i], rgba[i], 4. / 255) << "operator=" << op << " pixel=" << i / 4 << " component=" << i % 4;
+        }
+
+        std::vector<float> referenceRGB = renderCairo(shapes, width, height, CAIRO_FORMAT_RGB24);
+        std::vector<float> rgb = renderNative(shapes, width, height, 3);
+        for (int i = 0; i < width * height; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                EXPECT_NEAR(referenceRGB[i * 4 + k], rgb[i * 3 + k], 4. / 255) << "operator=" << op << " pixel=" << i << " component=" << k;
+            }
+        }
+    }
+}
+
+TEST(RotoRasterizer,CairoReferenceFeather) {
+    const int width = 96, height = 96;
+    std::vector<RotoRasterizerShape> shapes;
+    std::vector<Natron::Point> circle = circlePolygon(47.3, 45.8, 25.2, 200);
+
+    for (int f = 0; f < 3; ++f) {
+        shapes.clear();
+        shapes.push_back( makeShape( circle, featherPatches(circle, 12.), 1., 1., 1., 0.75, eRotoCompositingOperatorOver ) );
+        shapes[0].fallOff = f == 0 ? 0.3 : (f == 1 ? 1. : 3.);
+        std::vector<float> reference = renderCairo(shapes, width, height, CAIRO_FORMAT_A8);
+        std::vector<float> alpha = renderNative(shapes, width, height, 1);
+
+        ///cairo does not anti-alias the mesh patches and rounds to 8 bits
+        double sumDiff = 0.;
+        for (int i = 0; i < width * height; ++i) {
+            double diff = std::fabs(reference[i * 4 + 3] - alpha[i]);
+            EXPECT_LT(diff, 0.1) << "fallOff=" << shapes[0].fallOff << " pixel=" << i;
+            sumDiff += diff;
+        }
+        EXPECT_LT(sumDiff / (width * height), 0.01) << "fallOff=" << shapes[0].fallOff;
+    }
+}
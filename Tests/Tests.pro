@@ -155,9 +155,22 @@ SOURCES += \
     BaseTest.cpp \
     Hash64_Test.cpp \
     Image_Test.cpp \
+    ImageKernels_Test.cpp \
+    ImageLocker_Test.cpp \
     Lut_Test.cpp \
+    Profiler_Test.cpp \
+    AsyncLogger_Test.cpp \
+    RenderThreadPool_Test.cpp \
+    DedicatedThreadPool_Test.cpp \
     File_Knob_Test.cpp \
-    Curve_Test.cpp
+    Curve_Test.cpp \
+    ProjectBinaryFormat_Test.cpp \
+    NativeExpression_Test.cpp \
+    RotoRasterizer_Test.cpp \
+    ViewerBackgroundCache_Test.cpp \
+    CacheIndex_Test.cpp \
+    MemoryPool_Test.cpp \
+    Cache_Test.cpp
 
 HEADERS += \
     BaseTest.h
@@ -0,0 +1,83 @@
+//  Natron
+//
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+
+#include <list>
+#include <set>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "Engine/OutputSchedulerThread.h"
+
+namespace {
+
+std::vector<int>
+framesToPreRender(int time,
+                  int first,
+                  int last,
+                  OutputSchedulerThread::RenderDirectionEnum direction)
+{
+    std::list<int> frames;
+
+    ViewerBackgroundCacheScheduler::getFramesToPreRender(time, first, last, direction, &frames);
+
+    return std::vector<int>( frames.begin(), frames.end() );
+}
+
+} // anon namespace
+
+TEST(ViewerBackgroundCache,FramesAheadComeFirst) {
+    std::vector<int> frames = framesToPreRender(10, 1, 100, OutputSchedulerThread::eRenderDirectionForward);
+    ASSERT_LE( 6, (int)frames.size() );
+    ///Two frames ahead for each frame behind
+    EXPECT_EQ(11, frames[0]);
+    EXPECT_EQ(12, frames[1]);
+    EXPECT_EQ(9, frames[2]);
+    EXPECT_EQ(13, frames[3]);
+    EXPECT_EQ(14, frames[4]);
+    EXPECT_EQ(8, frames[5]);
+
+    frames = framesToPreRender(10, 1, 100, OutputSchedulerThread::eRenderDirectionBackward);
+    ASSERT_LE( 3, (int)frames.size() );
+    EXPECT_EQ(9, frames[0]);
+    EXPECT_EQ(8, frames[1]);
+    EXPECT_EQ(11, frames[2]);
+}
+
+TEST(ViewerBackgroundCache,FramesStayWithinBounds) {
+    const int first = 1;
+    const int last = 20;
+
+    for (int time = first; time <= last; ++time) {
+        for (int d = 0; d < 2; ++d) {
+            OutputSchedulerThread::RenderDirectionEnum direction = d == 0 ?
+                                                                   OutputSchedulerThread::eRenderDirectionForward :
+                                                                   OutputSchedulerThread::eRenderDirectionBackward;
+            std::vector<int> frames = framesToPreRender(time, first, last, direction);
+            ///Every frame of the range but the current one, exactly once
+            std::set<int> unique( frames.begin(), frames.end() );
+            EXPECT_EQ( last - first, (int)frames.size() );
+            EXPECT_EQ( frames.size(), unique.size() );
+            EXPECT_EQ( 0, (int)unique.count(time) );
+            EXPECT_LE( first, *unique.begin() );
+            EXPECT_GE( last, *unique.rbegin() );
+        }
+    }
+
+    ///Once one side of the range is exhausted, the other side is pre-rendered in order
+    std::vector<int> frames = framesToPreRender(19, first, last, OutputSchedulerThread::eRenderDirectionForward);
+    ASSERT_EQ( 19, (int)frames.size() );
+    EXPECT_EQ(20, frames[0]);
+    EXPECT_EQ(18, frames[1]);
+    EXPECT_EQ(17, frames[2]);
+    EXPECT_EQ(1, frames.back());
+
+    ///A single frame range has nothing to pre-render
+    EXPECT_TRUE( framesToPreRender(5, 5, 5, OutputSchedulerThread::eRenderDirectionForward).empty() );
+}